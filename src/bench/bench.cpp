@@ -0,0 +1,410 @@
+//
+//  Microbenchmarks of the SMX image lookups the debugger makes on every stop
+//  and every evaluated expression. Each image named on the command line is
+//  loaded through SmxV1Image; every result is printed as one JSON object per
+//  line, so runs can be compared by a script. The last result for an image,
+//  index_memory, gives the heap bytes of the tables its lookups built.
+//
+//  DebugHook_* and read_variables time the extension's own per-BREAK check
+//  and its Variables path, over a copy of the image's data and a zeroed
+//  stack rather than a live plugin, which needs SourceMod.
+//
+//  With --sweep, synthetic images of growing size are written to the given
+//  directory and benchmarked instead, up to --sweep-max functions. Their
+//  results carry the corpus shape, so cost can be read against size.
+//
+//  usage: sm_debugger_bench [--min-ms N] plugin.smx...
+//         sm_debugger_bench [--min-ms N] --sweep dir [--sweep-max 50000]
+//
+#include "breakpoints.h"
+#include "condition.h"
+#include "corpus.h"
+#include "sendbuffer.h"
+#include "smx-v1-image.h"
+#include "snapshot.h"
+#include "utlbuffer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using clock_type = std::chrono::steady_clock;
+
+static uint64_t min_nanoseconds = 200 * 1000 * 1000;
+
+// Keeps results observable so the timed calls aren't optimized away.
+static volatile uint64_t sink;
+
+// The shape of the synthetic image being measured, if any.
+static nlohmann::json current_shape;
+
+// Runs |body| in rounds until at least min_nanoseconds have passed. Each
+// round performs |ops| operations.
+template <typename Body>
+static void run(const std::string& image, const char* bench, size_t ops, Body&& body) {
+	if (!ops)
+		return;
+
+	uint64_t rounds = 0;
+	uint64_t elapsed = 0;
+	auto start = clock_type::now();
+	while (elapsed < min_nanoseconds) {
+		body();
+		rounds++;
+		elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count();
+	}
+
+	nlohmann::json result = {
+		{ "image", image },
+		{ "bench", bench },
+		{ "ops", rounds * ops },
+		{ "ns_per_op", double(elapsed) / double(rounds * ops) },
+	};
+	if (!current_shape.is_null())
+		result["shape"] = current_shape;
+	printf("%s\n", result.dump().c_str());
+	fflush(stdout);
+}
+
+static std::unique_ptr<sp::SmxV1Image> load(const std::string& path, bool debug_info_only) {
+	auto image = std::make_unique<sp::SmxV1Image>(path.c_str());
+	if (!image->validate(debug_info_only))
+		return nullptr;
+	return image;
+}
+
+// Plugin memory for the hook benchmarks: the image's data, then a zeroed
+// stack that every frame reads at the same address.
+class BenchMemory : public SnapshotPlan::Memory {
+public:
+	static constexpr size_t kStackBytes = 64 * 1024;
+
+	explicit BenchMemory(sp::SmxV1Image* image) {
+		auto data = image->DescribeData();
+		cells_.resize((data.length + kStackBytes) / sizeof(cell_t), 0);
+		memcpy(cells_.data(), data.bytes, data.length);
+	}
+
+	cell_t frm() const {
+		return static_cast<cell_t>(size() - kStackBytes / 2);
+	}
+
+	const cell_t* cells(cell_t addr, uint32_t count) const override {
+		if (addr < 0 || size_t(addr) + size_t(count) * sizeof(cell_t) > size())
+			return nullptr;
+		return reinterpret_cast<const cell_t*>(bytes() + addr);
+	}
+	const char* string(cell_t addr, size_t max, size_t* length) const override {
+		if (addr < 0 || size_t(addr) >= size())
+			return nullptr;
+		const char* str = bytes() + addr;
+		*length = strnlen(str, std::min(max, size() - size_t(addr)));
+		return str;
+	}
+
+private:
+	size_t size() const {
+		return cells_.size() * sizeof(cell_t);
+	}
+	const char* bytes() const {
+		return reinterpret_cast<const char*>(cells_.data());
+	}
+
+	std::vector<cell_t> cells_;
+};
+
+// A condition on the first local at |addr| that binds, as a client would
+// set one, or a constant if none does.
+static Predicate bench_condition(sp::SmxV1Image* image, uint32_t addr) {
+	std::vector<sp::SmxV1Image::Symbol> syms;
+	image->GetLocalVariables(addr, &syms);
+	Predicate predicate;
+	std::string error;
+	for (const auto& sym : syms) {
+		const char* name = image->GetDebugName(sym.name());
+		Condition condition;
+		if (name && condition.parse(std::string(name) + " == 1", &error) &&
+			condition.bind(image, addr, &predicate, &error))
+			return predicate;
+	}
+	Condition condition;
+	if (condition.parse("false", &error))
+		condition.bind(image, addr, &predicate, &error);
+	return predicate;
+}
+
+// The extension's work per BREAK and per Variables request, on |image|'s
+// breakable |addresses|.
+static void bench_hook(const std::string& path, sp::SmxV1Image* image,
+	const std::vector<uint32_t>& addresses) {
+	BenchMemory memory(image);
+	const cell_t frm = memory.frm();
+
+	// DebugHook's fast path: the bitmap, and on a hit the site and its
+	// condition. Without breakpoints that is all a BREAK costs while the
+	// plugin runs; with one on every 16th line, each of those also finds
+	// its site and runs a condition that doesn't hold, so none stops.
+	BreakpointBitmap breakpoints;
+	breakpoints.reset(image->DescribeCode().length);
+	std::unordered_map<cell_t, Predicate> sites;
+	auto hook = [&] {
+		for (uint32_t addr : addresses) {
+			if (!breakpoints.test(addr))
+				continue;
+			auto found = sites.find(addr);
+			if (found != sites.end())
+				sink += found->second.empty() || found->second.evaluate(memory, frm);
+		}
+	};
+	run(path, "DebugHook_no_breakpoints", addresses.size(), hook);
+	for (size_t i = 0; i < addresses.size(); i += 16) {
+		breakpoints.set(addresses[i]);
+		sites.emplace(addresses[i], bench_condition(image, addresses[i]));
+	}
+	run(path, "DebugHook_breakpoints", addresses.size(), hook);
+
+	// The locals at each function's first line, read, formatted as
+	// Variables shows them and written as its entries are. One op is one
+	// variable.
+	std::vector<std::shared_ptr<const SnapshotPlan>> plans;
+	size_t variables = 0;
+	for (const auto& fn : image->Functions()) {
+		std::vector<uint32_t> first;
+		image->GetLineAddresses(fn.codestart, fn.codeend, &first);
+		if (first.empty())
+			continue;
+		plans.push_back(SnapshotPlan::bind(image, first[0], {}));
+		Snapshot snap;
+		plans.back()->copy(memory, frm, &snap);
+		variables += plans.back()->format(snap).size();
+	}
+	run(path, "read_variables", variables, [&] {
+		Snapshot snap;
+		for (const auto& plan : plans) {
+			plan->copy(memory, frm, &snap);
+			SendBuffer buffer(std::make_shared<std::string>());
+			auto values = plan->format(snap);
+			buffer.PutInt(values.size());
+			for (const auto& value : values) {
+				buffer.PutLenString(value.name);
+				buffer.PutLenString(value.value);
+				buffer.PutLenString(value.type);
+				buffer.PutInt(0);
+			}
+			sink += buffer.TellPut();
+		}
+	});
+}
+
+static bool bench_image(const std::string& path) {
+	auto image = load(path, false);
+	if (!image) {
+		fprintf(stderr, "%s: could not load image\n", path.c_str());
+		return false;
+	}
+
+	run(path, "validate", 1, [&] {
+		sink += !!load(path, false);
+	});
+	run(path, "validate_debug_info", 1, [&] {
+		sink += !!load(path, true);
+	});
+
+	// Breakable addresses, the lines and files they belong to, and the
+	// variables in scope at each function's first line.
+	std::vector<uint32_t> addresses;
+	for (const auto& fn : image->Functions())
+		image->GetLineAddresses(fn.codestart, fn.codeend, &addresses);
+
+	struct Line {
+		std::string file;
+		uint32_t line;
+	};
+	std::vector<Line> lines;
+	for (uint32_t addr : addresses) {
+		uint32_t line;
+		const char* file = image->LookupFile(addr);
+		if (file && image->LookupLine(addr, &line))
+			lines.push_back({ file, line });
+	}
+
+	struct Name {
+		std::string name;
+		uint32_t scope;
+	};
+	std::vector<Name> names;
+	std::vector<sp::SmxV1Image::Symbol> symbols;
+	image->GetGlobalVariables(&symbols);
+	for (const auto& fn : image->Functions()) {
+		std::vector<uint32_t> first;
+		image->GetLineAddresses(fn.codestart, fn.codeend, &first);
+		if (!first.empty())
+			image->GetLocalVariables(first[0], &symbols);
+	}
+	for (const auto& sym : symbols) {
+		const char* name = image->GetDebugName(sym.name());
+		if (name)
+			names.push_back({ name, sym.codestart() });
+	}
+
+	run(path, "LookupLine", addresses.size(), [&] {
+		for (uint32_t addr : addresses) {
+			uint32_t line;
+			sink += image->LookupLine(addr, &line);
+		}
+	});
+	run(path, "LookupLocation", addresses.size(), [&] {
+		for (uint32_t addr : addresses) {
+			uint32_t file, line;
+			sink += image->LookupLocation(addr, &file, &line);
+		}
+	});
+	run(path, "LookupFunction", addresses.size(), [&] {
+		for (uint32_t addr : addresses)
+			sink += !!image->LookupFunction(addr);
+	});
+	run(path, "GetLineAddress", lines.size(), [&] {
+		for (const auto& line : lines) {
+			uint32_t addr;
+			sink += image->GetLineAddress(line.line, line.file.c_str(), &addr);
+		}
+	});
+	run(path, "GetVariable", names.size(), [&] {
+		std::unique_ptr<sp::SmxV1Image::Symbol> sym;
+		for (const auto& name : names)
+			sink += image->GetVariable(name.name.c_str(), name.scope, sym);
+	});
+	run(path, "GetArrayDimensions", symbols.size(), [&] {
+		for (const auto& sym : symbols)
+			sink += image->GetArrayDimensions(&sym).size();
+	});
+
+	// Images from newer compilers describe their variables with RTTI.
+	auto& rtti = image->rtti_data();
+	if (rtti) {
+		std::vector<uint32_t> type_ids;
+		for (const auto& sym : symbols) {
+			if (sym.rtti() && sym.rtti()->type_id)
+				type_ids.push_back(sym.rtti()->type_id);
+		}
+		run(path, "typeFromTypeId", type_ids.size(), [&] {
+			for (uint32_t type_id : type_ids)
+				sink += !!rtti->typeFromTypeId(type_id);
+		});
+	}
+
+	// What the debugger writes to the client about an image as a whole: the
+	// file table, as in Images, and each function's name and range, as in
+	// the headers of Disassembly. One op is one file or function.
+	uint32_t files = image->GetFileCount();
+	run(path, "serialize_listing", files + image->Functions().size(), [&] {
+		CUtlBuffer buffer;
+		buffer.PutUnsignedInt(files);
+		for (uint32_t i = 0; i < files; i++) {
+			const char* name = image->GetFileName(i);
+			if (!name)
+				name = "";
+			buffer.PutInt(strlen(name) + 1);
+			buffer.PutString(name);
+		}
+		buffer.PutInt(image->Functions().size());
+		for (const auto& fn : image->Functions()) {
+			const char* name = fn.name ? fn.name : "";
+			buffer.PutInt(strlen(name) + 1);
+			buffer.PutString(name);
+			buffer.PutUnsignedInt(fn.codestart);
+			buffer.PutUnsignedInt(fn.codeend);
+		}
+		sink += buffer.TellPut();
+	});
+
+	bench_hook(path, image.get(), addresses);
+
+	// What the tables built by the lookups above cost to keep resident.
+	auto memory = image->GetIndexMemory();
+	nlohmann::json result = {
+		{ "image", path },
+		{ "bench", "index_memory" },
+		{ "symbols", memory.symbols },
+		{ "functions", memory.functions },
+		{ "lines", memory.lines },
+		{ "types", memory.types },
+		{ "bytes", memory.total() },
+	};
+	if (!current_shape.is_null())
+		result["shape"] = current_shape;
+	printf("%s\n", result.dump().c_str());
+	fflush(stdout);
+	return true;
+}
+
+// Generates and benchmarks images from 1000 functions up to |max_functions|,
+// growing every part of the debug info in proportion.
+static bool sweep(const std::string& dir, uint32_t max_functions) {
+	const uint32_t steps[] = { 1000, 2500, 5000, 10000, 25000, 50000 };
+	std::vector<uint32_t> sizes;
+	for (uint32_t functions : steps) {
+		if (functions <= max_functions)
+			sizes.push_back(functions);
+	}
+	if (sizes.empty() || sizes.back() != max_functions)
+		sizes.push_back(max_functions);
+
+	bool ok = true;
+	for (uint32_t functions : sizes) {
+		CorpusShape shape = ScaledCorpusShape(functions);
+		std::string path = dir + "/corpus-" + std::to_string(functions) + ".smx";
+		std::string error;
+		if (!WriteCorpusImage(shape, path, &error)) {
+			fprintf(stderr, "%s\n", error.c_str());
+			return false;
+		}
+
+		current_shape = {
+			{ "functions", shape.functions },
+			{ "locals", shape.locals },
+			{ "globals", shape.globals },
+			{ "enum_structs", shape.enum_structs },
+			{ "types", shape.types },
+			{ "files", shape.files },
+			{ "lines", shape.lines },
+		};
+		ok &= bench_image(path);
+	}
+	current_shape = nullptr;
+	return ok;
+}
+
+int main(int argc, char** argv) {
+	std::vector<std::string> paths;
+	std::string sweep_dir;
+	uint32_t sweep_max = 50000;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--min-ms") == 0 && i + 1 < argc)
+			min_nanoseconds = strtoull(argv[++i], nullptr, 10) * 1000 * 1000;
+		else if (strcmp(argv[i], "--sweep") == 0 && i + 1 < argc)
+			sweep_dir = argv[++i];
+		else if (strcmp(argv[i], "--sweep-max") == 0 && i + 1 < argc)
+			sweep_max = uint32_t(strtoul(argv[++i], nullptr, 10));
+		else
+			paths.push_back(argv[i]);
+	}
+	if (paths.empty() == sweep_dir.empty() || !sweep_max) {
+		fprintf(stderr, "usage: %s [--min-ms N] plugin.smx...\n"
+			"       %s [--min-ms N] --sweep dir [--sweep-max N]\n", argv[0], argv[0]);
+		return 1;
+	}
+	if (!sweep_dir.empty())
+		return sweep(sweep_dir, sweep_max) ? 0 : 1;
+
+	bool ok = true;
+	for (const auto& path : paths)
+		ok &= bench_image(path);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+//
+//  Writes a synthetic plugin of a given size, for testing how the debugger
+//  scales with the size of a plugin's debug info: as an SMX image, or with
+//  --sources as .sp files to build with spcomp. Sizes are totals except
+//  --locals, which is per function; --scale N sets every size in proportion
+//  to N functions, as the benchmark sweep does, before the other options.
+//
+//  usage: sm_debugger_corpus_gen [--scale N] [--functions N] [--locals N]
+//         [--globals N] [--enum-structs N] [--types N] [--files N]
+//         [--lines N] (-o plugin.smx | --sources dir)
+//
+#include "corpus.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+static bool parse_count(const char* text, uint32_t* out) {
+	char* end;
+	unsigned long value = strtoul(text, &end, 10);
+	if (end == text || *end || value > UINT32_MAX)
+		return false;
+	*out = uint32_t(value);
+	return true;
+}
+
+int main(int argc, char** argv) {
+	CorpusShape shape;
+	std::string output, sources;
+
+	struct {
+		const char* name;
+		uint32_t* value;
+	} counts[] = {
+		{ "--functions", &shape.functions },
+		{ "--locals", &shape.locals },
+		{ "--globals", &shape.globals },
+		{ "--enum-structs", &shape.enum_structs },
+		{ "--types", &shape.types },
+		{ "--files", &shape.files },
+		{ "--lines", &shape.lines },
+	};
+
+	// --scale resets the shape, so it applies first wherever it is given.
+	for (int i = 1; i + 1 < argc; i++) {
+		if (strcmp(argv[i], "--scale") != 0)
+			continue;
+		uint32_t functions;
+		if (!parse_count(argv[i + 1], &functions)) {
+			fprintf(stderr, "invalid --scale: %s\n", argv[i + 1]);
+			return 1;
+		}
+		shape = ScaledCorpusShape(functions);
+	}
+
+	bool usage = false;
+	for (int i = 1; i < argc && !usage; i++) {
+		if (i + 1 >= argc) {
+			usage = true;
+			break;
+		}
+		const char* arg = argv[i];
+		const char* value = argv[++i];
+		if (strcmp(arg, "--scale") == 0)
+			continue;
+		if (strcmp(arg, "-o") == 0) {
+			output = value;
+			continue;
+		}
+		if (strcmp(arg, "--sources") == 0) {
+			sources = value;
+			continue;
+		}
+
+		usage = true;
+		for (const auto& count : counts) {
+			if (strcmp(arg, count.name) != 0)
+				continue;
+			if (!parse_count(value, count.value)) {
+				fprintf(stderr, "invalid %s: %s\n", arg, value);
+				return 1;
+			}
+			usage = false;
+			break;
+		}
+	}
+	if (usage || output.empty() == sources.empty()) {
+		fprintf(stderr,
+			"usage: %s [--scale N] [--functions N] [--locals N] [--globals N]\n"
+			"       [--enum-structs N] [--types N] [--files N] [--lines N]\n"
+			"       (-o plugin.smx | --sources dir)\n",
+			argv[0]);
+		return 1;
+	}
+
+	std::string error;
+	bool ok = output.empty()
+		? WriteCorpusSources(shape, sources, &error)
+		: WriteCorpusImage(shape, output, &error);
+	if (!ok) {
+		fprintf(stderr, "%s\n", error.c_str());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,582 @@
+#include "corpus.h"
+#include <smx/smx-headers.h>
+#include <smx/smx-typeinfo.h>
+#include <smx/smx-v1.h>
+#include <smx/smx-v1-opcodes.h>
+#include <sp_vm_types.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+using namespace sp;
+
+CorpusShape ScaledCorpusShape(uint32_t functions) {
+	CorpusShape shape;
+	shape.functions = functions;
+	shape.locals = 4;
+	shape.globals = std::max<uint32_t>(functions / 10, 1);
+	shape.enum_structs = std::max<uint32_t>(functions / 100, 1);
+	shape.types = std::max<uint32_t>(functions / 100, 1);
+	shape.files = std::max<uint32_t>(functions / 500, 1);
+	shape.lines = functions * 20;
+	return shape;
+}
+
+namespace {
+
+// The fields every generated enum struct has: id, weight and name[16].
+constexpr uint32_t kEnumStructCells = 1 + 1 + 16 / 4;
+constexpr uint32_t kStringChars = 64;
+
+enum class VarKind {
+	Int,
+	Float,
+	String,
+	Enum,
+	EnumStruct,
+};
+
+// What a variable of each kind is declared as. Variable |n| of a function
+// or of the globals cycles through the kinds the shape has.
+struct VarType {
+	VarKind kind;
+	uint32_t index;	// of the enum or enum struct
+
+	uint32_t cells() const {
+		switch (kind) {
+		case VarKind::String:
+			return kStringChars / 4;
+		case VarKind::EnumStruct:
+			return kEnumStructCells;
+		default:
+			return 1;
+		}
+	}
+};
+
+VarType var_type(const CorpusShape& shape, uint32_t owner, uint32_t n) {
+	VarKind kinds[5] = { VarKind::Int, VarKind::Float, VarKind::String };
+	size_t count = 3;
+	if (shape.types)
+		kinds[count++] = VarKind::Enum;
+	if (shape.enum_structs)
+		kinds[count++] = VarKind::EnumStruct;
+
+	VarType type;
+	type.kind = kinds[n % count];
+	type.index = 0;
+	if (type.kind == VarKind::Enum)
+		type.index = (owner + n) % shape.types;
+	else if (type.kind == VarKind::EnumStruct)
+		type.index = (owner + n) % shape.enum_structs;
+	return type;
+}
+
+// Lines function |index| gets out of the shape's total.
+uint32_t function_lines(const CorpusShape& shape, uint32_t index) {
+	return shape.lines / shape.functions + (index < shape.lines % shape.functions ? 1 : 0);
+}
+
+// The file function |index| is in. Each file holds a run of functions.
+uint32_t function_file(const CorpusShape& shape, uint32_t index) {
+	return uint32_t(uint64_t(index) * shape.files / shape.functions);
+}
+
+std::string file_name(uint32_t file) {
+	if (file == 0)
+		return "corpus.sp";
+	return "corpus_" + std::to_string(file) + ".sp";
+}
+
+// Source line layout of a function, shared by both writers so that an
+// image and the sources it stands for agree on line numbers: the header,
+// the brace, one declaration per local, the statements, the return and
+// the closing brace, then a blank line.
+uint32_t function_first_statement(const CorpusShape& shape, uint32_t start) {
+	return start + 2 + shape.locals;
+}
+uint32_t function_source_lines(const CorpusShape& shape, uint32_t index) {
+	return 2 + shape.locals + function_lines(shape, index) + 3;
+}
+
+// Lines before the first function of each file: in the main file, the
+// declarations. The includes of the other files come after its functions.
+uint32_t file_preamble_lines(const CorpusShape& shape, uint32_t file) {
+	if (file != 0)
+		return 0;
+	uint32_t lines = shape.types * 2;
+	lines += shape.enum_structs * 6;
+	lines += shape.globals + 1;
+	return lines;
+}
+
+class ByteWriter {
+public:
+	template <typename T>
+	void put(const T& value) {
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+		bytes_.insert(bytes_.end(), bytes, bytes + sizeof(T));
+	}
+	void put(const void* data, size_t length) {
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+		bytes_.insert(bytes_.end(), bytes, bytes + length);
+	}
+	void cell(cell_t value) {
+		put(value);
+	}
+	size_t size() const {
+		return bytes_.size();
+	}
+	std::vector<uint8_t>& bytes() {
+		return bytes_;
+	}
+
+private:
+	std::vector<uint8_t> bytes_;
+};
+
+template <typename Row>
+ByteWriter rtti_table(const std::vector<Row>& rows) {
+	ByteWriter out;
+	smx_rtti_table_header header;
+	header.header_size = sizeof(header);
+	header.row_size = sizeof(Row);
+	header.row_count = uint32_t(rows.size());
+	out.put(header);
+	if (!rows.empty())
+		out.put(rows.data(), rows.size() * sizeof(Row));
+	return out;
+}
+
+template <typename Row>
+ByteWriter list_section(const std::vector<Row>& rows) {
+	ByteWriter out;
+	if (!rows.empty())
+		out.put(rows.data(), rows.size() * sizeof(Row));
+	return out;
+}
+
+// .names, with each string entered once.
+class NameTable {
+public:
+	uint32_t add(const std::string& name) {
+		auto found = offsets_.find(name);
+		if (found != offsets_.end())
+			return found->second;
+		uint32_t offset = uint32_t(buffer_.size());
+		buffer_.append(name);
+		buffer_.push_back('\0');
+		offsets_.emplace(name, offset);
+		return offset;
+	}
+	const std::string& buffer() const {
+		return buffer_;
+	}
+
+private:
+	std::string buffer_;
+	std::unordered_map<std::string, uint32_t> offsets_;
+};
+
+// Type encodings in rtti.data, pooled like spcomp's, and the type ids that
+// refer to them.
+class TypePool {
+public:
+	uint32_t add(const std::vector<uint8_t>& bytes) {
+		std::string key(bytes.begin(), bytes.end());
+		auto found = offsets_.find(key);
+		if (found != offsets_.end())
+			return found->second;
+		uint32_t offset = uint32_t(data_.size());
+		data_.insert(data_.end(), bytes.begin(), bytes.end());
+		offsets_.emplace(std::move(key), offset);
+		return offset;
+	}
+	uint32_t type_id(const std::vector<uint8_t>& bytes) {
+		if (bytes.size() <= 4) {
+			uint32_t payload = 0;
+			for (size_t i = 0; i < bytes.size(); i++)
+				payload |= uint32_t(bytes[i]) << (i * 8);
+			if (payload <= kMaxTypeIdPayload)
+				return MakeTypeId(payload, kTypeId_Inline);
+		}
+		return MakeTypeId(add(bytes), kTypeId_Complex);
+	}
+	const std::vector<uint8_t>& data() const {
+		return data_;
+	}
+
+private:
+	std::vector<uint8_t> data_;
+	std::map<std::string, uint32_t> offsets_;
+};
+
+void compact_encode(std::vector<uint8_t>& out, uint32_t value) {
+	do {
+		uint8_t byte = uint8_t(value & 0x7f);
+		if (value > 0x7f)
+			byte |= 0x80;
+		out.push_back(byte);
+		value >>= 7;
+	} while (value);
+}
+
+std::vector<uint8_t> encode_type(const VarType& type) {
+	std::vector<uint8_t> bytes;
+	switch (type.kind) {
+	case VarKind::Int:
+		bytes.push_back(cb::kInt32);
+		break;
+	case VarKind::Float:
+		bytes.push_back(cb::kFloat32);
+		break;
+	case VarKind::String:
+		bytes.push_back(cb::kFixedArray);
+		compact_encode(bytes, kStringChars);
+		bytes.push_back(cb::kChar8);
+		break;
+	case VarKind::Enum:
+		bytes.push_back(cb::kEnum);
+		compact_encode(bytes, type.index);
+		break;
+	case VarKind::EnumStruct:
+		bytes.push_back(cb::kEnumStruct);
+		compact_encode(bytes, type.index);
+		break;
+	}
+	return bytes;
+}
+
+bool write_file(const std::string& path, const void* data, size_t length, std::string* error) {
+	FILE* fp = fopen(path.c_str(), "wb");
+	if (!fp) {
+		*error = "could not open " + path;
+		return false;
+	}
+	bool ok = fwrite(data, 1, length, fp) == length;
+	ok &= fclose(fp) == 0;
+	if (!ok)
+		*error = "could not write " + path;
+	return ok;
+}
+
+} // namespace
+
+bool WriteCorpusImage(const CorpusShape& shape, const std::string& path, std::string* error) {
+	if (!shape.functions || !shape.files || shape.files > shape.functions) {
+		*error = "a corpus needs at least one function per file";
+		return false;
+	}
+
+	NameTable names;
+	TypePool types;
+
+	std::vector<smx_rtti_enum> enums;
+	for (uint32_t i = 0; i < shape.types; i++) {
+		smx_rtti_enum row = {};
+		row.name = names.add("Kind" + std::to_string(i));
+		enums.push_back(row);
+	}
+
+	std::vector<smx_rtti_enumstruct> enumstructs;
+	std::vector<smx_rtti_es_field> es_fields;
+	for (uint32_t i = 0; i < shape.enum_structs; i++) {
+		smx_rtti_enumstruct row;
+		row.name = names.add("Es" + std::to_string(i));
+		row.first_field = uint32_t(es_fields.size());
+		row.size = kEnumStructCells;
+		enumstructs.push_back(row);
+
+		es_fields.push_back({ names.add("id"), types.type_id(encode_type({ VarKind::Int, 0 })), 0 });
+		es_fields.push_back({ names.add("weight"), types.type_id(encode_type({ VarKind::Float, 0 })), 4 });
+		std::vector<uint8_t> name_type = { cb::kFixedArray };
+		compact_encode(name_type, 16);
+		name_type.push_back(cb::kChar8);
+		es_fields.push_back({ names.add("name"), types.type_id(name_type), 8 });
+	}
+
+	std::vector<smx_rtti_debug_var> globals;
+	uint32_t data_cells = 0;
+	for (uint32_t i = 0; i < shape.globals; i++) {
+		VarType type = var_type(shape, 0, i);
+		smx_rtti_debug_var var;
+		var.address = int32_t(data_cells * sizeof(cell_t));
+		var.vclass = kVarClass_Global;
+		var.name = names.add("g" + std::to_string(i));
+		var.code_start = 0;
+		var.code_end = 0;
+		var.type_id = types.type_id(encode_type(type));
+		globals.push_back(var);
+		data_cells += type.cells();
+	}
+
+	// Every function returns an int and takes nothing.
+	uint32_t signature = types.add({ 0, cb::kInt32 });
+
+	ByteWriter code;
+	std::vector<smx_rtti_method> methods;
+	std::vector<smx_rtti_debug_method> dbg_methods;
+	std::vector<smx_rtti_debug_var> locals;
+	std::vector<sp_file_publics_t> publics;
+	std::vector<sp_fdbg_file_t> files;
+	std::vector<sp_fdbg_line_t> lines;
+
+	uint32_t current_file = UINT32_MAX;
+	uint32_t source_line = 0;
+	for (uint32_t i = 0; i < shape.functions; i++) {
+		uint32_t file = function_file(shape, i);
+		if (file != current_file) {
+			current_file = file;
+			source_line = file_preamble_lines(shape, file);
+			files.push_back({ uint32_t(code.size()), names.add(file_name(file)) });
+		}
+
+		std::string name = "fn" + std::to_string(i);
+		uint32_t codestart = uint32_t(code.size());
+		code.cell(OP_PROC);
+
+		// Each line is a break and a constant; every eighth line also calls
+		// the function before, so call targets resolve too.
+		uint32_t statement = function_first_statement(shape, source_line);
+		uint32_t count = function_lines(shape, i);
+		for (uint32_t line = 0; line < count; line++) {
+			lines.push_back({ uint32_t(code.size()), statement + line });
+			code.cell(OP_BREAK);
+			code.cell(OP_CONST_PRI);
+			code.cell(cell_t(line));
+			if (i > 0 && line % 8 == 7) {
+				code.cell(OP_PUSH_C);
+				code.cell(0);
+				code.cell(OP_CALL);
+				code.cell(cell_t(methods.back().pcode_start));
+			}
+		}
+		code.cell(OP_ZERO_PRI);
+		code.cell(OP_RETN);
+		uint32_t codeend = uint32_t(code.size());
+
+		smx_rtti_method method;
+		method.name = names.add(name);
+		method.pcode_start = codestart;
+		method.pcode_end = codeend;
+		method.signature = signature;
+
+		if (shape.locals) {
+			dbg_methods.push_back({ uint32_t(methods.size()), uint32_t(locals.size()) });
+			int32_t frame = 0;
+			for (uint32_t n = 0; n < shape.locals; n++) {
+				VarType type = var_type(shape, i, n);
+				frame -= int32_t(type.cells() * sizeof(cell_t));
+				smx_rtti_debug_var var;
+				var.address = frame;
+				var.vclass = kVarClass_Local;
+				var.name = names.add("l" + std::to_string(n));
+				var.code_start = codestart;
+				var.code_end = codeend;
+				var.type_id = types.type_id(encode_type(type));
+				locals.push_back(var);
+			}
+		}
+
+		methods.push_back(method);
+		publics.push_back({ codestart, method.name });
+		source_line += function_source_lines(shape, i);
+	}
+
+	// The VM finds publics by binary search on the name.
+	const std::string& name_buffer = names.buffer();
+	std::sort(publics.begin(), publics.end(),
+		[&name_buffer](const sp_file_publics_t& a, const sp_file_publics_t& b) {
+			return strcmp(name_buffer.c_str() + a.name, name_buffer.c_str() + b.name) < 0;
+		});
+
+	ByteWriter code_section;
+	{
+		sp_file_code_t header = {};
+		header.codesize = uint32_t(code.size());
+		header.cellsize = sizeof(cell_t);
+		header.codeversion = SmxConsts::CODE_VERSION_FEATURE_MASK;
+		header.flags = CODEFLAG_DEBUG;
+		header.main = 0;
+		header.code = sizeof(header);
+		header.features = 0;
+		code_section.put(header);
+		code_section.put(code.bytes().data(), code.size());
+	}
+
+	ByteWriter data_section;
+	{
+		sp_file_data_t header;
+		header.datasize = data_cells * sizeof(cell_t);
+		header.memsize = header.datasize + 64 * 1024;
+		header.data = sizeof(header);
+		data_section.put(header);
+		std::vector<uint8_t> zeroes(header.datasize);
+		data_section.put(zeroes.data(), zeroes.size());
+	}
+
+	ByteWriter names_section;
+	names_section.put(name_buffer.data(), name_buffer.size());
+
+	ByteWriter rtti_data;
+	rtti_data.put(types.data().data(), types.data().size());
+
+	ByteWriter dbg_info;
+	{
+		sp_fdbg_info_t info = {};
+		info.num_files = uint32_t(files.size());
+		info.num_lines = uint32_t(lines.size());
+		dbg_info.put(info);
+	}
+
+	// In the order spcomp writes them. Empty optional tables are left out:
+	// a section must start inside the file.
+	std::vector<std::pair<const char*, ByteWriter>> sections;
+	sections.emplace_back(".code", std::move(code_section));
+	sections.emplace_back(".data", std::move(data_section));
+	sections.emplace_back(".publics", list_section(publics));
+	sections.emplace_back(".names", std::move(names_section));
+	if (rtti_data.size())
+		sections.emplace_back("rtti.data", std::move(rtti_data));
+	sections.emplace_back("rtti.methods", rtti_table(methods));
+	sections.emplace_back("rtti.natives", rtti_table(std::vector<smx_rtti_native>()));
+	if (!enums.empty())
+		sections.emplace_back("rtti.enums", rtti_table(enums));
+	if (!enumstructs.empty()) {
+		sections.emplace_back("rtti.enumstructs", rtti_table(enumstructs));
+		sections.emplace_back("rtti.enumstruct_fields", rtti_table(es_fields));
+	}
+	sections.emplace_back(".dbg.files", list_section(files));
+	sections.emplace_back(".dbg.lines", list_section(lines));
+	sections.emplace_back(".dbg.info", std::move(dbg_info));
+	if (!dbg_methods.empty())
+		sections.emplace_back(".dbg.methods", rtti_table(dbg_methods));
+	if (!globals.empty())
+		sections.emplace_back(".dbg.globals", rtti_table(globals));
+	if (!locals.empty())
+		sections.emplace_back(".dbg.locals", rtti_table(locals));
+
+	sections.erase(std::remove_if(sections.begin(), sections.end(),
+		[](const std::pair<const char*, ByteWriter>& section) { return !section.second.size(); }),
+		sections.end());
+
+	// The same layout as SmxBuilder: header, section table, section names,
+	// then the sections.
+	std::string section_names;
+	for (const auto& section : sections) {
+		section_names.append(section.first);
+		section_names.push_back('\0');
+	}
+
+	sp_file_hdr_t header;
+	header.magic = SmxConsts::FILE_MAGIC;
+	header.version = SmxConsts::SP1_VERSION_1_1;
+	header.compression = SmxConsts::FILE_COMPRESSION_NONE;
+	header.sections = uint8_t(sections.size());
+	header.stringtab = uint32_t(sizeof(header) + sizeof(sp_file_section_t) * sections.size());
+	header.dataoffs = header.stringtab + uint32_t(section_names.size());
+	uint64_t disksize = header.dataoffs;
+	for (const auto& section : sections)
+		disksize += section.second.size();
+	if (disksize > UINT32_MAX) {
+		*error = "the corpus is too large for an SMX image";
+		return false;
+	}
+	header.disksize = uint32_t(disksize);
+	header.imagesize = header.disksize;
+
+	ByteWriter image;
+	image.put(header);
+	uint32_t name_offset = 0;
+	uint32_t data_offset = header.dataoffs;
+	for (const auto& section : sections) {
+		sp_file_section_t entry;
+		entry.nameoffs = name_offset;
+		entry.dataoffs = data_offset;
+		entry.size = uint32_t(section.second.size());
+		image.put(entry);
+		name_offset += uint32_t(strlen(section.first) + 1);
+		data_offset += entry.size;
+	}
+	image.put(section_names.data(), section_names.size());
+	for (auto& section : sections)
+		image.put(section.second.bytes().data(), section.second.size());
+
+	return write_file(path, image.bytes().data(), image.size(), error);
+}
+
+bool WriteCorpusSources(const CorpusShape& shape, const std::string& dir, std::string* error) {
+	if (!shape.functions || !shape.files || shape.files > shape.functions) {
+		*error = "a corpus needs at least one function per file";
+		return false;
+	}
+
+	auto declare = [&shape](std::string& out, const VarType& type, const std::string& name) {
+		switch (type.kind) {
+		case VarKind::Int:
+			out += "int " + name;
+			break;
+		case VarKind::Float:
+			out += "float " + name;
+			break;
+		case VarKind::String:
+			out += "char " + name + "[" + std::to_string(kStringChars) + "]";
+			break;
+		case VarKind::Enum:
+			out += "Kind" + std::to_string(type.index) + " " + name;
+			break;
+		case VarKind::EnumStruct:
+			out += "Es" + std::to_string(type.index) + " " + name;
+			break;
+		}
+		out += ";\n";
+	};
+
+	std::vector<std::string> sources(shape.files);
+
+	// Declarations. file_preamble_lines() counts these lines.
+	std::string& main = sources[0];
+	for (uint32_t i = 0; i < shape.types; i++) {
+		std::string name = "Kind" + std::to_string(i);
+		main += "enum " + name + " { " + name + "_A, " + name + "_B };\n\n";
+	}
+	for (uint32_t i = 0; i < shape.enum_structs; i++) {
+		main += "enum struct Es" + std::to_string(i) + " {\n";
+		main += "\tint id;\n";
+		main += "\tfloat weight;\n";
+		main += "\tchar name[16];\n";
+		main += "}\n\n";
+	}
+	for (uint32_t i = 0; i < shape.globals; i++)
+		declare(main, var_type(shape, 0, i), "g" + std::to_string(i));
+	main += "\n";
+
+	for (uint32_t i = 0; i < shape.functions; i++) {
+		std::string& out = sources[function_file(shape, i)];
+		out += "public int fn" + std::to_string(i) + "()\n{\n";
+		for (uint32_t n = 0; n < shape.locals; n++) {
+			out += "\t";
+			declare(out, var_type(shape, i, n), "l" + std::to_string(n));
+		}
+		uint32_t count = function_lines(shape, i);
+		for (uint32_t line = 0; line < count; line++) {
+			if (i > 0 && line % 8 == 7)
+				out += "\tfn" + std::to_string(i - 1) + "();\n";
+			else
+				out += "\tint s" + std::to_string(line) + " = " + std::to_string(line) + ";\n";
+		}
+		out += "\treturn 0;\n}\n\n";
+	}
+	for (uint32_t file = 1; file < shape.files; file++)
+		main += "#include \"" + file_name(file) + "\"\n";
+
+	for (uint32_t file = 0; file < shape.files; file++) {
+		std::string path = dir + "/" + file_name(file);
+		if (!write_file(path, sources[file].data(), sources[file].size(), error))
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,38 @@
+#ifndef _INCLUDE_BENCH_CORPUS_H_
+#define _INCLUDE_BENCH_CORPUS_H_
+
+#include <stdint.h>
+#include <string>
+
+//
+//  Synthetic plugins for scaling tests. A shape says how big each part of
+//  the debug info is; the same shape can be written as an SMX image, laid
+//  out the way spcomp lays out images with RTTI debug info, or as .sp
+//  sources for spcomp to build.
+//
+struct CorpusShape {
+	uint32_t functions = 1000;
+	// Per function.
+	uint32_t locals = 4;
+	uint32_t globals = 100;
+	uint32_t enum_structs = 10;
+	// Enums, each a distinct RTTI type that variables are declared with.
+	uint32_t types = 10;
+	uint32_t files = 10;
+	// Breakable lines, spread over the functions.
+	uint32_t lines = 20000;
+};
+
+// The shape of a plugin with |functions| functions and the other parts in
+// proportion to it, as the benchmark sweep grows them.
+CorpusShape ScaledCorpusShape(uint32_t functions);
+
+// Writes the shape as one SMX image to |path|. Returns false and sets
+// |error| if the file can't be written.
+bool WriteCorpusImage(const CorpusShape& shape, const std::string& path, std::string* error);
+
+// Writes the shape as corpus.sp and corpus_<n>.sp includes, one per file,
+// into the existing directory |dir|.
+bool WriteCorpusSources(const CorpusShape& shape, const std::string& dir, std::string* error);
+
+#endif //_INCLUDE_BENCH_CORPUS_H_
@@ -0,0 +1,318 @@
+//
+//  Replays a scripted debug session against a running server and reports
+//  how long each step took and how many bytes it moved. The server must run
+//  a plugin built from the image given with --plugin, and the game must keep
+//  calling into it, or the pause never stops anywhere.
+//
+//  The script: Hello, SetBreakpoint on up to --breakpoints breakable lines,
+//  Pause, then CallStack and the top frame's locals at the stop and after
+//  each of --steps StepOvers. It ends with ClearBreakpoints and Continue.
+//
+//  usage: sm_debugger_session_bench --plugin plugin.smx [--host 127.0.0.1]
+//         [--port 27015] [--breakpoints 500] [--steps 100] [--timeout-ms 10000]
+//
+#include "protocol.h"
+#include "smx-v1-image.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <nlohmann/json.hpp>
+#include <set>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET socket_t;
+#define close_socket closesocket
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int socket_t;
+#define INVALID_SOCKET (-1)
+#define close_socket close
+#endif
+
+using clock_type = std::chrono::steady_clock;
+
+static double elapsed_us(clock_type::time_point start) {
+	return std::chrono::duration<double, std::micro>(clock_type::now() - start).count();
+}
+
+class Connection {
+public:
+	~Connection() {
+		if (fd != INVALID_SOCKET)
+			close_socket(fd);
+	}
+
+	bool open(const std::string& host, uint16_t port) {
+		fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (fd == INVALID_SOCKET)
+			return false;
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char*)&one, sizeof(one));
+
+		sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1)
+			return false;
+		return connect(fd, (const sockaddr*)&addr, sizeof(addr)) == 0;
+	}
+
+	// Messages are built as the server reads them: a length placeholder,
+	// the type, then the payload.
+	struct Message {
+		std::vector<char> bytes;
+
+		explicit Message(MessageType type) : bytes(5) {
+			bytes[4] = char(type);
+		}
+		Message& putChar(unsigned char value) {
+			bytes.push_back(char(value));
+			return *this;
+		}
+		Message& putInt(int32_t value) {
+			const char* p = (const char*)&value;
+			bytes.insert(bytes.end(), p, p + sizeof(value));
+			return *this;
+		}
+		Message& putString(const std::string& value) {
+			putInt(int32_t(value.size() + 1));
+			bytes.insert(bytes.end(), value.c_str(), value.c_str() + value.size() + 1);
+			return *this;
+		}
+	};
+
+	bool send(Message& msg) {
+		uint32_t length = uint32_t(msg.bytes.size() - 5);
+		memcpy(msg.bytes.data(), &length, sizeof(length));
+		size_t sent = 0;
+		while (sent < msg.bytes.size()) {
+			int rv = ::send(fd, msg.bytes.data() + sent, int(msg.bytes.size() - sent), 0);
+			if (rv <= 0)
+				return false;
+			sent += rv;
+		}
+		bytes_sent += msg.bytes.size();
+		return true;
+	}
+
+	// Reads messages until one of |type| arrives, returning its size on the
+	// wire, or 0 on timeout or disconnect. Other messages are counted and
+	// dropped.
+	size_t waitFor(MessageType type, int timeout_ms) {
+		auto deadline = clock_type::now() + std::chrono::milliseconds(timeout_ms);
+		while (true) {
+			while (pending.size() >= 5) {
+				uint32_t length;
+				memcpy(&length, pending.data(), sizeof(length));
+				if (pending.size() - 5 < length)
+					break;
+				unsigned char got = (unsigned char)pending[4];
+				size_t size = 5 + size_t(length);
+				pending.erase(pending.begin(), pending.begin() + size);
+				received[got] += size;
+				if (got == type)
+					return size;
+			}
+
+			auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock_type::now()).count();
+			if (left <= 0 || !readSome(int(left)))
+				return 0;
+		}
+	}
+
+	size_t bytes_sent = 0;
+	// Bytes received per message type.
+	std::map<unsigned char, uint64_t> received;
+
+private:
+	bool readSome(int timeout_ms) {
+#ifdef _WIN32
+		WSAPOLLFD pfd = { fd, POLLRDNORM, 0 };
+		if (WSAPoll(&pfd, 1, timeout_ms) <= 0)
+			return false;
+#else
+		pollfd pfd = { fd, POLLIN, 0 };
+		if (poll(&pfd, 1, timeout_ms) <= 0)
+			return false;
+#endif
+		char chunk[64 * 1024];
+		int rv = recv(fd, chunk, sizeof(chunk), 0);
+		if (rv <= 0)
+			return false;
+		pending.insert(pending.end(), chunk, chunk + rv);
+		return true;
+	}
+
+	socket_t fd = INVALID_SOCKET;
+	std::vector<char> pending;
+};
+
+// Latencies of one step of the script, in microseconds.
+class Samples {
+public:
+	void add(double us, size_t bytes) {
+		values.push_back(us);
+		total_bytes += bytes;
+	}
+
+	nlohmann::json report(const char* step) {
+		nlohmann::json result = { { "step", step }, { "count", values.size() }, { "bytes", total_bytes } };
+		if (values.empty())
+			return result;
+		std::sort(values.begin(), values.end());
+		auto at = [this](double q) {
+			return values[std::min(values.size() - 1, size_t(q * values.size()))];
+		};
+		result["p50_us"] = at(0.50);
+		result["p90_us"] = at(0.90);
+		result["p99_us"] = at(0.99);
+		result["max_us"] = values.back();
+		return result;
+	}
+
+private:
+	std::vector<double> values;
+	uint64_t total_bytes = 0;
+};
+
+struct Options {
+	std::string host = "127.0.0.1";
+	uint16_t port = 27015;
+	std::string plugin;
+	size_t breakpoints = 500;
+	size_t steps = 100;
+	int timeout_ms = 10000;
+};
+
+static bool parse_options(int argc, char** argv, Options* options) {
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string flag = argv[i];
+		const char* value = argv[i + 1];
+		if (flag == "--host")
+			options->host = value;
+		else if (flag == "--port")
+			options->port = uint16_t(atoi(value));
+		else if (flag == "--plugin")
+			options->plugin = value;
+		else if (flag == "--breakpoints")
+			options->breakpoints = strtoul(value, nullptr, 10);
+		else if (flag == "--steps")
+			options->steps = strtoul(value, nullptr, 10);
+		else if (flag == "--timeout-ms")
+			options->timeout_ms = atoi(value);
+		else
+			return false;
+	}
+	return (argc % 2) == 1 && !options->plugin.empty();
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	if (!parse_options(argc, argv, &options)) {
+		fprintf(stderr, "usage: %s --plugin plugin.smx [--host H] [--port N] [--breakpoints N] "
+			"[--steps N] [--timeout-ms N]\n", argv[0]);
+		return 1;
+	}
+
+	// Breakable lines, spread over the plugin so every file gets some.
+	sp::SmxV1Image image(options.plugin.c_str());
+	if (!image.validate(true)) {
+		fprintf(stderr, "%s: %s\n", options.plugin.c_str(), image.errorMessage());
+		return 1;
+	}
+	std::vector<uint32_t> addresses;
+	for (const auto& fn : image.Functions())
+		image.GetLineAddresses(fn.codestart, fn.codeend, &addresses);
+	std::set<std::pair<std::string, uint32_t>> lines;
+	size_t stride = std::max<size_t>(1, addresses.size() / std::max<size_t>(1, options.breakpoints));
+	for (size_t i = 0; i < addresses.size() && lines.size() < options.breakpoints; i += stride) {
+		uint32_t line;
+		const char* file = image.LookupFile(addresses[i]);
+		if (file && image.LookupLine(addresses[i], &line))
+			lines.emplace(file, line + 1);
+	}
+
+#ifdef _WIN32
+	WSADATA wsa;
+	WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+
+	Connection conn;
+	if (!conn.open(options.host, options.port)) {
+		fprintf(stderr, "could not connect to %s:%u\n", options.host.c_str(), options.port);
+		return 1;
+	}
+
+	std::map<std::string, Samples> samples;
+	std::vector<std::string> order;
+	auto sample = [&](const std::string& step) -> Samples& {
+		if (!samples.count(step))
+			order.push_back(step);
+		return samples[step];
+	};
+	bool ok = true;
+	auto request = [&](const char* step, Connection::Message msg, MessageType reply) -> bool {
+		auto start = clock_type::now();
+		size_t sent = msg.bytes.size();
+		if (!conn.send(msg))
+			return false;
+		size_t size = conn.waitFor(reply, options.timeout_ms);
+		if (!size) {
+			fprintf(stderr, "%s: no reply\n", step);
+			return false;
+		}
+		sample(step).add(elapsed_us(start), sent + size);
+		return true;
+	};
+	auto inspect = [&]() -> bool {
+		return request("RequestCallStack", Connection::Message(RequestCallStack), CallStack) &&
+			request("RequestVariables", Connection::Message(RequestVariables).putString("0:%local%"), Variables);
+	};
+
+	ok = request("Hello", Connection::Message(Hello).putInt(PROTOCOL_VERSION).putInt(0), Capabilities);
+
+	auto start = clock_type::now();
+	size_t sent = conn.bytes_sent;
+	std::set<std::string> files;
+	int32_t id = 0;
+	for (const auto& line : lines) {
+		Connection::Message msg(SetBreakpoint);
+		msg.putString(line.first).putInt(int32_t(line.second)).putInt(++id);
+		files.insert(line.first);
+		ok = ok && conn.send(msg);
+	}
+	sample("SetBreakpoint").add(elapsed_us(start), conn.bytes_sent - sent);
+
+	ok = ok && request("Pause", Connection::Message(Pause).putChar(DebugPause), HasStopped) && inspect();
+	for (size_t i = 0; ok && i < options.steps; i++) {
+		ok = request("StepOver", Connection::Message(StepOver).putChar(DebugStepOver), HasStopped) &&
+			inspect();
+	}
+
+	for (const auto& file : files) {
+		Connection::Message msg(ClearBreakpoints);
+		conn.send(msg.putString(file));
+	}
+	Connection::Message resume(Continue);
+	conn.send(resume.putChar(DebugRun));
+
+	for (const auto& step : order)
+		printf("%s\n", samples[step].report(step.c_str()).dump().c_str());
+	nlohmann::json totals = { { "step", "total" }, { "bytes_sent", conn.bytes_sent } };
+	for (const auto& entry : conn.received)
+		totals["bytes_received"][std::to_string(entry.first)] = entry.second;
+	printf("%s\n", totals.dump().c_str());
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,60 @@
+#ifndef _INCLUDE_BREAKPOINTS_H_
+#define _INCLUDE_BREAKPOINTS_H_
+
+#include <sp_vm_types.h>
+#include <stdint.h>
+#include <vector>
+
+//
+//  One bit per code cell of a plugin. Breakpoints are resolved to a cip once,
+//  so the per-BREAK check in DebugHook is a single bit test.
+//
+class BreakpointBitmap {
+public:
+	void reset(size_t code_size) {
+		const size_t cells = code_size / sizeof(cell_t);
+		bits_.assign((cells + 31) / 32, 0);
+		count_ = 0;
+	}
+
+	void set(cell_t cip) {
+		const size_t cell = static_cast<uint32_t>(cip) / sizeof(cell_t);
+		if ((cell >> 5) >= bits_.size())
+			return;
+		uint32_t& word = bits_[cell >> 5];
+		const uint32_t mask = 1u << (cell & 31);
+		if (!(word & mask)) {
+			word |= mask;
+			count_++;
+		}
+	}
+
+	bool test(cell_t cip) const {
+		const size_t cell = static_cast<uint32_t>(cip) / sizeof(cell_t);
+		if ((cell >> 5) >= bits_.size())
+			return false;
+		return (bits_[cell >> 5] >> (cell & 31)) & 1;
+	}
+
+	bool empty() const {
+		return count_ == 0;
+	}
+
+	template <typename Fn>
+	void forEach(Fn fn) const {
+		for (size_t i = 0; i < bits_.size(); i++) {
+			if (!bits_[i])
+				continue;
+			for (uint32_t bit = 0; bit < 32; bit++) {
+				if ((bits_[i] >> bit) & 1)
+					fn(static_cast<cell_t>(((i << 5) + bit) * sizeof(cell_t)));
+			}
+		}
+	}
+
+private:
+	std::vector<uint32_t> bits_;
+	size_t count_ = 0;
+};
+
+#endif //_INCLUDE_BREAKPOINTS_H_
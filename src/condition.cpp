@@ -0,0 +1,1045 @@
+#include "condition.h"
+#include "rtti.h"
+#include <algorithm>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <smx/smx-typeinfo.h>
+
+using namespace sp;
+
+// Deeper programs are refused when binding.
+static constexpr int kMaxStack = 32;
+// Parentheses, indexes, casts and unary operators nested deeper than this,
+// or more nodes than this, are refused when parsing, so neither the parser
+// nor the passes over the tree recurse without bound.
+static constexpr int kMaxNesting = 64;
+static constexpr size_t kMaxNodes = 1024;
+
+enum Token {
+	TokEnd = 0,
+	TokInt = 256,
+	TokFloat,
+	TokName,
+	TokEq,
+	TokNe,
+	TokLe,
+	TokGe,
+	TokAnd,
+	TokOr,
+	TokError
+};
+
+//
+//  Recursive descent over the condition text, lowest precedence first:
+//  ||, &&, comparisons, + and -, * / and %, unary operators, operands with
+//  their indexes and fields.
+//
+class Condition::Parser {
+public:
+	Parser(const std::string& text, std::vector<Node>& nodes)
+		: text_(text), nodes_(nodes) {
+		next();
+	}
+
+	int parse(std::string* error) {
+		int root = parseOr();
+		if (root >= 0 && token_ != TokEnd)
+			fail("unexpected text");
+		if (!error_.empty()) {
+			*error = error_;
+			return -1;
+		}
+		return root;
+	}
+
+private:
+	void fail(const char* message) {
+		if (error_.empty())
+			error_ = std::string(message) + " at offset " + std::to_string(start_);
+	}
+
+	void next() {
+		while (pos_ < text_.size() && isspace((unsigned char)text_[pos_]))
+			pos_++;
+		start_ = pos_;
+		if (pos_ >= text_.size()) {
+			token_ = TokEnd;
+			return;
+		}
+
+		const char* p = text_.c_str() + pos_;
+		if (isdigit((unsigned char)*p) || (*p == '.' && isdigit((unsigned char)p[1]))) {
+			char* end;
+			long value = strtol(p, &end, 0);
+			if (*end == '.' || *end == 'e' || *end == 'E') {
+				float_ = strtof(p, &end);
+				token_ = TokFloat;
+			}
+			else {
+				int_ = static_cast<cell_t>(value);
+				token_ = TokInt;
+			}
+			pos_ += end - p;
+			return;
+		}
+		if (isalpha((unsigned char)*p) || *p == '_') {
+			size_t len = 1;
+			while (isalnum((unsigned char)p[len]) || p[len] == '_')
+				len++;
+			name_.assign(p, len);
+			pos_ += len;
+			token_ = TokName;
+			return;
+		}
+
+		static const struct {
+			const char* text;
+			int token;
+		} pairs[] = {
+			{ "==", TokEq }, { "!=", TokNe }, { "<=", TokLe },
+			{ ">=", TokGe }, { "&&", TokAnd }, { "||", TokOr },
+		};
+		for (auto& pair : pairs) {
+			if (strncmp(p, pair.text, 2) == 0) {
+				pos_ += 2;
+				token_ = pair.token;
+				return;
+			}
+		}
+		if (strchr("<>!-+*/%()[].", *p)) {
+			pos_++;
+			token_ = *p;
+			return;
+		}
+		token_ = TokError;
+		fail("unexpected character");
+	}
+
+	int add(Node node) {
+		if (nodes_.size() >= kMaxNodes) {
+			fail("condition is too long");
+			return -1;
+		}
+		nodes_.push_back(std::move(node));
+		return static_cast<int>(nodes_.size() - 1);
+	}
+
+	int binary(int op, int left, int right) {
+		if (left < 0 || right < 0)
+			return -1;
+		Node node{ Binary };
+		node.op = op;
+		node.left = left;
+		node.right = right;
+		return add(std::move(node));
+	}
+
+	int parseOr() {
+		int left = parseAnd();
+		while (token_ == TokOr) {
+			next();
+			left = binary(TokOr, left, parseAnd());
+		}
+		return left;
+	}
+
+	int parseAnd() {
+		int left = parseCompare();
+		while (token_ == TokAnd) {
+			next();
+			left = binary(TokAnd, left, parseCompare());
+		}
+		return left;
+	}
+
+	int parseCompare() {
+		int left = parseAdd();
+		switch (token_) {
+		case TokEq:
+		case TokNe:
+		case TokLe:
+		case TokGe:
+		case '<':
+		case '>': {
+			int op = token_;
+			next();
+			return binary(op, left, parseAdd());
+		}
+		}
+		return left;
+	}
+
+	int parseAdd() {
+		int left = parseMul();
+		while (token_ == '+' || token_ == '-') {
+			int op = token_;
+			next();
+			left = binary(op, left, parseMul());
+		}
+		return left;
+	}
+
+	int parseMul() {
+		int left = parseUnary();
+		while (token_ == '*' || token_ == '/' || token_ == '%') {
+			int op = token_;
+			next();
+			left = binary(op, left, parseUnary());
+		}
+		return left;
+	}
+
+	// Every nested expression comes through here.
+	int parseUnary() {
+		if (depth_ >= kMaxNesting) {
+			fail("condition is nested too deeply");
+			return -1;
+		}
+		depth_++;
+		int node = parseUnaryNested();
+		depth_--;
+		return node;
+	}
+
+	int parseUnaryNested() {
+		if (token_ == '!' || token_ == '-') {
+			int op = token_;
+			next();
+			int operand = parseUnary();
+			if (operand < 0)
+				return -1;
+			Node node{ Unary };
+			node.op = op;
+			node.left = operand;
+			return add(std::move(node));
+		}
+		return parseOperand();
+	}
+
+	int parseOperand() {
+		switch (token_) {
+		case TokInt: {
+			Node node{ IntConst };
+			node.value = int_;
+			next();
+			return add(std::move(node));
+		}
+		case TokFloat: {
+			Node node{ FloatConst };
+			node.value = sp_ftoc(float_);
+			next();
+			return add(std::move(node));
+		}
+		case TokName: {
+			if (name_ == "true" || name_ == "false") {
+				Node node{ IntConst };
+				node.value = name_ == "true";
+				next();
+				return add(std::move(node));
+			}
+			if (name_ == "view_as")
+				return parseCast();
+			Node name{ Name };
+			name.name = name_;
+			next();
+			int node = add(std::move(name));
+			while (token_ == '[' || token_ == '.') {
+				if (token_ == '.') {
+					next();
+					if (token_ != TokName) {
+						fail("expected a field name");
+						return -1;
+					}
+					Node field{ Field };
+					field.name = name_;
+					field.left = node;
+					next();
+					node = add(std::move(field));
+					continue;
+				}
+				next();
+				int index = parseOr();
+				if (token_ != ']') {
+					fail("expected ']'");
+					return -1;
+				}
+				next();
+				if (index < 0)
+					return -1;
+				Node element{ Element };
+				element.left = node;
+				element.right = index;
+				node = add(std::move(element));
+			}
+			return node;
+		}
+		case '(': {
+			next();
+			int inner = parseOr();
+			if (token_ != ')') {
+				fail("expected ')'");
+				return -1;
+			}
+			next();
+			return inner;
+		}
+		}
+		fail("expected a value");
+		return -1;
+	}
+
+	// view_as<type>(expression)
+	int parseCast() {
+		next();
+		if (token_ != '<') {
+			fail("expected '<'");
+			return -1;
+		}
+		next();
+		Node node{ Cast };
+		if (token_ == TokName && name_ == "float")
+			node.value = static_cast<cell_t>(Predicate::Result::Float);
+		else if (token_ == TokName && name_ == "bool")
+			node.value = static_cast<cell_t>(Predicate::Result::Bool);
+		else if (token_ == TokName && (name_ == "int" || name_ == "any"))
+			node.value = static_cast<cell_t>(Predicate::Result::Cell);
+		else {
+			fail("expected int, bool or float");
+			return -1;
+		}
+		next();
+		if (token_ != '>') {
+			fail("expected '>'");
+			return -1;
+		}
+		next();
+		if (token_ != '(') {
+			fail("expected '('");
+			return -1;
+		}
+		next();
+		int inner = parseOr();
+		if (token_ != ')') {
+			fail("expected ')'");
+			return -1;
+		}
+		next();
+		if (inner < 0)
+			return -1;
+		node.left = inner;
+		return add(std::move(node));
+	}
+
+	const std::string& text_;
+	std::vector<Node>& nodes_;
+	size_t pos_ = 0;
+	size_t start_ = 0;
+	int token_ = TokEnd;
+	cell_t int_ = 0;
+	float float_ = 0;
+	std::string name_;
+	std::string error_;
+	int depth_ = 0;
+};
+
+bool Condition::parse(const std::string& text, std::string* error) {
+	nodes_.clear();
+	Parser parser(text, nodes_);
+	root_ = parser.parse(error);
+	if (root_ < 0)
+		nodes_.clear();
+	return root_ >= 0;
+}
+
+// A name, element or field resolved for one plugin and address.
+struct Condition::Operand {
+	// Plain cells and legacy arrays, read by one load.
+	Predicate::Op load = Predicate::LoadGlobal;
+	cell_t arg = 0;
+	cell_t size = 0;
+	bool is_array = false;
+	bool is_float = false;
+	// In plugins with RTTI every name, element and field is a place: code
+	// computes its address and |type| says what is there. A name's |load|
+	// is then one of the address forms; an element's |arg| is its size in
+	// bytes and a field's its offset.
+	bool is_place = false;
+	const debug::Rtti* type = nullptr;
+};
+
+// Legacy debug info: plain cells and one-dimensional arrays of them.
+static bool resolveOperand(SmxV1Image* image, const SmxV1Image::Symbol& sym,
+	bool* is_array, bool* is_ref, cell_t* size, bool* is_float) {
+	*is_array = false;
+	*is_ref = false;
+	*size = 0;
+	*is_float = false;
+
+	switch (sym.ident()) {
+	case sp::IDENT_REFERENCE:
+		*is_ref = true;
+		break;
+	case sp::IDENT_REFARRAY:
+		*is_ref = true;
+		// fallthrough
+	case sp::IDENT_ARRAY: {
+		auto dims = image->GetArrayDimensions(&sym);
+		if (dims.size() != 1)
+			return false;
+		*is_array = true;
+		*size = dims[0].size();
+		break;
+	}
+	case sp::IDENT_VARIABLE:
+		break;
+	default:
+		return false;
+	}
+	*is_float = image->GetTagKind(sym.tagid()) == SmxV1Image::TagKind::Float;
+	return true;
+}
+
+// Whether a value of |type| fits in a cell.
+static bool isScalar(const debug::Rtti* type) {
+	if (!type)
+		return false;
+	switch (type->type()) {
+	case cb::kFixedArray:
+	case cb::kArray:
+	case cb::kEnumStruct:
+	case cb::kVoid:
+	case cb::kByRef:
+		return false;
+	}
+	return true;
+}
+
+static bool isArray(const debug::Rtti* type) {
+	return type && (type->type() == cb::kFixedArray || type->type() == cb::kArray);
+}
+
+bool Condition::bindPlace(SmxV1Image* image, int index, std::vector<Operand>& names,
+	std::string* error) const {
+	auto& node = nodes_[index];
+	auto& operand = names[index];
+	auto& base = names[node.left];
+	operand.is_place = true;
+
+	if (node.kind == Field) {
+		if (!base.is_place || !base.type || base.type->type() != cb::kEnumStruct) {
+			*error = "can't take field '" + node.name + "' of something that isn't an enum struct";
+			return false;
+		}
+		for (auto& field : image->getEnumFields(base.type->index())) {
+			if (!field.type)
+				break;
+			if (field.name && node.name == field.name) {
+				operand.arg = static_cast<cell_t>(field.offset);
+				operand.type = field.type;
+				return true;
+			}
+		}
+		*error = "no field '" + node.name + "'";
+		return false;
+	}
+
+	if (!base.is_place || !isArray(base.type)) {
+		*error = "can't index something that isn't an array";
+		return false;
+	}
+	auto inner = base.type->inner();
+	if (!inner) {
+		*error = "can't index an array of unknown type";
+		return false;
+	}
+	operand.type = inner;
+	operand.size = base.type->type() == cb::kFixedArray ? base.type->index() : 0;
+	switch (inner->type()) {
+	case cb::kChar8:
+		operand.arg = 1;
+		break;
+	case cb::kEnumStruct:
+		operand.arg = image->getEnumStructSize(inner->index()) * sizeof(cell_t);
+		if (!operand.arg) {
+			*error = "can't index an array of unknown type";
+			return false;
+		}
+		break;
+	default:
+		// Rows of a multi-dimensional array are found through a cell each.
+		operand.arg = sizeof(cell_t);
+		break;
+	}
+	return true;
+}
+
+bool Condition::bind(SmxV1Image* image, uint32_t addr, Predicate* out,
+	std::string* error) const {
+	return bind(image, addr, out, error, false, nullptr, nullptr);
+}
+
+bool Condition::bindExpression(SmxV1Image* image, uint32_t addr, Predicate* out,
+	std::string* error, uint32_t* start, uint32_t* end) const {
+	return bind(image, addr, out, error, true, start, end);
+}
+
+bool Condition::bind(SmxV1Image* image, uint32_t addr, Predicate* out,
+	std::string* error, bool places, uint32_t* start, uint32_t* end) const {
+	out->code_.clear();
+	out->result_ = Predicate::Result::Bool;
+	out->type_ = nullptr;
+	// Narrowed by every name looked up, including one that fails.
+	uint32_t lo = 0, hi = UINT32_MAX;
+	if (start)
+		*start = lo;
+	if (end)
+		*end = hi;
+	if (root_ < 0)
+		return true;
+
+	// Operands come before the nodes that use them.
+	std::vector<Operand> names(nodes_.size());
+	for (size_t i = 0; i < nodes_.size(); i++) {
+		auto& node = nodes_[i];
+		if (node.kind == Field || node.kind == Element) {
+			if (names[node.left].is_place) {
+				if (!bindPlace(image, static_cast<int>(i), names, error))
+					return false;
+				continue;
+			}
+			// Legacy arrays take one index, and nothing has fields.
+			auto& base = nodes_[node.left];
+			if (node.kind == Field || base.kind != Name) {
+				*error = node.kind == Field ? "can't take field '" + node.name + "' without type information"
+					: "can't index an element without type information";
+				return false;
+			}
+			if (!names[node.left].is_array) {
+				*error = "'" + base.name + "' isn't an array";
+				return false;
+			}
+			names[i] = names[node.left];
+			continue;
+		}
+		if (node.kind != Name)
+			continue;
+
+		std::unique_ptr<SmxV1Image::Symbol> sym;
+		uint32_t sym_start, sym_end;
+		bool found = image->GetVariable(node.name.c_str(), addr, sym, &sym_start, &sym_end);
+		lo = std::max(lo, sym_start);
+		hi = std::min(hi, sym_end);
+		if (start)
+			*start = lo;
+		if (end)
+			*end = hi;
+		if (!found) {
+			*error = "unknown variable '" + node.name + "'";
+			return false;
+		}
+		auto& operand = names[i];
+		int vclass = sym->vclass() & 0x0f;
+		bool local = vclass == 1 || vclass == 3;
+		operand.arg = static_cast<cell_t>(sym->addr());
+
+		if (auto var = sym->rtti()) {
+			auto type = image->rtti_data() ? image->rtti_data()->typeFromTypeId(var->type_id) : nullptr;
+			bool is_ref = false;
+			if (type && type->type() == cb::kByRef) {
+				is_ref = true;
+				type = type->inner();
+			}
+			if (type && (type->type() == cb::kFixedArray || type->type() == cb::kEnumStruct)) {
+				// Array and enum struct arguments are passed by reference.
+				is_ref = vclass == 3;
+			}
+			else if (type && type->type() == cb::kArray) {
+				if (vclass != 3)
+					type = nullptr;
+				is_ref = true;
+			}
+			if (!type) {
+				*error = "can't read '" + node.name + "'";
+				return false;
+			}
+			operand.is_place = true;
+			operand.type = type;
+			if (!local)
+				operand.load = Predicate::AddrGlobal;
+			else
+				operand.load = is_ref ? Predicate::AddrLocalRef : Predicate::AddrLocal;
+			continue;
+		}
+
+		bool is_array, is_ref;
+		if (!resolveOperand(image, *sym, &is_array, &is_ref, &operand.size,
+				&operand.is_float)) {
+			*error = "can't compare '" + node.name + "'";
+			return false;
+		}
+		if (!local)
+			operand.load = is_array ? Predicate::IndexGlobal : Predicate::LoadGlobal;
+		else if (is_ref)
+			operand.load = is_array ? Predicate::IndexLocalRef : Predicate::LoadLocalRef;
+		else
+			operand.load = is_array ? Predicate::IndexLocal : Predicate::LoadLocal;
+		operand.is_array = is_array;
+	}
+
+	if (!check(root_, !places, names, error))
+		return false;
+
+	auto result = resultOf(root_, names);
+	if (result == Predicate::Result::Place)
+		emitPlace(root_, names, out->code_);
+	else
+		emit(root_, names, out->code_);
+	out->result_ = result;
+	out->type_ = result == Predicate::Result::Place ? names[root_].type : nullptr;
+
+	// Every instruction but a load or constant takes one value or more off.
+	int depth = 0, max_depth = 0;
+	for (auto& instr : out->code_) {
+		switch (instr.op) {
+		case Predicate::Const:
+		case Predicate::LoadGlobal:
+		case Predicate::LoadLocal:
+		case Predicate::LoadLocalRef:
+		case Predicate::AddrGlobal:
+		case Predicate::AddrLocal:
+		case Predicate::AddrLocalRef:
+			depth++;
+			break;
+		case Predicate::IndexGlobal:
+		case Predicate::IndexLocal:
+		case Predicate::IndexLocalRef:
+		case Predicate::Offset:
+		case Predicate::Indirect:
+		case Predicate::Load:
+		case Predicate::LoadByte:
+		case Predicate::ToFloat:
+		case Predicate::Not:
+		case Predicate::Neg:
+		case Predicate::NegF:
+			break;
+		default:
+			depth--;
+			break;
+		}
+		max_depth = std::max(max_depth, depth);
+	}
+	if (max_depth > kMaxStack) {
+		out->code_.clear();
+		*error = "condition is too complex";
+		return false;
+	}
+	return true;
+}
+
+// Refuses what can't be computed: arrays and enum structs used as values,
+// unless |value| is false for the whole expression, and legacy arrays
+// without their index.
+bool Condition::check(int index, bool value, const std::vector<Operand>& names,
+	std::string* error) const {
+	auto& node = nodes_[index];
+	switch (node.kind) {
+	case IntConst:
+	case FloatConst:
+		return true;
+	case Cast:
+	case Unary:
+		return check(node.left, true, names, error);
+	case Binary:
+		return check(node.left, true, names, error) && check(node.right, true, names, error);
+	case Element:
+		if (!check(node.right, true, names, error))
+			return false;
+		// fallthrough
+	case Field:
+		if (names[node.left].is_place && !check(node.left, false, names, error))
+			return false;
+		break;
+	default:
+		break;
+	}
+
+	auto& operand = names[index];
+	if (operand.is_place) {
+		if (value && !isScalar(operand.type)) {
+			*error = "can't use " + describe(index) + " as a value";
+			return false;
+		}
+		return true;
+	}
+	if (node.kind == Name && operand.is_array) {
+		*error = "'" + node.name + "' needs an index";
+		return false;
+	}
+	return true;
+}
+
+// The text of a name, element or field, for errors.
+std::string Condition::describe(int index) const {
+	auto& node = nodes_[index];
+	switch (node.kind) {
+	case Name:
+		return "'" + node.name + "'";
+	case Field:
+		return "field '" + node.name + "'";
+	default:
+		return "an element of " + describe(node.left);
+	}
+}
+
+Predicate::Result Condition::resultOf(int index, const std::vector<Operand>& names) const {
+	using Result = Predicate::Result;
+	auto& node = nodes_[index];
+	switch (node.kind) {
+	case IntConst:
+		return Result::Cell;
+	case FloatConst:
+		return Result::Float;
+	case Name:
+	case Element:
+	case Field: {
+		auto& operand = names[index];
+		if (!operand.is_place)
+			return operand.is_float ? Result::Float : Result::Cell;
+		if (!isScalar(operand.type))
+			return Result::Place;
+		if (operand.type->type() == cb::kFloat32)
+			return Result::Float;
+		return operand.type->type() == cb::kBool ? Result::Bool : Result::Cell;
+	}
+	case Cast:
+		return static_cast<Result>(node.value);
+	case Unary:
+		if (node.op == '!')
+			return Result::Bool;
+		return isFloat(node.left, names) ? Result::Float : Result::Cell;
+	case Binary:
+		switch (node.op) {
+		case '+':
+		case '-':
+		case '*':
+		case '/':
+			return isFloat(node.left, names) || isFloat(node.right, names)
+				? Result::Float : Result::Cell;
+		case '%':
+			return Result::Cell;
+		}
+		return Result::Bool;
+	}
+	return Result::Cell;
+}
+
+bool Condition::isFloat(int index, const std::vector<Operand>& names) const {
+	return resultOf(index, names) == Predicate::Result::Float;
+}
+
+void Condition::emitPlace(int index, const std::vector<Operand>& names,
+	std::vector<Predicate::Instr>& code) const {
+	auto& node = nodes_[index];
+	auto& operand = names[index];
+	switch (node.kind) {
+	case Name:
+		code.push_back({ operand.load, operand.arg, 0 });
+		return;
+	case Field:
+		emitPlace(node.left, names, code);
+		code.push_back({ Predicate::Offset, operand.arg, 0 });
+		return;
+	default:
+		emitPlace(node.left, names, code);
+		emit(node.right, names, code);
+		code.push_back({ Predicate::Element, operand.arg, operand.size });
+		if (isArray(operand.type))
+			code.push_back({ Predicate::Indirect, 0, 0 });
+		return;
+	}
+}
+
+void Condition::emit(int index, const std::vector<Operand>& names,
+	std::vector<Predicate::Instr>& code) const {
+	auto& node = nodes_[index];
+	switch (node.kind) {
+	case IntConst:
+	case FloatConst:
+		code.push_back({ Predicate::Const, node.value, 0 });
+		return;
+	case Name:
+	case Element:
+	case Field: {
+		auto& operand = names[index];
+		if (!operand.is_place && node.kind == Name) {
+			code.push_back({ operand.load, operand.arg, 0 });
+			return;
+		}
+		if (!operand.is_place) {
+			emit(node.right, names, code);
+			code.push_back({ operand.load, operand.arg, operand.size });
+			return;
+		}
+		// A named cell is read in one go.
+		if (node.kind == Name) {
+			Predicate::Op load = operand.load == Predicate::AddrGlobal ? Predicate::LoadGlobal
+				: operand.load == Predicate::AddrLocal ? Predicate::LoadLocal : Predicate::LoadLocalRef;
+			code.push_back({ load, operand.arg, 0 });
+			return;
+		}
+		emitPlace(index, names, code);
+		code.push_back({ operand.type->type() == cb::kChar8 ? Predicate::LoadByte : Predicate::Load, 0, 0 });
+		return;
+	}
+	case Cast:
+		// Reinterprets the bits, as view_as does.
+		emit(node.left, names, code);
+		return;
+	case Unary:
+		emit(node.left, names, code);
+		if (node.op == '!')
+			code.push_back({ Predicate::Not, 0, 0 });
+		else
+			code.push_back({ isFloat(node.left, names) ? Predicate::NegF : Predicate::Neg, 0, 0 });
+		return;
+	case Binary:
+		break;
+	}
+
+	bool left_float = isFloat(node.left, names);
+	bool right_float = isFloat(node.right, names);
+	bool as_float = (left_float || right_float) && node.op != TokAnd && node.op != TokOr &&
+		node.op != '%';
+
+	emit(node.left, names, code);
+	emit(node.right, names, code);
+	if (as_float && !left_float)
+		code.push_back({ Predicate::ToFloat, 1, 0 });
+	if (as_float && !right_float)
+		code.push_back({ Predicate::ToFloat, 0, 0 });
+
+	Predicate::Op op;
+	switch (node.op) {
+	case '+': op = as_float ? Predicate::AddF : Predicate::Add; break;
+	case '-': op = as_float ? Predicate::SubF : Predicate::Sub; break;
+	case '*': op = as_float ? Predicate::MulF : Predicate::Mul; break;
+	case '/': op = as_float ? Predicate::DivF : Predicate::Div; break;
+	case '%': op = Predicate::Mod; break;
+	case TokEq: op = as_float ? Predicate::EqF : Predicate::Eq; break;
+	case TokNe: op = as_float ? Predicate::NeF : Predicate::Ne; break;
+	case '<': op = as_float ? Predicate::LtF : Predicate::Lt; break;
+	case TokLe: op = as_float ? Predicate::LeF : Predicate::Le; break;
+	case '>': op = as_float ? Predicate::GtF : Predicate::Gt; break;
+	case TokGe: op = as_float ? Predicate::GeF : Predicate::Ge; break;
+	case TokAnd: op = Predicate::And; break;
+	default: op = Predicate::Or; break;
+	}
+	code.push_back({ op, 0, 0 });
+}
+
+namespace {
+// The plugin's memory, on the game thread.
+class ContextReader {
+public:
+	explicit ContextReader(SourcePawn::IPluginContext* ctx) : ctx(ctx) {
+	}
+
+	bool cell(cell_t addr, cell_t* value) const {
+		cell_t* ptr;
+		if (ctx->LocalToPhysAddr(addr, &ptr) != SP_ERROR_NONE)
+			return false;
+		*value = *ptr;
+		return true;
+	}
+	bool byte(cell_t addr, cell_t* value) const {
+		cell_t* ptr;
+		if (ctx->LocalToPhysAddr(addr, &ptr) != SP_ERROR_NONE)
+			return false;
+		*value = *reinterpret_cast<const uint8_t*>(ptr);
+		return true;
+	}
+
+private:
+	SourcePawn::IPluginContext* ctx;
+};
+
+// Whatever a Memory copied; reads of anything else fail.
+class MemoryReader {
+public:
+	explicit MemoryReader(const SnapshotPlan::Memory& memory) : memory(memory) {
+	}
+
+	bool cell(cell_t addr, cell_t* value) const {
+		auto ptr = memory.cells(addr, 1);
+		if (!ptr)
+			return false;
+		*value = *ptr;
+		return true;
+	}
+	bool byte(cell_t addr, cell_t* value) const {
+		size_t length;
+		auto ptr = memory.string(addr, 1, &length);
+		if (!ptr)
+			return false;
+		*value = *reinterpret_cast<const uint8_t*>(ptr);
+		return true;
+	}
+
+private:
+	const SnapshotPlan::Memory& memory;
+};
+} // namespace
+
+bool Predicate::evaluate(SourcePawn::IPluginContext* ctx, cell_t frm) const {
+	cell_t value;
+	return run(ContextReader(ctx), frm, &value) && value != 0;
+}
+
+bool Predicate::value(SourcePawn::IPluginContext* ctx, cell_t frm, cell_t* out) const {
+	return run(ContextReader(ctx), frm, out);
+}
+
+bool Predicate::evaluate(const SnapshotPlan::Memory& memory, cell_t frm) const {
+	cell_t value;
+	return run(MemoryReader(memory), frm, &value) && value != 0;
+}
+
+bool Predicate::value(const SnapshotPlan::Memory& memory, cell_t frm, cell_t* out) const {
+	return run(MemoryReader(memory), frm, out);
+}
+
+template <typename Reader>
+bool Predicate::run(const Reader& reader, cell_t frm, cell_t* out) const {
+	cell_t stack[kMaxStack];
+	int top = -1;
+
+	auto read = [&reader](cell_t addr, cell_t* value) {
+		return reader.cell(addr, value);
+	};
+
+	for (auto& instr : code_) {
+		switch (instr.op) {
+		case Const:
+			stack[++top] = instr.arg;
+			break;
+		case LoadGlobal:
+			if (!read(instr.arg, &stack[++top]))
+				return false;
+			break;
+		case LoadLocal:
+			if (!read(frm + instr.arg, &stack[++top]))
+				return false;
+			break;
+		case LoadLocalRef: {
+			cell_t ref;
+			if (!read(frm + instr.arg, &ref) || !read(ref, &stack[++top]))
+				return false;
+			break;
+		}
+		case IndexGlobal:
+		case IndexLocal:
+		case IndexLocalRef: {
+			cell_t index = stack[top];
+			if (index < 0 || (instr.size && index >= instr.size))
+				return false;
+			cell_t base = instr.arg;
+			if (instr.op != IndexGlobal)
+				base += frm;
+			if (instr.op == IndexLocalRef && !read(base, &base))
+				return false;
+			if (!read(base + index * sizeof(cell_t), &stack[top]))
+				return false;
+			break;
+		}
+		case AddrGlobal:
+			stack[++top] = instr.arg;
+			break;
+		case AddrLocal:
+			stack[++top] = frm + instr.arg;
+			break;
+		case AddrLocalRef:
+			if (!read(frm + instr.arg, &stack[++top]))
+				return false;
+			break;
+		case Offset:
+			stack[top] += instr.arg;
+			break;
+		case Element: {
+			cell_t index = stack[top--];
+			if (index < 0 || (instr.size && index >= instr.size))
+				return false;
+			stack[top] += index * instr.arg;
+			break;
+		}
+		case Indirect: {
+			cell_t offset;
+			if (!read(stack[top], &offset))
+				return false;
+			stack[top] += offset;
+			break;
+		}
+		case Load:
+			if (!read(stack[top], &stack[top]))
+				return false;
+			break;
+		case LoadByte:
+			if (!reader.byte(stack[top], &stack[top]))
+				return false;
+			break;
+		case ToFloat:
+			stack[top - instr.arg] = sp_ftoc(static_cast<float>(stack[top - instr.arg]));
+			break;
+		case Not:
+			stack[top] = !stack[top];
+			break;
+		case Neg:
+			stack[top] = -stack[top];
+			break;
+		case NegF:
+			stack[top] = sp_ftoc(-sp_ctof(stack[top]));
+			break;
+		default: {
+			cell_t b = stack[top--];
+			cell_t a = stack[top];
+			float fa = sp_ctof(a), fb = sp_ctof(b);
+			cell_t result;
+			switch (instr.op) {
+			case Add: result = a + b; break;
+			case Sub: result = a - b; break;
+			case Mul: result = a * b; break;
+			case Div:
+			case Mod:
+				if (b == 0 || (a == INT32_MIN && b == -1))
+					return false;
+				result = instr.op == Div ? a / b : a % b;
+				break;
+			case AddF: result = sp_ftoc(fa + fb); break;
+			case SubF: result = sp_ftoc(fa - fb); break;
+			case MulF: result = sp_ftoc(fa * fb); break;
+			case DivF: result = sp_ftoc(fa / fb); break;
+			case Eq: result = a == b; break;
+			case Ne: result = a != b; break;
+			case Lt: result = a < b; break;
+			case Le: result = a <= b; break;
+			case Gt: result = a > b; break;
+			case Ge: result = a >= b; break;
+			case EqF: result = fa == fb; break;
+			case NeF: result = fa != fb; break;
+			case LtF: result = fa < fb; break;
+			case LeF: result = fa <= fb; break;
+			case GtF: result = fa > fb; break;
+			case GeF: result = fa >= fb; break;
+			case And: result = a && b; break;
+			default: result = a || b; break;
+			}
+			stack[top] = result;
+			break;
+		}
+		}
+	}
+	if (top < 0)
+		return false;
+	*out = stack[top];
+	return true;
+}
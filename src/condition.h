@@ -0,0 +1,204 @@
+#ifndef _INCLUDE_CONDITION_H_
+#define _INCLUDE_CONDITION_H_
+
+#include <sp_vm_api.h>
+#include "smx-v1-image.h"
+#include "snapshot.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace sp {
+namespace debug {
+class Rtti;
+} // namespace debug
+} // namespace sp
+
+//
+//  A breakpoint condition or watch expression compiled for one plugin and
+//  code address. Every name and field is already an address, frame offset
+//  or byte offset, so a hit runs a handful of stack operations and no
+//  symbol lookups.
+//
+class Predicate {
+public:
+	// What value() produces.
+	enum class Result : uint8_t {
+		Cell,
+		Bool,
+		Float,
+		// The plugin address of a value of type(), such as an array or an
+		// enum struct, for the caller to read.
+		Place
+	};
+
+	// True if the condition holds in the frame |frm|. A read outside the
+	// plugin's memory, an array index out of bounds or a division by zero
+	// makes it false.
+	bool evaluate(SourcePawn::IPluginContext* ctx, cell_t frm) const;
+
+	// The expression's value in the frame |frm|, or false if it can't be
+	// computed there.
+	bool value(SourcePawn::IPluginContext* ctx, cell_t frm, cell_t* out) const;
+
+	// As evaluate and value, reading |memory| instead of a live context,
+	// such as a snapshot after the plugin has moved on. Any thread.
+	bool evaluate(const SnapshotPlan::Memory& memory, cell_t frm) const;
+	bool value(const SnapshotPlan::Memory& memory, cell_t frm, cell_t* out) const;
+
+	Result result() const {
+		return result_;
+	}
+	// The type at the address of a Place result.
+	const sp::debug::Rtti* type() const {
+		return type_;
+	}
+
+	bool empty() const {
+		return code_.empty();
+	}
+
+private:
+	friend class Condition;
+
+	enum Op : uint8_t {
+		Const,
+		// Loads: arg is an address, or a frame offset for the Local forms;
+		// the Ref forms read a pointer there first. The Index forms pop an
+		// index and check it against size when it is known.
+		LoadGlobal,
+		LoadLocal,
+		LoadLocalRef,
+		IndexGlobal,
+		IndexLocal,
+		IndexLocalRef,
+		// Addresses: push |arg|, the frame plus |arg|, or the pointer stored
+		// there. Offset adds |arg| bytes to the address on top, Element pops
+		// an index and adds it times |arg| bytes after checking it against
+		// size, and Indirect follows a row of an indirection vector.
+		AddrGlobal,
+		AddrLocal,
+		AddrLocalRef,
+		Offset,
+		Element,
+		Indirect,
+		// Replace the address on top with the cell, or the byte, there.
+		Load,
+		LoadByte,
+		ToFloat,		// converts the value |arg| slots below the top
+		Not,
+		Neg,
+		NegF,
+		Add,
+		Sub,
+		Mul,
+		Div,
+		Mod,
+		AddF,
+		SubF,
+		MulF,
+		DivF,
+		Eq,
+		Ne,
+		Lt,
+		Le,
+		Gt,
+		Ge,
+		LtF,
+		LeF,
+		GtF,
+		GeF,
+		EqF,
+		NeF,
+		And,
+		Or
+	};
+
+	struct Instr {
+		Op op;
+		cell_t arg;
+		cell_t size;
+	};
+
+	template <typename Reader>
+	bool run(const Reader& reader, cell_t frm, cell_t* out) const;
+
+	std::vector<Instr> code_;
+	Result result_ = Result::Bool;
+	const sp::debug::Rtti* type_ = nullptr;
+};
+
+//
+//  A parsed condition or expression: comparisons, && and ||, !, unary
+//  minus, + - * / and %, view_as<int|bool|float>(...), integer and float
+//  constants, true/false, and variables. Variables of plugins with RTTI can
+//  be indexed and have their enum struct fields taken, as in a.b[3].c;
+//  others take one array index. Parsed once, bound per plugin and scope.
+//
+class Condition {
+public:
+	// False, with a message in |error|, if |text| doesn't parse.
+	bool parse(const std::string& text, std::string* error);
+
+	bool empty() const {
+		return root_ < 0;
+	}
+
+	// Compiles the condition for code at |addr|. Fails, with a message, if a
+	// name isn't visible there or something used as a value isn't a cell.
+	bool bind(sp::SmxV1Image* image, uint32_t addr, Predicate* out,
+		std::string* error) const;
+
+	// As bind, but the whole expression may also be an array or enum struct,
+	// for a watch to show. [*start, *end] is set to the code range in which
+	// every name resolves as it did at |addr|, so the binding can be reused
+	// there.
+	bool bindExpression(sp::SmxV1Image* image, uint32_t addr, Predicate* out,
+		std::string* error, uint32_t* start, uint32_t* end) const;
+
+private:
+	enum Kind {
+		IntConst,
+		FloatConst,
+		Name,
+		// left[right], and left.name
+		Element,
+		Field,
+		// view_as: |value| is the Predicate::Result it reads left as.
+		Cast,
+		Unary,
+		Binary
+	};
+
+	struct Node {
+		Kind kind;
+		// Operator token for Unary and Binary nodes.
+		int op = 0;
+		cell_t value = 0;
+		std::string name;
+		int left = -1;
+		int right = -1;
+	};
+
+	struct Operand;
+	class Parser;
+
+	bool bind(sp::SmxV1Image* image, uint32_t addr, Predicate* out,
+		std::string* error, bool places, uint32_t* start, uint32_t* end) const;
+	bool bindPlace(sp::SmxV1Image* image, int node, std::vector<Operand>& names,
+		std::string* error) const;
+	bool check(int node, bool value, const std::vector<Operand>& names,
+		std::string* error) const;
+	std::string describe(int node) const;
+	Predicate::Result resultOf(int node, const std::vector<Operand>& names) const;
+	bool isFloat(int node, const std::vector<Operand>& names) const;
+	void emit(int node, const std::vector<Operand>& names,
+		std::vector<Predicate::Instr>& code) const;
+	void emitPlace(int node, const std::vector<Operand>& names,
+		std::vector<Predicate::Instr>& code) const;
+
+	std::vector<Node> nodes_;
+	int root_ = -1;
+};
+
+#endif //_INCLUDE_CONDITION_H_
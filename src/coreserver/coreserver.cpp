@@ -0,0 +1,435 @@
+//
+//  Serves a script core to a debug adapter as if the plugin were stopped on
+//  the error that wrote it, so a production fault can be looked at without
+//  touching the server it happened on. The core is memory-mapped and its
+//  variables are read with the same plans snapshot points use, against the
+//  plugin's SMX.
+//
+//  The adapter connects as it would to a server and gets HasStopped once it
+//  sends StartDebugging or Pause. CallStack, Variables for a frame's locals
+//  and Evaluate are answered from the core. Globals were not saved and come
+//  back empty; anything that would resume the plugin is ignored.
+//
+//  usage: sm_debugger_core_server [--port 27015] core.spcore plugin.smx
+//
+#include "protocol.h"
+#include "scriptcore.h"
+#include "snapshot.h"
+#include "smx-v1-image.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+typedef SOCKET socket_t;
+#define close_socket closesocket
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+typedef int socket_t;
+#define INVALID_SOCKET (-1)
+#define close_socket close
+#endif
+
+// A read-only view of a whole file.
+class MappedFile {
+public:
+	~MappedFile() {
+#ifdef _WIN32
+		if (base)
+			UnmapViewOfFile(base);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+#else
+		if (base)
+			munmap((void*)base, size);
+#endif
+	}
+
+	bool open(const char* path) {
+#ifdef _WIN32
+		file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 0, nullptr);
+		LARGE_INTEGER length;
+		if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &length) || !length.QuadPart)
+			return false;
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping)
+			return false;
+		base = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		size = size_t(length.QuadPart);
+#else
+		int fd = ::open(path, O_RDONLY);
+		struct stat st;
+		if (fd < 0 || fstat(fd, &st) != 0 || !st.st_size) {
+			if (fd >= 0)
+				close(fd);
+			return false;
+		}
+		void* view = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (view == MAP_FAILED)
+			return false;
+		base = (const char*)view;
+		size = size_t(st.st_size);
+#endif
+		return base != nullptr;
+	}
+
+	const char* base = nullptr;
+	size_t size = 0;
+
+private:
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+};
+
+// Reads the core's fields in order; every read past the end fails.
+class CoreReader {
+public:
+	CoreReader(const char* data, size_t size) : pos(data), end(data + size) {
+	}
+
+	template <typename T> bool get(T* value) {
+		if (size_t(end - pos) < sizeof(T))
+			return false;
+		memcpy(value, pos, sizeof(T));
+		pos += sizeof(T);
+		return true;
+	}
+	bool getString(std::string* value) {
+		const char* bytes;
+		uint32_t length;
+		if (!getBytes(&bytes, &length))
+			return false;
+		value->assign(bytes, length);
+		return true;
+	}
+	bool getBytes(const char** bytes, uint32_t* length) {
+		if (!get(length) || size_t(end - pos) < *length)
+			return false;
+		*bytes = pos;
+		pos += *length;
+		return true;
+	}
+
+private:
+	const char* pos;
+	const char* end;
+};
+
+struct Core {
+	uint64_t hash;
+	int64_t time;
+	std::string plugin;
+	int32_t code;
+	std::string message;
+	struct frame_s {
+		bool scripted;
+		cell_t cip;
+		cell_t frm;
+		uint32_t line;
+		std::string function;
+		std::string file;
+	};
+	std::vector<frame_s> frames;
+	// The saved stack, mapped, and the plugin address it starts at.
+	cell_t sp;
+	const char* stack;
+	uint32_t stack_size;
+};
+
+static bool parse_core(const MappedFile& file, Core* core) {
+	CoreReader in(file.base, file.size);
+	uint32_t magic, version, count;
+	if (!in.get(&magic) || magic != SCRIPT_CORE_MAGIC || !in.get(&version) ||
+		version != SCRIPT_CORE_VERSION)
+		return false;
+	if (!in.get(&core->hash) || !in.get(&core->time) || !in.getString(&core->plugin) ||
+		!in.get(&core->code) || !in.getString(&core->message) || !in.get(&count))
+		return false;
+	for (uint32_t i = 0; i < count; i++) {
+		Core::frame_s frame;
+		uint8_t scripted;
+		if (!in.get(&scripted) || !in.get(&frame.cip) || !in.get(&frame.frm) ||
+			!in.get(&frame.line) || !in.getString(&frame.function) || !in.getString(&frame.file))
+			return false;
+		frame.scripted = scripted != 0;
+		core->frames.push_back(std::move(frame));
+	}
+	return in.get(&core->sp) && in.getBytes(&core->stack, &core->stack_size);
+}
+
+// The plugin's memory as far as the core has it: the stack in use.
+class CoreMemory : public SnapshotPlan::Memory {
+public:
+	explicit CoreMemory(const Core& core) : core(core) {
+	}
+
+	const cell_t* cells(cell_t addr, uint32_t count) const override {
+		if (addr < core.sp || addr % sizeof(cell_t) ||
+			uint64_t(addr - core.sp) + uint64_t(count) * sizeof(cell_t) > core.stack_size)
+			return nullptr;
+		return reinterpret_cast<const cell_t*>(core.stack + (addr - core.sp));
+	}
+
+	const char* string(cell_t addr, size_t max, size_t* length) const override {
+		if (addr < core.sp || uint32_t(addr - core.sp) >= core.stack_size)
+			return nullptr;
+		const char* str = core.stack + (addr - core.sp);
+		size_t room = core.stack_size - (addr - core.sp);
+		*length = strnlen(str, std::min(max, room));
+		return str;
+	}
+
+private:
+	const Core& core;
+};
+
+static uint64_t file_hash(const std::string& path) {
+	std::ifstream in(path, std::ios::binary);
+	SourcePawn::ImageHasher hasher;
+	char chunk[64 * 1024];
+	while (in.read(chunk, sizeof(chunk)) || in.gcount())
+		hasher.update(chunk, size_t(in.gcount()));
+	return hasher.digest();
+}
+
+// Messages are built as the server builds them: a length placeholder, the
+// type, then the payload.
+class Message {
+public:
+	explicit Message(MessageType type) : bytes(5) {
+		bytes[4] = char(type);
+	}
+	Message& putInt(int32_t value) {
+		const char* p = (const char*)&value;
+		bytes.insert(bytes.end(), p, p + sizeof(value));
+		return *this;
+	}
+	Message& putString(const std::string& value) {
+		putInt(int32_t(value.size() + 1));
+		bytes.insert(bytes.end(), value.c_str(), value.c_str() + value.size() + 1);
+		return *this;
+	}
+	Message& putVariable(const SnapshotPlan::value_s& var) {
+		return putString(var.name).putString(var.value).putString(var.type).putInt(0);
+	}
+
+	bool send(socket_t fd) {
+		uint32_t length = uint32_t(bytes.size() - 5);
+		memcpy(bytes.data(), &length, sizeof(length));
+		size_t sent = 0;
+		while (sent < bytes.size()) {
+			int rv = ::send(fd, bytes.data() + sent, int(bytes.size() - sent), 0);
+			if (rv <= 0)
+				return false;
+			sent += rv;
+		}
+		return true;
+	}
+
+private:
+	std::vector<char> bytes;
+};
+
+// Reads the payload of a client message, with the server's framing.
+class Payload {
+public:
+	Payload(const char* data, size_t size) : pos(data), end(data + size) {
+	}
+
+	int32_t getInt() {
+		int32_t value = 0;
+		if (size_t(end - pos) >= sizeof(value)) {
+			memcpy(&value, pos, sizeof(value));
+			pos += sizeof(value);
+		}
+		return value;
+	}
+	std::string getString() {
+		int32_t length = getInt();
+		if (length <= 0 || size_t(end - pos) < size_t(length))
+			return std::string();
+		std::string value(pos, strnlen(pos, size_t(length)));
+		pos += length;
+		return value;
+	}
+
+private:
+	const char* pos;
+	const char* end;
+};
+
+class Session {
+public:
+	Session(socket_t fd, const Core& core, sp::SmxV1Image& image)
+		: fd(fd), core(core), image(image) {
+	}
+
+	bool handle(unsigned char type, Payload& in) {
+		switch (type) {
+		case Hello: {
+			in.getInt();
+			uint32_t wanted = uint32_t(in.getInt());
+			return Message(Capabilities).putInt(PROTOCOL_VERSION)
+				.putInt(int32_t(wanted & CapFrameScopes)).send(fd);
+		}
+		case StartDebugging:
+		case Pause:
+			return Message(HasStopped).putString("exception").putString("exception")
+				.putString(core.message).send(fd);
+		case RequestCallStack: {
+			Message msg(CallStack);
+			msg.putInt(int32_t(core.frames.size()));
+			for (const auto& frame : core.frames)
+				msg.putString(frame.function).putString(frame.file).putInt(frame.scripted ? frame.line : 0);
+			return msg.send(fd);
+		}
+		case RequestVariables: {
+			// "<frame>:%local%"; the globals were not saved.
+			auto scope = in.getString();
+			std::vector<SnapshotPlan::value_s> vars;
+			if (strstr(scope.c_str(), ":%local%"))
+				vars = read(atoi(scope.c_str()), {}, true);
+			Message msg(Variables);
+			msg.putString(scope).putInt(int32_t(vars.size()));
+			for (const auto& var : vars)
+				msg.putVariable(var);
+			return msg.send(fd);
+		}
+		case RequestEvaluate: {
+			auto name = in.getString();
+			int frame = in.getInt();
+			auto vars = read(frame, { name }, false);
+			if (vars.empty())
+				vars.push_back({ name, "(not available)", "N/A" });
+			return Message(Evaluate).putVariable(vars[0]).send(fd);
+		}
+		case Disconnect:
+		case StopDebugging:
+			return false;
+		default:
+			return true;
+		}
+	}
+
+private:
+	// Variables of a frame of the failing plugin, bound at its cip.
+	std::vector<SnapshotPlan::value_s> read(int frame_id, const std::vector<std::string>& names,
+		bool locals) {
+		if (frame_id < 0 || size_t(frame_id) >= core.frames.size())
+			return {};
+		auto& frame = core.frames[frame_id];
+		if (!frame.scripted || !frame.cip || !frame.frm)
+			return {};
+		auto plan = SnapshotPlan::bind(&image, uint32_t(frame.cip), names, locals);
+		Snapshot snap;
+		plan->copy(CoreMemory(core), frame.frm, &snap);
+		return plan->format(snap);
+	}
+
+	socket_t fd;
+	const Core& core;
+	sp::SmxV1Image& image;
+};
+
+static void serve(socket_t fd, const Core& core, sp::SmxV1Image& image) {
+	Session session(fd, core, image);
+	std::vector<char> in;
+	char chunk[64 * 1024];
+	while (true) {
+		while (in.size() >= 5) {
+			uint32_t length;
+			memcpy(&length, in.data(), sizeof(length));
+			if (length > MAX_MESSAGE_SIZE - 5)
+				return;
+			if (in.size() - 5 < length)
+				break;
+			Payload payload(in.data() + 5, length);
+			if (!session.handle((unsigned char)in[4], payload))
+				return;
+			in.erase(in.begin(), in.begin() + 5 + length);
+		}
+		int rv = recv(fd, chunk, sizeof(chunk), 0);
+		if (rv <= 0)
+			return;
+		in.insert(in.end(), chunk, chunk + rv);
+	}
+}
+
+int main(int argc, char** argv) {
+	uint16_t port = 27015;
+	std::vector<const char*> paths;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+			port = uint16_t(atoi(argv[++i]));
+		else
+			paths.push_back(argv[i]);
+	}
+	if (paths.size() != 2) {
+		fprintf(stderr, "usage: %s [--port N] core.spcore plugin.smx\n", argv[0]);
+		return 1;
+	}
+
+	MappedFile file;
+	Core core;
+	if (!file.open(paths[0]) || !parse_core(file, &core)) {
+		fprintf(stderr, "%s: not a script core\n", paths[0]);
+		return 1;
+	}
+	sp::SmxV1Image image(paths[1]);
+	if (!image.validate(false)) {
+		fprintf(stderr, "%s: %s\n", paths[1], image.errorMessage());
+		return 1;
+	}
+	if (file_hash(paths[1]) != core.hash)
+		fprintf(stderr, "warning: %s is not the build %s was written by\n", paths[1], core.plugin.c_str());
+	printf("%s: error %d in %s: %s\n", paths[0], core.code, core.plugin.c_str(), core.message.c_str());
+
+#ifdef _WIN32
+	WSADATA wsa;
+	WSAStartup(MAKEWORD(2, 2), &wsa);
+#else
+	signal(SIGPIPE, SIG_IGN);
+#endif
+	socket_t listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	int one = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&one, sizeof(one));
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if (listener == INVALID_SOCKET || bind(listener, (const sockaddr*)&addr, sizeof(addr)) != 0 ||
+		listen(listener, 1) != 0) {
+		fprintf(stderr, "could not listen on port %u\n", port);
+		return 1;
+	}
+
+	// One adapter at a time, as often as they come.
+	while (true) {
+		socket_t fd = accept(listener, nullptr, nullptr);
+		if (fd == INVALID_SOCKET)
+			continue;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char*)&one, sizeof(one));
+		serve(fd, core, image);
+		close_socket(fd);
+	}
+}
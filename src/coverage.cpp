@@ -0,0 +1,87 @@
+#include "coverage.h"
+#include "imagecache.h"
+#include <filesystem>
+#include <map>
+
+LineCoverage DebugCoverage;
+
+void LineCoverage::enable(bool on) {
+	std::lock_guard<std::mutex> lock(mtx);
+	if (on && !enabled) {
+		for (auto& plugin : plugins) {
+			for (size_t i = 0; i < plugin.second->size; i++)
+				plugin.second->counts[i].store(0, std::memory_order_relaxed);
+		}
+	}
+	enabled = on;
+}
+
+LineCoverage::counts_s* LineCoverage::countsOf(SourcePawn::IPluginContext* ctx) {
+	auto found = plugins.find(ctx);
+	if (found != plugins.end())
+		return found->second.get();
+
+	// Looked up once; a plugin without an image keeps an empty entry.
+	auto entry = std::make_unique<counts_s>();
+	entry->runtime = ctx->GetRuntime();
+	entry->image = DebugImages.get(entry->runtime);
+	entry->hash = DebugImages.hash(entry->runtime);
+	entry->size = entry->image ? entry->image->DescribeCode().length / sizeof(cell_t) : 0;
+	entry->counts = std::make_unique<std::atomic<uint32_t>[]>(entry->size);
+
+	std::lock_guard<std::mutex> lock(mtx);
+	return plugins.emplace(ctx, std::move(entry)).first->second.get();
+}
+
+void LineCoverage::forget(SourcePawn::IPluginContext* ctx) {
+	std::lock_guard<std::mutex> lock(mtx);
+	plugins.erase(ctx);
+	if (last_context == ctx) {
+		last_context = nullptr;
+		last_counts = nullptr;
+	}
+}
+
+template <typename Fn> void LineCoverage::forEachLine(bool reset, Fn&& fn) {
+	std::lock_guard<std::mutex> lock(mtx);
+	for (auto& plugin : plugins) {
+		auto& entry = *plugin.second;
+		if (!entry.image)
+			continue;
+
+		// Every line-table entry is listed, so lines never run show up
+		// with a zero count. A line may have several BREAKs.
+		std::vector<uint32_t> addrs;
+		entry.image->GetLineAddresses(0, entry.size * sizeof(cell_t), &addrs);
+		std::map<std::pair<uint32_t, uint32_t>, uint64_t> counts;
+		for (auto addr : addrs) {
+			uint32_t file, line;
+			if (!entry.image->LookupLocation(addr, &file, &line))
+				continue;
+			auto& counter = entry.counts[addr / sizeof(cell_t)];
+			counts[{ file, line }] += counter.load(std::memory_order_relaxed);
+			if (reset)
+				counter.store(0, std::memory_order_relaxed);
+		}
+		for (auto& count : counts) {
+			uint32_t file = count.first.first;
+			const char* name = file < entry.image->GetFileCount()
+				? entry.image->GetFileName(file) : nullptr;
+			fn(entry, name, count.first.second, count.second);
+		}
+	}
+}
+
+std::vector<LineCoverage::line_s> LineCoverage::snapshot(bool reset) {
+	std::vector<line_s> lines;
+	forEachLine(reset, [&](const counts_s& entry, const char* name, uint32_t line, uint64_t count) {
+		lines.push_back({ name ? std::filesystem::path(name).filename().string() : "?", line, count });
+	});
+	return lines;
+}
+
+void LineCoverage::collect(CoverageSet* set, bool reset) {
+	forEachLine(reset, [&](const counts_s& entry, const char* name, uint32_t line, uint64_t count) {
+		set->add(entry.hash, name ? name : "?", line, count);
+	});
+}
@@ -0,0 +1,86 @@
+#ifndef _INCLUDE_COVERAGE_H_
+#define _INCLUDE_COVERAGE_H_
+
+#include <sp_vm_api.h>
+#include "smx-v1-image.h"
+#include "coveragefile.h"
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//
+//  Per-line execution counters. Every BREAK that reaches the debugger bumps
+//  the counter of its code cell; counters are only mapped to lines when
+//  they are read, so a hit costs one increment.
+//
+class LineCoverage {
+public:
+	struct line_s {
+		std::string file;
+		uint32_t line;
+		uint64_t count;
+	};
+
+	// Starts or stops counting. Starting drops the previous counts.
+	void enable(bool on);
+
+	bool active() const {
+		return enabled.load(std::memory_order_relaxed);
+	}
+
+	// Counts a BREAK. Main thread only.
+	void hit(SourcePawn::IPluginContext* ctx, cell_t cip) {
+		if (ctx != last_context) {
+			last_context = ctx;
+			last_counts = countsOf(ctx);
+		}
+		if (!last_counts || uint32_t(cip) / sizeof(cell_t) >= last_counts->size)
+			return;
+		auto& counter = last_counts->counts[cip / sizeof(cell_t)];
+		counter.store(counter.load(std::memory_order_relaxed) + 1,
+			std::memory_order_relaxed);
+	}
+
+	// The lines hit so far, by file and line, optionally starting over.
+	// Safe to call from any thread.
+	std::vector<line_s> snapshot(bool reset);
+
+	// Adds the lines hit so far to |set| by image hash and the file name
+	// the debug info has, optionally starting over. Safe to call from any
+	// thread.
+	void collect(CoverageSet* set, bool reset);
+
+	// Drops an unloading plugin's counters. Main thread only.
+	void forget(SourcePawn::IPluginContext* ctx);
+
+private:
+	struct counts_s {
+		SourcePawn::IPluginRuntime* runtime;
+		std::shared_ptr<sp::SmxV1Image> image;
+		uint64_t hash;
+		size_t size;
+		std::unique_ptr<std::atomic<uint32_t>[]> counts;
+	};
+
+	counts_s* countsOf(SourcePawn::IPluginContext* ctx);
+
+	// Calls |fn(entry, file, line, count)| for every line of every plugin
+	// with an image, under mtx.
+	template <typename Fn> void forEachLine(bool reset, Fn&& fn);
+
+	std::atomic<bool> enabled{ false };
+	// Written by the main thread under mtx; the main thread reads it
+	// without.
+	std::mutex mtx;
+	std::unordered_map<SourcePawn::IPluginContext*, std::unique_ptr<counts_s>> plugins;
+	SourcePawn::IPluginContext* last_context = nullptr;
+	counts_s* last_counts = nullptr;
+};
+
+extern LineCoverage DebugCoverage;
+
+#endif //_INCLUDE_COVERAGE_H_
@@ -0,0 +1,142 @@
+#include "coveragefile.h"
+#include <inttypes.h>
+#include <string.h>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+void CoverageSet::merge(const CoverageSet& other) {
+	sources += other.sources;
+	for (const auto& file : other.files) {
+		auto& lines = files[file.first];
+		for (const auto& line : file.second)
+			lines[line.first] += line.second;
+	}
+}
+
+namespace {
+// Reads packed values off the front of a buffer, failing once it runs out.
+class Reader {
+public:
+	Reader(const char* data, size_t size) : data(data), left(size) {
+	}
+
+	template <typename T> bool get(T* value) {
+		return bytes(value, sizeof(T));
+	}
+	bool bytes(void* out, size_t length) {
+		if (length > left)
+			return false;
+		memcpy(out, data, length);
+		data += length;
+		left -= length;
+		return true;
+	}
+
+private:
+	const char* data;
+	size_t left;
+};
+
+template <typename T> void put(std::ofstream& out, T value) {
+	out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+} // namespace
+
+bool CoverageSet::read(const std::string& path, std::string* error) {
+	std::ifstream in(path, std::ios::binary);
+	if (!in) {
+		*error = "can't be opened";
+		return false;
+	}
+	std::vector<char> contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	Reader reader(contents.data(), contents.size());
+
+	CoverageFileHeader header;
+	if (!reader.get(&header) || header.magic != COVERAGE_FILE_MAGIC) {
+		*error = "not a coverage file";
+		return false;
+	}
+	if (header.version != COVERAGE_FILE_VERSION) {
+		*error = "unsupported coverage file version " + std::to_string(header.version);
+		return false;
+	}
+
+	// Parsed aside, so a truncated file adds nothing.
+	CoverageSet parsed;
+	parsed.sources = header.sources;
+	for (uint32_t i = 0; i < header.file_count; i++) {
+		uint64_t image;
+		uint32_t name_length, line_count;
+		if (!reader.get(&image) || !reader.get(&name_length) || !reader.get(&line_count) ||
+			name_length > contents.size()) {
+			*error = "truncated";
+			return false;
+		}
+		std::string name(name_length, '\0');
+		if (!reader.bytes(&name[0], name_length)) {
+			*error = "truncated";
+			return false;
+		}
+		auto& lines = parsed.files[{ image, name }];
+		for (uint32_t j = 0; j < line_count; j++) {
+			uint32_t line;
+			uint64_t hits;
+			if (!reader.get(&line) || !reader.get(&hits)) {
+				*error = "truncated";
+				return false;
+			}
+			lines[line] += hits;
+		}
+	}
+	merge(parsed);
+	return true;
+}
+
+bool CoverageSet::write(const std::string& path) const {
+	std::string temp = path + ".tmp";
+	{
+		std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+		if (!out)
+			return false;
+		CoverageFileHeader header = { COVERAGE_FILE_MAGIC, COVERAGE_FILE_VERSION, sources,
+			uint32_t(files.size()) };
+		put(out, header);
+		for (const auto& file : files) {
+			put<uint64_t>(out, file.first.first);
+			put<uint32_t>(out, uint32_t(file.first.second.size()));
+			put<uint32_t>(out, uint32_t(file.second.size()));
+			out.write(file.first.second.data(), file.first.second.size());
+			for (const auto& line : file.second) {
+				put<uint32_t>(out, line.first);
+				put<uint64_t>(out, line.second);
+			}
+		}
+		if (!out.flush())
+			return false;
+	}
+	std::error_code ec;
+	std::filesystem::rename(temp, path, ec);
+	if (ec) {
+		std::filesystem::remove(temp, ec);
+		return false;
+	}
+	return true;
+}
+
+void CoverageSet::writeLcov(FILE* out) const {
+	for (const auto& file : files) {
+		fprintf(out, "TN:%016" PRIx64 "\n", file.first.first);
+		fprintf(out, "SF:%s\n", file.first.second.c_str());
+		uint32_t hit = 0;
+		for (const auto& line : file.second) {
+			fprintf(out, "DA:%u,%" PRIu64 "\n", line.first, line.second);
+			if (line.second)
+				hit++;
+		}
+		fprintf(out, "LH:%u\n", hit);
+		fprintf(out, "LF:%zu\n", file.second.size());
+		fprintf(out, "end_of_record\n");
+	}
+}
@@ -0,0 +1,76 @@
+#ifndef _INCLUDE_COVERAGEFILE_H_
+#define _INCLUDE_COVERAGEFILE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <utility>
+
+#define COVERAGE_FILE_MAGIC 0x56435053	// "SPCV"
+#define COVERAGE_FILE_VERSION 1
+
+//
+//  Line hit counts that add up across servers and over time. Lines are
+//  keyed by the image hash (sp_image_hash.h) of the plugin they were
+//  counted in and the source file its debug info names, so the same build
+//  on different servers sums into one set of lines and a rebuilt plugin
+//  gets its own. A file holds:
+//
+//    the header, then |file_count| times
+//      [uint64 image hash][uint32 name length][uint32 line count][name]
+//      and |line count| times [uint32 line][uint64 hits]
+//
+//  in host byte order, packed. |sources| counts the server exports summed
+//  into the file.
+//
+struct CoverageFileHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t sources;
+	uint32_t file_count;
+};
+
+class CoverageSet {
+public:
+	typedef std::pair<uint64_t, std::string> key_t;
+
+	// Adds hits to a line, listing it even for 0 hits.
+	void add(uint64_t image, const std::string& file, uint32_t line, uint64_t hits) {
+		files[{ image, file }][line] += hits;
+	}
+
+	// Counts this set as one more server's export.
+	void addSource() {
+		sources++;
+	}
+
+	// Sums |other| into this set.
+	void merge(const CoverageSet& other);
+
+	// Reads a file written by write(), summing it into this set; false with
+	// |error| set if it isn't one.
+	bool read(const std::string& path, std::string* error);
+
+	// Writes through a temporary file renamed over |path|, so a reader
+	// collecting exports never sees half of one.
+	bool write(const std::string& path) const;
+
+	// Writes lcov tracefile records, one per source file and image, the
+	// image hash being the test name.
+	void writeLcov(FILE* out) const;
+
+	uint32_t sourceCount() const {
+		return sources;
+	}
+
+	bool empty() const {
+		return files.empty();
+	}
+
+private:
+	uint32_t sources = 0;
+	std::map<key_t, std::map<uint32_t, uint64_t>> files;
+};
+
+#endif //_INCLUDE_COVERAGEFILE_H_
@@ -0,0 +1,66 @@
+//
+//  Sums coverage exports written with "sm debugger coverage export" on any
+//  number of servers, into one export that can be merged again or into an
+//  lcov tracefile for genhtml and coverage services. Lines are matched by
+//  plugin image hash and source file, so only servers running the same
+//  build of a plugin add up.
+//
+//  usage: sm_debugger_coverage_merge [-o merged.spcov] [-l merged.info] a.spcov ...
+//
+//  With neither output given, the lcov records go to stdout.
+//
+#include "coveragefile.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+int main(int argc, char** argv) {
+	std::string merged_path, lcov_path;
+	std::vector<const char*> inputs;
+	for (int i = 1; i < argc; i++) {
+		if ((strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "-l") == 0) && i + 1 < argc) {
+			(argv[i][1] == 'o' ? merged_path : lcov_path) = argv[i + 1];
+			i++;
+			continue;
+		}
+		inputs.push_back(argv[i]);
+	}
+	if (inputs.empty()) {
+		fprintf(stderr, "usage: %s [-o merged.spcov] [-l merged.info] a.spcov ...\n", argv[0]);
+		return 1;
+	}
+
+	// A bad export is skipped rather than failing a fleet-wide report.
+	CoverageSet merged;
+	size_t skipped = 0;
+	for (const char* input : inputs) {
+		std::string error;
+		if (!merged.read(input, &error)) {
+			fprintf(stderr, "warning: %s: %s\n", input, error.c_str());
+			skipped++;
+		}
+	}
+	if (skipped == inputs.size()) {
+		fprintf(stderr, "no coverage exports read\n");
+		return 1;
+	}
+
+	if (!merged_path.empty() && !merged.write(merged_path)) {
+		fprintf(stderr, "%s: can't be written\n", merged_path.c_str());
+		return 1;
+	}
+	if (!lcov_path.empty() || merged_path.empty()) {
+		FILE* out = lcov_path.empty() ? stdout : fopen(lcov_path.c_str(), "w");
+		if (!out) {
+			fprintf(stderr, "%s: can't be written\n", lcov_path.c_str());
+			return 1;
+		}
+		merged.writeLcov(out);
+		if (out != stdout)
+			fclose(out);
+	}
+	fprintf(stderr, "merged %u server exports from %zu files\n", merged.sourceCount(),
+		inputs.size() - skipped);
+	return 0;
+}
@@ -1,4 +1,5 @@
 ﻿#include "debugger.h"
+#include "protocol.h"
 #include <assert.h>
 #include <ctype.h>
 #include <deque>
@@ -11,12 +12,50 @@
 #include <time.h>
 #include <vector>
 #include "utlbuffer.h"
+#include "breakpoints.h"
+#include "imagecache.h"
+#include "fileids.h"
+#include "condition.h"
+#include "snapshot.h"
+#include "scriptcore.h"
+#include "sendbuffer.h"
+#include "eventpipe.h"
+#include "profiler.h"
+#include "coverage.h"
+#include "spikecapture.h"
+#include "functiontrace.h"
+#include "tracefile.h"
+#include "nativeprofiler.h"
+#include "nativebreaks.h"
+#include "publicbreaks.h"
+#include "publicprofiler.h"
+#include "heapprofiler.h"
+#include "recorder.h"
+#include "overhead.h"
+#include "plugincpu.h"
+#include "sourcecache.h"
+#include "disassembly.h"
+#include "metrics.h"
+#include "sharedring.h"
+#include "workerpool.h"
+#include "requestscheduler.h"
+#include "stoparena.h"
+#include "localsocket.h"
+#include <sp_image_hash.h>
+#include <algorithm>
 #include <fstream>
 #include <unordered_map>
 #include <unordered_set>
 #include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <filesystem>
 #include <fmt/printf.h>
+#include <cmath>
+#include <iterator>
+#include <optional>
+#include <zlib.h>
 
 #include <brynet/net/EventLoop.hpp>
 #include <brynet/net/ListenThread.hpp>
@@ -24,11 +63,12 @@
 #include <brynet/net/SocketLibFunction.hpp>
 #include <brynet/net/TcpService.hpp>
 #include <brynet/net/http/HttpFormat.hpp>
+#include <brynet/net/http/HttpService.hpp>
 #include <brynet/net/wrapper/ConnectionBuilder.hpp>
+#include <brynet/net/wrapper/HttpServiceBuilder.hpp>
 #include <brynet/net/wrapper/ServiceBuilder.hpp>
 
 #include "sourcepawn/include/sp_vm_types.h"
-#include <nlohmann/json.hpp>
 
 using namespace sp;
 using namespace brynet;
@@ -46,50 +86,114 @@ std::basic_string<T> lowercase(const std::basic_string<T>& s)
 	return std::move(s2);
 }
 
-enum DebugState {
-	DebugDead = -1,
-	DebugRun = 0,
-	DebugBreakpoint,
-	DebugPause,
-	DebugStepIn,
-	DebugStepOver,
-	DebugStepOut,
-	DebugException
-};
-enum MessageType {
-	Diagnostics = 0,
-	RequestFile,
-	File,
-
-	StartDebugging,
-	StopDebugging,
-	Pause,
-	Continue,
-
-	RequestCallStack,
-	CallStack,
-
-	ClearBreakpoints,
-	SetBreakpoint,
+//
+//  JSON text helpers for variable values, written without building a DOM.
+//
+static void write_json_string(std::string& out, const char* str)
+{
+	out += '"';
+	for (; *str; str++) {
+		unsigned char c = *str;
+		switch (c) {
+		case '"': out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\b': out += "\\b"; break;
+		case '\f': out += "\\f"; break;
+		case '\n': out += "\\n"; break;
+		case '\r': out += "\\r"; break;
+		case '\t': out += "\\t"; break;
+		default:
+			if (c < 0x20)
+				fmt::format_to(std::back_inserter(out), "\\u{:04x}", c);
+			else
+				out += c;
+			break;
+		}
+	}
+	out += '"';
+}
 
-	HasStopped,
-	HasContinued,
+// Chrome's trace event format: a B and an E event per call, timed in
+// microseconds, all on the one VM thread.
+static std::string formatChromeTrace(const std::vector<FunctionTrace::event_s>& events)
+{
+	std::string out = "{\"traceEvents\":[";
+	for (size_t i = 0; i < events.size(); i++) {
+		if (i)
+			out += ',';
+		out += "{\"name\":";
+		write_json_string(out, events[i].name.c_str());
+		fmt::format_to(std::back_inserter(out), ",\"ph\":\"{}\",\"ts\":{:.3f},\"pid\":1,\"tid\":1}}",
+			events[i].enter ? 'B' : 'E', events[i].timestamp / 1000.0);
+	}
+	out += "]}";
+	return out;
+}
 
-	StepOver,
-	StepIn,
-	StepOut,
+static void write_json_float(std::string& out, float value)
+{
+	if (!std::isfinite(value)) {
+		out += "null";
+		return;
+	}
+	size_t start = out.size();
+	// Shortest text that reads back as the same float.
+	fmt::format_to(std::back_inserter(out), "{}", value);
+	// Keep whole numbers recognizable as floats.
+	if (out.find_first_of(".e", start) == std::string::npos)
+		out += ".0";
+}
 
-	RequestSetVariable,
-	SetVariable,
-	RequestVariables,
-	Variables,
+// As write_json_float, but for display: not-a-numbers are spelled out.
+static void write_display_float(std::string& out, float value)
+{
+	if (std::isfinite(value))
+		write_json_float(out, value);
+	else
+		fmt::format_to(std::back_inserter(out), "{}", (double)value);
+}
 
-	RequestEvaluate,
-	Evaluate,
+// Whether |length| bytes read as text: a letter first, and only ASCII with
+// no control characters but line breaks and tabs. Counting rather than stopping at the
+// first bad byte keeps the loop vectorizable.
+static bool looks_like_text(const char* str, size_t length)
+{
+	if (!length || !isalpha((unsigned char)str[0]))
+		return false;
+	size_t bad = 0;
+	for (size_t i = 0; i < length; i++) {
+		unsigned char c = str[i];
+		bad += c >= 0x80 || (c < ' ' && c != '\n' && c != '\r' && c != '\t');
+	}
+	return bad == 0;
+}
 
-	Disconnect,
-	TotalMessages
-};
+// Formats |count| contiguous cells as JSON numbers into a buffer sized once
+// for the lot, |lead| before the first and |separator| before the rest.
+static void write_cells(std::string& out, const cell_t* cells, uint32_t count,
+	bool floats, std::string_view lead, std::string_view separator)
+{
+	out.reserve(out.size() + count * (12 + separator.size()));
+	fmt::memory_buffer buf;
+	for (uint32_t i = 0; i < count; i++) {
+		auto gap = i ? separator : lead;
+		buf.append(gap.data(), gap.data() + gap.size());
+		if (!floats) {
+			fmt::format_to(std::back_inserter(buf), "{}", cells[i]);
+			continue;
+		}
+		float value = sp_ctof(cells[i]);
+		if (!std::isfinite(value)) {
+			fmt::format_to(std::back_inserter(buf), "null");
+			continue;
+		}
+		size_t start = buf.size();
+		fmt::format_to(std::back_inserter(buf), "{}", value);
+		if (std::string_view(buf.data() + start, buf.size() - start).find_first_of(".e") == std::string_view::npos)
+			fmt::format_to(std::back_inserter(buf), ".0");
+	}
+	out.append(buf.data(), buf.size());
+}
 
 std::vector<std::string> split_string(const std::string& str,
 	const std::string& delimiter) {
@@ -107,48 +211,408 @@ std::vector<std::string> split_string(const std::string& str,
 
 	return strings;
 }
+//
+//  A logpoint message, split into literal text and {expression} parts at
+//  the time it is set. "{{" and "}}" stand for literal braces.
+//
+struct log_part_s {
+	std::string text;
+	bool is_expr;
+};
+
+static std::vector<log_part_s> parse_log_message(std::string_view message) {
+	std::vector<log_part_s> parts;
+	std::string text;
+	for (size_t i = 0; i < message.size(); i++) {
+		char c = message[i];
+		if ((c == '{' || c == '}') && i + 1 < message.size() && message[i + 1] == c) {
+			text += c;
+			i++;
+			continue;
+		}
+		auto close = c == '{' ? message.find('}', i + 1) : std::string_view::npos;
+		if (close == std::string_view::npos) {
+			text += c;
+			continue;
+		}
+		if (!text.empty())
+			parts.push_back({ std::move(text), false });
+		text.clear();
+		parts.push_back({ std::string(message.substr(i + 1, close - i - 1)), true });
+		i = close;
+	}
+	if (!text.empty())
+		parts.push_back({ std::move(text), false });
+	return parts;
+}
+
+// Room for what the game thread produces between two flushes, per client.
+#define EVENT_PIPE_BYTES (64 * 1024)
+#define MAX_SNAPSHOT_BACKLOG 64
+// How often errors that didn't stop are summarized to the client.
+#define ERROR_SUMMARY_INTERVAL std::chrono::seconds(1)
+// Shortest profiler sampling interval, in microseconds.
+#define MIN_PROFILE_INTERVAL 100
+// How often the debug thread sends buffered logpoint output and folds
+// profiler samples, about once per tick.
+#define FLUSH_INTERVAL_MS 15
+
 DebugReport DebugListener;
 void removeClientID(const TcpConnection::Ptr& session);
-class DebuggerClient {
+
+// Set whenever breakpoints or a client's run state change, so the BREAK sites
+// are re-armed on the main thread.
+std::atomic<bool> break_sites_dirty(true);
+
+// Starts or stops line coverage, arming every break site while it runs.
+// Safe to call from any thread.
+void SetCoverage(bool on) {
+	DebugCoverage.enable(on);
+	break_sites_dirty = true;
+}
+
+// Set whenever breakpoints or the plugins change, so clients are told which
+// breakpoints bind to code, and where, from the main thread.
+std::atomic<bool> breakpoints_unverified(true);
+
+// Set whenever watchpoints, a client's files or the plugins change, so the
+// VM's data watch ranges are rebuilt on the main thread.
+std::atomic<bool> data_watches_dirty(true);
+// Whether the VM checks stores against data watch ranges.
+bool data_watchpoints = false;
+// Whether loaded plugins are handed to the VM's background compiler.
+bool background_compile = false;
+
+// Bumped whenever a client's file set changes or a client comes or goes, so
+// DebugHandler knows its per-plugin list of interested clients is stale.
+std::atomic<uint32_t> client_files_generation(1);
+
+// When the game thread entered the debugger for the current break or error,
+// so a stop can say how long deciding to stop took. Game thread only.
+std::chrono::steady_clock::time_point hook_entered;
+
+// Timestamps on the wire: nanoseconds on the server's monotonic clock.
+static uint64_t monotonicNs(std::chrono::steady_clock::time_point when) {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(when.time_since_epoch()).count();
+}
+
+static uint32_t elapsedNs(std::chrono::steady_clock::time_point from,
+	std::chrono::steady_clock::time_point to) {
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count();
+	return static_cast<uint32_t>(std::clamp<int64_t>(ns, 0, UINT32_MAX));
+}
+
+// Set whenever a client's native breakpoints change or it goes, so the set
+// of natives to intercept is gathered again on the main thread.
+std::atomic<bool> native_breaks_dirty(false);
+// The same for public breakpoints and the publics to arm.
+std::atomic<bool> public_breaks_dirty(false);
+
+// Connected observers. While there are none, nothing is serialized for them.
+std::atomic<int> observer_count(0);
+// Hands one serialized message to every observer's queue.
+void fanOutToObservers(SendQueue::priority_e priority, const std::shared_ptr<std::string>& data);
+
+// Opened by the first client that is done sending its breakpoints, so
+// loading can go on as soon as that client can catch the first break.
+static std::mutex startup_mtx;
+static std::condition_variable startup_cv;
+static std::atomic<bool> startup_ready{ false };
+
+static void openStartupGate() {
+	if (startup_ready.load(std::memory_order_relaxed))
+		return;
+	{
+		std::lock_guard<std::mutex> lock(startup_mtx);
+		startup_ready = true;
+	}
+	startup_cv.notify_all();
+}
+
+// Blocks until a client opened the gate or |seconds| passed. Returns
+// whether a client did.
+bool WaitForClient(float seconds) {
+	if (seconds <= 0)
+		return startup_ready;
+	std::unique_lock<std::mutex> lock(startup_mtx);
+	return startup_cv.wait_for(lock, std::chrono::duration<float>(seconds),
+		[] { return startup_ready.load(); });
+}
+class DebuggerClient : public std::enable_shared_from_this<DebuggerClient> {
 public:
 	TcpConnection::Ptr socket;
-	std::unordered_set <std::string> files;
+	SendBufferPool send_pool;
+	// Everything sent to the client goes through here, so a slow one
+	// costs bounded memory and no waiting.
+	SendQueue outbound{ [this](std::shared_ptr<std::string> data) {
+		if (socket)
+			socket->send(std::move(data));
+	} };
+	// What the client asked for, run in turn with the other clients.
+	std::shared_ptr<RequestScheduler::Stream> requests = DebugRequests.open();
+	// Outgoing buffers at least this large are deflated into a Compressed
+	// message; 0 until the client asks for it.
+	std::atomic<uint32_t> compress_threshold{ 0 };
+	// String values are cut after this many bytes.
+	std::atomic<uint32_t> string_limit{ DEFAULT_STRING_LIMIT };
+	// Capabilities negotiated through Hello; 0 for legacy adapters.
+	uint32_t capabilities = 0;
+	uint32_t extended_capabilities = 0;
+	// Round trip of the last answered Heartbeat, 0 before the first.
+	std::atomic<uint64_t> rtt_ns{ 0 };
+	// Negotiated CapObserver: never stops the game thread and only gets
+	// what the other clients are sent.
+	std::atomic<bool> observer{ false };
+	// Breakpoint ids and the line each was last reported at, 0 while
+	// unverified. Main thread only; a new Hello asks for all of them again.
+	std::unordered_map<int, uint32_t> verified_sent;
+	std::atomic<bool> verified_reset{ false };
+	// Bytes and messages on the wire, and how long this client held the
+	// game thread at its stops.
+	OverheadCounters::traffic_s traffic;
+	// Large messages to a local client, once it shares a ring.
+	SharedRing shared_ring;
+	int client_version = 0;
+	std::unordered_set<uint32_t> files;
 	int DebugState = 0;
 
 	struct variable_s {
 		std::string name;
 		std::string value;
 		std::string type;
+		// Handle for RequestChildren, or 0 if the value has no children.
+		uint32_t children = 0;
 	};
 
 	struct call_stack_s {
 		uint32_t line;
 		std::string name;
 		std::string filename;
+		// DebugFiles id, or kNoFile for native frames.
+		uint32_t file = FileIdTable::kNoFile;
+		// Frame and code address of a scripted frame of the stopped
+		// plugin, or 0 if unknown.
+		cell_t frm = 0;
+		cell_t cip = 0;
 	};
 
 	struct breakpoint_s {
-		long line;
-		std::string filename;
+		int id = 0;
+		// A logpoint appends its message to the log instead of stopping.
+		bool is_logpoint = false;
+		std::vector<log_part_s> message;
+		// Stops (or logs) only when this holds; empty for always.
+		Condition condition;
+		// With a hit count, only the hit_count-th hit where the condition
+		// held counts, or every hit_count-th one with hit_every. The counter
+		// is shared by the copies in later tables and restarts when the
+		// breakpoint is set again.
+		uint32_t hit_count = 0;
+		bool hit_every = false;
+		std::shared_ptr<std::atomic<uint32_t>> hits =
+			std::make_shared<std::atomic<uint32_t>>(0);
+		// A temporary breakpoint is taken once, then removed from the
+		// table. |spent| is shared like |hits| and marks the hit.
+		bool temporary = false;
+		std::shared_ptr<std::atomic<bool>> spent =
+			std::make_shared<std::atomic<bool>>(false);
+		// A snapshot point never stops: a hit copies the locals, these
+		// globals and the call stack, and the debug thread sends them.
+		bool is_snapshot = false;
+		std::vector<std::string> globals;
+
+		bool countHit() const {
+			if (!hit_count)
+				return true;
+			uint32_t hit = ++*hits;
+			return hit_every ? hit % hit_count == 0 : hit == hit_count;
+		}
+
+		// Whether this hit is the one a temporary breakpoint is taken on.
+		bool claim() const {
+			return !temporary || !spent->exchange(true);
+		}
+	};
+
+	// Breakpoint lines per file id. A table is immutable once published;
+	// the network thread publishes edited copies and the game thread picks
+	// up the newest when the generation moves.
+	struct breakpoint_table_s {
+		uint32_t generation = 1;
+		std::unordered_map<uint32_t, std::unordered_map<long, breakpoint_s>> lines;
+		// Function breakpoints by name, on the first line of the function.
+		std::unordered_map<std::string, breakpoint_s> functions;
+		// Native breakpoints by native name, hit by every call to it.
+		std::unordered_map<std::string, breakpoint_s> natives;
+		// Public entry breakpoints by function name, or plugin file name,
+		// "::" and function name.
+		std::unordered_map<std::string, breakpoint_s> publics;
+	};
+
+	// A breakpoint that does more than stop, bound to one plugin: symbols
+	// are looked up once, at the breakpoint's address.
+	struct break_site_s {
+		const breakpoint_s* bp;
+		std::vector<std::optional<SmxV1Image::Symbol>> symbols;
+		Predicate predicate;
+		// Shared with the snapshots taken here until they are sent.
+		std::shared_ptr<const SnapshotPlan> snapshot;
+	};
+
+	// A data breakpoint on a global variable. Its condition and message are
+	// bound at each storing cip, the first time that cip writes.
+	struct watchpoint_s {
+		std::string name;
+		// Watched cells, or 0 for the whole variable.
+		uint32_t cells = 0;
+		breakpoint_s bp;
+	};
+
+	// Watchpoints by id, immutable once published like breakpoint_table_s.
+	struct watch_table_s {
+		std::unordered_map<int, watchpoint_s> watches;
+	};
+
+	// A watchpoint resolved to one plugin's memory.
+	struct watch_range_s {
+		const watchpoint_s* watch;
+		ucell_t addr;
+		ucell_t size;
+		std::unordered_map<cell_t, break_site_s> sites;
+	};
+
+	struct plugin_s {
+		std::shared_ptr<SmxV1Image> image;
+		// Names the build of |image|; clients key what they cache on it.
+		uint64_t image_hash = 0;
+		BreakpointBitmap breakpoints;
+		uint32_t generation = 0;
+		// Line breakpoints that bound here, by id, and the line each stops
+		// at, from the same resolution as |breakpoints|.
+		std::vector<std::pair<int, uint32_t>> verified;
+		// The table the sites point into.
+		std::shared_ptr<const breakpoint_table_s> table;
+		std::unordered_map<cell_t, break_site_s> sites;
+		// Native breakpoints bound at the cips that call them, the first
+		// time each one does.
+		std::unordered_map<cell_t, break_site_s> native_sites;
+		// Public entry breakpoints bound at their function, by function id.
+		std::unordered_map<funcid_t, break_site_s> public_sites;
+		// Set by a public entry breakpoint that stops: the step it starts
+		// stops at the public's first line under this name.
+		std::string entry_stop;
+		// The watch table the ranges point into.
+		std::shared_ptr<const watch_table_s> watch_table;
+		// Held while breakpoints are bound here, so the image's indices
+		// aren't evicted under DebuggerIndexBudget.
+		std::shared_ptr<void> index_pin;
+		std::vector<watch_range_s> watches;
+		// The last line a pause or step went through in this context, so
+		// it doesn't stop twice on one line of one frame.
+		cell_t step_frm = 0;
+		uint32_t step_line = 0;
+		// Frame of the last stop in this context, that a step over or out
+		// compares against. Frames of other contexts are not comparable.
+		cell_t last_frm = 0;
+		// Runtime errors of this context by (file id << 32 | line), and how
+		// many went unstopped since the last summary.
+		struct error_site_s {
+			uint32_t hits = 0;
+			uint32_t pending = 0;
+			std::string message;
+			std::string location;
+		};
+		std::unordered_map<uint64_t, error_site_s> errors;
+		// Summarized arrays by address: the cells seen at the last stop
+		// they were shown in, and at the one before that. At most
+		// kMaxArrayHistories, the ones shown longest ago going first, and
+		// none of arrays over kMaxArrayHistoryCells.
+		struct array_history_s {
+			uint32_t stop = 0;
+			std::vector<cell_t> previous;
+			std::vector<cell_t> seen;
+		};
+		std::unordered_map<const cell_t*, array_history_s> arrays;
+		// Names evaluated in this context and the code range each
+		// resolution holds for, so the hovers and watches sent at every stop
+		// skip the lookup. A null symbol caches a name that isn't visible.
+		struct resolved_s {
+			uint32_t start;
+			uint32_t end;
+			std::optional<SmxV1Image::Symbol> sym;
+		};
+		std::unordered_map<std::string, std::vector<resolved_s>> resolved;
+		// Watch expressions bound in this context, likewise by the code
+		// range the binding holds for. Without a predicate, |error| says why
+		// the expression can't be computed there.
+		struct expression_s {
+			uint32_t start = 0;
+			uint32_t end = UINT32_MAX;
+			std::shared_ptr<const Predicate> predicate;
+			std::string error;
+		};
+		std::unordered_map<std::string, std::vector<expression_s>> expressions;
+	};
+
+	// Which runtime errors stop the client; an empty set matches all.
+	// Plugins and files are FileIdTable ids of their base names.
+	struct exception_filter_s {
+		bool stop = true;
+		bool first_per_site = false;
+		std::unordered_set<int> codes;
+		std::unordered_set<uint32_t> plugins;
+		std::unordered_set<uint32_t> files;
 	};
 
 public:
-	bool unload = false;
 	bool receive_walk_cmd = false;
+	// The breakpoint file's client hit a breakpoint. Game thread only.
+	bool boot_stop = false;
 	std::mutex mtx;
 	std::condition_variable cv;
-	SourcePawn::IPluginContext* context_;
+	SourcePawn::IPluginContext* context_ = nullptr;
 	uint32_t current_line;
-	std::unordered_map<std::string, std::unordered_set<long>> break_list;
+	std::shared_ptr<const breakpoint_table_s> break_table =
+		std::make_shared<breakpoint_table_s>();
+	std::atomic<uint32_t> break_list_generation{ 1 };
+	// Serializes writers of break_table and watch_table.
+	std::mutex break_table_lock;
+	std::shared_ptr<const watch_table_s> watch_table =
+		std::make_shared<watch_table_s>();
+	std::unordered_map<SourcePawn::IPluginContext*, plugin_s> plugins;
 	int current_state = 0;
-	cell_t lastfrm_ = 0;
+	// The context of the last hook and its state, so a run of breaks in
+	// one plugin skips the map lookup. Nodes of |plugins| never move.
+	SourcePawn::IPluginContext* last_ctx_ = nullptr;
+	plugin_s* last_plugin_ = nullptr;
+	// One-shot traps for a step over, out or instruction: the BREAK sites of one plugin
+	// the step can end on. Published by the network thread and armed by the
+	// game thread; they go back to the fast path once the step stops.
+	struct step_traps_s {
+		SourcePawn::IPluginContext* context;
+		std::vector<cell_t> cips;
+	};
+	std::shared_ptr<const step_traps_s> step_traps;
+	std::shared_ptr<const exception_filter_s> exception_filter =
+		std::make_shared<exception_filter_s>();
+	std::chrono::steady_clock::time_point last_error_summary;
 	cell_t cip_;
 	cell_t frm_;
-	std::map<std::string, std::shared_ptr<SmxV1Image>> images;
+	// Frame whose variables are read: the stop point, unless a request
+	// picked an outer frame of the captured stack.
+	cell_t scope_cip_ = 0;
+	cell_t scope_frm_ = 0;
 	std::shared_ptr<SmxV1Image> current_image = nullptr;
 	SourcePawn::IFrameIterator* debug_iter;
 	DebuggerClient(const TcpConnection::Ptr& tcp_connection)
 		: socket(tcp_connection) {
+		outbound.setDropNotice(dropNotice);
+	}
+
+	// What the client is called in tables and scrapes. The client without a
+	// socket holds the breakpoint file.
+	std::string address() const {
+		return socket ? socket->getIP() : std::string("breakpoint file");
 	}
 
 	~DebuggerClient() {
@@ -166,15 +630,333 @@ public:
 		}
 	};
 
-	void setBreakpoint(std::string path, int line, int id) {
-		break_list[path].insert(line);
+	// Publishes a copy of the breakpoint table with |edit| applied to it, if
+	// it returns true.
+	template <typename Fn>
+	void updateBreakpoints(Fn edit) {
+		std::lock_guard<std::mutex> lock(break_table_lock);
+		auto table = std::make_shared<breakpoint_table_s>(*std::atomic_load(&break_table));
+		if (!edit(*table))
+			return;
+		table->generation++;
+		uint32_t generation = table->generation;
+		std::atomic_store(&break_table,
+			std::shared_ptr<const breakpoint_table_s>(std::move(table)));
+		break_list_generation.store(generation, std::memory_order_release);
+		break_sites_dirty = true;
+		breakpoints_unverified = true;
+	}
+
+	void setBreakpoint(uint32_t file, int line, breakpoint_s bp) {
+		updateBreakpoints([&](auto& table) {
+			table.lines[file][line] = std::move(bp);
+			return true;
+		});
+	}
+
+	void clearBreakpoints(uint32_t file) {
+		updateBreakpoints([&](auto& table) {
+			return table.lines.erase(file) != 0;
+		});
+	}
+
+	// Drops a temporary breakpoint that was just taken. The edit is found
+	// by its shared |spent| flag, since the line may have been set again.
+	void removeTemporary(const breakpoint_s& bp) {
+		updateBreakpoints([&](auto& table) {
+			for (auto& file : table.lines) {
+				for (auto iter = file.second.begin(); iter != file.second.end(); ++iter) {
+					if (iter->second.spent == bp.spent) {
+						file.second.erase(iter);
+						return true;
+					}
+				}
+			}
+			return false;
+		});
+	}
+
+	// Publishes a copy of the watch table with |edit| applied, if it
+	// returns true.
+	template <typename Fn>
+	void updateWatchpoints(Fn edit) {
+		std::lock_guard<std::mutex> lock(break_table_lock);
+		auto table = std::make_shared<watch_table_s>(*std::atomic_load(&watch_table));
+		if (!edit(table->watches))
+			return;
+		std::atomic_store(&watch_table,
+			std::shared_ptr<const watch_table_s>(std::move(table)));
+		data_watches_dirty = true;
+	}
+
+	// Whether every line has to reach the hook, not just breakpoints.
+	bool isStepping() const {
+		return current_state == DebugPause || current_state == DebugStepIn ||
+			current_state == DebugStepOver || current_state == DebugStepOut ||
+			current_state == DebugStepInstruction;
+	}
+
+	// The traps of a step over, out or instruction, if only they have to
+	// reach the hook rather than every line.
+	std::shared_ptr<const step_traps_s> activeStepTraps() const {
+		if (current_state != DebugStepOver && current_state != DebugStepOut &&
+			current_state != DebugStepInstruction)
+			return nullptr;
+		return std::atomic_load(&step_traps);
+	}
+
+	/* first check already found attached hook, then search for a
+	 * client who wants to attach to one of the plugin's files */
+	bool isInterested(SourcePawn::IPluginContext* ctx) {
+		if (observer)
+			return false;
+		if (context_ == ctx)
+			return true;
+		return wantsFiles(ctx->GetRuntime()) || wantsFunctions(ctx->GetRuntime());
+	}
+
+	// A function breakpoint makes its plugin interesting without the file.
+	bool wantsFunctions(SourcePawn::IPluginRuntime* runtime) {
+		auto table = std::atomic_load(&break_table);
+		if (table->functions.empty())
+			return false;
+		auto image = DebugImages.get(runtime);
+		if (!image)
+			return false;
+		uint32_t addr;
+		for (auto& entry : table->functions) {
+			if (image->GetFunctionAddress(entry.first.c_str(), nullptr, &addr))
+				return true;
+		}
+		return false;
+	}
+
+	bool wantsFiles(SourcePawn::IPluginRuntime* runtime) {
+		if (observer)
+			return false;
+		for (auto file : DebugFiles.ofPlugin(runtime)) {
+			if (files.find(file) != files.end())
+				return true;
+		}
+		return false;
+	}
+
+	// Translate the (file, line) breakpoints into cips of this plugin, so the
+	// hook only has to test a bit.
+	void resolveBreakpoints(SourcePawn::IPluginRuntime* runtime, plugin_s& plugin) {
+		auto& image = plugin.image;
+		auto table = std::atomic_load(&break_table);
+		plugin.breakpoints.reset(image->DescribeCode().length);
+		plugin.generation = table->generation;
+		plugin.sites.clear();
+		plugin.native_sites.clear();
+		plugin.public_sites.clear();
+		plugin.verified.clear();
+		plugin.table = table;
+
+		auto& file_ids = DebugFiles.ofPlugin(runtime);
+		for (uint32_t i = 0; i < image->GetFileCount() && i < file_ids.size(); i++) {
+			const char* name = image->GetFileName(i);
+			if (!name)
+				continue;
+			auto found = table->lines.find(file_ids[i]);
+			if (found == table->lines.end())
+				continue;
+			for (auto& entry : found->second) {
+				uint32_t addr, line;
+				// Lines in the debug table are zero based.
+				if (!image->GetLineAddress(entry.first - 1, name, &addr, &line))
+					continue;
+				plugin.verified.emplace_back(entry.second.id, line + 1);
+				plugin.breakpoints.set(addr);
+				if (needsSite(entry.second))
+					bindSite(image.get(), addr, entry.second, plugin.sites[addr]);
+			}
+		}
+
+		// A function breakpoint arms the one cip its name hashes to.
+		bool armed = !plugin.verified.empty() || !table->natives.empty() ||
+			!table->publics.empty();
+		for (auto& entry : table->functions) {
+			uint32_t addr;
+			if (!image->GetFunctionAddress(entry.first.c_str(), nullptr, &addr))
+				continue;
+			plugin.breakpoints.set(addr);
+			armed = true;
+			if (needsSite(entry.second))
+				bindSite(image.get(), addr, entry.second, plugin.sites[addr]);
+		}
+		if (!armed)
+			plugin.index_pin = nullptr;
+		else if (!plugin.index_pin)
+			plugin.index_pin = DebugImages.pin(image);
+	}
+
+	// BreakpointsVerified: [int count]{[int id][uint8 verified][int line]}
+	// for the line breakpoints whose state changed since the last one.
+	// |line| is where a verified breakpoint stops: the line asked for, or
+	// the next one with code. Verified means some loaded plugin among
+	// |contexts| has it. Each plugin's breakpoints are read from its last
+	// resolution, which a new table or a reloaded plugin redoes here, once
+	// for all of its breakpoints. Main thread only.
+	void verifyBreakpoints(const std::vector<SourcePawn::IPluginContext*>& contexts) {
+		if (!(capabilities & CapVerifiedBreakpoints))
+			return;
+		if (verified_reset.exchange(false))
+			verified_sent.clear();
+
+		auto table = std::atomic_load(&break_table);
+		std::unordered_map<int, uint32_t> lines;
+		for (auto& file : table->lines) {
+			for (auto& entry : file.second)
+				lines.emplace(entry.second.id, 0);
+		}
+		for (auto ctx : contexts) {
+			if (!isInterested(ctx))
+				continue;
+			auto plugin = pluginState(ctx);
+			if (!plugin)
+				continue;
+			for (auto& entry : plugin->verified) {
+				auto found = lines.find(entry.first);
+				if (found != lines.end() && !found->second)
+					found->second = entry.second;
+			}
+		}
+
+		std::vector<std::pair<int, uint32_t>> changed;
+		for (auto& entry : lines) {
+			auto sent = verified_sent.find(entry.first);
+			if (sent == verified_sent.end() || sent->second != entry.second)
+				changed.push_back(entry);
+		}
+		verified_sent = std::move(lines);
+		if (changed.empty())
+			return;
+
+		auto buffer = send_pool.acquire(9 + changed.size() * 9);
+		buffer.PutUnsignedInt(0);
+		buffer.PutChar(MessageType::BreakpointsVerified);
+		buffer.PutInt(changed.size());
+		for (auto& entry : changed) {
+			buffer.PutInt(entry.first);
+			buffer.PutChar(entry.second != 0);
+			buffer.PutInt(entry.second);
+		}
+		*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
+		sendMessage(buffer);
+	}
+
+	// Whether a breakpoint does more than stop, and so needs a bound site.
+	static bool needsSite(const breakpoint_s& bp) {
+		return bp.is_logpoint || !bp.condition.empty() || bp.hit_count || bp.temporary ||
+			bp.is_snapshot;
+	}
+
+	void bindSite(SmxV1Image* image, uint32_t addr, const breakpoint_s& bp,
+		break_site_s& site) {
+		site.bp = &bp;
+		site.symbols.clear();
+		for (auto& part : bp.message) {
+			std::unique_ptr<SmxV1Image::Symbol> sym;
+			if (part.is_expr && image->GetVariable(part.text.c_str(), addr, sym))
+				site.symbols.emplace_back(*sym);
+			else
+				site.symbols.emplace_back();
+		}
+
+		// A condition that can't be compiled here leaves the breakpoint
+		// unconditional, so the mistake shows up as a stop.
+		std::string error;
+		if (!bp.condition.bind(image, addr, &site.predicate, &error))
+			fmt::print("Debugger: breakpoint {} condition ignored: {}\n", bp.id, error);
+		site.snapshot = bp.is_snapshot ? SnapshotPlan::bind(image, addr, bp.globals) : nullptr;
+	}
+
+	// The bytes a watchpoint covers. Scalars are one cell and arrays their
+	// first dimension; char arrays count characters there, so a client
+	// watching a string passes its size in cells.
+	bool watchRange(SmxV1Image* image, const watchpoint_s& watch, ucell_t* addr,
+		ucell_t* size) {
+		std::unique_ptr<SmxV1Image::Symbol> sym;
+		if (!image->GetVariable(watch.name.c_str(), 0, sym))
+			return false;
+		int vclass = sym->vclass() & 0x0f;
+		if (vclass == 1 || vclass == 3)
+			return false;
+
+		uint32_t cells = watch.cells;
+		if (!cells && sym->ident() == sp::IDENT_VARIABLE)
+			cells = 1;
+		else if (!cells && sym->ident() == sp::IDENT_ARRAY && sym->dimcount() == 1) {
+			auto dims = image->GetArrayDimensions(sym.get());
+			if (!dims.empty())
+				cells = dims[0].size();
+		}
+		if (!cells)
+			return false;
+		*addr = sym->addr();
+		*size = cells * sizeof(cell_t);
+		return true;
+	}
+
+	// Resolves the watchpoints for one plugin and adds their ranges to the
+	// VM, whose ranges were just cleared. Main thread only.
+	void resolveWatchpoints(SourcePawn::IPluginContext* ctx) {
+		plugin_s* plugin = pluginState(ctx);
+		if (!plugin)
+			return;
+		plugin->watches.clear();
+		plugin->watch_table = std::atomic_load(&watch_table);
+#if SOURCEPAWN_API_VERSION >= 0x0212
+		for (auto& entry : plugin->watch_table->watches) {
+			auto& watch = entry.second;
+			ucell_t addr, size;
+			if (!watchRange(plugin->image.get(), watch, &addr, &size))
+				continue;
+			int err = ctx->GetRuntime()->SetDataWatch(addr, size, true);
+			if (err != SP_ERROR_NONE) {
+				fmt::print("Debugger: watchpoint {} on '{}' not set (error {})\n",
+					watch.bp.id, watch.name, err);
+				continue;
+			}
+			plugin->watches.push_back({ &watch, addr, size, {} });
+		}
+#endif
+	}
+
+	void forgetPlugin(SourcePawn::IPluginContext* ctx) {
+		plugins.erase(ctx);
+		if (last_ctx_ == ctx) {
+			last_ctx_ = nullptr;
+			last_plugin_ = nullptr;
+		}
+		if (context_ == ctx) {
+			context_ = nullptr;
+			current_image = nullptr;
+		}
+		if (global_cache.ctx == ctx)
+			global_cache = global_cache_s();
 	}
 
-	void clearBreakpoints(std::string fileName) {
-		auto found = break_list.find(fileName);
-		if (found != break_list.end()) {
-			found->second.clear();
+	plugin_s* pluginState(SourcePawn::IPluginContext* ctx) {
+		if (ctx != last_ctx_) {
+			auto found = plugins.find(ctx);
+			if (found == plugins.end()) {
+				plugin_s plugin;
+				plugin.image = DebugImages.get(ctx->GetRuntime());
+				if (!plugin.image)
+					return nullptr;
+				plugin.image_hash = DebugImages.hash(ctx->GetRuntime());
+				found = plugins.emplace(ctx, std::move(plugin)).first;
+			}
+			last_ctx_ = ctx;
+			last_plugin_ = &found->second;
 		}
+		// The one atomic load on the hot path.
+		if (last_plugin_->generation != break_list_generation.load(std::memory_order_acquire))
+			resolveBreakpoints(ctx->GetRuntime(), *last_plugin_);
+		return last_plugin_;
 	}
 
 	enum {
@@ -188,17 +970,31 @@ public:
 	};
 #define MAX_DIMS 3
 #define DISP_MASK 0x0f
+#define MAX_VARIABLE_DEPTH 16
+#define MAX_VARIABLE_ELEMENTS 1024
+// Arrays longer than this show as a summary; their children still page.
+#define SUMMARY_ELEMENTS 256
+// Fewest variables a worker formats when a scope is split across them.
+#define PARALLEL_FORMAT_MIN 128
+// Fewest bytes a worker deflates when a message is compressed in parts.
+#define PARALLEL_COMPRESS_MIN (128 * 1024)
+// The part of a client's stop arena kept between stops.
+#define STOP_ARENA_BYTES (64 * 1024)
 
-	char* get_string(SmxV1Image::Symbol* sym) {
+	// The contents of a one-dimensional char array; |size| is set to its
+	// declared length in bytes, or 0 if it has none.
+	char* get_string(SmxV1Image::Symbol* sym, size_t* size) {
 		assert(sym->ident() == sp::IDENT_ARRAY ||
 			sym->ident() == sp::IDENT_REFARRAY);
 		assert(sym->dimcount() == 1);
+		auto dims = current_image->GetArrayDimensions(sym);
+		*size = dims.empty() ? 0 : dims[0].size();
 
 		// get the starting address and the length of the string
 		cell_t* addr;
 		cell_t base = sym->addr();
 		if (sym->vclass() == 1 || sym->vclass() == 3) // local var or arg but not static
-			base += frm_; // addresses of local vars are relative to the frame
+			base += scope_frm_; // addresses of local vars are relative to the frame
 		if (sym->ident() == sp::IDENT_REFARRAY) {
 			context_->LocalToPhysAddr(base, &addr);
 			assert(addr != nullptr);
@@ -211,13 +1007,40 @@ public:
 		return str;
 	}
 
+	// The text of the string at |str|, reading no more than |size| bytes, or
+	// one past the display limit if its size isn't known. Text past the limit
+	// is cut and counted; a string that fills its array without a terminator
+	// is marked as such. |length| is set to the bytes before the terminator.
+	std::string boundedString(const char* str, size_t size, size_t* length) {
+		size_t limit = string_limit.load(std::memory_order_relaxed);
+		size_t scan = size ? size : limit + 1;
+		auto nul = static_cast<const char*>(memchr(str, '\0', scan));
+		size_t len = nul ? nul - str : scan;
+		*length = len;
+		if (len <= limit) {
+			std::string text(str, len);
+			if (!nul && size)
+				text += "... (unterminated)";
+			return text;
+		}
+		// Don't split a UTF-8 sequence.
+		while (limit > 0 && (str[limit] & 0xc0) == 0x80)
+			limit--;
+		std::string text(str, limit);
+		if (nul || size)
+			fmt::format_to(std::back_inserter(text), "... ({} more bytes)", len - limit);
+		else
+			text += "... (more)";
+		return text;
+	}
+
 	int get_symbolvalue(const SmxV1Image::Symbol* sym, int index,
 		cell_t* value) {
 
 		cell_t* vptr;
 		cell_t base = sym->addr();
 		if (sym->vclass() & DISP_MASK)
-			base += frm_; // addresses of local vars are relative to the frame
+			base += scope_frm_; // addresses of local vars are relative to the frame
 
 		// a reference
 		if (sym->ident() == sp::IDENT_REFERENCE ||
@@ -238,12 +1061,257 @@ public:
 		return vptr != nullptr;
 	}
 
+	// |count| cells of a symbol from |index|, or null unless all of them
+	// are in plugin memory. Both ends are checked so the span can be read
+	// directly.
+	const cell_t* get_symbolcells(const SmxV1Image::Symbol* sym, int index, uint32_t count) {
+		cell_t* vptr;
+		cell_t* last;
+		cell_t base = sym->addr();
+		if (sym->vclass() & DISP_MASK)
+			base += scope_frm_; // addresses of local vars are relative to the frame
+		if (sym->ident() == sp::IDENT_REFERENCE ||
+			sym->ident() == sp::IDENT_REFARRAY) {
+			if (context_->LocalToPhysAddr(base, &vptr) != SP_ERROR_NONE)
+				return nullptr;
+			base = *vptr;
+		}
+		if (!count ||
+			context_->LocalToPhysAddr(base + index * sizeof(cell_t), &vptr) != SP_ERROR_NONE ||
+			context_->LocalToPhysAddr(base + (index + count - 1) * sizeof(cell_t), &last) != SP_ERROR_NONE)
+			return nullptr;
+		return vptr;
+	}
+
+	// Names resolved per context are kept up to this many; past it the
+	// cache starts over.
+	static constexpr size_t MAX_RESOLVED_NAMES = 1024;
+
+	// GetVariable at the selected frame's cip, through the context's cache
+	// of resolved names. The symbol is a copy, since displaying it may tag
+	// it with a display class.
+	bool lookupVariable(const char* name, std::unique_ptr<SmxV1Image::Symbol>& sym) {
+		uint32_t cip = static_cast<uint32_t>(scope_cip_);
+		auto state = context_ ? pluginState(context_) : nullptr;
+		if (!state || state->image != current_image)
+			return current_image->GetVariable(name, cip, sym);
+
+		auto& entries = state->resolved[name];
+		for (const auto& entry : entries) {
+			if (cip >= entry.start && cip <= entry.end) {
+				sym = entry.sym ? std::make_unique<SmxV1Image::Symbol>(*entry.sym) : nullptr;
+				return sym != nullptr;
+			}
+		}
+		plugin_s::resolved_s entry{ 0, 0, std::nullopt };
+		bool found = current_image->GetVariable(name, cip, sym, &entry.start, &entry.end);
+		if (found)
+			entry.sym = *sym;
+		if (state->resolved.size() > MAX_RESOLVED_NAMES) {
+			state->resolved.clear();
+			state->resolved[name].push_back(std::move(entry));
+		}
+		else {
+			entries.push_back(std::move(entry));
+		}
+		return found;
+	}
+
+	// Watch expressions as parsed, for any context; null if they don't
+	// parse, with the message.
+	struct parsed_s {
+		std::shared_ptr<const Condition> condition;
+		std::string error;
+	};
+	std::unordered_map<std::string, parsed_s> parsed_expressions;
+
+	static bool isIdentifier(const char* text) {
+		if (!isalpha((unsigned char)*text) && *text != '_')
+			return false;
+		while (*++text) {
+			if (!isalnum((unsigned char)*text) && *text != '_')
+				return false;
+		}
+		return true;
+	}
+
+	// The value of a watch expression such as a.b[3].c at the selected
+	// frame. It is parsed once and bound once per scope; later stops only
+	// run the bound program.
+	variable_s expressionVariable(const std::string& text) {
+		variable_s var;
+		var.name = text;
+		var.type = "N/A";
+		uint32_t cip = static_cast<uint32_t>(scope_cip_);
+		auto state = context_ ? pluginState(context_) : nullptr;
+		if (!state || !current_image || state->image != current_image) {
+			var.value = "(not available)";
+			return var;
+		}
+
+		auto& entries = state->expressions[text];
+		const plugin_s::expression_s* bound = nullptr;
+		for (const auto& entry : entries) {
+			if (cip >= entry.start && cip <= entry.end) {
+				bound = &entry;
+				break;
+			}
+		}
+		if (!bound) {
+			if (parsed_expressions.size() > MAX_RESOLVED_NAMES)
+				parsed_expressions.clear();
+			auto& parsed = parsed_expressions[text];
+			if (!parsed.condition && parsed.error.empty()) {
+				auto condition = std::make_shared<Condition>();
+				if (condition->parse(text, &parsed.error))
+					parsed.condition = std::move(condition);
+			}
+			plugin_s::expression_s entry;
+			entry.error = parsed.error;
+			if (parsed.condition) {
+				auto predicate = std::make_shared<Predicate>();
+				if (parsed.condition->bindExpression(current_image.get(), cip, predicate.get(),
+						&entry.error, &entry.start, &entry.end))
+					entry.predicate = std::move(predicate);
+			}
+			if (state->expressions.size() > MAX_RESOLVED_NAMES) {
+				state->expressions.clear();
+				state->expressions[text].push_back(std::move(entry));
+				bound = &state->expressions[text].back();
+			}
+			else {
+				entries.push_back(std::move(entry));
+				bound = &entries.back();
+			}
+		}
+
+		cell_t value;
+		if (!bound->predicate) {
+			var.value = "(" + bound->error + ")";
+			return var;
+		}
+		if (!bound->predicate->value(context_, scope_frm_, &value)) {
+			var.value = "(?)";
+			return var;
+		}
+		switch (bound->predicate->result()) {
+		case Predicate::Result::Float:
+			printvalue(value, DISP_FLOAT, var.value, var.type);
+			break;
+		case Predicate::Result::Bool:
+			printvalue(value, DISP_BOOL, var.value, var.type);
+			break;
+		case Predicate::Result::Cell:
+			printvalue(value, 0, var.value, var.type);
+			break;
+		case Predicate::Result::Place: {
+			uint32_t addr = static_cast<uint32_t>(value);
+			uint32_t start = addr;
+			if (!write_variable(var.value, start, bound->predicate->type()))
+				var.value = "(?)";
+			var.children = addChildren(bound->predicate->type(), addr, false);
+			break;
+		}
+		}
+		return var;
+	}
+
+	// Counts stops, so array summaries compare against the previous one.
+	uint32_t stop_serial = 0;
+
+	// Where a worker formatting part of a scope puts the array histories
+	// it updates, merged into the plugin's once the parts are done; see
+	// formatVariables. Workers only read the plugin's map.
+	struct array_sink_s {
+		plugin_s* state;
+		std::unordered_map<const cell_t*, plugin_s::array_history_s> arrays;
+	};
+	static inline thread_local array_sink_s* array_sink = nullptr;
+
+	static constexpr size_t kMaxArrayHistories = 256;
+	static constexpr uint32_t kMaxArrayHistoryCells = 64 * 1024;
+
+	plugin_s::array_history_s& arrayHistory(plugin_s* state, const cell_t* cells) {
+		if (!array_sink) {
+			if (state->arrays.find(cells) == state->arrays.end())
+				trimArrayHistories(state, kMaxArrayHistories - 1);
+			return state->arrays[cells];
+		}
+		auto found = array_sink->arrays.find(cells);
+		if (found == array_sink->arrays.end()) {
+			auto shared = state->arrays.find(cells);
+			found = array_sink->arrays.emplace(cells, shared != state->arrays.end() ?
+				shared->second : plugin_s::array_history_s()).first;
+		}
+		return found->second;
+	}
+
+	// Forgets the arrays shown longest ago until at most |keep| are left.
+	static void trimArrayHistories(plugin_s* state, size_t keep) {
+		while (state->arrays.size() > keep) {
+			auto oldest = std::min_element(state->arrays.begin(), state->arrays.end(),
+				[](const auto& a, const auto& b) {
+					return a.second.stop < b.second.stop;
+				});
+			state->arrays.erase(oldest);
+		}
+	}
+
+	// "[N] min X, max Y, Z non-zero, hash H" and where the cells first
+	// differ from the previous stop that showed them, in one pass.
+	std::string summarizeArray(const cell_t* cells, uint32_t count, bool floats) {
+		cell_t lo = INT32_MAX, hi = INT32_MIN;
+		float flo = INFINITY, fhi = -INFINITY;
+		uint32_t nonzero = 0;
+		// Four independent lanes keep the loop free of a serial chain.
+		uint32_t lanes[4] = { 0x811c9dc5u, 0x811c9dc5u, 0x811c9dc5u, 0x811c9dc5u };
+		for (uint32_t i = 0; i < count; i++) {
+			cell_t value = cells[i];
+			lo = value < lo ? value : lo;
+			hi = value > hi ? value : hi;
+			float f = sp_ctof(value);
+			flo = f < flo ? f : flo;
+			fhi = f > fhi ? f : fhi;
+			nonzero += value != 0;
+			lanes[i & 3] = (lanes[i & 3] ^ uint32_t(value)) * 0x01000193u;
+		}
+		uint32_t hash = ((lanes[0] * 31 + lanes[1]) * 31 + lanes[2]) * 31 + lanes[3];
+
+		std::string out = fmt::format("[{}] ", count);
+		if (floats)
+			fmt::format_to(std::back_inserter(out), "min {}, max {}", flo, fhi);
+		else
+			fmt::format_to(std::back_inserter(out), "min {}, max {}", lo, hi);
+		fmt::format_to(std::back_inserter(out), ", {} non-zero, hash {:08x}", nonzero, hash);
+
+		auto state = array_sink ? array_sink->state : context_ ? pluginState(context_) : nullptr;
+		if (!state || count > kMaxArrayHistoryCells)
+			return out;
+		auto& history = arrayHistory(state, cells);
+		if (history.stop != stop_serial) {
+			history.previous = std::move(history.seen);
+			history.seen.assign(cells, cells + count);
+			history.stop = stop_serial;
+		}
+		if (history.previous.empty())
+			return out;
+		auto end = history.previous.begin() + std::min<size_t>(history.previous.size(), count);
+		auto diff = std::mismatch(history.previous.begin(), end, cells);
+		if (diff.first != end)
+			fmt::format_to(std::back_inserter(out), ", changed from [{}]", diff.first - history.previous.begin());
+		else if (history.previous.size() != count)
+			fmt::format_to(std::back_inserter(out), ", changed from [{}]", end - history.previous.begin());
+		else
+			out += ", unchanged";
+		return out;
+	}
+
 	void printvalue(long value, int disptype, std::string& out_value,
 		std::string& out_type) {
-		char out[64];
+		auto out = std::back_inserter(out_value);
 		if (disptype == DISP_FLOAT) {
 			out_type = "float";
-			sprintf(out, "%f", sp_ctof(value));
+			write_display_float(out_value, sp_ctof(value));
 		}
 		else if (disptype == DISP_FIXED) {
 			out_type = "fixed";
@@ -252,160 +1320,680 @@ public:
 			value -= MULTIPLIER * ipart;
 			if (value < 0)
 				value = -value;
-			sprintf(out, "%ld.%03ld", ipart, value);
+			fmt::format_to(out, "{}.{:03}", ipart, value);
 		}
 		else if (disptype == DISP_HEX) {
 			out_type = "hex";
-			sprintf(out, "%lx", value);
+			fmt::format_to(out, "{:x}", (unsigned long)value);
 		}
 		else if (disptype == DISP_BOOL) {
 			out_type = "bool";
 			switch (value) {
 			case 0:
-				sprintf(out, "false");
+				out_value += "false";
 				break;
 			case 1:
-				sprintf(out, "true");
+				out_value += "true";
 				break;
 			default:
-				sprintf(out, "%ld (true)", value);
+				fmt::format_to(out, "{} (true)", value);
 				break;
 			} /* switch */
 		}
 		else {
 			out_type = "cell";
-			sprintf(out, "%ld", value);
+			fmt::format_to(out, "{}", value);
 		} /* if */
-		out_value += out;
 	}
-	nlohmann::json read_variable(uint32_t& addr, uint32_t type_id, debug::Rtti* rtti, bool is_ref = false)
+	// A string of at most |size| bytes, 0 if unknown, as a JSON string.
+	// Moves |addr| past it to the next cell.
+	bool write_string(std::string& out, uint32_t& addr, size_t size) {
+		char* str = nullptr;
+		if (context_->LocalToStringNULL(addr, &str) != SP_ERROR_NONE)
+			return false;
+		std::string text;
+		if (str) {
+			size_t length;
+			text = boundedString(str, size, &length);
+			addr += length + 1;
+		}
+		if (addr % sizeof(cell_t) != 0)
+			addr += sizeof(cell_t) - (addr % sizeof(cell_t));
+		write_json_string(out, text.c_str());
+		return true;
+	}
+
+	// Serializes the plugin memory described by |rtti| as JSON text straight
+	// into |out|. Returns false without writing anything if there is no value.
+	bool write_variable(std::string& out, uint32_t& addr, const debug::Rtti* rtti,
+		bool is_ref = false, int depth = 0)
 	{
-		nlohmann::json json;
 		if (!rtti)
-		{
-			rtti = const_cast<debug::Rtti*>(current_image->rtti_data()->typeFromTypeId(type_id));
+			return false;
+		if (depth > MAX_VARIABLE_DEPTH) {
+			out += "\"...\"";
+			return true;
 		}
+
 		cell_t* ptr;
 		switch (rtti->type())
 		{
 		case cb::kAny:
+		case cb::kInt32:
 		{
-			context_->LocalToPhysAddr(addr, &ptr);
-			json = (int32_t)*ptr;
+			if (context_->LocalToPhysAddr(addr, &ptr) != SP_ERROR_NONE)
+				return false;
+			fmt::format_to(std::back_inserter(out), "{}", (int32_t)*ptr);
+			return true;
 		}
 		case cb::kBool:
 		{
-			context_->LocalToPhysAddr(addr, &ptr);
-			json = (bool)*ptr;
-			break;
-		}
-		case cb::kInt32:
-		{
-			context_->LocalToPhysAddr(addr, &ptr);
-			json = (int32_t)*ptr;
-			break;
+			if (context_->LocalToPhysAddr(addr, &ptr) != SP_ERROR_NONE)
+				return false;
+			out += *ptr ? "true" : "false";
+			return true;
 		}
 		case cb::kFloat32:
 		{
-			context_->LocalToPhysAddr(addr, &ptr);
-			json = sp_ctof(*ptr);
-			break;
+			if (context_->LocalToPhysAddr(addr, &ptr) != SP_ERROR_NONE)
+				return false;
+			write_json_float(out, sp_ctof(*ptr));
+			return true;
 		}
 		case cb::kFixedArray:
 		{
-			if (rtti->inner())
-			{
-				if (rtti->inner()->type() == cb::kChar8)
-				{
-					json = read_variable(addr, rtti->inner()->type(), const_cast<debug::Rtti*>(rtti->inner()), false);
-				}
-				else
-				{
-					for (int i = 0; i < rtti->index(); i++)
-					{
-						uint32_t start = addr;
+			auto inner = rtti->inner();
+			if (!inner)
+				return false;
+			if (inner->type() == cb::kChar8)
+				return write_string(out, addr, rtti->index());
+			if (rtti->index() == 0)
+				return false;
 
-						json[i] = read_variable(start, rtti->inner()->type(), const_cast<debug::Rtti*>(rtti->inner()), false);
-						addr += 4;
+			// Scalars are read as one span and formatted back to back, or
+			// summarized if there are many.
+			uint32_t count = rtti->index();
+			cell_t* first;
+			cell_t* last;
+			bool floats = inner->type() == cb::kFloat32;
+			if ((inner->type() == cb::kInt32 || inner->type() == cb::kAny || floats) &&
+				context_->LocalToPhysAddr(addr, &first) == SP_ERROR_NONE &&
+				context_->LocalToPhysAddr(addr + (rtti->index() - 1) * sizeof(cell_t), &last) == SP_ERROR_NONE) {
+				if (count > SUMMARY_ELEMENTS) {
+					write_json_string(out, summarizeArray(first, count, floats).c_str());
+				}
+				else {
+					out += '[';
+					write_cells(out, first, count, floats, "", ",");
+					out += ']';
+				}
+				addr += rtti->index() * sizeof(cell_t);
+				return true;
+			}
 
-					}
+			out += '[';
+			for (uint32_t i = 0; i < rtti->index(); i++) {
+				if (i > 0)
+					out += ',';
+				if (i == MAX_VARIABLE_ELEMENTS) {
+					out += "\"...\"";
+					break;
 				}
+				uint32_t start = addr;
+				if (!write_variable(out, start, inner, false, depth + 1))
+					out += "null";
+				addr += 4;
 			}
-			break;
+			out += ']';
+			return true;
 		}
 		case cb::kChar8:
-		{
-			char* str = nullptr;
-			if (context_->LocalToStringNULL(addr, &str) != SP_ERROR_NONE)
-			{
-				break;
-			}
-			if (str)
-			{
-				addr += strlen(str) + 1;
-			}
-			if (addr % sizeof(cell_t) != 0)
-			{
-				addr += sizeof(cell_t) - (addr % sizeof(cell_t));
-			}
-			json = str ? str : "";
-			break;
-		}
+			return write_string(out, addr, 0);
 		case cb::kArray:
 		{
 			if (is_ref)
 			{
 				cell_t* a;
-				context_->LocalToPhysAddr(addr, &a);
+				if (context_->LocalToPhysAddr(addr, &a) != SP_ERROR_NONE)
+					return false;
 				addr = *a;
 			}
-			if (rtti->inner())
-			{
-				json = read_variable(addr, rtti->inner()->type(), const_cast<debug::Rtti*>(rtti->inner()));
-			}
-			break;
+			return write_variable(out, addr, rtti->inner(), false, depth + 1);
 		}
 		case cb::kEnumStruct:
 		{
-			auto fields = current_image->getEnumFields(rtti->index());
-
-			uint32_t start = addr;
-
-			for (auto& field : fields)
+			bool any = false;
+			for (auto& field : current_image->getEnumFields(rtti->index()))
 			{
-				auto name = current_image->GetDebugName(field->name);
-				auto rtti_field = current_image->rtti_data()->typeFromTypeId(field->type_id);
-				if (!rtti_field)
-				{
+				if (!field.type)
 					break;
-				}
-				json[name] = read_variable(start, rtti_field->type(), (sp::debug::Rtti*)rtti_field);
+				out += any ? ',' : '{';
+				any = true;
+				write_json_string(out, field.name ? field.name : "");
+				out += ':';
+				uint32_t start = addr + field.offset;
+				if (!write_variable(out, start, field.type, false, depth + 1))
+					out += "null";
 			}
-			break;
+			if (any)
+				out += '}';
+			return any;
 		}
 		case cb::kClassdef:
 		{
-			auto fields = current_image->getTypeFields(rtti->index());
-			cell_t* ptr;
 			uint32_t field_offset = addr;
-
-			for (auto& field : fields)
+			bool any = false;
+			for (auto& field : current_image->getTypeFields(rtti->index()))
 			{
+				if (!field.type)
+					break;
+				out += any ? ',' : '{';
+				any = true;
+				write_json_string(out, field.name ? field.name : "");
+				out += ':';
 				uint32_t start = field_offset;
-
-				auto name = current_image->GetDebugName(field->name);
-				auto rtti_field = current_image->rtti_data()->typeFromTypeId(field->type_id);
-				json[name] = read_variable(start, rtti_field->type(), (sp::debug::Rtti*)rtti_field, true);
+				if (!write_variable(out, start, field.type, true, depth + 1))
+					out += "null";
 				field_offset += sizeof(cell_t);
 			}
+			if (any)
+				out += '}';
+			return any;
+		}
+		}
+
+		return false;
+	}
+
+	//
+	//  Arrays and structs get a handle valid until the next stop, so the
+	//  client pages through their children instead of receiving them all.
+	//
+	struct child_s {
+		// RTTI values: a fixed array, enum struct or classdef at addr.
+		const debug::Rtti* type = nullptr;
+		uint32_t addr = 0;
+		bool is_ref = false;
+		// Legacy arrays: the dimension and the cell index of the row.
+		std::optional<SmxV1Image::Symbol> sym;
+		int level = 0;
+		int base = 0;
+		// Frame the symbol's locals are relative to.
+		cell_t frm = 0;
+	};
+	// What the current stop keeps until the next one, reset wholesale.
+	StopArena stop_arena{ STOP_ARENA_BYTES };
+	std::pmr::vector<child_s> children{ &stop_arena };
+	// Where a worker formatting part of a scope puts the handles it
+	// creates; see formatVariables. The arena is the stop's thread's alone.
+	static inline thread_local std::pmr::vector<child_s>* child_sink = nullptr;
+
+	std::pmr::vector<child_s>& childTable() {
+		return child_sink ? *child_sink : children;
+	}
+
+	// Stores |child| as a new handle and returns it.
+	uint32_t keepChild(child_s child) {
+		auto& table = childTable();
+		table.push_back(std::move(child));
+		return table.size();
+	}
+
+	// Fills |vars| with |format(i)| for i below |count|. With enough of
+	// them the calls are split across DebugWorkers, which only reads plugin
+	// memory while the plugin is stopped. Each part keeps its handles apart,
+	// and they are numbered as a serial pass would number them.
+	template <typename Fn>
+	void formatVariables(size_t count, std::vector<variable_s>& vars, Fn&& format) {
+		size_t first = vars.size();
+		vars.resize(first + count);
+		size_t parts = DebugWorkers.parts(count, PARALLEL_FORMAT_MIN);
+		if (parts <= 1) {
+			for (size_t i = 0; i < count; i++)
+				vars[first + i] = format(i);
+			return;
+		}
+		std::vector<std::pmr::vector<child_s>> handles(parts);
+		// Looked up here: pluginState caches and may resolve breakpoints.
+		auto state = context_ ? pluginState(context_) : nullptr;
+		std::vector<array_sink_s> histories(parts, array_sink_s{ state, {} });
+		DebugWorkers.run(parts, [&](size_t part) {
+			child_sink = &handles[part];
+			array_sink = &histories[part];
+			for (size_t i = count * part / parts; i < count * (part + 1) / parts; i++)
+				vars[first + i] = format(i);
+			child_sink = nullptr;
+			array_sink = nullptr;
+		});
+		if (state) {
+			for (auto& part : histories) {
+				for (auto& entry : part.arrays)
+					state->arrays[entry.first] = std::move(entry.second);
+			}
+			trimArrayHistories(state, kMaxArrayHistories);
+		}
+		for (size_t part = 0; part < parts; part++) {
+			uint32_t base = children.size();
+			for (size_t i = count * part / parts; i < count * (part + 1) / parts; i++) {
+				if (vars[first + i].children)
+					vars[first + i].children += base;
+			}
+			children.insert(children.end(), std::make_move_iterator(handles[part].begin()),
+				std::make_move_iterator(handles[part].end()));
+		}
+	}
+
+	uint32_t addChildren(const debug::Rtti* type, uint32_t addr, bool is_ref) {
+		while (type && type->type() == cb::kArray) {
+			if (is_ref) {
+				cell_t* ptr;
+				if (context_->LocalToPhysAddr(addr, &ptr) != SP_ERROR_NONE)
+					return 0;
+				addr = *ptr;
+			}
+			type = type->inner();
+			is_ref = false;
+		}
+		if (!type)
+			return 0;
+		switch (type->type()) {
+		case cb::kFixedArray:
+			if (!type->inner() || type->inner()->type() == cb::kChar8 || type->index() == 0)
+				return 0;
+			break;
+		case cb::kEnumStruct:
+		case cb::kClassdef:
+			break;
+		default:
+			return 0;
+		}
+
+		child_s child;
+		child.type = type;
+		child.addr = addr;
+		child.is_ref = is_ref;
+		return keepChild(std::move(child));
+	}
+
+	uint32_t addChildren(const SmxV1Image::Symbol& sym, int level, int base) {
+		child_s child;
+		child.sym = sym;
+		child.level = level;
+		child.base = base;
+		child.frm = scope_frm_;
+		return keepChild(std::move(child));
+	}
+
+	// The handle of an array or struct variable's children, or 0.
+	uint32_t symbolChildren(SmxV1Image::Symbol* sym) {
+		auto rtti = sym->rtti();
+		if (rtti && rtti->type_id && current_image->rtti_data()) {
+			uint32_t addr = static_cast<uint32_t>(rtti->address);
+			if (sym->vclass() == 1 || sym->vclass() == 3)
+				addr += scope_frm_;
+			auto type = current_image->rtti_data()->typeFromTypeId(rtti->type_id);
+			return addChildren(type, addr, sym->vclass() == 0x3);
+		}
+		if ((uint32_t)scope_cip_ < sym->codestart() || (uint32_t)scope_cip_ > sym->codeend())
+			return 0;
+		if ((sym->ident() != sp::IDENT_ARRAY && sym->ident() != sp::IDENT_REFARRAY) ||
+			current_image->GetArrayDimensions(sym).empty())
+			return 0;
+		// Strings are shown whole.
+		const char* tag = current_image->GetTagName(sym->tagid());
+		if (sym->dimcount() == 1 && ((sym->vclass() & ~DISP_MASK) == DISP_STRING ||
+				(tag && (!strcmp(tag, "String") || !strcmp(tag, "char")))))
+			return 0;
+		return addChildren(*sym, 0, 0);
+	}
+
+	uint32_t childCount(const child_s& parent) {
+		if (parent.sym) {
+			auto dims = current_image->GetArrayDimensions(&*parent.sym);
+			if ((size_t)parent.level >= dims.size())
+				return 0;
+			return dims[parent.level].size();
+		}
+		switch (parent.type->type()) {
+		case cb::kFixedArray:
+			return parent.type->index();
+		case cb::kEnumStruct:
+		case cb::kClassdef: {
+			auto fields = parent.type->type() == cb::kEnumStruct
+				? current_image->getEnumFields(parent.type->index())
+				: current_image->getTypeFields(parent.type->index());
+			uint32_t count = 0;
+			while (count < fields.size() && fields[count].type)
+				count++;
+			return count;
+		}
+		}
+		return 0;
+	}
+
+	variable_s childVariable(const child_s& parent, uint32_t index) {
+		variable_s var;
+		var.name = std::to_string(index);
+		var.type = "N/A";
+
+		if (parent.sym) {
+			auto& sym = *parent.sym;
+			cell_t value;
+			int cell = parent.base + index;
+			if (parent.level + 1 < sym.dimcount()) {
+				// A row of a multi-dimensional array, found through the
+				// indirection vector.
+				var.type = "Array";
+				if (!get_symbolvalue(&sym, cell, &value)) {
+					var.value = "(?)";
+					return var;
+				}
+				auto dims = current_image->GetArrayDimensions(&sym);
+				var.value = fmt::format("[{}]", dims[parent.level + 1].size());
+				var.children = addChildren(sym, parent.level + 1, cell + value / (cell_t)sizeof(cell_t));
+			}
+			else if (get_symbolvalue(&sym, cell, &value)) {
+				printvalue(value, (sym.vclass() & ~DISP_MASK), var.value, var.type);
+			}
+			else {
+				var.value = "(?)";
+			}
+			return var;
+		}
+
+		const debug::Rtti* type = nullptr;
+		uint32_t addr = parent.addr;
+		bool is_ref = false;
+		switch (parent.type->type()) {
+		case cb::kFixedArray:
+			type = parent.type->inner();
+			addr += index * sizeof(cell_t);
+			break;
+		case cb::kEnumStruct: {
+			auto& field = current_image->getEnumFields(parent.type->index())[index];
+			var.name = field.name ? field.name : "";
+			type = field.type;
+			addr += field.offset;
+			break;
+		}
+		case cb::kClassdef: {
+			auto& field = current_image->getTypeFields(parent.type->index())[index];
+			var.name = field.name ? field.name : "";
+			type = field.type;
+			addr += index * sizeof(cell_t);
+			is_ref = true;
 			break;
 		}
 		}
 
-		return json;
-	}	variable_s display_variable(SmxV1Image::Symbol* sym, uint32_t index[],
-		int idxlevel, bool noarray = false) {
-		nlohmann::json json;
+		uint32_t start = addr;
+		if (!write_variable(var.value, start, type, is_ref))
+			var.value = "null";
+		var.children = addChildren(type, addr, is_ref);
+		return var;
+	}
+
+	// How long a message may wait behind a slow connection, by the type of
+	// its first message: stop and run notices go first, unsolicited streams
+	// are dropped first.
+	static SendQueue::priority_e priorityOf(SendBuffer& buffer) {
+		switch (static_cast<const uint8_t*>(buffer.Base())[4]) {
+		case MessageType::HasStopped:
+		case MessageType::HasContinued:
+		case MessageType::Capabilities:
+		case MessageType::SharedMemory:
+		case MessageType::BreakpointsVerified:
+		case MessageType::Heartbeat:
+			return SendQueue::Control;
+		case MessageType::LogMessages:
+		case MessageType::Snapshots:
+		case MessageType::Diagnostics:
+			return SendQueue::Telemetry;
+		default:
+			return SendQueue::Bulk;
+		}
+	}
+
+	// A LogMessages with the one line |text|, for notices that don't come
+	// from the game thread's log pipe.
+	static std::shared_ptr<std::string> logLine(std::string_view text) {
+		SendBuffer buffer(std::make_shared<std::string>());
+		buffer.Reserve(text.size() + 18);
+		buffer.PutUnsignedInt(0);
+		buffer.PutChar(MessageType::LogMessages);
+		buffer.PutInt(0);
+		buffer.PutInt(1);
+		buffer.PutLenString(text);
+		*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
+		return buffer.take();
+	}
+
+	// A reply the client was too slow to take is replaced by a LogMessages
+	// line naming it, so the client gives up on it instead of waiting.
+	static std::shared_ptr<std::string> dropNotice(const std::string& dropped) {
+		uint8_t type = dropped.size() > 4 ? uint8_t(dropped[4]) : 0;
+		return logLine(fmt::format("reply dropped: message type {} of {} bytes, the client is not reading fast enough",
+			type, dropped.size()));
+	}
+
+	// Deflates |size| bytes at |src| into |out| as one zlib stream, as
+	// compress2 would write it. Large input is split across DebugWorkers:
+	// each part is raw deflate primed with the 32K before it and ended on a
+	// byte boundary, so behind one header and ahead of the combined
+	// Adler-32 the parts read as a single stream. False if zlib failed.
+	static bool compressParts(const Bytef* src, uLong size, std::vector<std::string>& out) {
+		size_t parts = DebugWorkers.parts(size, PARALLEL_COMPRESS_MIN);
+		out.assign(parts + 2, std::string());
+		std::vector<uLong> sums(parts);
+		std::atomic<bool> failed{ false };
+		DebugWorkers.run(parts, [&](size_t part) {
+			uLong start = uLong(uint64_t(size) * part / parts);
+			uLong end = uLong(uint64_t(size) * (part + 1) / parts);
+			z_stream strm = {};
+			if (deflateInit2(&strm, Z_BEST_SPEED, Z_DEFLATED, -MAX_WBITS, 8,
+					Z_DEFAULT_STRATEGY) != Z_OK) {
+				failed = true;
+				return;
+			}
+			uLong window = std::min<uLong>(start, 1u << MAX_WBITS);
+			if (window)
+				deflateSetDictionary(&strm, src + start - window, window);
+			// Room for the sync flush's empty block too.
+			auto& dest = out[part + 1];
+			dest.resize(deflateBound(&strm, end - start) + 16);
+			strm.next_in = const_cast<Bytef*>(src + start);
+			strm.avail_in = end - start;
+			strm.next_out = reinterpret_cast<Bytef*>(&dest[0]);
+			strm.avail_out = uInt(dest.size());
+			int flush = part + 1 == parts ? Z_FINISH : Z_SYNC_FLUSH;
+			int result = deflate(&strm, flush);
+			if (strm.avail_in || result != (flush == Z_FINISH ? Z_STREAM_END : Z_OK))
+				failed = true;
+			dest.resize(strm.total_out);
+			deflateEnd(&strm);
+			sums[part] = adler32(1, src + start, end - start);
+		});
+		if (failed)
+			return false;
+
+		// A zlib header for the fastest level, and the Adler-32 of it all.
+		uLong sum = 1;
+		for (size_t part = 0; part < parts; part++) {
+			uLong start = uLong(uint64_t(size) * part / parts);
+			uLong end = uLong(uint64_t(size) * (part + 1) / parts);
+			sum = adler32_combine(sum, sums[part], end - start);
+		}
+		out.front() = { '\x78', '\x01' };
+		out.back() = { char(sum >> 24), char(sum >> 16), char(sum >> 8), char(sum) };
+		return true;
+	}
+
+	// Sends one or more complete messages. A Compressed message carries the
+	// original size followed by the zlib stream of all of them.
+	void sendMessage(SendBuffer& buffer) {
+		uint32_t threshold = compress_threshold;
+		uLong size = static_cast<uLong>(buffer.TellPut());
+		if (shared_ring.wants(size) && sendShared(buffer))
+			return;
+		auto priority = priorityOf(buffer);
+		std::vector<std::string> parts;
+		size_t packed_size = 0;
+		if (threshold && size >= threshold &&
+			compressParts(static_cast<const Bytef*>(buffer.Base()), size, parts)) {
+			for (const auto& part : parts)
+				packed_size += part.size();
+		}
+		if (packed_size && 9 + packed_size < size) {
+			auto packed = send_pool.acquire(9 + packed_size);
+			packed.PutUnsignedInt(0);
+			packed.PutChar(MessageType::Compressed);
+			packed.PutUnsignedInt(size);
+			for (const auto& part : parts)
+				packed.Put(part.data(), part.size());
+			*(uint32_t*)packed.Base() = packed.TellPut() - 5;
+			countSent(packed.TellPut());
+			outbound.push(priority, packed.take());
+			return;
+		}
+		countSent(size);
+		outbound.push(priority, buffer.take());
+	}
+
+	// SharedPayload: [uint32 position][uint32 length]. The messages are in
+	// the ring; only where they are goes over the socket.
+	bool sendShared(SendBuffer& buffer) {
+		std::lock_guard<std::mutex> lock(shared_ring.lock);
+		uint32_t position;
+		if (!shared_ring.write(buffer.Base(), buffer.TellPut(), &position))
+			return false;
+		auto notice = send_pool.acquire(13);
+		notice.PutUnsignedInt(8);
+		notice.PutChar(MessageType::SharedPayload);
+		notice.PutUnsignedInt(position);
+		notice.PutUnsignedInt(buffer.TellPut());
+		countSent(buffer.TellPut());
+		outbound.push(priorityOf(buffer), notice.take());
+		return true;
+	}
+
+	// A message another client serialized, sent as is: it isn't compressed
+	// or put in the ring, so every observer shares the same bytes.
+	void pushObserved(SendQueue::priority_e priority, const std::shared_ptr<std::string>& data) {
+		countSent(data->size());
+		outbound.push(priority, data);
+	}
+
+	void countSent(size_t bytes) {
+		traffic.bytes_sent.fetch_add(bytes, std::memory_order_relaxed);
+		traffic.messages_sent.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Bytes putVariable writes, for sizing the reply up front.
+	static size_t variableSize(const variable_s& var) {
+		return 4 * sizeof(int) + var.name.size() + var.value.size() +
+			var.type.size() + 3;
+	}
+
+	void putVariable(SendBuffer& buffer, const variable_s& var) {
+		buffer.PutLenString(var.name);
+		buffer.PutLenString(var.value);
+		buffer.PutLenString(var.type);
+		buffer.PutInt(var.children);
+	}
+
+	// With CapDeltas, scope and watch values are compared with what this
+	// client was last sent under the same key. An unchanged one goes out as
+	// [name][uint8 1][int children], a changed one as
+	// [name][uint8 0][value][type][int children]. Stops fill it on the game
+	// thread and requests on the request threads, and Hello clears it.
+	std::mutex sent_values_lock;
+	std::unordered_map<std::string, std::string> sent_values;
+
+	// Key prefix of a scope: plugin, kind and, for locals, the frame: its
+	// function, depth from the outermost frame and frame address, so a
+	// recursive call is not compared with its caller.
+	std::string deltaScope(const char* kind, int frame_id = -1) {
+		std::string function;
+		size_t depth = 0;
+		cell_t frm = 0;
+		if (frame_id >= 0) {
+			auto& stack = collectCallStack();
+			if (static_cast<size_t>(frame_id) < stack.size()) {
+				function = stack[frame_id].name;
+				depth = stack.size() - 1 - frame_id;
+				frm = stack[frame_id].frm;
+			}
+		}
+		return fmt::format("{}:{}:{}:{}:{}:", (void*)context_, kind, function, depth, frm);
+	}
+
+	void putVariableDelta(SendBuffer& buffer, const std::string& scope,
+		const variable_s& var) {
+		std::string sent = var.value;
+		sent += '\0';
+		sent += var.type;
+		bool same;
+		{
+			std::lock_guard<std::mutex> lock(sent_values_lock);
+			auto& last = sent_values[scope + var.name];
+			same = last == sent;
+			if (!same)
+				last = std::move(sent);
+		}
+
+		buffer.PutLenString(var.name);
+		buffer.PutChar(same);
+		if (!same) {
+			buffer.PutLenString(var.value);
+			buffer.PutLenString(var.type);
+		}
+		// Handles are per stop, so they are always sent.
+		buffer.PutInt(var.children);
+	}
+
+	void sendChildren(uint32_t handle, uint32_t start, uint32_t count) {
+		std::vector<variable_s> vars;
+		uint32_t total = 0;
+		if (current_state != DebugRun && current_image && handle > 0 &&
+			handle <= children.size()) {
+			// Copy, since expanding a child may grow the handle table.
+			child_s parent = children[handle - 1];
+			scope_frm_ = parent.frm;
+			total = childCount(parent);
+			count = std::min<uint32_t>(count, MAX_VARIABLE_ELEMENTS);
+			uint32_t end = start < total ? std::min(total, start + count) : start;
+			// Elements of a legacy row are read as one span.
+			const cell_t* cells = nullptr;
+			if (parent.sym && parent.level + 1 >= parent.sym->dimcount() && end > start)
+				cells = get_symbolcells(&*parent.sym, parent.base + start, end - start);
+			formatVariables(end - start, vars, [&](size_t i) {
+				if (!cells)
+					return childVariable(parent, uint32_t(start + i));
+				variable_s var;
+				var.name = std::to_string(start + i);
+				printvalue(cells[i], (parent.sym->vclass() & ~DISP_MASK), var.value, var.type);
+				return var;
+			});
+		}
+
+		size_t size = 32;
+		for (const auto& var : vars)
+			size += variableSize(var);
+		auto buffer = send_pool.acquire(size);
+		buffer.PutUnsignedInt(0);
+		buffer.PutChar(MessageType::Children);
+		buffer.PutInt(handle);
+		buffer.PutInt(start);
+		buffer.PutInt(total);
+		buffer.PutInt(vars.size());
+		for (const auto& var : vars)
+			putVariable(buffer, var);
+		*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
+		sendMessage(buffer);
+	}
+
+	variable_s display_variable(SmxV1Image::Symbol* sym, uint32_t index[],
+		int idxlevel) {
 		variable_s var;
 		var.name = "N/A";
 		if (current_image->GetDebugName(sym->name()) != nullptr) {
@@ -414,65 +2002,54 @@ public:
 		var.type = "N/A";
 		var.value = "";
 		cell_t value;
-		std::unique_ptr<std::vector<SmxV1Image::ArrayDim*>> symdims;
+		SmxV1Image::ArrayDims symdims;
 		assert(index != NULL);
 		auto rtti = sym->rtti();
-		if (rtti && rtti->type_id)
+		if (rtti && rtti->type_id && current_image->rtti_data())
 		{
 			uint32_t base = static_cast<uint32_t>(rtti->address);
 			if (sym->vclass() == 1 || sym->vclass() == 3) // local var or arg but not static
-				base += frm_; // addresses of local vars are relative to the frame
+				base += scope_frm_; // addresses of local vars are relative to the frame
 
-			try
-			{
-				auto json = read_variable(base, rtti->type_id, nullptr, sym->vclass() == 0x3);
-				if (!json.empty())
-				{
-					var.value = json.dump();
-					return var;
-				}
-			}
-			catch(...)
-			{
-				// skip rtti parse
+			auto type = current_image->rtti_data()->typeFromTypeId(rtti->type_id);
+			uint32_t addr = base;
+			if (write_variable(var.value, base, type, sym->vclass() == 0x3)) {
+				var.children = addChildren(type, addr, sym->vclass() == 0x3);
+				return var;
 			}
 		}
 		// first check whether the variable is visible at all
-		if ((uint32_t)cip_ < sym->codestart() ||
-			(uint32_t)cip_ > sym->codeend()) {
+		if ((uint32_t)scope_cip_ < sym->codestart() ||
+			(uint32_t)scope_cip_ > sym->codeend()) {
 			var.value = "Not in scope.";
 			return var;
 		}
 
 		// set default display type for the symbol (if none was set)
 		if ((sym->vclass() & ~DISP_MASK) == 0) {
-			const char* tagname = current_image->GetTagName(sym->tagid());
-			if (tagname != nullptr) {
-				if (!stricmp(tagname, "bool")) {
-					sym->setVClass(sym->vclass() | DISP_BOOL);
-				}
-				else if (!stricmp(tagname, "float")) {
-					sym->setVClass(sym->vclass() | DISP_FLOAT);
-				}
+			switch (current_image->GetTagKind(sym->tagid())) {
+			case SmxV1Image::TagKind::Bool:
+				sym->setVClass(sym->vclass() | DISP_BOOL);
+				break;
+			case SmxV1Image::TagKind::Float:
+				sym->setVClass(sym->vclass() | DISP_FLOAT);
+				break;
+			default:
+				break;
 			}
 			if ((sym->vclass() & ~DISP_MASK) == 0 &&
 				(sym->ident() == sp::IDENT_ARRAY ||
 					sym->ident() == sp::IDENT_REFARRAY) &&
 				sym->dimcount() == 1) {
-				/* untagged array with a single dimension, walk through all
-				 * elements and check whether this could be a string
+				/* untagged array with a single dimension, check whether
+				 * its terminated contents could be a string
 				 */
-				char* ptr = get_string(sym);
+				size_t size;
+				char* ptr = get_string(sym, &size);
 				if (ptr != nullptr) {
-					uint32_t i;
-					for (i = 0; ptr[i] != '\0'; i++) {
-						if ((ptr[i] < ' ' && ptr[i] != '\n' && ptr[i] != '\r' &&
-							ptr[i] != '\t'))
-							break; // non-ASCII character
-						if (i == 0 && !isalpha(ptr[i]))
-							break; // want a letter at the start
-					}
-					if (i > 0 && ptr[i] == '\0')
+					size_t scan = size ? size : string_limit + 1;
+					auto nul = static_cast<const char*>(memchr(ptr, '\0', scan));
+					if (nul && looks_like_text(ptr, nul - ptr))
 						sym->setVClass(sym->vclass() | DISP_STRING);
 				}
 			}
@@ -481,12 +2058,12 @@ public:
 		if (sym->ident() == sp::IDENT_ARRAY ||
 			sym->ident() == sp::IDENT_REFARRAY) {
 			int dim;
-			symdims = std::make_unique< std::vector<SmxV1Image::ArrayDim*>>(*current_image->GetArrayDimensions(sym));
+			symdims = current_image->GetArrayDimensions(sym);
 			// check whether any of the indices are out of range
-			assert(symdims != nullptr);
+			assert(!symdims.empty());
 			for (dim = 0; dim < idxlevel; dim++) {
-				if (symdims->at(dim)->size() > 0 &&
-					index[dim] >= symdims->at(dim)->size())
+				if (symdims[dim].size() > 0 &&
+					index[dim] >= symdims[dim].size())
 					break;
 			}
 			if (dim < idxlevel) {
@@ -503,10 +2080,11 @@ public:
 			// Print string
 			if ((sym->vclass() & ~DISP_MASK) == DISP_STRING) {
 				var.type = "String";
-				char* str = get_string(sym);
+				size_t size, length;
+				char* str = get_string(sym, &size);
 				if (str != nullptr)
 				{
-					var.value = str;
+					var.value = boundedString(str, size, &length);
 				}
 				else
 					var.value = "NULL_STRING";
@@ -514,45 +2092,26 @@ public:
 			// Print one-dimensional array
 			else if (sym->dimcount() == 1) {
 
-				if (!noarray)
-					var.type = "Array";
-				assert(symdims != nullptr); // set in the previous block
-				uint32_t len = symdims->at(0)->size();
-				uint32_t i;
+				var.type = "Array";
+				assert(!symdims.empty()); // set in the previous block
+				uint32_t len = symdims[0].size();
 				auto type = (sym->vclass() & ~DISP_MASK);
-				if (type == DISP_FLOAT)
-				{
-					json = std::vector<float>();
-				}
-				else if (type == DISP_BOOL)
-				{
-					json = std::vector<bool>();
-				}
-				else
-				{
-					json = std::vector<cell_t>();
+				var.value = "[";
+				auto cells = get_symbolcells(sym, 0, len);
+				if (cells && len > SUMMARY_ELEMENTS) {
+					var.value = summarizeArray(cells, len, type == DISP_FLOAT);
 				}
-				for (i = 0; i < len; i++) {
-					if (get_symbolvalue(sym, i, &value))
-					{
-						if (type == DISP_FLOAT) {
-							json.push_back(sp_ctof(value));
-						}
-						else if (type == DISP_BOOL)
-						{
-							json.push_back(value);
-						}
-						else
-						{
-							json.push_back(value);
-						}
-					}
+				else {
+					if (cells)
+						write_cells(var.value, cells, len, type == DISP_FLOAT, "\n    ", ",\n    ");
+					var.value += len ? "\n]" : "]";
 				}
-				var.value = json.dump(4).c_str();
+				var.children = addChildren(*sym, 0, 0);
 			}
-			// Not supported..
+			// Only browsable through its children.
 			else {
 				var.value = "(multi-dimensional array)";
+				var.children = addChildren(*sym, 0, 0);
 			}
 		}
 		else if (sym->ident() != sp::IDENT_ARRAY &&
@@ -567,8 +2126,7 @@ public:
 			int dim;
 			int base = 0;
 			for (dim = 0; dim < idxlevel - 1; dim++) {
-				if (!noarray)
-					var.type = "Array";
+				var.type = "Array";
 				base += index[dim];
 				if (!get_symbolvalue(sym, base, &value))
 					break;
@@ -587,32 +2145,31 @@ public:
 		return var;
 	}
 
-	void evaluateVar(int frame_id, char* variable) {
+	void evaluateVar(int frame_id, const char* variable) {
 		if (current_state != DebugRun) {
-			auto imagev1 = current_image.get();
-
+			selectFrame(frame_id);
 			std::unique_ptr<SmxV1Image::Symbol> sym;
-			if (imagev1->GetVariable(variable, cip_, sym)) {
+			variable_s var;
+			// Expressions always answer, with the reason if they can't be computed.
+			bool found = true;
+			if (!isIdentifier(variable)) {
+				var = expressionVariable(variable);
+			}
+			else if ((found = lookupVariable(variable, sym))) {
 				uint32_t idx[MAX_DIMS], dim;
 				dim = 0;
 				memset(idx, 0, sizeof idx);
-				auto var = display_variable(sym.get(), idx, dim);
-				CUtlBuffer buffer;
+				var = display_variable(sym.get(), idx, dim);
+			}
+			if (found) {
+				auto buffer = send_pool.acquire(8 + variableSize(var));
 				buffer.PutUnsignedInt(0);
 				{
 					buffer.PutChar(MessageType::Evaluate);
-					buffer.PutInt(var.name.size() + 1);
-					buffer.PutString(var.name.c_str());
-					buffer.PutInt(var.value.size() + 1);
-					buffer.PutString(var.value.c_str());
-					;
-					buffer.PutInt(var.type.size() + 1);
-					buffer.PutString(var.type.c_str());
-					buffer.PutInt(0);
+					putVariable(buffer, var);
 				}
 				*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
-				socket->send(static_cast<const char*>(buffer.Base()),
-					static_cast<size_t>(buffer.TellPut()));
+				sendMessage(buffer);
 			}
 		}
 	}
@@ -622,7 +2179,7 @@ public:
 		cell_t* vptr;
 		cell_t base = sym->addr();
 		if (sym->vclass() & DISP_MASK)
-			base += frm_; // addresses of local vars are relative to the frame
+			base += scope_frm_; // addresses of local vars are relative to the frame
 
 		// a reference
 		if (sym->ident() == sp::IDENT_REFERENCE ||
@@ -646,7 +2203,7 @@ public:
 		cell_t* vptr;
 		cell_t base = sym->addr();
 		if (sym->vclass() & DISP_MASK)
-			base += frm_; // addresses of local vars are relative to the frame
+			base += scope_frm_; // addresses of local vars are relative to the frame
 
 		// a reference
 		if (sym->ident() == sp::IDENT_REFERENCE ||
@@ -656,9 +2213,10 @@ public:
 			base = *vptr;
 		}
 
-		std::unique_ptr<std::vector<SmxV1Image::ArrayDim*>> dims;
-		dims = std::make_unique<std::vector<SmxV1Image::ArrayDim*>>(*current_image->GetArrayDimensions(sym));
-		return context_->StringToLocalUTF8(base, dims->at(0)->size(), str,
+		auto dims = current_image->GetArrayDimensions(sym);
+		if (dims.empty())
+			return false;
+		return context_->StringToLocalUTF8(base, dims[0].size(), str,
 			NULL) == SP_ERROR_NONE;
 	}
 
@@ -666,11 +2224,11 @@ public:
 		bool success = false;
 		bool valid_value = true;
 		if (current_state != DebugRun) {
-			auto imagev1 = current_image.get();
 			std::unique_ptr<SmxV1Image::Symbol> sym;
 			cell_t result = 0;
 			value.erase(remove(value.begin(), value.end(), '\"'), value.end());
-			if (imagev1->GetVariable(var.c_str(), cip_, sym)) {
+			selectFrame(0);
+			if (lookupVariable(var.c_str(), sym)) {
 
 				if ((sym->ident() == IDENT_ARRAY ||
 					sym->ident() == IDENT_REFARRAY)) {
@@ -706,24 +2264,21 @@ public:
 					}
 				}
 
-				if (valid_value &&
-					(imagev1->GetVariable(var.c_str(), cip_, sym))) {
+				if (valid_value)
 					success = set_symbolvalue(sym.get(), index, (cell_t)result);
-				}
 			}
 		}
-		CUtlBuffer buffer;
+		auto buffer = send_pool.acquire();
 		buffer.PutUnsignedInt(0);
 		{
 			buffer.PutChar(MessageType::SetVariable);
 			buffer.PutInt(success);
 		}
 		*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
-		socket->send(static_cast<const char*>(buffer.Base()),
-			static_cast<size_t>(buffer.TellPut()));
+		sendMessage(buffer);
 	}
 
-	void sendVariables(char* scope) {
+	void sendVariables(const char* scope) {
 		bool local_scope = strstr(scope, ":%local%");
 		bool global_scope = strstr(scope, ":%global%");
 		if (current_state != DebugRun) {
@@ -736,82 +2291,88 @@ public:
 				dim = 0;
 				memset(idx, 0, sizeof idx);
 				std::vector<variable_s> vars;
-				if (local_scope || global_scope) {
-					SmxV1Image::SymbolIterator iter = imagev1->symboliterator(global_scope);
-					while (!iter.Done()) {
-						const auto sym = iter.Next();
-
-						// Only variables in scope.
-						if (sym->ident() != sp::IDENT_FUNCTION &&
-							(sym->codestart() <= (uint32_t)cip_ &&
-								sym->codeend() >= (uint32_t)cip_) || global_scope) {
-							auto var = display_variable(sym, idx, dim);
-							if (local_scope) {
-								if ((sym->vclass() & DISP_MASK) > 0) {
-									vars.push_back(var);
-								}
-							}
-							else {
-								if (!((sym->vclass() & DISP_MASK) > 0)) {
-									vars.push_back(var);
-								}
-							}
-						}
-					}
+				bool deltas = (capabilities & CapDeltas) && (local_scope || global_scope);
+				int frame_id = 0;
+				if (local_scope) {
+					// The scope is "<frame>:%local%"; no frame means the top one.
+					frame_id = selectFrame(atoi(scope));
+					auto& syms = frameLocals(frame_id);
+					formatVariables(syms.size(), vars, [&](size_t i) {
+						uint32_t at[sDIMEN_MAX] = {};
+						return display_variable(&syms[i], at, 0);
+					});
+				}
+				else if (global_scope) {
+					selectFrame(0);
+					globalVariables(&vars);
 				}
 				else {
-					if (imagev1->GetVariable(scope, cip_, sym)) {
-						auto var = display_variable(sym.get(), idx, dim, true);
-						std::string var_name = scope;
-						auto values = split_string(var.value, ",");
-						int i = 0;
-						for (auto val : values) {
-							vars.push_back({ std::to_string(i), val, var.type });
-							i++;
+					selectFrame(0);
+					if (lookupVariable(scope, sym)) {
+						// One entry per element, read from memory and typed
+						// like the children of a handle.
+						uint32_t handle = symbolChildren(sym.get());
+						if (handle) {
+							child_s parent = children[handle - 1];
+							uint32_t total = std::min<uint32_t>(childCount(parent), MAX_VARIABLE_ELEMENTS);
+							formatVariables(total, vars, [&](size_t i) {
+								return childVariable(parent, uint32_t(i));
+							});
+						}
+						else {
+							auto var = display_variable(sym.get(), idx, dim);
+							var.name = "0";
+							vars.push_back(std::move(var));
 						}
 					}
 				}
-				CUtlBuffer buffer;
+				size_t size = 16 + strlen(scope);
+				for (const auto& var : vars)
+					size += variableSize(var);
+				auto buffer = send_pool.acquire(size);
 				buffer.PutUnsignedInt(0);
 				buffer.PutChar(Variables);
-				buffer.PutInt(strlen(scope) + 1);
-				buffer.PutString(scope);
+				buffer.PutLenString(scope);
 				buffer.PutInt(vars.size());
-				for (auto var : vars) {
-					buffer.PutInt(var.name.size() + 1);
-					buffer.PutString(var.name.c_str());
-					buffer.PutInt(var.value.size() + 1);
-					buffer.PutString(var.value.c_str());
-					;
-					buffer.PutInt(var.type.size() + 1);
-					buffer.PutString(var.type.c_str());
-					buffer.PutInt(0);
+				if (deltas) {
+					auto key = local_scope ? deltaScope("local", frame_id) : deltaScope("global");
+					for (const auto& var : vars)
+						putVariableDelta(buffer, key, var);
+				}
+				else {
+					for (const auto& var : vars)
+						putVariable(buffer, var);
 				}
 				*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
-				socket->send(static_cast<const char*>(buffer.Base()),
-					static_cast<size_t>(buffer.TellPut()));
+				sendMessage(buffer);
 			}
 		}
 	}
 
-	void CallStack() {
-		std::vector<call_stack_s> callStack;
+	// The stack is captured once per stop and reused until the VM resumes;
+	// the client asks for it again on every step and refresh.
+	std::vector<call_stack_s> stop_stack;
+	bool stop_stack_valid = false;
+
+	const std::vector<call_stack_s>& collectCallStack() {
+		if (stop_stack_valid)
+			return stop_stack;
+		stop_stack.clear();
 		if (current_state == DebugException) {
 			if (debug_iter) {
-				uint32_t index = 0;
-				for (; !debug_iter->Done(); debug_iter->Next(), index++) {
+				for (; !debug_iter->Done(); debug_iter->Next()) {
 
 					if (debug_iter->IsNativeFrame()) {
-						callStack.push_back({ 0,
-											 debug_iter->FunctionName(),
-											 "native" });
+						call_stack_s frame{ 0, debug_iter->FunctionName(), "native" };
+						stop_stack.push_back(std::move(frame));
 					}
 					else if (debug_iter->IsScriptedFrame()) {
-						auto current_file = std::filesystem::path(debug_iter->FilePath()).filename().string();
-						lowercase(current_file);
-						callStack.push_back({ debug_iter->LineNumber() - 1,
-											 debug_iter->FunctionName(),
-											 current_file });
+						auto file = DebugFiles.intern(debug_iter->FilePath());
+						call_stack_s frame{ debug_iter->LineNumber() - 1,
+											debug_iter->FunctionName(),
+											DebugFiles.name(file) };
+						frame.file = file;
+						stop_stack.push_back(std::move(frame));
 					}
 				}
 			}
@@ -821,356 +2382,2687 @@ public:
 
 			IFrameIterator* iter = context_->CreateFrameIterator();
 
-			uint32_t index = 0;
-			for (; !iter->Done(); iter->Next(), index++) {
+			// Scripted frames of the stopped plugin are linked through the
+			// frm saved by each PROC, one cell above the frame base.
+			cell_t frm = frm_;
+			cell_t cip = cip_;
+			for (; !iter->Done(); iter->Next()) {
 
 				if (iter->IsNativeFrame()) {
-					callStack.push_back({ 0,
-										 iter->FunctionName(),
-										 "" });
+					call_stack_s frame{ 0, iter->FunctionName(), "" };
+					stop_stack.push_back(std::move(frame));
 				}
 				else if (iter->IsScriptedFrame()) {
-					std::string current_file = iter->FilePath();
-					for (auto file : files) {
-						if (file.find(current_file) != std::string::npos) {
-							current_file = file;
-							break;
-						}
+					const char* path = iter->FilePath();
+					auto file = DebugFiles.intern(path);
+					call_stack_s frame{ iter->LineNumber() - 1,
+										iter->FunctionName(),
+										files.count(file) ? DebugFiles.name(file) : path };
+					frame.file = file;
+					if (iter->Context() == context_ && frm) {
+						// Callers only know their line; its first address
+						// is close enough to pick the scope.
+						uint32_t addr;
+						if (!cip && current_image &&
+							current_image->GetLineAddress(frame.line, path, &addr))
+							cip = addr;
+						frame.frm = frm;
+						frame.cip = cip;
+
+						cell_t* saved;
+						if (context_->LocalToPhysAddr(frm + sizeof(cell_t), &saved) == SP_ERROR_NONE)
+							frm = *saved;
+						else
+							frm = 0;
+						cip = 0;
 					}
-					callStack.push_back({ iter->LineNumber() - 1,
-										 iter->FunctionName(), current_file });
+					stop_stack.push_back(std::move(frame));
 				}
 			}
 			context_->DestroyFrameIterator(iter);
 		}
-
-		CUtlBuffer buffer;
-		buffer.PutUnsignedInt(0);
-		{
-			buffer.PutChar(MessageType::CallStack);
-			buffer.PutInt(callStack.size());
-			for (auto stack : callStack) {
-				buffer.PutInt(stack.name.size() + 1);
-				buffer.PutString(stack.name.c_str());
-				buffer.PutInt(stack.filename.size() + 1);
-				buffer.PutString(stack.filename.c_str());
-				buffer.PutInt(stack.line + 1);
-			}
-		}
-		*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
-		socket->send(static_cast<const char*>(buffer.Base()),
-			static_cast<size_t>(buffer.TellPut()));
+		stop_stack_valid = true;
+		return stop_stack;
 	}
 
-	void WaitWalkCmd(std::string reason = "Breakpoint",
-		std::string text = "N/A") {
-		if (!receive_walk_cmd) {
-			CUtlBuffer buffer;
-			{
-				buffer.PutUnsignedInt(0);
-				{
-					buffer.PutChar(MessageType::HasStopped);
-					buffer.PutInt(reason.size() + 1);
-					buffer.PutString(reason.c_str());
-					buffer.PutInt(reason.size() + 1);
-					buffer.PutString(reason.c_str());
-					buffer.PutInt(text.size() + 1);
-					buffer.PutString(text.c_str());
-				}
-				*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
-			}
-			socket->send(static_cast<const char*>(buffer.Base()),
-				static_cast<size_t>(buffer.TellPut()));
-			std::unique_lock<std::mutex> lck(mtx);
-			cv.wait(lck, [this] { return receive_walk_cmd; });
-		}
-		if(current_state == DebugDead)
-		{
-			unload = true;
-			throw debugger_stopped();
-		}
+	// Points scope_frm_/scope_cip_ at a frame of the captured stack and
+	// returns the frame actually used; frames without a known frm fall
+	// back to the stop point.
+	int selectFrame(int frame_id) {
+		scope_frm_ = frm_;
+		scope_cip_ = cip_;
+		if (frame_id <= 0)
+			return 0;
+		auto& stack = collectCallStack();
+		if (static_cast<size_t>(frame_id) >= stack.size() || !stack[frame_id].frm)
+			return 0;
+		scope_frm_ = stack[frame_id].frm;
+		scope_cip_ = stack[frame_id].cip;
+		return frame_id;
 	}
 
-	void ReportError(const IErrorReport& report, IFrameIterator& iter) {
-		receive_walk_cmd = false;
-		current_state = DebugException;
-		context_ = iter.Context();
-		debug_iter = &iter;
-		WaitWalkCmd("exception", report.Message());
+	// Locals of each frame, resolved on first use and kept until the VM
+	// resumes, so switching frames doesn't rescan the symbol table.
+	std::pmr::unordered_map<int, std::vector<SmxV1Image::Symbol>> frame_locals{ &stop_arena };
+
+	std::vector<SmxV1Image::Symbol>& frameLocals(int frame_id) {
+		auto found = frame_locals.find(frame_id);
+		if (found != frame_locals.end())
+			return found->second;
+		auto& syms = frame_locals[frame_id];
+		if (current_image)
+			current_image->GetLocalVariables(scope_cip_, &syms);
+		return syms;
 	}
-	int(DebugHook)(SourcePawn::IPluginContext* ctx,
-		sp_debug_break_info_t& BreakInfo) {
-		std::string filename = ctx->GetRuntime()->GetFilename();
-		auto image = images.find(filename);
-		if (image == images.end()) {
-			FILE* fp = fopen(filename.c_str(), "rb");
-			current_image = std::make_shared<SmxV1Image>(fp);
-			current_image->validate();
-			images.insert({ filename, current_image });
-			fclose(fp);
-		}
-		else {
-			current_image = image->second;
-		}
-		context_ = ctx;
-		if (current_state == DebugDead)
-			return current_state;
 
-		context_ = ctx;
-		cip_ = BreakInfo.cip;
-		// Reset the state.
-		frm_ = BreakInfo.frm;
-		receive_walk_cmd = false;
+	// Globals as formatted at the last refresh of the global scope, with
+	// hashes of the data section in blocks as it was then. A global whose
+	// blocks all hash the same again is sent as it was, so stepping through
+	// a plugin with large globals only formats the ones that changed.
+	static constexpr uint32_t kGlobalBlockBytes = 256;
+	struct cached_global_s {
+		variable_s var;
+		// What var.children stood for; the handle is made again per stop.
+		std::optional<child_s> child;
+		bool in_scope;
+	};
+	struct global_cache_s {
+		SourcePawn::IPluginContext* ctx = nullptr;
+		SmxV1Image* image = nullptr;
+		size_t string_limit = 0;
+		std::vector<uint64_t> blocks;
+		// By address and name.
+		std::unordered_map<uint64_t, cached_global_s> values;
+	};
+	global_cache_s global_cache;
 
-		IFrameIterator* iter = context_->CreateFrameIterator();
-		std::string current_file = "N/A";
-		uint32_t index = 0;
-		for (; !iter->Done(); iter->Next(), index++) {
+	void globalVariables(std::vector<variable_s>* vars) {
+		std::vector<SmxV1Image::Symbol> syms;
+		current_image->GetGlobalVariables(&syms);
 
-			if (iter->IsNativeFrame()) {
-				continue;
+		auto data = current_image->DescribeData();
+		uint32_t data_size = static_cast<uint32_t>(data.length);
+		std::vector<uint64_t> blocks;
+		cell_t* first;
+		cell_t* last;
+		if (data_size && context_->LocalToPhysAddr(0, &first) == SP_ERROR_NONE &&
+			context_->LocalToPhysAddr(data_size - sizeof(cell_t), &last) == SP_ERROR_NONE) {
+			auto bytes = reinterpret_cast<const uint8_t*>(first);
+			blocks.resize((data_size + kGlobalBlockBytes - 1) / kGlobalBlockBytes);
+			for (size_t i = 0; i < blocks.size(); i++) {
+				size_t offset = i * kGlobalBlockBytes;
+				blocks[i] = SourcePawn::ImageHasher::hash(bytes + offset,
+					std::min<size_t>(kGlobalBlockBytes, data_size - offset));
 			}
+		}
 
-			if (iter->IsScriptedFrame()) {
-				current_file = std::filesystem::path(iter->FilePath()).filename().string();
-				lowercase(current_file);
+		size_t limit = string_limit.load(std::memory_order_relaxed);
+		bool reuse = !blocks.empty() && global_cache.ctx == context_ &&
+			global_cache.image == current_image.get() && global_cache.string_limit == limit &&
+			global_cache.blocks.size() == blocks.size();
+		// Blocks changed before each one, so a range is checked with two loads.
+		std::vector<uint32_t> changed(blocks.size() + 1, 0);
+		for (size_t i = 0; reuse && i < blocks.size(); i++)
+			changed[i + 1] = changed[i] + (blocks[i] != global_cache.blocks[i]);
 
-				for (auto file : files) {
-					if (file.find(current_file) != std::string::npos) {
-						current_file = file;
-						break;
-					}
+		// A global runs up to the next one; multi-dimensional arrays keep
+		// their rows right after the indirection vectors.
+		std::vector<uint32_t> starts;
+		for (const auto& sym : syms)
+			starts.push_back(static_cast<uint32_t>(sym.addr()));
+		std::sort(starts.begin(), starts.end());
+
+		// Formatted in parts; the cache is only read until they are done.
+		size_t base = vars->size();
+		std::vector<uint8_t> in_scope(syms.size());
+		auto keyOf = [&](size_t i) {
+			return (uint64_t(static_cast<uint32_t>(syms[i].addr())) << 32) | syms[i].name();
+		};
+		formatVariables(syms.size(), *vars, [&](size_t i) {
+			auto& sym = syms[i];
+			uint32_t addr = static_cast<uint32_t>(sym.addr());
+			auto next = std::upper_bound(starts.begin(), starts.end(), addr);
+			uint32_t end = next == starts.end() ? data_size : *next;
+			in_scope[i] = (uint32_t)scope_cip_ >= sym.codestart() &&
+				(uint32_t)scope_cip_ <= sym.codeend();
+
+			if (reuse && addr < end && end <= data_size &&
+				changed[(end - 1) / kGlobalBlockBytes + 1] == changed[addr / kGlobalBlockBytes]) {
+				auto found = global_cache.values.find(keyOf(i));
+				if (found != global_cache.values.end() && found->second.in_scope == bool(in_scope[i])) {
+					auto var = found->second.var;
+					if (found->second.child)
+						var.children = keepChild(*found->second.child);
+					return var;
 				}
-				break;
 			}
+			uint32_t idx[MAX_DIMS] = {};
+			return display_variable(&sym, idx, 0);
+		});
+
+		std::unordered_map<uint64_t, cached_global_s> values;
+		for (size_t i = 0; i < syms.size(); i++) {
+			auto& var = (*vars)[base + i];
+			cached_global_s entry{ var, std::nullopt, bool(in_scope[i]) };
+			if (var.children)
+				entry.child = children[var.children - 1];
+			values.emplace(keyOf(i), std::move(entry));
 		}
-		context_->DestroyFrameIterator(iter);
 
-		static uint32_t lastline = 0;
-		current_image->LookupLine(cip_, &current_line);
-		// Reset the frame iterator, so stack traces start at the beginning
-		// again.
+		global_cache.ctx = context_;
+		global_cache.image = current_image.get();
+		global_cache.string_limit = limit;
+		global_cache.blocks = std::move(blocks);
+		global_cache.values = std::move(values);
+	}
 
-		/* dont break twice */
-		if (current_line == lastline)
-			return current_state;
+	void putCallStack(SendBuffer& buffer, const std::vector<call_stack_s>& callStack) {
+		buffer.PutInt(callStack.size());
+		for (const auto& stack : callStack) {
+			buffer.PutLenString(stack.name);
+			buffer.PutLenString(stack.filename);
+			buffer.PutInt(stack.line + 1);
+		}
+	}
+
+	void CallStack() {
+		auto& callStack = collectCallStack();
+		size_t size = 16;
+		for (const auto& stack : callStack)
+			size += 3 * sizeof(int) + stack.name.size() + stack.filename.size() + 2;
+		auto buffer = send_pool.acquire(size);
+		buffer.PutUnsignedInt(0);
+		{
+			buffer.PutChar(MessageType::CallStack);
+			putCallStack(buffer, callStack);
+		}
+		*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
+		sendMessage(buffer);
+	}
+
+	// With the snapshot enabled, a stop ships the call stack, the top
+	// frame's locals and the watches right behind HasStopped, so the client
+	// doesn't need a round trip for each of them.
+	bool stop_snapshot = false;
+	std::vector<std::string> watches;
+
+	// Where the time building a stop went, in nanoseconds; the rest of it
+	// was serialization.
+	struct stop_timing_s {
+		uint32_t stack = 0;		// walking the frames
+		uint32_t format = 0;	// formatting locals and watches
+	};
+
+	void putStopSnapshot(SendBuffer& buffer, bool deltas, stop_timing_s& timing) {
+		size_t start = buffer.TellPut();
+		buffer.PutUnsignedInt(0);
+		buffer.PutChar(MessageType::StopSnapshot);
+
+		// The exception path has no frame of its own to read locals from.
+		bool has_frame = current_state != DebugException && current_image;
+		auto mark = std::chrono::steady_clock::now();
+		auto stack = collectCallStack();
+		auto now = std::chrono::steady_clock::now();
+		timing.stack += elapsedNs(mark, now);
+		putCallStack(buffer, stack);
+
+		// Formatting and writing values interleave, so writing counts as
+		// formatting here.
+		mark = std::chrono::steady_clock::now();
+		uint32_t idx[MAX_DIMS] = { 0 };
+		selectFrame(0);
+		if (has_frame) {
+			auto& syms = frameLocals(0);
+			auto key = deltas ? deltaScope("local", 0) : std::string();
+			buffer.PutInt(syms.size());
+			for (auto& sym : syms) {
+				if (deltas)
+					putVariableDelta(buffer, key, display_variable(&sym, idx, 0));
+				else
+					putVariable(buffer, display_variable(&sym, idx, 0));
+			}
+		}
+		else {
+			buffer.PutInt(0);
+		}
+
+		auto watch_key = deltas ? deltaScope("watch") : std::string();
+		buffer.PutInt(watches.size());
+		for (const auto& watch : watches) {
+			std::unique_ptr<SmxV1Image::Symbol> sym;
+			variable_s var;
+			if (has_frame && !isIdentifier(watch.c_str())) {
+				var = expressionVariable(watch);
+			}
+			else if (has_frame && lookupVariable(watch.c_str(), sym)) {
+				var = display_variable(sym.get(), idx, 0);
+			}
+			else {
+				var.value = "(not available)";
+				var.type = "N/A";
+			}
+			var.name = watch;
+			if (deltas)
+				putVariableDelta(buffer, watch_key, var);
+			else
+				putVariable(buffer, var);
+		}
+		timing.format += elapsedNs(mark, std::chrono::steady_clock::now());
+		*(uint32_t*)((char*)buffer.Base() + start) = buffer.TellPut() - start - 5;
+	}
+
+	// Logpoint output and the like, pushed by the game thread and sent in
+	// batches by the debug thread, so a hit never waits on the network or
+	// a lock.
+	EventPipe events{ EVENT_PIPE_BYTES };
+
+	// A native or public logpoint's {N}, {N:s}, {N:f} or {args}: the Nth argument
+	// as a cell, a string or a float, or all of them as cells. False if
+	// |part| is none of those, or names an argument the call doesn't have.
+	bool formatNativeArg(const std::string& part, const cell_t* params, std::string& text) {
+		if (part == "args") {
+			for (cell_t i = 1; i <= params[0]; i++)
+				text += fmt::format(i > 1 ? ", {}" : "{}", params[i]);
+			return true;
+		}
+		char* end;
+		long arg = strtol(part.c_str(), &end, 10);
+		if (end == part.c_str() || arg < 1 || arg > params[0] ||
+			(*end && (end[0] != ':' || !end[1] || end[2])))
+			return false;
+		cell_t value = params[arg];
+		char* str;
+		size_t length;
+		switch (*end ? end[1] : 'd') {
+		case 'd':
+			text += std::to_string(value);
+			return true;
+		case 'f':
+			write_display_float(text, sp_ctof(value));
+			return true;
+		case 's':
+			if (context_->LocalToStringNULL(value, &str) != SP_ERROR_NONE || !str)
+				text += "null";
+			else
+				text += boundedString(str, 0, &length);
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	// With |params|, a native or public logpoint's hit: its arguments can
+	// be named too, see formatNativeArg.
+	std::string formatLog(break_site_s& site, const cell_t* params = nullptr) {
+		scope_frm_ = frm_;
+		scope_cip_ = cip_;
+		// Values are formatted inline, so their child handles aren't kept.
+		size_t handles = children.size();
+		uint32_t idx[MAX_DIMS] = { 0 };
+		std::string text;
+		auto& parts = site.bp->message;
+		for (size_t i = 0; i < parts.size(); i++) {
+			if (!parts[i].is_expr)
+				text += parts[i].text;
+			else if (params && formatNativeArg(parts[i].text, params, text))
+				continue;
+			else if (site.symbols[i])
+				text += display_variable(&*site.symbols[i], idx, 0).value;
+			else
+				text += "{" + parts[i].text + "?}";
+		}
+		children.resize(handles);
+		return text;
+	}
+
+	// Game thread only, the pipe's one producer. Lines that don't fit are
+	// dropped and counted.
+	void queueLog(const std::string& text) {
+		// Nobody reads the breakpoint file's logpoints but the server's
+		// log, which LogMessage writes and echoes to the console.
+		if (!socket) {
+			smutils->LogMessage(myself, "%s", text.c_str());
+			return;
+		}
+		events.push(EventPipe::Log, text.data(), uint32_t(text.size()));
+	}
+
+	// Over the tick budget the hit is only counted, and the count goes out
+	// with the next LogMessages.
+	void logHit(break_site_s& site, const cell_t* params = nullptr) {
+		if (DebugBudget.level() >= TickBudget::NoLogpoints) {
+			events.drop(EventPipe::Log);
+			return;
+		}
+		queueLog(formatLog(site, params));
+	}
+
+	// Snapshots taken by the game thread and not sent yet. Dropped ones,
+	// over the backlog or the tick budget, are only counted.
+	std::mutex snapshot_lock;
+	std::deque<Snapshot> snapshot_ring;
+	uint32_t snapshots_dropped = 0;
+
+	void takeSnapshot(SourcePawn::IPluginContext* ctx, const break_site_s& site, cell_t frm) {
+		if (DebugBudget.level() >= TickBudget::NoLogpoints) {
+			std::lock_guard<std::mutex> lock(snapshot_lock);
+			snapshots_dropped++;
+			return;
+		}
+		Snapshot snap;
+		snap.id = site.bp->id;
+		snap.plan = site.snapshot;
+		site.snapshot->capture(ctx, frm, &snap);
+
+		std::lock_guard<std::mutex> lock(snapshot_lock);
+		if (snapshot_ring.size() >= MAX_SNAPSHOT_BACKLOG) {
+			snapshot_ring.pop_front();
+			snapshots_dropped++;
+		}
+		snapshot_ring.push_back(std::move(snap));
+	}
+
+	// Snapshots: [int dropped][int count]{[int id][call stack]
+	// [int count]{variable}}, the stack and variables as in CallStack and
+	// Variables. Sends nothing if nothing was taken or dropped since the
+	// last call.
+	void flushSnapshots() {
+		std::deque<Snapshot> taken;
+		uint32_t dropped;
+		{
+			std::lock_guard<std::mutex> lock(snapshot_lock);
+			if (snapshot_ring.empty() && !snapshots_dropped)
+				return;
+			taken.swap(snapshot_ring);
+			dropped = snapshots_dropped;
+			snapshots_dropped = 0;
+		}
+		std::vector<std::vector<SnapshotPlan::value_s>> values;
+		size_t size = 16;
+		for (const auto& snap : taken) {
+			size += 3 * sizeof(int);
+			for (const auto& frame : snap.frames)
+				size += 3 * sizeof(int) + frame.name.size() + frame.file.size() + 2;
+			values.push_back(snap.plan->format(snap));
+			for (const auto& var : values.back())
+				size += 4 * sizeof(int) + var.name.size() + var.value.size() + var.type.size() + 3;
+		}
+		auto buffer = send_pool.acquire(size);
+		buffer.PutUnsignedInt(0);
+		buffer.PutChar(MessageType::Snapshots);
+		buffer.PutInt(dropped);
+		buffer.PutInt(taken.size());
+		for (size_t i = 0; i < taken.size(); i++) {
+			buffer.PutInt(taken[i].id);
+			buffer.PutInt(taken[i].frames.size());
+			for (const auto& frame : taken[i].frames) {
+				buffer.PutLenString(frame.name);
+				buffer.PutLenString(frame.file);
+				buffer.PutInt(frame.line + 1);
+			}
+			buffer.PutInt(values[i].size());
+			for (auto& var : values[i])
+				putVariable(buffer, { std::move(var.name), std::move(var.value), std::move(var.type), 0 });
+		}
+		*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
+		sendMessage(buffer);
+	}
+
+	// LogMessages: [int dropped][int count]{[int len][string]}. Sends
+	// nothing if nothing was logged or dropped since the last call.
+	// Debug thread only, the pipe's one consumer.
+	void flushLog() {
+		uint32_t dropped = events.takeDropped(EventPipe::Log);
+		if (events.empty() && !dropped)
+			return;
+		auto buffer = send_pool.acquire();
+		buffer.PutUnsignedInt(0);
+		buffer.PutChar(MessageType::LogMessages);
+		buffer.PutInt(dropped);
+		size_t count_at = buffer.TellPut();
+		buffer.PutInt(0);
+		int count = 0;
+		events.drain([&](EventPipe::type_e type, const char* data, uint32_t size) {
+			if (type != EventPipe::Log)
+				return;
+			buffer.PutLenString(std::string_view(data, size));
+			count++;
+		});
+		*(int*)((char*)buffer.Base() + count_at) = count;
+		*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
+		if (observer_count && !observer)
+			fanOutToObservers(SendQueue::Telemetry, buffer.data());
+		sendMessage(buffer);
+	}
+
+	// With CapTimings, HasStopped ends in [uint64 stopped at][uint32 hook
+	// entry to stop decision][uint32 stack capture][uint32 variable
+	// formatting][uint32 serialization], in ns, filled in by
+	// putStopTimings once the stop is built. Returns where they go.
+	size_t putHasStopped(SendBuffer& buffer, const std::string& reason, const std::string& text,
+		bool image_hash, bool timings) {
+		size_t start = buffer.TellPut();
+		buffer.PutUnsignedInt(0);
+		buffer.PutChar(MessageType::HasStopped);
+		buffer.PutLenString(reason);
+		buffer.PutLenString(reason);
+		buffer.PutLenString(text);
+		if (image_hash) {
+			auto plugin = context_ ? pluginState(context_) : nullptr;
+			buffer.PutUnsignedInt64(plugin ? plugin->image_hash : 0);
+		}
+		size_t timing_at = buffer.TellPut();
+		if (timings)
+			buffer.Extend(sizeof(uint64_t) + 4 * sizeof(uint32_t));
+		*(uint32_t*)((char*)buffer.Base() + start) = buffer.TellPut() - start - 5;
+		return timing_at;
+	}
+
+	// |decided| is when the client decided to stop, |built| when it began
+	// serializing this message.
+	static void putStopTimings(SendBuffer& buffer, size_t at, std::chrono::steady_clock::time_point decided,
+		std::chrono::steady_clock::time_point built, const stop_timing_s& timing) {
+		uint32_t total = elapsedNs(built, std::chrono::steady_clock::now());
+		uint32_t serialize = total - std::min(total, timing.stack + timing.format);
+		uint64_t stopped_at = monotonicNs(decided);
+		uint32_t fields[4] = { elapsedNs(hook_entered, decided), timing.stack, timing.format, serialize };
+		char* dest = (char*)buffer.Base() + at;
+		memcpy(dest, &stopped_at, sizeof(stopped_at));
+		memcpy(dest + sizeof(stopped_at), fields, sizeof(fields));
+	}
+
+	void WaitWalkCmd(std::string reason = "Breakpoint",
+		std::string text = "N/A") {
+		// The breakpoint file's breakpoints are held by DebugHandler until a
+		// client connects to take them; nothing else stops without one.
+		if (!socket) {
+			if (current_state == DebugBreakpoint)
+				boot_stop = true;
+			receive_walk_cmd = true;
+			current_state = DebugRun;
+			return;
+		}
+		if (!receive_walk_cmd) {
+			// Handles from the previous stop point at stale memory. What
+			// the stop kept goes before its arena does.
+			children = std::pmr::vector<child_s>(&stop_arena);
+			frame_locals = decltype(frame_locals)(&stop_arena);
+			stop_arena.reset();
+			stop_serial++;
+			stop_stack_valid = false;
+			auto decided = std::chrono::steady_clock::now();
+			// Whatever the stop queued before it waits goes out in one write.
+			std::optional<SendQueue::Cork> cork(outbound);
+			bool image_hash = capabilities & CapImageHashes;
+			bool deltas = capabilities & CapDeltas;
+			bool timings = extended_capabilities & CapTimings;
+			auto buffer = send_pool.acquire();
+			size_t timing_at = putHasStopped(buffer, reason, text, image_hash, timings);
+			std::shared_ptr<std::string> observed;
+			{
+				std::lock_guard<std::mutex> lck(mtx);
+				stop_timing_s timing;
+				if (stop_snapshot)
+					putStopSnapshot(buffer, deltas, timing);
+				if (timings)
+					putStopTimings(buffer, timing_at, decided, decided, timing);
+				// Observers all get the full encoding, serialized once; this
+				// client's stop is reused when it has the same bytes.
+				if (observer_count) {
+					if (stop_snapshot && image_hash && !deltas && timings) {
+						observed = buffer.data();
+					}
+					else {
+						auto built = std::chrono::steady_clock::now();
+						stop_timing_s full_timing;
+						auto full = send_pool.acquire();
+						size_t full_timing_at = putHasStopped(full, reason, text, true, true);
+						putStopSnapshot(full, false, full_timing);
+						putStopTimings(full, full_timing_at, decided, built, full_timing);
+						observed = full.take();
+					}
+				}
+			}
+			auto enqueued = std::chrono::steady_clock::now();
+			if (observed)
+				fanOutToObservers(SendQueue::Control, observed);
+			sendMessage(buffer);
+			cork.reset();
+			auto start = std::chrono::steady_clock::now();
+			uint32_t enqueue = elapsedNs(enqueued, start);
+			{
+				std::unique_lock<std::mutex> lck(mtx);
+				cv.wait(lck, [this] { return receive_walk_cmd; });
+			}
+			uint64_t blocked = std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - start).count();
+			traffic.blocked.fetch_add(blocked, std::memory_order_relaxed);
+			DebugOverhead.addBlocked(blocked);
+			// HasContinued: [uint64 resumed at][uint64 frozen ns][uint32
+			// enqueue ns], frozen from hook entry and enqueue being how long
+			// handing HasStopped to the queues took. Observers have no
+			// command of their own to tell them the stop is over.
+			if (timings || observer_count) {
+				auto resumed_at = std::chrono::steady_clock::now();
+				auto resumed = send_pool.acquire(25);
+				resumed.PutUnsignedInt(20);
+				resumed.PutChar(MessageType::HasContinued);
+				resumed.PutUnsignedInt64(monotonicNs(resumed_at));
+				resumed.PutUnsignedInt64(std::chrono::duration_cast<std::chrono::nanoseconds>(
+					resumed_at - hook_entered).count());
+				resumed.PutUnsignedInt(enqueue);
+				if (observer_count)
+					fanOutToObservers(SendQueue::Control, resumed.data());
+				if (timings)
+					sendMessage(resumed);
+			}
+		}
+		if(current_state == DebugDead)
+		{
+			throw debugger_stopped();
+		}
+	}
+
+	// Counts the error against its line and decides whether it stops the
+	// client. Errors that don't are left for the next summary.
+	bool shouldStopOnError(const IErrorReport& report, IFrameIterator& iter,
+		plugin_s* plugin) {
+		auto filter = std::atomic_load(&exception_filter);
+		const char* path = nullptr;
+		unsigned line = 0;
+		for (; !iter.Done(); iter.Next()) {
+			if (iter.IsScriptedFrame()) {
+				path = iter.FilePath();
+				line = iter.LineNumber();
+				break;
+			}
+		}
+		iter.Reset();
+		uint32_t file = path ? DebugFiles.intern(path) : FileIdTable::kNoFile;
+
+		bool stop = filter->stop &&
+			(filter->codes.empty() || filter->codes.count(report.Code())) &&
+			(filter->files.empty() || filter->files.count(file));
+		if (stop && !filter->plugins.empty()) {
+			auto name = iter.Context()->GetRuntime()->GetFilename();
+			stop = name && filter->plugins.count(DebugFiles.intern(name));
+		}
+		if (!plugin)
+			return stop;
+
+		auto& site = plugin->errors[(uint64_t(file) << 32) | line];
+		site.hits++;
+		if (stop && (!filter->first_per_site || site.hits == 1))
+			return true;
+		if (!site.pending++) {
+			site.message = report.Message();
+			site.location = fmt::format("{}:{}",
+				file != FileIdTable::kNoFile ? DebugFiles.name(file) : "?", line);
+		}
+		return false;
+	}
+
+	// Sends the errors counted since the last summary as log lines, at
+	// most once per ERROR_SUMMARY_INTERVAL. Main thread only.
+	void flushErrorSummaries(std::chrono::steady_clock::time_point now) {
+		if (!(capabilities & CapExceptionFilters) ||
+			now - last_error_summary < ERROR_SUMMARY_INTERVAL)
+			return;
+		last_error_summary = now;
+		for (auto& plugin : plugins) {
+			for (auto& error : plugin.second.errors) {
+				auto& site = error.second;
+				if (!site.pending)
+					continue;
+				queueLog(fmt::format("{} error(s) at {}: {}", site.pending,
+					site.location, site.message));
+				site.pending = 0;
+			}
+		}
+	}
+
+	void ReportError(const IErrorReport& report, IFrameIterator& iter) {
+		if (!shouldStopOnError(report, iter, pluginState(iter.Context())))
+			return;
+		receive_walk_cmd = false;
+		current_state = DebugException;
+		context_ = iter.Context();
+		debug_iter = &iter;
+		auto plugin = pluginState(context_);
+		current_image = plugin ? plugin->image : nullptr;
+		DebugImages.touch(current_image);
+		WaitWalkCmd("exception", report.Message());
+	}
+	int(DebugHook)(SourcePawn::IPluginContext* ctx,
+		sp_debug_break_info_t& BreakInfo) {
+		if (current_state == DebugDead)
+			return current_state;
+
+		plugin_s* plugin = pluginState(ctx);
+		if (!plugin)
+			return current_state;
+
+#if SOURCEPAWN_API_VERSION >= 0x0212
+		if (BreakInfo.version >= 2 && (BreakInfo.flags & SP_DEBUG_BREAK_DATAWATCH))
+			return dataWatchHook(ctx, *plugin, BreakInfo);
+#endif
+
+		// Fast path: running, and no breakpoint on this cip. Conditions and
+		// hit counts are settled here too, before any client state changes.
+		bool is_breakpoint = plugin->breakpoints.test(BreakInfo.cip);
+		break_site_s* site = nullptr;
+		if (is_breakpoint) {
+			auto found = plugin->sites.find(BreakInfo.cip);
+			if (found != plugin->sites.end()) {
+				site = &found->second;
+				auto& predicate = site->predicate;
+				if ((!predicate.empty() && !predicate.evaluate(ctx, BreakInfo.frm)) ||
+					!site->bp->countHit() || !site->bp->claim())
+					is_breakpoint = false;
+				else if (site->bp->temporary)
+					removeTemporary(*site->bp);
+			}
+		}
+		if (is_breakpoint && site && site->snapshot) {
+			takeSnapshot(ctx, *site, BreakInfo.frm);
+			is_breakpoint = false;
+		}
+		if (current_state == DebugRun && !is_breakpoint)
+			return current_state;
+		// A step over or out finishes in the plugin it started in; other
+		// plugins it calls into run on.
+		if ((current_state == DebugStepOver || current_state == DebugStepOut) &&
+			!is_breakpoint && context_ && context_ != ctx)
+			return current_state;
+
+		if (context_ != ctx) {
+			current_image = plugin->image;
+			context_ = ctx;
+		}
+		cip_ = BreakInfo.cip;
+		// Reset the state.
+		frm_ = BreakInfo.frm;
+
+		if (is_breakpoint && site && site->bp->is_logpoint) {
+			logHit(*site);
+			is_breakpoint = false;
+			if (current_state == DebugRun)
+				return current_state;
+		}
+		receive_walk_cmd = false;
+		DebugImages.touch(current_image);
+
+		uint32_t file;
+		current_image->LookupLocation(cip_, &file, &current_line);
+
+		if (current_state == DebugStepOut && frm_ > plugin->last_frm)
+			current_state = DebugStepIn;
+
+		bool same_line = plugin->step_frm == frm_ && plugin->step_line == current_line;
+		plugin->step_frm = frm_;
+		plugin->step_line = current_line;
+		if (is_breakpoint) {
+			current_state = DebugBreakpoint;
+			WaitWalkCmd();
+		}
+		else if (current_state == DebugPause || current_state == DebugStepIn ||
+			current_state == DebugStepInstruction) {
+			/* dont break twice */
+			if (same_line)
+				return current_state;
+			if (!plugin->entry_stop.empty())
+				WaitWalkCmd("public entry", std::exchange(plugin->entry_stop, std::string()));
+			else
+				WaitWalkCmd();
+		}
+
+		/* check whether we are stepping through a sub-function */
+		if (current_state == DebugStepOver) {
+			if (frm_ < plugin->last_frm)
+			{
+				return current_state;
+			}
+			
+			WaitWalkCmd();
+
+			if (current_state == DebugDead)
+				return current_state;
+		}
+
+		plugin->last_frm = frm_;
+
+		return current_state;
+	}
+
+	// |ctx| is calling a native some client watches. |cip| and |frm| are
+	// the caller's, 0 if the VM can't tell; the condition and the logpoint's
+	// expressions are read in that frame.
+	void nativeHook(SourcePawn::IPluginContext* ctx, const std::string& native, cell_t cip,
+		cell_t frm, const cell_t* params) {
+		if (observer || current_state == DebugDead)
+			return;
+		plugin_s* plugin = pluginState(ctx);
+		if (!plugin)
+			return;
+		auto found = plugin->table->natives.find(native);
+		if (found == plugin->table->natives.end())
+			return;
+		auto& bp = found->second;
+
+		// A cip calls one native, so the site is keyed by the cip alone.
+		auto bound = plugin->native_sites.find(cip);
+		if (bound == plugin->native_sites.end()) {
+			bound = plugin->native_sites.emplace(cip, break_site_s()).first;
+			bindSite(plugin->image.get(), cip, bp, bound->second);
+		}
+		auto& site = bound->second;
+		if ((!site.predicate.empty() && (!frm || !site.predicate.evaluate(ctx, frm))) ||
+			!bp.countHit())
+			return;
+
+		if (context_ != ctx) {
+			current_image = plugin->image;
+			context_ = ctx;
+		}
+		cip_ = cip;
+		frm_ = frm;
+		if (bp.is_logpoint) {
+			logHit(site, params);
+			return;
+		}
+
+		receive_walk_cmd = false;
+		DebugImages.touch(current_image);
+		uint32_t file;
+		if (cip_)
+			current_image->LookupLocation(cip_, &file, &current_line);
+		current_state = DebugBreakpoint;
+		WaitWalkCmd("native breakpoint", native);
+		plugin->last_frm = frm_;
+	}
+
+	// |fn| of |ctx| is about to be called with |params|, |params[0]| of
+	// them. It has no frame yet, so its logpoints see globals and the
+	// arguments, and a stop steps into its first line.
+	void publicHook(SourcePawn::IPluginContext* ctx, SourcePawn::IPluginFunction* fn,
+		const cell_t* params) {
+		if (observer || current_state == DebugDead)
+			return;
+		plugin_s* plugin = pluginState(ctx);
+		if (!plugin)
+			return;
+		std::string full = fn->DebugName();
+		auto split = full.rfind("::");
+		auto name = split == std::string::npos ? full : full.substr(split + 2);
+		auto& publics = plugin->table->publics;
+		auto found = publics.find(std::filesystem::path(ctx->GetRuntime()->GetFilename())
+			.filename().string() + "::" + name);
+		if (found == publics.end())
+			found = publics.find(name);
+		if (found == publics.end())
+			return;
+		auto& bp = found->second;
+
+		uint32_t addr = 0;
+		plugin->image->GetFunctionAddress(name.c_str(), nullptr, &addr);
+		auto bound = plugin->public_sites.find(fn->GetFunctionID());
+		if (bound == plugin->public_sites.end()) {
+			bound = plugin->public_sites.emplace(fn->GetFunctionID(), break_site_s()).first;
+			bindSite(plugin->image.get(), addr, bp, bound->second);
+			// Locals live in the frame the call hasn't pushed yet.
+			for (auto& sym : bound->second.symbols) {
+				if (sym && (sym->vclass() & 0x0f) == 1)
+					sym.reset();
+			}
+		}
+		if (!bp.countHit())
+			return;
+
+		if (context_ != ctx) {
+			current_image = plugin->image;
+			context_ = ctx;
+		}
+		if (bp.is_logpoint) {
+			cip_ = addr;
+			frm_ = 0;
+			logHit(bound->second, params);
+			return;
+		}
+		plugin->entry_stop = full;
+		plugin->step_frm = 0;
+		current_state = DebugStepIn;
+	}
+
+#if SOURCEPAWN_API_VERSION >= 0x0212
+	// A store touched a watched range. The cip is the storing instruction
+	// and the new value is already in memory.
+	int dataWatchHook(SourcePawn::IPluginContext* ctx, plugin_s& plugin,
+		sp_debug_break_info_t& BreakInfo) {
+		watch_range_s* range = nullptr;
+		for (auto& watch : plugin.watches) {
+			if (BreakInfo.addr < watch.addr + watch.size &&
+				watch.addr < BreakInfo.addr + BreakInfo.size) {
+				range = &watch;
+				break;
+			}
+		}
+		// Another client's watchpoint.
+		if (!range)
+			return current_state;
+
+		auto& bp = range->watch->bp;
+		auto found = range->sites.find(BreakInfo.cip);
+		if (found == range->sites.end()) {
+			found = range->sites.emplace(BreakInfo.cip, break_site_s()).first;
+			bindSite(plugin.image.get(), BreakInfo.cip, bp, found->second);
+		}
+		auto& site = found->second;
+		if ((!site.predicate.empty() && !site.predicate.evaluate(ctx, BreakInfo.frm)) ||
+			!bp.countHit())
+			return current_state;
+
+		if (context_ != ctx) {
+			current_image = plugin.image;
+			context_ = ctx;
+		}
+		cip_ = BreakInfo.cip;
+		frm_ = BreakInfo.frm;
+		if (bp.is_logpoint) {
+			logHit(site);
+			return current_state;
+		}
+
+		receive_walk_cmd = false;
+		DebugImages.touch(current_image);
+		uint32_t file;
+		current_image->LookupLocation(cip_, &file, &current_line);
+		current_state = DebugBreakpoint;
+		WaitWalkCmd("data breakpoint", range->watch->name);
+		plugin.last_frm = frm_;
+		return current_state;
+	}
+#endif
+
+	// Appends the BREAK sites of the function containing |cip|.
+	void addFunctionSites(cell_t cip, std::vector<cell_t>& sites) {
+		auto range = current_image->LookupFunctionRange(cip);
+		if (!range)
+			return;
+		std::vector<uint32_t> lines;
+		current_image->GetLineAddresses(range->codestart, range->codeend, &lines);
+		sites.insert(sites.end(), lines.begin(), lines.end());
+	}
+
+	// Appends the entry lines of the functions the stopped line calls.
+	void addCallSites(std::vector<cell_t>& sites) {
+		std::vector<uint32_t> targets;
+		current_image->GetLineCalls(cip_, &targets);
+		for (auto target : targets) {
+			auto range = current_image->LookupFunctionRange(target);
+			if (!range)
+				continue;
+			std::vector<uint32_t> lines;
+			current_image->GetLineAddresses(range->codestart, range->codeend, &lines);
+			if (!lines.empty())
+				sites.push_back(lines.front());
+		}
+	}
+
+	// Where a step from the stop point can end: the caller's function for
+	// all of them, the rest of the current one for a step over or
+	// instruction, and the callees of the line for a step instruction. The
+	// frame checks in DebugHook skip hits in deeper recursion. Empty when
+	// the caller isn't a scripted frame of the same plugin, in which case
+	// the step runs every line as before.
+	std::vector<cell_t> findStepTraps(unsigned char state) {
+		std::vector<cell_t> traps;
+		if (!context_ || !current_image || current_state == DebugException)
+			return traps;
+		auto& stack = collectCallStack();
+		if (stack.size() < 2 || !stack[1].cip)
+			return traps;
+		if (state == DebugStepOver || state == DebugStepInstruction)
+			addFunctionSites(cip_, traps);
+		if (state == DebugStepInstruction)
+			addCallSites(traps);
+		addFunctionSites(stack[1].cip, traps);
+		return traps;
+	}
+
+	void SwitchState(unsigned char state) {
+		std::shared_ptr<const step_traps_s> traps;
+		if (!receive_walk_cmd && (state == DebugStepOver || state == DebugStepOut ||
+			state == DebugStepInstruction)) {
+			auto cips = findStepTraps(state);
+			if (!cips.empty())
+				traps = std::make_shared<step_traps_s>(step_traps_s{ context_, std::move(cips) });
+		}
+		std::atomic_store(&step_traps, std::move(traps));
+		current_state = state;
+		break_sites_dirty = true;
+		receive_walk_cmd = true;
+		cv.notify_one();
+	}
+
+	void AskFile() {
+		// Legacy until the client says Hello.
+		capabilities = 0;
+		extended_capabilities = 0;
+		client_version = 0;
+	}
+
+	// Hello: [int version][uint32 capabilities][uint32 extended], answered
+	// by Capabilities in the same layout with what was enabled.
+	void recvHello(CUtlBuffer* buf) {
+		client_version = buf->GetInt();
+		capabilities = buf->GetUnsignedInt() & ServerCapabilities;
+		// Reads as 0 from clients that end Hello after the first word.
+		extended_capabilities = buf->GetUnsignedInt() & ServerExtendedCapabilities;
+		bool observing = capabilities & CapObserver;
+		if (observing) {
+			capabilities = (capabilities & ObserverCapabilities) | CapStopSnapshot | CapImageHashes;
+			extended_capabilities = CapTimings;
+		}
+		if (!DebugNativeBreaks.available())
+			extended_capabilities &= ~CapNativeBreakpoints;
+		if (!DebugPublicBreaks.available())
+			extended_capabilities &= ~CapPublicBreakpoints;
+		if (observer.exchange(observing) != observing) {
+			observer_count += observing ? 1 : -1;
+			client_files_generation++;
+			break_sites_dirty = true;
+			data_watches_dirty = true;
+		}
+		if (!data_watchpoints)
+			capabilities &= ~CapWatchpoints;
+		if (!DebugTrace.available())
+			capabilities &= ~CapTracing;
+		if (!DebugNatives.available())
+			capabilities &= ~CapNativeProfiler;
+		if (!DebugPublics.available())
+			capabilities &= ~CapPublicProfiler;
+		if (!DebugCpu.available())
+			capabilities &= ~CapPluginCpu;
+		if (!DebugHeap.available())
+			capabilities &= ~CapHeapProfiler;
+		if (!DebugRecorder.available())
+			capabilities &= ~CapRecording;
+		if (!DebugSources.active())
+			capabilities &= ~CapSources;
+		verified_reset = true;
+		breakpoints_unverified = true;
+		outbound.setChunking((capabilities & CapChunks) != 0, MessageType::Chunk);
+		// The client starts over with no values to compare against.
+		{
+			std::lock_guard<std::mutex> lock(sent_values_lock);
+			sent_values.clear();
+		}
+		if ((capabilities & CapCompression) && !compress_threshold)
+			compress_threshold = DEFAULT_COMPRESS_THRESHOLD;
+
+		auto buffer = send_pool.acquire();
+		buffer.PutUnsignedInt(0);
+		buffer.PutChar(MessageType::Capabilities);
+		buffer.PutInt(PROTOCOL_VERSION);
+		buffer.PutUnsignedInt(capabilities);
+		buffer.PutUnsignedInt(extended_capabilities);
+		*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
+		// Never compressed, so the client can read it before it knows.
+		countSent(buffer.TellPut());
+		outbound.push(SendQueue::Control, buffer.take());
+	}
+
+	// Heartbeat: [uint64 sent at][uint64 last round trip ns, 0 if none].
+	// The client answers with HeartbeatAck: [uint64 sent at], echoed.
+	void sendHeartbeat(std::chrono::steady_clock::time_point now) {
+		auto buffer = send_pool.acquire(21);
+		buffer.PutUnsignedInt(16);
+		buffer.PutChar(MessageType::Heartbeat);
+		buffer.PutUnsignedInt64(monotonicNs(now));
+		buffer.PutUnsignedInt64(rtt_ns);
+		sendMessage(buffer);
+	}
+
+	void recvHeartbeatAck(CUtlBuffer* buf) {
+		uint64_t sent = buf->GetUnsignedInt64();
+		uint64_t now = monotonicNs(std::chrono::steady_clock::now());
+		// Only echoes of what was sent count.
+		if (buf->IsValid() && sent && sent <= now)
+			rtt_ns = now - sent;
+	}
+
+	void RecvDebugFile(CUtlBuffer* buf) {
+		files.insert(DebugFiles.intern(buf->GetStringView()));
+		client_files_generation++;
+		data_watches_dirty = true;
+	}
+
+	void RecvStateSwitch(CUtlBuffer* buf) {
+		auto CurrentState = buf->GetUnsignedChar();
+		SwitchState(CurrentState);
+		// Clients that never send StartDebugging are done once they run.
+		openStartupGate();
+	}
+
+	// StartDebugging: no payload. The client has sent its breakpoints.
+	void recvStartDebugging(CUtlBuffer* buf) {
+		openStartupGate();
+	}
+
+	void RecvCallStack(CUtlBuffer* buf) {
+		CallStack();
+	}
+
+	void recvRequestVariables(CUtlBuffer* buf) {
+		sendVariables(buf->GetStringView().data());
+	}
+
+	void recvRequestEvaluate(CUtlBuffer* buf) {
+		auto variable = buf->GetStringView();
+		int frameId = buf->GetInt();
+		evaluateVar(frameId, variable.data());
+	}
+
+	void recvDisconnect(CUtlBuffer* buf) {
+	}
+
+	void recvSetStopSnapshot(CUtlBuffer* buf) {
+		bool enabled = buf->GetInt() != 0;
+		int count = buf->GetInt();
+		std::vector<std::string> exprs;
+		for (int i = 0; i < count; i++) {
+			exprs.emplace_back(buf->GetStringView());
+		}
+		// Read by the game thread when it next stops.
+		std::lock_guard<std::mutex> lck(mtx);
+		stop_snapshot = enabled;
+		watches = std::move(exprs);
+	}
+
+	// SetExceptionFilter: [uint8 stop][uint8 first_per_site]
+	// [int count]{[int code]}[int count]{[int len][string plugin]}
+	// [int count]{[int len][string file]}.
+	void recvSetExceptionFilter(CUtlBuffer* buf) {
+		auto filter = std::make_shared<exception_filter_s>();
+		filter->stop = buf->GetUnsignedChar() != 0;
+		filter->first_per_site = buf->GetUnsignedChar() != 0;
+		int count = buf->GetInt();
+		for (int i = 0; i < count && buf->IsValid(); i++)
+			filter->codes.insert(buf->GetInt());
+		for (auto* names : { &filter->plugins, &filter->files }) {
+			count = buf->GetInt();
+			for (int i = 0; i < count && buf->IsValid(); i++) {
+				names->insert(DebugFiles.intern(buf->GetStringView()));
+			}
+		}
+		std::atomic_store(&exception_filter,
+			std::shared_ptr<const exception_filter_s>(std::move(filter)));
+	}
+
+	// SetProfiler: [int interval_us], 0 stops. Starting drops the previous
+	// results. Every BREAK has to reach the debugger while it runs.
+	void recvSetProfiler(CUtlBuffer* buf) {
+		int interval = buf->GetInt();
+		if (interval > 0)
+			DebugProfiler.start(std::max(interval, MIN_PROFILE_INTERVAL));
+		else
+			DebugProfiler.stop();
+		break_sites_dirty = true;
+	}
+
+	// RequestProfile: [uint8 reset][int len][string dump]. A dump name also
+	// writes the folded stacks to SourceMod's logs folder, or a pprof
+	// profile if it ends in ".pb.gz". Both are made from a copy of the
+	// results, on this thread.
+	// Profile: [int interval_us][int samples][int idle][int dropped]
+	// [int count]{[int len][string function][int self][int total]}
+	// [int count]{[int len][string folded stack][int samples]}.
+	void recvRequestProfile(CUtlBuffer* buf) {
+		bool reset = buf->GetUnsignedChar() != 0;
+		auto name = buf->GetStringView();
+		auto file = std::filesystem::path(name).filename().string();
+		if (!file.empty()) {
+			char path[PLATFORM_MAX_PATH];
+			smutils->BuildPath(Path_SM, path, sizeof(path), "logs/%s", file.c_str());
+			if (!DebugProfiler.dump(path))
+				fmt::print("Debugger: can't write profile to {}\n", path);
+		}
+
+		auto profile = DebugProfiler.snapshot(reset);
+		size_t size = 32;
+		for (const auto& function : profile.functions)
+			size += function.first.size() + 13;
+		for (const auto& stack : profile.stacks)
+			size += stack.first.size() + 9;
+		auto buffer = send_pool.acquire(size);
+		buffer.PutUnsignedInt(0);
+		buffer.PutChar(MessageType::Profile);
+		buffer.PutInt(profile.interval_us);
+		buffer.PutInt(profile.samples);
+		buffer.PutInt(profile.idle);
+		buffer.PutInt(profile.dropped);
+		buffer.PutInt(profile.functions.size());
+		for (const auto& function : profile.functions) {
+			buffer.PutLenString(function.first);
+			buffer.PutInt(function.second.self);
+			buffer.PutInt(function.second.total);
+		}
+		buffer.PutInt(profile.stacks.size());
+		for (const auto& stack : profile.stacks) {
+			buffer.PutLenString(stack.first);
+			buffer.PutInt(stack.second);
+		}
+		*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
+		if (observer_count && !observer)
+			fanOutToObservers(SendQueue::Bulk, buffer.data());
+		sendMessage(buffer);
+	}
+
+	// SetCoverage: [uint8 enabled]. Enabling starts the counts over. Every
+	// BREAK has to reach the debugger while it is on.
+	void recvSetCoverage(CUtlBuffer* buf) {
+		SetCoverage(buf->GetUnsignedChar() != 0);
+	}
+
+	// RequestCoverage: [uint8 reset].
+	// Coverage: [int count]{[int len][string file][int line][int hits]}.
+	void recvRequestCoverage(CUtlBuffer* buf) {
+		bool reset = buf->GetUnsignedChar() != 0;
+		auto lines = DebugCoverage.snapshot(reset);
+		size_t size = 16;
+		for (const auto& line : lines)
+			size += line.file.size() + 13;
+		auto buffer = send_pool.acquire(size);
+		buffer.PutUnsignedInt(0);
+		buffer.PutChar(MessageType::Coverage);
+		buffer.PutInt(lines.size());
+		for (const auto& line : lines) {
+			buffer.PutLenString(line.file);
+			buffer.PutInt(line.line);
+			buffer.PutUnsignedInt(std::min<uint64_t>(line.count, UINT32_MAX));
+		}
+		*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
+		sendMessage(buffer);
+	}
+
+	// SetTracing: [uint8 active]. Only calls made from then on are read.
+	void recvSetTracing(CUtlBuffer* buf) {
+		DebugTrace.setActive(buf->GetUnsignedChar() != 0);
+	}
+
+	// RequestTrace: [int len][string dump]. A dump name also writes the
+	// trace to SourceMod's logs folder.
+	// Trace: [int dropped][int len][string Chrome trace JSON] with the calls
+	// recorded since the last request.
+	void recvRequestTrace(CUtlBuffer* buf) {
+		auto name = buf->GetStringView();
+
+		uint32_t dropped;
+		auto json = formatChromeTrace(DebugTrace.read(&dropped));
+		auto file = std::filesystem::path(name).filename().string();
+		if (!file.empty()) {
+			char path[PLATFORM_MAX_PATH];
+			smutils->BuildPath(Path_SM, path, sizeof(path), "logs/%s", file.c_str());
+			std::ofstream out(path, std::ios::trunc);
+			if (!(out << json))
+				fmt::print("Debugger: can't write trace to {}\n", path);
+		}
+
+		auto buffer = send_pool.acquire(json.size() + 16);
+		buffer.PutUnsignedInt(0);
+		buffer.PutChar(MessageType::Trace);
+		buffer.PutInt(dropped);
+		buffer.PutLenString(json);
+		*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
+		sendMessage(buffer);
+	}
+
+	// SetNativeProfiler: [uint8 active]. Starting drops the previous counts;
+	// the natives are wrapped on the next game frame.
+	void recvSetNativeProfiler(CUtlBuffer* buf) {
+		DebugNatives.setActive(buf->GetUnsignedChar() != 0);
+	}
+
+	// RequestNativeProfile: [uint8 reset].
+	// NativeProfile: [int count]{[int len][string plugin][int len][string native]
+	// [uint64 calls][uint64 cycles][int buckets]{[uint64 calls]}}, where
+	// bucket n counts the calls that took 2^n to 2^(n+1) cycles.
+	void recvRequestNativeProfile(CUtlBuffer* buf) {
+		bool reset = buf->GetUnsignedChar() != 0;
+		auto natives = DebugNatives.snapshot(reset);
+		size_t size = 16;
+		for (const auto& native : natives)
+			size += native.plugin.size() + native.native.size() + 28 +
+				NativeProfiler::kBuckets * 8;
+		auto buffer = send_pool.acquire(size);
+		buffer.PutUnsignedInt(0);
+		buffer.PutChar(MessageType::NativeProfile);
+		buffer.PutInt(natives.size());
+		for (const auto& native : natives) {
+			buffer.PutLenString(native.plugin);
+			buffer.PutLenString(native.native);
+			buffer.PutUnsignedInt64(native.calls);
+			buffer.PutUnsignedInt64(native.cycles);
+			buffer.PutInt(NativeProfiler::kBuckets);
+			buffer.PutSpan(native.histogram, NativeProfiler::kBuckets);
+		}
+		*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
+		sendMessage(buffer);
+	}
+
+	// SetHeapProfiler: [uint32 interval]. Samples about one heap allocation
+	// per |interval| bytes, every one for 1; 0 stops. Starting drops the
+	// previous results.
+	void recvSetHeapProfiler(CUtlBuffer* buf) {
+		DebugHeap.setInterval(buf->GetUnsignedInt());
+	}
+
+	// RequestHeapProfile: [uint8 reset][int len][string dump]. A dump name
+	// also writes the sites to SourceMod's logs folder, as a pprof profile
+	// if it ends in ".pb.gz".
+	// HeapProfile: [uint32 interval][int count]{[int len][string plugin]
+	// [int len][string function][int len][string file][uint32 line]
+	// [uint32 cip][uint64 samples][uint64 allocations][uint64 bytes]}, most
+	// bytes first. Allocations and bytes are estimates from the samples.
+	void recvRequestHeapProfile(CUtlBuffer* buf) {
+		bool reset = buf->GetUnsignedChar() != 0;
+		auto name = buf->GetStringView();
+		auto file = std::filesystem::path(name).filename().string();
+		if (!file.empty()) {
+			char path[PLATFORM_MAX_PATH];
+			smutils->BuildPath(Path_SM, path, sizeof(path), "logs/%s", file.c_str());
+			if (!DebugHeap.dump(path))
+				fmt::print("Debugger: can't write heap profile to {}\n", path);
+		}
+
+		auto profile = DebugHeap.snapshot(reset);
+		size_t size = 16;
+		for (const auto& site : profile.sites)
+			size += site.plugin.size() + site.function.size() + site.file.size() + 47;
+		auto buffer = send_pool.acquire(size);
+		buffer.PutUnsignedInt(0);
+		buffer.PutChar(MessageType::HeapProfile);
+		buffer.PutUnsignedInt(profile.interval);
+		buffer.PutInt(profile.sites.size());
+		for (const auto& site : profile.sites) {
+			buffer.PutLenString(site.plugin);
+			buffer.PutLenString(site.function);
+			buffer.PutLenString(site.file);
+			buffer.PutUnsignedInt(site.line);
+			buffer.PutUnsignedInt(site.cip);
+			buffer.PutUnsignedInt64(site.samples);
+			buffer.PutUnsignedInt64(site.allocations);
+			buffer.PutUnsignedInt64(site.bytes);
+		}
+		*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
+		sendMessage(buffer);
+	}
+
+	// SetRecording: [uint8 on][uint32 interval][uint32 checkpoints]. On,
+	// while stopped, records the stopped plugin from this step with a
+	// checkpoint every |interval| steps, keeping the last |checkpoints|; 0
+	// takes the default. Every BREAK has to reach the debugger while it is on.
+	void recvSetRecording(CUtlBuffer* buf) {
+		bool on = buf->GetUnsignedChar() != 0;
+		uint32_t interval = buf->GetUnsignedInt();
+		uint32_t checkpoints = buf->GetUnsignedInt();
+		if (!on)
+			DebugRecorder.stop();
+		else if (current_state != DebugRun && context_)
+			DebugRecorder.start(context_, cip_, frm_, interval, checkpoints);
+		break_sites_dirty = true;
+	}
+
+	// RequestHistory: [uint32 back]. While stopped in the recorded plugin.
+	// History: [uint32 steps][uint32 back][uint32 cip][int len][string file]
+	// [uint32 line][int len][string function][uint32 since checkpoint]
+	// [int count]{variable}, the step |back| steps before the current one,
+	// at most steps - 1, with its locals as the checkpoint |since
+	// checkpoint| steps before it holds them. Steps is 0 if nothing was
+	// recorded.
+	void recvRequestHistory(CUtlBuffer* buf) {
+		uint32_t back = buf->GetUnsignedInt();
+		Recorder::history_s history{};
+		std::vector<SnapshotPlan::value_s> values;
+		const char* file = nullptr;
+		const char* function = nullptr;
+		uint32_t line = 0;
+		if (current_state != DebugRun && context_ && current_image &&
+			DebugRecorder.history(context_, back, &history)) {
+			uint32_t cip = static_cast<uint32_t>(history.step.cip);
+			file = current_image->LookupFile(cip);
+			function = current_image->LookupFunction(cip);
+			if (!current_image->LookupLine(cip, &line))
+				line = 0;
+			Snapshot snap;
+			snap.plan = SnapshotPlan::bind(current_image.get(), cip, {});
+			snap.plan->copy(Recorder::View(history.checkpoint), history.step.frm, &snap);
+			values = snap.plan->format(snap);
+		} else {
+			history = Recorder::history_s{};
+		}
+		if (!file)
+			file = "";
+		if (!function)
+			function = "";
+
+		size_t size = 48 + strlen(file) + strlen(function);
+		for (const auto& var : values)
+			size += 4 * sizeof(int) + var.name.size() + var.value.size() + var.type.size() + 3;
+		auto buffer = send_pool.acquire(size);
+		buffer.PutUnsignedInt(0);
+		buffer.PutChar(MessageType::History);
+		buffer.PutUnsignedInt(static_cast<uint32_t>(history.steps));
+		buffer.PutUnsignedInt(history.back);
+		buffer.PutUnsignedInt(static_cast<uint32_t>(history.step.cip));
+		buffer.PutLenString(file);
+		buffer.PutUnsignedInt(line);
+		buffer.PutLenString(function);
+		buffer.PutUnsignedInt(history.since_checkpoint);
+		buffer.PutInt(values.size());
+		for (auto& var : values)
+			putVariable(buffer, { std::move(var.name), std::move(var.value), std::move(var.type), 0 });
+		*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
+		sendMessage(buffer);
+	}
+
+	// SetPublicProfiler: [uint8 active]. Starting drops the previous
+	// histograms.
+	void recvSetPublicProfiler(CUtlBuffer* buf) {
+		DebugPublics.setActive(buf->GetUnsignedChar() != 0);
+	}
+
+	// RequestPublicProfile: [uint8 reset].
+	// PublicProfile: [int count]{[int len][string plugin][int len][string function]
+	// [uint64 calls][uint64 total][uint64 p50][uint64 p99][uint64 max]}, in
+	// nanoseconds.
+	void recvRequestPublicProfile(CUtlBuffer* buf) {
+		bool reset = buf->GetUnsignedChar() != 0;
+		auto publics = DebugPublics.snapshot(reset);
+		size_t size = 16;
+		for (const auto& function : publics)
+			size += function.plugin.size() + function.function.size() + 50;
+		auto buffer = send_pool.acquire(size);
+		buffer.PutUnsignedInt(0);
+		buffer.PutChar(MessageType::PublicProfile);
+		buffer.PutInt(publics.size());
+		for (const auto& function : publics) {
+			buffer.PutLenString(function.plugin);
+			buffer.PutLenString(function.function);
+			buffer.PutUnsignedInt64(function.calls);
+			buffer.PutUnsignedInt64(function.total);
+			buffer.PutUnsignedInt64(function.p50);
+			buffer.PutUnsignedInt64(function.p99);
+			buffer.PutUnsignedInt64(function.max);
+		}
+		*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
+		sendMessage(buffer);
+	}
+
+	// RequestOverhead: [uint8 reset]. Resetting clears the server's totals
+	// and this client's traffic.
+	// Overhead: [uint64 breaks][uint64 handled][uint64 handler ns]
+	// [uint64 image loads][uint64 image load ns][uint64 stopped ns]
+	// [int count]{[int len][string plugin][uint64 breaks]}
+	// [uint64 bytes sent][uint64 messages sent][uint64 bytes received]
+	// [uint64 messages received][uint64 stopped ns]
+	// [uint64 bytes waiting][uint64 messages dropped][uint64 bytes dropped]
+	// [uint64 messages coalesced], the last nine for this client. Drops are
+	// not reset.
+	void recvRequestOverhead(CUtlBuffer* buf) {
+		bool reset = buf->GetUnsignedChar() != 0;
+		auto totals = DebugOverhead.snapshot(reset);
+		auto queue = outbound.stats();
+		size_t size = 132;
+		for (const auto& plugin : totals.plugins)
+			size += plugin.plugin.size() + 13;
+		auto buffer = send_pool.acquire(size);
+		buffer.PutUnsignedInt(0);
+		buffer.PutChar(MessageType::Overhead);
+		buffer.PutUnsignedInt64(totals.breaks);
+		buffer.PutUnsignedInt64(totals.handled);
+		buffer.PutUnsignedInt64(totals.handler_time);
+		buffer.PutUnsignedInt64(totals.image_loads);
+		buffer.PutUnsignedInt64(totals.image_load_time);
+		buffer.PutUnsignedInt64(totals.blocked);
+		buffer.PutInt(totals.plugins.size());
+		for (const auto& plugin : totals.plugins) {
+			buffer.PutLenString(plugin.plugin);
+			buffer.PutUnsignedInt64(plugin.breaks);
+		}
+		buffer.PutUnsignedInt64(traffic.bytes_sent);
+		buffer.PutUnsignedInt64(traffic.messages_sent);
+		buffer.PutUnsignedInt64(traffic.bytes_received);
+		buffer.PutUnsignedInt64(traffic.messages_received);
+		buffer.PutUnsignedInt64(traffic.blocked);
+		buffer.PutUnsignedInt64(queue.waiting_bytes);
+		buffer.PutUnsignedInt64(queue.dropped_messages);
+		buffer.PutUnsignedInt64(queue.dropped_bytes);
+		buffer.PutUnsignedInt64(queue.coalesced);
+		if (reset)
+			traffic.reset();
+		*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
+		sendMessage(buffer);
+	}
+
+	// RequestPluginCpu: [uint32 seconds].
+	// PluginCpu: [uint64 window ns][int count]{[int len][string plugin]
+	// [uint64 ns][uint64 invocations][uint64 total ns][uint64 total
+	// invocations]}, busiest in the window first; the window is shorter than
+	// asked for until enough has been sampled.
+	void recvRequestPluginCpu(CUtlBuffer* buf) {
+		uint32_t seconds = buf->GetUnsignedInt();
+		auto window = DebugCpu.top(seconds);
+		size_t size = 20;
+		for (const auto& plugin : window.plugins)
+			size += plugin.plugin.size() + 37;
+		auto buffer = send_pool.acquire(size);
+		buffer.PutUnsignedInt(0);
+		buffer.PutChar(MessageType::PluginCpu);
+		buffer.PutUnsignedInt64(window.nanoseconds);
+		buffer.PutInt(window.plugins.size());
+		for (const auto& plugin : window.plugins) {
+			buffer.PutLenString(plugin.plugin);
+			buffer.PutUnsignedInt64(plugin.nanoseconds);
+			buffer.PutUnsignedInt64(plugin.invocations);
+			buffer.PutUnsignedInt64(plugin.total_nanoseconds);
+			buffer.PutUnsignedInt64(plugin.total_invocations);
+		}
+		*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
+		sendMessage(buffer);
+	}
+
+	// RequestSource: [uint64 image hash][uint32 file index][uint64 hash of
+	// the client's copy, or 0].
+	// Source: [uint64 image hash][uint32 file index][uint8 SourceStatus]
+	// [int len][string name in the debug info][uint64 source hash]
+	// [uint32 length][bytes], the bytes only when sent. The image hash is
+	// the one HasStopped carries. Large files go out like any large reply,
+	// compressed and in chunks where the client negotiated them.
+	void recvRequestSource(CUtlBuffer* buf) {
+		uint64_t image_hash = buf->GetUnsignedInt64();
+		uint32_t index = buf->GetUnsignedInt();
+		uint64_t cached = buf->GetUnsignedInt64();
+
+		std::string name;
+		std::shared_ptr<const SourceCache::source_s> source;
+		if (auto image = DebugImages.find(image_hash)) {
+			DebugImages.touch(image);
+			if (index < image->GetFileCount()) {
+				if (const char* file = image->GetFileName(index)) {
+					name = file;
+					source = DebugSources.get(name);
+				}
+			}
+		}
+		uint8_t status = SourceMissing;
+		if (source)
+			status = source->hash == cached ? SourceUnchanged : SourceSent;
+		size_t length = status == SourceSent ? source->bytes.size() : 0;
+
+		auto buffer = send_pool.acquire(38 + name.size() + length);
+		buffer.PutUnsignedInt(0);
+		buffer.PutChar(MessageType::Source);
+		buffer.PutUnsignedInt64(image_hash);
+		buffer.PutUnsignedInt(index);
+		buffer.PutChar(status);
+		buffer.PutLenString(name);
+		buffer.PutUnsignedInt64(source ? source->hash : 0);
+		buffer.PutUnsignedInt(length);
+		if (length)
+			buffer.Put(source->bytes.data(), length);
+		*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
+		sendMessage(buffer);
+	}
+
+	// ListImages: no payload.
+	// Images: [int count]{[int len][string plugin path][uint64 image hash]
+	// [uint8 flags][uint32 functions][uint32 files]{[int len][string file]}}
+	// for every plugin the debugger has an image of, file names in debug
+	// file index order. Flag 1: the image is loaded, otherwise it is still
+	// loading and only the path and hash are known. Flag 2: its debug info
+	// is indexed by the compiler. Functions and files come from tables
+	// built at load, so this costs no symbol walk however many plugins
+	// there are.
+	void recvListImages(CUtlBuffer* buf) {
+		auto listing = DebugImages.list();
+		size_t size = 9;
+		for (const auto& entry : listing) {
+			size += entry.path.size() + 22;
+			uint32_t files = entry.image ? entry.image->GetFileCount() : 0;
+			for (uint32_t i = 0; i < files; i++) {
+				const char* name = entry.image->GetFileName(i);
+				size += (name ? strlen(name) : 0) + 5;
+			}
+		}
+		auto buffer = send_pool.acquire(size);
+		buffer.PutUnsignedInt(0);
+		buffer.PutChar(MessageType::Images);
+		buffer.PutInt(listing.size());
+		for (const auto& entry : listing) {
+			const auto& image = entry.image;
+			buffer.PutLenString(entry.path);
+			buffer.PutUnsignedInt64(entry.hash);
+			uint8_t flags = 0;
+			if (image)
+				flags |= 1;
+			if (image && image->HasDebugIndex())
+				flags |= 2;
+			buffer.PutChar(flags);
+			buffer.PutUnsignedInt(image ? image->Functions().size() : 0);
+			uint32_t files = image ? image->GetFileCount() : 0;
+			buffer.PutUnsignedInt(files);
+			for (uint32_t i = 0; i < files; i++) {
+				const char* name = image->GetFileName(i);
+				if (!name)
+					name = "";
+				buffer.PutLenString(name);
+			}
+		}
+		*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
+		sendMessage(buffer);
+	}
+
+	// Disassemble: [uint64 image hash][uint32 start cip][uint32 end cip].
+	// Disassembly: [uint64 image hash][uint32 next cip][int functions]
+	// {[int len][string name][uint32 codestart][uint32 codeend]
+	// [uint8 complete][int count]{[uint32 cip][uint32 file][uint32 line]
+	// [int len][string text]}} for the instructions in [start, end), by
+	// function. File is a debug file index, UINT32_MAX for none, and line
+	// is 0 where there is none. At most kMaxDisassembly instructions are
+	// sent; next cip is where to ask again, or 0 if the range is done.
+	static constexpr size_t kMaxDisassembly = 4096;
+	void recvDisassemble(CUtlBuffer* buf) {
+		uint64_t image_hash = buf->GetUnsignedInt64();
+		uint32_t start = buf->GetUnsignedInt();
+		uint32_t end = buf->GetUnsignedInt();
+
+		std::vector<std::shared_ptr<const Disassembly::function_s>> listed;
+		uint32_t next = 0;
+		size_t instructions = 0;
+		auto image = DebugImages.find(image_hash);
+		DebugImages.touch(image);
+		for (uint32_t cip = start; image && cip < end;) {
+			auto function = DebugDisassembly.get(image_hash, image.get(), cip);
+			if (!function) {
+				// Skip to the next function with debug info.
+				const auto& functions = image->Functions();
+				auto after = std::upper_bound(functions.begin(), functions.end(), cip,
+					[](uint32_t at, const SmxV1Image::FunctionRange& fn) { return at < fn.codestart; });
+				if (after == functions.end())
+					break;
+				cip = after->codestart;
+				continue;
+			}
+			for (const auto& line : function->lines) {
+				if (line.cip >= start && line.cip < end)
+					instructions++;
+			}
+			listed.push_back(function);
+			if (function->codeend <= cip)
+				break;
+			cip = function->codeend;
+			if (instructions >= kMaxDisassembly) {
+				next = cip < end ? cip : 0;
+				break;
+			}
+		}
+
+		size_t size = 21;
+		for (const auto& function : listed) {
+			size += function->name.size() + 18;
+			for (const auto& line : function->lines)
+				size += line.text.size() + 17;
+		}
+		auto buffer = send_pool.acquire(size);
+		buffer.PutUnsignedInt(0);
+		buffer.PutChar(MessageType::Disassembly);
+		buffer.PutUnsignedInt64(image_hash);
+		buffer.PutUnsignedInt(next);
+		buffer.PutInt(listed.size());
+		for (const auto& function : listed) {
+			buffer.PutLenString(function->name);
+			buffer.PutUnsignedInt(function->codestart);
+			buffer.PutUnsignedInt(function->codeend);
+			buffer.PutChar(function->complete);
+			int count = 0;
+			for (const auto& line : function->lines)
+				count += line.cip >= start && line.cip < end;
+			buffer.PutInt(count);
+			for (const auto& line : function->lines) {
+				if (line.cip < start || line.cip >= end)
+					continue;
+				buffer.PutUnsignedInt(line.cip);
+				buffer.PutUnsignedInt(line.file);
+				buffer.PutUnsignedInt(line.line);
+				buffer.PutLenString(line.text);
+			}
+		}
+		*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
+		sendMessage(buffer);
+	}
+
+	// SetSharedMemory: [int len][string name][uint32 threshold]. An empty
+	// name detaches the ring.
+	// SharedMemory: [uint8 attached].
+	void recvSetSharedMemory(CUtlBuffer* buf) {
+		// Longer names were never accepted.
+		auto name = buf->GetStringView();
+		if (name.size() >= 256)
+			return;
+		uint32_t threshold = buf->GetUnsignedInt();
+		bool attached = false;
+		{
+			std::lock_guard<std::mutex> lock(shared_ring.lock);
+			if (!name.empty())
+				attached = shared_ring.attach(std::string(name), threshold);
+			else
+				shared_ring.detach();
+		}
+		auto buffer = send_pool.acquire(6);
+		buffer.PutUnsignedInt(0);
+		buffer.PutChar(MessageType::SharedMemory);
+		buffer.PutChar(attached);
+		*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
+		countSent(buffer.TellPut());
+		// Not through the ring it is about.
+		outbound.push(SendQueue::Control, buffer.take());
+	}
+
+	// SetStringLimit: [int bytes]; 0 restores the default.
+	void recvSetStringLimit(CUtlBuffer* buf) {
+		int limit = buf->GetInt();
+		string_limit = limit > 0 ? limit : DEFAULT_STRING_LIMIT;
+	}
+
+	// RequestMemory: [int addr][int length]. Answered, while stopped, by
+	// Memory messages [int addr][int length][bytes] covering the range in
+	// order; one with length 0 if any of it is outside the plugin's memory.
+	void recvRequestMemory(CUtlBuffer* buf) {
+		cell_t addr = buf->GetInt();
+		uint32_t length = std::min<uint32_t>(buf->GetInt(), MAX_MEMORY_READ);
+		if (current_state == DebugRun || !context_)
+			return;
+
+		// Both ends, so the whole read stays inside the plugin's memory.
+		cell_t* first;
+		cell_t* last;
+		if (!length || context_->LocalToPhysAddr(addr, &first) != SP_ERROR_NONE ||
+			context_->LocalToPhysAddr(addr + length - 1, &last) != SP_ERROR_NONE ||
+			last < first) {
+			auto buffer = send_pool.acquire(13);
+			buffer.PutUnsignedInt(8);
+			buffer.PutChar(MessageType::Memory);
+			buffer.PutInt(addr);
+			buffer.PutUnsignedInt(0);
+			sendMessage(buffer);
+			return;
+		}
+		sendMemory(addr, length, 0, stop_serial);
+	}
+
+	// One Memory chunk per turn, the rest yielded to the other clients'
+	// requests. A read the game thread has run on from since ends early.
+	// Each chunk is copied holding the stop lock, which a stopped game
+	// thread needs to leave its wait, so it can't resume mid-copy.
+	void sendMemory(cell_t addr, uint32_t length, uint32_t offset, uint32_t serial) {
+		uint32_t size = std::min<uint32_t>(length - offset, MEMORY_CHUNK_SIZE);
+		auto buffer = send_pool.acquire(13 + size);
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			cell_t* first;
+			if (serial != stop_serial || receive_walk_cmd || current_state == DebugRun || !context_ ||
+				context_->LocalToPhysAddr(addr + offset, &first) != SP_ERROR_NONE)
+				return;
+			buffer.PutUnsignedInt(8 + size);
+			buffer.PutChar(MessageType::Memory);
+			buffer.PutInt(addr + offset);
+			buffer.PutUnsignedInt(size);
+			buffer.Put(reinterpret_cast<const char*>(first), size);
+		}
+		sendMessage(buffer);
+		offset += size;
+		if (offset < length) {
+			DebugRequests.yield(requests, [self = shared_from_this(), addr, length, offset, serial]() {
+				self->sendMemory(addr, length, offset, serial);
+			});
+		}
+	}
+
+	void recvSetCompression(CUtlBuffer* buf) {
+		int threshold = buf->GetInt();
+		// Below this deflate's overhead eats the gain.
+		if (threshold > 0 && threshold < 256)
+			threshold = 256;
+		compress_threshold = threshold > 0 ? threshold : 0;
+	}
+
+	void recvRequestChildren(CUtlBuffer* buf) {
+		uint32_t handle = buf->GetInt();
+		uint32_t start = buf->GetInt();
+		uint32_t count = buf->GetInt();
+		sendChildren(handle, start, count);
+	}
+
+	void recvBreakpoint(CUtlBuffer* buf) {
+		auto path = buf->GetStringView();
+		auto file = DebugFiles.intern(path);
+		files.insert(file);
+		client_files_generation++;
+		int line = buf->GetInt();
+		breakpoint_s bp;
+		bp.id = buf->GetInt();
+		setBreakpoint(file, line, std::move(bp));
+	}
+
+	// [id][condition][message][int hit count][int every], as in
+	// SetBreakpointCondition.
+	static breakpoint_s readBreakpoint(CUtlBuffer* buf) {
+		breakpoint_s bp;
+		bp.id = buf->GetInt();
+		std::string error;
+		if (!bp.condition.parse(std::string(buf->GetStringView()), &error))
+			fmt::print("Debugger: breakpoint {} condition ignored: {}\n", bp.id, error);
+		auto message = buf->GetStringView();
+		if (!message.empty()) {
+			bp.is_logpoint = true;
+			bp.message = parse_log_message(message);
+		}
+		// Older senders end here; a missing count reads as 0.
+		int hit_count = buf->GetInt();
+		bp.hit_count = hit_count > 0 ? hit_count : 0;
+		bp.hit_every = buf->GetInt() != 0;
+		return bp;
+	}
+
+	// SetBreakpointCondition: [path][line][id][condition][message]
+	// [int hit count][int every]. An empty message sets a breakpoint,
+	// otherwise a logpoint; an empty condition and a zero count always hit.
+	void recvSetBreakpointCondition(CUtlBuffer* buf) {
+		auto path = buf->GetStringView();
+		auto file = DebugFiles.intern(path);
+		files.insert(file);
+		client_files_generation++;
+		int line = buf->GetInt();
+		setBreakpoint(file, line, readBreakpoint(buf));
+	}
+
+	// SetBreakpoints: [path][int count]{[line][id][condition][message]
+	// [int hit count][int every]}. Replaces every breakpoint of the file,
+	// so an edit is one message and one new table; a count of 0 clears it.
+	void recvSetBreakpoints(CUtlBuffer* buf) {
+		auto path = buf->GetStringView();
+		auto file = DebugFiles.intern(path);
+		std::unordered_map<long, breakpoint_s> lines;
+		int count = buf->GetInt();
+		for (int i = 0; i < count && buf->IsValid(); i++) {
+			int line = buf->GetInt();
+			lines[line] = readBreakpoint(buf);
+		}
+		if (!buf->IsValid())
+			return;
+		if (!lines.empty()) {
+			files.insert(file);
+			client_files_generation++;
+		}
+		updateBreakpoints([&](auto& table) {
+			if (lines.empty())
+				return table.lines.erase(file) != 0;
+			table.lines[file] = std::move(lines);
+			return true;
+		});
+	}
+
+	// SetTemporaryBreakpoint: [path][line][id][uint8 run]. The breakpoint
+	// is removed when first taken. With |run| the game thread is released
+	// too, so a run to cursor is a single message.
+	void recvSetTemporaryBreakpoint(CUtlBuffer* buf) {
+		auto path = buf->GetStringView();
+		auto file = DebugFiles.intern(path);
+		files.insert(file);
+		client_files_generation++;
+		int line = buf->GetInt();
+		breakpoint_s bp;
+		bp.id = buf->GetInt();
+		bp.temporary = true;
+		bool run = buf->GetUnsignedChar() != 0;
+		setBreakpoint(file, line, std::move(bp));
+		if (run)
+			SwitchState(DebugRun);
+	}
+
+	// SetFunctionBreakpoint: [function][id][condition]. Stops on the first
+	// line of every loaded function with that name.
+	void recvSetFunctionBreakpoint(CUtlBuffer* buf) {
+		auto name = buf->GetStringView();
+		breakpoint_s bp;
+		bp.id = buf->GetInt();
+		std::string error;
+		if (!bp.condition.parse(std::string(buf->GetStringView()), &error))
+			fmt::print("Debugger: breakpoint {} condition ignored: {}\n", bp.id, error);
+		updateBreakpoints([&](auto& table) {
+			table.functions[std::string(name)] = std::move(bp);
+			return true;
+		});
+		client_files_generation++;
+	}
+
+	void recvClearFunctionBreakpoints(CUtlBuffer* buf) {
+		updateBreakpoints([&](auto& table) {
+			bool had = !table.functions.empty();
+			table.functions.clear();
+			return had;
+		});
+		client_files_generation++;
+	}
+
+	// SetNativeBreakpoints: [int count]{[native][id][condition][message]
+	// [int hit count][int every]}. Replaces every native breakpoint; a count
+	// of 0 clears them. An empty message stops at each call, otherwise it
+	// is logged, where {1}, {2}... are the native's arguments as cells,
+	// {1:s} and {1:f} one as a string or a float, and {args} all of them.
+	void recvSetNativeBreakpoints(CUtlBuffer* buf) {
+		std::unordered_map<std::string, breakpoint_s> natives;
+		int count = buf->GetInt();
+		for (int i = 0; i < count && buf->IsValid(); i++) {
+			std::string name(buf->GetStringView());
+			natives[name] = readBreakpoint(buf);
+		}
+		if (!buf->IsValid())
+			return;
+		updateBreakpoints([&](auto& table) {
+			if (natives.empty() && table.natives.empty())
+				return false;
+			table.natives = std::move(natives);
+			return true;
+		});
+		native_breaks_dirty = true;
+	}
+
+	// SetPublicBreakpoints: [int count]{[plugin][function][id][condition]
+	// [message][int hit count][int every]}. Replaces every public entry
+	// breakpoint; a count of 0 clears them, an empty plugin file name
+	// matches every plugin. One with a condition is refused, since the
+	// function has no frame yet to evaluate it in: it is reported as not
+	// verified, with a LogMessages line saying why. Messages name arguments
+	// as native logpoints do.
+	void recvSetPublicBreakpoints(CUtlBuffer* buf) {
+		std::unordered_map<std::string, breakpoint_s> publics;
+		std::vector<int> refused;
+		int count = buf->GetInt();
+		for (int i = 0; i < count && buf->IsValid(); i++) {
+			std::string plugin(buf->GetStringView());
+			std::string function(buf->GetStringView());
+			auto bp = readBreakpoint(buf);
+			if (!bp.condition.empty()) {
+				refused.push_back(bp.id);
+				continue;
+			}
+			publics[plugin.empty() ? function : plugin + "::" + function] = std::move(bp);
+		}
+		if (!buf->IsValid())
+			return;
+		if (!refused.empty() && (capabilities & CapVerifiedBreakpoints)) {
+			auto buffer = send_pool.acquire(9 + refused.size() * 9);
+			buffer.PutUnsignedInt(0);
+			buffer.PutChar(MessageType::BreakpointsVerified);
+			buffer.PutInt(refused.size());
+			for (int id : refused) {
+				buffer.PutInt(id);
+				buffer.PutChar(0);
+				buffer.PutInt(0);
+			}
+			*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
+			sendMessage(buffer);
+		}
+		for (int id : refused) {
+			SendBuffer notice(logLine(fmt::format(
+				"public breakpoint {} not set: conditions can't be evaluated at public entry", id)));
+			sendMessage(notice);
+		}
+		updateBreakpoints([&](auto& table) {
+			if (publics.empty() && table.publics.empty())
+				return false;
+			table.publics = std::move(publics);
+			return true;
+		});
+		public_breaks_dirty = true;
+	}
+
+	void recvSetLogpoint(CUtlBuffer* buf) {
+		auto path = buf->GetStringView();
+		auto file = DebugFiles.intern(path);
+		files.insert(file);
+		client_files_generation++;
+		int line = buf->GetInt();
+		breakpoint_s bp;
+		bp.id = buf->GetInt();
+		bp.is_logpoint = true;
+		bp.message = parse_log_message(buf->GetStringView());
+		setBreakpoint(file, line, std::move(bp));
+	}
+
+	// SetSnapshotpoint: [path][line][id][condition][globals]. |globals| is
+	// a comma separated list of names copied with the locals on every hit,
+	// and of watch expressions, computed on the network thread from the
+	// copy when the snapshot is sent.
+	void recvSetSnapshotpoint(CUtlBuffer* buf) {
+		auto path = buf->GetStringView();
+		auto file = DebugFiles.intern(path);
+		files.insert(file);
+		client_files_generation++;
+		int line = buf->GetInt();
+		breakpoint_s bp;
+		bp.id = buf->GetInt();
+		std::string error;
+		if (!bp.condition.parse(std::string(buf->GetStringView()), &error))
+			fmt::print("Debugger: snapshot point {} condition ignored: {}\n", bp.id, error);
+		bp.is_snapshot = true;
+		for (auto& name : split_string(std::string(buf->GetStringView()), ",")) {
+			auto first = name.find_first_not_of(" \t");
+			if (first == std::string::npos)
+				continue;
+			bp.globals.push_back(name.substr(first, name.find_last_not_of(" \t") - first + 1));
+		}
+		setBreakpoint(file, line, std::move(bp));
+	}
+
+	// SetWatchpoint: [variable][int cells][id][condition][message]. Zero
+	// cells watch the whole variable; an empty message stops, otherwise
+	// the store is logged.
+	void recvSetWatchpoint(CUtlBuffer* buf) {
+		watchpoint_s watch;
+		watch.name = buf->GetStringView();
+		int cells = buf->GetInt();
+		watch.cells = cells > 0 ? cells : 0;
+		watch.bp.id = buf->GetInt();
+		std::string error;
+		if (!watch.bp.condition.parse(std::string(buf->GetStringView()), &error))
+			fmt::print("Debugger: watchpoint {} condition ignored: {}\n", watch.bp.id, error);
+		auto message = buf->GetStringView();
+		if (!message.empty()) {
+			watch.bp.is_logpoint = true;
+			watch.bp.message = parse_log_message(message);
+		}
+		updateWatchpoints([&](auto& watches) {
+			watches[watch.bp.id] = std::move(watch);
+			return true;
+		});
+	}
+
+	// ClearWatchpoint: [id].
+	void recvClearWatchpoint(CUtlBuffer* buf) {
+		int id = buf->GetInt();
+		updateWatchpoints([&](auto& watches) {
+			return watches.erase(id) != 0;
+		});
+	}
+
+	void recvClearBreakpoints(CUtlBuffer* buf) {
+		auto path = buf->GetStringView();
+
+		clearBreakpoints(DebugFiles.intern(path));
+	}
+
+	// Releases a stopped game thread. Doesn't wait for it: the thread
+	// holds its own reference to the client until it has left the hook.
+	void stopDebugging() {
+		{
+			std::lock_guard<std::mutex> lck(mtx);
+			current_state = DebugDead;
+			receive_walk_cmd = true;
+		}
+		cv.notify_one();
+	}
+
+	void recvStopDebugging(CUtlBuffer* buf) {
+		stopDebugging();
+		removeClientID(socket);
+	}
+
+	void recvRequestSetVariable(CUtlBuffer* buf) {
+		auto var = buf->GetStringView();
+		auto value = buf->GetStringView();
+		auto index = buf->GetInt();
+		setVariable(std::string(var), std::string(value), index);
+	}
 
-		lastline = current_line;
-		if (current_state == DebugStepOut && frm_ > lastfrm_)
-			current_state = DebugStepIn;
+	typedef void (DebuggerClient::*RecvHandler)(CUtlBuffer* buf);
 
-		if (current_state == DebugPause || current_state == DebugStepIn) {
-			WaitWalkCmd();
+	// What an observer may send: nothing that sets breakpoints, drives the
+	// game thread, reads a stopped frame or resets shared state.
+	static bool observerMay(unsigned char type) {
+		switch (type) {
+		case Hello:
+		case StopDebugging:
+		case Disconnect:
+		case RequestSource:
+		case ListImages:
+		case HeartbeatAck:
+			return true;
+		default:
+			return false;
 		}
-		else {
+	}
 
-			auto found = break_list.find(current_file);
-			if (found != break_list.end()) {
-				if (found->second.find(current_line) != found->second.end())
-				{
-					current_state = DebugBreakpoint;
-					WaitWalkCmd();
-				}
+	static const RecvHandler* recvHandlers() {
+		static RecvHandler handlers[TotalMessages] = {};
+		static bool filled = [] {
+			handlers[RequestFile] = &DebuggerClient::RecvDebugFile;
+			handlers[Pause] = &DebuggerClient::RecvStateSwitch;
+			handlers[Continue] = &DebuggerClient::RecvStateSwitch;
+			handlers[StepIn] = &DebuggerClient::RecvStateSwitch;
+			handlers[StepOver] = &DebuggerClient::RecvStateSwitch;
+			handlers[StepOut] = &DebuggerClient::RecvStateSwitch;
+			handlers[StepInstruction] = &DebuggerClient::RecvStateSwitch;
+			handlers[RequestCallStack] = &DebuggerClient::RecvCallStack;
+			handlers[RequestVariables] = &DebuggerClient::recvRequestVariables;
+			handlers[RequestEvaluate] = &DebuggerClient::recvRequestEvaluate;
+			handlers[Disconnect] = &DebuggerClient::recvDisconnect;
+			handlers[ClearBreakpoints] = &DebuggerClient::recvClearBreakpoints;
+			handlers[SetBreakpoint] = &DebuggerClient::recvBreakpoint;
+			handlers[StartDebugging] = &DebuggerClient::recvStartDebugging;
+			handlers[StopDebugging] = &DebuggerClient::recvStopDebugging;
+			handlers[RequestSetVariable] = &DebuggerClient::recvRequestSetVariable;
+			handlers[RequestChildren] = &DebuggerClient::recvRequestChildren;
+			handlers[SetStopSnapshot] = &DebuggerClient::recvSetStopSnapshot;
+			handlers[SetCompression] = &DebuggerClient::recvSetCompression;
+			handlers[Hello] = &DebuggerClient::recvHello;
+			handlers[SetLogpoint] = &DebuggerClient::recvSetLogpoint;
+			handlers[SetBreakpointCondition] = &DebuggerClient::recvSetBreakpointCondition;
+			handlers[SetBreakpoints] = &DebuggerClient::recvSetBreakpoints;
+			handlers[SetSnapshotpoint] = &DebuggerClient::recvSetSnapshotpoint;
+			handlers[SetStringLimit] = &DebuggerClient::recvSetStringLimit;
+			handlers[RequestMemory] = &DebuggerClient::recvRequestMemory;
+			handlers[SetWatchpoint] = &DebuggerClient::recvSetWatchpoint;
+			handlers[ClearWatchpoint] = &DebuggerClient::recvClearWatchpoint;
+			handlers[SetTemporaryBreakpoint] = &DebuggerClient::recvSetTemporaryBreakpoint;
+			handlers[SetFunctionBreakpoint] = &DebuggerClient::recvSetFunctionBreakpoint;
+			handlers[ClearFunctionBreakpoints] = &DebuggerClient::recvClearFunctionBreakpoints;
+			handlers[SetExceptionFilter] = &DebuggerClient::recvSetExceptionFilter;
+			handlers[SetProfiler] = &DebuggerClient::recvSetProfiler;
+			handlers[RequestProfile] = &DebuggerClient::recvRequestProfile;
+			handlers[SetCoverage] = &DebuggerClient::recvSetCoverage;
+			handlers[RequestCoverage] = &DebuggerClient::recvRequestCoverage;
+			handlers[SetTracing] = &DebuggerClient::recvSetTracing;
+			handlers[RequestTrace] = &DebuggerClient::recvRequestTrace;
+			handlers[SetNativeProfiler] = &DebuggerClient::recvSetNativeProfiler;
+			handlers[RequestNativeProfile] = &DebuggerClient::recvRequestNativeProfile;
+			handlers[SetPublicProfiler] = &DebuggerClient::recvSetPublicProfiler;
+			handlers[RequestPublicProfile] = &DebuggerClient::recvRequestPublicProfile;
+			handlers[RequestOverhead] = &DebuggerClient::recvRequestOverhead;
+			handlers[RequestPluginCpu] = &DebuggerClient::recvRequestPluginCpu;
+			handlers[RequestSource] = &DebuggerClient::recvRequestSource;
+			handlers[ListImages] = &DebuggerClient::recvListImages;
+			handlers[Disassemble] = &DebuggerClient::recvDisassemble;
+			handlers[SetHeapProfiler] = &DebuggerClient::recvSetHeapProfiler;
+			handlers[RequestHeapProfile] = &DebuggerClient::recvRequestHeapProfile;
+			handlers[SetRecording] = &DebuggerClient::recvSetRecording;
+			handlers[RequestHistory] = &DebuggerClient::recvRequestHistory;
+			handlers[SetSharedMemory] = &DebuggerClient::recvSetSharedMemory;
+			handlers[HeartbeatAck] = &DebuggerClient::recvHeartbeatAck;
+			handlers[SetNativeBreakpoints] = &DebuggerClient::recvSetNativeBreakpoints;
+			handlers[SetPublicBreakpoints] = &DebuggerClient::recvSetPublicBreakpoints;
+			return true;
+		}();
+		(void)filled;
+		return handlers;
+	}
+
+	// How many bytes of complete messages |buffer| starts with. A message
+	// too large to ever arrive loses the connection, and all of |buffer|.
+	size_t framedLength(const char* buffer, size_t len) {
+		size_t pos = 0;
+		while (len - pos >= 5) {
+			uint32_t msg_len;
+			memcpy(&msg_len, buffer + pos, sizeof(msg_len));
+			if (msg_len > MAX_MESSAGE_SIZE - 5) {
+				if (socket)
+					socket->postDisConnect();
+				return len;
 			}
+			if (len - pos - 5 < msg_len)
+				break;
+			pos += 5 + msg_len;
 		}
+		return pos;
+	}
 
-		/* check whether we are stepping through a sub-function */
-		if (current_state == DebugStepOver) {
-			if (frm_ < lastfrm_)
-			{
-				return current_state;
+	// Dispatches the complete messages at the start of |buffer| and returns
+	// how many bytes they took. A partial message is left for the next call,
+	// once the rest of it has arrived.
+	size_t RecvCmd(const char* buffer, size_t len) {
+		// The replies to everything that arrived together go out together.
+		SendQueue::Cork cork(outbound);
+		const RecvHandler* handlers = recvHandlers();
+		size_t pos = 0;
+		while (len - pos >= 5) {
+			uint32_t msg_len;
+			memcpy(&msg_len, buffer + pos, sizeof(msg_len));
+			if (msg_len > MAX_MESSAGE_SIZE - 5) {
+				// Can never fit the receive buffer; the stream is lost.
+				if (socket)
+					socket->postDisConnect();
+				return len;
 			}
-			
-			WaitWalkCmd();
+			if (len - pos - 5 < msg_len)
+				break;
 
-			if (current_state == DebugDead)
-				return current_state;
+			unsigned char type = buffer[pos + 4];
+			CUtlBuffer buf(buffer + pos + 5, msg_len);
+			pos += 5 + msg_len;
+			traffic.bytes_received.fetch_add(5 + msg_len, std::memory_order_relaxed);
+			traffic.messages_received.fetch_add(1, std::memory_order_relaxed);
+			if (type >= TotalMessages || !handlers[type])
+				continue;
+			if (observer && !observerMay(type))
+				continue;
+			(this->*handlers[type])(&buf);
+			// The client is destroyed when it stops debugging.
+			if (type == StopDebugging)
+				return pos;
 		}
+		return pos;
+	}
+};
 
-		lastfrm_ = frm_;
+//
+//  Connected clients. The game thread walks an immutable list taken with one
+//  atomic load; the I/O threads look their client up by session. Whoever
+//  holds a client's pointer keeps it alive, so a disconnect never frees a
+//  client the game thread is stopped in.
+//
+class ClientRegistry {
+public:
+	typedef std::vector<std::shared_ptr<DebuggerClient>> List;
 
-		return current_state;
+	std::shared_ptr<const List> snapshot() const {
+		return std::atomic_load(&list_);
 	}
 
-	void SwitchState(unsigned char state) {
-		current_state = state;
-		receive_walk_cmd = true;
-		cv.notify_one();
+	std::shared_ptr<DebuggerClient> find(const TcpConnection::Ptr& session) {
+		std::lock_guard<std::mutex> lock(lock_);
+		auto found = sessions_.find(session.get());
+		if (found == sessions_.end())
+			return nullptr;
+		return found->second;
 	}
 
-	void AskFile() {
+	std::shared_ptr<DebuggerClient> add(const TcpConnection::Ptr& session) {
+		auto client = std::make_shared<DebuggerClient>(session);
+		std::lock_guard<std::mutex> lock(lock_);
+		sessions_[session.get()] = client;
+		publish();
+		return client;
 	}
 
-	void RecvDebugFile(CUtlBuffer* buf) {
-		char file[260];
-		int strlen = buf->GetInt();
-		buf->GetString(file, strlen);
-		auto filename = std::filesystem::path(file).filename().string();
-		lowercase(filename);
-		files.insert(filename);
+	// Lists the breakpoint file's client, under no session until a client
+	// connects.
+	void addBoot(std::shared_ptr<DebuggerClient> client) {
+		std::lock_guard<std::mutex> lock(lock_);
+		sessions_[nullptr] = std::move(client);
+		publish();
 	}
 
-	void RecvStateSwitch(CUtlBuffer* buf) {
-		auto CurrentState = buf->GetUnsignedChar();
-		SwitchState(CurrentState);
+	std::shared_ptr<DebuggerClient> remove(const TcpConnection::Ptr& session) {
+		std::lock_guard<std::mutex> lock(lock_);
+		auto found = sessions_.find(session.get());
+		if (found == sessions_.end())
+			return nullptr;
+		auto client = std::move(found->second);
+		sessions_.erase(found);
+		publish();
+		return client;
 	}
 
-	void RecvCallStack(CUtlBuffer* buf) {
-		CallStack();
+private:
+	void publish() {
+		auto list = std::make_shared<List>();
+		list->reserve(sessions_.size());
+		for (auto& entry : sessions_)
+			list->push_back(entry.second);
+		std::atomic_store(&list_, std::shared_ptr<const List>(std::move(list)));
 	}
 
-	void recvRequestVariables(CUtlBuffer* buf) {
-		char scope[256];
-		int strlen = buf->GetInt();
-		buf->GetString(scope, strlen);
-		sendVariables(scope);
+	std::mutex lock_;
+	std::unordered_map<TcpConnection*, std::shared_ptr<DebuggerClient>> sessions_;
+	std::shared_ptr<const List> list_ = std::make_shared<List>();
+};
+ClientRegistry clients;
+
+void addClientID(const TcpConnection::Ptr& session) {
+	clients.add(session)->AskFile();
+	client_files_generation++;
+	// The first client to connect takes over from the breakpoint file.
+	if (clients.find(TcpConnection::Ptr())) {
+		fmt::print("[SM_DEBUGGER] Client connected, breakpoint file dropped.\n");
+		removeClientID(TcpConnection::Ptr());
 	}
+}
 
-	void recvRequestEvaluate(CUtlBuffer* buf) {
-		int frameId;
-		char variable[256];
-		int strlen = buf->GetInt();
-		buf->GetString(variable, strlen);
-		frameId = buf->GetInt();
-		evaluateVar(frameId, variable);
+void removeClientID(const TcpConnection::Ptr& session) {
+	if (auto client = clients.remove(session)) {
+		if (client->observer.exchange(false))
+			observer_count--;
+		DebugRequests.close(client->requests);
+		client->stopDebugging();
 	}
+	client_files_generation++;
+	native_breaks_dirty = true;
+	public_breaks_dirty = true;
+	break_sites_dirty = true;
+	data_watches_dirty = true;
+}
 
-	void recvDisconnect(CUtlBuffer* buf) {
+//
+//  The breakpoint file: SetBreakpoints messages framed as a client sends
+//  them, [uint32 length][uint8 SetBreakpoints][payload] each, held by a
+//  client without a socket. Its breakpoints resolve against each plugin as
+//  it loads like any client's, so OnPluginStart can stop or log with no
+//  client connected and no DebuggerWaitTime to wait out. Logpoints print to
+//  the console; a stop holds the game thread until a client connects and
+//  then pauses that client there.
+//
+bool LoadBreakpointFile(const std::string& path) {
+	std::ifstream in(path, std::ios::binary);
+	if (!in) {
+		fmt::print("[SM_DEBUGGER] Breakpoint file {} can't be opened.\n", path);
+		return false;
+	}
+	std::vector<char> contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	auto boot = std::make_shared<DebuggerClient>(TcpConnection::Ptr());
+	size_t pos = 0, messages = 0;
+	while (contents.size() - pos >= 5) {
+		uint32_t length;
+		memcpy(&length, contents.data() + pos, sizeof(length));
+		if (contents.size() - pos - 5 < length)
+			break;
+		if ((unsigned char)contents[pos + 4] == SetBreakpoints) {
+			CUtlBuffer buf(contents.data() + pos + 5, length);
+			boot->recvSetBreakpoints(&buf);
+			messages++;
+		}
+		pos += 5 + length;
 	}
+	if (pos != contents.size())
+		fmt::print("[SM_DEBUGGER] Breakpoint file {} is truncated after {} bytes.\n", path, pos);
 
-	void recvBreakpoint(CUtlBuffer* buf) {
-		char path[256];
-		int strlen = buf->GetInt();
-		buf->GetString(path, strlen);
-		std::string filename(std::filesystem::path(path).filename().string());
-		lowercase(filename);
-		files.insert(filename);
-		int line = buf->GetInt();
-		int id = buf->GetInt();
-		setBreakpoint(filename, line, id);
+	size_t count = 0;
+	for (auto& file : std::atomic_load(&boot->break_table)->lines)
+		count += file.second.size();
+	if (!count) {
+		fmt::print("[SM_DEBUGGER] Breakpoint file {} sets no breakpoints.\n", path);
+		return false;
 	}
+	clients.addBoot(std::move(boot));
+	client_files_generation++;
+	break_sites_dirty = true;
+	fmt::print("[SM_DEBUGGER] {} breakpoints in {} files from {}.\n", count, messages, path);
+	return true;
+}
 
-	void recvClearBreakpoints(CUtlBuffer* buf) {
-		char path[256];
-		int strlen = buf->GetInt();
-		buf->GetString(path, strlen);
+// A breakpoint from the file was hit: waits for a client to be ready and
+// hands it the stop as a pause at the same place.
+static void HandOverBootStop(SourcePawn::IPluginContext* ctx, sp_debug_break_info_t& info) {
+	fmt::print("[SM_DEBUGGER] Stopped at a breakpoint from the breakpoint file, waiting for a client.\n");
+	while (!WaitForClient(1.0f)) {
+	}
+	for (auto& client : *clients.snapshot()) {
+		if (!client->socket || client->observer)
+			continue;
+		client->SwitchState(DebugPause);
+		try
+		{
+			client->DebugHook(ctx, info);
+		}
+		catch (DebuggerClient::debugger_stopped& ex)
+		{
+		}
+		return;
+	}
+}
 
-		std::string filename(std::filesystem::path(path).filename().string());
-		lowercase(filename);
-		clearBreakpoints(filename);
+void fanOutToObservers(SendQueue::priority_e priority, const std::shared_ptr<std::string>& data) {
+	for (auto& client : *clients.snapshot()) {
+		if (client->observer)
+			client->pushObserved(priority, data);
 	}
+}
 
-	void stopDebugging() {
-		current_state = DebugDead;
-		receive_walk_cmd = true;
-		cv.notify_one();
-		std::unique_lock<std::mutex> lck(mtx);
-		cv.wait(lck, [this] { return unload; });
+//
+//  Clients interested in each plugin, so a BREAK in a plugin nobody debugs
+//  costs a hash probe instead of a path compare per file and client.
+//
+struct interested_clients_s {
+	uint32_t generation = 0;
+	std::vector<std::shared_ptr<DebuggerClient>> clients;
+};
+std::unordered_map<SourcePawn::IPluginContext*, interested_clients_s> interested_clients;
+
+const std::vector<std::shared_ptr<DebuggerClient>>& interestedClients(SourcePawn::IPluginContext* ctx) {
+	auto& interest = interested_clients[ctx];
+	uint32_t generation = client_files_generation;
+	if (interest.generation != generation) {
+		interest.generation = generation;
+		interest.clients.clear();
+		auto list = clients.snapshot();
+		for (auto& client : *list) {
+			if (client->isInterested(ctx))
+				interest.clients.push_back(client);
+		}
 	}
+	return interest.clients;
+}
 
-	void recvStopDebugging(CUtlBuffer* buf) {
-		stopDebugging();
-		removeClientID(socket);
+//
+//  Patchable BREAK sites. With a VM that supports them, only the cips some
+//  client has a breakpoint on call into DebugHandler; every site is armed
+//  while a client is pausing or stepping.
+//
+bool patchable_break_sites = false;
+std::unordered_map<SourcePawn::IPluginRuntime*, std::vector<cell_t>> armed_break_sites;
+
+void EnablePatchableBreakSites() {
+	patchable_break_sites = true;
+}
+
+void DisablePatchableBreakSites() {
+	patchable_break_sites = false;
+}
+
+// Must run on the main thread, since it rewrites plugin code.
+void SyncBreakSites() {
+#if SOURCEPAWN_API_VERSION >= 0x020F
+	if (!patchable_break_sites || !break_sites_dirty.exchange(false))
+		return;
+
+	// A step over or out only needs its traps; other steps, the profiler,
+	// coverage and recording need every site.
+	auto list = clients.snapshot();
+	bool stepping = DebugProfiler.active() || DebugCoverage.active() || DebugRecorder.active();
+	for (auto& client : *list)
+		stepping = stepping || (client->isStepping() && !client->activeStepTraps());
+
+	std::unordered_map<SourcePawn::IPluginRuntime*, std::vector<cell_t>> armed;
+	IPluginIterator* iter = plsys->GetPluginIterator();
+	for (; iter->MorePlugins(); iter->NextPlugin()) {
+		auto ctx = iter->GetPlugin()->GetBaseContext();
+		if (!ctx || !ctx->IsDebugging())
+			continue;
+		auto runtime = ctx->GetRuntime();
+
+		auto previous = armed_break_sites.find(runtime);
+		if (previous != armed_break_sites.end()) {
+			for (auto cip : previous->second)
+				runtime->SetDebugBreakSite(cip, false);
+		}
+
+		auto& cips = armed[runtime];
+		for (auto& client : *list) {
+			if (!client->isInterested(ctx))
+				continue;
+			auto plugin = client->pluginState(ctx);
+			if (!plugin)
+				continue;
+			plugin->breakpoints.forEach([&](cell_t cip) {
+				if (runtime->SetDebugBreakSite(cip, true) == SP_ERROR_NONE)
+					cips.push_back(cip);
+				});
+			auto traps = client->activeStepTraps();
+			if (traps && traps->context == ctx) {
+				for (auto cip : traps->cips) {
+					if (runtime->SetDebugBreakSite(cip, true) == SP_ERROR_NONE)
+						cips.push_back(cip);
+				}
+			}
+		}
+		runtime->SetAllDebugBreakSites(stepping);
 	}
+	iter->Release();
+	armed_break_sites = std::move(armed);
+#endif
+}
 
-	void recvRequestSetVariable(CUtlBuffer* buf) {
-		char var[256];
-		int strlen = buf->GetInt();
-		buf->GetString(var, strlen);
-		char value[256];
-		strlen = buf->GetInt();
-		buf->GetString(value, strlen);
-		auto index = buf->GetInt();
-		setVariable(var, value, index);
+// Must run on the main thread, since it walks the plugin list.
+void SyncBreakpointVerification() {
+	if (!breakpoints_unverified.exchange(false))
+		return;
+	auto list = clients.snapshot();
+	if (list->empty())
+		return;
+
+	std::vector<SourcePawn::IPluginContext*> contexts;
+	IPluginIterator* iter = plsys->GetPluginIterator();
+	for (; iter->MorePlugins(); iter->NextPlugin()) {
+		auto ctx = iter->GetPlugin()->GetBaseContext();
+		if (ctx && ctx->IsDebugging())
+			contexts.push_back(ctx);
 	}
+	iter->Release();
+	for (auto& client : *list)
+		client->verifyBreakpoints(contexts);
+}
 
-	void RecvCmd(const char* buffer, size_t len) {
-		CUtlBuffer buf((void*)buffer, len);
-		while (buf.TellGet() < len) {
-			int msg_len = buf.GetUnsignedInt();
-			int type = buf.GetUnsignedChar();
-			switch (type) {
-			case RequestFile: {
-				RecvDebugFile(&buf);
-				break;
-			}
-			case Pause: {
-				RecvStateSwitch(&buf);
-				break;
-			}
-			case Continue: {
-				RecvStateSwitch(&buf);
-				break;
-			}
-			case StepIn: {
-				RecvStateSwitch(&buf);
-				break;
-			}
-			case StepOver: {
-				RecvStateSwitch(&buf);
-				break;
-			}
-			case StepOut: {
-				RecvStateSwitch(&buf);
-				break;
-			}
-			case RequestCallStack: {
-				RecvCallStack(&buf);
-				break;
-			}
-			case RequestVariables: {
-				recvRequestVariables(&buf);
-				break;
-			}
-			case RequestEvaluate: {
-				recvRequestEvaluate(&buf);
-				break;
-			}
-			case Disconnect: {
-				recvDisconnect(&buf);
-				break;
-			}
-			case ClearBreakpoints: {
-				recvClearBreakpoints(&buf);
-				break;
-			}
-			case SetBreakpoint: {
-				recvBreakpoint(&buf);
-				break;
-			}
-			case StopDebugging: {
-				recvStopDebugging(&buf);
-				break;
-			}
-			case RequestSetVariable: {
-				recvRequestSetVariable(&buf);
-				break;
-			}
-			}
+//
+//  Data watchpoints. The VM keeps a few watched ranges per plugin and calls
+//  DebugHandler from any store that touches one; the ranges are rebuilt from
+//  every interested client's watchpoints when something changes.
+//
+void EnableDataWatchpoints() {
+	data_watchpoints = true;
+}
+
+void EnableBackgroundCompilation() {
+	background_compile = true;
+}
+
+// Must run on the main thread, between plugin calls.
+void SyncDataWatches() {
+#if SOURCEPAWN_API_VERSION >= 0x0212
+	if (!data_watchpoints || !data_watches_dirty.exchange(false))
+		return;
+
+	auto list = clients.snapshot();
+	IPluginIterator* iter = plsys->GetPluginIterator();
+	for (; iter->MorePlugins(); iter->NextPlugin()) {
+		auto ctx = iter->GetPlugin()->GetBaseContext();
+		if (!ctx || !ctx->IsDebugging())
+			continue;
+		ctx->GetRuntime()->ClearDataWatches();
+		for (auto& client : *list) {
+			if (client->isInterested(ctx))
+				client->resolveWatchpoints(ctx);
 		}
 	}
-};
+	iter->Release();
+#endif
+}
 
-std::vector<std::unique_ptr<DebuggerClient>> clients;
 
-void addClientID(const TcpConnection::Ptr& session) {
-	clients.push_back(std::make_unique<DebuggerClient>(session));
-	clients.back()->AskFile();
+//
+//  Debug breaks are only compiled in while something uses them. Once the
+//  last client is gone and neither the profiler nor coverage runs, plugin
+//  functions are compiled again without them as they are entered.
+//
+SourcePawn::ISourcePawnEnvironment* debug_break_env = nullptr;
+bool debug_breaks_active = true;
+
+void EnableDebugBreakSwitching(SourcePawn::ISourcePawnEnvironment* env) {
+	debug_break_env = env;
 }
 
-void removeClientID(const TcpConnection::Ptr& session) {
-	for (auto it = clients.begin(); it != clients.end(); ++it) {
-		if ((*it)->socket == session) {
-			clients.erase(it);
+// Must run on the main thread.
+void SyncDebugBreaks() {
+#if SOURCEPAWN_API_VERSION >= 0x021B
+	if (!debug_break_env)
+		return;
+	bool active = !clients.snapshot()->empty() || DebugProfiler.active() || DebugCoverage.active() ||
+		DebugRecorder.active();
+	if (active == debug_breaks_active)
+		return;
+	debug_breaks_active = active;
+	debug_break_env->SetDebugBreaksActive(active);
+#endif
+}
+
+// Intercepts the natives the clients' native breakpoints name. Must run on
+// the main thread, with no plugin code on the stack; syncs the native
+// profiler too.
+void SyncNativeBreakpoints() {
+	if (native_breaks_dirty.exchange(false)) {
+		std::unordered_set<std::string> names;
+		for (auto& client : *clients.snapshot()) {
+			for (auto& entry : std::atomic_load(&client->break_table)->natives)
+				names.insert(entry.first);
+		}
+		static std::unordered_set<std::string> watched;
+		if (names != watched) {
+			watched = names;
+			DebugNativeBreaks.watch(std::move(names));
+		}
+	}
+	DebugNativeBreaks.sync();
+}
+
+// Arms the publics the clients' public breakpoints name. Must run on the
+// main thread.
+void SyncPublicBreakpoints() {
+	if (public_breaks_dirty.exchange(false)) {
+		std::unordered_set<std::string> keys;
+		for (auto& client : *clients.snapshot()) {
+			for (auto& entry : std::atomic_load(&client->break_table)->publics)
+				keys.insert(entry.first);
+		}
+		static std::unordered_set<std::string> watched;
+		if (keys != watched) {
+			watched = keys;
+			DebugPublicBreaks.watch(std::move(keys));
+		}
+	}
+	DebugPublicBreaks.sync();
+}
+
+// Must run on the main thread.
+void FlushErrorSummaries() {
+	auto now = std::chrono::steady_clock::now();
+	for (auto& client : *clients.snapshot())
+		client->flushErrorSummaries(now);
+}
+
+// Must run on the main thread, once per tick. Each tick over the budget
+// gives up one more kind of instrumentation, and the clients are told why.
+void EnforceTickBudget() {
+	uint64_t cost;
+	auto step = DebugBudget.endTick(&cost);
+	if (step == TickBudget::Hold)
+		return;
+
+	std::string action;
+	if (step == TickBudget::Recover) {
+		switch (DebugBudget.level()) {
+		case TickBudget::Full:
+			DebugProfiler.throttle(1);
+			if (!DebugProfiler.active())
+				return;
+			action = "profiler sampling is back to normal";
+			break;
+		case TickBudget::SlowSampling:
+			action = "logpoint output is back";
+			break;
+		default:
+			action = "tracing, coverage, profiling and recording may be turned back on";
+			break;
+		}
+	} else {
+		switch (DebugBudget.level()) {
+		case TickBudget::SlowSampling:
+			DebugProfiler.throttle(4);
+			if (!DebugProfiler.active())
+				return;
+			action = "profiler sampling slowed down 4x";
+			break;
+		case TickBudget::NoLogpoints:
+			action = "logpoint output dropped";
+			break;
+		default:
+			if (!DebugTrace.active() && !DebugCoverage.active() && !DebugProfiler.active() &&
+				!DebugRecorder.active())
+				return;
+			DebugTrace.setActive(false);
+			DebugCoverage.enable(false);
+			DebugProfiler.stop();
+			DebugRecorder.stop();
+			action = "tracing, coverage, profiling and recording turned off";
 			break;
 		}
 	}
+	auto text = fmt::format("[SM_DEBUGGER] {}: a tick cost the debugger {:.3f} ms of its {:.3f} ms budget.",
+		action, cost / 1e6, DebugBudget.budget() / 1e6);
+	for (auto& client : *clients.snapshot())
+		client->queueLog(text);
+	SyncDebugBreaks();
+}
+
+// The server's overhead followed by each connected client's share.
+std::vector<std::string> OverheadTable(bool reset) {
+	auto lines = DebugOverhead.table(reset);
+	if (DebugBudget.budget()) {
+		static const char* levels[] = { "full", "slow sampling", "no logpoints", "disarmed" };
+		lines.push_back(fmt::format("tick budget  {:>12.3f} ms, instrumentation {}",
+			DebugBudget.budget() / 1e6, levels[DebugBudget.level()]));
+	}
+	for (auto& client : *clients.snapshot()) {
+		auto& traffic = client->traffic;
+		lines.push_back(fmt::format("client {}: sent {} bytes in {} messages, received {} bytes in {} messages, stopped {:.1f} us, rtt {:.1f} us",
+			client->address(), uint64_t(traffic.bytes_sent), uint64_t(traffic.messages_sent),
+			uint64_t(traffic.bytes_received), uint64_t(traffic.messages_received), traffic.blocked / 1000.0,
+			client->rtt_ns / 1000.0));
+		if (reset)
+			traffic.reset();
+	}
+	return lines;
 }
 
+// GET /metrics: the Prometheus page, with each client's traffic labelled by
+// its address.
+static void serveMetrics(const HTTPParser& request, const HttpSession::Ptr& session) {
+	HttpResponse response;
+	if (request.getPath() != "/metrics") {
+		response.setStatus(HttpResponse::HTTP_RESPONSE_STATUS::NOT_FOUND);
+	} else {
+		MetricsWriter out;
+		WriteMetrics(out);
+		auto list = clients.snapshot();
+		out.family("sm_debugger_client_sent_bytes_total", "counter", "Bytes sent to a debugger client.");
+		for (auto& client : *list)
+			out.sample("sm_debugger_client_sent_bytes_total", { { "client", client->address() } }, uint64_t(client->traffic.bytes_sent));
+		out.family("sm_debugger_client_received_bytes_total", "counter", "Bytes received from a debugger client.");
+		for (auto& client : *list)
+			out.sample("sm_debugger_client_received_bytes_total", { { "client", client->address() } }, uint64_t(client->traffic.bytes_received));
+		out.family("sm_debugger_client_stopped_seconds_total", "counter", "Time a debugger client held the game thread at stops.");
+		for (auto& client : *list)
+			out.sample("sm_debugger_client_stopped_seconds_total", { { "client", client->address() } }, client->traffic.blocked / 1e9);
+		out.family("sm_debugger_client_rtt_seconds", "gauge", "Round trip of a debugger client's last heartbeat.");
+		for (auto& client : *list) {
+			if (client->rtt_ns)
+				out.sample("sm_debugger_client_rtt_seconds", { { "client", client->address() } }, client->rtt_ns / 1e9);
+		}
+		response.setStatus(HttpResponse::HTTP_RESPONSE_STATUS::OK);
+		response.setContentType("text/plain; version=0.0.4");
+		response.setBody(out.take());
+	}
+	response.addHeadValue("Connection", "Close");
+	session->send(response.getResult(), [session]() {
+		session->postShutdown();
+		});
+}
 
+// Started once a port is configured. The connections are served by the
+// service's worker threads; this thread sends what the game thread
+// buffered since the last tick.
 void debugThread() {
-        auto service = brynet::net::IOThreadTcpService::Create();
-	service->startWorkerThread(2);
+	auto service = brynet::net::IOThreadTcpService::Create();
+	service->startWorkerThread(SM_Debugger_threads());
 
 	auto mainLoop = std::make_shared<EventLoop>();
 	auto enterCallback = [=](const TcpConnection::Ptr& session) {
@@ -1181,30 +5073,177 @@ void debugThread() {
 			});
 		auto contentLength = std::make_shared<size_t>();
 		session->setDataCallback([=](brynet::base::BasePacketReader& reader) {
-			for (auto& client : clients) {
-				if (client->socket == session) {
-					client->RecvCmd(reader.begin(), reader.size());
-					break;
-				}
+			auto client = clients.find(session);
+			if (!client) {
+				reader.consumeAll();
+				return;
 			}
-			reader.consumeAll();
+			// Complete messages wait for the client's turn on the request
+			// threads, so this I/O thread goes on serving the others. A
+			// partial one stays in the reader until the rest arrives.
+			size_t used = client->framedLength(reader.begin(), reader.size());
+			if (used) {
+				auto batch = std::make_shared<std::string>(reader.begin(), used);
+				DebugRequests.push(client->requests, [client, batch]() {
+					client->RecvCmd(batch->data(), batch->size());
+				});
+			}
+			reader.addPos(used);
+			reader.savePos();
 			});
 	};
 
-	wrapper::ListenerBuilder listener;
-	listener.WithService(service)
-		.AddSocketProcess(
-			{ [](TcpSocket& socket) { socket.setNodelay(); } })
-		.WithMaxRecvBufferSize(1024 * 1024)
-		.AddEnterCallback(enterCallback)
-		.WithAddr(false, "0.0.0.0", SM_Debugger_port())
-		.asyncRun();
+	if (SM_Debugger_port()) {
+		wrapper::ListenerBuilder listener;
+		listener.WithService(service)
+			.AddSocketProcess(
+				{ [](TcpSocket& socket) { socket.setNodelay(); } })
+			.WithMaxRecvBufferSize(MAX_MESSAGE_SIZE)
+			.AddEnterCallback(enterCallback)
+			.WithAddr(false, "0.0.0.0", SM_Debugger_port())
+			.asyncRun();
+	}
+
+	// Local adapters skip TCP; their sockets are served the same way.
+	static LocalListener local;
+	if (SM_Debugger_local_socket()[0]) {
+		bool listening = local.start(SM_Debugger_local_socket(), [service, enterCallback](local_socket_t fd) {
+			auto socket = TcpSocket::Create(fd, true);
+			socket->setNonblock();
+			ConnectionOption option;
+			option.enterCallback.push_back(enterCallback);
+			option.maxRecvBufferSize = MAX_MESSAGE_SIZE;
+			service->addTcpConnection(std::move(socket), option);
+			});
+		if (!listening)
+			fmt::print("[SM_DEBUGGER] Can't listen on {}.\n", SM_Debugger_local_socket());
+	}
+
+	if (SM_Debugger_metrics_port()) {
+		wrapper::HttpListenerBuilder metrics;
+		metrics.WithService(service)
+			.AddSocketProcess(
+				{ [](TcpSocket& socket) { socket.setNodelay(); } })
+			.WithMaxRecvBufferSize(4096)
+			.WithAddr(false, "0.0.0.0", SM_Debugger_metrics_port())
+			.WithEnterCallback([](const HttpSession::Ptr& session, HttpSessionHandlers& handlers) {
+				handlers.setHttpEndCallback(serveMetrics);
+				})
+			.asyncRun();
+	}
 
+	auto last_heartbeat = std::chrono::steady_clock::now();
 	while (true) {
-		mainLoop->loop(1000);
+		mainLoop->loop(FLUSH_INTERVAL_MS);
+		auto now = std::chrono::steady_clock::now();
+		bool heartbeat = now - last_heartbeat >= std::chrono::milliseconds(HEARTBEAT_INTERVAL_MS);
+		if (heartbeat)
+			last_heartbeat = now;
+		for (auto& client : *clients.snapshot()) {
+			{
+				SendQueue::Cork cork(client->outbound);
+				if (heartbeat && (client->extended_capabilities & CapTimings))
+					client->sendHeartbeat(now);
+				client->flushLog();
+				client->flushSnapshots();
+			}
+			client->outbound.flush();
+		}
+		// Keeps the sample ring from filling between profile requests.
+		if (DebugProfiler.active())
+			DebugProfiler.drain();
+	}
+}
+
+#if SOURCEPAWN_API_VERSION >= 0x0210
+DebugBreakFilter DebugFilter;
+
+bool DebugBreakFilter::ShouldDebugBreak(IPluginRuntime* runtime) {
+	if (plugins.empty())
+		return true;
+
+	auto name = lowercase(std::filesystem::path(runtime->GetFilename()).filename().string());
+	if (plugins.find(name) != plugins.end())
+		return true;
+
+	// A client that is already connected may have asked for its sources,
+	// or set a breakpoint on one of its functions.
+	auto list = clients.snapshot();
+	for (auto& client : *list) {
+		if (client->wantsFiles(runtime) || client->wantsFunctions(runtime))
+			return true;
+	}
+	return false;
+}
+
+void DebugBreakFilter::SetPlugins(const char* list) {
+	plugins.clear();
+	for (auto& entry : split_string(list, ",")) {
+		auto first = entry.find_first_not_of(" \t");
+		if (first == std::string::npos)
+			continue;
+		auto last = entry.find_last_not_of(" \t");
+		plugins.insert(lowercase(entry.substr(first, last - first + 1)));
+	}
+}
+#endif
+
+DebugPluginsListener DebugPlugins;
+
+void DebugPluginsListener::OnPluginLoaded(IPlugin* plugin) {
+	break_sites_dirty = true;
+	data_watches_dirty = true;
+	breakpoints_unverified = true;
+
+	// Parse the debug info now rather than on the first break.
+	auto ctx = plugin->GetBaseContext();
+	if (ctx && ctx->IsDebugging())
+		DebugImages.preload(ctx->GetRuntime());
+	if (ctx) {
+		DebugTrace.addPlugin(ctx);
+		DebugTraceFile.addPlugin(ctx);
+		DebugSpikes.addPlugin(ctx);
+		DebugNatives.addPlugin(ctx);
+		DebugNativeBreaks.addPlugin(ctx);
+		DebugPublicBreaks.addPlugin(ctx);
+#if SOURCEPAWN_API_VERSION >= 0x0217
+		// Natives are bound by now, so compiled native calls don't have to
+		// go through the binding.
+		if (background_compile)
+			ctx->GetRuntime()->CompileInBackground();
+#endif
 	}
 }
 
+void DebugPluginsListener::OnPluginUnloaded(IPlugin* plugin) {
+	auto ctx = plugin->GetBaseContext();
+	if (!ctx)
+		return;
+
+	// Samples name functions through the plugin's image.
+	DebugProfiler.removePlugin(ctx);
+	breakpoints_unverified = true;
+
+	auto list = clients.snapshot();
+	for (auto& client : *list)
+		client->forgetPlugin(ctx);
+	interested_clients.erase(ctx);
+	DebugCoverage.forget(ctx);
+	DebugTrace.removePlugin(ctx);
+	DebugSpikes.removePlugin(ctx);
+	DebugNativeBreaks.removePlugin(ctx);
+	DebugPublicBreaks.removePlugin(ctx);
+	DebugNatives.removePlugin(ctx);
+	DebugPublics.removePlugin(ctx);
+	DebugHeap.removePlugin(ctx);
+	DebugRecorder.removePlugin(ctx);
+	DebugOverhead.removePlugin(ctx);
+	DebugCpu.removePlugin(ctx);
+	DebugCores.removePlugin(ctx->GetRuntime());
+	DebugImages.release(ctx->GetRuntime());
+	DebugFiles.forget(ctx->GetRuntime());
+}
+
 /**
  * @brief Called on debug spew.
  *
@@ -1230,15 +5269,20 @@ void DebugReport::OnDebugSpew(const char* msg, ...) {
  */
 void DebugReport::ReportError(const IErrorReport& report,
 	IFrameIterator& iter) {
-	if (!clients.empty()) {
+	hook_entered = std::chrono::steady_clock::now();
+	auto list = clients.snapshot();
+	bool reported = false;
+	if (!list->empty()) {
 		auto plugin = report.Context();
 		if (plugin) {
+			TickBudget::scope_s budget;
 
 			auto found = false;
 			/* first search already found attached hook */
-			for (auto& client : clients) {
-				if (client && client->context_ == iter.Context()) {
+			for (auto& client : *list) {
+				if (client->context_ == iter.Context()) {
 					found = true;
+					reported = true;
 					client->ReportError(report, iter);
 					break;
 				}
@@ -1247,29 +5291,18 @@ void DebugReport::ReportError(const IErrorReport& report,
 			/* if not found, search for new client who wants to attach to
 			 * current file */
 			if (!found) {
-				for (int i = 0; i < report.Context()
-					->GetRuntime()
-					->GetDebugInfo()
-					->NumFiles();
-					i++) {
-					auto filename = std::string(report.Context()
-						->GetRuntime()
-						->GetDebugInfo()
-						->GetFileName(i));
-
-					auto current_file = std::filesystem::path(filename).filename().string();
-					lowercase(current_file);
-
-					for (auto& client : clients) {
-						if (client->files.find(current_file) != client->files.end())
-						{
-							client->ReportError(report, iter);
-						}
+				for (auto& client : *list) {
+					if (client->wantsFiles(report.Context()->GetRuntime())) {
+						reported = true;
+						client->ReportError(report, iter);
 					}
 				}
 			}
 		}
 	}
+	// Nobody saw it stop; keep what it left on the stack.
+	if (!reported && DebugCores.active())
+		DebugCores.write(report, iter);
 
 	original->ReportError(report, iter);
 }
@@ -1280,48 +5313,105 @@ void(DebugHandler)(SourcePawn::IPluginContext* IPlugin,
 	if (!IPlugin->IsDebugging())
 		return;
 
-	if (!clients.empty()) {
-		/* first search already found attached hook */
-		for (auto it = clients.begin(); it != clients.end(); ++it) {
-			const auto& client = *it;
-			if (client && client->context_ == IPlugin) {
-				try
-				{
-					client->DebugHook(IPlugin, BreakInfo);
-				}
-				catch (DebuggerClient::debugger_stopped& ex)
-				{
-					//it = clients.begin();
-					//continue;
-					return;
-				}
-			}
-			
+	hook_entered = std::chrono::steady_clock::now();
+	TickBudget::scope_s budget;
+	DebugOverhead.onBreak(IPlugin);
+	DebugProfiler.onBreak(IPlugin);
+	if (DebugCoverage.active()) {
+#if SOURCEPAWN_API_VERSION >= 0x0212
+		// Data watch hits are stores, not lines.
+		if (BreakInfo.version < 2 || !(BreakInfo.flags & SP_DEBUG_BREAK_DATAWATCH))
+#endif
+			DebugCoverage.hit(IPlugin, BreakInfo.cip);
+	}
+	if (DebugRecorder.active()) {
+#if SOURCEPAWN_API_VERSION >= 0x0212
+		if (BreakInfo.version < 2 || !(BreakInfo.flags & SP_DEBUG_BREAK_DATAWATCH))
+#endif
+			DebugRecorder.onBreak(IPlugin, BreakInfo.cip, BreakInfo.frm);
+	}
+
+	auto& interested = interestedClients(IPlugin);
+	if (interested.empty())
+		return;
+
+	// Time at a stop is the user's, not the debugger's; it is counted apart.
+	auto start = std::chrono::steady_clock::now();
+	uint64_t blocked = DebugOverhead.blocked();
+	for (auto& client : interested) {
+		try
+		{
+			client->DebugHook(IPlugin, BreakInfo);
 		}
-				
-		for (int i = 0;
-			i < IPlugin->GetRuntime()->GetDebugInfo()->NumFiles();
-			i++) {
-			auto filename =
-				IPlugin->GetRuntime()->GetDebugInfo()->GetFileName(
-					i);
-			auto current_file = std::filesystem::path(filename).filename().string();
-			lowercase(current_file);
-
-			for (auto it = clients.begin(); it != clients.end(); ++it) {
-				const auto& client = *it;
-				if (client->files.find(current_file) != client->files.end())
-				{
-					try
-					{
-						client->DebugHook(IPlugin, BreakInfo);
-					}
-					catch (DebuggerClient::debugger_stopped& ex)
-					{
-						return;
-					}
-				}
-			}			
+		catch (DebuggerClient::debugger_stopped& ex)
+		{
+			break;
+		}
+		if (std::exchange(client->boot_stop, false))
+			HandOverBootStop(IPlugin, BreakInfo);
+	}
+
+	// A client may have started or stopped stepping while we were stopped.
+	SyncBreakSites();
+	SyncDataWatches();
+
+	uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start).count();
+	uint64_t stopped = DebugOverhead.blocked() - blocked;
+	DebugOverhead.addHandlerTime(elapsed > stopped ? elapsed - stopped : 0);
+}
+void NativeBreakHandler(SourcePawn::IPluginContext* ctx, const std::string& native,
+	cell_t cip, cell_t frm, const cell_t* params) {
+	if (!ctx->IsDebugging())
+		return;
+
+	hook_entered = std::chrono::steady_clock::now();
+	TickBudget::scope_s budget;
+	auto start = std::chrono::steady_clock::now();
+	uint64_t blocked = DebugOverhead.blocked();
+	auto list = clients.snapshot();
+	for (auto& client : *list) {
+		try
+		{
+			client->nativeHook(ctx, native, cip, frm, params);
+		}
+		catch (DebuggerClient::debugger_stopped& ex)
+		{
+			break;
 		}
 	}
-}
\ No newline at end of file
+
+	SyncBreakSites();
+	SyncDataWatches();
+
+	uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start).count();
+	uint64_t stopped = DebugOverhead.blocked() - blocked;
+	DebugOverhead.addHandlerTime(elapsed > stopped ? elapsed - stopped : 0);
+}
+
+void PublicEntryHandler(SourcePawn::IPluginFunction* fn, const cell_t* params,
+	unsigned int num_params) {
+	auto ctx = fn->GetParentContext();
+	if (!ctx || !ctx->IsDebugging())
+		return;
+
+	hook_entered = std::chrono::steady_clock::now();
+	TickBudget::scope_s budget;
+	auto start = std::chrono::steady_clock::now();
+	uint64_t blocked = DebugOverhead.blocked();
+	// Counted like a native's, so logpoint messages format them the same.
+	std::vector<cell_t> args(num_params + 1);
+	args[0] = cell_t(num_params);
+	std::copy(params, params + num_params, args.begin() + 1);
+	auto list = clients.snapshot();
+	for (auto& client : *list)
+		client->publicHook(ctx, fn, args.data());
+
+	SyncBreakSites();
+
+	uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start).count();
+	uint64_t stopped = DebugOverhead.blocked() - blocked;
+	DebugOverhead.addHandlerTime(elapsed > stopped ? elapsed - stopped : 0);
+}
@@ -19,6 +19,8 @@
 #include "smx-v1-image.h"
 #include "stack-frames.h"
 #include "extension.h"
+#include <string>
+#include <unordered_set>
 #endif //_INCLUDE_DEBUGGER_H_
 
 
@@ -42,4 +44,46 @@ public:
 	void ReportError(const IErrorReport &report, IFrameIterator &iter);
 	
 	IDebugListener *original;
-};
\ No newline at end of file
+};
+
+class DebugPluginsListener : public IPluginsListener {
+public:
+	/**
+	 * @brief Called when a plugin is fully loaded. Schedules its debug image
+	 * to be loaded and indexed in the background.
+	 *
+	 * @param plugin  Plugin that was loaded.
+	 */
+	void OnPluginLoaded(IPlugin *plugin);
+
+	/**
+	 * @brief Called when a plugin is unloaded. Drops every reference to its
+	 * context and debug image.
+	 *
+	 * @param plugin  Plugin that was unloaded.
+	 */
+	void OnPluginUnloaded(IPlugin *plugin);
+};
+
+#if SOURCEPAWN_API_VERSION >= 0x0210
+class DebugBreakFilter : public IDebugBreakFilter {
+public:
+	/**
+	 * @brief Called once per plugin, before its first function is compiled.
+	 *
+	 * @param runtime  Plugin runtime.
+	 * @return         True to instrument the plugin's BREAK instructions.
+	 */
+	bool ShouldDebugBreak(IPluginRuntime *runtime);
+
+	/**
+	 * @brief Sets the plugins to instrument from a comma separated list of
+	 * plugin file names. An empty list instruments every plugin.
+	 *
+	 * @param list     Plugin list, e.g. "admin.smx, myplugin.smx".
+	 */
+	void SetPlugins(const char *list);
+
+	std::unordered_set<std::string> plugins;
+};
+#endif
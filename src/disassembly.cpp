@@ -0,0 +1,177 @@
+#include "disassembly.h"
+#include <fmt/format.h>
+
+using sp::SmxV1Image;
+
+Disassembly DebugDisassembly;
+
+namespace {
+enum class Operand {
+	Value,
+	Frame,		// offset from the frame
+	Global,		// data address
+	Code,		// code address
+	Native		// native index
+};
+
+Operand operandOf(sp::OPCODE op, uint32_t index) {
+	switch (op) {
+	case sp::OP_LOAD_S_PRI: case sp::OP_LOAD_S_ALT:
+	case sp::OP_LREF_S_PRI: case sp::OP_LREF_S_ALT:
+	case sp::OP_ADDR_PRI: case sp::OP_ADDR_ALT:
+	case sp::OP_STOR_S_PRI: case sp::OP_STOR_S_ALT:
+	case sp::OP_SREF_S_PRI: case sp::OP_SREF_S_ALT:
+	case sp::OP_PUSH_S: case sp::OP_ZERO_S: case sp::OP_INC_S: case sp::OP_DEC_S:
+	case sp::OP_PUSH_ADR: case sp::OP_LOAD_S_BOTH:
+	case sp::OP_PUSH2_S: case sp::OP_PUSH3_S: case sp::OP_PUSH4_S: case sp::OP_PUSH5_S:
+	case sp::OP_PUSH2_ADR: case sp::OP_PUSH3_ADR: case sp::OP_PUSH4_ADR: case sp::OP_PUSH5_ADR:
+		return Operand::Frame;
+	case sp::OP_CONST_S:
+		return index == 0 ? Operand::Frame : Operand::Value;
+	case sp::OP_LOAD_PRI: case sp::OP_LOAD_ALT:
+	case sp::OP_STOR_PRI: case sp::OP_STOR_ALT:
+	case sp::OP_PUSH: case sp::OP_ZERO: case sp::OP_INC: case sp::OP_DEC:
+	case sp::OP_LOAD_BOTH:
+	case sp::OP_PUSH2: case sp::OP_PUSH3: case sp::OP_PUSH4: case sp::OP_PUSH5:
+		return Operand::Global;
+	case sp::OP_CONST:
+		return index == 0 ? Operand::Global : Operand::Value;
+	case sp::OP_CALL: case sp::OP_JUMP: case sp::OP_JZER: case sp::OP_JNZ:
+	case sp::OP_JEQ: case sp::OP_JNEQ: case sp::OP_JSLESS: case sp::OP_JSLEQ:
+	case sp::OP_JSGRTR: case sp::OP_JSGEQ: case sp::OP_SWITCH:
+		return Operand::Code;
+	case sp::OP_SYSREQ_C: case sp::OP_SYSREQ_N:
+		return index == 0 ? Operand::Native : Operand::Value;
+	// [count][default]{[value][target]}
+	case sp::OP_CASETBL:
+		if (index == 0)
+			return Operand::Value;
+		return index % 2 ? Operand::Code : Operand::Value;
+	default:
+		return Operand::Value;
+	}
+}
+}
+
+std::shared_ptr<const Disassembly::function_s> Disassembly::decode(SmxV1Image* image,
+	const SmxV1Image::FunctionRange& fn) {
+	auto function = std::make_shared<function_s>();
+	function->codestart = fn.codestart;
+	function->codeend = fn.codeend;
+	function->name = fn.name ? fn.name : "";
+
+	std::vector<SmxV1Image::Instruction> insns;
+	function->complete = image->DecodeInstructions(fn.codestart, fn.codeend, &insns);
+
+	std::unordered_map<int32_t, const char*> globals;
+	{
+		std::vector<SmxV1Image::Symbol> symbols;
+		image->GetGlobalVariables(&symbols);
+		for (const auto& sym : symbols)
+			globals.emplace(sym.addr(), image->GetDebugName(sym.name()));
+	}
+
+	std::vector<SmxV1Image::Symbol> locals;
+	function->lines.reserve(insns.size());
+	for (const auto& insn : insns) {
+		line_s line{ insn.cip, SmxV1Image::kNoFile, 0, SmxV1Image::OpcodeName(insn.op) };
+		image->LookupLocation(insn.cip, &line.file, &line.line);
+
+		// Locals, arguments and statics in scope, looked up once per
+		// instruction that refers to any.
+		bool scoped = false;
+		auto local = [&](int32_t addr, bool frame) -> const char* {
+			if (!scoped) {
+				locals.clear();
+				image->GetLocalVariables(insn.cip, &locals);
+				scoped = true;
+			}
+			for (const auto& sym : locals) {
+				int vclass = sym.vclass() & 0x0f;
+				bool in_frame = vclass == 1 || vclass == 3;
+				if (in_frame == frame && sym.addr() == addr)
+					return image->GetDebugName(sym.name());
+			}
+			return nullptr;
+		};
+
+		std::string notes;
+		auto note = [&](const char* text) {
+			if (!text || !text[0])
+				return;
+			notes += notes.empty() ? " ; " : ", ";
+			notes += text;
+		};
+		for (uint32_t i = 0; i < insn.count; i++) {
+			cell_t value = insn.operands[i];
+			switch (operandOf(insn.op, i)) {
+			case Operand::Frame:
+				line.text += fmt::format(" {}", value);
+				note(local(value, true));
+				break;
+			case Operand::Global: {
+				line.text += fmt::format(" {:#x}", uint32_t(value));
+				const char* name = local(value, false);
+				if (!name) {
+					auto found = globals.find(value);
+					if (found != globals.end())
+						name = found->second;
+				}
+				note(name);
+				break;
+			}
+			case Operand::Code: {
+				line.text += fmt::format(" {:#x}", uint32_t(value));
+				if (insn.op == sp::OP_CALL) {
+					auto target = image->LookupFunctionRange(value);
+					if (target && target->codestart == uint32_t(value))
+						note(target->name);
+				}
+				break;
+			}
+			case Operand::Native:
+				line.text += fmt::format(" {}", value);
+				if (value >= 0 && size_t(value) < image->NumNatives())
+					note(image->GetNative(value));
+				break;
+			default:
+				line.text += fmt::format(" {}", value);
+				break;
+			}
+		}
+		line.text += notes;
+		function->lines.push_back(std::move(line));
+	}
+	return function;
+}
+
+std::shared_ptr<const Disassembly::function_s> Disassembly::get(uint64_t hash,
+	SmxV1Image* image, uint32_t cip) {
+	const auto* fn = image->LookupFunctionRange(cip);
+	if (!fn)
+		return nullptr;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto image_found = functions.find(hash);
+		if (image_found != functions.end()) {
+			auto found = image_found->second.find(fn->codestart);
+			if (found != image_found->second.end())
+				return found->second;
+		}
+	}
+
+	// Decoded outside the lock; two clients asking at once both decode,
+	// and the first one kept wins.
+	auto function = decode(image, *fn);
+	std::lock_guard<std::mutex> lock(mtx);
+	if (count >= kMaxFunctions) {
+		functions.clear();
+		count = 0;
+	}
+	auto& slot = functions[hash][fn->codestart];
+	if (!slot) {
+		slot = function;
+		count++;
+	}
+	return slot;
+}
@@ -0,0 +1,57 @@
+#ifndef _INCLUDE_DISASSEMBLY_H_
+#define _INCLUDE_DISASSEMBLY_H_
+
+#include "smx-v1-image.h"
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//
+//  Bytecode listings of plugin functions, one line per instruction with the
+//  source line it belongs to and the names behind its operands: locals by
+//  frame offset, globals by address, call targets and natives. A function is
+//  decoded once per image hash and kept, so paging through it costs a cache
+//  lookup per request.
+//
+class Disassembly {
+public:
+	// Functions kept before the cache starts over.
+	static constexpr size_t kMaxFunctions = 1024;
+
+	struct line_s {
+		uint32_t cip;
+		uint32_t file;	// debug file index, or SmxV1Image::kNoFile
+		uint32_t line;	// 0 where the debug info has none
+		std::string text;
+	};
+
+	struct function_s {
+		uint32_t codestart;
+		uint32_t codeend;
+		std::string name;
+		// False if decoding stopped at something that isn't an instruction.
+		bool complete;
+		std::vector<line_s> lines;
+	};
+
+	// Returns the listing of the function containing |cip| in |image|, whose
+	// image hash is |hash|, or nullptr if no function does. Safe to call
+	// from any thread.
+	std::shared_ptr<const function_s> get(uint64_t hash, sp::SmxV1Image* image, uint32_t cip);
+
+private:
+	static std::shared_ptr<const function_s> decode(sp::SmxV1Image* image,
+		const sp::SmxV1Image::FunctionRange& fn);
+
+	// By image hash, then by codestart.
+	std::mutex mtx;
+	std::unordered_map<uint64_t, std::unordered_map<uint32_t, std::shared_ptr<const function_s>>> functions;
+	size_t count = 0;
+};
+
+extern Disassembly DebugDisassembly;
+
+#endif //_INCLUDE_DISASSEMBLY_H_
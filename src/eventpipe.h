@@ -0,0 +1,120 @@
+#ifndef _INCLUDE_EVENTPIPE_H_
+#define _INCLUDE_EVENTPIPE_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <memory>
+
+//
+//  A single-producer, single-consumer ring of typed records, for moving
+//  what the game thread produces to the debug thread without locks or
+//  allocation. A record is an 8 byte header and its payload, padded to 8
+//  bytes; one that doesn't fit before the end leaves a pad record there and
+//  starts over at the front. A record that doesn't fit at all is dropped,
+//  and counted by its type, so the consumer can tell the client.
+//
+class EventPipe {
+public:
+	enum type_e : uint16_t {
+		// Logpoint output and other log lines, as text.
+		Log,
+		kTypes
+	};
+
+	// |capacity| is in bytes and rounded up to a power of two.
+	explicit EventPipe(size_t capacity) {
+		size_t size = 64;
+		while (size < capacity)
+			size <<= 1;
+		capacity_ = size;
+		data_.reset(new char[size]);
+	}
+
+	EventPipe(const EventPipe&) = delete;
+	EventPipe& operator=(const EventPipe&) = delete;
+
+	// Producer only. False, counting the record as dropped, if the consumer
+	// hasn't freed enough room.
+	bool push(type_e type, const void* data, uint32_t size) {
+		size_t need = align(sizeof(header_s) + size);
+		size_t head = head_.load(std::memory_order_relaxed);
+		size_t tail = tail_.load(std::memory_order_acquire);
+		size_t offset = head & (capacity_ - 1);
+		size_t pad = capacity_ - offset < need ? capacity_ - offset : 0;
+		if (head + pad + need - tail > capacity_) {
+			drop(type);
+			return false;
+		}
+		if (pad) {
+			header_s skip = { kPad, 0, uint32_t(pad - sizeof(header_s)) };
+			memcpy(data_.get() + offset, &skip, sizeof(skip));
+			head += pad;
+			offset = 0;
+		}
+		header_s header = { uint16_t(type), 0, size };
+		memcpy(data_.get() + offset, &header, sizeof(header));
+		memcpy(data_.get() + offset + sizeof(header), data, size);
+		head_.store(head + need, std::memory_order_release);
+		return true;
+	}
+
+	// Counts a record the producer chose not to push. Any thread.
+	void drop(type_e type) {
+		dropped_[type].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Consumer only. Calls |fn(type, data, size)| for each record, oldest
+	// first; |data| is only valid during the call. Returns how many there
+	// were.
+	template <typename Fn>
+	size_t drain(Fn&& fn) {
+		size_t tail = tail_.load(std::memory_order_relaxed);
+		size_t head = head_.load(std::memory_order_acquire);
+		size_t records = 0;
+		while (tail != head) {
+			const char* record = data_.get() + (tail & (capacity_ - 1));
+			header_s header;
+			memcpy(&header, record, sizeof(header));
+			if (header.type != kPad) {
+				fn(type_e(header.type), record + sizeof(header), header.size);
+				records++;
+			}
+			tail += align(sizeof(header) + header.size);
+			tail_.store(tail, std::memory_order_release);
+		}
+		return records;
+	}
+
+	// Records of |type| dropped since the last call. Consumer only.
+	uint32_t takeDropped(type_e type) {
+		return dropped_[type].exchange(0, std::memory_order_relaxed);
+	}
+
+	bool empty() const {
+		return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_relaxed);
+	}
+
+private:
+	static constexpr uint16_t kPad = 0xffff;
+
+	struct header_s {
+		uint16_t type;
+		uint16_t reserved;
+		uint32_t size;
+	};
+
+	static size_t align(size_t size) {
+		return (size + 7) & ~size_t(7);
+	}
+
+	size_t capacity_;
+	std::unique_ptr<char[]> data_;
+	// Written by the producer and the consumer respectively, on their own
+	// cache lines; both only grow, and wrap by masking.
+	alignas(64) std::atomic<size_t> head_{ 0 };
+	alignas(64) std::atomic<size_t> tail_{ 0 };
+	std::atomic<uint32_t> dropped_[kTypes] = {};
+};
+
+#endif //_INCLUDE_EVENTPIPE_H_
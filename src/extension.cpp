@@ -1,5 +1,26 @@
 #include "debugger.h"
 #include "extension.h"
+#include "imagecache.h"
+#include "profiler.h"
+#include "functiontrace.h"
+#include "tracefile.h"
+#include "nativeprofiler.h"
+#include "nativebreaks.h"
+#include "publicbreaks.h"
+#include "workerpool.h"
+#include "requestscheduler.h"
+#include "publicprofiler.h"
+#include "heapprofiler.h"
+#include "recorder.h"
+#include "opcodestats.h"
+#include "overhead.h"
+#include "plugincpu.h"
+#include "scriptcore.h"
+#include "sourcecache.h"
+#include "coverage.h"
+#include "spikecapture.h"
+#include <algorithm>
+#include <filesystem>
 #include <string>
 #include <thread>
 #include <fmt/format.h>
@@ -8,11 +29,21 @@
 Extension g_zr;
 SMEXT_LINK(&g_zr);
 
+// The VM SourceMod loads: the JIT on 32-bit servers, and on 64-bit ones the
+// VM without a JIT, from bin/x64.
+#if defined(_WIN64) || defined(__x86_64__)
+static const char kVmModule[] = "sourcepawn.vm.";
+#define VM_MODULE_DIR "x64/"
+#else
+static const char kVmModule[] = "sourcepawn.jit.x86.";
+#define VM_MODULE_DIR ""
+#endif
+
 #ifndef _WIN32
 #define GetProcAddress dlsym
 // Linux doesn't have this function so this emulates its functionality
 void *GetModuleHandle(const char *name) {
-	std::string path = "cstrike/addons/sourcemod/bin/" + std::string(name);
+	std::string path = "cstrike/addons/sourcemod/bin/" VM_MODULE_DIR + std::string(name);
 #define HMODULE void *
 	void *handle;
 	if (name == nullptr) {
@@ -39,20 +70,102 @@ extern void(DebugHandler)(SourcePawn::IPluginContext *IPlugin,
 						  const SourcePawn::IErrorReport *IErrorReport);
 
 extern void debugThread();
+extern void EnablePatchableBreakSites();
+extern void DisablePatchableBreakSites();
+extern void SyncBreakSites();
+extern void SyncBreakpointVerification();
+extern void EnableDataWatchpoints();
+extern void SyncDataWatches();
+extern void EnableBackgroundCompilation();
+extern void EnableDebugBreakSwitching(SourcePawn::ISourcePawnEnvironment* env);
+extern void SyncDebugBreaks();
+extern void FlushErrorSummaries();
+extern void SetCoverage(bool on);
+extern void SyncNativeBreakpoints();
+extern void SyncPublicBreakpoints();
+extern void PublicEntryHandler(SourcePawn::IPluginFunction* fn, const cell_t* params,
+	unsigned int num_params);
+extern void NativeBreakHandler(SourcePawn::IPluginContext* ctx, const std::string& native,
+	cell_t cip, cell_t frm, const cell_t* params);
+extern void EnforceTickBudget();
+extern bool WaitForClient(float seconds);
+extern bool LoadBreakpointFile(const std::string& path);
+extern std::vector<std::string> OverheadTable(bool reset);
 bool Inited = false;
 
 extern DebugReport DebugListener;
+extern DebugPluginsListener DebugPlugins;
+#if SOURCEPAWN_API_VERSION >= 0x0210
+extern DebugBreakFilter DebugFilter;
+#endif
 
 uint16_t sm_debugger_port = 27015;
 float sm_debugger_delay = 0.f;
+uint16_t sm_debugger_metrics_port = 0;
+int sm_debugger_threads = 2;
+std::string sm_debugger_local_socket;
 int SM_Debugger_port()
 {
 	return sm_debugger_port;
 }
+int SM_Debugger_metrics_port()
+{
+	return sm_debugger_metrics_port;
+}
+int SM_Debugger_threads()
+{
+	return sm_debugger_threads;
+}
+const char* SM_Debugger_local_socket()
+{
+	return sm_debugger_local_socket.c_str();
+}
 float SM_Debugger_timeout()
 {
 	return sm_debugger_delay;
 }
+
+// Plugin memory usage between debug breaks, for plugins that rarely or
+// never reach one.
+static void SamplePlugins()
+{
+	static std::chrono::steady_clock::time_point next;
+	bool memory = DebugOverhead.tracksMemory();
+	bool cpu = DebugCpu.available();
+	if (!memory && !cpu)
+		return;
+	auto now = std::chrono::steady_clock::now();
+	if (now < next)
+		return;
+	next = now + OverheadCounters::kSampleInterval;
+	if (cpu)
+		DebugCpu.beginSample(now);
+	IPluginIterator *iter = plsys->GetPluginIterator();
+	for (; iter->MorePlugins(); iter->NextPlugin()) {
+		auto ctx = iter->GetPlugin()->GetBaseContext();
+		if (!ctx)
+			continue;
+		if (memory)
+			DebugOverhead.sampleMemory(ctx);
+		if (cpu)
+			DebugCpu.sample(ctx);
+	}
+	iter->Release();
+}
+
+static void OnGameFrame(bool simulating)
+{
+	DebugSpikes.endFrame();
+	SyncBreakSites();
+	SyncBreakpointVerification();
+	SyncDataWatches();
+	SyncDebugBreaks();
+	FlushErrorSummaries();
+	SyncNativeBreakpoints();
+	SyncPublicBreakpoints();
+	EnforceTickBudget();
+	SamplePlugins();
+}
 /*
 
 bool Extension::SDK_OnMetamodLoad(ISmmAPI* ismm, char* error, size_t maxlen, bool late) {
@@ -77,9 +190,33 @@ bool Extension::SDK_OnLoad(char *error, size_t maxlen, bool late) {
 	ISourcePawnFactory *factory = nullptr;
 	GetSourcePawnFactoryFn factoryFn = nullptr;
 	ISourcePawnEnvironment *current_env = nullptr;
-	std::string modulename = "sourcepawn.jit.x86.";
+	std::string modulename = kVmModule;
 	const char* debugPort = g_pSM->GetCoreConfigValue("DebuggerPort");
 	const char* debugDelay = g_pSM->GetCoreConfigValue("DebuggerWaitTime");
+	const char* debugPlugins = g_pSM->GetCoreConfigValue("DebuggerPlugins");
+	const char* traceBuffer = g_pSM->GetCoreConfigValue("DebuggerTraceBuffer");
+	const char* nativeProfiler = g_pSM->GetCoreConfigValue("DebuggerNativeProfiler");
+	const char* nativeBreakpoints = g_pSM->GetCoreConfigValue("DebuggerNativeBreakpoints");
+	const char* opcodePairs = g_pSM->GetCoreConfigValue("DebuggerOpcodePairs");
+	const char* backgroundCompile = g_pSM->GetCoreConfigValue("DebuggerBackgroundCompile");
+	const char* codeCache = g_pSM->GetCoreConfigValue("DebuggerCodeCache");
+	const char* codeRegion = g_pSM->GetCoreConfigValue("DebuggerCodeRegion");
+	const char* verifyThreads = g_pSM->GetCoreConfigValue("DebuggerVerifyThreads");
+	const char* tickBudget = g_pSM->GetCoreConfigValue("DebuggerTickBudget");
+	const char* metricsPort = g_pSM->GetCoreConfigValue("DebuggerMetricsPort");
+	const char* debugThreads = g_pSM->GetCoreConfigValue("DebuggerThreads");
+	const char* localSocket = g_pSM->GetCoreConfigValue("DebuggerLocalSocket");
+	const char* coreDir = g_pSM->GetCoreConfigValue("DebuggerCoreDir");
+	const char* traceFile = g_pSM->GetCoreConfigValue("DebuggerTraceFile");
+	const char* cpuAccounting = g_pSM->GetCoreConfigValue("DebuggerCpuAccounting");
+	const char* sourceRoot = g_pSM->GetCoreConfigValue("DebuggerSourceRoot");
+	const char* heapProfiler = g_pSM->GetCoreConfigValue("DebuggerHeapProfiler");
+	const char* methodBreaks = g_pSM->GetCoreConfigValue("DebuggerMethodBreaks");
+	const char* indexBudget = g_pSM->GetCoreConfigValue("DebuggerIndexBudget");
+	const char* spikeDir = g_pSM->GetCoreConfigValue("DebuggerSpikeDir");
+	const char* spikeThreshold = g_pSM->GetCoreConfigValue("DebuggerSpikeThreshold");
+	const char* spikeWindow = g_pSM->GetCoreConfigValue("DebuggerSpikeWindow");
+	const char* breakpointFile = g_pSM->GetCoreConfigValue("DebuggerBreakpointFile");
 	if(debugPort && debugPort[0])
 	{
 		try
@@ -107,7 +244,7 @@ bool Extension::SDK_OnLoad(char *error, size_t maxlen, bool late) {
 	{
 		try
 		{
-			sm_debugger_delay = std::stof(debugPort);
+			sm_debugger_delay = std::stof(debugDelay);
 		}
 		catch (std::invalid_argument& e) {
 			fmt::print("Can't convert DebuggerWaitTime from core.cfg. Invalid argument: [%s]\n", debugDelay);
@@ -124,6 +261,16 @@ bool Extension::SDK_OnLoad(char *error, size_t maxlen, bool late) {
 	{
 		fmt::print("[SM_DEBUGGER] DebuggerWaitTime is not exists in core.cfg. Setting default delay 0.\n");		
 	}
+	// Without it there is no HTTP listener.
+	if (metricsPort && metricsPort[0])
+		sm_debugger_metrics_port = uint16_t(strtoul(metricsPort, nullptr, 10));
+	// Network threads serving the connections.
+	if (debugThreads && debugThreads[0])
+		sm_debugger_threads = std::clamp(atoi(debugThreads), 1, 16);
+	// A socket file for adapters on this machine, besides or instead of
+	// DebuggerPort.
+	if (localSocket && localSocket[0])
+		sm_debugger_local_socket = localSocket;
 	modulename += PLATFORM_LIB_EXT;
 	auto module = GetModuleHandle(modulename.c_str());
 	if (module) {
@@ -137,14 +284,199 @@ bool Extension::SDK_OnLoad(char *error, size_t maxlen, bool late) {
 		current_env = factory->CurrentEnvironment();
 	}
 	if (current_env) {
-		if (!Inited) {
+		// DebuggerPort 0 with nothing else to listen on leaves the network
+		// alone.
+		if (!Inited && (sm_debugger_port || sm_debugger_metrics_port || !sm_debugger_local_socket.empty())) {
 			std::thread(debugThread).detach();
 			Inited = true;
 		}
-		current_env->EnableDebugBreak();
+		bool patchable = false;
+#if SOURCEPAWN_API_VERSION >= 0x020F
+		// Only the BREAK sites with breakpoints call into the debugger.
+		patchable = current_env->ApiVersion() >= 0x020F &&
+			current_env->EnablePatchableDebugBreak();
+#endif
+		if (patchable) {
+			EnablePatchableBreakSites();
+#if SOURCEPAWN_API_VERSION >= 0x0224
+			// Methods without breakpoints or step traps are compiled as if
+			// debug breaks were off, and again once one lands in them. A
+			// frame already running such code doesn't stop until the method
+			// is entered again, so this is opt-in.
+			if (methodBreaks && atoi(methodBreaks) && current_env->ApiVersion() >= 0x0224)
+				current_env->EnableMethodDebugBreaks();
+#endif
+#if SOURCEPAWN_API_VERSION >= 0x0212
+			// Stores into watched globals call into the debugger too.
+			if (current_env->ApiVersion() >= 0x0212 &&
+				current_env->EnableDataWatchpoints())
+				EnableDataWatchpoints();
+#endif
+		}
+		else {
+			current_env->EnableDebugBreak();
+		}
+		// Error summaries and native wrapping run between frames as well.
+		smutils->AddGameFrameHook(OnGameFrame);
+		DebugImages.setRuntimeImages(current_env->ApiVersion() >= 0x0211);
+		DebugImages.setEnvironment(current_env);
+		// Megabytes of symbol and line indices kept for plugins nobody is
+		// debugging; without it every loaded plugin keeps its own.
+		if (indexBudget && indexBudget[0])
+			DebugImages.setIndexBudget(size_t(strtoull(indexBudget, nullptr, 10)) << 20);
+#if SOURCEPAWN_API_VERSION >= 0x0213
+		// Function entry and exit hooks, recorded into a ring of this many
+		// calls once a client turns tracing on.
+		uint32_t trace_records = traceBuffer ? strtoul(traceBuffer, nullptr, 10) : 0;
+#if SOURCEPAWN_API_VERSION >= 0x021F
+		// With a trace file the ring lives in it and always records, so a
+		// crash leaves the last calls on disk.
+		if (trace_records && traceFile && traceFile[0] &&
+			DebugTraceFile.open(current_env, traceFile, trace_records)) {
+			DebugTrace.setEnvironment(current_env);
+			DebugTrace.keepRecording();
+		}
+		else
+#endif
+		if (trace_records && current_env->ApiVersion() >= 0x0213 &&
+			current_env->EnableFunctionTracing(trace_records))
+			DebugTrace.setEnvironment(current_env);
+		// Frames and public calls over DebuggerSpikeThreshold, "frame
+		// ms[,public ms]" with 50 ms frames by default, leave the ring's
+		// last DebuggerSpikeWindow ms as a trace file.
+		if (spikeDir && spikeDir[0] && DebugTrace.available()) {
+			unsigned frame_ms = 50, public_ms = 0;
+			if (spikeThreshold)
+				sscanf(spikeThreshold, "%u,%u", &frame_ms, &public_ms);
+			DebugSpikes.enable(spikeDir, frame_ms, public_ms,
+				spikeWindow ? strtoul(spikeWindow, nullptr, 10) : 0);
+		}
+#endif
+#if SOURCEPAWN_API_VERSION >= 0x0214
+		// Native calls are compiled as indirect calls so the natives can be
+		// wrapped with timing or breakpoint stubs once a client asks for them.
+		bool profileNatives = nativeProfiler && atoi(nativeProfiler);
+		bool breakNatives = nativeBreakpoints && atoi(nativeBreakpoints);
+		if ((profileNatives || breakNatives) && current_env->ApiVersion() >= 0x0214 &&
+			current_env->EnableNativeRebinding()) {
+			if (profileNatives)
+				DebugNatives.setEngine(current_env->APIv2());
+#if SOURCEPAWN_API_VERSION >= 0x021E
+			// Breakpoints need the caller's frame, from GetScriptFrames.
+			if (breakNatives && current_env->ApiVersion() >= 0x021E)
+				DebugNativeBreaks.setEnvironment(current_env, NativeBreakHandler);
+#endif
+		}
+#endif
+#if SOURCEPAWN_API_VERSION >= 0x0215
+		// Costs a load per public call until a client starts timing.
+		if (current_env->ApiVersion() >= 0x0215)
+			DebugPublics.setEnvironment(current_env);
+#endif
+#if SOURCEPAWN_API_VERSION >= 0x0225
+		// A flag test per public call until a client arms one.
+		if (current_env->ApiVersion() >= 0x0225)
+			DebugPublicBreaks.setEnvironment(current_env, PublicEntryHandler);
+#endif
+#if SOURCEPAWN_API_VERSION >= 0x0216
+		// Pair counts take OPCODES_TOTAL^2 counters per plugin, so they are
+		// opt-in even in VMs built to count opcodes.
+		if (opcodePairs && atoi(opcodePairs) && current_env->ApiVersion() >= 0x0216)
+			current_env->EnableOpcodePairStats();
+#endif
+#if SOURCEPAWN_API_VERSION >= 0x0217
+		// Plugins are compiled on a thread of their own as they load, so
+		// their first calls don't stall a frame.
+		if (backgroundCompile && atoi(backgroundCompile) && current_env->ApiVersion() >= 0x0217 &&
+			current_env->EnableBackgroundCompilation())
+			EnableBackgroundCompilation();
+#endif
+#if SOURCEPAWN_API_VERSION >= 0x0218
+		// Reuses compiled methods of unchanged plugins across restarts.
+		if (codeCache && codeCache[0] && current_env->ApiVersion() >= 0x0218) {
+			std::error_code ec;
+			std::filesystem::create_directories(codeCache, ec);
+			current_env->EnableCodeCache(codeCache);
+		}
+#endif
+#if SOURCEPAWN_API_VERSION >= 0x0219
+		// Size in MB of one huge-page-backed region for compiled code.
+		if (codeRegion && atoi(codeRegion) > 0 && current_env->ApiVersion() >= 0x0219)
+			current_env->ReserveCodeRegion(size_t(atoi(codeRegion)) << 20);
+#endif
+#if SOURCEPAWN_API_VERSION >= 0x021C
+		// Large plugins are verified up front on this many extra threads.
+		if (verifyThreads && atoi(verifyThreads) > 0 && current_env->ApiVersion() >= 0x021C)
+			current_env->EnableParallelVerification(size_t(atoi(verifyThreads)));
+#endif
+#if SOURCEPAWN_API_VERSION >= 0x0210
+		// Without a list every plugin gets debug breaks, as before.
+		if (debugPlugins && debugPlugins[0] && current_env->ApiVersion() >= 0x0210) {
+			DebugFilter.SetPlugins(debugPlugins);
+			current_env->SetDebugBreakFilter(&DebugFilter);
+		}
+#endif
+		// Runtime errors no client stops on leave a script core here.
+		if (coreDir && coreDir[0]) {
+			DebugCores.enable(coreDir);
+			DebugCores.setEnvironment(current_env);
+		}
+		// Clients whose sources don't match the running build fetch them
+		// from here.
+		if (sourceRoot && sourceRoot[0])
+			DebugSources.setRoot(sourceRoot);
+		// Microseconds of game-thread time per tick the debugger may take
+		// before it turns instrumentation down.
+		if (tickBudget && tickBudget[0])
+			DebugBudget.setBudget(strtoul(tickBudget, nullptr, 10));
+#if SOURCEPAWN_API_VERSION >= 0x021D
+		// Scrapes get plugin heap and stack usage, sampled at debug breaks
+		// and once a second.
+		if (sm_debugger_metrics_port && current_env->ApiVersion() >= 0x021D)
+			DebugOverhead.trackMemory(current_env);
+#endif
+#if SOURCEPAWN_API_VERSION >= 0x021D
+		// Recording costs nothing until a client starts it.
+		if (current_env->ApiVersion() >= 0x021D)
+			DebugRecorder.setEnvironment(current_env);
+#endif
+#if SOURCEPAWN_API_VERSION >= 0x0221
+		// Profiler samples leave names for later.
+		if (current_env->ApiVersion() >= 0x0221)
+			DebugProfiler.setEnvironment(current_env);
+#endif
+#if SOURCEPAWN_API_VERSION >= 0x0220
+		// Two clock reads per call into a plugin buy the busiest plugins
+		// of the last few minutes on the console, to clients and in scrapes.
+		if (cpuAccounting && atoi(cpuAccounting))
+			DebugCpu.setEnvironment(current_env);
+#endif
+#if SOURCEPAWN_API_VERSION >= 0x0223
+		// A compare per heap allocation until a client starts sampling.
+		if (heapProfiler && atoi(heapProfiler) && current_env->ApiVersion() >= 0x0223)
+			DebugHeap.setEnvironment(current_env);
+#endif
+		plsys->AddPluginsListener(&DebugPlugins);
+		rootconsole->AddRootConsoleCommand3("debugger", "SourcePawn debugger", this);
 		DebugListener.original = current_env->APIv1()->SetDebugListener(&DebugListener);
 		current_env->APIv1()->SetDebugBreakHandler(DebugHandler);
-		std::this_thread::sleep_for(std::chrono::duration<float>(SM_Debugger_timeout()));
+		// SetBreakpoints messages to have set before any plugin loads, so
+		// nothing waits on a client to upload them.
+		bool preloaded = breakpointFile && breakpointFile[0] &&
+			LoadBreakpointFile(breakpointFile);
+		// Up to DebuggerWaitTime for a client to set its breakpoints, and no
+		// wait at all without a listener or with the breakpoint file.
+		if (Inited && !preloaded && (sm_debugger_port || !sm_debugger_local_socket.empty()) &&
+			WaitForClient(SM_Debugger_timeout()))
+			fmt::print("[SM_DEBUGGER] Client ready, loading plugins.\n");
+#if SOURCEPAWN_API_VERSION >= 0x021B
+		// Without a client by now, plugins load without debug breaks until
+		// one connects.
+		if (current_env->ApiVersion() >= 0x021B) {
+			EnableDebugBreakSwitching(current_env);
+			SyncDebugBreaks();
+		}
+#endif
 	}
 	return true;
 }
@@ -154,7 +486,7 @@ void Extension::SDK_OnUnload()
 	ISourcePawnFactory *factory = nullptr;
 	GetSourcePawnFactoryFn factoryFn = nullptr;
 	ISourcePawnEnvironment *current_env = nullptr;
-	std::string modulename = "sourcepawn.jit.x86.";
+	std::string modulename = kVmModule;
 	modulename += PLATFORM_LIB_EXT;
 	auto module = GetModuleHandle(modulename.c_str());
 	if (module) {
@@ -167,9 +499,31 @@ void Extension::SDK_OnUnload()
 	if (factory) {
 		current_env = factory->CurrentEnvironment();
 	}
+	// The VM keeps calling into whatever it was handed; none of it may
+	// point into the extension once it is gone.
+	DebugHeap.shutdown();
 	if (current_env) {
 		current_env->APIv1()->SetDebugListener(DebugListener.original);
 	}
+	smutils->RemoveGameFrameHook(OnGameFrame);
+	DebugNativeBreaks.shutdown();
+	DebugNatives.shutdown();
+	DisablePatchableBreakSites();
+	DebugProfiler.stop();
+#if SOURCEPAWN_API_VERSION >= 0x0215
+	if (current_env && current_env->ApiVersion() >= 0x0215)
+		current_env->SetInvokeListener(nullptr);
+#endif
+#if SOURCEPAWN_API_VERSION >= 0x0225
+	if (current_env && current_env->ApiVersion() >= 0x0225)
+		current_env->SetPublicEntryListener(nullptr);
+#endif
+	plsys->RemovePluginsListener(&DebugPlugins);
+	rootconsole->RemoveRootConsoleCommand("debugger", this);
+	DebugImages.shutdown();
+	DebugWorkers.shutdown();
+	DebugRequests.shutdown();
+	DebugSpikes.shutdown();
 }
 
 void Extension::SDK_OnAllLoaded() {
@@ -180,6 +534,141 @@ void Extension::SDK_OnPauseChange(bool paused) {
 
 void Extension::SDK_OnDependenciesDropped() {
 }
+
+void Extension::OnRootConsoleCommand(const char *cmdname, const ICommandArgs *args) {
+	const char *command = args->ArgC() >= 3 ? args->Arg(2) : "";
+	if (strcmp(command, "natives") == 0) {
+		if (!DebugNatives.available()) {
+			rootconsole->ConsolePrint("[SM_DEBUGGER] Native profiling needs DebuggerNativeProfiler in core.cfg.");
+			return;
+		}
+		const char *action = args->ArgC() >= 4 ? args->Arg(3) : "";
+		bool start = strcmp(action, "start") == 0;
+		if (start || strcmp(action, "stop") == 0) {
+			DebugNatives.setActive(start);
+			return;
+		}
+		for (const auto &line : DebugNatives.table(strcmp(action, "reset") == 0))
+			rootconsole->ConsolePrint("%s", line.c_str());
+		return;
+	}
+	if (strcmp(command, "publics") == 0) {
+		if (!DebugPublics.available()) {
+			rootconsole->ConsolePrint("[SM_DEBUGGER] Public function timing needs a newer SourcePawn VM.");
+			return;
+		}
+		const char *action = args->ArgC() >= 4 ? args->Arg(3) : "";
+		bool start = strcmp(action, "start") == 0;
+		if (start || strcmp(action, "stop") == 0) {
+			DebugPublics.setActive(start);
+			return;
+		}
+		for (const auto &line : DebugPublics.table(strcmp(action, "reset") == 0))
+			rootconsole->ConsolePrint("%s", line.c_str());
+		return;
+	}
+	if (strcmp(command, "heap") == 0) {
+		if (!DebugHeap.available()) {
+			rootconsole->ConsolePrint("[SM_DEBUGGER] Heap profiling needs DebuggerHeapProfiler in core.cfg.");
+			return;
+		}
+		const char *action = args->ArgC() >= 4 ? args->Arg(3) : "";
+		if (strcmp(action, "start") == 0) {
+			int bytes = args->ArgC() >= 5 ? atoi(args->Arg(4)) : 0;
+			DebugHeap.setInterval(bytes > 0 ? uint32_t(bytes) : HeapProfiler::kDefaultInterval);
+			return;
+		}
+		if (strcmp(action, "stop") == 0) {
+			DebugHeap.setInterval(0);
+			return;
+		}
+		for (const auto &line : DebugHeap.table(strcmp(action, "reset") == 0))
+			rootconsole->ConsolePrint("%s", line.c_str());
+		return;
+	}
+	if (strcmp(command, "opcodes") == 0) {
+		bool reset = args->ArgC() >= 4 && strcmp(args->Arg(3), "reset") == 0;
+		bool counted = false;
+		IPluginIterator *iter = plsys->GetPluginIterator();
+		for (; iter->MorePlugins(); iter->NextPlugin()) {
+			IPluginRuntime *runtime = iter->GetPlugin()->GetRuntime();
+			if (!runtime)
+				continue;
+			for (const auto &line : DebugOpcodes.table(runtime, reset)) {
+				rootconsole->ConsolePrint("%s", line.c_str());
+				counted = true;
+			}
+		}
+		iter->Release();
+		if (!counted)
+			rootconsole->ConsolePrint("[SM_DEBUGGER] No interpreted opcodes counted. The VM has to be built with SP_OPCODE_STATS.");
+		return;
+	}
+	if (strcmp(command, "compact") == 0) {
+		if (!DebugPublics.canRelocate()) {
+			rootconsole->ConsolePrint("[SM_DEBUGGER] Hot code layout needs a newer SourcePawn VM.");
+			return;
+		}
+		int count = args->ArgC() >= 4 ? atoi(args->Arg(3)) : 32;
+		auto hot = DebugPublics.hottest(count > 0 ? size_t(count) : 0);
+		if (hot.empty()) {
+			rootconsole->ConsolePrint("[SM_DEBUGGER] No public calls timed yet. Run \"publics start\" first.");
+			return;
+		}
+		size_t relocated = DebugPublics.relocate(hot);
+		rootconsole->ConsolePrint("[SM_DEBUGGER] Moved %zu of the %zu busiest functions together.", relocated, hot.size());
+		return;
+	}
+	if (strcmp(command, "coverage") == 0) {
+		const char *action = args->ArgC() >= 4 ? args->Arg(3) : "";
+		bool start = strcmp(action, "start") == 0;
+		if (start || strcmp(action, "stop") == 0) {
+			SetCoverage(start);
+			return;
+		}
+		if (strcmp(action, "export") != 0 || args->ArgC() < 5) {
+			rootconsole->ConsolePrint("[SM_DEBUGGER] usage: sm debugger coverage start|stop|export <file> [reset]");
+			return;
+		}
+		if (!DebugCoverage.active()) {
+			rootconsole->ConsolePrint("[SM_DEBUGGER] Coverage is off. Run \"coverage start\" first.");
+			return;
+		}
+		CoverageSet set;
+		set.addSource();
+		DebugCoverage.collect(&set, args->ArgC() >= 6 && strcmp(args->Arg(5), "reset") == 0);
+		if (!set.write(args->Arg(4)))
+			rootconsole->ConsolePrint("[SM_DEBUGGER] Couldn't write %s.", args->Arg(4));
+		return;
+	}
+	if (strcmp(command, "overhead") == 0) {
+		bool reset = args->ArgC() >= 4 && strcmp(args->Arg(3), "reset") == 0;
+		for (const auto &line : OverheadTable(reset))
+			rootconsole->ConsolePrint("%s", line.c_str());
+		return;
+	}
+	if (strcmp(command, "cpu") == 0) {
+		if (!DebugCpu.available()) {
+			rootconsole->ConsolePrint("[SM_DEBUGGER] CPU accounting is off; set DebuggerCpuAccounting in core.cfg.");
+			return;
+		}
+		uint32_t seconds = 60;
+		if (args->ArgC() >= 4 && atoi(args->Arg(3)) > 0)
+			seconds = uint32_t(atoi(args->Arg(3)));
+		for (const auto &line : DebugCpu.table(seconds))
+			rootconsole->ConsolePrint("%s", line.c_str());
+		return;
+	}
+	rootconsole->ConsolePrint("SourcePawn debugger commands:");
+	rootconsole->DrawGenericOption("natives", "Native call counts and cycles [start|stop|reset]");
+	rootconsole->DrawGenericOption("publics", "Public function latency percentiles [start|stop|reset]");
+	rootconsole->DrawGenericOption("heap", "Plugin heap allocations by function [start [bytes]|stop|reset]");
+	rootconsole->DrawGenericOption("opcodes", "Interpreted opcode and pair counts per plugin [reset]");
+	rootconsole->DrawGenericOption("compact", "Move the most called public functions' code together [count]");
+	rootconsole->DrawGenericOption("coverage", "Line hit counts, mergeable across servers [start|stop|export <file> [reset]]");
+	rootconsole->DrawGenericOption("overhead", "Debugger cost: breaks, handler and stop time, traffic [reset]");
+	rootconsole->DrawGenericOption("cpu", "Busiest plugins by time in their code [seconds, default 60]");
+}
 /*
 bool Extension::RegisterConCommandBase(ConCommandBase* pVar) {
 	return META_REGCVAR(pVar);
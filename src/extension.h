@@ -5,13 +5,15 @@
 #include "smsdk_ext.h"
 //#include <convar.h>
 
-class Extension : public SDKExtension {
+class Extension : public SDKExtension, public IRootConsoleCommand {
 public:
 	virtual bool SDK_OnLoad(char *error, size_t maxlen, bool late);
 	virtual void SDK_OnUnload();
 	virtual void SDK_OnAllLoaded();
 	virtual void SDK_OnPauseChange(bool paused);
 	virtual void SDK_OnDependenciesDropped();
+public: // IRootConsoleCommand
+	void OnRootConsoleCommand(const char *cmdname, const ICommandArgs *args) override;
 	/*
 	virtual bool SDK_OnMetamodLoad(ISmmAPI* ismm, char* error, size_t maxlen, bool late);
 public: // IConCommandBaseAccessor
@@ -19,6 +21,9 @@ public: // IConCommandBaseAccessor
 	*/
 };
 extern int SM_Debugger_port();
+extern int SM_Debugger_metrics_port();
+extern int SM_Debugger_threads();
+extern const char* SM_Debugger_local_socket();
 extern float SM_Debugger_timeout();
 
 #endif
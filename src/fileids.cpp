@@ -0,0 +1,56 @@
+#include "fileids.h"
+#include <algorithm>
+#include <ctype.h>
+
+FileIdTable DebugFiles;
+
+uint32_t FileIdTable::intern(std::string_view path) {
+	// The base name, split the way std::filesystem::path would, and only it
+	// copied.
+#ifdef _WIN32
+	auto slash = path.find_last_of("/\\");
+#else
+	auto slash = path.find_last_of('/');
+#endif
+	if (slash != std::string_view::npos)
+		path.remove_prefix(slash + 1);
+	std::string name(path);
+	std::transform(name.begin(), name.end(), name.begin(), tolower);
+
+	std::lock_guard<std::mutex> lock(mtx);
+	auto found = ids.find(name);
+	if (found != ids.end())
+		return found->second;
+
+	uint32_t id = static_cast<uint32_t>(names.size());
+	names.push_back(name);
+	ids.emplace(std::move(name), id);
+	return id;
+}
+
+std::string FileIdTable::name(uint32_t id) {
+	std::lock_guard<std::mutex> lock(mtx);
+	if (id >= names.size())
+		return std::string();
+	return names[id];
+}
+
+const std::vector<uint32_t>& FileIdTable::ofPlugin(SourcePawn::IPluginRuntime* runtime) {
+	auto found = plugins.find(runtime);
+	if (found != plugins.end())
+		return found->second;
+
+	std::vector<uint32_t> files;
+	auto debug_info = runtime->GetDebugInfo();
+	if (debug_info) {
+		for (size_t i = 0; i < debug_info->NumFiles(); i++) {
+			const char* name = debug_info->GetFileName(i);
+			files.push_back(name ? intern(name) : kNoFile);
+		}
+	}
+	return plugins.emplace(runtime, std::move(files)).first->second;
+}
+
+void FileIdTable::forget(SourcePawn::IPluginRuntime* runtime) {
+	plugins.erase(runtime);
+}
@@ -0,0 +1,45 @@
+#ifndef _INCLUDE_FILEIDS_H_
+#define _INCLUDE_FILEIDS_H_
+
+#include <sp_vm_api.h>
+#include <stdint.h>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+//
+//  Source files are matched by base name, ignoring case. Every distinct name
+//  is interned once and gets a stable id, so clients and plugins compare
+//  files with an integer compare.
+//
+class FileIdTable {
+public:
+	static constexpr uint32_t kNoFile = UINT32_MAX;
+
+	// Returns the id of a path's lowercased base name. Safe to call from any
+	// thread.
+	uint32_t intern(std::string_view path);
+
+	// The lowercased base name an id was interned from.
+	std::string name(uint32_t id);
+
+	// Ids of a plugin's debug file entries, in entry order. Entries without
+	// a name are kNoFile. Computed once per plugin; main thread only.
+	const std::vector<uint32_t>& ofPlugin(SourcePawn::IPluginRuntime* runtime);
+
+	// Forgets an unloading plugin's entries.
+	void forget(SourcePawn::IPluginRuntime* runtime);
+
+private:
+	std::mutex mtx;
+	std::unordered_map<std::string, uint32_t> ids;
+	std::deque<std::string> names;
+	std::unordered_map<SourcePawn::IPluginRuntime*, std::vector<uint32_t>> plugins;
+};
+
+extern FileIdTable DebugFiles;
+
+#endif //_INCLUDE_FILEIDS_H_
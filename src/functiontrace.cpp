@@ -0,0 +1,134 @@
+#include "functiontrace.h"
+#include "imagecache.h"
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fmt/format.h>
+
+FunctionTrace DebugTrace;
+
+void FunctionTrace::setEnvironment(SourcePawn::ISourcePawnEnvironment* environment) {
+	env = environment;
+#if SOURCEPAWN_API_VERSION >= 0x0213
+	ring = env->GetTraceRing();
+#endif
+}
+
+void FunctionTrace::setActive(bool active) {
+#if SOURCEPAWN_API_VERSION >= 0x0213
+	if (!ring)
+		return;
+	std::lock_guard<std::mutex> lock(mtx);
+	// Only what is recorded from now on is read.
+	if (active)
+		position = ring->head;
+	env->SetFunctionTracing(active || always);
+	recording = active;
+#endif
+}
+
+void FunctionTrace::keepRecording() {
+#if SOURCEPAWN_API_VERSION >= 0x0213
+	if (!ring)
+		return;
+	std::lock_guard<std::mutex> lock(mtx);
+	always = true;
+	env->SetFunctionTracing(true);
+#endif
+}
+
+void FunctionTrace::addPlugin(SourcePawn::IPluginContext* ctx) {
+	if (!ring)
+		return;
+	auto runtime = ctx->GetRuntime();
+	plugin_s plugin{ std::filesystem::path(runtime->GetFilename()).filename().string(),
+		DebugImages.get(runtime) };
+	std::lock_guard<std::mutex> lock(mtx);
+	plugins[ctx] = std::move(plugin);
+}
+
+void FunctionTrace::removePlugin(SourcePawn::IPluginContext* ctx) {
+	std::lock_guard<std::mutex> lock(mtx);
+	plugins.erase(ctx);
+}
+
+std::vector<FunctionTrace::event_s> FunctionTrace::read(uint32_t* dropped) {
+	std::vector<event_s> events;
+	*dropped = 0;
+#if SOURCEPAWN_API_VERSION >= 0x0213
+	if (!ring)
+		return events;
+
+	std::lock_guard<std::mutex> lock(mtx);
+	uint32_t size = ring->mask + 1;
+	uint32_t head = ring->head;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (head - position > size) {
+		*dropped = head - position - size;
+		position = head - size;
+	}
+	std::vector<SourcePawn::sp_trace_record_t> records;
+	records.reserve(head - position);
+	for (uint32_t i = position; i != head; i++)
+		records.push_back(ring->records[i & ring->mask]);
+
+	// Records the VM lapped while they were copied may be torn.
+	std::atomic_thread_fence(std::memory_order_acquire);
+	uint32_t lapped = ring->head - size;
+	uint32_t first = position;
+	if (int32_t(lapped - first) > 0) {
+		*dropped += lapped - first;
+		first = int32_t(lapped - head) > 0 ? head : lapped;
+	}
+
+	for (uint32_t i = first; i != head; i++) {
+		const SourcePawn::sp_trace_record_t& record = records[i - position];
+#ifdef SP_TRACE_BREAK
+		if (record.event == SP_TRACE_BREAK)
+			continue;
+#endif
+		std::string name = "?";
+		auto found = plugins.find(record.context);
+		if (found != plugins.end()) {
+			const char* function = found->second.image
+				? found->second.image->LookupFunction(record.function) : nullptr;
+			name = function ? fmt::format("{}::{}", found->second.name, function)
+				: fmt::format("{}::{:#x}", found->second.name, record.function);
+		}
+		events.push_back({ record.timestamp, std::move(name), record.event == SP_TRACE_ENTER });
+	}
+	position = head;
+#endif
+	return events;
+}
+
+std::vector<SourcePawn::sp_trace_record_t> FunctionTrace::recent(uint64_t since) {
+	std::vector<SourcePawn::sp_trace_record_t> records;
+#if SOURCEPAWN_API_VERSION >= 0x0213
+	if (!ring)
+		return records;
+
+	// Walks back from the head while records are new enough; the ring is
+	// in timestamp order.
+	uint32_t size = ring->mask + 1;
+	uint32_t head = ring->head;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	uint32_t first = head;
+	while (head - first < size) {
+		const auto& record = ring->records[(first - 1) & ring->mask];
+		if (!record.timestamp || record.timestamp < since)
+			break;
+		first--;
+	}
+	records.reserve(head - first);
+	for (uint32_t i = first; i != head; i++)
+		records.push_back(ring->records[i & ring->mask]);
+
+	// Drop what the VM lapped while it was copied.
+	std::atomic_thread_fence(std::memory_order_acquire);
+	uint32_t lapped = ring->head - size;
+	if (int32_t(lapped - first) > 0)
+		records.erase(records.begin(), records.begin() + std::min<uint32_t>(lapped - first, head - first));
+#endif
+	return records;
+}
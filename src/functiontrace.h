@@ -0,0 +1,76 @@
+#ifndef _INCLUDE_FUNCTIONTRACE_H_
+#define _INCLUDE_FUNCTIONTRACE_H_
+
+#include <sp_vm_api.h>
+#include "smx-v1-image.h"
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//
+//  Reader of the VM's function trace ring. The JIT records every function
+//  entry and exit while tracing is on; this copies out what was written
+//  since the last read and names the functions through the plugin images.
+//
+class FunctionTrace {
+public:
+	struct event_s {
+		uint64_t timestamp;	// nanoseconds
+		std::string name;	// "plugin.smx::Function"
+		bool enter;
+	};
+
+	// Only VMs with API version 0x0213 or later record traces. Called before
+	// any plugins are loaded.
+	void setEnvironment(SourcePawn::ISourcePawnEnvironment* env);
+
+	bool available() const {
+		return ring != nullptr;
+	}
+
+	// Starts or stops recording. Safe to call from any thread.
+	void setActive(bool active);
+	// Keeps the VM recording whether or not a client reads, for a trace
+	// file. Before any plugins are loaded.
+	void keepRecording();
+	bool active() const {
+		return recording.load(std::memory_order_relaxed);
+	}
+
+	// Names a plugin's functions from now on. Main thread only.
+	void addPlugin(SourcePawn::IPluginContext* ctx);
+
+	// Forgets an unloading plugin. Main thread only.
+	void removePlugin(SourcePawn::IPluginContext* ctx);
+
+	// The events recorded since the last read, oldest first. |dropped| is
+	// set to the records the VM overwrote before they were read.
+	std::vector<event_s> read(uint32_t* dropped);
+
+	// Copies the raw records the ring still holds from |since| on, in
+	// steady clock nanoseconds, oldest first. Leaves read()'s position
+	// alone. Safe to call from any thread.
+	std::vector<SourcePawn::sp_trace_record_t> recent(uint64_t since);
+
+private:
+	struct plugin_s {
+		std::string name;
+		std::shared_ptr<sp::SmxV1Image> image;
+	};
+
+	SourcePawn::ISourcePawnEnvironment* env = nullptr;
+	const SourcePawn::sp_trace_ring_t* ring = nullptr;
+	std::mutex mtx;
+	std::unordered_map<SourcePawn::IPluginContext*, plugin_s> plugins;
+	uint32_t position = 0;
+	std::atomic<bool> recording{ false };
+	bool always = false;
+};
+
+extern FunctionTrace DebugTrace;
+
+#endif //_INCLUDE_FUNCTIONTRACE_H_
@@ -0,0 +1,188 @@
+#include "heapprofiler.h"
+#include "pprof.h"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <fmt/format.h>
+
+HeapProfiler DebugHeap;
+
+void HeapProfiler::setEnvironment(SourcePawn::ISourcePawnEnvironment* env) {
+#if SOURCEPAWN_API_VERSION >= 0x0223
+	if (env->ApiVersion() >= 0x0223 && env->EnableHeapProfiling(this))
+		this->env = env;
+#endif
+}
+
+void HeapProfiler::setInterval(uint32_t bytes) {
+	if (!env)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if (bytes && !sampling)
+			sites.clear();
+		sampling = bytes;
+	}
+#if SOURCEPAWN_API_VERSION >= 0x0223
+	env->SetHeapSampling(bytes);
+#endif
+}
+
+void HeapProfiler::shutdown() {
+	if (!env)
+		return;
+	setInterval(0);
+#if SOURCEPAWN_API_VERSION >= 0x0223
+	env->EnableHeapProfiling(nullptr);
+#endif
+	env = nullptr;
+}
+
+void HeapProfiler::OnHeapAlloc(SourcePawn::IPluginContext* ctx, cell_t cip, uint32_t size, uint64_t weight) {
+	if (!sampling.load(std::memory_order_relaxed))
+		return;
+
+	std::lock_guard<std::mutex> lock(mtx);
+	auto found = sites.emplace(key_s{ ctx, cip }, entry_s());
+	entry_s& entry = found.first->second;
+	if (found.second) {
+		// Named while the plugin is sure to be loaded.
+		auto runtime = ctx->GetRuntime();
+		auto info = runtime->GetDebugInfo();
+		const char* function = nullptr;
+		const char* file = nullptr;
+		uint32_t line = 0;
+		if (!info || info->LookupFunction(cip, &function) != SP_ERROR_NONE)
+			function = "?";
+		if (!info || info->LookupFile(cip, &file) != SP_ERROR_NONE)
+			file = "";
+		if (info && info->LookupLine(cip, &line) != SP_ERROR_NONE)
+			line = 0;
+		entry.site = site_s{ std::filesystem::path(runtime->GetFilename()).filename().string(),
+			function, file, line, cip, 0, 0, 0 };
+	}
+	entry.site.samples++;
+	entry.site.bytes += weight;
+	entry.allocations += size ? double(weight) / size : 0;
+}
+
+void HeapProfiler::removePlugin(SourcePawn::IPluginContext* ctx) {
+	std::lock_guard<std::mutex> lock(mtx);
+	for (auto it = sites.begin(); it != sites.end();) {
+		if (it->first.context == ctx)
+			it = sites.erase(it);
+		else
+			++it;
+	}
+}
+
+HeapProfiler::profile_s HeapProfiler::snapshot(bool reset) {
+	profile_s profile;
+	profile.interval = sampling;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		profile.sites.reserve(sites.size());
+		for (auto& it : sites) {
+			site_s site = it.second.site;
+			site.allocations = uint64_t(std::llround(it.second.allocations));
+			profile.sites.push_back(std::move(site));
+		}
+		if (reset)
+			sites.clear();
+	}
+	std::sort(profile.sites.begin(), profile.sites.end(), [](const site_s& a, const site_s& b) {
+		return a.bytes > b.bytes;
+	});
+	return profile;
+}
+
+static std::vector<std::string> formatTable(const HeapProfiler::profile_s& profile) {
+	std::vector<std::string> lines;
+	lines.push_back(fmt::format("Sampling one allocation per {} bytes; counts are estimates.",
+		profile.interval));
+	lines.push_back(fmt::format("{:>12} {:>10} {:>8}  {}", "bytes", "allocs", "samples", "site"));
+	for (const auto& site : profile.sites) {
+		lines.push_back(fmt::format("{:>12} {:>10} {:>8}  {}::{} ({}:{})", site.bytes, site.allocations,
+			site.samples, site.plugin, site.function, site.file, site.line));
+	}
+	return lines;
+}
+
+std::vector<std::string> HeapProfiler::table(bool reset) {
+	return formatTable(snapshot(reset));
+}
+
+bool HeapProfiler::dump(const std::string& path) {
+	auto profile = snapshot(false);
+	if (isPprofPath(path))
+		return writeGzipped(path, pprof(profile));
+
+	std::ofstream out(path, std::ios::trunc);
+	if (!out)
+		return false;
+	for (const auto& line : formatTable(profile))
+		out << line << '\n';
+	return bool(out);
+}
+
+std::string HeapProfiler::pprof(const profile_s& profile) {
+	// Field numbers from profile.proto.
+	enum {
+		ProfileSampleType = 1, ProfileSample = 2, ProfileLocation = 4, ProfileFunction = 5,
+		ProfileStringTable = 6, ProfilePeriodType = 11, ProfilePeriod = 12,
+		ValueTypeType = 1, ValueTypeUnit = 2,
+		SampleLocationId = 1, SampleValue = 2,
+		LocationId = 1, LocationAddress = 3, LocationLine = 4,
+		LineFunctionId = 1, LineLine = 2,
+		FunctionId = 1, FunctionName = 2, FunctionSystemName = 3, FunctionFilename = 4,
+	};
+	strings_s strings;
+	proto_s out;
+
+	auto valueType = [&](uint32_t field, const char* type, const char* unit) {
+		proto_s value;
+		value.uint(ValueTypeType, strings(type));
+		value.uint(ValueTypeUnit, strings(unit));
+		out.bytes(field, value.out);
+	};
+	valueType(ProfileSampleType, "alloc_objects", "count");
+	valueType(ProfileSampleType, "alloc_space", "bytes");
+
+	// One location per site and one function per "plugin::function", so
+	// pprof can show either.
+	std::unordered_map<std::string, uint64_t> functions;
+	for (size_t i = 0; i < profile.sites.size(); i++) {
+		const site_s& site = profile.sites[i];
+		std::string name = fmt::format("{}::{}", site.plugin, site.function);
+		auto found = functions.emplace(name, functions.size() + 1);
+		if (found.second) {
+			proto_s function;
+			function.uint(FunctionId, found.first->second);
+			function.uint(FunctionName, strings(name));
+			function.uint(FunctionSystemName, strings(site.function));
+			function.uint(FunctionFilename, strings(site.file.empty() ? site.plugin : site.file));
+			out.bytes(ProfileFunction, function.out);
+		}
+
+		proto_s line;
+		line.uint(LineFunctionId, found.first->second);
+		line.uint(LineLine, site.line);
+		proto_s location;
+		location.uint(LocationId, i + 1);
+		location.uint(LocationAddress, uint32_t(site.cip));
+		location.bytes(LocationLine, line.out);
+		out.bytes(ProfileLocation, location.out);
+
+		proto_s sample;
+		sample.packed(SampleLocationId, { i + 1 });
+		sample.packed(SampleValue, { site.allocations, site.bytes });
+		out.bytes(ProfileSample, sample.out);
+	}
+
+	valueType(ProfilePeriodType, "space", "bytes");
+	out.uint(ProfilePeriod, profile.interval);
+	for (const auto& string : strings.table)
+		out.bytes(ProfileStringTable, string);
+	return out.out;
+}
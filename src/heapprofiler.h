@@ -0,0 +1,111 @@
+#ifndef _INCLUDE_HEAPPROFILER_H_
+#define _INCLUDE_HEAPPROFILER_H_
+
+#include <sp_vm_api.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//
+//  Plugin heap allocations by the instruction that made them. The VM calls
+//  in after the HEAP and GENARRAY instructions it samples, about one per
+//  sampling interval of bytes allocated, and each sample is weighted by the
+//  bytes since the previous one. Summed per site that estimates the bytes
+//  and allocations each function puts on the heap, which is what to look at
+//  when a plugin runs out of heap: temporary strings and arrays passed by
+//  value, and dynamic arrays.
+//
+class HeapProfiler : public SourcePawn::IHeapAllocListener {
+public:
+	// Sampling interval in bytes when none is given.
+	static constexpr uint32_t kDefaultInterval = 4096;
+
+	struct site_s {
+		std::string plugin;
+		std::string function;
+		std::string file;
+		uint32_t line;
+		cell_t cip;
+		uint64_t samples;
+		// Estimates.
+		uint64_t allocations;
+		uint64_t bytes;
+	};
+	struct profile_s {
+		uint32_t interval = 0;
+		std::vector<site_s> sites;
+	};
+
+	// Only VMs with API version 0x0223 or later sample heap allocations.
+	// Called before any plugins are loaded.
+	void setEnvironment(SourcePawn::ISourcePawnEnvironment* env);
+
+	bool available() const {
+		return env != nullptr;
+	}
+
+	// Samples about one allocation per |bytes| allocated, or every one for
+	// 1; 0 stops. Starting drops the previous results. Safe to call from
+	// any thread.
+	void setInterval(uint32_t bytes);
+
+	// Stops sampling and takes the listener back from the VM, before the
+	// extension unloads. Main thread only.
+	void shutdown();
+
+	uint32_t interval() const {
+		return sampling.load(std::memory_order_relaxed);
+	}
+
+	void OnHeapAlloc(SourcePawn::IPluginContext* ctx, cell_t cip, uint32_t size, uint64_t weight) override;
+
+	// Forgets an unloading plugin's sites. Main thread only.
+	void removePlugin(SourcePawn::IPluginContext* ctx);
+
+	// The sites sampled so far, most bytes first, optionally starting over.
+	// Safe to call from any thread.
+	profile_s snapshot(bool reset);
+
+	// The snapshot as a console table, one line per site.
+	std::vector<std::string> table(bool reset);
+
+	// Writes snapshot(false) to |path|: as a gzipped pprof profile if the
+	// name ends in ".pb.gz", as the console table otherwise.
+	bool dump(const std::string& path);
+
+	// |profile| in pprof's profile.proto encoding, uncompressed, with one
+	// location per site.
+	static std::string pprof(const profile_s& profile);
+
+private:
+	struct key_s {
+		SourcePawn::IPluginContext* context;
+		cell_t cip;
+
+		bool operator==(const key_s& other) const {
+			return context == other.context && cip == other.cip;
+		}
+	};
+	struct hash_s {
+		size_t operator()(const key_s& key) const {
+			return std::hash<const void*>()(key.context) ^ std::hash<cell_t>()(key.cip);
+		}
+	};
+	struct entry_s {
+		site_s site;
+		// Fractional allocations, as weight / size.
+		double allocations = 0;
+	};
+
+	SourcePawn::ISourcePawnEnvironment* env = nullptr;
+	std::atomic<uint32_t> sampling{ 0 };
+	std::mutex mtx;
+	std::unordered_map<key_s, entry_s, hash_s> sites;
+};
+
+extern HeapProfiler DebugHeap;
+
+#endif //_INCLUDE_HEAPPROFILER_H_
@@ -0,0 +1,376 @@
+#include "imagecache.h"
+#include "overhead.h"
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+
+static uint64_t elapsedSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+ImageCache DebugImages;
+
+std::shared_ptr<sp::SmxV1Image> ImageCache::load(const std::string& path, bool* loaded) {
+	std::error_code ec;
+	auto mtime = std::filesystem::last_write_time(path, ec);
+	if (ec)
+		return nullptr;
+	// A rebuild within the file system's time resolution keeps the mtime.
+	auto size = std::filesystem::file_size(path, ec);
+	if (ec)
+		return nullptr;
+
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto found = images.find(path);
+		if (found != images.end() && found->second.mtime == mtime && found->second.size == size)
+			return found->second.image;
+	}
+
+	// Only the debug info is wanted up front; code is decompressed when
+	// it is first looked at. Either way not under the lock, which every
+	// lookup takes.
+	auto start = std::chrono::steady_clock::now();
+	auto image = std::make_shared<sp::SmxV1Image>(path.c_str());
+	bool valid = image->validate(true);
+	DebugOverhead.addImageLoad(elapsedSince(start));
+	if (!valid)
+		return nullptr;
+
+	std::lock_guard<std::mutex> lock(mtx);
+	// Another thread may have loaded the same file meanwhile; the first
+	// one in stays, so every holder shares it.
+	auto& entry = images[path];
+	if (entry.image && entry.mtime == mtime && entry.size == size)
+		return entry.image;
+	entry = { mtime, size, image };
+	*loaded = true;
+	return image;
+}
+
+std::shared_ptr<sp::SmxV1Image> ImageCache::get(const std::string& path) {
+	bool loaded = false;
+	auto image = load(path, &loaded);
+	// A new image brings new indices.
+	if (loaded)
+		trim();
+	return image;
+}
+
+void ImageCache::track(SourcePawn::IPluginRuntime* runtime) {
+	uint64_t loaded = 0;
+#if SOURCEPAWN_API_VERSION >= 0x0222
+	if (env && !env->GetImageHash(runtime->GetDefaultContext(), &loaded))
+		loaded = 0;
+#endif
+	std::lock_guard<std::mutex> lock(mtx);
+	paths.emplace(runtime, tracked_s{ runtime->GetFilename(), loaded });
+}
+
+std::shared_ptr<sp::SmxV1Image> ImageCache::get(SourcePawn::IPluginRuntime* runtime) {
+	track(runtime);
+#if SOURCEPAWN_API_VERSION >= 0x0211
+	if (runtime_images) {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			auto found = runtimes.find(runtime);
+			if (found != runtimes.end())
+				return found->second;
+		}
+
+		std::shared_ptr<sp::SmxV1Image> image;
+		const uint8_t* bytes;
+		size_t length;
+		if (runtime->GetImageBuffer(&bytes, &length)) {
+			// Handlers off the game thread may hold the image past the
+			// plugin's unload, which frees the VM's buffer; so it gets a
+			// copy of its own. Copied and validated outside the lock.
+			auto start = std::chrono::steady_clock::now();
+			auto copy = std::make_unique<uint8_t[]>(length);
+			memcpy(copy.get(), bytes, length);
+			image = std::make_shared<sp::SmxV1Image>(std::move(copy), length);
+			bool valid = image->validate();
+			DebugOverhead.addImageLoad(elapsedSince(start));
+			if (!valid)
+				image = nullptr;
+		}
+		if (image) {
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				auto inserted = runtimes.emplace(runtime, image);
+				if (!inserted.second)
+					return inserted.first->second;
+			}
+			trim();
+			return image;
+		}
+	}
+#endif
+	auto image = get(runtime->GetFilename());
+#if SOURCEPAWN_API_VERSION >= 0x0222
+	// Its lines would be wrong for the code that runs.
+	uint64_t loaded;
+	if (image && env && env->GetImageHash(runtime->GetDefaultContext(), &loaded) &&
+		image->FileHash() != loaded)
+		return nullptr;
+#endif
+	return image;
+}
+
+void ImageCache::setEnvironment(SourcePawn::ISourcePawnEnvironment* env) {
+#if SOURCEPAWN_API_VERSION >= 0x0222
+	if (env->ApiVersion() >= 0x0222)
+		this->env = env;
+#endif
+}
+
+uint64_t ImageCache::hash(SourcePawn::IPluginRuntime* runtime) {
+#if SOURCEPAWN_API_VERSION >= 0x0222
+	uint64_t loaded;
+	if (env && env->GetImageHash(runtime->GetDefaultContext(), &loaded))
+		return loaded;
+#endif
+	auto image = get(runtime->GetFilename());
+	return image ? image->FileHash() : 0;
+}
+
+std::shared_ptr<sp::SmxV1Image> ImageCache::find(uint64_t hash) {
+	if (!hash)
+		return nullptr;
+	std::lock_guard<std::mutex> lock(mtx);
+	for (const auto& entry : paths) {
+		if (entry.second.hash && entry.second.hash != hash)
+			continue;
+		// The VM's own copy has the same debug info as the file it hashed.
+		if (entry.second.hash) {
+			auto wrapped = runtimes.find(entry.first);
+			if (wrapped != runtimes.end())
+				return wrapped->second;
+		}
+		auto found = images.find(entry.second.path);
+		if (found != images.end() && found->second.image->FileHash() == hash)
+			return found->second.image;
+	}
+	return nullptr;
+}
+
+std::vector<ImageCache::listing_s> ImageCache::list() {
+	std::lock_guard<std::mutex> lock(mtx);
+	std::vector<listing_s> listing;
+	listing.reserve(paths.size());
+	for (const auto& entry : paths) {
+		std::shared_ptr<sp::SmxV1Image> image;
+		auto wrapped = runtimes.find(entry.first);
+		if (wrapped != runtimes.end()) {
+			image = wrapped->second;
+		} else {
+			auto found = images.find(entry.second.path);
+			if (found != images.end())
+				image = found->second.image;
+		}
+		uint64_t hash = entry.second.hash;
+		if (!hash && image)
+			hash = image->FileHash();
+		listing.push_back({ entry.second.path, hash, std::move(image) });
+	}
+	return listing;
+}
+
+void ImageCache::release(SourcePawn::IPluginRuntime* runtime) {
+	std::lock_guard<std::mutex> lock(mtx);
+	runtimes.erase(runtime);
+	auto found = paths.find(runtime);
+	if (found == paths.end())
+		return;
+	std::string path = std::move(found->second.path);
+	paths.erase(found);
+	for (const auto& entry : paths) {
+		if (entry.second.path == path)
+			return;
+	}
+	images.erase(path);
+}
+
+void ImageCache::release(const std::string& path) {
+	std::lock_guard<std::mutex> lock(mtx);
+	images.erase(path);
+}
+
+void ImageCache::setIndexBudget(size_t bytes) {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		index_budget = bytes;
+	}
+	trim();
+}
+
+void ImageCache::touch(const std::shared_ptr<sp::SmxV1Image>& image) {
+	if (!image)
+		return;
+	bool rebuild;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto& entry = usage[image.get()];
+		entry.image = image;
+		entry.last_use = std::chrono::steady_clock::now();
+		rebuild = index_budget && !image->EvictableIndexBytes();
+	}
+	if (rebuild) {
+		std::lock_guard<std::mutex> lock(queue_mtx);
+		if (stopping)
+			return;
+		rebuilds.push_back(image);
+		startWorker();
+		queue_cv.notify_one();
+	}
+}
+
+std::shared_ptr<void> ImageCache::pin(const std::shared_ptr<sp::SmxV1Image>& image) {
+	if (!image)
+		return nullptr;
+	std::weak_ptr<sp::SmxV1Image> weak = image;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto& entry = usage[image.get()];
+		entry.image = weak;
+		entry.pins++;
+	}
+	const sp::SmxV1Image* key = image.get();
+	return std::shared_ptr<void>(nullptr, [this, key, weak](void*) {
+		std::lock_guard<std::mutex> lock(mtx);
+		auto found = usage.find(key);
+		// The address may have gone to another image since.
+		if (found == usage.end() || weak.owner_before(found->second.image) ||
+			found->second.image.owner_before(weak))
+			return;
+		if (found->second.pins)
+			found->second.pins--;
+	});
+}
+
+void ImageCache::trim() {
+	// Used this recently, an image is being debugged even without a pin.
+	static constexpr auto kRecentUse = std::chrono::minutes(1);
+
+	std::lock_guard<std::mutex> lock(mtx);
+	if (!index_budget)
+		return;
+
+	for (auto it = usage.begin(); it != usage.end();) {
+		if (it->second.image.expired())
+			it = usage.erase(it);
+		else
+			++it;
+	}
+
+	struct candidate_s {
+		std::chrono::steady_clock::time_point last_use;
+		sp::SmxV1Image* image;
+		size_t bytes;
+	};
+	std::vector<candidate_s> candidates;
+	size_t total = 0;
+	auto now = std::chrono::steady_clock::now();
+	auto consider = [&](const std::shared_ptr<sp::SmxV1Image>& image) {
+		size_t bytes = image->EvictableIndexBytes();
+		if (!bytes)
+			return;
+		total += bytes;
+		std::chrono::steady_clock::time_point last_use;
+		auto found = usage.find(image.get());
+		if (found != usage.end()) {
+			if (found->second.pins || now - found->second.last_use < kRecentUse)
+				return;
+			last_use = found->second.last_use;
+		}
+		candidates.push_back({ last_use, image.get(), bytes });
+	};
+	for (const auto& entry : images)
+		consider(entry.second.image);
+	for (const auto& entry : runtimes)
+		consider(entry.second);
+	if (total <= index_budget)
+		return;
+
+	std::sort(candidates.begin(), candidates.end(),
+		[](const candidate_s& a, const candidate_s& b) { return a.last_use < b.last_use; });
+	for (const auto& candidate : candidates) {
+		if (total <= index_budget)
+			break;
+		total -= std::min(total, candidate.image->EvictIndices());
+	}
+}
+
+void ImageCache::startWorker() {
+	if (!worker.joinable())
+		worker = std::thread(&ImageCache::work, this);
+}
+
+void ImageCache::preload(const std::string& path) {
+	std::lock_guard<std::mutex> lock(queue_mtx);
+	if (stopping)
+		return;
+	queue.push_back(path);
+	startWorker();
+	queue_cv.notify_one();
+}
+
+void ImageCache::preload(SourcePawn::IPluginRuntime* runtime) {
+	if (runtime_images) {
+		get(runtime);
+		return;
+	}
+	track(runtime);
+	preload(runtime->GetFilename());
+}
+
+void ImageCache::shutdown() {
+	{
+		std::lock_guard<std::mutex> lock(queue_mtx);
+		stopping = true;
+		queue.clear();
+		rebuilds.clear();
+	}
+	queue_cv.notify_one();
+	if (worker.joinable())
+		worker.join();
+}
+
+void ImageCache::work() {
+	while (true) {
+		std::string path;
+		std::shared_ptr<sp::SmxV1Image> rebuild;
+		{
+			std::unique_lock<std::mutex> lock(queue_mtx);
+			queue_cv.wait(lock, [this] {
+				return stopping || !queue.empty() || !rebuilds.empty();
+			});
+			if (stopping)
+				return;
+			if (!rebuilds.empty()) {
+				rebuild = rebuilds.front().lock();
+				rebuilds.pop_front();
+			} else {
+				path = std::move(queue.front());
+				queue.pop_front();
+			}
+		}
+		if (!rebuild && path.empty())
+			continue;
+		if (rebuild) {
+			rebuild->BuildIndices();
+			trim();
+			continue;
+		}
+		// Its plugin may have unloaded while it waited.
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			bool loaded = false;
+			for (const auto& entry : paths)
+				loaded = loaded || entry.second.path == path;
+			if (!loaded)
+				continue;
+		}
+		get(path);
+	}
+}
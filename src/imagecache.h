@@ -0,0 +1,153 @@
+#ifndef _INCLUDE_IMAGECACHE_H_
+#define _INCLUDE_IMAGECACHE_H_
+
+#include <sp_vm_api.h>
+#include "smx-v1-image.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+//
+//  Process-wide cache of validated plugin images, shared by every client.
+//  Entries are keyed by path and reloaded when the file's mtime or size
+//  changes, so a plugin is read and decompressed once no matter how many
+//  clients attach. A file rebuilt after its plugin loaded doesn't match
+//  the VM's image hash and isn't handed out for that plugin. A path's entry goes when the last loaded plugin with
+//  that path unloads, so reloads keep memory flat. Under an index budget,
+//  the lookup indices of images nobody is debugging are evicted and later
+//  rebuilt, while the tables stack traces use stay.
+//
+class ImageCache {
+public:
+	// Returns the validated image, loading it on first use, or nullptr if the
+	// file can't be read or isn't a valid SMX image. Safe to call from any
+	// thread.
+	std::shared_ptr<sp::SmxV1Image> get(const std::string& path);
+
+	// Returns the image of a loaded plugin. When the VM exposes its own copy
+	// the image is made from a copy of that, otherwise this falls back to
+	// get(path). Either way the image owns its bytes and outlives the
+	// plugin as long as it is held.
+	std::shared_ptr<sp::SmxV1Image> get(SourcePawn::IPluginRuntime* runtime);
+
+	// Only VMs with API version 0x0211 or later can hand out their images.
+	void setRuntimeImages(bool enabled) {
+		runtime_images = enabled;
+	}
+
+	// VMs with API version 0x0222 or later hash each file as they load it,
+	// so an image read from the path later can be checked against it.
+	void setEnvironment(SourcePawn::ISourcePawnEnvironment* env);
+
+	// Returns the image hash of a loaded plugin's file: the VM's, or else
+	// that of the file behind get(path), or 0 if there is neither. Safe to
+	// call from any thread.
+	uint64_t hash(SourcePawn::IPluginRuntime* runtime);
+
+	// Returns the cached image of the loaded plugin whose file has |hash|,
+	// or nullptr if no plugin asked for so far has it. Never reads a file
+	// and never touches a runtime, so it is safe on any thread even while
+	// plugins unload.
+	std::shared_ptr<sp::SmxV1Image> find(uint64_t hash);
+
+	// The loaded plugins whose images were asked for, with the image each
+	// has cached so far or nullptr while it is still loading. Like find(),
+	// safe on any thread.
+	struct listing_s {
+		std::string path;
+		uint64_t hash;
+		std::shared_ptr<sp::SmxV1Image> image;
+	};
+	std::vector<listing_s> list();
+
+	// Drops the cached image. Holders of the shared pointer keep theirs.
+	void release(const std::string& path);
+
+	// Drops the image of an unloading plugin, and the image of its path
+	// if no other loaded plugin has it. Holders of the shared pointer keep
+	// theirs.
+	void release(SourcePawn::IPluginRuntime* runtime);
+
+	// Loads and indexes the image on a worker thread, so the first break in
+	// the plugin finds it warm.
+	void preload(const std::string& path);
+
+	// Copies the VM's image right away, since that is cheap, or else queues
+	// the plugin file for preload(path).
+	void preload(SourcePawn::IPluginRuntime* runtime);
+
+	// Caps the bytes of symbol and line indices kept across all cached
+	// images; 0, the default, keeps them all. Over the budget, the indices
+	// of images that are neither pinned nor used in the last minute are
+	// evicted, least recently used first. They are rebuilt when next
+	// needed, or ahead of that by touch().
+	void setIndexBudget(size_t bytes);
+
+	// Marks the image as used now, as a stop in its plugin or a client
+	// asking about it does. Evicted indices are rebuilt on the worker.
+	void touch(const std::shared_ptr<sp::SmxV1Image>& image);
+
+	// Keeps the image's indices resident until the returned token goes, as
+	// for a plugin with breakpoints bound.
+	std::shared_ptr<void> pin(const std::shared_ptr<sp::SmxV1Image>& image);
+
+	// Stops the worker thread. Pending preloads are dropped.
+	void shutdown();
+
+private:
+	// get(path), setting |*loaded| if the file was read.
+	std::shared_ptr<sp::SmxV1Image> load(const std::string& path, bool* loaded);
+	void work();
+	void startWorker();
+	// Evicts indices until the budget holds. Takes mtx.
+	void trim();
+
+	struct entry_s {
+		std::filesystem::file_time_type mtime;
+		uintmax_t size;
+		std::shared_ptr<sp::SmxV1Image> image;
+	};
+	void track(SourcePawn::IPluginRuntime* runtime);
+
+	std::mutex mtx;
+	std::unordered_map<std::string, entry_s> images;
+	std::unordered_map<SourcePawn::IPluginRuntime*, std::shared_ptr<sp::SmxV1Image>> runtimes;
+	// Paths of the loaded plugins whose images were asked for, and the
+	// VM's hash of each, or 0 without one.
+	struct tracked_s {
+		std::string path;
+		uint64_t hash;
+	};
+	std::unordered_map<SourcePawn::IPluginRuntime*, tracked_s> paths;
+	bool runtime_images = false;
+	SourcePawn::ISourcePawnEnvironment* env = nullptr;
+
+	// Use of each image for the index budget; entries of images that are
+	// gone are dropped by trim().
+	struct usage_s {
+		std::weak_ptr<sp::SmxV1Image> image;
+		std::chrono::steady_clock::time_point last_use;
+		uint32_t pins = 0;
+	};
+	std::unordered_map<const sp::SmxV1Image*, usage_s> usage;
+	size_t index_budget = 0;
+
+	std::mutex queue_mtx;
+	std::condition_variable queue_cv;
+	std::deque<std::string> queue;
+	// Images whose evicted indices a touch() wants back.
+	std::deque<std::weak_ptr<sp::SmxV1Image>> rebuilds;
+	std::thread worker;
+	bool stopping = false;
+};
+
+extern ImageCache DebugImages;
+
+#endif //_INCLUDE_IMAGECACHE_H_
@@ -0,0 +1,62 @@
+#include "localsocket.h"
+#include <string.h>
+#include <chrono>
+
+#ifdef _WIN32
+#include <afunix.h>
+#define close_socket closesocket
+#else
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define INVALID_SOCKET (-1)
+#define close_socket close
+#endif
+
+bool LocalListener::start(const std::string& where, accept_t callback) {
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (where.empty() || where.size() >= sizeof(addr.sun_path))
+		return false;
+	memcpy(addr.sun_path, where.c_str(), where.size() + 1);
+
+#ifdef _WIN32
+	WSADATA wsa;
+	WSAStartup(MAKEWORD(2, 2), &wsa);
+	DeleteFileA(where.c_str());
+#else
+	unlink(where.c_str());
+#endif
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener == INVALID_SOCKET)
+		return false;
+#ifndef _WIN32
+	// The socket file is created owner-only, rather than narrowed after
+	// bind() while someone else could already connect.
+	mode_t mask = umask(0177);
+#endif
+	int bound = bind(listener, (const sockaddr*)&addr, sizeof(addr));
+#ifndef _WIN32
+	umask(mask);
+#endif
+	if (bound != 0 || listen(listener, 4) != 0) {
+		close_socket(listener);
+		return false;
+	}
+
+	accepted = std::move(callback);
+	worker = std::thread(&LocalListener::run, this);
+	worker.detach();
+	return true;
+}
+
+void LocalListener::run() {
+	while (true) {
+		local_socket_t fd = accept(listener, nullptr, nullptr);
+		if (fd != INVALID_SOCKET)
+			accepted(fd);
+		else
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+}
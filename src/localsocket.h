@@ -0,0 +1,36 @@
+#ifndef _INCLUDE_LOCALSOCKET_H_
+#define _INCLUDE_LOCALSOCKET_H_
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#include <winsock2.h>
+typedef SOCKET local_socket_t;
+#else
+typedef int local_socket_t;
+#endif
+
+//
+//  Listens on a Unix domain socket, so an adapter on the same machine can
+//  connect without a TCP port. Windows 10 and later have AF_UNIX too. Each
+//  accepted socket is handed over to be served like a TCP connection.
+//
+class LocalListener {
+public:
+	typedef std::function<void(local_socket_t)> accept_t;
+
+	// Replaces whatever is at |path|. Only the server's user may connect.
+	bool start(const std::string& path, accept_t accepted);
+
+private:
+	void run();
+
+	accept_t accepted;
+	local_socket_t listener;
+	std::thread worker;
+};
+
+#endif //_INCLUDE_LOCALSOCKET_H_
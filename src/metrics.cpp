@@ -0,0 +1,179 @@
+#include "metrics.h"
+#include "nativeprofiler.h"
+#include "overhead.h"
+#include "plugincpu.h"
+#include "publicprofiler.h"
+#include <algorithm>
+#include <fmt/format.h>
+
+static void escape(std::string& out, const std::string& value) {
+	for (char c : value) {
+		if (c == '\\' || c == '"')
+			out += '\\';
+		if (c == '\n')
+			out += "\\n";
+		else
+			out += c;
+	}
+}
+
+void MetricsWriter::family(const char* name, const char* type, const char* help) {
+	fmt::format_to(std::back_inserter(text), "# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+}
+
+void MetricsWriter::name(const char* name, labels_t labels) {
+	text += name;
+	if (!labels.size())
+		return;
+	char separator = '{';
+	for (const auto& label : labels) {
+		text += separator;
+		text += label.first;
+		text += "=\"";
+		escape(text, label.second);
+		text += '"';
+		separator = ',';
+	}
+	text += '}';
+}
+
+void MetricsWriter::sample(const char* metric, labels_t labels, double value) {
+	name(metric, labels);
+	fmt::format_to(std::back_inserter(text), " {}\n", value);
+}
+
+void MetricsWriter::sample(const char* metric, labels_t labels, uint64_t value) {
+	name(metric, labels);
+	fmt::format_to(std::back_inserter(text), " {}\n", value);
+}
+
+static void writeOverhead(MetricsWriter& out) {
+	auto totals = DebugOverhead.snapshot(false);
+	out.family("sm_debugger_debug_breaks_total", "counter", "Debug breaks that reached the debugger.");
+	for (const auto& plugin : totals.plugins)
+		out.sample("sm_debugger_debug_breaks_total", { { "plugin", plugin.plugin } }, plugin.breaks);
+	out.family("sm_debugger_handled_breaks_total", "counter", "Debug breaks a client was interested in.");
+	out.sample("sm_debugger_handled_breaks_total", {}, totals.handled);
+	out.family("sm_debugger_handler_seconds_total", "counter", "Game-thread time spent on handled breaks, stops excluded.");
+	out.sample("sm_debugger_handler_seconds_total", {}, totals.handler_time / 1e9);
+	out.family("sm_debugger_image_loads_total", "counter", "Plugin images parsed by the debugger.");
+	out.sample("sm_debugger_image_loads_total", {}, totals.image_loads);
+	out.family("sm_debugger_image_load_seconds_total", "counter", "Time spent parsing plugin images.");
+	out.sample("sm_debugger_image_load_seconds_total", {}, totals.image_load_time / 1e9);
+	out.family("sm_debugger_stopped_seconds_total", "counter", "Time the game thread stood still at stops.");
+	out.sample("sm_debugger_stopped_seconds_total", {}, totals.blocked / 1e9);
+
+	out.family("sm_debugger_budget_level", "gauge", "Instrumentation given up to the tick budget: 0 none, 3 all.");
+	out.sample("sm_debugger_budget_level", {}, uint64_t(DebugBudget.level()));
+
+	// Plugins are measured at debug breaks and once a second.
+	out.family("sm_debugger_plugin_data_bytes", "gauge", "Global variables of the plugin.");
+	for (const auto& plugin : totals.plugins) {
+		if (plugin.heap_stack)
+			out.sample("sm_debugger_plugin_data_bytes", { { "plugin", plugin.plugin } }, uint64_t(plugin.data));
+	}
+	out.family("sm_debugger_plugin_heap_stack_bytes", "gauge", "Heap and stack space of the plugin.");
+	for (const auto& plugin : totals.plugins) {
+		if (plugin.heap_stack)
+			out.sample("sm_debugger_plugin_heap_stack_bytes", { { "plugin", plugin.plugin } }, uint64_t(plugin.heap_stack));
+	}
+	out.family("sm_debugger_plugin_heap_bytes", "gauge", "Heap in use at the last sample.");
+	for (const auto& plugin : totals.plugins) {
+		if (plugin.heap_stack)
+			out.sample("sm_debugger_plugin_heap_bytes", { { "plugin", plugin.plugin } }, uint64_t(plugin.heap));
+	}
+	out.family("sm_debugger_plugin_stack_bytes", "gauge", "Stack in use at the last sample.");
+	for (const auto& plugin : totals.plugins) {
+		if (plugin.heap_stack)
+			out.sample("sm_debugger_plugin_stack_bytes", { { "plugin", plugin.plugin } }, uint64_t(plugin.stack));
+	}
+	out.family("sm_debugger_plugin_heap_peak_bytes", "gauge", "Most heap in use seen.");
+	for (const auto& plugin : totals.plugins) {
+		if (plugin.heap_stack)
+			out.sample("sm_debugger_plugin_heap_peak_bytes", { { "plugin", plugin.plugin } }, uint64_t(plugin.heap_peak));
+	}
+	out.family("sm_debugger_plugin_stack_peak_bytes", "gauge", "Most stack in use seen.");
+	for (const auto& plugin : totals.plugins) {
+		if (plugin.heap_stack)
+			out.sample("sm_debugger_plugin_stack_peak_bytes", { { "plugin", plugin.plugin } }, uint64_t(plugin.stack_peak));
+	}
+	out.family("sm_debugger_plugin_heap_stack_peak_bytes", "gauge",
+		"Most heap and stack in use at once; they collide at the heap and stack space.");
+	for (const auto& plugin : totals.plugins) {
+		if (plugin.heap_stack)
+			out.sample("sm_debugger_plugin_heap_stack_peak_bytes", { { "plugin", plugin.plugin } }, uint64_t(plugin.used_peak));
+	}
+}
+
+static void writeCpu(MetricsWriter& out) {
+	if (!DebugCpu.available())
+		return;
+	auto window = DebugCpu.top(0);
+	out.family("sm_debugger_plugin_cpu_seconds_total", "counter", "Time in the plugin's code and its natives.");
+	for (const auto& plugin : window.plugins)
+		out.sample("sm_debugger_plugin_cpu_seconds_total", { { "plugin", plugin.plugin } }, plugin.total_nanoseconds / 1e9);
+	out.family("sm_debugger_plugin_invocations_total", "counter", "Calls into the plugin from outside of it.");
+	for (const auto& plugin : window.plugins)
+		out.sample("sm_debugger_plugin_invocations_total", { { "plugin", plugin.plugin } }, plugin.total_invocations);
+}
+
+static void writeNatives(MetricsWriter& out) {
+	auto natives = DebugNatives.snapshot(false);
+	if (natives.empty())
+		return;
+
+	// Every native gets the same buckets, up to the highest one in use, so
+	// they can be summed.
+	size_t used = 0;
+	for (const auto& native : natives) {
+		for (size_t i = used; i < NativeProfiler::kBuckets; i++) {
+			if (native.histogram[i])
+				used = i + 1;
+		}
+	}
+	used = std::min(used, NativeProfiler::kBuckets - 1);
+
+	out.family("sm_debugger_native_cycles", "histogram", "CPU cycles per native call.");
+	for (const auto& native : natives) {
+		uint64_t count = 0;
+		for (size_t i = 0; i < used; i++) {
+			count += native.histogram[i];
+			out.sample("sm_debugger_native_cycles_bucket", { { "plugin", native.plugin }, { "native", native.native },
+				{ "le", std::to_string((uint64_t(1) << (i + 1)) - 1) } }, count);
+		}
+		out.sample("sm_debugger_native_cycles_bucket", { { "plugin", native.plugin }, { "native", native.native },
+			{ "le", "+Inf" } }, native.calls);
+		out.sample("sm_debugger_native_cycles_sum", { { "plugin", native.plugin }, { "native", native.native } }, native.cycles);
+		out.sample("sm_debugger_native_cycles_count", { { "plugin", native.plugin }, { "native", native.native } }, native.calls);
+	}
+}
+
+static void writePublics(MetricsWriter& out) {
+	auto publics = DebugPublics.snapshot(false);
+	if (publics.empty())
+		return;
+
+	out.family("sm_debugger_public_seconds", "summary", "Time per call of a public function.");
+	for (const auto& function : publics) {
+		out.sample("sm_debugger_public_seconds", { { "plugin", function.plugin }, { "function", function.function },
+			{ "quantile", "0.5" } }, function.p50 / 1e9);
+		out.sample("sm_debugger_public_seconds", { { "plugin", function.plugin }, { "function", function.function },
+			{ "quantile", "0.99" } }, function.p99 / 1e9);
+		out.sample("sm_debugger_public_seconds_sum", { { "plugin", function.plugin }, { "function", function.function } },
+			function.total / 1e9);
+		out.sample("sm_debugger_public_seconds_count", { { "plugin", function.plugin }, { "function", function.function } },
+			function.calls);
+	}
+	out.family("sm_debugger_public_max_seconds", "gauge", "Longest call of a public function.");
+	for (const auto& function : publics) {
+		out.sample("sm_debugger_public_max_seconds", { { "plugin", function.plugin }, { "function", function.function } },
+			function.max / 1e9);
+	}
+}
+
+void WriteMetrics(MetricsWriter& out) {
+	writeOverhead(out);
+	writeCpu(out);
+	writeNatives(out);
+	writePublics(out);
+}
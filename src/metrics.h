@@ -0,0 +1,37 @@
+#ifndef _INCLUDE_METRICS_H_
+#define _INCLUDE_METRICS_H_
+
+#include <stdint.h>
+#include <initializer_list>
+#include <string>
+#include <utility>
+
+//
+//  Prometheus text exposition of what the extension counts, for scraping
+//  over HTTP without attaching a debugger. The page is rendered from the
+//  modules' snapshots on the scraping I/O thread; nothing is reset.
+//
+class MetricsWriter {
+public:
+	typedef std::initializer_list<std::pair<const char*, std::string>> labels_t;
+
+	// Starts a metric family; its samples must follow.
+	void family(const char* name, const char* type, const char* help);
+	void sample(const char* name, labels_t labels, double value);
+	void sample(const char* name, labels_t labels, uint64_t value);
+
+	std::string take() {
+		return std::move(text);
+	}
+
+private:
+	void name(const char* name, labels_t labels);
+
+	std::string text;
+};
+
+// The debugger's overhead, tick budget, plugin memory and the native and
+// public function profiles.
+void WriteMetrics(MetricsWriter& out);
+
+#endif //_INCLUDE_METRICS_H_
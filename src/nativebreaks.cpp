@@ -0,0 +1,141 @@
+#include "nativebreaks.h"
+#include "nativeprofiler.h"
+
+NativeBreakpoints DebugNativeBreaks;
+
+void NativeBreakpoints::setEnvironment(SourcePawn::ISourcePawnEnvironment* api, hit_t handler) {
+	env = api;
+	hit = handler;
+}
+
+void NativeBreakpoints::watch(std::unordered_set<std::string> names) {
+	if (!env)
+		return;
+	std::lock_guard<std::mutex> lock(mtx);
+	requested = std::move(names);
+	dirty = true;
+}
+
+cell_t NativeBreakpoints::invoke(SourcePawn::IPluginContext* ctx, const cell_t* params, void* data) {
+	auto entry = static_cast<entry_s*>(data);
+#if SOURCEPAWN_API_VERSION >= 0x021E
+	SourcePawn::sp_script_frame_t frame = {};
+	cell_t sp, stp;
+	entry->owner->env->GetScriptFrames(ctx, &frame, 1, &sp, &stp);
+	entry->owner->hit(ctx, entry->name, frame.cip, frame.frm, params);
+#endif
+	return entry->original(ctx, params);
+}
+
+void NativeBreakpoints::wrap(plugin_s& plugin) {
+#if SOURCEPAWN_API_VERSION >= 0x021E
+	if (watched.empty())
+		return;
+	uint32_t count = plugin.runtime->GetNativesNum();
+	if (plugin.natives.size() < count)
+		plugin.natives.resize(count);
+	for (uint32_t i = 0; i < count; i++) {
+		const sp_native_t* native = plugin.runtime->GetNative(i);
+		if (!native || !native->name || !watched.count(native->name))
+			continue;
+		SPVM_NATIVE_FUNC pfn;
+		uint32_t flags;
+		void* user;
+		if (plugin.runtime->GetNativeBinding(i, &pfn, &flags, &user) != SP_ERROR_NONE || !pfn)
+			continue;
+
+		auto& entry = plugin.natives[i];
+		if (!entry) {
+			entry = std::make_unique<entry_s>();
+			entry->owner = this;
+			entry->index = i;
+			entry->name = native->name;
+		}
+		if (entry->thunk && pfn == entry->thunk)
+			continue;
+
+		entry->original = pfn;
+		if (!entry->thunk)
+			entry->thunk = env->APIv2()->CreateFakeNative(&NativeBreakpoints::invoke, entry.get());
+		if (entry->thunk)
+			plugin.runtime->UpdateNativeBinding(i, entry->thunk, flags, user);
+	}
+#endif
+}
+
+void NativeBreakpoints::unwrap(plugin_s& plugin) {
+#if SOURCEPAWN_API_VERSION >= 0x021E
+	for (auto& entry : plugin.natives) {
+		if (!entry || !entry->thunk)
+			continue;
+		SPVM_NATIVE_FUNC pfn;
+		uint32_t flags;
+		void* user;
+		if (plugin.runtime->GetNativeBinding(entry->index, &pfn, &flags, &user) != SP_ERROR_NONE)
+			continue;
+		// Natives rebound by SourceMod since they were wrapped keep their
+		// new binding.
+		if (pfn == entry->thunk &&
+			plugin.runtime->UpdateNativeBinding(entry->index, entry->original, flags, user) != SP_ERROR_NONE)
+			continue;
+		env->APIv2()->DestroyFakeNative(entry->thunk);
+		entry->thunk = nullptr;
+	}
+#endif
+}
+
+void NativeBreakpoints::sync() {
+	bool profiler = DebugNatives.pending();
+	if (!env || (!dirty && !profiler)) {
+		DebugNatives.sync();
+		return;
+	}
+	if (dirty.exchange(false)) {
+		std::lock_guard<std::mutex> lock(mtx);
+		watched = requested;
+	}
+	// Ours are outermost: off before the profiler changes its stubs, and
+	// back on around whatever it left. Natives no longer watched lose their
+	// entry along with the stub.
+	for (auto& plugin : plugins) {
+		unwrap(plugin.second);
+		for (auto& entry : plugin.second.natives) {
+			if (entry && !entry->thunk && !watched.count(entry->name))
+				entry.reset();
+		}
+	}
+	DebugNatives.sync();
+	for (auto& plugin : plugins)
+		wrap(plugin.second);
+}
+
+void NativeBreakpoints::addPlugin(SourcePawn::IPluginContext* ctx) {
+	if (!env)
+		return;
+	auto& added = plugins[ctx];
+	added.runtime = ctx->GetRuntime();
+	wrap(added);
+}
+
+void NativeBreakpoints::removePlugin(SourcePawn::IPluginContext* ctx) {
+	auto found = plugins.find(ctx);
+	if (found == plugins.end())
+		return;
+	unwrap(found->second);
+	plugins.erase(found);
+}
+
+void NativeBreakpoints::shutdown() {
+	if (!env)
+		return;
+	for (auto& plugin : plugins)
+		unwrap(plugin.second);
+	plugins.clear();
+	watched.clear();
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		requested.clear();
+		dirty = false;
+	}
+	env = nullptr;
+}
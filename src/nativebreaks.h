@@ -0,0 +1,88 @@
+#ifndef _INCLUDE_NATIVEBREAKS_H_
+#define _INCLUDE_NATIVEBREAKS_H_
+
+#include <sp_vm_api.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+//
+//  Breakpoints on native calls. Only the natives some client watches are
+//  rebound, each to a fake native stub that reports the call and then calls
+//  the original; every other native keeps its binding and costs nothing.
+//  The stubs wrap the native profiler's, so both can be on at once.
+//
+class NativeBreakpoints {
+public:
+	// Called on the game thread before a watched native runs, with the
+	// calling plugin's innermost scripted frame, 0s where it is unknown.
+	// May stop the game thread.
+	typedef void (*hit_t)(SourcePawn::IPluginContext* ctx, const std::string& native,
+		cell_t cip, cell_t frm, const cell_t* params);
+
+	// Needs API version 0x021E or later, with native rebinding enabled.
+	// Called before any plugins are loaded.
+	void setEnvironment(SourcePawn::ISourcePawnEnvironment* env, hit_t hit);
+
+	bool available() const {
+		return env != nullptr;
+	}
+
+	// The natives to intercept, by name, from the next game frame. Safe to
+	// call from any thread.
+	void watch(std::unordered_set<std::string> names);
+
+	// Rebinds the natives to match watch(), and runs DebugNatives.sync()
+	// in between, so the profiler never unwraps a stub ours still calls.
+	// Main thread only, with no plugin code on the stack.
+	void sync();
+
+	// Tracks a loaded plugin, after DebugNatives has. Main thread only.
+	void addPlugin(SourcePawn::IPluginContext* ctx);
+
+	// Restores and forgets an unloading plugin, before DebugNatives does.
+	// Main thread only.
+	void removePlugin(SourcePawn::IPluginContext* ctx);
+
+	// Restores every plugin's watched natives and destroys the stubs before
+	// the extension unloads, and before DebugNatives.shutdown(). Main
+	// thread only.
+	void shutdown();
+
+private:
+	struct entry_s {
+		NativeBreakpoints* owner;
+		uint32_t index;
+		std::string name;
+		SPVM_NATIVE_FUNC original = nullptr;
+		SPVM_NATIVE_FUNC thunk = nullptr;
+	};
+
+	struct plugin_s {
+		SourcePawn::IPluginRuntime* runtime;
+		std::vector<std::unique_ptr<entry_s>> natives;
+	};
+
+	static cell_t invoke(SourcePawn::IPluginContext* ctx, const cell_t* params, void* data);
+	void wrap(plugin_s& plugin);
+	void unwrap(plugin_s& plugin);
+
+	SourcePawn::ISourcePawnEnvironment* env = nullptr;
+	hit_t hit = nullptr;
+	std::atomic<bool> dirty{ false };
+	// Written under mtx by any thread, read by sync().
+	std::unordered_set<std::string> requested;
+	// What is wrapped. Main thread only.
+	std::unordered_set<std::string> watched;
+	std::mutex mtx;
+	std::unordered_map<SourcePawn::IPluginContext*, plugin_s> plugins;
+};
+
+extern NativeBreakpoints DebugNativeBreaks;
+
+#endif //_INCLUDE_NATIVEBREAKS_H_
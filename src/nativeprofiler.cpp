@@ -0,0 +1,209 @@
+#include "nativeprofiler.h"
+#include <algorithm>
+#include <filesystem>
+#include <fmt/format.h>
+#ifdef _WIN32
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+NativeProfiler DebugNatives;
+
+static size_t bucketOf(uint64_t cycles) {
+	size_t bucket = 0;
+	while (cycles >>= 1) {
+		if (++bucket == NativeProfiler::kBuckets - 1)
+			break;
+	}
+	return bucket;
+}
+
+static void bump(std::atomic<uint64_t>& counter, uint64_t amount) {
+	counter.store(counter.load(std::memory_order_relaxed) + amount,
+		std::memory_order_relaxed);
+}
+
+void NativeProfiler::setEngine(SourcePawn::ISourcePawnEngine2* api) {
+	engine = api;
+}
+
+void NativeProfiler::setActive(bool active) {
+	if (!engine)
+		return;
+	std::lock_guard<std::mutex> lock(mtx);
+	if (active && !requested) {
+		for (auto& plugin : plugins) {
+			for (auto& entry : plugin.second.natives) {
+				if (!entry)
+					continue;
+				entry->calls.store(0, std::memory_order_relaxed);
+				entry->cycles.store(0, std::memory_order_relaxed);
+				for (auto& bucket : entry->histogram)
+					bucket.store(0, std::memory_order_relaxed);
+			}
+		}
+	}
+	requested = active;
+}
+
+cell_t NativeProfiler::invoke(SourcePawn::IPluginContext* ctx, const cell_t* params, void* data) {
+	auto entry = static_cast<entry_s*>(data);
+	uint64_t start = __rdtsc();
+	cell_t result = entry->original(ctx, params);
+	uint64_t cycles = __rdtsc() - start;
+	bump(entry->calls, 1);
+	bump(entry->cycles, cycles);
+	bump(entry->histogram[bucketOf(cycles)], 1);
+	return result;
+}
+
+void NativeProfiler::wrap(plugin_s& plugin) {
+#if SOURCEPAWN_API_VERSION >= 0x0214
+	uint32_t count = plugin.runtime->GetNativesNum();
+	if (plugin.natives.size() < count)
+		plugin.natives.resize(count);
+	for (uint32_t i = 0; i < count; i++) {
+		SPVM_NATIVE_FUNC pfn;
+		uint32_t flags;
+		void* user;
+		if (plugin.runtime->GetNativeBinding(i, &pfn, &flags, &user) != SP_ERROR_NONE || !pfn)
+			continue;
+
+		auto& entry = plugin.natives[i];
+		if (!entry) {
+			entry = std::make_unique<entry_s>();
+			entry->runtime = plugin.runtime;
+			entry->index = i;
+			const sp_native_t* native = plugin.runtime->GetNative(i);
+			entry->name = native && native->name ? native->name : fmt::format("#{}", i);
+		}
+		if (entry->thunk && pfn == entry->thunk)
+			continue;
+
+		// The binding's flags and user data stay as they were; only the
+		// function goes through the stub.
+		entry->original = pfn;
+		if (!entry->thunk)
+			entry->thunk = engine->CreateFakeNative(&NativeProfiler::invoke, entry.get());
+		if (entry->thunk)
+			plugin.runtime->UpdateNativeBinding(i, entry->thunk, flags, user);
+	}
+#endif
+}
+
+void NativeProfiler::unwrap(plugin_s& plugin) {
+#if SOURCEPAWN_API_VERSION >= 0x0214
+	for (auto& entry : plugin.natives) {
+		if (!entry || !entry->thunk)
+			continue;
+		SPVM_NATIVE_FUNC pfn;
+		uint32_t flags;
+		void* user;
+		if (plugin.runtime->GetNativeBinding(entry->index, &pfn, &flags, &user) != SP_ERROR_NONE)
+			continue;
+		// Natives rebound by SourceMod since they were wrapped keep their
+		// new binding.
+		if (pfn == entry->thunk &&
+			plugin.runtime->UpdateNativeBinding(entry->index, entry->original, flags, user) != SP_ERROR_NONE)
+			continue;
+		engine->DestroyFakeNative(entry->thunk);
+		entry->thunk = nullptr;
+	}
+#endif
+}
+
+void NativeProfiler::sync() {
+	bool want = requested.load(std::memory_order_relaxed);
+	if (!engine || want == wrapped)
+		return;
+	std::lock_guard<std::mutex> lock(mtx);
+	for (auto& plugin : plugins) {
+		if (want)
+			wrap(plugin.second);
+		else
+			unwrap(plugin.second);
+	}
+	wrapped = want;
+}
+
+void NativeProfiler::addPlugin(SourcePawn::IPluginContext* ctx) {
+	if (!engine)
+		return;
+	auto runtime = ctx->GetRuntime();
+	plugin_s plugin{ runtime, std::filesystem::path(runtime->GetFilename()).filename().string() };
+	std::lock_guard<std::mutex> lock(mtx);
+	auto& added = plugins[ctx] = std::move(plugin);
+	if (wrapped)
+		wrap(added);
+}
+
+void NativeProfiler::removePlugin(SourcePawn::IPluginContext* ctx) {
+	std::lock_guard<std::mutex> lock(mtx);
+	auto found = plugins.find(ctx);
+	if (found == plugins.end())
+		return;
+	unwrap(found->second);
+	plugins.erase(found);
+}
+
+void NativeProfiler::shutdown() {
+	if (!engine)
+		return;
+	std::lock_guard<std::mutex> lock(mtx);
+	for (auto& plugin : plugins)
+		unwrap(plugin.second);
+	plugins.clear();
+	wrapped = false;
+	requested = false;
+	engine = nullptr;
+}
+
+std::vector<NativeProfiler::native_s> NativeProfiler::snapshot(bool reset) {
+	std::vector<native_s> natives;
+	std::lock_guard<std::mutex> lock(mtx);
+	for (auto& plugin : plugins) {
+		for (auto& entry : plugin.second.natives) {
+			if (!entry || !entry->calls.load(std::memory_order_relaxed))
+				continue;
+			native_s native{ plugin.second.name, entry->name,
+				entry->calls.load(std::memory_order_relaxed),
+				entry->cycles.load(std::memory_order_relaxed) };
+			for (size_t i = 0; i < kBuckets; i++)
+				native.histogram[i] = entry->histogram[i].load(std::memory_order_relaxed);
+			natives.push_back(std::move(native));
+			if (reset) {
+				entry->calls.store(0, std::memory_order_relaxed);
+				entry->cycles.store(0, std::memory_order_relaxed);
+				for (auto& bucket : entry->histogram)
+					bucket.store(0, std::memory_order_relaxed);
+			}
+		}
+	}
+	return natives;
+}
+
+std::vector<std::string> NativeProfiler::table(bool reset) {
+	auto natives = snapshot(reset);
+	std::sort(natives.begin(), natives.end(), [](const native_s& a, const native_s& b) {
+		return a.cycles > b.cycles;
+	});
+
+	std::vector<std::string> lines;
+	lines.push_back(fmt::format("{:>10} {:>14} {:>10} {:>10}  {}",
+		"calls", "cycles", "average", "p99 <", "native"));
+	for (const auto& native : natives) {
+		// The upper bound of the bucket holding the 99th percentile call.
+		uint64_t seen = 0;
+		size_t p99 = 0;
+		for (; p99 < kBuckets - 1; p99++) {
+			seen += native.histogram[p99];
+			if (seen * 100 >= native.calls * 99)
+				break;
+		}
+		lines.push_back(fmt::format("{:>10} {:>14} {:>10} {:>10}  {}::{}",
+			native.calls, native.cycles, native.cycles / native.calls,
+			uint64_t(2) << p99, native.plugin, native.native));
+	}
+	return lines;
+}
@@ -0,0 +1,107 @@
+#ifndef _INCLUDE_NATIVEPROFILER_H_
+#define _INCLUDE_NATIVEPROFILER_H_
+
+#include <sp_vm_api.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//
+//  Native call timing. While active every bound native of every plugin is
+//  rebound to a fake native stub generated by the VM, which calls the
+//  original and counts the call and its cycles per (plugin, native).
+//
+class NativeProfiler {
+public:
+	// Cycles are bucketed by their highest set bit.
+	static constexpr size_t kBuckets = 32;
+
+	struct native_s {
+		std::string plugin;
+		std::string native;
+		uint64_t calls;
+		uint64_t cycles;
+		uint64_t histogram[kBuckets];
+	};
+
+	// Only VMs with API version 0x0214 or later let bound natives be
+	// rebound. Called before any plugins are loaded.
+	void setEngine(SourcePawn::ISourcePawnEngine2* api);
+
+	bool available() const {
+		return engine != nullptr;
+	}
+
+	// Starts or stops timing from the next game frame. Starting drops the
+	// previous counts. Safe to call from any thread.
+	void setActive(bool active);
+
+	bool active() const {
+		return requested.load(std::memory_order_relaxed);
+	}
+
+	// Wraps or unwraps the natives to match setActive. Main thread only,
+	// with no plugin code on the stack.
+	void sync();
+
+	// Whether the next sync() wraps or unwraps. Main thread only.
+	bool pending() const {
+		return engine && requested.load(std::memory_order_relaxed) != wrapped;
+	}
+
+	// Tracks a loaded plugin. Main thread only.
+	void addPlugin(SourcePawn::IPluginContext* ctx);
+
+	// Restores and forgets an unloading plugin. Main thread only.
+	void removePlugin(SourcePawn::IPluginContext* ctx);
+
+	// Restores every plugin's natives and frees the stubs, which live in
+	// code the VM keeps after the extension unloads. Main thread only,
+	// after DebugNativeBreaks.shutdown().
+	void shutdown();
+
+	// The natives called so far, optionally starting over. Safe to call
+	// from any thread.
+	std::vector<native_s> snapshot(bool reset);
+
+	// The snapshot as a console table, one line per native, busiest first.
+	std::vector<std::string> table(bool reset);
+
+private:
+	struct entry_s {
+		SourcePawn::IPluginRuntime* runtime;
+		uint32_t index;
+		std::string name;
+		SPVM_NATIVE_FUNC original = nullptr;
+		SPVM_NATIVE_FUNC thunk = nullptr;
+		std::atomic<uint64_t> calls{ 0 };
+		std::atomic<uint64_t> cycles{ 0 };
+		std::atomic<uint64_t> histogram[kBuckets] = {};
+	};
+
+	struct plugin_s {
+		SourcePawn::IPluginRuntime* runtime;
+		std::string name;
+		std::vector<std::unique_ptr<entry_s>> natives;
+	};
+
+	static cell_t invoke(SourcePawn::IPluginContext* ctx, const cell_t* params, void* data);
+	void wrap(plugin_s& plugin);
+	void unwrap(plugin_s& plugin);
+
+	SourcePawn::ISourcePawnEngine2* engine = nullptr;
+	std::atomic<bool> requested{ false };
+	bool wrapped = false;
+	// Written by the main thread under mtx; the main thread reads it
+	// without.
+	std::mutex mtx;
+	std::unordered_map<SourcePawn::IPluginContext*, plugin_s> plugins;
+};
+
+extern NativeProfiler DebugNatives;
+
+#endif //_INCLUDE_NATIVEPROFILER_H_
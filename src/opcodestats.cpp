@@ -0,0 +1,75 @@
+#include "opcodestats.h"
+#include <smx/smx-v1-opcodes.h>
+#include <algorithm>
+#include <filesystem>
+#include <fmt/format.h>
+
+OpcodeStats DebugOpcodes;
+
+static const char* const kOpcodeNames[] = {
+#define _G(op, text, cells) text,
+#define _U(op, text) text,
+	OPCODE_LIST(_G, _U)
+#undef _U
+#undef _G
+};
+
+static const size_t kTopEntries = 20;
+
+static const char* opcodeName(uint32_t op) {
+	return op < sizeof(kOpcodeNames) / sizeof(kOpcodeNames[0]) ? kOpcodeNames[op] : "?";
+}
+
+std::vector<std::string> OpcodeStats::table(SourcePawn::IPluginRuntime* runtime, bool reset) {
+	std::vector<std::string> lines;
+#if SOURCEPAWN_API_VERSION >= 0x0216
+	const uint64_t* counts;
+	const uint64_t* pairs;
+	uint32_t total = runtime->GetOpcodeStats(&counts, &pairs);
+	if (!total || !counts)
+		return lines;
+
+	uint64_t executed = 0;
+	std::vector<std::pair<uint64_t, uint32_t>> ops;
+	for (uint32_t i = 0; i < total; i++) {
+		executed += counts[i];
+		if (counts[i])
+			ops.emplace_back(counts[i], i);
+	}
+	if (!executed)
+		return lines;
+
+	auto top = [](std::vector<std::pair<uint64_t, uint32_t>>& entries) {
+		size_t n = std::min(entries.size(), kTopEntries);
+		std::partial_sort(entries.begin(), entries.begin() + n, entries.end(),
+			[](const auto& a, const auto& b) { return a.first > b.first; });
+		entries.resize(n);
+	};
+
+	lines.push_back(fmt::format("{}: {} opcodes interpreted",
+		std::filesystem::path(runtime->GetFilename()).filename().string(), executed));
+	top(ops);
+	for (const auto& op : ops)
+		lines.push_back(fmt::format("  {:>14} {:>6.2f}%  {}", op.first,
+			op.first * 100.0 / executed, opcodeName(op.second)));
+
+	if (pairs) {
+		std::vector<std::pair<uint64_t, uint32_t>> pair_counts;
+		for (uint32_t i = 0; i < total * total; i++) {
+			if (pairs[i])
+				pair_counts.emplace_back(pairs[i], i);
+		}
+		top(pair_counts);
+		if (!pair_counts.empty())
+			lines.push_back("  pairs:");
+		for (const auto& pair : pair_counts)
+			lines.push_back(fmt::format("  {:>14} {:>6.2f}%  {} -> {}", pair.first,
+				pair.first * 100.0 / executed, opcodeName(pair.second / total),
+				opcodeName(pair.second % total)));
+	}
+
+	if (reset)
+		runtime->ResetOpcodeStats();
+#endif
+	return lines;
+}
@@ -0,0 +1,22 @@
+#ifndef _INCLUDE_OPCODESTATS_H_
+#define _INCLUDE_OPCODESTATS_H_
+
+#include <sp_vm_api.h>
+#include <string>
+#include <vector>
+
+//
+//  Reports the opcode counts the interpreter keeps per plugin in VMs built
+//  with SP_OPCODE_STATS: which opcodes and opcode pairs interpreted plugins
+//  run most.
+//
+class OpcodeStats {
+public:
+	// Lines listing the busiest opcodes and pairs of |runtime|, or nothing
+	// if its opcodes aren't counted. Main thread only.
+	std::vector<std::string> table(SourcePawn::IPluginRuntime* runtime, bool reset);
+};
+
+extern OpcodeStats DebugOpcodes;
+
+#endif //_INCLUDE_OPCODESTATS_H_
@@ -0,0 +1,221 @@
+#include "overhead.h"
+#include <algorithm>
+#include <filesystem>
+#include <fmt/format.h>
+
+OverheadCounters DebugOverhead;
+TickBudget DebugBudget;
+
+static void addMax(std::atomic<uint64_t>& max, uint64_t value) {
+	uint64_t seen = max.load(std::memory_order_relaxed);
+	while (value > seen && !max.compare_exchange_weak(seen, value, std::memory_order_relaxed))
+		;
+}
+
+static void addMax(std::atomic<uint32_t>& max, uint32_t value) {
+	uint32_t seen = max.load(std::memory_order_relaxed);
+	while (value > seen && !max.compare_exchange_weak(seen, value, std::memory_order_relaxed))
+		;
+}
+
+static uint64_t take(std::atomic<uint64_t>& counter, bool reset) {
+	return reset ? counter.exchange(0, std::memory_order_relaxed) : counter.load(std::memory_order_relaxed);
+}
+
+void OverheadCounters::traffic_s::reset() {
+	bytes_sent = 0;
+	messages_sent = 0;
+	bytes_received = 0;
+	messages_received = 0;
+	blocked = 0;
+}
+
+OverheadCounters::counter_s* OverheadCounters::counterOf(SourcePawn::IPluginContext* ctx) {
+	std::lock_guard<std::mutex> lock(mtx);
+	auto& entry = plugins[ctx];
+	if (!entry) {
+		entry = std::make_unique<counter_s>();
+		entry->plugin = std::filesystem::path(ctx->GetRuntime()->GetFilename()).filename().string();
+	}
+	return entry.get();
+}
+
+void OverheadCounters::onBreak(SourcePawn::IPluginContext* ctx) {
+	// Consecutive breaks are nearly always in the same plugin.
+	struct cache_s {
+		SourcePawn::IPluginContext* ctx = nullptr;
+		counter_s* counter = nullptr;
+		uint32_t generation = 0;
+	};
+	thread_local cache_s cache;
+
+	uint32_t current = generation.load(std::memory_order_acquire);
+	if (cache.ctx != ctx || cache.generation != current) {
+		cache.ctx = ctx;
+		cache.counter = counterOf(ctx);
+		cache.generation = current;
+	}
+	cache.counter->breaks.fetch_add(1, std::memory_order_relaxed);
+	breaks_.fetch_add(1, std::memory_order_relaxed);
+	if (memory_env)
+		sample(*cache.counter, ctx);
+}
+
+void OverheadCounters::sampleMemory(SourcePawn::IPluginContext* ctx) {
+	if (!memory_env)
+		return;
+	auto& counter = *counterOf(ctx);
+	sample(counter, ctx);
+#if SOURCEPAWN_API_VERSION >= 0x0227
+	SourcePawn::sp_memory_usage_t peaks;
+	if (memory_env->ApiVersion() < 0x0227 || !memory_env->GetMemoryPeaks(ctx, &peaks, true))
+		return;
+	addMax(counter.heap_peak, peaks.heap);
+	addMax(counter.stack_peak, peaks.stack);
+	addMax(counter.used_peak, peaks.heap + peaks.stack);
+#endif
+}
+
+void OverheadCounters::sample(counter_s& counter, SourcePawn::IPluginContext* ctx) {
+#if SOURCEPAWN_API_VERSION >= 0x021D
+	SourcePawn::sp_memory_usage_t usage;
+	if (!memory_env->GetMemoryUsage(ctx, &usage))
+		return;
+	counter.data.store(usage.data, std::memory_order_relaxed);
+	counter.heap_stack.store(usage.heap_stack, std::memory_order_relaxed);
+	counter.heap.store(usage.heap, std::memory_order_relaxed);
+	counter.stack.store(usage.stack, std::memory_order_relaxed);
+	addMax(counter.heap_peak, usage.heap);
+	addMax(counter.stack_peak, usage.stack);
+	addMax(counter.used_peak, usage.heap + usage.stack);
+#endif
+}
+
+void OverheadCounters::addHandlerTime(uint64_t nanoseconds) {
+	handled_.fetch_add(1, std::memory_order_relaxed);
+	handler_time_.fetch_add(nanoseconds, std::memory_order_relaxed);
+	addMax(handler_max_, nanoseconds);
+}
+
+void OverheadCounters::addBlocked(uint64_t nanoseconds) {
+	blocked_.fetch_add(nanoseconds, std::memory_order_relaxed);
+}
+
+void OverheadCounters::addImageLoad(uint64_t nanoseconds) {
+	image_loads_.fetch_add(1, std::memory_order_relaxed);
+	image_load_time_.fetch_add(nanoseconds, std::memory_order_relaxed);
+	addMax(image_load_max_, nanoseconds);
+}
+
+void OverheadCounters::removePlugin(SourcePawn::IPluginContext* ctx) {
+	std::lock_guard<std::mutex> lock(mtx);
+	auto found = plugins.find(ctx);
+	if (found == plugins.end())
+		return;
+	retired.push_back(std::move(found->second));
+	plugins.erase(found);
+	generation.fetch_add(1, std::memory_order_release);
+}
+
+OverheadCounters::totals_s OverheadCounters::snapshot(bool reset) {
+	totals_s totals;
+	totals.breaks = take(breaks_, reset);
+	totals.handled = take(handled_, reset);
+	totals.handler_time = take(handler_time_, reset);
+	totals.handler_max = take(handler_max_, reset);
+	totals.image_loads = take(image_loads_, reset);
+	totals.image_load_time = take(image_load_time_, reset);
+	totals.image_load_max = take(image_load_max_, reset);
+	totals.blocked = take(blocked_, reset);
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		for (auto& entry : plugins) {
+			auto& counter = *entry.second;
+			uint64_t breaks = take(counter.breaks, reset);
+			uint32_t heap_stack = counter.heap_stack.load(std::memory_order_relaxed);
+			if (!breaks && !heap_stack)
+				continue;
+			totals.plugins.push_back({ counter.plugin, breaks,
+				counter.data.load(std::memory_order_relaxed),
+				heap_stack,
+				counter.heap.load(std::memory_order_relaxed),
+				counter.stack.load(std::memory_order_relaxed),
+				counter.heap_peak.load(std::memory_order_relaxed),
+				counter.stack_peak.load(std::memory_order_relaxed),
+				counter.used_peak.load(std::memory_order_relaxed) });
+			if (reset) {
+				counter.heap_peak = 0;
+				counter.stack_peak = 0;
+				counter.used_peak = 0;
+			}
+		}
+	}
+	std::sort(totals.plugins.begin(), totals.plugins.end(), [](const plugin_s& a, const plugin_s& b) {
+		return a.breaks > b.breaks;
+	});
+	return totals;
+}
+
+std::vector<std::string> OverheadCounters::table(bool reset) {
+	auto totals = snapshot(reset);
+	std::vector<std::string> lines;
+	lines.push_back(fmt::format("debug breaks {:>12}, {} handled in {:.1f} us (max {:.1f} us)",
+		totals.breaks, totals.handled, totals.handler_time / 1000.0, totals.handler_max / 1000.0));
+	lines.push_back(fmt::format("image loads  {:>12} in {:.1f} us (max {:.1f} us)",
+		totals.image_loads, totals.image_load_time / 1000.0, totals.image_load_max / 1000.0));
+	lines.push_back(fmt::format("stopped      {:>12.1f} us", totals.blocked / 1000.0));
+	for (const auto& plugin : totals.plugins) {
+		if (plugin.heap_stack)
+			lines.push_back(fmt::format("{:>12} breaks  {}, heap and stack peak {} of {} bytes", plugin.breaks,
+				plugin.plugin, plugin.used_peak, plugin.heap_stack));
+		else
+			lines.push_back(fmt::format("{:>12} breaks  {}", plugin.breaks, plugin.plugin));
+	}
+	return lines;
+}
+
+TickBudget::scope_s::scope_s() : timing(DebugBudget.budget() != 0) {
+	if (!timing)
+		return;
+	start = std::chrono::steady_clock::now();
+	blocked = DebugOverhead.blocked();
+}
+
+TickBudget::scope_s::~scope_s() {
+	if (!timing)
+		return;
+	int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start).count();
+	int64_t cost = elapsed - int64_t(DebugOverhead.blocked() - blocked);
+	if (cost > 0)
+		DebugBudget.tick_ns.fetch_add(uint64_t(cost), std::memory_order_relaxed);
+}
+
+TickBudget::step_e TickBudget::endTick(uint64_t* cost) {
+	*cost = tick_ns.exchange(0, std::memory_order_relaxed);
+	uint64_t limit = budget();
+	if (!limit)
+		return Hold;
+	if (settle) {
+		settle--;
+		return Hold;
+	}
+	if (*cost > limit) {
+		cheap = 0;
+		// Disarmed again: a client may have turned something back on.
+		if (level_ != Disarmed)
+			level_ = level_e(level_ + 1);
+		settle = kSettleTicks;
+		return Degrade;
+	}
+	if (*cost * 2 > limit || level_ == Full) {
+		cheap = 0;
+		return Hold;
+	}
+	if (++cheap < kRecoverTicks)
+		return Hold;
+	cheap = 0;
+	level_ = level_e(level_ - 1);
+	settle = kSettleTicks;
+	return Recover;
+}
@@ -0,0 +1,187 @@
+#ifndef _INCLUDE_OVERHEAD_H_
+#define _INCLUDE_OVERHEAD_H_
+
+#include <sp_vm_api.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//
+//  What the loaded debugger costs the server: debug breaks per plugin, time
+//  spent handling the breaks a client is interested in, image loads, and
+//  time the game thread stood still at a stop. Each client counts its own
+//  traffic in a traffic_s. Everything is a relaxed atomic, so counting is a
+//  few increments and reading never blocks the game thread.
+//
+class OverheadCounters {
+public:
+	struct traffic_s {
+		std::atomic<uint64_t> bytes_sent{ 0 };
+		std::atomic<uint64_t> messages_sent{ 0 };
+		std::atomic<uint64_t> bytes_received{ 0 };
+		std::atomic<uint64_t> messages_received{ 0 };
+		std::atomic<uint64_t> blocked{ 0 };		// nanoseconds
+
+		void reset();
+	};
+
+	struct plugin_s {
+		std::string plugin;
+		uint64_t breaks;
+		// Bytes, with trackMemory(); the current values are the last sample
+		// and the peaks the most seen at debug breaks and samples.
+		uint32_t data;
+		uint32_t heap_stack;
+		uint32_t heap;
+		uint32_t stack;
+		uint32_t heap_peak;
+		uint32_t stack_peak;
+		// Heap and stack in use at once; at heap_stack they collide.
+		uint32_t used_peak;
+	};
+
+	struct totals_s {
+		uint64_t breaks;
+		uint64_t handled;			// breaks some client looked at
+		uint64_t handler_time;		// nanoseconds, stops excluded
+		uint64_t handler_max;
+		uint64_t image_loads;
+		uint64_t image_load_time;	// nanoseconds
+		uint64_t image_load_max;
+		uint64_t blocked;			// nanoseconds
+		std::vector<plugin_s> plugins;
+	};
+
+	// Debug breaks also note how much heap and stack the plugin uses. Only
+	// VMs with API version 0x021D or later tell.
+	void trackMemory(SourcePawn::ISourcePawnEnvironment* env) {
+		memory_env = env;
+	}
+	bool tracksMemory() const {
+		return memory_env != nullptr;
+	}
+	// Samples a plugin's memory outside of debug breaks, so plugins that
+	// never reach one are measured too. Between calls into a plugin its heap
+	// and stack are empty, so the peaks come from the high-water marks the
+	// VM finds in its memory, on VMs with API version 0x0227 or later. Game
+	// thread, every kSampleInterval.
+	static constexpr auto kSampleInterval = std::chrono::seconds(1);
+	void sampleMemory(SourcePawn::IPluginContext* ctx);
+
+	// Game thread. Once per debug break.
+	void onBreak(SourcePawn::IPluginContext* ctx);
+	void addHandlerTime(uint64_t nanoseconds);
+	void addBlocked(uint64_t nanoseconds);
+	uint64_t blocked() const {
+		return blocked_.load(std::memory_order_relaxed);
+	}
+
+	// Any thread.
+	void addImageLoad(uint64_t nanoseconds);
+
+	void removePlugin(SourcePawn::IPluginContext* ctx);
+
+	// Plugins sorted by breaks, busiest first.
+	totals_s snapshot(bool reset);
+	std::vector<std::string> table(bool reset);
+
+private:
+	struct counter_s {
+		std::string plugin;
+		std::atomic<uint64_t> breaks{ 0 };
+		std::atomic<uint32_t> data{ 0 };
+		std::atomic<uint32_t> heap_stack{ 0 };
+		std::atomic<uint32_t> heap{ 0 };
+		std::atomic<uint32_t> stack{ 0 };
+		std::atomic<uint32_t> heap_peak{ 0 };
+		std::atomic<uint32_t> stack_peak{ 0 };
+		std::atomic<uint32_t> used_peak{ 0 };
+	};
+	counter_s* counterOf(SourcePawn::IPluginContext* ctx);
+	void sample(counter_s& counter, SourcePawn::IPluginContext* ctx);
+
+	std::atomic<uint64_t> breaks_{ 0 };
+	std::atomic<uint64_t> handled_{ 0 };
+	std::atomic<uint64_t> handler_time_{ 0 };
+	std::atomic<uint64_t> handler_max_{ 0 };
+	std::atomic<uint64_t> image_loads_{ 0 };
+	std::atomic<uint64_t> image_load_time_{ 0 };
+	std::atomic<uint64_t> image_load_max_{ 0 };
+	std::atomic<uint64_t> blocked_{ 0 };
+	SourcePawn::ISourcePawnEnvironment* memory_env = nullptr;
+
+	std::mutex mtx;
+	std::unordered_map<SourcePawn::IPluginContext*, std::unique_ptr<counter_s>> plugins;
+	// Counters of unloaded plugins stay allocated, since a thread may still
+	// have one cached. They are a few bytes per plugin load.
+	std::vector<std::unique_ptr<counter_s>> retired;
+	std::atomic<uint32_t> generation{ 0 };
+};
+
+extern OverheadCounters DebugOverhead;
+
+//
+//  Keeps the debugger's game-thread cost per tick under a configured budget.
+//  Debug breaks and error reports charge their time, less any stops, to the
+//  current tick; at the end of each tick a tick over budget moves one level
+//  down, and a long run of cheap ticks moves one level back up.
+//
+class TickBudget {
+public:
+	enum level_e {
+		Full,			// everything as the clients asked
+		SlowSampling,	// the profiler samples less often
+		NoLogpoints,	// logpoint output is dropped and counted
+		Disarmed,		// tracing, coverage and profiling are off
+	};
+	enum step_e { Hold, Degrade, Recover };
+
+	// Ticks to wait after a change before judging its effect, and cheap
+	// ticks in a row before recovering a level.
+	static constexpr uint32_t kSettleTicks = 8;
+	static constexpr uint32_t kRecoverTicks = 1000;
+
+	// Microseconds per tick; 0 turns the guard off.
+	void setBudget(uint32_t us) {
+		budget_ns.store(uint64_t(us) * 1000, std::memory_order_relaxed);
+	}
+	uint64_t budget() const {
+		return budget_ns.load(std::memory_order_relaxed);
+	}
+	level_e level() const {
+		return level_;
+	}
+
+	// Charges the game-thread time from construction to destruction, less
+	// any stops, to the current tick.
+	class scope_s {
+	public:
+		scope_s();
+		~scope_s();
+
+	private:
+		std::chrono::steady_clock::time_point start;
+		uint64_t blocked = 0;
+		bool timing;
+	};
+
+	// Game thread, once per tick. |cost| receives the tick's cost in
+	// nanoseconds.
+	step_e endTick(uint64_t* cost);
+
+private:
+	std::atomic<uint64_t> budget_ns{ 0 };
+	std::atomic<uint64_t> tick_ns{ 0 };
+	level_e level_ = Full;
+	uint32_t settle = 0;
+	uint32_t cheap = 0;
+};
+
+extern TickBudget DebugBudget;
+
+#endif //_INCLUDE_OVERHEAD_H_
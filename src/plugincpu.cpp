@@ -0,0 +1,97 @@
+#include "plugincpu.h"
+#include <algorithm>
+#include <filesystem>
+#include <fmt/format.h>
+
+PluginCpu DebugCpu;
+
+bool PluginCpu::setEnvironment(SourcePawn::ISourcePawnEnvironment* env) {
+#if SOURCEPAWN_API_VERSION >= 0x0220
+	if (env->ApiVersion() < 0x0220 || !env->EnableCpuAccounting())
+		return false;
+	env_ = env;
+	return true;
+#else
+	return false;
+#endif
+}
+
+void PluginCpu::beginSample(std::chrono::steady_clock::time_point now) {
+	std::lock_guard<std::mutex> lock(mtx);
+	times[samples % kSamples] = now;
+	samples++;
+}
+
+void PluginCpu::sample(SourcePawn::IPluginContext* ctx) {
+#if SOURCEPAWN_API_VERSION >= 0x0220
+	SourcePawn::sp_cpu_usage_t usage;
+	if (!env_ || !env_->GetCpuUsage(ctx, &usage))
+		return;
+	std::lock_guard<std::mutex> lock(mtx);
+	if (!samples)
+		return;
+	uint64_t current = samples - 1;
+	auto& entry = plugins[ctx];
+	if (!entry) {
+		entry = std::make_unique<counter_s>();
+		entry->plugin = std::filesystem::path(ctx->GetRuntime()->GetFilename()).filename().string();
+		entry->first = current;
+	}
+	entry->nanoseconds[current % kSamples] = usage.nanoseconds;
+	entry->invocations[current % kSamples] = usage.invocations;
+#endif
+}
+
+void PluginCpu::removePlugin(SourcePawn::IPluginContext* ctx) {
+	std::lock_guard<std::mutex> lock(mtx);
+	plugins.erase(ctx);
+}
+
+PluginCpu::window_s PluginCpu::top(uint32_t seconds) {
+	window_s window;
+	std::lock_guard<std::mutex> lock(mtx);
+	if (!samples)
+		return window;
+	uint64_t last = samples - 1;
+	uint64_t oldest = samples > kSamples ? samples - kSamples : 0;
+	auto end = times[last % kSamples];
+	auto wanted = end - std::chrono::seconds(seconds);
+	// The latest sample at or before the start of the window, or the oldest
+	// one if the ring does not reach back that far.
+	uint64_t start = last;
+	while (start > oldest && times[start % kSamples] > wanted)
+		start--;
+	window.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		end - times[start % kSamples]).count();
+
+	for (auto& entry : plugins) {
+		auto& counter = *entry.second;
+		// Plugins loaded during the window count from their first sample.
+		uint64_t from = std::max(start, counter.first);
+		uint64_t ns = counter.nanoseconds[last % kSamples];
+		uint64_t invocations = counter.invocations[last % kSamples];
+		if (!ns && !invocations)
+			continue;
+		window.plugins.push_back({ counter.plugin, ns - counter.nanoseconds[from % kSamples],
+			invocations - counter.invocations[from % kSamples], ns, invocations });
+	}
+	std::sort(window.plugins.begin(), window.plugins.end(), [](const plugin_s& a, const plugin_s& b) {
+		return a.nanoseconds > b.nanoseconds;
+	});
+	return window;
+}
+
+std::vector<std::string> PluginCpu::table(uint32_t seconds) {
+	auto window = top(seconds);
+	std::vector<std::string> lines;
+	double span = window.nanoseconds / 1e9;
+	lines.push_back(fmt::format("plugin time over the last {:.0f} s", span));
+	for (const auto& plugin : window.plugins) {
+		if (!plugin.nanoseconds && !plugin.invocations)
+			continue;
+		double share = window.nanoseconds ? 100.0 * plugin.nanoseconds / window.nanoseconds : 0.0;
+		lines.push_back(fmt::format("{:>10.1f} ms {:>6.2f}% {:>10} calls  {}", plugin.nanoseconds / 1e6, share,
+			plugin.invocations, plugin.plugin));
+	}
+	return lines;
+}
@@ -0,0 +1,76 @@
+#ifndef _INCLUDE_PLUGINCPU_H_
+#define _INCLUDE_PLUGINCPU_H_
+
+#include <sp_vm_api.h>
+#include <stdint.h>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//
+//  Time each plugin's code ran and how often it was called into, as the VM
+//  charges them at entries into and exits from the VM. The running totals
+//  are sampled once a second into a ring, so the busiest plugins of the last
+//  few seconds or minutes can be listed at any time without the VM keeping
+//  more than two counters per plugin.
+//
+class PluginCpu {
+public:
+	static constexpr auto kSampleInterval = std::chrono::seconds(1);
+	// Five minutes of samples, plus the one the oldest window starts at.
+	static constexpr size_t kSamples = 301;
+
+	struct plugin_s {
+		std::string plugin;
+		uint64_t nanoseconds;		// in the window
+		uint64_t invocations;
+		uint64_t total_nanoseconds;	// since the plugin loaded
+		uint64_t total_invocations;
+	};
+
+	struct window_s {
+		uint64_t nanoseconds = 0;	// length of the window actually covered
+		std::vector<plugin_s> plugins;
+	};
+
+	// Only VMs with API version 0x0220 or later account time, and only if
+	// told to before any plugin code runs.
+	bool setEnvironment(SourcePawn::ISourcePawnEnvironment* env);
+	bool available() const {
+		return env_ != nullptr;
+	}
+
+	// Game thread, every kSampleInterval: beginSample(), then sample() for
+	// each loaded plugin.
+	void beginSample(std::chrono::steady_clock::time_point now);
+	void sample(SourcePawn::IPluginContext* ctx);
+
+	void removePlugin(SourcePawn::IPluginContext* ctx);
+
+	// Plugins over the last |seconds|, or as much of it as was sampled,
+	// busiest first. Plugins that never ran are left out.
+	window_s top(uint32_t seconds);
+	std::vector<std::string> table(uint32_t seconds);
+
+private:
+	struct counter_s {
+		std::string plugin;
+		uint64_t first;				// sample the plugin was first seen at
+		uint64_t nanoseconds[kSamples];
+		uint64_t invocations[kSamples];
+	};
+
+	SourcePawn::ISourcePawnEnvironment* env_ = nullptr;
+
+	std::mutex mtx;
+	uint64_t samples = 0;
+	std::chrono::steady_clock::time_point times[kSamples];
+	std::unordered_map<SourcePawn::IPluginContext*, std::unique_ptr<counter_s>> plugins;
+};
+
+extern PluginCpu DebugCpu;
+
+#endif //_INCLUDE_PLUGINCPU_H_
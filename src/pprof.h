@@ -0,0 +1,68 @@
+#ifndef _INCLUDE_PPROF_H_
+#define _INCLUDE_PPROF_H_
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <zlib.h>
+
+//
+//  Protocol buffer wire format, as much of it as pprof's profile.proto
+//  needs, for the profilers that export to it.
+//
+struct proto_s {
+	std::string out;
+
+	void varint(uint64_t value) {
+		for (; value >= 0x80; value >>= 7)
+			out += char(value | 0x80);
+		out += char(value);
+	}
+	void uint(uint32_t field, uint64_t value) {
+		varint(uint64_t(field) << 3);
+		varint(value);
+	}
+	void bytes(uint32_t field, const std::string& value) {
+		varint((uint64_t(field) << 3) | 2);
+		varint(value.size());
+		out += value;
+	}
+	void packed(uint32_t field, const std::vector<uint64_t>& values) {
+		proto_s inner;
+		for (uint64_t value : values)
+			inner.varint(value);
+		bytes(field, inner.out);
+	}
+};
+
+// Index into the string table, which starts with "" as pprof requires.
+struct strings_s {
+	std::vector<std::string> table{ "" };
+	std::unordered_map<std::string, uint64_t> index{ { "", 0 } };
+
+	uint64_t operator()(const std::string& value) {
+		auto found = index.emplace(value, table.size());
+		if (found.second)
+			table.push_back(value);
+		return found.first->second;
+	}
+};
+
+// Whether a dump named |path| is written as a pprof profile.
+inline bool isPprofPath(const std::string& path) {
+	static const char kPprof[] = ".pb.gz";
+	return path.size() > sizeof(kPprof) - 1 &&
+		path.compare(path.size() - (sizeof(kPprof) - 1), std::string::npos, kPprof) == 0;
+}
+
+// Writes |data| to |path|, gzipped as pprof reads profiles.
+inline bool writeGzipped(const std::string& path, const std::string& data) {
+	gzFile file = gzopen(path.c_str(), "wb");
+	if (!file)
+		return false;
+	bool written = data.empty() || gzwrite(file, data.data(), unsigned(data.size())) == int(data.size());
+	return gzclose(file) == Z_OK && written;
+}
+
+#endif //_INCLUDE_PPROF_H_
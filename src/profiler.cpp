@@ -0,0 +1,294 @@
+#include "profiler.h"
+#include "pprof.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <fmt/format.h>
+
+SampleProfiler DebugProfiler;
+
+void SampleProfiler::start(uint32_t interval_us) {
+	std::lock_guard<std::mutex> control(control_mtx);
+	if (running.exchange(false)) {
+		timer_cv.notify_one();
+		worker.join();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(results_mtx);
+		drainLocked();
+		resetLocked();
+	}
+	ring_idle = 0;
+	ring_dropped = 0;
+	requested = false;
+	interval = interval_us;
+	running = true;
+	worker = std::thread(&SampleProfiler::timer, this, interval_us);
+}
+
+void SampleProfiler::stop() {
+	std::lock_guard<std::mutex> control(control_mtx);
+	if (!running.exchange(false))
+		return;
+	timer_cv.notify_one();
+	worker.join();
+	requested = false;
+}
+
+void SampleProfiler::timer(uint32_t interval_us) {
+	std::unique_lock<std::mutex> lock(timer_mtx);
+	while (running) {
+		timer_cv.wait_for(lock, std::chrono::microseconds(uint64_t(interval_us) * slowdown));
+		if (!running)
+			break;
+		// Nothing ran a BREAK since the last request, so the time went to
+		// the game rather than to plugins.
+		if (requested.exchange(true))
+			ring_idle++;
+	}
+}
+
+void SampleProfiler::sample(SourcePawn::IPluginContext* ctx) {
+	if (!requested.exchange(false))
+		return;
+
+	uint32_t position = head.load(std::memory_order_relaxed);
+	if (position - tail.load(std::memory_order_acquire) >= kRingSize) {
+		ring_dropped++;
+		return;
+	}
+
+	sample_s& entry = ring[position % kRingSize];
+	entry.depth = 0;
+#if SOURCEPAWN_API_VERSION >= 0x0221
+	if (capture_env) {
+		SourcePawn::sp_stack_frame_t frames[kMaxDepth];
+		entry.depth = uint32_t(capture_env->CaptureStack(frames, kMaxDepth));
+		for (uint32_t i = 0; i < entry.depth; i++)
+			entry.frames[i] = { frames[i].context, nullptr, frames[i].function, frames[i].native };
+		head.store(position + 1, std::memory_order_release);
+		return;
+	}
+#endif
+	SourcePawn::IFrameIterator* iter = ctx->CreateFrameIterator();
+	for (; !iter->Done() && entry.depth < kMaxDepth; iter->Next()) {
+		if (iter->IsScriptedFrame())
+			entry.frames[entry.depth++] = { iter->Context(), iter->FunctionName(), 0, -1 };
+		else if (iter->IsNativeFrame())
+			entry.frames[entry.depth++] = { nullptr, iter->FunctionName(), 0, 0 };
+	}
+	ctx->DestroyFrameIterator(iter);
+	head.store(position + 1, std::memory_order_release);
+}
+
+void SampleProfiler::drain() {
+	std::lock_guard<std::mutex> lock(results_mtx);
+	drainLocked();
+}
+
+void SampleProfiler::removePlugin(SourcePawn::IPluginContext* ctx) {
+	std::lock_guard<std::mutex> lock(results_mtx);
+	drainLocked();
+	// A later plugin may get the same context and addresses.
+	interned.clear();
+}
+
+void SampleProfiler::resetLocked() {
+	results = profile_s();
+	interned.clear();
+}
+
+// How the results name a frame: "plugin::function" for scripted frames and
+// the bare name for natives.
+static std::string frameName(SourcePawn::IPluginContext* context, const char* function, cell_t cip, int32_t native) {
+	if (function || !context) {
+		// Named when sampled; natives have no context then.
+		if (!function)
+			function = "?";
+		if (!context)
+			return function;
+	} else if (native >= 0) {
+		sp_native_t* info;
+		if (context->GetRuntime()->GetNativeByIndex(native, &info) == SP_ERROR_NONE && info->name)
+			return info->name;
+		return "?";
+	} else if (context->GetRuntime()->GetDebugInfo()->LookupFunction(cip, &function) != SP_ERROR_NONE) {
+		function = "?";
+	}
+	return fmt::format("{}::{}", std::filesystem::path(context->GetRuntime()->GetFilename()).filename().string(),
+		function);
+}
+
+SampleProfiler::interned_s SampleProfiler::intern(const sample_s& entry) {
+	interned_s stack;
+	stack.frames.assign(entry.frames, entry.frames + entry.depth);
+
+	// Folded stacks run from the root to the leaf.
+	std::string folded;
+	std::unordered_set<std::string> seen;
+	for (uint32_t i = entry.depth; i-- > 0;) {
+		const frame_s& frame = entry.frames[i];
+		std::string name = frameName(frame.context, frame.function, frame.cip, frame.native);
+		auto& counts = results.functions[name];
+		if (seen.insert(name).second)
+			stack.functions.push_back(&counts);
+		if (i == 0)
+			stack.leaf = &counts;
+		if (!folded.empty())
+			folded += ';';
+		folded += name;
+	}
+	stack.stack = &results.stacks[folded];
+	return stack;
+}
+
+void SampleProfiler::count(const interned_s& stack) {
+	for (auto function : stack.functions)
+		function->total++;
+	stack.leaf->self++;
+	(*stack.stack)++;
+}
+
+void SampleProfiler::drainLocked() {
+	uint32_t position = tail.load(std::memory_order_relaxed);
+	uint32_t end = head.load(std::memory_order_acquire);
+	for (; position != end; position++) {
+		const sample_s& entry = ring[position % kRingSize];
+		results.samples++;
+		if (!entry.depth)
+			continue;
+
+		uint64_t key = hash(entry);
+		auto found = interned.find(key);
+		if (found == interned.end()) {
+			found = interned.emplace(key, intern(entry)).first;
+		} else if (found->second.frames.size() != entry.depth ||
+			!std::equal(found->second.frames.begin(), found->second.frames.end(), entry.frames)) {
+			// Two stacks with one hash; the later one goes uncached.
+			count(intern(entry));
+			continue;
+		}
+		count(found->second);
+	}
+	tail.store(position, std::memory_order_release);
+	results.idle += ring_idle.exchange(0);
+	results.dropped += ring_dropped.exchange(0);
+}
+
+uint64_t SampleProfiler::hash(const sample_s& entry) {
+	uint64_t hash = 14695981039346656037ull;
+	auto mix = [&hash](uint64_t value) {
+		hash = (hash ^ value) * 1099511628211ull;
+	};
+	for (uint32_t i = 0; i < entry.depth; i++) {
+		const auto& frame = entry.frames[i];
+		mix(uintptr_t(frame.context));
+		mix(uintptr_t(frame.function));
+		mix((uint64_t(uint32_t(frame.cip)) << 32) | uint32_t(frame.native));
+	}
+	return hash;
+}
+
+SampleProfiler::profile_s SampleProfiler::snapshot(bool reset) {
+	std::lock_guard<std::mutex> lock(results_mtx);
+	drainLocked();
+	profile_s profile = results;
+	profile.interval_us = interval * slowdown;
+	if (reset)
+		resetLocked();
+	return profile;
+}
+
+std::string SampleProfiler::pprof(const profile_s& profile) {
+	// Field numbers from profile.proto.
+	enum {
+		ProfileSampleType = 1, ProfileSample = 2, ProfileLocation = 4, ProfileFunction = 5,
+		ProfileStringTable = 6, ProfilePeriodType = 11, ProfilePeriod = 12,
+		ValueTypeType = 1, ValueTypeUnit = 2,
+		SampleLocationId = 1, SampleValue = 2,
+		LocationId = 1, LocationLine = 4,
+		LineFunctionId = 1,
+		FunctionId = 1, FunctionName = 2, FunctionSystemName = 3, FunctionFilename = 4,
+	};
+	uint64_t period = uint64_t(profile.interval_us) * 1000;
+	strings_s strings;
+	proto_s out;
+
+	auto valueType = [&](uint32_t field, const char* type, const char* unit) {
+		proto_s value;
+		value.uint(ValueTypeType, strings(type));
+		value.uint(ValueTypeUnit, strings(unit));
+		out.bytes(field, value.out);
+	};
+	valueType(ProfileSampleType, "samples", "count");
+	valueType(ProfileSampleType, "cpu", "nanoseconds");
+
+	// One location per function; the folded names are "plugin::function"
+	// for scripted frames and the bare name for natives.
+	std::unordered_map<std::string, uint64_t> ids;
+	std::vector<const std::string*> functions;
+	std::vector<uint64_t> locations;
+	for (const auto& stack : profile.stacks) {
+		locations.clear();
+		size_t end = stack.first.size();
+		while (true) {
+			size_t start = stack.first.rfind(';', end ? end - 1 : 0);
+			start = start == std::string::npos ? 0 : start + 1;
+			auto found = ids.emplace(stack.first.substr(start, end - start), ids.size() + 1);
+			if (found.second)
+				functions.push_back(&found.first->first);
+			// Leaf first.
+			locations.push_back(found.first->second);
+			if (!start)
+				break;
+			end = start - 1;
+		}
+		proto_s sample;
+		sample.packed(SampleLocationId, locations);
+		sample.packed(SampleValue, { stack.second, stack.second * period });
+		out.bytes(ProfileSample, sample.out);
+	}
+
+	for (size_t i = 0; i < functions.size(); i++) {
+		const std::string& name = *functions[i];
+		size_t split = name.find("::");
+		proto_s line;
+		line.uint(LineFunctionId, i + 1);
+		proto_s location;
+		location.uint(LocationId, i + 1);
+		location.bytes(LocationLine, line.out);
+		out.bytes(ProfileLocation, location.out);
+
+		proto_s function;
+		function.uint(FunctionId, i + 1);
+		function.uint(FunctionName, strings(name));
+		function.uint(FunctionSystemName, strings(split == std::string::npos ? name : name.substr(split + 2)));
+		if (split != std::string::npos)
+			function.uint(FunctionFilename, strings(name.substr(0, split)));
+		out.bytes(ProfileFunction, function.out);
+	}
+
+	valueType(ProfilePeriodType, "cpu", "nanoseconds");
+	out.uint(ProfilePeriod, period);
+	for (const auto& string : strings.table)
+		out.bytes(ProfileStringTable, string);
+	return out.out;
+}
+
+bool SampleProfiler::dump(const std::string& path) {
+	auto profile = snapshot(false);
+	if (isPprofPath(path))
+		return writeGzipped(path, pprof(profile));
+
+	std::ofstream out(path, std::ios::trunc);
+	if (!out)
+		return false;
+	for (const auto& stack : profile.stacks)
+		out << stack.first << ' ' << stack.second << '\n';
+	return bool(out);
+}
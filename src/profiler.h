@@ -0,0 +1,163 @@
+#ifndef _INCLUDE_PROFILER_H_
+#define _INCLUDE_PROFILER_H_
+
+#include <sp_vm_api.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+//
+//  Sampling profiler for plugin code. A timer thread asks for a sample and
+//  the next BREAK that reaches the debugger records the scripted stack into
+//  a single-producer ring. The ring is folded into per-function counts and
+//  folded stacks (one "root;...;leaf" line per distinct stack) on demand,
+//  which flamegraph.pl takes as they are and pprof() turns into a profile
+//  for pprof.
+//
+//  With a VM that captures stacks without names (API 0x0221), samples hold
+//  function addresses and native indexes, and names are only looked up the
+//  first time a stack is drained. Each distinct stack is interned with its
+//  names and the results it counts into, so a repeated stack costs a hash
+//  and a few increments.
+//
+//  Frames point into plugin images, so the ring must be drained before a
+//  plugin goes away.
+//
+class SampleProfiler {
+public:
+	static constexpr size_t kMaxDepth = 32;
+	static constexpr size_t kRingSize = 4096;
+
+	struct function_s {
+		uint64_t self = 0;	// samples with the function on top
+		uint64_t total = 0;	// samples with the function anywhere
+	};
+	struct profile_s {
+		uint32_t interval_us = 0;
+		uint64_t samples = 0;
+		// Requests that found no plugin code running in time.
+		uint64_t idle = 0;
+		// Samples lost to a full ring.
+		uint64_t dropped = 0;
+		std::map<std::string, function_s> functions;
+		std::map<std::string, uint64_t> stacks;
+	};
+
+	// Samples capture stacks through |env|. Only VMs with API version
+	// 0x0221 or later can.
+	void setEnvironment(SourcePawn::ISourcePawnEnvironment* env) {
+		capture_env = env;
+	}
+
+	// Starts sampling every |interval_us| microseconds and drops the
+	// previous results. Safe to call from any thread.
+	void start(uint32_t interval_us);
+
+	// Stops the timer thread. The results are kept.
+	void stop();
+
+	// Samples every |factor| intervals instead of every one, until set back
+	// to 1. Kept across start().
+	void throttle(uint32_t factor) {
+		slowdown.store(factor ? factor : 1, std::memory_order_relaxed);
+	}
+
+	// Whether every BREAK has to reach the debugger.
+	bool active() const {
+		return running.load(std::memory_order_relaxed);
+	}
+
+	// Called at every BREAK that reaches the debugger. Main thread only.
+	void onBreak(SourcePawn::IPluginContext* ctx) {
+		if (requested.load(std::memory_order_relaxed))
+			sample(ctx);
+	}
+
+	// Folds the recorded samples into the results.
+	void drain();
+
+	// Drains the ring and forgets the interned stacks, which may name
+	// |ctx|. Before the plugin goes away.
+	void removePlugin(SourcePawn::IPluginContext* ctx);
+
+	// The results so far, optionally starting over.
+	profile_s snapshot(bool reset);
+
+	// Writes snapshot(false) to |path|: as a gzipped pprof profile if the
+	// name ends in ".pb.gz", as folded stacks otherwise.
+	bool dump(const std::string& path);
+
+	// |profile| in pprof's profile.proto encoding, uncompressed.
+	static std::string pprof(const profile_s& profile);
+
+private:
+	struct frame_s {
+		SourcePawn::IPluginContext* context;
+		// Named frames, from an IFrameIterator; otherwise null and the
+		// frame is the function at |cip| or the native at |native|.
+		const char* function;
+		cell_t cip;
+		int32_t native;
+
+		bool operator==(const frame_s& other) const {
+			return context == other.context && function == other.function &&
+				cip == other.cip && native == other.native;
+		}
+	};
+	struct sample_s {
+		uint32_t depth;
+		frame_s frames[kMaxDepth];
+	};
+	// A distinct stack and the results it counts into. Map nodes stay put,
+	// so the pointers hold until the results are started over.
+	struct interned_s {
+		std::vector<frame_s> frames;
+		uint64_t* stack;
+		function_s* leaf;
+		std::vector<function_s*> functions;	// each once
+	};
+
+	void sample(SourcePawn::IPluginContext* ctx);
+	void timer(uint32_t interval_us);
+	void drainLocked();
+	interned_s intern(const sample_s& entry);
+	static uint64_t hash(const sample_s& entry);
+	static void count(const interned_s& stack);
+	void resetLocked();
+
+	// Set by the timer, taken by the next BREAK.
+	std::atomic<bool> requested{ false };
+	std::atomic<bool> running{ false };
+	std::atomic<uint32_t> interval{ 0 };
+	std::atomic<uint32_t> slowdown{ 1 };
+
+	// Written by the main thread at head, read under results_mtx at tail.
+	sample_s ring[kRingSize];
+	std::atomic<uint32_t> head{ 0 };
+	std::atomic<uint32_t> tail{ 0 };
+	std::atomic<uint64_t> ring_dropped{ 0 };
+	std::atomic<uint64_t> ring_idle{ 0 };
+
+	SourcePawn::ISourcePawnEnvironment* capture_env = nullptr;
+
+	std::mutex results_mtx;
+	profile_s results;
+	// By a hash of the frames.
+	std::unordered_map<uint64_t, interned_s> interned;
+
+	// Serializes start() and stop().
+	std::mutex control_mtx;
+	std::mutex timer_mtx;
+	std::condition_variable timer_cv;
+	std::thread worker;
+};
+
+extern SampleProfiler DebugProfiler;
+
+#endif //_INCLUDE_PROFILER_H_
@@ -0,0 +1,258 @@
+#ifndef _INCLUDE_PROTOCOL_H_
+#define _INCLUDE_PROTOCOL_H_
+
+#include <stdint.h>
+
+//
+//  The wire protocol between the debugger and its clients. Every message is
+//  a little-endian uint32 payload length, a MessageType byte and the payload,
+//  in which strings are an int32 length, terminator included, then the bytes.
+//
+
+// Largest message accepted from a client, header included.
+#define MAX_MESSAGE_SIZE (1024 * 1024)
+
+enum DebugState {
+	DebugDead = -1,
+	DebugRun = 0,
+	DebugBreakpoint,
+	DebugPause,
+	DebugStepIn,
+	DebugStepOver,
+	DebugStepOut,
+	DebugException,
+	DebugStepInstruction
+};
+enum MessageType {
+	Diagnostics = 0,
+	RequestFile,
+	File,
+
+	StartDebugging,
+	StopDebugging,
+	Pause,
+	Continue,
+
+	RequestCallStack,
+	CallStack,
+
+	ClearBreakpoints,
+	SetBreakpoint,
+
+	HasStopped,
+	HasContinued,
+
+	StepOver,
+	StepIn,
+	StepOut,
+
+	RequestSetVariable,
+	SetVariable,
+	RequestVariables,
+	Variables,
+
+	RequestEvaluate,
+	Evaluate,
+
+	Disconnect,
+
+	RequestChildren,
+	Children,
+
+	SetStopSnapshot,
+	StopSnapshot,
+
+	SetCompression,
+	Compressed,
+
+	Hello,
+	Capabilities,
+
+	SetLogpoint,
+	LogMessages,
+
+	SetBreakpointCondition,
+
+	SetWatchpoint,
+	ClearWatchpoint,
+
+	SetTemporaryBreakpoint,
+
+	SetFunctionBreakpoint,
+	ClearFunctionBreakpoints,
+
+	StepInstruction,
+
+	SetExceptionFilter,
+
+	SetProfiler,
+	RequestProfile,
+	Profile,
+
+	SetCoverage,
+	RequestCoverage,
+	Coverage,
+
+	SetTracing,
+	RequestTrace,
+	Trace,
+
+	SetNativeProfiler,
+	RequestNativeProfile,
+	NativeProfile,
+
+	SetPublicProfiler,
+	RequestPublicProfile,
+	PublicProfile,
+
+	RequestOverhead,
+	Overhead,
+
+	SetSharedMemory,
+	SharedMemory,
+	SharedPayload,
+
+	// Only between sm_debugger_relay and its adapter.
+	Relayed,
+	RelayServers,
+
+	SetSnapshotpoint,
+	Snapshots,
+
+	SetStringLimit,
+
+	RequestMemory,
+	Memory,
+
+	RequestPluginCpu,
+	PluginCpu,
+
+	SetBreakpoints,
+	BreakpointsVerified,
+
+	Chunk,
+
+	RequestSource,
+	Source,
+
+	ListImages,
+	Images,
+
+	Disassemble,
+	Disassembly,
+
+	SetHeapProfiler,
+	RequestHeapProfile,
+	HeapProfile,
+
+	SetRecording,
+	RequestHistory,
+	History,
+
+	Heartbeat,
+	HeartbeatAck,
+
+	SetNativeBreakpoints,
+	SetPublicBreakpoints,
+	TotalMessages
+};
+
+//
+//  Optional protocol features. A client lists the ones it wants in Hello and
+//  the server answers with the subset it enabled for the connection; a
+//  client that never says Hello gets the legacy encoding.
+//
+#define PROTOCOL_VERSION 1
+enum Capability : uint32_t {
+	CapChildren = 1 << 0,		// RequestChildren pages values by handle
+	CapStopSnapshot = 1 << 1,	// SetStopSnapshot / StopSnapshot
+	CapCompression = 1 << 2,	// large messages arrive as Compressed
+	CapFrameScopes = 1 << 3,	// locals and evaluations per stack frame
+	CapDeltas = 1 << 4,			// unchanged values are sent as a marker
+	CapLogpoints = 1 << 5,		// SetLogpoint / LogMessages
+	CapConditions = 1 << 6,		// SetBreakpointCondition
+	CapWatchpoints = 1 << 7,	// SetWatchpoint / ClearWatchpoint, if the VM has them
+	CapTemporary = 1 << 8,		// SetTemporaryBreakpoint
+	CapFunctions = 1 << 9,		// SetFunctionBreakpoint / ClearFunctionBreakpoints
+	CapStepInstruction = 1 << 10,	// StepInstruction
+	CapExceptionFilters = 1 << 11,	// SetExceptionFilter, summaries as LogMessages
+	CapProfiler = 1 << 12,		// SetProfiler / RequestProfile / Profile
+	CapCoverage = 1 << 13,		// SetCoverage / RequestCoverage / Coverage
+	CapTracing = 1 << 14,		// SetTracing / RequestTrace / Trace, if the VM records them
+	CapNativeProfiler = 1 << 15,	// SetNativeProfiler / RequestNativeProfile / NativeProfile, if the VM rebinds natives
+	CapPublicProfiler = 1 << 16,	// SetPublicProfiler / RequestPublicProfile / PublicProfile, if the VM times calls
+	CapOverhead = 1 << 17,		// RequestOverhead / Overhead
+	CapSharedMemory = 1 << 18,	// SetSharedMemory / SharedMemory / SharedPayload
+	CapSnapshots = 1 << 19,		// SetSnapshotpoint / Snapshots
+	CapMemory = 1 << 20,		// RequestMemory / Memory
+	CapPluginCpu = 1 << 21,		// RequestPluginCpu / PluginCpu, if the VM accounts time
+	CapBatchBreakpoints = 1 << 22,	// SetBreakpoints
+	CapVerifiedBreakpoints = 1 << 23,	// BreakpointsVerified
+	CapChunks = 1 << 24,		// large replies arrive as Chunk messages, between control messages
+	CapImageHashes = 1 << 25,	// HasStopped ends in the stopped plugin's uint64 image hash
+	CapSources = 1 << 26,		// RequestSource / Source, if the server has a source root
+	CapImages = 1 << 27,		// ListImages / Images
+	CapDisassembly = 1 << 28,	// Disassemble / Disassembly
+	CapHeapProfiler = 1 << 29,	// SetHeapProfiler / RequestHeapProfile / HeapProfile, if the VM samples the heap
+	CapRecording = 1 << 30,		// SetRecording / RequestHistory / History, if the VM reports memory use
+	CapObserver = 1u << 31,		// read-only: gets the other clients' stops, logpoints and profiles
+	ServerCapabilities = CapChildren | CapStopSnapshot | CapCompression |
+		CapFrameScopes | CapDeltas | CapLogpoints | CapConditions | CapWatchpoints |
+		CapTemporary | CapFunctions | CapStepInstruction | CapExceptionFilters |
+		CapProfiler | CapCoverage | CapTracing | CapNativeProfiler | CapPublicProfiler |
+		CapOverhead | CapSharedMemory | CapSnapshots | CapMemory | CapPluginCpu |
+		CapBatchBreakpoints | CapVerifiedBreakpoints | CapChunks | CapImageHashes |
+		CapSources | CapImages | CapDisassembly | CapHeapProfiler | CapRecording |
+		CapObserver,
+	// What an observer may have. It is always sent stops as HasStopped with
+	// the image hash, timings and a full StopSnapshot, whether it asked or
+	// not.
+	ObserverCapabilities = CapObserver | CapStopSnapshot | CapImageHashes | CapLogpoints |
+		CapProfiler | CapChunks | CapSources | CapImages
+};
+// Capabilities past the first 32, in the word that follows them in Hello
+// and Capabilities; a client that leaves it out asks for none.
+enum ExtendedCapability : uint32_t {
+	CapTimings = 1 << 0,		// Heartbeat / HeartbeatAck, timings in HasStopped and HasContinued
+	CapNativeBreakpoints = 1 << 1,	// SetNativeBreakpoints, if the VM rebinds natives
+	CapPublicBreakpoints = 1 << 2,	// SetPublicBreakpoints, if the VM hooks public entry
+	ServerExtendedCapabilities = CapTimings | CapNativeBreakpoints | CapPublicBreakpoints
+};
+// How often a client with CapTimings is sent a Heartbeat.
+#define HEARTBEAT_INTERVAL_MS 1000
+// Outcome of a RequestSource.
+enum SourceStatus {
+	SourceSent = 0,		// the bytes follow
+	SourceUnchanged,	// the client's copy has the hash it named
+	SourceMissing		// unknown image or file index, or no such file under the root
+};
+// Threshold used when compression is negotiated without SetCompression.
+#define DEFAULT_COMPRESS_THRESHOLD 4096
+// Bytes of a string value shown before it is cut, unless SetStringLimit
+// says otherwise. Cut strings end in "... (N more bytes)".
+#define DEFAULT_STRING_LIMIT 4096
+// A memory read is answered in Memory messages of at most this many bytes,
+// and a longer read than MAX_MEMORY_READ is cut to it.
+#define MEMORY_CHUNK_SIZE (64 * 1024)
+#define MAX_MEMORY_READ (16 * 1024 * 1024)
+
+//
+//  Ring a local client shares with the server for large messages. The client
+//  creates the mapping, a SharedRingHeader followed by |size| bytes, and
+//  names it in SetSharedMemory. The server appends complete messages at
+//  head and sends a SharedPayload with where they start and how long they
+//  are; the client handles them as if they had come over the socket and
+//  then moves tail past them. Both are free-running byte counts, taken
+//  modulo |size|, a power of two.
+//
+#define SHARED_RING_MAGIC 0x47525053	// "SPRG"
+#define MIN_SHARED_RING_SIZE (64 * 1024)
+#define MAX_SHARED_RING_SIZE (256 * 1024 * 1024)
+struct SharedRingHeader {
+	uint32_t magic;
+	uint32_t size;
+	volatile uint32_t head;		// written by the server
+	volatile uint32_t tail;		// written by the client
+};
+
+#endif //_INCLUDE_PROTOCOL_H_
@@ -0,0 +1,77 @@
+#include "publicbreaks.h"
+#include <filesystem>
+
+PublicBreakpoints DebugPublicBreaks;
+
+void PublicBreakpoints::setEnvironment(SourcePawn::ISourcePawnEnvironment* api, hit_t handler) {
+#if SOURCEPAWN_API_VERSION >= 0x0225
+	env = api;
+	hit = handler;
+	env->SetPublicEntryListener(this);
+#endif
+}
+
+void PublicBreakpoints::watch(std::unordered_set<std::string> keys) {
+	if (!env)
+		return;
+	std::lock_guard<std::mutex> lock(mtx);
+	requested = std::move(keys);
+	dirty = true;
+}
+
+void PublicBreakpoints::OnPublicEntry(SourcePawn::IPluginFunction* fn, const cell_t* params,
+	unsigned int num_params) {
+	hit(fn, params, num_params);
+}
+
+void PublicBreakpoints::arm(plugin_s& plugin) {
+#if SOURCEPAWN_API_VERSION >= 0x0225
+	for (auto& key : watched) {
+		auto split = key.rfind("::");
+		if (split != std::string::npos && key.compare(0, split, plugin.file) != 0)
+			continue;
+		auto name = split == std::string::npos ? key : key.substr(split + 2);
+		auto fn = plugin.runtime->GetFunctionByName(name.c_str());
+		if (fn && env->SetPublicEntryHook(fn, true))
+			plugin.armed.push_back(fn);
+	}
+#endif
+}
+
+void PublicBreakpoints::disarm(plugin_s& plugin) {
+#if SOURCEPAWN_API_VERSION >= 0x0225
+	for (auto fn : plugin.armed)
+		env->SetPublicEntryHook(fn, false);
+#endif
+	plugin.armed.clear();
+}
+
+void PublicBreakpoints::sync() {
+	if (!env || !dirty.exchange(false))
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		watched = requested;
+	}
+	for (auto& plugin : plugins) {
+		disarm(plugin.second);
+		arm(plugin.second);
+	}
+}
+
+void PublicBreakpoints::addPlugin(SourcePawn::IPluginContext* ctx) {
+	if (!env)
+		return;
+	auto& added = plugins[ctx];
+	added.runtime = ctx->GetRuntime();
+	added.file = std::filesystem::path(added.runtime->GetFilename()).filename().string();
+	arm(added);
+}
+
+void PublicBreakpoints::removePlugin(SourcePawn::IPluginContext* ctx) {
+	auto found = plugins.find(ctx);
+	if (found == plugins.end())
+		return;
+	disarm(found->second);
+	plugins.erase(found);
+}
@@ -0,0 +1,74 @@
+#ifndef _INCLUDE_PUBLICBREAKS_H_
+#define _INCLUDE_PUBLICBREAKS_H_
+
+#include <sp_vm_api.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+//
+//  Breakpoints on public function entry. The VM reports calls through a
+//  public function only while its entry hook is armed, so the check costs a
+//  load per call for every other public, and no BREAK line of the function
+//  is involved.
+//
+class PublicBreakpoints : public SourcePawn::IPublicEntryListener {
+public:
+	// Called on the game thread before an armed public runs. May stop the
+	// game thread.
+	typedef void (*hit_t)(SourcePawn::IPluginFunction* fn, const cell_t* params,
+		unsigned int num_params);
+
+	// Needs API version 0x0225 or later. Called before any plugins are
+	// loaded.
+	void setEnvironment(SourcePawn::ISourcePawnEnvironment* env, hit_t hit);
+
+	bool available() const {
+		return env != nullptr;
+	}
+
+	// The publics to arm from the next game frame, each a function name
+	// for that public of every plugin, or a plugin file name, "::" and the
+	// function name. Safe to call from any thread.
+	void watch(std::unordered_set<std::string> keys);
+
+	// Arms and disarms entry hooks to match watch(). Main thread only.
+	void sync();
+
+	// Tracks a loaded plugin. Main thread only.
+	void addPlugin(SourcePawn::IPluginContext* ctx);
+
+	// Forgets an unloading plugin. Main thread only.
+	void removePlugin(SourcePawn::IPluginContext* ctx);
+
+	void OnPublicEntry(SourcePawn::IPluginFunction* fn, const cell_t* params,
+		unsigned int num_params) override;
+
+private:
+	struct plugin_s {
+		SourcePawn::IPluginRuntime* runtime;
+		std::string file;
+		std::vector<SourcePawn::IPluginFunction*> armed;
+	};
+
+	void arm(plugin_s& plugin);
+	void disarm(plugin_s& plugin);
+
+	SourcePawn::ISourcePawnEnvironment* env = nullptr;
+	hit_t hit = nullptr;
+	std::atomic<bool> dirty{ false };
+	// Written under mtx by any thread, read by sync().
+	std::unordered_set<std::string> requested;
+	// What is armed. Main thread only.
+	std::unordered_set<std::string> watched;
+	std::mutex mtx;
+	std::unordered_map<SourcePawn::IPluginContext*, plugin_s> plugins;
+};
+
+extern PublicBreakpoints DebugPublicBreaks;
+
+#endif //_INCLUDE_PUBLICBREAKS_H_
@@ -0,0 +1,151 @@
+#include "publicprofiler.h"
+#include "spikecapture.h"
+#include <algorithm>
+#include <filesystem>
+#include <fmt/format.h>
+
+PublicProfiler DebugPublics;
+
+static uint32_t bucketOf(uint64_t nanoseconds) {
+	if (nanoseconds < PublicProfiler::kSubBuckets)
+		return uint32_t(nanoseconds);
+	uint32_t exponent = 0;
+	for (uint64_t v = nanoseconds; v >>= 1;)
+		exponent++;
+	uint32_t bucket = (exponent - 2) * PublicProfiler::kSubBuckets +
+		uint32_t(nanoseconds >> (exponent - 3)) - PublicProfiler::kSubBuckets;
+	return std::min(bucket, PublicProfiler::kBuckets - 1);
+}
+
+static uint64_t lowerBoundOf(uint32_t bucket) {
+	if (bucket < PublicProfiler::kSubBuckets)
+		return bucket;
+	uint32_t exponent = bucket / PublicProfiler::kSubBuckets + 2;
+	return uint64_t(PublicProfiler::kSubBuckets + bucket % PublicProfiler::kSubBuckets) << (exponent - 3);
+}
+
+// The largest duration the bucket holding the call at |rank| covers.
+static uint64_t percentileOf(const uint32_t* counts, uint64_t rank, uint64_t max) {
+	uint64_t seen = 0;
+	for (uint32_t i = 0; i < PublicProfiler::kBuckets; i++) {
+		seen += counts[i];
+		if (seen >= rank)
+			return std::min(lowerBoundOf(i + 1) - 1, max);
+	}
+	return max;
+}
+
+void PublicProfiler::setEnvironment(SourcePawn::ISourcePawnEnvironment* env) {
+#if SOURCEPAWN_API_VERSION >= 0x0215
+	env->SetInvokeListener(this);
+	installed = true;
+#endif
+#if SOURCEPAWN_API_VERSION >= 0x021A
+	if (env->ApiVersion() >= 0x021A)
+		relocator = env;
+#endif
+}
+
+void PublicProfiler::setActive(bool active) {
+	if (!installed)
+		return;
+	std::lock_guard<std::mutex> lock(mtx);
+	if (active && !enabled)
+		functions.clear();
+	enabled = active;
+}
+
+void PublicProfiler::OnInvoked(SourcePawn::IPluginFunction* fn, uint64_t nanoseconds) {
+	DebugSpikes.invoked(fn, nanoseconds);
+	if (!enabled.load(std::memory_order_relaxed))
+		return;
+
+	std::lock_guard<std::mutex> lock(mtx);
+	auto& entry = functions[fn];
+	if (!entry) {
+		entry = std::make_unique<histogram_s>();
+		entry->runtime = fn->GetParentRuntime();
+		entry->plugin = std::filesystem::path(entry->runtime->GetFilename()).filename().string();
+		entry->function = fn->DebugName();
+	}
+	entry->calls++;
+	entry->total += nanoseconds;
+	entry->max = std::max(entry->max, nanoseconds);
+	entry->counts[bucketOf(nanoseconds)]++;
+}
+
+void PublicProfiler::removePlugin(SourcePawn::IPluginContext* ctx) {
+	auto runtime = ctx->GetRuntime();
+	std::lock_guard<std::mutex> lock(mtx);
+	for (auto it = functions.begin(); it != functions.end();) {
+		if (it->second->runtime == runtime)
+			it = functions.erase(it);
+		else
+			++it;
+	}
+}
+
+std::vector<PublicProfiler::public_s> PublicProfiler::snapshot(bool reset) {
+	std::vector<public_s> publics;
+	std::lock_guard<std::mutex> lock(mtx);
+	for (auto& function : functions) {
+		auto& entry = *function.second;
+		if (!entry.calls)
+			continue;
+		publics.push_back({ entry.plugin, entry.function, entry.calls, entry.total,
+			percentileOf(entry.counts, (entry.calls + 1) / 2, entry.max),
+			percentileOf(entry.counts, entry.calls - entry.calls / 100, entry.max),
+			entry.max });
+		if (reset) {
+			entry.calls = 0;
+			entry.total = 0;
+			entry.max = 0;
+			std::fill(std::begin(entry.counts), std::end(entry.counts), 0);
+		}
+	}
+	return publics;
+}
+
+std::vector<SourcePawn::IPluginFunction*> PublicProfiler::hottest(size_t count) {
+	std::vector<std::pair<uint64_t, SourcePawn::IPluginFunction*>> calls;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		for (auto& function : functions) {
+			if (function.second->calls)
+				calls.emplace_back(function.second->calls, function.first);
+		}
+	}
+	std::sort(calls.begin(), calls.end(), [](const auto& a, const auto& b) {
+		return a.first > b.first;
+	});
+
+	std::vector<SourcePawn::IPluginFunction*> hot;
+	for (size_t i = 0; i < calls.size() && i < count; i++)
+		hot.push_back(calls[i].second);
+	return hot;
+}
+
+size_t PublicProfiler::relocate(std::vector<SourcePawn::IPluginFunction*>& hot) {
+#if SOURCEPAWN_API_VERSION >= 0x021A
+	if (relocator && !hot.empty())
+		return relocator->RelocateHotCode(hot.data(), hot.size());
+#endif
+	return 0;
+}
+
+std::vector<std::string> PublicProfiler::table(bool reset) {
+	auto publics = snapshot(reset);
+	std::sort(publics.begin(), publics.end(), [](const public_s& a, const public_s& b) {
+		return a.total > b.total;
+	});
+
+	std::vector<std::string> lines;
+	lines.push_back(fmt::format("{:>10} {:>12} {:>10} {:>10} {:>10}  {}",
+		"calls", "total us", "p50 us", "p99 us", "max us", "function"));
+	for (const auto& function : publics) {
+		lines.push_back(fmt::format("{:>10} {:>12.1f} {:>10.1f} {:>10.1f} {:>10.1f}  {}::{}",
+			function.calls, function.total / 1000.0, function.p50 / 1000.0,
+			function.p99 / 1000.0, function.max / 1000.0, function.plugin, function.function));
+	}
+	return lines;
+}
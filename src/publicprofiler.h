@@ -0,0 +1,94 @@
+#ifndef _INCLUDE_PUBLICPROFILER_H_
+#define _INCLUDE_PUBLICPROFILER_H_
+
+#include <sp_vm_api.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//
+//  Latency histograms of the public functions SourceMod calls: forwards,
+//  timers and hooks. Durations go into log-linear buckets, eight per power
+//  of two, so percentiles are within an eighth of the real value.
+//
+class PublicProfiler : public SourcePawn::IInvokeListener {
+public:
+	static constexpr uint32_t kSubBuckets = 8;
+	static constexpr uint32_t kBuckets = 46 * kSubBuckets;
+
+	struct public_s {
+		std::string plugin;
+		std::string function;
+		uint64_t calls;
+		uint64_t total;		// nanoseconds
+		uint64_t p50;
+		uint64_t p99;
+		uint64_t max;
+	};
+
+	// Only VMs with API version 0x0215 or later time public calls. Called
+	// before any plugins are loaded.
+	void setEnvironment(SourcePawn::ISourcePawnEnvironment* env);
+
+	bool available() const {
+		return installed;
+	}
+
+	// Starts or stops timing. Starting drops the previous histograms. Safe
+	// to call from any thread.
+	void setActive(bool active);
+
+	bool active() const {
+		return enabled.load(std::memory_order_relaxed);
+	}
+
+	void OnInvoked(SourcePawn::IPluginFunction* fn, uint64_t nanoseconds) override;
+
+	// Forgets an unloading plugin's functions. Main thread only.
+	void removePlugin(SourcePawn::IPluginContext* ctx);
+
+	// The functions called so far, optionally starting over. Safe to call
+	// from any thread.
+	std::vector<public_s> snapshot(bool reset);
+
+	// The snapshot as a console table, one line per function, busiest first.
+	std::vector<std::string> table(bool reset);
+
+	// Up to |count| of the most called functions, most called first. Main
+	// thread only, since the functions go away with their plugins.
+	std::vector<SourcePawn::IPluginFunction*> hottest(size_t count);
+
+	// Only VMs with API version 0x021A or later can move code.
+	bool canRelocate() const {
+		return relocator != nullptr;
+	}
+
+	// Has the VM compile the functions again next to each other. Returns
+	// how many were moved. Main thread only.
+	size_t relocate(std::vector<SourcePawn::IPluginFunction*>& hot);
+
+private:
+	struct histogram_s {
+		SourcePawn::IPluginRuntime* runtime;
+		std::string plugin;
+		std::string function;
+		uint64_t calls = 0;
+		uint64_t total = 0;
+		uint64_t max = 0;
+		uint32_t counts[kBuckets] = {};
+	};
+
+	bool installed = false;
+	SourcePawn::ISourcePawnEnvironment* relocator = nullptr;
+	std::atomic<bool> enabled{ false };
+	std::mutex mtx;
+	std::unordered_map<SourcePawn::IPluginFunction*, std::unique_ptr<histogram_s>> functions;
+};
+
+extern PublicProfiler DebugPublics;
+
+#endif //_INCLUDE_PUBLICPROFILER_H_
@@ -0,0 +1,192 @@
+#include "recorder.h"
+#include <algorithm>
+#include <string.h>
+
+Recorder DebugRecorder;
+
+cell_t Recorder::View::usedEnd(cell_t addr) const {
+	if (addr >= 0 && addr < checkpoint->hp)
+		return checkpoint->hp;
+	if (addr >= checkpoint->sp && addr < checkpoint->top)
+		return checkpoint->top;
+	return 0;
+}
+
+const uint8_t* Recorder::View::gather(cell_t addr, size_t length) const {
+	scratch.resize(length);
+	size_t copied = 0;
+	while (copied < length) {
+		size_t offset = size_t(addr) + copied;
+		const auto& page = checkpoint->pages[offset / kPageBytes];
+		size_t in_page = offset % kPageBytes;
+		if (!page || in_page >= page->size())
+			return nullptr;
+		size_t chunk = std::min(length - copied, page->size() - in_page);
+		memcpy(scratch.data() + copied, page->data() + in_page, chunk);
+		copied += chunk;
+	}
+	return scratch.data();
+}
+
+const cell_t* Recorder::View::cells(cell_t addr, uint32_t count) const {
+	cell_t end = usedEnd(addr);
+	uint64_t bytes = uint64_t(count) * sizeof(cell_t);
+	if (!end || !count || uint64_t(end - addr) < bytes)
+		return nullptr;
+	return reinterpret_cast<const cell_t*>(gather(addr, size_t(bytes)));
+}
+
+const char* Recorder::View::string(cell_t addr, size_t max, size_t* length) const {
+	cell_t end = usedEnd(addr);
+	if (!end)
+		return nullptr;
+	auto str = reinterpret_cast<const char*>(gather(addr, std::min<size_t>(max, size_t(end - addr))));
+	if (!str)
+		return nullptr;
+	*length = strnlen(str, scratch.size());
+	return str;
+}
+
+void Recorder::setEnvironment(SourcePawn::ISourcePawnEnvironment* env) {
+	this->env = env;
+}
+
+bool Recorder::start(SourcePawn::IPluginContext* ctx, cell_t cip, cell_t frm,
+	uint32_t interval, uint32_t checkpoints) {
+	if (!env || !ctx)
+		return false;
+
+	std::lock_guard<std::mutex> lock(mtx);
+	resetLocked();
+	target = ctx;
+	this->interval = std::clamp<uint32_t>(interval ? interval : kDefaultInterval, 1, kMaxInterval);
+	capacity = std::clamp<uint32_t>(checkpoints ? checkpoints : kDefaultCheckpoints, 1, kMaxCheckpoints);
+	steps.push_back({ cip, frm });
+	checkpointLocked(0);
+	if (this->checkpoints.empty()) {
+		resetLocked();
+		return false;
+	}
+	recording = true;
+	return true;
+}
+
+void Recorder::stop() {
+	std::lock_guard<std::mutex> lock(mtx);
+	resetLocked();
+}
+
+void Recorder::removePlugin(SourcePawn::IPluginContext* ctx) {
+	std::lock_guard<std::mutex> lock(mtx);
+	if (target == ctx)
+		resetLocked();
+}
+
+void Recorder::resetLocked() {
+	recording = false;
+	target = nullptr;
+	steps.clear();
+	first_step = 0;
+	checkpoints.clear();
+}
+
+void Recorder::record(SourcePawn::IPluginContext* ctx, cell_t cip, cell_t frm) {
+	std::lock_guard<std::mutex> lock(mtx);
+	if (ctx != target)
+		return;
+
+	uint64_t step = first_step + steps.size();
+	steps.push_back({ cip, frm });
+	if (step - checkpoints.back()->step < interval)
+		return;
+
+	checkpointLocked(step);
+	if (checkpoints.size() > capacity)
+		dropOldestLocked();
+	// Checkpoints that failed leave their steps to the one before.
+	while (recording && steps.size() > kMaxSteps)
+		dropOldestLocked();
+}
+
+void Recorder::dropOldestLocked() {
+	// The only checkpoint left is what every step is shown with.
+	if (checkpoints.size() < 2) {
+		resetLocked();
+		return;
+	}
+	checkpoints.pop_front();
+	// Steps before the oldest checkpoint have nothing to show them with.
+	while (first_step < checkpoints.front()->step) {
+		steps.pop_front();
+		first_step++;
+	}
+}
+
+void Recorder::checkpointLocked(uint64_t step) {
+#if SOURCEPAWN_API_VERSION >= 0x021D
+	SourcePawn::sp_memory_usage_t usage;
+	if (!env->GetMemoryUsage(target, &usage))
+		return;
+
+	auto checkpoint = std::make_shared<checkpoint_s>();
+	checkpoint->step = step;
+	checkpoint->hp = cell_t(usage.data + usage.heap);
+	checkpoint->top = cell_t(usage.data + usage.heap_stack);
+	checkpoint->sp = checkpoint->top - cell_t(usage.stack);
+
+	// Both ends, so the copy stays inside the plugin's memory.
+	cell_t* first;
+	cell_t* last;
+	if (checkpoint->top <= 0 || target->LocalToPhysAddr(0, &first) != SP_ERROR_NONE ||
+		target->LocalToPhysAddr(checkpoint->top - sizeof(cell_t), &last) != SP_ERROR_NONE)
+		return;
+	auto memory = reinterpret_cast<const uint8_t*>(first);
+
+	const checkpoint_s* previous = checkpoints.empty() ? nullptr : checkpoints.back().get();
+	size_t count = (size_t(checkpoint->top) + kPageBytes - 1) / kPageBytes;
+	checkpoint->pages.resize(count);
+	for (size_t i = 0; i < count; i++) {
+		cell_t start = cell_t(i * kPageBytes);
+		cell_t end = std::min<cell_t>(start + kPageBytes, checkpoint->top);
+		// Pages wholly between the heap and the stack hold nothing.
+		if (start >= checkpoint->hp && end <= checkpoint->sp)
+			continue;
+
+		size_t length = size_t(end - start);
+		if (previous && i < previous->pages.size()) {
+			const auto& page = previous->pages[i];
+			if (page && page->size() == length && memcmp(page->data(), memory + start, length) == 0) {
+				checkpoint->pages[i] = page;
+				continue;
+			}
+		}
+		checkpoint->pages[i] = std::make_shared<const std::vector<uint8_t>>(memory + start, memory + end);
+	}
+	checkpoints.push_back(std::move(checkpoint));
+#else
+	(void)step;
+#endif
+}
+
+bool Recorder::history(SourcePawn::IPluginContext* ctx, uint32_t back, history_s* out) {
+	std::lock_guard<std::mutex> lock(mtx);
+	if (!recording || ctx != target || steps.empty())
+		return false;
+
+	back = uint32_t(std::min<uint64_t>(back, steps.size() - 1));
+	uint64_t step = first_step + steps.size() - 1 - back;
+	auto found = std::upper_bound(checkpoints.begin(), checkpoints.end(), step,
+		[](uint64_t step, const std::shared_ptr<const checkpoint_s>& checkpoint) {
+			return step < checkpoint->step;
+		});
+	if (found == checkpoints.begin())
+		return false;
+	--found;
+
+	out->steps = steps.size();
+	out->back = back;
+	out->step = steps[size_t(step - first_step)];
+	out->since_checkpoint = uint32_t(step - (*found)->step);
+	out->checkpoint = *found;
+	return true;
+}
@@ -0,0 +1,143 @@
+#ifndef _INCLUDE_RECORDER_H_
+#define _INCLUDE_RECORDER_H_
+
+#include <sp_vm_api.h>
+#include "snapshot.h"
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//
+//  Recording for stepping back. While on, every BREAK of one plugin is
+//  kept as a step (cip and frame), and every few steps a checkpoint copies
+//  the plugin's memory in use: globals, heap and stack. Checkpoints are
+//  made of pages, and a page that hasn't changed since the previous
+//  checkpoint is shared with it, so a checkpoint costs a compare of the
+//  memory in use and a copy of what changed. Only the last few are kept,
+//  along with the steps since the oldest of them.
+//
+//  Nothing is ever written back into the plugin. Stepping back shows a
+//  past step's location, with its locals read from the nearest checkpoint
+//  at or before it; with a checkpoint every step, those are the values the
+//  step saw.
+//
+class Recorder {
+public:
+	static constexpr uint32_t kPageBytes = 4096;
+	static constexpr uint32_t kDefaultInterval = 8;
+	static constexpr uint32_t kDefaultCheckpoints = 128;
+	static constexpr uint32_t kMaxCheckpoints = 4096;
+	static constexpr uint32_t kMaxInterval = 4096;
+	// Steps kept at most, whatever the interval and checkpoints allow; past
+	// it the oldest checkpoints go, with the steps they showed.
+	static constexpr size_t kMaxSteps = 1 << 20;
+
+	struct checkpoint_s {
+		// Step the checkpoint was taken at.
+		uint64_t step;
+		// Globals and heap in use are below |hp|, the stack in use is from
+		// |sp| up to |top|, the end of the plugin's memory.
+		cell_t hp;
+		cell_t sp;
+		cell_t top;
+		// By address; null for pages with nothing in use.
+		std::vector<std::shared_ptr<const std::vector<uint8_t>>> pages;
+	};
+
+	// A checkpoint's memory, as snapshot plans read it.
+	class View : public SnapshotPlan::Memory {
+	public:
+		explicit View(std::shared_ptr<const checkpoint_s> checkpoint) : checkpoint(std::move(checkpoint)) {
+		}
+
+		const cell_t* cells(cell_t addr, uint32_t count) const override;
+		const char* string(cell_t addr, size_t max, size_t* length) const override;
+
+	private:
+		// Where the range in use holding |addr| ends, or 0 if none does.
+		cell_t usedEnd(cell_t addr) const;
+		// Copies [addr, addr + length) out of the pages into scratch.
+		const uint8_t* gather(cell_t addr, size_t length) const;
+
+		std::shared_ptr<const checkpoint_s> checkpoint;
+		mutable std::vector<uint8_t> scratch;
+	};
+
+	struct step_s {
+		cell_t cip;
+		cell_t frm;
+	};
+
+	struct history_s {
+		// Steps kept, the current one included.
+		uint64_t steps;
+		// Steps back from the current one, at most steps - 1.
+		uint32_t back;
+		step_s step;
+		// Steps between the checkpoint and |step|; 0 if it has its own.
+		uint32_t since_checkpoint;
+		std::shared_ptr<const checkpoint_s> checkpoint;
+	};
+
+	// Only VMs with API version 0x021D or later tell where the heap and
+	// stack end.
+	void setEnvironment(SourcePawn::ISourcePawnEnvironment* env);
+
+	bool available() const {
+		return env != nullptr;
+	}
+
+	// Starts recording |ctx|, stopped at |cip| in the frame |frm|, with a
+	// checkpoint every |interval| steps, keeping the last |checkpoints|.
+	// Both are clamped to their limits; 0 picks the default.
+	// Drops what was recorded before. Only while the game thread is
+	// stopped, or on it.
+	bool start(SourcePawn::IPluginContext* ctx, cell_t cip, cell_t frm,
+		uint32_t interval, uint32_t checkpoints);
+
+	// Stops recording and drops what was recorded.
+	void stop();
+
+	// Whether every BREAK has to reach the debugger.
+	bool active() const {
+		return recording.load(std::memory_order_relaxed);
+	}
+
+	// Called at every BREAK that reaches the debugger. Game thread only.
+	void onBreak(SourcePawn::IPluginContext* ctx, cell_t cip, cell_t frm) {
+		if (recording.load(std::memory_order_relaxed))
+			record(ctx, cip, frm);
+	}
+
+	// The step |back| steps before the current one of |ctx|, or false if
+	// it isn't being recorded. Safe to call from any thread.
+	bool history(SourcePawn::IPluginContext* ctx, uint32_t back, history_s* out);
+
+	// Stops recording an unloading plugin. Game thread only.
+	void removePlugin(SourcePawn::IPluginContext* ctx);
+
+private:
+	void record(SourcePawn::IPluginContext* ctx, cell_t cip, cell_t frm);
+	void checkpointLocked(uint64_t step);
+	void dropOldestLocked();
+	void resetLocked();
+
+	SourcePawn::ISourcePawnEnvironment* env = nullptr;
+	std::atomic<bool> recording{ false };
+
+	std::mutex mtx;
+	SourcePawn::IPluginContext* target = nullptr;
+	uint32_t interval = kDefaultInterval;
+	uint32_t capacity = kDefaultCheckpoints;
+	// steps[0] is step |first_step|.
+	std::deque<step_s> steps;
+	uint64_t first_step = 0;
+	std::deque<std::shared_ptr<const checkpoint_s>> checkpoints;
+};
+
+extern Recorder DebugRecorder;
+
+#endif //_INCLUDE_RECORDER_H_
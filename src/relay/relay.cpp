@@ -0,0 +1,434 @@
+//
+//  Relays one adapter connection to the debug ports of many servers.
+//
+//  Every message from a server reaches the adapter wrapped in a Relayed
+//  message: [uint16 server][the server's message, header included]. The
+//  adapter addresses one server the same way, or all of them with server
+//  0xFFFF; messages it sends unwrapped go to all servers too, so one
+//  breakpoint set fans out in one operation. RelayServers: [int count]
+//  {[uint16 server][int len][string name][uint8 connected]} is sent when
+//  the adapter connects and whenever a server connects or goes away.
+//  Servers that go away are connected again every few seconds; the adapter
+//  sends them its breakpoints again when it sees them come back.
+//
+//  With --log, LogMessages from every server are also written there, one
+//  line each, prefixed with the server's name.
+//
+//  usage: sm_debugger_relay [--listen 27020] [--log file|-]
+//         name=host:port...
+//
+#include "protocol.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET socket_t;
+typedef WSAPOLLFD pollfd_t;
+#define poll_sockets WSAPoll
+#define close_socket closesocket
+#define IN_PROGRESS (WSAGetLastError() == WSAEWOULDBLOCK)
+#else
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int socket_t;
+typedef pollfd pollfd_t;
+#define poll_sockets poll
+#define INVALID_SOCKET (-1)
+#define close_socket close
+#define IN_PROGRESS (errno == EINPROGRESS)
+#endif
+
+using clock_type = std::chrono::steady_clock;
+
+#define BROADCAST 0xFFFF
+// Largest message taken from each side, header included. Servers send
+// large replies whole to clients without CapChunks; the adapter's are what
+// a server accepts, wrapped in Relayed.
+#define MAX_SERVER_MESSAGE (64 * MAX_MESSAGE_SIZE)
+#define MAX_ADAPTER_MESSAGE (MAX_MESSAGE_SIZE + 7)
+#define RECONNECT_INTERVAL std::chrono::seconds(5)
+
+static void set_nonblocking(socket_t fd) {
+#ifdef _WIN32
+	u_long one = 1;
+	ioctlsocket(fd, FIONBIO, &one);
+#else
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#endif
+	int one_flag = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char*)&one_flag, sizeof(one_flag));
+}
+
+static bool would_block() {
+#ifdef _WIN32
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+// One end of the relay: a socket with what was read but not yet handled
+// and what is waiting to be written.
+struct Link {
+	socket_t fd = INVALID_SOCKET;
+	std::string in;
+	std::string out;
+	size_t limit;
+
+	explicit Link(size_t limit) : limit(limit) {
+	}
+
+	void reset() {
+		if (fd != INVALID_SOCKET)
+			close_socket(fd);
+		fd = INVALID_SOCKET;
+		in.clear();
+		out.clear();
+	}
+
+	// Reads what is there; false once the peer is gone.
+	bool receive() {
+		char chunk[64 * 1024];
+		int rv = recv(fd, chunk, sizeof(chunk), 0);
+		if (rv <= 0)
+			return false;
+		in.append(chunk, rv);
+		return true;
+	}
+
+	bool flush() {
+		while (!out.empty()) {
+			int rv = ::send(fd, out.data(), int(out.size()), 0);
+			if (rv <= 0)
+				return rv < 0 && would_block();
+			out.erase(0, rv);
+		}
+		return true;
+	}
+
+	// Takes the next complete message off |in|, header included. A message
+	// over the limit would never fit, so it sets |*oversized| and the link
+	// has to be dropped.
+	bool next(std::string* message, bool* oversized) {
+		if (in.size() < 5)
+			return false;
+		uint32_t length;
+		memcpy(&length, in.data(), sizeof(length));
+		if (length > limit - 5) {
+			*oversized = true;
+			return false;
+		}
+		if (in.size() - 5 < length)
+			return false;
+		message->assign(in, 0, 5 + size_t(length));
+		in.erase(0, 5 + size_t(length));
+		return true;
+	}
+};
+
+struct Server {
+	std::string name;
+	sockaddr_in addr = {};
+	Link link{ MAX_SERVER_MESSAGE };
+	bool connecting = false;
+	bool connected = false;
+	clock_type::time_point last_attempt;
+};
+
+static std::vector<Server> servers;
+static Link adapter{ MAX_ADAPTER_MESSAGE };
+static FILE* log_file = nullptr;
+
+static void put_u32(std::string& out, uint32_t value) {
+	out.append((const char*)&value, sizeof(value));
+}
+
+static void send_servers() {
+	if (adapter.fd == INVALID_SOCKET)
+		return;
+	std::string payload;
+	put_u32(payload, uint32_t(servers.size()));
+	for (size_t i = 0; i < servers.size(); i++) {
+		uint16_t id = uint16_t(i);
+		payload.append((const char*)&id, sizeof(id));
+		put_u32(payload, uint32_t(servers[i].name.size() + 1));
+		payload.append(servers[i].name.c_str(), servers[i].name.size() + 1);
+		payload.push_back(char(servers[i].connected));
+	}
+	put_u32(adapter.out, uint32_t(payload.size()));
+	adapter.out.push_back(char(RelayServers));
+	adapter.out += payload;
+}
+
+// Writes the lines of a LogMessages, or of the LogMessages inside a
+// Compressed message, to the aggregated log.
+static void log_lines(const Server& server, const char* message, size_t size) {
+	unsigned char type = (unsigned char)message[4];
+	const char* payload = message + 5;
+	size_t left = size - 5;
+	if (type == Compressed && left >= 4) {
+		uint32_t original;
+		memcpy(&original, payload, sizeof(original));
+		if (original > 64 * MAX_MESSAGE_SIZE)
+			return;
+		std::string inflated(original, '\0');
+		uLongf length = original;
+		if (uncompress((Bytef*)&inflated[0], &length, (const Bytef*)payload + 4, uLong(left - 4)) != Z_OK)
+			return;
+		for (size_t pos = 0; pos + 5 <= length;) {
+			uint32_t inner;
+			memcpy(&inner, &inflated[pos], sizeof(inner));
+			if (length - pos - 5 < inner)
+				break;
+			log_lines(server, &inflated[pos], 5 + size_t(inner));
+			pos += 5 + size_t(inner);
+		}
+		return;
+	}
+	if (type != LogMessages || left < 8)
+		return;
+
+	int32_t dropped, count;
+	memcpy(&dropped, payload, 4);
+	memcpy(&count, payload + 4, 4);
+	size_t pos = 8;
+	if (dropped)
+		fprintf(log_file, "%s: (%d lines dropped)\n", server.name.c_str(), dropped);
+	for (int32_t i = 0; i < count && pos + 4 <= left; i++) {
+		int32_t length;
+		memcpy(&length, payload + pos, 4);
+		pos += 4;
+		if (length <= 0 || size_t(length) > left - pos)
+			break;
+		fprintf(log_file, "%s: %.*s\n", server.name.c_str(), length - 1, payload + pos);
+		pos += length;
+	}
+	fflush(log_file);
+}
+
+static void from_server(size_t id, const std::string& message) {
+	if (log_file)
+		log_lines(servers[id], message.data(), message.size());
+	if (adapter.fd == INVALID_SOCKET)
+		return;
+	put_u32(adapter.out, uint32_t(2 + message.size()));
+	adapter.out.push_back(char(Relayed));
+	uint16_t tag = uint16_t(id);
+	adapter.out.append((const char*)&tag, sizeof(tag));
+	adapter.out += message;
+}
+
+static void to_servers(uint16_t id, const char* message, size_t size) {
+	for (size_t i = 0; i < servers.size(); i++) {
+		if ((id == BROADCAST || id == i) && servers[i].connected)
+			servers[i].link.out.append(message, size);
+	}
+}
+
+static void from_adapter(const std::string& message) {
+	unsigned char type = (unsigned char)message[4];
+	if (type == Relayed && message.size() >= 7 + 5) {
+		uint16_t id;
+		memcpy(&id, message.data() + 5, sizeof(id));
+		to_servers(id, message.data() + 7, message.size() - 7);
+		return;
+	}
+	to_servers(BROADCAST, message.data(), message.size());
+}
+
+static void start_connect(Server& server) {
+	server.last_attempt = clock_type::now();
+	server.link.fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (server.link.fd == INVALID_SOCKET)
+		return;
+	set_nonblocking(server.link.fd);
+	if (connect(server.link.fd, (const sockaddr*)&server.addr, sizeof(server.addr)) == 0) {
+		server.connected = true;
+		send_servers();
+	} else if (IN_PROGRESS) {
+		server.connecting = true;
+	} else {
+		server.link.reset();
+	}
+}
+
+static void drop_server(Server& server) {
+	bool was = server.connected;
+	server.link.reset();
+	server.connected = false;
+	server.connecting = false;
+	if (was)
+		send_servers();
+}
+
+static bool parse_server(const char* arg, Server* server) {
+	std::string spec = arg;
+	size_t eq = spec.find('=');
+	size_t colon = spec.rfind(':');
+	if (eq == std::string::npos || colon == std::string::npos || colon < eq)
+		return false;
+	server->name = spec.substr(0, eq);
+	std::string host = spec.substr(eq + 1, colon - eq - 1);
+	addrinfo hints = {};
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* found = nullptr;
+	if (getaddrinfo(host.c_str(), spec.c_str() + colon + 1, &hints, &found) != 0 || !found)
+		return false;
+	memcpy(&server->addr, found->ai_addr, sizeof(server->addr));
+	freeaddrinfo(found);
+	return true;
+}
+
+int main(int argc, char** argv) {
+#ifdef _WIN32
+	WSADATA wsa;
+	WSAStartup(MAKEWORD(2, 2), &wsa);
+#else
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	uint16_t listen_port = 27020;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--listen") == 0 && i + 1 < argc) {
+			listen_port = uint16_t(atoi(argv[++i]));
+		} else if (strcmp(argv[i], "--log") == 0 && i + 1 < argc) {
+			const char* path = argv[++i];
+			log_file = strcmp(path, "-") == 0 ? stdout : fopen(path, "a");
+		} else {
+			Server server;
+			if (servers.size() >= BROADCAST || !parse_server(argv[i], &server)) {
+				fprintf(stderr, "bad server \"%s\", expected name=host:port\n", argv[i]);
+				return 1;
+			}
+			servers.push_back(std::move(server));
+		}
+	}
+	if (servers.empty()) {
+		fprintf(stderr, "usage: %s [--listen port] [--log file|-] name=host:port...\n", argv[0]);
+		return 1;
+	}
+
+	socket_t listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	int one = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&one, sizeof(one));
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(listen_port);
+	if (listener == INVALID_SOCKET || bind(listener, (const sockaddr*)&addr, sizeof(addr)) != 0 ||
+		listen(listener, 1) != 0) {
+		fprintf(stderr, "could not listen on port %u\n", listen_port);
+		return 1;
+	}
+
+	std::vector<pollfd_t> fds;
+	while (true) {
+		auto now = clock_type::now();
+		for (auto& server : servers) {
+			if (server.link.fd == INVALID_SOCKET && now - server.last_attempt >= RECONNECT_INTERVAL)
+				start_connect(server);
+		}
+
+		// The listener, the adapter, then every server in order.
+		fds.clear();
+		fds.push_back({ listener, POLLIN, 0 });
+		fds.push_back({ adapter.fd, short(POLLIN | (adapter.out.empty() ? 0 : POLLOUT)), 0 });
+		for (auto& server : servers) {
+			short events = server.connecting ? POLLOUT : short(POLLIN | (server.link.out.empty() ? 0 : POLLOUT));
+			fds.push_back({ server.link.fd, events, 0 });
+		}
+		// Windows rejects invalid sockets in the set, so they wait on
+		// nothing instead.
+		for (auto& fd : fds) {
+			if (fd.fd == INVALID_SOCKET) {
+				fd.fd = listener;
+				fd.events = 0;
+			}
+		}
+		if (poll_sockets(fds.data(), (unsigned long)fds.size(), 1000) < 0)
+			continue;
+
+		if (fds[0].revents & POLLIN) {
+			socket_t fd = accept(listener, nullptr, nullptr);
+			if (fd != INVALID_SOCKET) {
+				// A new adapter takes over from the old one.
+				adapter.reset();
+				adapter.fd = fd;
+				set_nonblocking(fd);
+				send_servers();
+			}
+		}
+
+		if (adapter.fd != INVALID_SOCKET && fds[1].fd == adapter.fd) {
+			bool alive = true;
+			if (fds[1].revents & (POLLIN | POLLHUP | POLLERR))
+				alive = adapter.receive();
+			std::string message;
+			bool oversized = false;
+			while (alive && adapter.next(&message, &oversized))
+				from_adapter(message);
+			if (oversized) {
+				fprintf(stderr, "adapter sent a message over %u bytes, disconnecting it\n",
+					unsigned(MAX_ADAPTER_MESSAGE));
+				alive = false;
+			}
+			if (alive && (fds[1].revents & POLLOUT))
+				alive = adapter.flush();
+			if (!alive)
+				adapter.reset();
+		}
+
+		for (size_t i = 0; i < servers.size(); i++) {
+			auto& server = servers[i];
+			short revents = fds[2 + i].fd == server.link.fd ? fds[2 + i].revents : 0;
+			if (server.connecting && revents) {
+				int error = 0;
+				socklen_t length = sizeof(error);
+				getsockopt(server.link.fd, SOL_SOCKET, SO_ERROR, (char*)&error, &length);
+				server.connecting = false;
+				if (error) {
+					server.link.reset();
+					continue;
+				}
+				server.connected = true;
+				send_servers();
+				continue;
+			}
+			if (!server.connected)
+				continue;
+			bool alive = true;
+			if (revents & (POLLIN | POLLHUP | POLLERR))
+				alive = server.link.receive();
+			std::string message;
+			bool oversized = false;
+			while (alive && server.link.next(&message, &oversized))
+				from_server(i, message);
+			if (oversized) {
+				fprintf(stderr, "%s sent a message over %u bytes, reconnecting\n",
+					server.name.c_str(), unsigned(MAX_SERVER_MESSAGE));
+				alive = false;
+			}
+			if (alive && !server.link.out.empty())
+				alive = server.link.flush();
+			if (!alive)
+				drop_server(server);
+		}
+		if (adapter.fd != INVALID_SOCKET && !adapter.out.empty() && !adapter.flush())
+			adapter.reset();
+	}
+}
@@ -0,0 +1,80 @@
+#include "requestscheduler.h"
+#include <algorithm>
+
+RequestScheduler DebugRequests(4);
+
+RequestScheduler::RequestScheduler(size_t max_threads) {
+	// The game server keeps a core; there is always one.
+	size_t cores = std::thread::hardware_concurrency();
+	threads_wanted = std::max<size_t>(1, std::min(max_threads, cores > 2 ? cores - 2 : 1));
+}
+
+void RequestScheduler::push(const std::shared_ptr<Stream>& stream, std::function<void()> task) {
+	std::lock_guard<std::mutex> lock(mtx);
+	if (stopping || stream->closed)
+		return;
+	while (threads.size() < threads_wanted)
+		threads.emplace_back(&RequestScheduler::work, this);
+	stream->tasks.push_back(std::move(task));
+	schedule(stream);
+}
+
+void RequestScheduler::yield(const std::shared_ptr<Stream>& stream, std::function<void()> rest) {
+	std::lock_guard<std::mutex> lock(mtx);
+	if (stopping || stream->closed)
+		return;
+	// The stream is still scheduled; it goes back in line once this task
+	// returns.
+	stream->tasks.push_front(std::move(rest));
+}
+
+void RequestScheduler::close(const std::shared_ptr<Stream>& stream) {
+	std::lock_guard<std::mutex> lock(mtx);
+	stream->closed = true;
+	stream->tasks.clear();
+}
+
+void RequestScheduler::schedule(const std::shared_ptr<Stream>& stream) {
+	if (stream->scheduled)
+		return;
+	stream->scheduled = true;
+	ready.push_back(stream);
+	wake.notify_one();
+}
+
+void RequestScheduler::work() {
+	std::unique_lock<std::mutex> lock(mtx);
+	while (true) {
+		wake.wait(lock, [this] { return stopping || !ready.empty(); });
+		if (stopping)
+			return;
+		auto stream = std::move(ready.front());
+		ready.pop_front();
+		if (stream->tasks.empty()) {
+			stream->scheduled = false;
+			continue;
+		}
+		auto task = std::move(stream->tasks.front());
+		stream->tasks.pop_front();
+		lock.unlock();
+		task();
+		task = nullptr;
+		lock.lock();
+		// Behind every other client with work waiting.
+		stream->scheduled = false;
+		if (!stream->tasks.empty())
+			schedule(stream);
+	}
+}
+
+void RequestScheduler::shutdown() {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stopping = true;
+		ready.clear();
+	}
+	wake.notify_all();
+	for (auto& thread : threads)
+		thread.join();
+	threads.clear();
+}
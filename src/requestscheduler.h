@@ -0,0 +1,70 @@
+#ifndef _INCLUDE_REQUESTSCHEDULER_H_
+#define _INCLUDE_REQUESTSCHEDULER_H_
+
+#include <stddef.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+//  Runs the clients' requests on a few threads of their own rather than on
+//  the I/O thread that read them. Clients take turns: one with work waiting
+//  runs a task and goes to the back of the line, and a long reply yields
+//  the rest of itself as another task, so a client pulling a large dump
+//  delays only itself while other clients, observers and the metrics page
+//  sharing its I/O thread keep being served. A client's tasks run one at a
+//  time, in the order they were pushed.
+//
+class RequestScheduler {
+public:
+	// One client's tasks.
+	class Stream {
+	private:
+		friend class RequestScheduler;
+		std::deque<std::function<void()>> tasks;
+		// In |ready| or being run.
+		bool scheduled = false;
+		bool closed = false;
+	};
+
+	// At most |max_threads|, fewer on smaller hosts, started on the first
+	// task.
+	explicit RequestScheduler(size_t max_threads);
+
+	std::shared_ptr<Stream> open() {
+		return std::make_shared<Stream>();
+	}
+
+	// Queues |task| behind the stream's others.
+	void push(const std::shared_ptr<Stream>& stream, std::function<void()> task);
+
+	// From a task of |stream|: queues |rest| to run before anything else
+	// on the stream, after the other clients had their turn.
+	void yield(const std::shared_ptr<Stream>& stream, std::function<void()> rest);
+
+	// Drops the tasks that haven't started; the running one finishes.
+	void close(const std::shared_ptr<Stream>& stream);
+
+	// Stops and joins the threads; tasks still queued are dropped.
+	void shutdown();
+
+private:
+	void work();
+	// Puts |stream| in line unless it already is. Holds |mtx|.
+	void schedule(const std::shared_ptr<Stream>& stream);
+
+	size_t threads_wanted;
+	std::mutex mtx;
+	std::condition_variable wake;
+	std::vector<std::thread> threads;
+	std::deque<std::shared_ptr<Stream>> ready;
+	bool stopping = false;
+};
+
+extern RequestScheduler DebugRequests;
+
+#endif //_INCLUDE_REQUESTSCHEDULER_H_
@@ -0,0 +1,176 @@
+#include "scriptcore.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include <fmt/format.h>
+
+ScriptCores DebugCores;
+
+// At most one core per plugin and code address in this long.
+static constexpr auto kRateLimit = std::chrono::minutes(1);
+static constexpr size_t kMaxFrames = 64;
+// Stacks are copied up to this many bytes from sp.
+static constexpr cell_t kMaxStackBytes = 1 << 20;
+
+void ScriptCores::enable(const std::string& dir) {
+	std::error_code ec;
+	std::filesystem::create_directories(dir, ec);
+	directory = dir;
+}
+
+void ScriptCores::setEnvironment(SourcePawn::ISourcePawnEnvironment* env) {
+#if SOURCEPAWN_API_VERSION >= 0x021E
+	if (env->ApiVersion() >= 0x021E)
+		this->env = env;
+#endif
+}
+
+void ScriptCores::removePlugin(SourcePawn::IPluginRuntime* runtime) {
+	plugins.erase(runtime);
+}
+
+// The image hash of the file, which the VM took as it loaded the plugin;
+// older VMs leave it to be read once per plugin.
+uint64_t ScriptCores::smxHash(SourcePawn::IPluginRuntime* runtime) {
+	auto& plugin = plugins[runtime];
+	if (plugin.hashed)
+		return plugin.hash;
+	plugin.hashed = true;
+#if SOURCEPAWN_API_VERSION >= 0x0222
+	if (env && env->ApiVersion() >= 0x0222 &&
+		env->GetImageHash(runtime->GetDefaultContext(), &plugin.hash))
+		return plugin.hash;
+#endif
+	std::ifstream in(runtime->GetFilename(), std::ios::binary);
+	if (!in)
+		return 0;
+	SourcePawn::ImageHasher hasher;
+	char chunk[64 * 1024];
+	while (in.read(chunk, sizeof(chunk)) || in.gcount())
+		hasher.update(chunk, size_t(in.gcount()));
+	plugin.hash = hasher.digest();
+	return plugin.hash;
+}
+
+namespace {
+class CoreWriter {
+public:
+	explicit CoreWriter(const std::string& path) : out(path, std::ios::binary | std::ios::trunc) {
+	}
+
+	template <typename T> void put(T value) {
+		out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+	}
+	void putString(const char* str) {
+		uint32_t length = str ? uint32_t(strlen(str)) : 0;
+		put(length);
+		out.write(str, length);
+	}
+	void putBytes(const void* bytes, uint32_t length) {
+		put(length);
+		out.write(reinterpret_cast<const char*>(bytes), length);
+	}
+
+	std::ofstream out;
+};
+} // namespace
+
+void ScriptCores::write(const SourcePawn::IErrorReport& report, SourcePawn::IFrameIterator& iter) {
+	auto ctx = report.Context();
+	if (!ctx || directory.empty())
+		return;
+	auto runtime = ctx->GetRuntime();
+
+	SourcePawn::sp_script_frame_t frames[kMaxFrames] = {};
+	size_t frame_count = 0;
+	cell_t sp = 0, stp = 0;
+#if SOURCEPAWN_API_VERSION >= 0x021E
+	if (env)
+		frame_count = env->GetScriptFrames(ctx, frames, kMaxFrames, &sp, &stp);
+#endif
+
+	// The erroring line stands in for its address on older VMs.
+	uint32_t key = frame_count ? uint32_t(frames[0].cip) : 0;
+	iter.Reset();
+	for (; !key && !iter.Done(); iter.Next()) {
+		if (iter.IsScriptedFrame() && iter.Context() == ctx)
+			key = iter.LineNumber() | 0x80000000u;
+	}
+	auto now = std::chrono::steady_clock::now();
+	auto& written = plugins[runtime].written;
+	auto last = written.find(key);
+	if (last != written.end() && now - last->second < kRateLimit) {
+		iter.Reset();
+		return;
+	}
+	written[key] = now;
+
+	time_t stamp = time(nullptr);
+	std::string name = std::filesystem::path(runtime->GetFilename()).stem().string();
+	auto path = std::filesystem::path(directory) / fmt::format("{}-{}-{:x}.spcore", name, (int64_t)stamp, key);
+	CoreWriter core(path.string());
+	if (!core.out) {
+		iter.Reset();
+		return;
+	}
+
+	core.put<uint32_t>(SCRIPT_CORE_MAGIC);
+	core.put<uint32_t>(SCRIPT_CORE_VERSION);
+	core.put<uint64_t>(smxHash(runtime));
+	core.put<int64_t>(stamp);
+	core.putString(runtime->GetFilename());
+	core.put<int32_t>(report.Code());
+	core.putString(report.Message());
+
+	// Scripted frames of the failing plugin line up with what the VM
+	// listed, in order.
+	struct frame_s {
+		bool scripted;
+		SourcePawn::sp_script_frame_t at;
+		uint32_t line;
+		const char* function;
+		const char* file;
+	};
+	std::vector<frame_s> stack;
+	size_t scripted = 0;
+	iter.Reset();
+	for (; !iter.Done() && stack.size() < kMaxFrames; iter.Next()) {
+		if (iter.IsNativeFrame()) {
+			stack.push_back({ false, {}, 0, iter.FunctionName(), "" });
+		}
+		else if (iter.IsScriptedFrame()) {
+			frame_s frame{ true, {}, iter.LineNumber(), iter.FunctionName(), iter.FilePath() };
+			if (iter.Context() == ctx && scripted < frame_count)
+				frame.at = frames[scripted++];
+			stack.push_back(frame);
+		}
+	}
+	iter.Reset();
+
+	core.put<uint32_t>(uint32_t(stack.size()));
+	for (const auto& frame : stack) {
+		core.put<uint8_t>(frame.scripted);
+		core.put<int32_t>(frame.at.cip);
+		core.put<int32_t>(frame.at.frm);
+		core.put<uint32_t>(frame.line);
+		core.putString(frame.function);
+		core.putString(frame.file);
+	}
+
+	// Both ends, so the copy stays inside the plugin's memory.
+	cell_t* base;
+	cell_t* end;
+	cell_t bytes = std::min(stp - sp, kMaxStackBytes);
+	if (bytes <= 0 || ctx->LocalToPhysAddr(sp, &base) != SP_ERROR_NONE ||
+		ctx->LocalToPhysAddr(sp + bytes - sizeof(cell_t), &end) != SP_ERROR_NONE) {
+		bytes = 0;
+		base = nullptr;
+	}
+	core.put<int32_t>(sp);
+	core.putBytes(base, uint32_t(bytes));
+	if (!core.out)
+		fmt::print("Debugger: could not write script core {}\n", path.string());
+}
@@ -0,0 +1,67 @@
+#ifndef _INCLUDE_SCRIPTCORE_H_
+#define _INCLUDE_SCRIPTCORE_H_
+
+#include <sp_image_hash.h>
+#include <sp_vm_api.h>
+#include <stdint.h>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+
+#define SCRIPT_CORE_MAGIC 0x52435053	// "SPCR"
+#define SCRIPT_CORE_VERSION 2
+
+//
+//  Script cores: what a runtime error left on a plugin's stack, written to
+//  disk when no client was there to stop on it. Integers are little endian
+//  and strings are [u32 length][bytes]:
+//
+//    [u32 magic][u32 version][u64 image hash of the .smx][i64 unix time]
+//    [string plugin path][i32 error code][string message]
+//    [u32 frames]{[u8 scripted][i32 cip][i32 frm][u32 line]
+//                 [string function][string file]}
+//    [i32 sp][u32 bytes][the stack from sp up to the stack top]
+//
+//  Frames are innermost first. cip and frm are 0 where the VM couldn't tell
+//  them, so a loader checks the hash against the SMX it reads symbols from
+//  and then finds each frame's locals in the stack bytes by frame offset.
+//  Only errors cost anything; nothing runs between them.
+//
+class ScriptCores {
+public:
+	// Starts writing cores into |dir|, creating it if needed.
+	void enable(const std::string& dir);
+
+	bool active() const {
+		return !directory.empty();
+	}
+
+	// Only VMs with API version 0x021E or later list frame addresses;
+	// without it cores carry no stack memory.
+	void setEnvironment(SourcePawn::ISourcePawnEnvironment* env);
+
+	// Writes a core for the error, unless one was written for the same
+	// plugin and code address within the last minute. Leaves |iter| reset.
+	// Main thread only.
+	void write(const SourcePawn::IErrorReport& report, SourcePawn::IFrameIterator& iter);
+
+	// Forgets an unloading plugin's hash and rate limits. Main thread only.
+	void removePlugin(SourcePawn::IPluginRuntime* runtime);
+
+private:
+	uint64_t smxHash(SourcePawn::IPluginRuntime* runtime);
+
+	std::string directory;
+	SourcePawn::ISourcePawnEnvironment* env = nullptr;
+	struct plugin_s {
+		uint64_t hash = 0;
+		bool hashed = false;
+		// Last core per code address, or per line without addresses.
+		std::unordered_map<uint32_t, std::chrono::steady_clock::time_point> written;
+	};
+	std::unordered_map<SourcePawn::IPluginRuntime*, plugin_s> plugins;
+};
+
+extern ScriptCores DebugCores;
+
+#endif //_INCLUDE_SCRIPTCORE_H_
@@ -0,0 +1,239 @@
+#include "sendbuffer.h"
+#include <algorithm>
+
+// Pooled strings per client, and the largest one worth keeping around.
+static constexpr size_t kMaxPooledBuffers = 8;
+static constexpr size_t kMaxPooledCapacity = 1024 * 1024;
+static constexpr size_t kDefaultCapacity = 256;
+
+SendBuffer SendBufferPool::acquire(size_t size_hint) {
+	size_hint = std::max(size_hint, kDefaultCapacity);
+
+	std::lock_guard<std::mutex> lock(mtx);
+	for (auto& buffer : buffers) {
+		if (buffer.use_count() != 1)
+			continue;
+		if (buffer->capacity() > kMaxPooledCapacity)
+			buffer = std::make_shared<std::string>();
+		buffer->clear();
+		buffer->reserve(size_hint);
+		return SendBuffer(buffer);
+	}
+
+	auto buffer = std::make_shared<std::string>();
+	buffer->reserve(size_hint);
+	if (buffers.size() < kMaxPooledBuffers)
+		buffers.push_back(buffer);
+	return SendBuffer(std::move(buffer));
+}
+
+void SendQueue::setChunking(bool enabled, uint8_t type) {
+	std::lock_guard<std::mutex> lock(mtx);
+	chunking = enabled;
+	chunk_type = type;
+}
+
+void SendQueue::setDropNotice(notice_t notice) {
+	std::lock_guard<std::mutex> lock(mtx);
+	notice_ = std::move(notice);
+}
+
+void SendQueue::push(priority_e priority, std::shared_ptr<std::string> data) {
+	std::lock_guard<std::mutex> lock(mtx);
+	pruneLocked();
+	if (corked) {
+		holdLocked(priority, std::move(data));
+		return;
+	}
+	size_t size = data->size();
+	bool chunked = chunking && priority == Bulk && size > kChunkBytes;
+	if (!chunked && !waitingLocked() && unwritten_bytes < kWindow) {
+		sendLocked(std::move(data));
+		return;
+	}
+
+	auto& queue = waiting[priority];
+	if (priority == Bulk && waiting_bytes[Bulk] + size > kBulkLimit) {
+		dropBulkLocked(*data);
+		flushLocked();
+		return;
+	}
+	if (chunked) {
+		chunkLocked(*data, waiting[Bulk], waiting_bytes[Bulk]);
+		flushLocked();
+		return;
+	}
+	if (priority == Telemetry) {
+		if (size > kTelemetryLimit) {
+			dropped_messages++;
+			dropped_bytes += size;
+			return;
+		}
+		while (waiting_bytes[Telemetry] + size > kTelemetryLimit) {
+			dropped_messages++;
+			dropped_bytes += queue.front()->size();
+			waiting_bytes[Telemetry] -= queue.front()->size();
+			queue.pop_front();
+		}
+	}
+	waiting_bytes[priority] += size;
+	queue.push_back(std::move(data));
+	flushLocked();
+}
+
+void SendQueue::flush() {
+	std::lock_guard<std::mutex> lock(mtx);
+	pruneLocked();
+	flushLocked();
+}
+
+void SendQueue::cork() {
+	std::lock_guard<std::mutex> lock(mtx);
+	corked++;
+}
+
+void SendQueue::uncork() {
+	std::lock_guard<std::mutex> lock(mtx);
+	if (--corked)
+		return;
+	pruneLocked();
+	releaseLocked();
+	flushLocked();
+}
+
+SendQueue::stats_s SendQueue::stats() {
+	std::lock_guard<std::mutex> lock(mtx);
+	return { waiting_bytes[Control] + waiting_bytes[Bulk] + waiting_bytes[Telemetry] + held_bytes,
+		dropped_messages, dropped_bytes, coalesced };
+}
+
+// Only bulk messages are chunked: telemetry drops whole messages, which a
+// dropped chunk would not be.
+void SendQueue::chunkLocked(const std::string& data, std::deque<std::shared_ptr<std::string>>& queue,
+	size_t& bytes) {
+	uint32_t id = chunk_id++;
+	for (size_t offset = 0; offset < data.size(); offset += kChunkBytes) {
+		size_t length = std::min(kChunkBytes, data.size() - offset);
+		uint32_t payload = uint32_t(length + 5);
+		uint8_t last = offset + length == data.size();
+		auto chunk = std::make_shared<std::string>();
+		chunk->reserve(payload + 5);
+		chunk->append(reinterpret_cast<const char*>(&payload), sizeof(payload));
+		chunk->push_back(char(chunk_type));
+		chunk->append(reinterpret_cast<const char*>(&id), sizeof(id));
+		chunk->push_back(char(last));
+		chunk->append(data, offset, length);
+		bytes += chunk->size();
+		queue.push_back(std::move(chunk));
+	}
+}
+
+void SendQueue::dropBulkLocked(const std::string& data) {
+	dropped_messages++;
+	dropped_bytes += data.size();
+	if (!notice_)
+		return;
+	auto notice = notice_(data);
+	if (!notice)
+		return;
+	waiting_bytes[Control] += notice->size();
+	waiting[Control].push_back(std::move(notice));
+}
+
+void SendQueue::holdLocked(priority_e priority, std::shared_ptr<std::string> data) {
+	if (held_priority == kPriorities)
+		held_priority = priority;
+	else if (held_priority != priority)
+		held_priority = Bulk;
+	if (chunking && priority == Bulk && data->size() > kChunkBytes) {
+		chunkLocked(*data, held, held_bytes);
+	} else {
+		held_bytes += data->size();
+		held.push_back(std::move(data));
+	}
+	if (held_bytes >= kCoalesceBytes) {
+		releaseLocked();
+		flushLocked();
+	}
+}
+
+// Queues what was held as writes of up to kCoalesceBytes, in order.
+void SendQueue::releaseLocked() {
+	if (held.empty())
+		return;
+	auto& queue = waiting[held_priority];
+	while (!held.empty()) {
+		if (held.front()->size() >= kCoalesceBytes) {
+			waiting_bytes[held_priority] += held.front()->size();
+			queue.push_back(std::move(held.front()));
+			held.pop_front();
+			continue;
+		}
+		auto write = std::make_shared<std::string>();
+		write->reserve(kCoalesceBytes);
+		size_t count = 0;
+		while (!held.empty() && write->size() + held.front()->size() <= kCoalesceBytes) {
+			*write += *held.front();
+			held.pop_front();
+			count++;
+		}
+		if (count > 1)
+			coalesced += count;
+		waiting_bytes[held_priority] += write->size();
+		queue.push_back(std::move(write));
+	}
+	held_bytes = 0;
+	held_priority = kPriorities;
+}
+
+void SendQueue::sendLocked(std::shared_ptr<std::string> data) {
+	auto hold = std::make_shared<hold_s>();
+	hold->data = std::move(data);
+	size_t size = hold->data->size();
+	unwritten.push_back({ hold, size });
+	unwritten_bytes += size;
+	std::string* message = hold->data.get();
+	send_(std::shared_ptr<std::string>(std::move(hold), message));
+}
+
+void SendQueue::flushLocked() {
+	std::vector<std::shared_ptr<std::string>> batch;
+	while (unwritten_bytes < kWindow && waitingLocked()) {
+		// One write of the first waiting messages, most urgent first.
+		size_t bytes = 0;
+		batch.clear();
+		for (int priority = Control; priority < kPriorities; priority++) {
+			auto& queue = waiting[priority];
+			while (!queue.empty() && (batch.empty() || bytes + queue.front()->size() <= kCoalesceBytes)) {
+				bytes += queue.front()->size();
+				waiting_bytes[priority] -= queue.front()->size();
+				batch.push_back(std::move(queue.front()));
+				queue.pop_front();
+			}
+			if (!queue.empty())
+				break;
+		}
+		if (batch.size() == 1) {
+			sendLocked(std::move(batch[0]));
+			continue;
+		}
+		coalesced += batch.size();
+		auto write = std::make_shared<std::string>();
+		write->reserve(bytes);
+		for (auto& message : batch)
+			*write += *message;
+		sendLocked(std::move(write));
+	}
+}
+
+void SendQueue::pruneLocked() {
+	// The connection writes in order.
+	while (!unwritten.empty() && unwritten.front().hold.expired()) {
+		unwritten_bytes -= unwritten.front().size;
+		unwritten.pop_front();
+	}
+}
+
+bool SendQueue::waitingLocked() const {
+	return !waiting[Control].empty() || !waiting[Bulk].empty() || !waiting[Telemetry].empty();
+}
@@ -0,0 +1,247 @@
+#ifndef _INCLUDE_SENDBUFFER_H_
+#define _INCLUDE_SENDBUFFER_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+//
+//  An outgoing message, written straight into a string that the connection
+//  sends as is. Offers the subset of CUtlBuffer's put interface the senders
+//  use, so a message is built the same way and never copied again.
+//
+class SendBuffer {
+public:
+	explicit SendBuffer(std::shared_ptr<std::string> data)
+		: data_(std::move(data)) {
+	}
+
+	void PutChar(char c) {
+		data_->push_back(c);
+	}
+	void PutInt(int i) {
+		Put(&i, sizeof(i));
+	}
+	void PutUnsignedInt(uint32_t u) {
+		Put(&u, sizeof(u));
+	}
+	void PutUnsignedInt64(uint64_t u) {
+		Put(&u, sizeof(u));
+	}
+	void PutString(const char* str) {
+		Put(str, strlen(str) + 1);
+	}
+	// [int size + 1][bytes][NUL], the length-prefixed form every string
+	// in the protocol takes, written with one append.
+	void PutLenString(std::string_view str) {
+		int size = static_cast<int>(str.size() + 1);
+		size_t start = data_->size();
+		data_->resize(start + sizeof(size) + size);
+		char* dest = &(*data_)[start];
+		memcpy(dest, &size, sizeof(size));
+		memcpy(dest + sizeof(size), str.data(), str.size());
+		dest[sizeof(size) + str.size()] = '\0';
+	}
+	// |count| values as they are in memory, in one copy.
+	template <typename T>
+	void PutSpan(const T* values, size_t count) {
+		Put(values, count * sizeof(T));
+	}
+	void PutCells(const int32_t* cells, size_t count) {
+		PutSpan(cells, count);
+	}
+	void Put(const void* mem, size_t size) {
+		data_->append(static_cast<const char*>(mem), size);
+	}
+
+	// Grows the message by |size| bytes and returns where they start, for
+	// writers that fill memory directly.
+	void* Extend(size_t size) {
+		size_t start = data_->size();
+		data_->resize(start + size);
+		return &(*data_)[start];
+	}
+	// Makes room for |size| more bytes up front, so a message whose size is
+	// known grows once.
+	void Reserve(size_t size) {
+		data_->reserve(data_->size() + size);
+	}
+	// Cuts the message back to |size| bytes.
+	void Truncate(size_t size) {
+		data_->resize(size);
+	}
+
+	int TellPut() const {
+		return static_cast<int>(data_->size());
+	}
+	void* Base() {
+		return &(*data_)[0];
+	}
+
+	// The message so far, for handing the same bytes to more than one
+	// connection.
+	const std::shared_ptr<std::string>& data() const {
+		return data_;
+	}
+
+	// Hands the message over for TcpConnection::send. The buffer is empty
+	// afterwards.
+	std::shared_ptr<std::string> take() {
+		return std::move(data_);
+	}
+
+private:
+	std::shared_ptr<std::string> data_;
+};
+
+//
+//  Per-client pool of message strings. The pool keeps a reference to every
+//  string it hands out; once it holds the only one, the connection is done
+//  with it and its memory is reused for the next message.
+//
+class SendBufferPool {
+public:
+	// A cleared buffer with room for at least |size_hint| bytes.
+	SendBuffer acquire(size_t size_hint = 0);
+
+private:
+	std::mutex mtx;
+	std::vector<std::shared_ptr<std::string>> buffers;
+};
+
+//
+//  Per-client queue in front of the connection. Messages go straight
+//  through while the connection holds less than kWindow bytes it has not
+//  written yet; past that they wait here, by priority, and are written
+//  together once it catches up. Each priority has a cap on what may wait:
+//  control messages always wait, a bulk message over the cap is dropped
+//  and replaced by the drop notice, if one is set, and telemetry drops its
+//  oldest messages to make room. So a slow client never makes a sender
+//  wait, never costs more than the caps, and is told which reply it lost
+//  instead of waiting for it.
+//
+//  While corked, messages are held in the order they were pushed, whatever
+//  their priority, and go out together on the last uncork, so a pass that
+//  answers several requests costs one write instead of one per reply. Once
+//  kCoalesceBytes are held they are queued early, still in order. Held
+//  messages are not dropped: the pass already did the work, and its replies
+//  queue behind each other as one unit, as control messages if that is all
+//  they are and as bulk otherwise, past the bulk cap.
+//
+//  With chunking on, bulk messages larger than kChunkBytes go out as Chunk
+//  messages of that size, so a waiting control message is queued ahead of
+//  the rest of a dump rather than behind all of it. It still waits for what
+//  the connection already holds, up to kWindow plus one write.
+//
+class SendQueue {
+public:
+	enum priority_e {
+		Control,	// run state notices; small and never dropped
+		Bulk,		// replies to requests
+		Telemetry,	// unsolicited streams, e.g. log lines
+		kPriorities
+	};
+	static constexpr size_t kWindow = 512 * 1024;
+	static constexpr size_t kBulkLimit = 16 * 1024 * 1024;
+	static constexpr size_t kTelemetryLimit = 1024 * 1024;
+	// Waiting messages are written together up to this many bytes.
+	static constexpr size_t kCoalesceBytes = 64 * 1024;
+	static constexpr size_t kChunkBytes = 64 * 1024;
+
+	struct stats_s {
+		uint64_t waiting_bytes;
+		uint64_t dropped_messages;
+		uint64_t dropped_bytes;
+		uint64_t coalesced;			// messages written along with others
+	};
+
+	using sender_t = std::function<void(std::shared_ptr<std::string>)>;
+	// Builds the message that stands in for a dropped bulk message. Called
+	// with the queue locked, so it must not use the queue.
+	using notice_t = std::function<std::shared_ptr<std::string>(const std::string& dropped)>;
+	explicit SendQueue(sender_t send)
+		: send_(std::move(send)) {
+	}
+
+	// The notice is queued as a control message, so it is never dropped.
+	void setDropNotice(notice_t notice);
+
+	// Chunk: [uint32 id][uint8 last][bytes]. The bytes of one id, in
+	// order, are the original messages. |type| is the Chunk message type.
+	void setChunking(bool enabled, uint8_t type);
+
+	// Any thread.
+	void push(priority_e priority, std::shared_ptr<std::string> data);
+	// Writes what waits, as far as the window allows. Any thread; the
+	// network thread calls it regularly.
+	void flush();
+	// Any thread; corks nest.
+	void cork();
+	void uncork();
+
+	// Corks the queue for a scope.
+	class Cork {
+	public:
+		explicit Cork(SendQueue& queue)
+			: queue_(queue) {
+			queue_.cork();
+		}
+		~Cork() {
+			queue_.uncork();
+		}
+		Cork(const Cork&) = delete;
+		Cork& operator=(const Cork&) = delete;
+
+	private:
+		SendQueue& queue_;
+	};
+	stats_s stats();
+
+private:
+	// The connection's reference to a message. It expires once the
+	// connection has written the message and let go of it.
+	struct hold_s {
+		std::shared_ptr<std::string> data;
+	};
+	struct unwritten_s {
+		std::weak_ptr<hold_s> hold;
+		size_t size;
+	};
+
+	void chunkLocked(const std::string& data, std::deque<std::shared_ptr<std::string>>& queue,
+		size_t& bytes);
+	void holdLocked(priority_e priority, std::shared_ptr<std::string> data);
+	void releaseLocked();
+	void dropBulkLocked(const std::string& data);
+	void sendLocked(std::shared_ptr<std::string> data);
+	void flushLocked();
+	void pruneLocked();
+	bool waitingLocked() const;
+
+	std::mutex mtx;
+	sender_t send_;
+	notice_t notice_;
+	std::deque<std::shared_ptr<std::string>> waiting[kPriorities];
+	size_t waiting_bytes[kPriorities] = {};
+	std::deque<unwritten_s> unwritten;
+	size_t unwritten_bytes = 0;
+	uint64_t dropped_messages = 0;
+	uint64_t dropped_bytes = 0;
+	uint64_t coalesced = 0;
+	int corked = 0;
+	// What was pushed while corked, in order, and the priority it queues at.
+	std::deque<std::shared_ptr<std::string>> held;
+	size_t held_bytes = 0;
+	int held_priority = kPriorities;
+	bool chunking = false;
+	uint8_t chunk_type = 0;
+	uint32_t chunk_id = 0;
+};
+
+#endif //_INCLUDE_SENDBUFFER_H_
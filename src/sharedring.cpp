@@ -0,0 +1,107 @@
+#include "sharedring.h"
+#include <algorithm>
+#include <atomic>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool SharedRing::attach(const std::string& name, uint32_t threshold) {
+	detach();
+
+	size_t length = 0;
+	void* base = nullptr;
+#ifdef _WIN32
+	HANDLE mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+	if (!mapping)
+		return false;
+	base = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	MEMORY_BASIC_INFORMATION info;
+	if (!base || !VirtualQuery(base, &info, sizeof(info))) {
+		if (base)
+			UnmapViewOfFile(base);
+		CloseHandle(mapping);
+		return false;
+	}
+	length = info.RegionSize;
+	mapping_ = mapping;
+#else
+	int fd = shm_open(name.c_str(), O_RDWR, 0);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(SharedRingHeader)) {
+		length = st.st_size;
+		base = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (base == MAP_FAILED)
+			base = nullptr;
+	}
+	close(fd);
+	if (!base)
+		return false;
+#endif
+	header_ = static_cast<SharedRingHeader*>(base);
+	data_ = reinterpret_cast<uint8_t*>(header_ + 1);
+	mapped_ = length;
+
+	uint32_t size = header_->size;
+	if (length < sizeof(SharedRingHeader) || header_->magic != SHARED_RING_MAGIC ||
+		size < MIN_SHARED_RING_SIZE || size > MAX_SHARED_RING_SIZE || (size & (size - 1)) ||
+		length - sizeof(SharedRingHeader) < size) {
+		detach();
+		return false;
+	}
+	capacity_ = size;
+	// Whatever the client left in it is not ours.
+	header_->head = header_->tail;
+	threshold_.store(threshold, std::memory_order_relaxed);
+	attached_.store(true, std::memory_order_release);
+	return true;
+}
+
+void SharedRing::detach() {
+	if (!header_)
+		return;
+	attached_.store(false, std::memory_order_release);
+#ifdef _WIN32
+	UnmapViewOfFile(header_);
+	CloseHandle(mapping_);
+	mapping_ = nullptr;
+#else
+	munmap(header_, mapped_);
+#endif
+	header_ = nullptr;
+	data_ = nullptr;
+	mapped_ = 0;
+	capacity_ = 0;
+}
+
+bool SharedRing::write(const void* data, uint32_t size, uint32_t* position) {
+	if (!header_)
+		return false;
+	// The client frees space by moving tail; read it before writing behind it.
+	// head and tail are the client's to scribble on too, so both are only
+	// trusted once bounded by the capacity.
+	uint32_t mask = capacity_ - 1;
+	uint32_t head = header_->head;
+	uint32_t tail = header_->tail;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	uint32_t used = head - tail;
+	if (used > capacity_ || size > capacity_ - used)
+		return false;
+
+	uint32_t offset = head & mask;
+	uint32_t first = std::min(size, capacity_ - offset);
+	memcpy(data_ + offset, data, first);
+	memcpy(data_, static_cast<const uint8_t*>(data) + first, size - first);
+	std::atomic_thread_fence(std::memory_order_release);
+	header_->head = head + size;
+	*position = head;
+	return true;
+}
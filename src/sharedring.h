@@ -0,0 +1,58 @@
+#ifndef _INCLUDE_SHAREDRING_H_
+#define _INCLUDE_SHAREDRING_H_
+
+#include "protocol.h"
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+
+//
+//  The server's side of a client's shared-memory ring (see SharedRingHeader).
+//  Writes copy whole messages in and report where they went; a write that
+//  doesn't fit in the space the client has freed fails, and the message
+//  goes over the socket instead.
+//
+class SharedRing {
+public:
+	SharedRing() = default;
+	SharedRing(const SharedRing&) = delete;
+	SharedRing& operator=(const SharedRing&) = delete;
+	~SharedRing() {
+		detach();
+	}
+
+	// Maps the ring the client named. Messages of at least |threshold| bytes
+	// go through it from then on.
+	bool attach(const std::string& name, uint32_t threshold);
+	void detach();
+
+	// Safe without |lock|: it only reads what attach() and detach() publish,
+	// and write() checks again under the lock.
+	bool wants(size_t size) const {
+		return attached_.load(std::memory_order_acquire) &&
+			size >= threshold_.load(std::memory_order_relaxed);
+	}
+
+	// Copies |size| bytes to head and sets |position| to where they start.
+	bool write(const void* data, uint32_t size, uint32_t* position);
+
+	// Held across write() and sending its SharedPayload, so the client sees
+	// payloads in ring order.
+	std::mutex lock;
+
+private:
+	SharedRingHeader* header_ = nullptr;
+	uint8_t* data_ = nullptr;
+	size_t mapped_ = 0;
+	// The ring's size as validated on attach. The header's copy is in memory
+	// the client can write, so no index is bounded by it.
+	uint32_t capacity_ = 0;
+	std::atomic<bool> attached_{ false };
+	std::atomic<uint32_t> threshold_{ 0 };
+#ifdef _WIN32
+	void* mapping_ = nullptr;
+#endif
+};
+
+#endif //_INCLUDE_SHAREDRING_H_
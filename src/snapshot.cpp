@@ -0,0 +1,353 @@
+#include "snapshot.h"
+#include "condition.h"
+#include "rtti.h"
+#include <algorithm>
+#include <cmath>
+#include <ctype.h>
+#include <string.h>
+#include <fmt/format.h>
+#include <smx/smx-typeinfo.h>
+
+using namespace sp;
+
+// Longest array, or string in cells, a slot copies.
+static constexpr uint32_t kMaxCells = 256;
+// Frames past this are left out of the copied stack.
+static constexpr size_t kMaxFrames = 32;
+
+namespace {
+class ContextMemory : public SnapshotPlan::Memory {
+public:
+	explicit ContextMemory(SourcePawn::IPluginContext* ctx) : ctx(ctx) {
+	}
+
+	// Both ends, so the copy stays inside the plugin's memory.
+	const cell_t* cells(cell_t addr, uint32_t count) const override {
+		cell_t* first;
+		cell_t* last;
+		if (ctx->LocalToPhysAddr(addr, &first) != SP_ERROR_NONE ||
+			ctx->LocalToPhysAddr(addr + (count - 1) * sizeof(cell_t), &last) != SP_ERROR_NONE)
+			return nullptr;
+		return first;
+	}
+
+	const char* string(cell_t addr, size_t max, size_t* length) const override {
+		char* str;
+		if (ctx->LocalToStringNULL(addr, &str) != SP_ERROR_NONE || !str)
+			return nullptr;
+		*length = strnlen(str, max);
+		return str;
+	}
+
+private:
+	SourcePawn::IPluginContext* ctx;
+};
+
+bool isName(const std::string& text) {
+	if (text.empty() || (!isalpha((unsigned char)text[0]) && text[0] != '_'))
+		return false;
+	return std::all_of(text.begin(), text.end(),
+		[](char c) { return isalnum((unsigned char)c) || c == '_'; });
+}
+} // namespace
+
+std::shared_ptr<const SnapshotPlan> SnapshotPlan::bind(SmxV1Image* image,
+	uint32_t addr, const std::vector<std::string>& globals, bool locals) {
+	auto plan = std::make_shared<SnapshotPlan>();
+	if (locals) {
+		std::vector<SmxV1Image::Symbol> syms;
+		image->GetLocalVariables(addr, &syms);
+		for (auto& sym : syms)
+			plan->add(image, sym);
+	}
+	for (auto& name : globals) {
+		if (!isName(name)) {
+			expression_s expr{ name, nullptr, "" };
+			Condition condition;
+			auto predicate = std::make_shared<Predicate>();
+			if (condition.parse(name, &expr.error) &&
+				condition.bind(image, addr, predicate.get(), &expr.error))
+				expr.predicate = std::move(predicate);
+			plan->expressions_.push_back(std::move(expr));
+			continue;
+		}
+		std::unique_ptr<SmxV1Image::Symbol> sym;
+		if (image->GetVariable(name.c_str(), addr, sym))
+			plan->add(image, *sym);
+	}
+	return plan;
+}
+
+void SnapshotPlan::add(SmxV1Image* image, const SmxV1Image::Symbol& sym) {
+	const char* name = image->GetDebugName(sym.name());
+	if (!name)
+		return;
+	for (auto& slot : slots_) {
+		if (slot.name == name)
+			return;
+	}
+
+	int vclass = sym.vclass() & 0x0f;
+	slot_s slot{ name, Unsupported, vclass == 1 || vclass == 3, false,
+		static_cast<cell_t>(sym.addr()), 1 };
+	bool is_array = false;
+	if (auto var = sym.rtti()) {
+		auto type = image->rtti_data() ? image->rtti_data()->typeFromTypeId(var->type_id) : nullptr;
+		if (type && type->type() == cb::kByRef) {
+			slot.ref = true;
+			type = type->inner();
+		}
+		if (type && type->type() == cb::kFixedArray) {
+			is_array = true;
+			slot.cells = type->index();
+			// Array arguments are passed by reference.
+			slot.ref = vclass == 3;
+			type = type->inner();
+		}
+		else if (type && type->type() == cb::kArray && vclass == 3) {
+			// Only strings carry their own length.
+			is_array = true;
+			slot.cells = 0;
+			slot.ref = true;
+			type = type->inner();
+		}
+		switch (type ? type->type() : cb::kVoid) {
+		case cb::kAny:
+		case cb::kInt32:
+			slot.kind = is_array ? Array : Cell;
+			break;
+		case cb::kBool:
+			slot.kind = is_array ? Array : Bool;
+			break;
+		case cb::kFloat32:
+			slot.kind = is_array ? FloatArray : Float;
+			break;
+		case cb::kChar8:
+			slot.kind = is_array ? String : Cell;
+			break;
+		}
+	}
+	else {
+		switch (sym.ident()) {
+		case sp::IDENT_REFERENCE:
+			slot.ref = true;
+			// fallthrough
+		case sp::IDENT_VARIABLE:
+			slot.kind = Cell;
+			break;
+		case sp::IDENT_REFARRAY:
+			slot.ref = true;
+			// fallthrough
+		case sp::IDENT_ARRAY: {
+			auto dims = image->GetArrayDimensions(&sym);
+			if (dims.size() == 1) {
+				is_array = true;
+				slot.cells = dims[0].size();
+				slot.kind = Array;
+			}
+			break;
+		}
+		}
+		const char* tag = image->GetTagName(sym.tagid());
+		auto kind = image->GetTagKind(sym.tagid());
+		if (slot.kind == Cell && kind == SmxV1Image::TagKind::Bool)
+			slot.kind = Bool;
+		else if (slot.kind == Cell && kind == SmxV1Image::TagKind::Float)
+			slot.kind = Float;
+		else if (slot.kind == Array && kind == SmxV1Image::TagKind::Float)
+			slot.kind = FloatArray;
+		else if (slot.kind == Array && tag && (!strcmp(tag, "String") || !strcmp(tag, "char")))
+			slot.kind = String;
+	}
+
+	if (slot.kind == String)
+		slot.cells = kMaxCells;
+	else if (is_array && !slot.cells)
+		slot.kind = Unsupported;
+	if (slot.kind == Unsupported)
+		slot.cells = 0;
+	slot.cells = std::min(slot.cells, kMaxCells);
+	total_cells_ += slot.cells;
+	slots_.push_back(std::move(slot));
+}
+
+// Frame iterators answer null for names they don't know.
+static const char* orEmpty(const char* str) {
+	return str ? str : "";
+}
+
+void SnapshotPlan::capture(SourcePawn::IPluginContext* ctx, cell_t frm,
+	Snapshot* out) const {
+	copy(ContextMemory(ctx), frm, out);
+
+	out->frames.clear();
+	auto iter = ctx->CreateFrameIterator();
+	for (; !iter->Done() && out->frames.size() < kMaxFrames; iter->Next()) {
+		if (iter->IsNativeFrame())
+			out->frames.push_back({ orEmpty(iter->FunctionName()), "", 0 });
+		else if (iter->IsScriptedFrame())
+			out->frames.push_back({ orEmpty(iter->FunctionName()), orEmpty(iter->FilePath()),
+				iter->LineNumber() - 1 });
+	}
+	ctx->DestroyFrameIterator(iter);
+}
+
+void SnapshotPlan::copy(const Memory& memory, cell_t frm, Snapshot* out) const {
+	out->cells.clear();
+	out->cells.reserve(total_cells_);
+	out->sizes.assign(slots_.size(), 0);
+	out->regions.clear();
+	out->frm = frm;
+	// The references themselves go after the slots, for expressions to
+	// follow.
+	std::vector<std::pair<cell_t, cell_t>> refs;
+	for (size_t i = 0; i < slots_.size(); i++) {
+		auto& slot = slots_[i];
+		if (slot.kind == Unsupported)
+			continue;
+		cell_t base = slot.local ? frm + slot.addr : slot.addr;
+		if (slot.ref) {
+			auto ref = memory.cells(base, 1);
+			if (!ref)
+				continue;
+			refs.emplace_back(base, *ref);
+			base = *ref;
+		}
+
+		if (slot.kind == String) {
+			size_t length;
+			auto str = memory.string(base, kMaxCells * sizeof(cell_t) - 1, &length);
+			if (!str)
+				continue;
+			size_t at = out->cells.size();
+			out->cells.resize(at + length / sizeof(cell_t) + 1, 0);
+			memcpy(&out->cells[at], str, length);
+			out->sizes[i] = static_cast<uint32_t>(out->cells.size() - at);
+			out->regions.push_back({ base, uint32_t(at), out->sizes[i] });
+			continue;
+		}
+
+		auto ptr = memory.cells(base, slot.cells);
+		if (!ptr)
+			continue;
+		out->regions.push_back({ base, uint32_t(out->cells.size()), slot.cells });
+		out->cells.insert(out->cells.end(), ptr, ptr + slot.cells);
+		out->sizes[i] = slot.cells;
+	}
+	for (auto& ref : refs) {
+		out->regions.push_back({ ref.first, uint32_t(out->cells.size()), 1 });
+		out->cells.push_back(ref.second);
+	}
+}
+
+static void format_float(std::string& out, cell_t value) {
+	float f = sp_ctof(value);
+	if (std::isfinite(f))
+		fmt::format_to(std::back_inserter(out), "{:f}", f);
+	else
+		out += "null";
+}
+
+std::vector<SnapshotPlan::value_s> SnapshotPlan::format(const Snapshot& snap) const {
+	std::vector<value_s> values;
+	const cell_t* cells = snap.cells.data();
+	for (size_t i = 0; i < slots_.size() && i < snap.sizes.size(); i++) {
+		auto& slot = slots_[i];
+		uint32_t size = snap.sizes[i];
+		value_s var{ slot.name, "", "N/A" };
+		if (slot.kind == Unsupported) {
+			var.value = "(not captured)";
+		}
+		else if (!size) {
+			var.value = "(?)";
+		}
+		else if (slot.kind == String) {
+			var.type = "String";
+			var.value = reinterpret_cast<const char*>(cells);
+		}
+		else if (slot.kind == Array || slot.kind == FloatArray) {
+			var.type = "Array";
+			var.value = "[";
+			for (uint32_t j = 0; j < size; j++) {
+				var.value += j ? ",\n    " : "\n    ";
+				if (slot.kind == FloatArray)
+					format_float(var.value, cells[j]);
+				else
+					fmt::format_to(std::back_inserter(var.value), "{}", cells[j]);
+			}
+			var.value += "\n]";
+		}
+		else if (slot.kind == Float) {
+			var.type = "float";
+			format_float(var.value, *cells);
+		}
+		else if (slot.kind == Bool) {
+			var.type = "bool";
+			var.value = *cells == 0 ? "false" : *cells == 1 ? "true" : fmt::format("{} (true)", *cells);
+		}
+		else {
+			var.type = "cell";
+			var.value = fmt::format("{}", *cells);
+		}
+		cells += size;
+		values.push_back(std::move(var));
+	}
+
+	SnapshotMemory memory(snap);
+	for (auto& expr : expressions_) {
+		value_s var{ expr.text, "", "N/A" };
+		cell_t value;
+		if (!expr.predicate) {
+			var.value = "(" + expr.error + ")";
+		}
+		else if (!expr.predicate->value(memory, snap.frm, &value)) {
+			var.value = "(not captured)";
+		}
+		else if (expr.predicate->result() == Predicate::Result::Float) {
+			var.type = "float";
+			format_float(var.value, value);
+		}
+		else if (expr.predicate->result() == Predicate::Result::Bool) {
+			var.type = "bool";
+			var.value = value ? "true" : "false";
+		}
+		else {
+			var.type = "cell";
+			var.value = fmt::format("{}", value);
+		}
+		values.push_back(std::move(var));
+	}
+	return values;
+}
+
+const Snapshot::region_s* SnapshotMemory::find(cell_t addr, size_t* left) const {
+	for (auto& region : snap.regions) {
+		if (addr < region.addr)
+			continue;
+		size_t offset = size_t(addr - region.addr);
+		size_t bytes = size_t(region.count) * sizeof(cell_t);
+		if (offset < bytes) {
+			*left = bytes - offset;
+			return &region;
+		}
+	}
+	return nullptr;
+}
+
+const cell_t* SnapshotMemory::cells(cell_t addr, uint32_t count) const {
+	size_t left;
+	auto region = find(addr, &left);
+	if (!region || (addr - region->addr) % sizeof(cell_t) || left < count * sizeof(cell_t))
+		return nullptr;
+	return &snap.cells[region->at + (addr - region->addr) / sizeof(cell_t)];
+}
+
+const char* SnapshotMemory::string(cell_t addr, size_t max, size_t* length) const {
+	size_t left;
+	auto region = find(addr, &left);
+	if (!region)
+		return nullptr;
+	auto str = reinterpret_cast<const char*>(&snap.cells[region->at]) + (addr - region->addr);
+	*length = strnlen(str, std::min(max, left));
+	return str;
+}
@@ -0,0 +1,144 @@
+#ifndef _INCLUDE_SNAPSHOT_H_
+#define _INCLUDE_SNAPSHOT_H_
+
+#include <sp_vm_api.h>
+#include "smx-v1-image.h"
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Predicate;
+class SnapshotPlan;
+
+//
+//  What one hit of a snapshot point copied: raw cells laid out as the plan
+//  says, and the call stack. Nothing in it points into plugin memory, so it
+//  can be formatted after the plugin has moved on, or unloaded.
+//
+struct Snapshot {
+	struct frame_s {
+		std::string name;
+		std::string file;
+		// Zero based; 0 for native frames.
+		uint32_t line;
+	};
+
+	int id = 0;
+	std::shared_ptr<const SnapshotPlan> plan;
+	std::vector<frame_s> frames;
+	// Cells of each slot, back to back.
+	std::vector<cell_t> cells;
+	// Cells copied for each slot; 0 if it couldn't be read.
+	std::vector<uint32_t> sizes;
+
+	// Where runs of |cells| were copied from, so an expression can read
+	// them back as plugin memory through SnapshotMemory.
+	struct region_s {
+		cell_t addr;
+		uint32_t at;
+		uint32_t count;
+	};
+	std::vector<region_s> regions;
+	cell_t frm = 0;
+};
+
+//
+//  The variables a snapshot point copies, bound for one plugin and code
+//  address like a Predicate: the locals in scope there and the globals it
+//  names, each resolved to an address and a cell count. A hit copies cells
+//  and nothing else; values are only formatted when the snapshot is sent.
+//
+class SnapshotPlan {
+public:
+	struct value_s {
+		std::string name;
+		std::string value;
+		std::string type;
+	};
+
+	// Plugin memory as a snapshot reads it: a live context, or the stack
+	// saved in a script core.
+	class Memory {
+	public:
+		// |count| cells at |addr|, or null unless all of them are there.
+		virtual const cell_t* cells(cell_t addr, uint32_t count) const = 0;
+		// The string at |addr| and its length, at most |max|, or null.
+		virtual const char* string(cell_t addr, size_t max, size_t* length) const = 0;
+	};
+
+	// Names that aren't visible at |addr| are left out; ones that can't be
+	// copied as cells, like enum structs, show as such. Without |locals|
+	// the plan has only the named variables. An entry that isn't a name is
+	// an expression, compiled here and computed by format() from what was
+	// copied, so it costs the hit nothing.
+	static std::shared_ptr<const SnapshotPlan> bind(sp::SmxV1Image* image,
+		uint32_t addr, const std::vector<std::string>& globals, bool locals = true);
+
+	// Copies the slots as they are in the frame |frm|, and the call stack.
+	// Game thread only.
+	void capture(SourcePawn::IPluginContext* ctx, cell_t frm, Snapshot* out) const;
+
+	// Copies the slots out of |memory|, leaving the call stack alone.
+	void copy(const Memory& memory, cell_t frm, Snapshot* out) const;
+
+	// The values of |snap|, formatted as Variables shows them, then those
+	// of the expressions. Any thread.
+	std::vector<value_s> format(const Snapshot& snap) const;
+
+private:
+	enum Kind : uint8_t {
+		Cell,
+		Bool,
+		Float,
+		String,
+		Array,
+		FloatArray,
+		Unsupported
+	};
+
+	struct slot_s {
+		std::string name;
+		Kind kind;
+		// The address is a frame offset; with |ref|, a pointer is read there.
+		bool local;
+		bool ref;
+		cell_t addr;
+		uint32_t cells;
+	};
+
+	// Null |predicate| if it didn't bind, with |error| saying why.
+	struct expression_s {
+		std::string text;
+		std::shared_ptr<const Predicate> predicate;
+		std::string error;
+	};
+
+	void add(sp::SmxV1Image* image, const sp::SmxV1Image::Symbol& sym);
+
+	std::vector<slot_s> slots_;
+	std::vector<expression_s> expressions_;
+	size_t total_cells_ = 0;
+};
+
+//
+//  Plugin memory as a snapshot holds it: the cells it copied, at the
+//  addresses they were copied from. Reads of anything else fail, so an
+//  expression over what wasn't copied has no value rather than a wrong one.
+//
+class SnapshotMemory : public SnapshotPlan::Memory {
+public:
+	explicit SnapshotMemory(const Snapshot& snap) : snap(snap) {
+	}
+
+	const cell_t* cells(cell_t addr, uint32_t count) const override;
+	const char* string(cell_t addr, size_t max, size_t* length) const override;
+
+private:
+	// The region holding |addr|, and the bytes it has from there.
+	const Snapshot::region_s* find(cell_t addr, size_t* left) const;
+
+	const Snapshot& snap;
+};
+
+#endif //_INCLUDE_SNAPSHOT_H_
@@ -0,0 +1,75 @@
+#include "sourcecache.h"
+#include <sp_image_hash.h>
+#include <algorithm>
+#include <fstream>
+
+SourceCache DebugSources;
+
+void SourceCache::setRoot(const std::string& dir) {
+	std::error_code ec;
+	auto canonical = std::filesystem::canonical(dir, ec);
+	root = ec ? std::filesystem::path() : canonical;
+}
+
+// Debug info names are what the compiler was given: relative to wherever
+// it ran, absolute, or with the other platform's separators.
+bool SourceCache::resolve(const std::string& name, std::filesystem::path* path) const {
+	std::string portable = name;
+	std::replace(portable.begin(), portable.end(), '\\', '/');
+	std::filesystem::path given(portable);
+
+	std::filesystem::path candidates[2];
+	size_t count = 0;
+	if (given.is_relative() && !given.has_root_name())
+		candidates[count++] = root / given;
+	if (given.has_filename())
+		candidates[count++] = root / given.filename();
+
+	for (size_t i = 0; i < count; i++) {
+		std::error_code ec;
+		auto found = std::filesystem::weakly_canonical(candidates[i], ec);
+		if (ec)
+			continue;
+		// Symlinks and ".." are followed, so anything resolving outside the
+		// root is refused.
+		auto inside = std::mismatch(root.begin(), root.end(), found.begin(), found.end());
+		if (inside.first != root.end())
+			continue;
+		if (!std::filesystem::is_regular_file(found, ec))
+			continue;
+		*path = found;
+		return true;
+	}
+	return false;
+}
+
+std::shared_ptr<const SourceCache::source_s> SourceCache::get(const std::string& name) {
+	std::filesystem::path path;
+	if (!active() || !resolve(name, &path))
+		return nullptr;
+
+	std::error_code ec;
+	auto mtime = std::filesystem::last_write_time(path, ec);
+	if (ec)
+		return nullptr;
+	auto size = std::filesystem::file_size(path, ec);
+	if (ec || size > kMaxBytes)
+		return nullptr;
+
+	std::lock_guard<std::mutex> lock(mtx);
+	auto found = sources.find(path.string());
+	if (found != sources.end() && found->second.mtime == mtime && found->second.size == size)
+		return found->second.source;
+
+	std::ifstream in(path, std::ios::binary);
+	if (!in)
+		return nullptr;
+	auto source = std::make_shared<source_s>();
+	source->bytes.resize(size_t(size));
+	if (!in.read(source->bytes.data(), source->bytes.size()))
+		return nullptr;
+	source->hash = SourcePawn::ImageHasher::hash(source->bytes.data(), source->bytes.size());
+
+	sources[path.string()] = { mtime, size, source };
+	return source;
+}
@@ -0,0 +1,58 @@
+#ifndef _INCLUDE_SOURCECACHE_H_
+#define _INCLUDE_SOURCECACHE_H_
+
+#include <stdint.h>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+//
+//  Plugin sources served to clients whose own copies don't match the build
+//  that runs. Files are looked up under one configured root by the name the
+//  compiler put in the debug info, or else by its last component, and never
+//  outside the root. Like ImageCache, entries are shared by every client and
+//  reread when the file's mtime or size changes; each carries the image hash
+//  (sp_image_hash.h) of its bytes, so a client that cached a file in an
+//  earlier session only gets it again once it changed.
+//
+class SourceCache {
+public:
+	// Larger files are not served; a reply must fit the send queue.
+	static constexpr uintmax_t kMaxBytes = 8 << 20;
+
+	struct source_s {
+		uint64_t hash;
+		std::string bytes;
+	};
+
+	// Serves files from |root|. An empty root serves nothing.
+	void setRoot(const std::string& root);
+
+	bool active() const {
+		return !root.empty();
+	}
+
+	// Returns the file the debug info calls |name|, or nullptr if there is
+	// no such file under the root or it is too large. Safe to call from any
+	// thread.
+	std::shared_ptr<const source_s> get(const std::string& name);
+
+private:
+	bool resolve(const std::string& name, std::filesystem::path* path) const;
+
+	struct entry_s {
+		std::filesystem::file_time_type mtime;
+		uintmax_t size;
+		std::shared_ptr<const source_s> source;
+	};
+
+	std::filesystem::path root;
+	std::mutex mtx;
+	std::unordered_map<std::string, entry_s> sources;
+};
+
+extern SourceCache DebugSources;
+
+#endif //_INCLUDE_SOURCECACHE_H_
@@ -22,6 +22,8 @@
  *  Version: $Id$
  */
 #include <assert.h>
+#include <algorithm>
+#include <atomic>
 #include <ctype.h>
 #include <stddef.h> /* for macro offsetof() */
 #include <stdio.h>
@@ -41,6 +43,7 @@
 #endif
 #include <amtl/am-hashmap.h>
 #include <amtl/am-string.h>
+#include <amtl/am-thread-utils.h>
 #include <smx/smx-v1-opcodes.h>
 #include <smx/smx-v1.h>
 #include <zlib/zlib.h>
@@ -52,6 +55,7 @@
 #include "memfile.h"
 #include "sctracker.h"
 #include "shared/byte-buffer.h"
+#include "shared/keyword-hash.h"
 #include "sp_symhash.h"
 #include "types.h"
 
@@ -75,8 +79,15 @@ struct BackpatchEntry {
     cell target;
 };
 
+// A code cell holding a code address: a call target or a label.
+struct CodeRef {
+    size_t index;
+    bool call;
+};
+
 static ke::Vector<cell> sLabelTable;
 static ke::Vector<BackpatchEntry> sBackpatchList;
+static ke::Vector<CodeRef> sCodeRefs;
 
 class CellWriter
 {
@@ -90,8 +101,15 @@ class CellWriter
         buffer_.append(value);
         current_address_ += sizeof(value);
     }
+    void append_call(cell address) {
+        CodeRef ref = {current_index(), true};
+        sCodeRefs.append(ref);
+        append(address);
+    }
     void write_label(int index) {
         assert(index >= 0 && index < sc_labnum);
+        CodeRef ref = {current_index(), false};
+        sCodeRefs.append(ref);
         if (sLabelTable[index] < 0) {
             BackpatchEntry entry = {current_index(), index};
             sBackpatchList.append(entry);
@@ -424,7 +442,7 @@ do_call(CellWriter* writer, AsmReader* reader, cell opcode)
     assert(!sym->skipped);
 
     writer->append(opcode);
-    writer->append(sym->addr());
+    writer->append_call(sym->addr());
 }
 
 static void
@@ -615,34 +633,28 @@ static OPCODEC opcodelist[] = {
 };
 // clang-format on
 
-static ke::HashMap<CharsAndLength, int, KeywordTablePolicy> sOpcodeLookup;
+static const int kNumOpcodes = int(sizeof(opcodelist) / sizeof(*opcodelist));
+
+// Names of opcodelist[1] onward, in order.
+static const char* sOpcodeNames[kNumOpcodes - 1];
+static KeywordHash sOpcodeLookup;
 
 static void
 init_opcode_lookup()
 {
-    if (sOpcodeLookup.elements())
+    if (sOpcodeNames[0])
         return;
 
-    sOpcodeLookup.init(512);
-
-    static const int kNumOpcodes = size_t(sizeof(opcodelist) / sizeof(*opcodelist));
-    for (int i = 1; i < kNumOpcodes; i++) {
-        const auto& entry = opcodelist[i];
-        CharsAndLength key(entry.name, strlen(entry.name));
-        auto p = sOpcodeLookup.findForAdd(key);
-        assert(!p.found());
-        sOpcodeLookup.add(p, key, i);
-    }
+    for (int i = 1; i < kNumOpcodes; i++)
+        sOpcodeNames[i - 1] = opcodelist[i].name;
+    sOpcodeLookup.init(sOpcodeNames, kNumOpcodes - 1);
 }
 
 static int
 findopcode(const char* instr, size_t maxlen)
 {
-    CharsAndLength key(instr, maxlen);
-    auto p = sOpcodeLookup.find(key);
-    if (!p.found())
-        return 0;
-    return p->value;
+    // Index 0 of the opcode list is the "not found" entry.
+    return sOpcodeLookup.find(instr, maxlen) + 1;
 }
 
 // Generate code or data into a buffer.
@@ -703,6 +715,289 @@ class VerifyOpcodeSorting
 } sVerifyOpcodeSorting;
 #endif
 
+// Where function bodies were moved by order_functions(). The code is cut
+// into chunks, one per function plus whatever precedes the first; an
+// address maps to the same offset in its chunk's new position. With no
+// chunks, every address maps to itself.
+class CodeLayout
+{
+  public:
+    struct Chunk {
+        cell old_start;
+        cell old_end;
+        cell new_start;
+    };
+
+    bool moved() const {
+        return !chunks_.empty();
+    }
+    // Sorted by old_start.
+    const Vector<Chunk>& chunks() const {
+        return chunks_;
+    }
+    void set(Vector<Chunk>&& chunks) {
+        chunks_ = ke::Move(chunks);
+    }
+
+    cell map(cell address) const {
+        const Chunk* chunk = find(address);
+        if (!chunk)
+            return address;
+        return chunk->new_start + (address - chunk->old_start);
+    }
+
+    // Moves [start, end) along with the chunk it lies in. A range spanning
+    // chunks, such as a global's scope, is left alone.
+    void map_range(uint32_t* start, uint32_t* end) const {
+        const Chunk* chunk = find(*start);
+        if (!chunk || *end < *start || cell(*end) > chunk->old_end)
+            return;
+        *start = chunk->new_start + (*start - chunk->old_start);
+        *end = chunk->new_start + (*end - chunk->old_start);
+    }
+
+  private:
+    const Chunk* find(cell address) const {
+        size_t lo = 0, hi = chunks_.length();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (address < chunks_[mid].old_start)
+                hi = mid;
+            else if (address >= chunks_[mid].old_end)
+                lo = mid + 1;
+            else
+                return &chunks_[mid];
+        }
+        return nullptr;
+    }
+
+  private:
+    Vector<Chunk> chunks_;
+};
+
+static CodeLayout sCodeLayout;
+
+struct function_body {
+    symbol* sym;
+    cell start;
+    cell end;
+    uint64_t count;
+    bool placed;
+    Vector<size_t> callees;
+};
+
+static int
+sort_bodies(const void* a1, const void* a2)
+{
+    const function_body* b1 = *(const function_body**)a1;
+    const function_body* b2 = *(const function_body**)a2;
+    return (b1->start > b2->start) - (b1->start < b2->start);
+}
+
+// Reads "<function> <count>" lines, as saved from the debugger's
+// per-function call counts, adding each count to the body it names. Blank
+// lines and lines starting with '#' are skipped.
+static void
+read_profile(const char* path, Vector<function_body>& bodies,
+             ke::HashMap<symbol*, size_t, ke::PointerPolicy<symbol>>& index)
+{
+    FILE* fp = fopen(path, "rt");
+    if (!fp) {
+        error(FATAL_ERROR_READ, path);
+        return;
+    }
+
+    char line[sLINEMAX + 1];
+    while (fgets(line, sizeof(line), fp)) {
+        char* name = line;
+        while (isspace(*name))
+            name++;
+        if (*name == '\0' || *name == '#')
+            continue;
+
+        char* end = name;
+        while (*end && !isspace(*end))
+            end++;
+        if (!*end)
+            continue;
+        *end++ = '\0';
+
+        uint64_t count = strtoull(end, nullptr, 10);
+        symbol* sym = findglb(name);
+        if (!sym || !count)
+            continue;
+
+        auto p = index.find(sym);
+        if (p.found())
+            bodies[p->value].count += count;
+    }
+    fclose(fp);
+}
+
+// Orders function bodies by the call counts in the profile file: starting
+// from the most called function not yet placed, each is followed by its
+// most called callee, that callee's own callees, and so on, so that a hot
+// path is laid out contiguously. Functions the profile never saw keep
+// their order, after the others. Call and jump operands, function
+// addresses, and (through sCodeLayout) the debug tables are all rewritten
+// to the new layout.
+static void
+order_functions(Vector<cell>* code_buffer)
+{
+    cell code_end = cell(code_buffer->length() * sizeof(cell));
+
+    Vector<function_body> bodies;
+    for (symbol* sym = glbtab.next; sym; sym = sym->next) {
+        if (sym->ident != iFUNCTN || sym->native || !sym->defined || sym->skipped)
+            continue;
+        if (sym->addr() < 0 || sym->codeaddr <= sym->addr())
+            continue;
+        function_body body;
+        body.sym = sym;
+        body.start = sym->addr();
+        body.end = sym->codeaddr;
+        body.count = 0;
+        body.placed = false;
+        bodies.append(ke::Move(body));
+    }
+    if (bodies.length() < 2)
+        return;
+
+    {
+        Vector<function_body*> sorted;
+        for (auto& body : bodies)
+            sorted.append(&body);
+        qsort(sorted.buffer(), sorted.length(), sizeof(function_body*), sort_bodies);
+
+        Vector<function_body> by_start;
+        for (function_body* body : sorted)
+            by_start.append(ke::Move(*body));
+        bodies = ke::Move(by_start);
+    }
+
+    // Each chunk runs up to the next function, taking in anything emitted
+    // between the two.
+    for (size_t i = 0; i < bodies.length(); i++) {
+        assert(i == 0 || bodies[i].start > bodies[i - 1].start);
+        bodies[i].end = (i + 1 < bodies.length()) ? bodies[i + 1].start : code_end;
+    }
+
+    ke::HashMap<symbol*, size_t, ke::PointerPolicy<symbol>> index;
+    index.init(bodies.length() * 2);
+    for (size_t i = 0; i < bodies.length(); i++)
+        index.add(index.findForAdd(bodies[i].sym), bodies[i].sym, i);
+
+    read_profile(sc_profilefile.chars(), bodies, index);
+
+    // Finds the body holding |address|.
+    auto body_at = [&](cell address) -> size_t {
+        size_t lo = 0, hi = bodies.length();
+        while (lo + 1 < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (address < bodies[mid].start)
+                hi = mid;
+            else
+                lo = mid;
+        }
+        return lo;
+    };
+
+    for (const auto& ref : sCodeRefs) {
+        if (!ref.call)
+            continue;
+        cell from = cell(ref.index * sizeof(cell));
+        cell target = code_buffer->at(ref.index);
+        if (from < bodies[0].start || target < bodies[0].start)
+            continue;
+        function_body& caller = bodies[body_at(from)];
+        size_t callee = body_at(target);
+        if (bodies[callee].start != target || !bodies[callee].count)
+            continue;
+        bool known = false;
+        for (size_t other : caller.callees)
+            known |= (other == callee);
+        if (!known)
+            caller.callees.append(callee);
+    }
+
+    Vector<size_t> hot;
+    for (size_t i = 0; i < bodies.length(); i++) {
+        if (bodies[i].count)
+            hot.append(i);
+    }
+    if (hot.empty())
+        return;
+
+    auto hotter = [&](size_t a, size_t b) -> bool {
+        return bodies[a].count > bodies[b].count;
+    };
+    std::stable_sort(hot.buffer(), hot.buffer() + hot.length(), hotter);
+
+    Vector<size_t> order;
+    Vector<size_t> stack;
+    for (size_t seed : hot) {
+        stack.append(seed);
+        while (!stack.empty()) {
+            function_body& body = bodies[stack.popCopy()];
+            if (body.placed)
+                continue;
+            body.placed = true;
+            order.append(&body - bodies.buffer());
+
+            // The hottest callee goes on top, to be placed next.
+            Vector<size_t>& callees = body.callees;
+            std::stable_sort(callees.buffer(), callees.buffer() + callees.length(), hotter);
+            for (size_t i = callees.length(); i > 0; i--) {
+                if (!bodies[callees[i - 1]].placed)
+                    stack.append(callees[i - 1]);
+            }
+        }
+    }
+    for (size_t i = 0; i < bodies.length(); i++) {
+        if (!bodies[i].placed)
+            order.append(i);
+    }
+
+    bool identity = true;
+    for (size_t i = 0; i < order.length(); i++)
+        identity &= (order[i] == i);
+    if (identity)
+        return;
+
+    Vector<CodeLayout::Chunk> chunks;
+    chunks.resize(bodies.length() + 1);
+    chunks[0].old_start = 0;
+    chunks[0].old_end = bodies[0].start;
+    chunks[0].new_start = 0;
+
+    Vector<cell> code;
+    for (cell i = 0; i < bodies[0].start; i += sizeof(cell))
+        code.append(code_buffer->at(i / sizeof(cell)));
+    for (size_t i : order) {
+        const function_body& body = bodies[i];
+        CodeLayout::Chunk& chunk = chunks[i + 1];
+        chunk.old_start = body.start;
+        chunk.old_end = body.end;
+        chunk.new_start = cell(code.length() * sizeof(cell));
+        for (cell addr = body.start; addr < body.end; addr += sizeof(cell))
+            code.append(code_buffer->at(addr / sizeof(cell)));
+    }
+    sCodeLayout.set(ke::Move(chunks));
+
+    for (const auto& ref : sCodeRefs) {
+        size_t new_index = sCodeLayout.map(cell(ref.index * sizeof(cell))) / sizeof(cell);
+        code[new_index] = sCodeLayout.map(code_buffer->at(ref.index));
+    }
+    for (const auto& body : bodies) {
+        symbol* sym = body.sym;
+        cell new_start = sCodeLayout.map(sym->addr());
+        sym->codeaddr = new_start + (sym->codeaddr - sym->addr());
+        sym->setAddr(new_start);
+    }
+
+    *code_buffer = ke::Move(code);
+}
+
 static int
 sort_by_name(const void* a1, const void* a2)
 {
@@ -861,6 +1156,10 @@ RttiBuilder::finish(SmxBuilder& builder)
 
     const ByteBuffer& buffer = type_pool_.buffer();
     data_->add(buffer.bytes(), buffer.size());
+    if (sc_symbolstats) {
+        pc_printf("Type pool:         %8u bytes (%u more without sharing)\n",
+                  (unsigned)buffer.size(), (unsigned)type_pool_.bytes_saved());
+    }
 
     builder.add(data_);
     builder.add(methods_);
@@ -880,6 +1179,53 @@ RttiBuilder::finish(SmxBuilder& builder)
     builder.add(dbg_locals_);
 }
 
+// The file a range of code came from, starting at |addr| and running to
+// the next change.
+struct file_change {
+    cell addr;
+    const char* name;
+};
+
+// Rebuilds the file table for the moved chunks: each starts with the file
+// in effect where it used to start, followed by the changes inside it.
+static Vector<file_change>
+relocate_files(const Vector<file_change>& files)
+{
+    Vector<CodeLayout::Chunk> chunks;
+    for (const auto& chunk : sCodeLayout.chunks())
+        chunks.append(chunk);
+    std::sort(chunks.buffer(), chunks.buffer() + chunks.length(),
+              [](const CodeLayout::Chunk& a, const CodeLayout::Chunk& b) -> bool {
+                  return a.new_start < b.new_start;
+              });
+
+    Vector<file_change> moved;
+    auto add = [&moved](cell addr, const char* name) -> void {
+        if (!moved.empty() && !strcmp(moved.back().name, name))
+            return;
+        moved.append(file_change{addr, name});
+    };
+
+    for (const auto& chunk : chunks) {
+        if (chunk.old_start == chunk.old_end)
+            continue;
+
+        // The last change at or before the chunk's start.
+        const file_change* begin = files.buffer();
+        const file_change* end = begin + files.length();
+        const file_change* next =
+            std::upper_bound(begin, end, chunk.old_start,
+                             [](cell addr, const file_change& change) -> bool {
+                                 return addr < change.addr;
+                             });
+        if (next != begin)
+            add(chunk.new_start, (next - 1)->name);
+        for (; next != end && next->addr < chunk.old_end; next++)
+            add(chunk.new_start + (next->addr - chunk.old_start), next->name);
+    }
+    return moved;
+}
+
 void
 RttiBuilder::build_debuginfo()
 {
@@ -889,6 +1235,7 @@ RttiBuilder::build_debuginfo()
     // behavior here which excludes duplicate addresses.
     ucell prev_file_addr = 0;
     const char* prev_file_name = nullptr;
+    Vector<file_change> files;
 
     // Add debug data.
     for (stringlist* iter = dbgstrs; iter; iter = iter->next) {
@@ -900,11 +1247,8 @@ RttiBuilder::build_debuginfo()
             case 'F': {
                 ucell codeidx = str.parse();
                 if (codeidx != prev_file_addr) {
-                    if (prev_file_name) {
-                        sp_fdbg_file_t& entry = dbg_files_->add();
-                        entry.addr = prev_file_addr;
-                        entry.name = names_->add(gAtoms, prev_file_name);
-                    }
+                    if (prev_file_name)
+                        files.append(file_change{cell(prev_file_addr), prev_file_name});
                     prev_file_addr = codeidx;
                 }
                 prev_file_name = str.skipspaces();
@@ -913,7 +1257,7 @@ RttiBuilder::build_debuginfo()
 
             case 'L': {
                 sp_fdbg_line_t& entry = dbg_lines_->add();
-                entry.addr = str.parse();
+                entry.addr = sCodeLayout.map(str.parse());
                 entry.line = str.parse();
                 break;
             }
@@ -925,10 +1269,25 @@ RttiBuilder::build_debuginfo()
     }
 
     // Add the last file.
-    if (prev_file_name) {
+    if (prev_file_name)
+        files.append(file_change{cell(prev_file_addr), prev_file_name});
+
+    if (sCodeLayout.moved()) {
+        // Lines are looked up by address, so they must stay in order.
+        if (dbg_lines_->count()) {
+            sp_fdbg_line_t* lines = &dbg_lines_->at(0);
+            std::stable_sort(lines, lines + dbg_lines_->count(),
+                             [](const sp_fdbg_line_t& a, const sp_fdbg_line_t& b) -> bool {
+                                 return a.addr < b.addr;
+                             });
+        }
+        files = relocate_files(files);
+    }
+
+    for (const auto& change : files) {
         sp_fdbg_file_t& entry = dbg_files_->add();
-        entry.addr = prev_file_addr;
-        entry.name = names_->add(gAtoms, prev_file_name);
+        entry.addr = change.addr;
+        entry.name = names_->add(gAtoms, change.name);
     }
 
     // Finish up debug header statistics.
@@ -949,6 +1308,7 @@ RttiBuilder::add_debug_var(SmxRttiTable<smx_rtti_debug_var>* table, DebugString&
     const char* name_end = str.skipto(' ');
     uint32_t code_start = str.parse();
     uint32_t code_end = str.parse();
+    sCodeLayout.map_range(&code_start, &code_end);
     int ident = str.parse();
     int vclass = str.parse();
     bool is_const = !!str.parse();
@@ -1474,8 +1834,24 @@ assemble_to_buffer(SmxByteBuffer* buffer, memfile_t* fin)
         }
     }
 
-    // The public list must be sorted.
+    // The public list must be sorted. Function ids are needed to generate
+    // code; addresses are final only once it is generated.
     qsort(functions.buffer(), functions.length(), sizeof(function_entry), sort_functions);
+    for (size_t i = 0; i < functions.length(); i++)
+        functions[i].sym->function()->funcid = (uint32_t(i) << 1) | 1;
+
+    for (int i = 1; i <= sc_labnum; i++)
+        sLabelTable.append(-1);
+    assert(sLabelTable.length() == size_t(sc_labnum));
+
+    // Generate buffers.
+    AsmReader reader(fin);
+    Vector<cell> code_buffer, data_buffer;
+    generate_segment(reader, &code_buffer, &data_buffer);
+
+    if (sc_profilefile.length())
+        order_functions(&code_buffer);
+
     for (size_t i = 0; i < functions.length(); i++) {
         function_entry& f = functions[i];
         symbol* sym = f.sym;
@@ -1488,20 +1864,9 @@ assemble_to_buffer(SmxByteBuffer* buffer, memfile_t* fin)
         pubfunc.address = sym->addr();
         pubfunc.name = names->add(gAtoms, f.name.chars());
 
-        sym->function()->funcid = (uint32_t(i) << 1) | 1;
-
         rtti.add_method(sym);
     }
 
-    for (int i = 1; i <= sc_labnum; i++)
-        sLabelTable.append(-1);
-    assert(sLabelTable.length() == size_t(sc_labnum));
-
-    // Generate buffers.
-    AsmReader reader(fin);
-    Vector<cell> code_buffer, data_buffer;
-    generate_segment(reader, &code_buffer, &data_buffer);
-
     // Populate the native table.
     for (size_t i = 0; i < reader.native_list().length(); i++) {
         symbol* sym = reader.native_list()[i];
@@ -1548,6 +1913,9 @@ assemble_to_buffer(SmxByteBuffer* buffer, memfile_t* fin)
     builder.add(names);
     rtti.finish(builder);
 
+    // Every section knows its size by now, so the file is written into a
+    // buffer of that size rather than one that grows as it goes.
+    buffer->reserve(builder.length());
     builder.write(buffer);
 }
 
@@ -1568,6 +1936,108 @@ splat_to_binary(const char* binfname, const void* bytes, size_t size)
     fclose(fp);
 }
 
+// Input compressed by each thread at a time, as in pigz.
+static const size_t kCompressChunkSize = 128 * 1024;
+
+// Deflate keeps a window of this much input.
+static const size_t kCompressWindowSize = 32 * 1024;
+
+struct CompressedChunk {
+    UniquePtr<Bytef[]> bytes;
+    size_t length;
+    int err;
+};
+
+static void
+compress_chunk(const Bytef* data, size_t size, size_t start, int level, CompressedChunk* chunk)
+{
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    chunk->length = 0;
+    chunk->err = deflateInit2(&strm, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+    if (chunk->err != Z_OK)
+        return;
+
+    // Each chunk is primed with the input before it, so it compresses as
+    // densely as it would have in one stream.
+    size_t dict = ke::Min(start, kCompressWindowSize);
+    if (dict)
+        chunk->err = deflateSetDictionary(&strm, data + start - dict, (uInt)dict);
+
+    size_t length = ke::Min(kCompressChunkSize, size - start);
+    bool last = (start + length == size);
+
+    // A sync flush adds an empty stored block, which deflateBound() leaves out.
+    size_t bound = deflateBound(&strm, (uLong)length) + 16;
+    chunk->bytes = MakeUnique<Bytef[]>(bound);
+
+    strm.next_in = const_cast<Bytef*>(data + start);
+    strm.avail_in = (uInt)length;
+    strm.next_out = chunk->bytes.get();
+    strm.avail_out = (uInt)bound;
+    if (chunk->err == Z_OK) {
+        // Every chunk but the last ends byte-aligned and without a final
+        // block, so the chunks can be joined into one stream.
+        int rv = deflate(&strm, last ? Z_FINISH : Z_SYNC_FLUSH);
+        if (last && rv == Z_STREAM_END)
+            chunk->err = Z_OK;
+        else if (!last && rv == Z_OK && strm.avail_in == 0 && strm.avail_out != 0)
+            chunk->err = Z_OK;
+        else
+            chunk->err = (rv == Z_OK || rv == Z_STREAM_END) ? Z_BUF_ERROR : rv;
+    }
+    chunk->length = bound - strm.avail_out;
+    deflateEnd(&strm);
+}
+
+// Compresses "data" into one zlib stream, like compress2(), but in chunks
+// deflated on several threads.
+static int
+compress_parallel(ByteBuffer* out, const Bytef* data, size_t size, int level, int threads)
+{
+    size_t nchunks = (size + kCompressChunkSize - 1) / kCompressChunkSize;
+    UniquePtr<CompressedChunk[]> chunks = MakeUnique<CompressedChunk[]>(nchunks);
+
+    std::atomic<size_t> next(0);
+    auto compress = [&]() -> void {
+        for (size_t i = next++; i < nchunks; i = next++)
+            compress_chunk(data, size, i * kCompressChunkSize, level, &chunks[i]);
+    };
+
+    Vector<UniquePtr<ke::Thread>> workers;
+    for (int i = 1; i < threads && size_t(i) < nchunks; i++) {
+        UniquePtr<ke::Thread> thread(new ke::Thread(compress, "spcomp compressor"));
+        if (!thread->Succeeded())
+            break;
+        workers.append(ke::Move(thread));
+    }
+    compress();
+    for (const auto& thread : workers)
+        thread->Join();
+
+    for (size_t i = 0; i < nchunks; i++) {
+        if (chunks[i].err != Z_OK)
+            return chunks[i].err;
+    }
+
+    // The zlib header, with the level flags deflate() would write (RFC 1950).
+    int flevel = (level < 2) ? 0 : (level < 6) ? 1 : (level == 6) ? 2 : 3;
+    uint8_t cmf = 0x78;
+    uint8_t flg = uint8_t(flevel << 6);
+    flg |= 31 - ((cmf << 8) | flg) % 31;
+    out->writeBytes(&cmf, 1);
+    out->writeBytes(&flg, 1);
+
+    for (size_t i = 0; i < nchunks; i++)
+        out->writeBytes(chunks[i].bytes.get(), chunks[i].length);
+
+    uLong check = adler32(adler32(0, Z_NULL, 0), data, (uInt)size);
+    uint8_t trailer[4] = {uint8_t(check >> 24), uint8_t(check >> 16), uint8_t(check >> 8),
+                          uint8_t(check)};
+    out->writeBytes(trailer, sizeof(trailer));
+    return Z_OK;
+}
+
 void
 assemble(const char* binfname, memfile_t* fin)
 {
@@ -1579,8 +2049,29 @@ assemble(const char* binfname, memfile_t* fin)
     // Buffer compression logic.
     sp_file_hdr_t* header = (sp_file_hdr_t*)buffer.bytes();
 
+    size_t region_size = header->imagesize - header->dataoffs;
+    if (sc_compression_level && sc_compression_threads > 1 && region_size > kCompressChunkSize) {
+        ByteBuffer new_buffer;
+        new_buffer.writeBytes(buffer.bytes(), header->dataoffs);
+
+        const Bytef* region = (const Bytef*)(buffer.bytes() + header->dataoffs);
+        int err = compress_parallel(&new_buffer, region, region_size, sc_compression_level,
+                                    sc_compression_threads);
+        if (err == Z_OK) {
+            // The header was copied before these were known.
+            sp_file_hdr_t* new_header = (sp_file_hdr_t*)new_buffer.bytes();
+            new_header->disksize = new_buffer.size();
+            new_header->compression = SmxConsts::FILE_COMPRESSION_GZ;
+
+            splat_to_binary(binfname, new_buffer.bytes(), new_buffer.size());
+            return;
+        }
+
+        // Try again in one stream.
+        pc_printf("Unable to compress on several threads, error %d\n", err);
+    }
+
     if (sc_compression_level) {
-        size_t region_size = header->imagesize - header->dataoffs;
         size_t zbuf_max = compressBound(region_size);
         UniquePtr<Bytef[]> zbuf = MakeUnique<Bytef[]>(zbuf_max);
 
@@ -1592,6 +2083,7 @@ assemble(const char* binfname, memfile_t* fin)
             header->compression = SmxConsts::FILE_COMPRESSION_GZ;
 
             ByteBuffer new_buffer;
+            new_buffer.reserve(header->dataoffs + new_disksize);
             new_buffer.writeBytes(buffer.bytes(), header->dataoffs);
             new_buffer.writeBytes(zbuf.get(), new_disksize);
 
@@ -0,0 +1,388 @@
+// vim: set ts=8 sts=4 sw=4 tw=99 et:
+//
+// Copyright (C) 2018 AlliedModders LLC
+//
+// This file is part of SourcePawn.
+//
+// SourcePawn is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// SourcePawn is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+#include "compile-server.h"
+#include <amtl/am-vector.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libpawnc.h"
+#include "sc.h"
+
+#if (defined __linux__ || defined __FreeBSD__ || defined __OpenBSD__ || defined DARWIN) && \
+    !defined __EMSCRIPTEN__
+#    define HAVE_COMPILE_SERVER
+#    include <dirent.h>
+#    include <signal.h>
+#    include <sys/socket.h>
+#    include <sys/stat.h>
+#    include <sys/types.h>
+#    include <sys/un.h>
+#    include <sys/wait.h>
+#    include <unistd.h>
+#endif
+
+/* The compiler keeps its state in globals, so a server cannot run two compiles
+ * side by side, or one after the other, in one process. Instead it forks a
+ * process per job: jobs are isolated from each other and from the server, they
+ * run concurrently, and each starts with the server's source cache, which holds
+ * every include file in the server's include folders.
+ *
+ * A job is the client's working directory and then the compiler arguments,
+ * each ending in a NUL, with an empty string after the last. The reply is what
+ * the compiler prints, then a NUL and the exit code in one byte.
+ *
+ * Include files are only found in the cache under the name the compiler opens
+ * them by, so the clients should name include folders the way the server does:
+ * as absolute paths. The default "include" folder is always kept.
+ */
+
+#if defined HAVE_COMPILE_SERVER
+
+#define sMAXJOB (64 * 1024)  /* longest job, in bytes */
+#define sMAXINCLUDEDEPTH 4 /* sub-folders of an include folder that are kept */
+
+static ke::Vector<char*> sIncludeDirs;
+
+static void
+add_includedir(const char* dir)
+{
+    for (size_t i = 0; i < sIncludeDirs.length(); i++) {
+        if (strcmp(sIncludeDirs[i], dir) == 0)
+            return;
+    }
+    sIncludeDirs.append(strdup(dir));
+}
+
+static int
+write_all(int fd, const char* data, size_t length)
+{
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return FALSE;
+        data += n;
+        length -= n;
+    }
+    return TRUE;
+}
+
+static int
+open_socket(const char* name, struct sockaddr_un* addr)
+{
+    if (strlen(name) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "socket path too long: %s\n", name);
+        return -1;
+    }
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, name);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        fprintf(stderr, "socket failed: %s\n", strerror(errno));
+    return fd;
+}
+
+/* preload_dir
+ * Reads the include files in "dir", which ends in a DIRSEP_CHAR, and in its
+ * sub-folders into the source cache.
+ */
+static void
+preload_dir(const char* dir, int depth)
+{
+    DIR* listing = opendir(dir);
+    if (listing == NULL)
+        return;
+
+    struct dirent* entry;
+    while ((entry = readdir(listing)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+        char path[_MAX_PATH];
+        if ((size_t)snprintf(path, sizeof(path), "%s%s", dir, entry->d_name) >= sizeof(path))
+            continue;
+
+        struct stat info;
+        if (stat(path, &info) != 0)
+            continue;
+        if (S_ISDIR(info.st_mode)) {
+            size_t len = strlen(path);
+            if (depth < sMAXINCLUDEDEPTH && len + 1 < sizeof(path)) {
+                path[len] = DIRSEP_CHAR;
+                path[len + 1] = '\0';
+                preload_dir(path, depth + 1);
+            }
+        } else {
+            const char* ext = strrchr(entry->d_name, '.');
+            if (ext != NULL && strcmp(ext, ".inc") == 0)
+                pc_preloadsrc(path);
+        }
+    }
+    closedir(listing);
+}
+
+/* warm_cache
+ * Brings the source cache up to date before a job is forked off: changed and
+ * removed files are dropped, new and changed ones read.
+ */
+static void
+warm_cache(void)
+{
+    pc_revalidatesrccache();
+    for (size_t i = 0; i < sIncludeDirs.length(); i++)
+        preload_dir(sIncludeDirs[i], 0);
+}
+
+static int
+read_job(int fd, char* job, size_t* length)
+{
+    size_t used = 0;
+    for (;;) {
+        if (used >= 2 && job[used - 1] == '\0' && job[used - 2] == '\0')
+            break;
+        if (used == sMAXJOB)
+            return FALSE;
+        ssize_t n = read(fd, job + used, sMAXJOB - used);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return FALSE;
+        used += n;
+    }
+    *length = used;
+    return TRUE;
+}
+
+/* run_job
+ * Runs in the process forked off for one connection: reads the job, compiles
+ * it in a process of its own, so that the compiler may exit() on a fatal
+ * error, and sends its exit code.
+ */
+static void
+run_job(int fd, char* root)
+{
+    signal(SIGCHLD, SIG_DFL);
+
+    char* job = (char*)malloc(sMAXJOB);
+    size_t length;
+    if (job == NULL || !read_job(fd, job, &length))
+        _exit(1);
+
+    const char* cwd = job;
+    ke::Vector<char*> args;
+    args.append(root);
+    for (char* ptr = job + strlen(job) + 1; *ptr != '\0'; ptr += strlen(ptr) + 1)
+        args.append(ptr);
+    args.append(NULL);
+
+    int code = 1;
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+        if (chdir(cwd) != 0) {
+            fprintf(stderr, "chdir failed: %s\n", strerror(errno));
+            exit(1);
+        }
+        exit(pc_compile((int)args.length() - 1, args.buffer()));
+    }
+    if (pid > 0) {
+        int status;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+            ;
+        if (WIFEXITED(status))
+            code = WEXITSTATUS(status);
+    } else {
+        const char* message = "fork failed\n";
+        write_all(fd, message, strlen(message));
+    }
+
+    char trailer[2] = {'\0', (char)code};
+    write_all(fd, trailer, sizeof(trailer));
+    close(fd);
+    _exit(0);
+}
+
+int
+pc_compileserver(int argc, char** argv)
+{
+    char root[_MAX_PATH];
+    char path[_MAX_PATH];
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s --server <socket> [-i <folder>]...\n", argv[0]);
+        return 1;
+    }
+
+    /* jobs run in the client's directory, so relative paths would not do */
+    if (realpath(argv[0], root) == NULL)
+        strlcpy(root, argv[0], sizeof(root));
+    if (pc_defaultinclude(root, path))
+        add_includedir(path);
+    for (int i = 3; i < argc; i++) {
+        const char* dir = argv[i];
+        if (strncmp(dir, "-i", 2) == 0 && dir[2] != '\0') {
+            dir += 2;
+        } else if (strcmp(dir, "-i") == 0 && i + 1 < argc) {
+            dir = argv[++i];
+        } else {
+            fprintf(stderr, "unknown server option: %s\n", dir);
+            return 1;
+        }
+        if (realpath(dir, path) == NULL) {
+            fprintf(stderr, "cannot find include folder %s: %s\n", dir, strerror(errno));
+            return 1;
+        }
+        size_t len = strlen(path);
+        if (len + 1 < sizeof(path) && path[len - 1] != DIRSEP_CHAR) {
+            path[len] = DIRSEP_CHAR;
+            path[len + 1] = '\0';
+        }
+        add_includedir(path);
+    }
+
+    struct sockaddr_un addr;
+    int listener = open_socket(argv[2], &addr);
+    if (listener < 0)
+        return 1;
+    unlink(argv[2]);
+    if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 16) != 0) {
+        fprintf(stderr, "cannot listen on %s: %s\n", argv[2], strerror(errno));
+        close(listener);
+        return 1;
+    }
+
+    /* job processes are reaped by the system */
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+
+    warm_cache();
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            fprintf(stderr, "accept failed: %s\n", strerror(errno));
+            break;
+        }
+
+        warm_cache();
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(listener);
+            run_job(fd, root);
+        }
+        if (pid < 0) {
+            char reply[] = "fork failed\n\0\1";
+            write_all(fd, reply, sizeof(reply) - 1);
+        }
+        close(fd);
+    }
+
+    close(listener);
+    unlink(argv[2]);
+    return 1;
+}
+
+int
+pc_compileclient(int argc, char** argv)
+{
+    char cwd[_MAX_PATH];
+
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s --connect <socket> [options] <filename> [filename...]\n",
+                argv[0]);
+        return 1;
+    }
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        fprintf(stderr, "getcwd failed: %s\n", strerror(errno));
+        return 1;
+    }
+
+    struct sockaddr_un addr;
+    int fd = open_socket(argv[2], &addr);
+    if (fd < 0)
+        return 1;
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "cannot connect to %s: %s\n", argv[2], strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    int ok = write_all(fd, cwd, strlen(cwd) + 1);
+    for (int i = 3; ok && i < argc; i++) {
+        /* an empty argument would end the job */
+        if (argv[i][0] != '\0')
+            ok = write_all(fd, argv[i], strlen(argv[i]) + 1);
+    }
+    ok = ok && write_all(fd, "", 1);
+    if (!ok) {
+        fprintf(stderr, "cannot send the job to %s\n", argv[2]);
+        close(fd);
+        return 1;
+    }
+
+    /* pass the output on as it comes, except for the last two bytes, which end
+     * up being the trailer */
+    char buffer[4096 + 2];
+    size_t held = 0;
+    ssize_t n;
+    while ((n = read(fd, buffer + held, sizeof(buffer) - held)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        size_t total = held + n;
+        if (total > 2) {
+            fwrite(buffer, 1, total - 2, stdout);
+            memmove(buffer, buffer + total - 2, 2);
+            held = 2;
+        } else {
+            held = total;
+        }
+    }
+    close(fd);
+
+    if (held == 2 && buffer[0] == '\0')
+        return (unsigned char)buffer[1];
+    fwrite(buffer, 1, held, stdout);
+    fprintf(stderr, "the compile server closed the connection\n");
+    return 1;
+}
+
+#else
+
+int
+pc_compileserver(int argc, char** argv)
+{
+    fprintf(stderr, "this build of the compiler has no compile server\n");
+    return 1;
+}
+
+int
+pc_compileclient(int argc, char** argv)
+{
+    return pc_compileserver(argc, argv);
+}
+
+#endif
@@ -0,0 +1,33 @@
+// vim: set ts=8 sts=4 sw=4 tw=99 et:
+//
+// Copyright (C) 2018 AlliedModders LLC
+//
+// This file is part of SourcePawn.
+//
+// SourcePawn is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// SourcePawn is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+#ifndef _include_spcomp_compile_server_h_
+#define _include_spcomp_compile_server_h_
+
+/* spcomp --server <socket> [-i <folder>]...
+ * Listens on a local socket and compiles the jobs sent to it, keeping the
+ * include files read between jobs. Returns only on an error.
+ */
+int pc_compileserver(int argc, char** argv);
+
+/* spcomp --connect <socket> [options] <filename> [filename...]
+ * Has a compile server run the compiler with these options, in the current
+ * directory, and returns its exit code.
+ */
+int pc_compileclient(int argc, char** argv);
+
+#endif // _include_spcomp_compile_server_h_
@@ -40,6 +40,8 @@
 #include "scvars.h"
 
 static int fcurseg; /* the file number (fcurrent) for the active segment */
+static int break_line = -1; /* line of the last "break" in this basic block */
+static short break_file;    /* file (fcurrent) of that "break" */
 
 void load_i();
 
@@ -148,7 +150,19 @@ setline(int chkbounds)
         stgwrite("\t; line ");
         outval(fline, TRUE);
     }
+    /* With sc_nobreaks, the debugger finds statements through the line table
+     * only (the JIT places patchable breakpoint sites there). With
+     * sc_coalescebreaks, a statement on the line that the last "break" of the
+     * basic block already stopped at gets none; setlabel() and startfunc()
+     * start a new block.
+     */
+    if (sc_nobreaks)
+        return;
     if ((sc_debug & sSYMBOLIC) != 0 || (chkbounds && (sc_debug & sCHKBOUNDS) != 0)) {
+        if (sc_coalescebreaks && break_line == fline && break_file == fcurrent)
+            return;
+        break_line = fline;
+        break_file = fcurrent;
         /* generate a "break" (start statement) opcode rather than a "line" opcode
          * because earlier versions of Small/Pawn have an incompatible version of the
          * line opcode
@@ -188,6 +202,7 @@ void
 setlabel(int number)
 {
     assert(number >= 0);
+    break_line = -1;
     stgwrite("l.");
     stgwrite((char*)itoh(number));
     /* To assist verification of the assembled code, put the address of the
@@ -235,6 +250,7 @@ markexpr(optmark type, const char* name, cell offset)
 void
 startfunc(const char* fname)
 {
+    break_line = -1;
     stgwrite("\tproc");
     if (sc_asmfile) {
         char symname[2 * sNAMEMAX + 16];
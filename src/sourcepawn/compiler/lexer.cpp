@@ -44,6 +44,7 @@
 #if defined __linux__ || defined __FreeBSD__ || defined __OpenBSD__
 #    include "sclinux.h"
 #endif
+#include "shared/keyword-hash.h"
 #include "sp_symhash.h"
 #include "types.h"
 
@@ -79,7 +80,7 @@ static int listline = -1; /* "current line" for the list file */
 
 static bool sLiteralQueueDisabled = false;
 
-ke::HashMap<CharsAndLength, int, KeywordTablePolicy> sKeywords;
+static KeywordHash sKeywords;
 
 AutoDisableLiteralQueue::AutoDisableLiteralQueue()
  : prev_value_(sLiteralQueueDisabled)
@@ -91,6 +92,196 @@ AutoDisableLiteralQueue::~AutoDisableLiteralQueue() {
     sLiteralQueueDisabled = prev_value_;
 }
 
+/* skips white space and comments, carrying a block comment over to the next
+ * line in "incomment"; unlike stripcom(), nothing is reported
+ */
+static const unsigned char*
+skipblanks(const unsigned char* ptr, int* incomment)
+{
+    for (;;) {
+        if (*incomment) {
+            while (*ptr != '\0' && !(*ptr == '*' && *(ptr + 1) == '/'))
+                ptr++;
+            if (*ptr == '\0')
+                return ptr;
+            ptr += 2;
+            *incomment = FALSE;
+        }
+        while (*ptr <= ' ' && *ptr != '\0')
+            ptr++;
+        if (*ptr == '/' && *(ptr + 1) == '*') {
+            *incomment = TRUE;
+            ptr += 2;
+        } else if (*ptr == '/' && *(ptr + 1) == '/') {
+            return ptr + strlen((const char*)ptr);
+        } else {
+            return ptr;
+        }
+    }
+}
+
+/* skips the rest of a line, with its literals and comments */
+static void
+skipline(const unsigned char* ptr, int* incomment)
+{
+    while (*(ptr = skipblanks(ptr, incomment)) != '\0') {
+        if (*ptr == '\"' || *ptr == '\'') {
+            unsigned char c = *ptr++;
+            while (*ptr != c && *ptr != '\0') {
+                if (*ptr == sc_ctrlchar && *(ptr + 1) != '\0')
+                    ptr++;
+                ptr++;
+            }
+            if (*ptr != '\0')
+                ptr++;
+        } else {
+            ptr++;
+        }
+    }
+}
+
+/* the directive at "ptr" if it is "word", plus any white space behind it */
+static const unsigned char*
+skipdirective(const unsigned char* ptr, const char* word)
+{
+    size_t len = strlen(word);
+
+    if (*ptr++ != '#')
+        return NULL;
+    while (*ptr <= ' ' && *ptr != '\0')
+        ptr++;
+    if (strncmp((const char*)ptr, word, len) != 0 || alphanum(ptr[len]))
+        return NULL;
+    for (ptr += len; *ptr <= ' ' && *ptr != '\0'; ptr++)
+        /* nothing */;
+    return ptr;
+}
+
+/* reads the next line for includeguard(); FALSE at the end of the file or on
+ * lines that are continued or too long, which the scan does not follow
+ */
+static int
+guardline(void* fp, unsigned char* line)
+{
+    unsigned char* ptr;
+
+    if (pc_readsrc(fp, line, sLINEMAX) == NULL)
+        return FALSE;
+    if ((ptr = (unsigned char*)strchr((char*)line, '\n')) == NULL)
+        return pc_eofsrc(fp) && strchr((char*)line, '\\') == NULL;
+    while (ptr > line && *(ptr - 1) <= ' ')
+        ptr--;
+    return ptr == line || *(ptr - 1) != '\\';
+}
+
+/*  includeguard
+ *
+ *  Returns the macro that guards the include file "fp" against being read
+ *  twice, or an empty string. Both idioms are recognized, with only white
+ *  space and comments before them:
+ *
+ *     #if defined NAME           #if !defined NAME
+ *         #endinput                  ...the whole file...
+ *     #endif                     #endif
+ *
+ *  While NAME is a macro, reading either file has no effect. Each file is
+ *  scanned once per compile; the position in "fp" is left as it was.
+ */
+static const char*
+includeguard(void* fp, const char* filename)
+{
+    const char* macro;
+    unsigned char* line;
+    const unsigned char* ptr;
+    char name[sNAMEMAX + 1];
+    void* mark;
+    int incomment, negated, paren, depth, len;
+    int found = FALSE;
+
+    if (find_includeguard(filename, &macro))
+        return macro;
+    if ((line = (unsigned char*)malloc((sLINEMAX + 1) * sizeof(unsigned char))) == NULL)
+        return "";
+    mark = pc_getpossrc(fp);
+
+    /* the first directive: "#if defined NAME" or "#if !defined NAME" */
+    incomment = FALSE;
+    ptr = NULL;
+    while (guardline(fp, line)) {
+        ptr = skipblanks(line, &incomment);
+        if (*ptr != '\0')
+            break;
+        ptr = NULL;
+    }
+    if (ptr != NULL && (ptr = skipdirective(ptr, "if")) != NULL) {
+        if ((negated = (*ptr == '!')) != 0)
+            for (ptr++; *ptr <= ' ' && *ptr != '\0'; ptr++)
+                /* nothing */;
+        if (strncmp((const char*)ptr, "defined", 7) != 0 || alphanum(ptr[7]))
+            ptr = NULL;
+    }
+    if (ptr != NULL) {
+        for (ptr += 7; *ptr <= ' ' && *ptr != '\0'; ptr++)
+            /* nothing */;
+        if ((paren = (*ptr == '(')) != 0)
+            for (ptr++; *ptr <= ' ' && *ptr != '\0'; ptr++)
+                /* nothing */;
+        for (len = 0; alphanum(*ptr) && len < sNAMEMAX; len++)
+            name[len] = *ptr++;
+        name[len] = '\0';
+        ptr = skipblanks(ptr, &incomment);
+        if (paren && *ptr == ')')
+            ptr = skipblanks(ptr + 1, &incomment);
+        else if (paren)
+            ptr = NULL;
+        if (ptr != NULL && (len == 0 || !alpha(name[0]) || *ptr != '\0'))
+            ptr = NULL;
+    }
+
+    if (ptr != NULL && !negated) {
+        /* the next directive ends the file */
+        ptr = NULL;
+        while (guardline(fp, line)) {
+            ptr = skipblanks(line, &incomment);
+            if (*ptr != '\0')
+                break;
+            ptr = NULL;
+        }
+        if (ptr != NULL && (ptr = skipdirective(ptr, "endinput")) != NULL)
+            found = (*skipblanks(ptr, &incomment) == '\0');
+    } else if (ptr != NULL) {
+        /* the matching "#endif" is the last thing in the file, with no "#else" */
+        depth = 1;
+        while (depth > 0 && guardline(fp, line)) {
+            ptr = skipblanks(line, &incomment);
+            if (skipdirective(ptr, "if") != NULL) {
+                depth++;
+            } else if (skipdirective(ptr, "else") != NULL || skipdirective(ptr, "elseif") != NULL) {
+                if (depth == 1)
+                    break;
+            } else if (skipdirective(ptr, "endif") != NULL) {
+                if (--depth == 0) {
+                    ptr = skipblanks(skipdirective(ptr, "endif"), &incomment);
+                    break;
+                }
+            }
+            skipline(ptr, &incomment);
+        }
+        if (depth == 0 && *ptr == '\0') {
+            found = TRUE;
+            while (found && guardline(fp, line))
+                found = (*skipblanks(line, &incomment) == '\0');
+            found = found && pc_eofsrc(fp) && !incomment;
+        }
+    }
+
+    pc_resetsrc(fp, mark);
+    free(line);
+    insert_includeguard(filename, found ? name : "");
+    find_includeguard(filename, &macro);
+    return macro;
+}
+
 int
 plungequalifiedfile(char* name)
 {
@@ -142,6 +333,14 @@ plungequalifiedfile(char* name)
     setfiledirect(inpfname); /* (optionally) set in the list file */
     listline = -1;           /* force a #line directive when changing the file */
     skip_utf8_bom(inpf);
+    /* an include file whose guard is defined is done before it starts, as if
+     * it had reached its #endinput
+     */
+    const char* guard = includeguard(inpf, inpfname);
+    if (*guard != '\0' && find_subst(guard, strlen(guard), nullptr)) {
+        pc_closesrc(inpf);
+        inpf = NULL;
+    }
     return TRUE;
 }
 
@@ -1438,6 +1637,22 @@ substpattern(unsigned char* line, size_t buffersize, const char* pattern,
     return match;
 }
 
+/* Replaces an object-like macro, which always matches, in one step; see
+ * substpattern() for the general case.
+ */
+static void
+substobject(unsigned char* line, size_t buffersize, int prefixlen, const macro_t* macro)
+{
+    size_t linelen = strlen((char*)line);
+
+    if (linelen + macro->length - prefixlen > buffersize) {
+        error(75); /* line too long */
+        return;
+    }
+    memmove(line + macro->length, line + prefixlen, linelen - prefixlen + 1);
+    memcpy(line, macro->second, macro->length);
+}
+
 static void
 substallpatterns(unsigned char* line, int buffersize)
 {
@@ -1484,7 +1699,9 @@ substallpatterns(unsigned char* line, int buffersize)
         macro_t subst;
         if (find_subst((const char*)start, prefixlen, &subst)) {
             /* properly match the pattern and substitute */
-            if (!substpattern(start, buffersize - (int)(start - line), subst.first, subst.second))
+            if (subst.object_like)
+                substobject(start, buffersize - (int)(start - line), prefixlen, &subst);
+            else if (!substpattern(start, buffersize - (int)(start - line), subst.first, subst.second))
                 start = end; /* match failed, skip this prefix */
             /* match succeeded: do not update "start", because the substitution text
              * may be matched by other macros
@@ -1849,17 +2066,11 @@ lexinit()
     memset(&sPreprocessBuffer, 0, sizeof(sPreprocessBuffer));
     sTokenBuffer = &sNormalBuffer;
 
-    if (!sKeywords.elements()) {
-        sKeywords.init(128);
-
-        const int kStart = tMIDDLE + 1;
-        const char** tokptr = &sc_tokens[kStart - tFIRST];
-        for (int i = kStart; i <= tLAST; i++, tokptr++) {
-            CharsAndLength key(*tokptr, strlen(*tokptr));
-            auto p = sKeywords.findForAdd(key);
-            assert(!p.found());
-            sKeywords.add(p, key, i);
-        }
+    /* the keywords are tMIDDLE+1 through tLAST, in order */
+    static bool keywords_ready = false;
+    if (!keywords_ready) {
+        sKeywords.init(&sc_tokens[tMIDDLE + 1 - tFIRST], tLAST - tMIDDLE);
+        keywords_ready = true;
     }
 }
 
@@ -1881,11 +2092,10 @@ get_token_string(int tok_id)
 static int
 lex_keyword_impl(const char* match, size_t length)
 {
-    CharsAndLength key(match, length);
-    auto p = sKeywords.find(key);
-    if (!p.found())
+    int index = sKeywords.find(match, length);
+    if (index < 0)
         return 0;
-    return p->value;
+    return tMIDDLE + 1 + index;
 }
 
 static inline bool
@@ -3094,6 +3304,7 @@ symbol::symbol()
 
 symbol::symbol(const char* symname, cell symaddr, int symident, int symvclass, int symtag)
  : next(nullptr),
+   hash_next(nullptr),
    codeaddr(code_idx),
    vclass((char)symvclass),
    ident((char)symident),
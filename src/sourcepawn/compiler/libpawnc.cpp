@@ -24,13 +24,17 @@
  *  Version: $Id$
  */
 #include "libpawnc.h"
+#include <amtl/am-hashmap.h>
 #include <assert.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "memfile.h"
 #include "sc.h"
+#include "sp_symhash.h"
 
 #if defined __linux__ || defined __FreeBSD__ || defined __OpenBSD__ || defined DARWIN
 #    include <sys/stat.h>
@@ -63,26 +67,59 @@ typedef struct src_file_s {
     char* pos;        // IO position.
     char* end;        // End of buffer.
     size_t maxlength; // Maximum length of the writable buffer.
+    bool cached;      // The buffer belongs to the source cache.
 } src_file_t;
 
-/* pc_opensrc()
- * Opens a source file (or include file) for reading. The "file" does not have
- * to be a physical file, one might compile from memory.
- *    filename    the name of the "file" to read from
- * Return:
- *    The function must return a pointer, which is used as a "magic cookie" to
- *    all I/O functions. When failing to open the file for reading, the
- *    function must return NULL.
- * Note:
- *    Several "source files" may be open at the same time. Specifically, one
- *    file can be open for reading and another for writing.
+/* Sources are read once per compile and kept until pc_clearsrccache(): the
+ * compiler reads every file again in its second pass, and an include file
+ * again for every #include of it.
  */
-void*
-pc_opensrc(char* filename)
+typedef struct src_cache_s {
+    src_cache_s* next;
+    char* filename;
+    char* buffer;
+    size_t length;
+    time_t mtime;
+    bool used;        // Opened during this compile.
+} src_cache_t;
+
+static src_cache_t* src_cache = NULL;
+static ke::HashMap<sp::CharsAndLength, src_cache_t*, KeywordTablePolicy> src_cache_index;
+static bool src_cache_initialized = false;
+
+static src_cache_t*
+find_cachedsrc(const char* filename)
+{
+    if (!src_cache_initialized)
+        return NULL;
+    auto p = src_cache_index.find(sp::CharsAndLength(filename, strlen(filename)));
+    return p.found() ? p->value : NULL;
+}
+
+static void
+drop_cachedsrc(const char* filename)
+{
+    src_cache_t** link;
+    for (link = &src_cache; *link != NULL; link = &(*link)->next) {
+        src_cache_t* entry = *link;
+        if (strcmp(entry->filename, filename) == 0) {
+            sp::CharsAndLength key(entry->filename, strlen(entry->filename));
+            src_cache_index.remove(src_cache_index.find(key));
+            *link = entry->next;
+            free(entry->filename);
+            free(entry->buffer);
+            free(entry);
+            return;
+        }
+    }
+}
+
+static src_cache_t*
+read_src(char* filename)
 {
     FILE* fp = NULL;
     long length;
-    src_file_t* src = NULL;
+    src_cache_t* entry = NULL;
 
 #if defined __linux__ || defined __FreeBSD__ || defined __OpenBSD__ || defined DARWIN
     struct stat fileInfo;
@@ -104,24 +141,229 @@ pc_opensrc(char* filename)
     if (fseek(fp, 0, SEEK_SET) == -1)
         goto err;
 
-    if ((src = (src_file_t*)calloc(1, sizeof(src_file_t))) == NULL)
+    if ((entry = (src_cache_t*)calloc(1, sizeof(src_cache_t))) == NULL)
         goto err;
-    if ((src->buffer = (char*)calloc(length, sizeof(char))) == NULL)
+    if ((entry->buffer = (char*)calloc(length, sizeof(char))) == NULL)
         goto err;
-    if (fread(src->buffer, length, 1, fp) != 1)
+    if (fread(entry->buffer, length, 1, fp) != 1)
         goto err;
-
-    src->pos = src->buffer;
-    src->end = src->buffer + length;
+    if ((entry->filename = strdup(filename)) == NULL)
+        goto err;
+    entry->length = length;
+#if defined __linux__ || defined __FreeBSD__ || defined __OpenBSD__ || defined DARWIN
+    entry->mtime = fileInfo.st_mtime;
+#endif
     fclose(fp);
-    return src;
+
+    if (!src_cache_initialized) {
+        src_cache_index.init(64);
+        src_cache_initialized = true;
+    }
+    sp::CharsAndLength key(entry->filename, strlen(entry->filename));
+    auto p = src_cache_index.findForAdd(key);
+    src_cache_index.add(p, key, entry);
+    entry->next = src_cache;
+    src_cache = entry;
+    return entry;
 
 err:
-    pc_closesrc(src);
+    if (entry != NULL) {
+        free(entry->buffer);
+        free(entry);
+    }
     fclose(fp);
     return NULL;
 }
 
+/* pc_opensrc()
+ * Opens a source file (or include file) for reading. The "file" does not have
+ * to be a physical file, one might compile from memory.
+ *    filename    the name of the "file" to read from
+ * Return:
+ *    The function must return a pointer, which is used as a "magic cookie" to
+ *    all I/O functions. When failing to open the file for reading, the
+ *    function must return NULL.
+ * Note:
+ *    Several "source files" may be open at the same time. Specifically, one
+ *    file can be open for reading and another for writing.
+ */
+void*
+pc_opensrc(char* filename)
+{
+    src_cache_t* entry;
+    src_file_t* src;
+
+    if ((entry = find_cachedsrc(filename)) == NULL && (entry = read_src(filename)) == NULL)
+        return NULL;
+    if ((src = (src_file_t*)calloc(1, sizeof(src_file_t))) == NULL)
+        return NULL;
+    src->buffer = entry->buffer;
+    src->pos = src->buffer;
+    src->end = src->buffer + entry->length;
+    src->cached = true;
+    entry->used = true;
+    return src;
+}
+
+/* pc_clearsrccache()
+ * Forgets the sources read so far; handles from pc_opensrc() must be closed
+ * before.
+ */
+void
+pc_clearsrccache(void)
+{
+    while (src_cache != NULL) {
+        src_cache_t* entry = src_cache;
+        src_cache = entry->next;
+        free(entry->filename);
+        free(entry->buffer);
+        free(entry);
+    }
+    if (src_cache_initialized)
+        src_cache_index.clear();
+}
+
+/* pc_preloadsrc()
+ * Reads a source file into the cache without opening it, unless it is there
+ * already. A compile server does this for the include files it keeps warm.
+ * Return:
+ *    TRUE if the file is in the cache.
+ */
+int
+pc_preloadsrc(char* filename)
+{
+    return find_cachedsrc(filename) != NULL || read_src(filename) != NULL;
+}
+
+/* pc_revalidatesrccache()
+ * Drops the cached sources whose file was changed or removed since it was read,
+ * so that a cache kept across compiles does not serve stale files. Handles from
+ * pc_opensrc() must be closed before.
+ */
+void
+pc_revalidatesrccache(void)
+{
+#if defined __linux__ || defined __FreeBSD__ || defined __OpenBSD__ || defined DARWIN
+    src_cache_t** link = &src_cache;
+    while (*link != NULL) {
+        src_cache_t* entry = *link;
+        struct stat fileInfo;
+        if (stat(entry->filename, &fileInfo) == 0 && fileInfo.st_mtime == entry->mtime &&
+            (size_t)fileInfo.st_size == entry->length)
+        {
+            link = &entry->next;
+            continue;
+        }
+        sp::CharsAndLength key(entry->filename, strlen(entry->filename));
+        src_cache_index.remove(src_cache_index.find(key));
+        *link = entry->next;
+        free(entry->filename);
+        free(entry->buffer);
+        free(entry);
+    }
+#else
+    pc_clearsrccache();
+#endif
+}
+
+/* A dependency file lists what went into a compile: a hash of the options,
+ * then the hash and the name of every source file opened, one per line. */
+#define DEPS_MAGIC "spcomp-deps 1"
+
+#define HASH_START 14695981039346656037ULL
+
+static uint64_t
+hash_bytes(const void* data, size_t length, uint64_t hash = HASH_START)
+{
+    /* 64-bit FNV-1a */
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < length; i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    return hash;
+}
+
+static int
+hash_file(const char* filename, uint64_t* hash)
+{
+    FILE* fp = fopen(filename, "rb");
+    if (fp == NULL)
+        return FALSE;
+    char buffer[4096];
+    size_t n;
+    *hash = HASH_START;
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+        *hash = hash_bytes(buffer, n, *hash);
+    int ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+/* pc_writedeps()
+ * Writes the dependency file for the compile that just ended: "options" is
+ * what the output depends on besides the sources, and "skip" a source file to
+ * leave out, or NULL.
+ * Return:
+ *    TRUE on success.
+ */
+int
+pc_writedeps(const char* depsname, const char* options, size_t length, const char* skip)
+{
+    FILE* fp = fopen(depsname, "wt");
+    if (fp == NULL)
+        return FALSE;
+    fprintf(fp, "%s\n%016llx options\n", DEPS_MAGIC,
+            (unsigned long long)hash_bytes(options, length));
+    for (src_cache_t* entry = src_cache; entry != NULL; entry = entry->next) {
+        if (!entry->used || (skip != NULL && strcmp(entry->filename, skip) == 0))
+            continue;
+        fprintf(fp, "%016llx %s\n", (unsigned long long)hash_bytes(entry->buffer, entry->length),
+                entry->filename);
+    }
+    return fclose(fp) == 0;
+}
+
+/* pc_depsuptodate()
+ * Checks a dependency file from an earlier compile against the options and
+ * the files on disk now.
+ * Return:
+ *    TRUE if neither the options nor any of the files changed.
+ */
+int
+pc_depsuptodate(const char* depsname, const char* options, size_t length)
+{
+    FILE* fp = fopen(depsname, "rt");
+    if (fp == NULL)
+        return FALSE;
+
+    char line[_MAX_PATH + 32];
+    int uptodate = fgets(line, sizeof(line), fp) != NULL &&
+                   strncmp(line, DEPS_MAGIC "\n", sizeof(DEPS_MAGIC)) == 0;
+    int first = TRUE;
+    while (uptodate && fgets(line, sizeof(line), fp) != NULL) {
+        char* name;
+        unsigned long long hash = strtoull(line, &name, 16);
+        size_t len = strlen(line);
+        if (name != line + 16 || *name != ' ' || len == 0 || line[len - 1] != '\n') {
+            uptodate = FALSE;
+            break;
+        }
+        line[len - 1] = '\0';
+        name++;
+
+        if (first) {
+            uptodate = strcmp(name, "options") == 0 && hash == hash_bytes(options, length);
+            first = FALSE;
+            continue;
+        }
+
+        /* read the file afresh; the cache may hold what it was */
+        uint64_t current;
+        uptodate = hash_file(name, &current) && hash == current;
+    }
+    fclose(fp);
+    return uptodate && !first;
+}
+
 /* pc_createsrc()
  * Creates/overwrites a source file for writing. The "file" does not have
  * to be a physical file, one might compile from memory.
@@ -137,6 +379,8 @@ err:
 void*
 pc_createsrc(char* filename)
 {
+    drop_cachedsrc(filename);
+
     src_file_t* src = (src_file_t*)calloc(1, sizeof(src_file_t));
     if (!src)
         return NULL;
@@ -170,7 +414,8 @@ pc_closesrc(void* handle)
         fwrite(src->buffer, src->pos - src->buffer, 1, src->fp);
         fclose(src->fp);
     }
-    free(src->buffer);
+    if (!src->cached)
+        free(src->buffer);
     free(src);
 }
 
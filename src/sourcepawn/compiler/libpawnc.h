@@ -19,6 +19,8 @@
 //  3.  This notice may not be removed or altered from any source distribution.
 #pragma once
 
+#include <stddef.h>
+
 struct memfile_t;
 
 void* pc_opensrc(char* filename); /* reading only */
@@ -29,6 +31,11 @@ int pc_writesrc(void* handle, unsigned char* source);
 void* pc_getpossrc(void* handle);
 void pc_resetsrc(void* handle, void* position); /* reset to a position marked earlier */
 int pc_eofsrc(void* handle);
+void pc_clearsrccache(void); /* forget the sources read during the compile */
+int pc_preloadsrc(char* filename); /* read into the cache, without opening */
+void pc_revalidatesrccache(void); /* forget cached sources changed on disk */
+int pc_writedeps(const char* depsname, const char* options, size_t length, const char* skip);
+int pc_depsuptodate(const char* depsname, const char* options, size_t length);
 
 memfile_t* pc_openasm(char* filename); /* read/write */
 void pc_closeasm(memfile_t* handle, int deletefile);
@@ -59,6 +59,7 @@
 #include "errors.h"
 #include "lexer.h"
 #include "libpawnc.h"
+#include "optimizer.h"
 #include "sc.h"
 #include "scvars.h"
 
@@ -413,21 +414,165 @@ stgset(int onoff)
 }
 
 /* phopt_init
- * Initialize all sequence strings of the peehole optimizer. The strings
- * are embedded in the .EXE file in compressed format, here we expand
- * them (and allocate memory for the sequences).
+ * Indexes the sequences of the peephole optimizer by the mnemonic that starts
+ * their "find" pattern. A sequence can only match at a line that starts with
+ * the same mnemonic, so stgopt() tries just those, still in table order,
+ * instead of every sequence on every line. The few sequences that do not
+ * start with a plain mnemonic are tried on every line.
  */
 static SEQUENCE* sequences = sequences_cmp;
 
+#define MAX_MNEMONIC 15
+
+typedef struct {
+    char name[MAX_MNEMONIC + 1];
+    int* seqs; /* indices into sequences[], ascending, ending with -1 */
+} MNEMONIC;
+
+static MNEMONIC* mnemonics = NULL;
+static int nummnemonics = 0;
+static int* seqlists = NULL; /* storage for all lists */
+static int* seqany = NULL;   /* for lines that start with no listed mnemonic */
+static int nomacro_end = 0;  /* first sequence that creates macro instructions */
+
+/* the mnemonic a pattern starts with, in lower case; FALSE if the pattern
+ * does not start with a plain mnemonic followed by a space or a line end
+ */
+static int
+pattern_mnemonic(const char* pattern, char name[MAX_MNEMONIC + 1])
+{
+    int i;
+
+    for (i = 0; pattern[i] != '\0' && strchr(" !%-", pattern[i]) == NULL; i++) {
+        if (i >= MAX_MNEMONIC || (pattern[i] == ';' && i > 0))
+            return FALSE;
+        name[i] = (char)tolower(pattern[i]);
+    }
+    name[i] = '\0';
+    return i > 0 && (pattern[i] == ' ' || pattern[i] == '!');
+}
+
+/* the mnemonic a line starts with, as pattern_mnemonic() would see it */
+static int
+line_mnemonic(const char* start, const char* end, char name[MAX_MNEMONIC + 1])
+{
+    int i;
+
+    while (start < end && (*start == '\t' || *start == ' '))
+        start++;
+    for (i = 0; start < end && *start != '\0' && *start != ' ' && *start != '\t' && *start != '\n';
+         i++, start++)
+    {
+        if (*start == ';' && i > 0)
+            break;
+        if (i >= MAX_MNEMONIC)
+            return FALSE;
+        name[i] = (char)tolower(*start);
+    }
+    name[i] = '\0';
+    return i > 0;
+}
+
+static int
+cmpmnemonic(const void* a, const void* b)
+{
+    return strcmp(((const MNEMONIC*)a)->name, ((const MNEMONIC*)b)->name);
+}
+
+/* the sequences to try at the line at "start", in table order */
+static const int*
+candidates(const char* start, const char* end)
+{
+    MNEMONIC key;
+    MNEMONIC* found;
+
+    if (!line_mnemonic(start, end, key.name))
+        return seqany;
+    found = (MNEMONIC*)bsearch(&key, mnemonics, nummnemonics, sizeof(MNEMONIC), cmpmnemonic);
+    return found != NULL ? found->seqs : seqany;
+}
+
 int
 phopt_init(void)
 {
+    char(*names)[MAX_MNEMONIC + 1];
+    int numseqs, numany, seq, idx, count;
+    int* list;
+
+    if (mnemonics != NULL)
+        return TRUE;
+    for (numseqs = 0; sequences[numseqs].find != NULL; numseqs++)
+        /* nothing */;
+    for (nomacro_end = 0; nomacro_end < numseqs && *sequences[nomacro_end].find != '\0';
+         nomacro_end++)
+        /* nothing */;
+
+    names = (char(*)[MAX_MNEMONIC + 1])malloc((numseqs + 1) * sizeof(*names));
+    mnemonics = (MNEMONIC*)malloc((numseqs + 1) * sizeof(MNEMONIC));
+    if (names == NULL || mnemonics == NULL) {
+        free(names);
+        phopt_cleanup();
+        return FALSE;
+    }
+
+    /* collect the distinct mnemonics; an empty name marks a sequence that is
+     * tried everywhere (separators are not tried at all)
+     */
+    numany = 0;
+    nummnemonics = 0;
+    for (seq = 0; seq < numseqs; seq++) {
+        if (*sequences[seq].find == '\0') {
+            names[seq][0] = '\0';
+            continue;
+        }
+        if (!pattern_mnemonic(sequences[seq].find, names[seq])) {
+            names[seq][0] = '\0';
+            numany++;
+            continue;
+        }
+        for (idx = 0; idx < nummnemonics && strcmp(mnemonics[idx].name, names[seq]) != 0; idx++)
+            /* nothing */;
+        if (idx == nummnemonics)
+            strcpy(mnemonics[nummnemonics++].name, names[seq]);
+    }
+    qsort(mnemonics, nummnemonics, sizeof(MNEMONIC), cmpmnemonic);
+
+    /* every list holds its own sequences and the ones tried everywhere */
+    count = numseqs + (nummnemonics + 1) * (numany + 1);
+    if ((seqlists = (int*)malloc(count * sizeof(int))) == NULL) {
+        free(names);
+        phopt_cleanup();
+        return FALSE;
+    }
+    list = seqlists;
+    for (idx = 0; idx <= nummnemonics; idx++) {
+        const char* name = idx < nummnemonics ? mnemonics[idx].name : NULL;
+        if (name != NULL)
+            mnemonics[idx].seqs = list;
+        else
+            seqany = list;
+        for (seq = 0; seq < numseqs; seq++) {
+            if (*sequences[seq].find == '\0')
+                continue;
+            if (names[seq][0] == '\0' || (name != NULL && strcmp(names[seq], name) == 0))
+                *list++ = seq;
+        }
+        *list++ = -1;
+    }
+    assert(list - seqlists <= count);
+    free(names);
     return TRUE;
 }
 
 int
 phopt_cleanup(void)
 {
+    free(mnemonics);
+    free(seqlists);
+    mnemonics = NULL;
+    seqlists = NULL;
+    seqany = NULL;
+    nummnemonics = 0;
     return FALSE;
 }
 
@@ -621,31 +766,25 @@ static void
 stgopt(char* start, char* end, int (*outputfunc)(char* str))
 {
     char symbols[MAX_OPT_VARS][MAX_ALIAS + 1];
-    int seq, match_length, repl_length;
+    const int* seq;
+    int match_length, repl_length;
     int matches;
     char* debut = start; /* save original start of the buffer */
 
-    assert(sequences != NULL);
+    assert(seqany != NULL);
     /* do not match anything if debug-level is maximum */
     if (pc_optimize > sOPTIMIZE_NONE && sc_status == statWRITE) {
         do {
             matches = 0;
             start = debut;
             while (start < end) {
-                seq = 0;
-                while (sequences[seq].find != NULL) {
-                    assert(seq >= 0);
-                    if (*sequences[seq].find == '\0') {
-                        if (pc_optimize == sOPTIMIZE_NOMACRO) {
-                            break; /* don't look further */
-                        } else {
-                            seq++; /* continue with next string */
-                            continue;
-                        }
-                    }
-                    if (matchsequence(start, end, sequences[seq].find, symbols, &match_length)) {
+                seq = candidates(start, end);
+                while (*seq >= 0) {
+                    if (pc_optimize == sOPTIMIZE_NOMACRO && *seq >= nomacro_end)
+                        break; /* don't look further */
+                    if (matchsequence(start, end, sequences[*seq].find, symbols, &match_length)) {
                         char* replace =
-                            replacesequence(sequences[seq].replace, symbols, &repl_length);
+                            replacesequence(sequences[*seq].replace, symbols, &repl_length);
                         /* If the replacement is bigger than the original section, we may need
                          * to "grow" the staging buffer. This is quite complex, due to the
                          * re-ordering of expressions that can also happen in the staging
@@ -660,8 +799,8 @@ stgopt(char* start, char* end, int (*outputfunc)(char* str))
                                        (int)(end - start));
                             end -= match_length - repl_length;
                             free(replace);
-                            code_idx -= sequences[seq].savesize;
-                            seq = 0; /* restart search for matches */
+                            code_idx -= sequences[*seq].savesize;
+                            seq = candidates(start, end); /* restart search for matches */
                             matches++;
                         } else {
                             /* actually, we should never get here (match_length<repl_length) */
@@ -672,8 +811,6 @@ stgopt(char* start, char* end, int (*outputfunc)(char* str))
                         seq++;
                     }
                 }
-                assert(sequences[seq].find == NULL ||
-                       (*sequences[seq].find == '\0' && pc_optimize == sOPTIMIZE_NOMACRO));
                 start += strlen(start) + 1; /* to next string */
             }                               /* while (start<end) */
         } while (matches > 0);
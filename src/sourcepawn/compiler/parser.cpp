@@ -35,6 +35,7 @@
 #include <amtl/am-platform.h>
 #include <amtl/am-string.h>
 #include <amtl/am-unused.h>
+#include <amtl/am-vector.h>
 #include <amtl/experimental/am-argparser.h>
 
 #include "types.h"
@@ -118,6 +119,7 @@ static void resetglobals(void);
 static void initglobals(void);
 static char* get_extension(char* filename);
 static void setopt(int argc, char** argv, char* oname, char* ename, char* pname);
+static void depsoptions(int argc, char** argv, ke::Vector<char>* options);
 static void setconfig(char* root);
 static void setcaption(void);
 static void setconstants(void);
@@ -232,6 +234,9 @@ pc_compile(int argc, char* argv[]) {
     void* inpfmark;
     int lcl_packstr, lcl_needsemicolon, lcl_tabsize, lcl_require_newdecls;
     char* ptr;
+    char depsfname[_MAX_PATH];
+    ke::Vector<char> depsopts;
+    int uptodate = FALSE;
 
     /* set global variables to their initial value */
     initglobals();
@@ -275,6 +280,22 @@ pc_compile(int argc, char* argv[]) {
     else if (verbosity > 0)
         setcaption();
     setconfig(argv[0]); /* the path to the include files */
+
+    /* a build driver may run the compiler for every plugin, and have it stop
+     * here if nothing the plugin was built from changed */
+    strcpy(depsfname, binfname);
+    set_extension(depsfname, ".deps", TRUE);
+    depsoptions(argc, argv, &depsopts);
+    if (sc_skipunchanged && pc_depsuptodate(depsfname, depsopts.buffer(), depsopts.length())) {
+        FILE* fp = fopen(binfname, "rb");
+        if (fp != NULL) {
+            fclose(fp);
+            uptodate = TRUE;
+            if (verbosity >= 2)
+                pc_printf("%s is up to date.\n", binfname);
+            goto cleanup;
+        }
+    }
     sc_ctrlchar_org = sc_ctrlchar;
     lcl_packstr = sc_packstr;
     lcl_needsemicolon = sc_needsemicolon;
@@ -456,9 +477,16 @@ cleanup:
     }
 
     // Write the binary file.
-    if (!(sc_asmfile || sc_listing) && errnum == 0 && jmpcode == 0) {
+    if (!(sc_asmfile || sc_listing) && errnum == 0 && jmpcode == 0 && !uptodate) {
         pc_resetasm(outf);
         assemble(binfname, outf);
+
+        if ((sc_depsfile || sc_skipunchanged) && errnum == 0 &&
+            !pc_writedeps(depsfname, depsopts.buffer(), depsopts.length(),
+                          g_tmpfile[0] != '\0' ? g_tmpfile : NULL))
+        {
+            pc_printf("Unable to write %s\n", depsfname);
+        }
     }
 
     if (outf != NULL) {
@@ -466,7 +494,7 @@ cleanup:
         outf = NULL;
     }
 
-    if (errnum == 0 && strlen(errfname) == 0) {
+    if (errnum == 0 && strlen(errfname) == 0 && !uptodate) {
         if ((!norun && (sc_debug & sSYMBOLIC) != 0) || verbosity >= 2) {
             pc_printf("Code size:         %8ld bytes\n", (long)code_idx);
             pc_printf("Data size:         %8ld bytes\n", (long)glb_declared * sizeof(cell));
@@ -498,6 +526,8 @@ cleanup:
     delete_symbols(&loctab, 0, TRUE);            /* delete local variables if not yet
                                                   * done (i.e. on a fatal error) */
     delete_symbols(&glbtab, 0, TRUE);
+    if (sc_symbolstats && sp_Globals != NULL)
+        PrintHashTableStats(sp_Globals);
     DestroyHashTable(sp_Globals);
     delete_consttable(&libname_tab);
     delete_aliastable();
@@ -510,6 +540,8 @@ cleanup:
     methodmaps_free();
     pstructs_free();
     delete_substtable();
+    delete_includeguardtable();
+    pc_clearsrccache();
     if (sc_documentation != NULL)
         free(sc_documentation);
     delete_autolisttable();
@@ -742,10 +774,24 @@ args::ToggleOption opt_warnings_as_errors("-E", "--warnings-as-errors", Some(fal
                                           "Treat warnings as errors");
 args::ToggleOption opt_showincludes("-h", "--show-includes", Some(false),
                                     "Show included file paths");
+args::ToggleOption opt_symbolstats(nullptr, "--stats", Some(false),
+                                   "Show symbol table and type pool statistics");
+args::ToggleOption opt_depsfile(nullptr, "--deps", Some(false),
+                                "Write the include files used, with their hashes, to a .deps file");
+args::ToggleOption opt_skipunchanged(nullptr, "--skip-unchanged", Some(false),
+                                     "Skip the compile if no file in the .deps file changed");
+args::ToggleOption opt_coalescebreaks(nullptr, "--coalesce-breaks", Some(false),
+                                      "Emit at most one debug break per line and basic block");
+args::ToggleOption opt_nobreaks(nullptr, "--no-breaks", Some(false),
+                                "Emit line info without debug break opcodes");
+args::StringOption opt_profilefile(nullptr, "--order-by-profile", {},
+                                   "Order function bodies by the call counts in this file");
 args::ToggleOption opt_listing("-l", "--listing", Some(false),
                                "Create list file (preprocess only)");
 args::IntOption opt_compression("-z", "--compress-level", Some(9),
                                 "Compression level, default 9 (0=none, 1=worst, 9=best)");
+args::IntOption opt_compression_threads(nullptr, "--compress-threads", Some(1),
+                                        "Threads that compress the output, default 1");
 args::IntOption opt_tabsize("-t", "--tabsize", Some(8),
                             "TAB indent size (in character positions, default=8)");
 args::StringOption opt_verbosity("-v", "--verbose", {},
@@ -795,8 +841,16 @@ parseoptions(int argc, char** argv, char* oname, char* ename, char* pname)
 
     sc_warnings_are_errors = opt_warnings_as_errors.value();
     sc_showincludes = opt_showincludes.value();
+    sc_symbolstats = opt_symbolstats.value();
+    sc_depsfile = opt_depsfile.value();
+    sc_skipunchanged = opt_skipunchanged.value();
+    sc_coalescebreaks = opt_coalescebreaks.value();
+    sc_nobreaks = opt_nobreaks.value();
+    if (opt_profilefile.hasValue())
+        sc_profilefile = opt_profilefile.value();
     sc_listing = opt_listing.value();
     sc_compression_level = opt_compression.value();
+    sc_compression_threads = opt_compression_threads.value();
     sc_tabsize = opt_tabsize.value();
     sc_needsemicolon = opt_semicolons.value();
 
@@ -936,23 +990,53 @@ setopt(int argc, char** argv, char* oname, char* ename, char* pname) {
     parseoptions(argc, argv, oname, ename, pname);
 }
 
-#if defined __BORLANDC__ || defined __WATCOMC__
-#    pragma argsused
-#endif
+/* depsoptions
+ * What the output depends on besides the sources: the compiler version and its
+ * arguments, less those that only say whether to skip the compile.
+ */
+static void
+depsoptions(int argc, char** argv, ke::Vector<char>* options) {
+    const char* version = SOURCEPAWN_VERSION;
+    for (const char* ptr = version; *ptr != '\0'; ptr++)
+        options->append(*ptr);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--deps") == 0 || strcmp(argv[i], "--skip-unchanged") == 0)
+            continue;
+        options->append('\0');
+        for (const char* ptr = argv[i]; *ptr != '\0'; ptr++)
+            options->append(*ptr);
+    }
+}
+
 static void
 setconfig(char* root) {
     char path[_MAX_PATH];
+
+    /* add the default "include" directory */
+    if (pc_defaultinclude(root, path))
+        insert_path(path);
+}
+
+/* pc_defaultinclude
+ * Finds the "include" directory that goes with the compiler executable; "path"
+ * must hold _MAX_PATH characters. Returns FALSE if there is none.
+ */
+#if defined __BORLANDC__ || defined __WATCOMC__
+#    pragma argsused
+#endif
+int
+pc_defaultinclude(char* root, char* path) {
     char *ptr, *base;
     int len;
 
-    /* add the default "include" directory */
+    path[0] = '\0';
 #if defined KE_WINDOWS
     GetModuleFileNameA(NULL, path, _MAX_PATH);
 #elif defined ENABLE_BINRELOC
     /* see www.autopackage.org for the BinReloc module */
     br_init_lib(NULL);
     ptr = br_find_exe("spcomp");
-    strlcpy(path, ptr, sizeof path);
+    strlcpy(path, ptr, _MAX_PATH);
     free(ptr);
 #elif defined __EMSCRIPTEN__
     if (EM_ASM_INT(
@@ -963,13 +1047,13 @@ setconfig(char* root) {
                 }
                 return 0;
             },
-            path, sizeof(path)) == 0 &&
+            path, _MAX_PATH) == 0 &&
         root != NULL) {
-        strlcpy(path, root, sizeof(path));
+        strlcpy(path, root, _MAX_PATH);
     }
 #else
     if (root != NULL)
-        strlcpy(path, root, sizeof path); /* path + filename (hopefully) */
+        strlcpy(path, root, _MAX_PATH); /* path + filename (hopefully) */
 #endif
 
 #if defined __MSDOS__
@@ -1006,8 +1090,9 @@ setconfig(char* root) {
                 *base = DIRSEP_CHAR;
             }
         }
-        insert_path(path);
+        return TRUE;
     }
+    return FALSE;
 }
 
 static void
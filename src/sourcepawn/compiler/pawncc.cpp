@@ -9,11 +9,16 @@
 #elif defined WIN32
 #    include <io.h>
 #endif
+#include "compile-server.h"
 #include "sc.h"
 
 int
 main(int argc, char* argv[])
 {
+    if (argc >= 2 && strcmp(argv[1], "--server") == 0)
+        return pc_compileserver(argc, argv);
+    if (argc >= 2 && strcmp(argv[1], "--connect") == 0)
+        return pc_compileclient(argc, argv);
     return pc_compile(argc, argv);
 }
 
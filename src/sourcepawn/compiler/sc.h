@@ -178,6 +178,7 @@ struct symbol {
     ~symbol();
 
     symbol* next;
+    symbol* hash_next; /* next global symbol with the same name, see sp_symhash */
     cell codeaddr; /* address (in the code segment) where the symbol declaration starts */
     char vclass;   /* sLOCAL if "addr" refers to a local symbol */
     char ident;    /* see below for possible values */
@@ -451,6 +452,7 @@ struct token_t;
  */
 int pc_compile(int argc, char** argv);
 int pc_addconstant(const char* name, cell value, int tag);
+int pc_defaultinclude(char* root, char* path);
 int pc_addtag(const char* name);
 int pc_findtag(const char* name);
 const char* pc_tagname(int tag);
@@ -863,6 +863,9 @@ static void parseoptions(int argc,char **argv,char *oname,char *ename,char *pnam
         if (sc_asmfile && verbosity>1)
           verbosity=1;
         break;
+      case 'x':
+        sc_debug_index = true;
+        break;
       case 'w':
         i=(int)strtol(option_value(ptr,argv,argc,&arg),(char **)&ptr,10);
         if (*ptr=='-')
@@ -1120,6 +1123,7 @@ static void about(void)
     pc_printf("         -t<num>  TAB indent size (in character positions, default=%d)\n",sc_tabsize);
     pc_printf("         -v<num>  verbosity level; 0=quiet, 1=normal, 2=verbose (default=%d)\n",verbosity);
     pc_printf("         -w<num>  disable a specific warning by its number\n");
+    pc_printf("         -x       write an index of the debug information for debuggers\n");
     pc_printf("         -E       treat warnings as errors\n");
     pc_printf("         -\\       use '\\' for escape characters\n");
     pc_printf("         -^       use '^' for escape characters\n");
@@ -655,6 +655,9 @@ static void append_debug_tables(SmxBuilder *builder, StringPool &pool, RefPtr<Sm
   RefPtr<SmxDebugSymbolsSection> symbols = new SmxDebugSymbolsSection(".dbg.symbols");
   RefPtr<SmxDebugNativesSection> natives = new SmxDebugNativesSection(".dbg.natives");
   RefPtr<SmxTagSection> tags = new SmxTagSection(".tags");
+  RefPtr<SmxDebugIndexSection> index;
+  if (sc_debug_index)
+    index = new SmxDebugIndexSection(".dbg.index");
 
   stringlist *dbgstrs = get_dbgstrings();
 
@@ -678,6 +681,8 @@ static void append_debug_tables(SmxBuilder *builder, StringPool &pool, RefPtr<Sm
             sp_fdbg_file_t &entry = files->add();
             entry.addr = prev_file_addr;
             entry.name = dbgnames->add(pool, prev_file_name);
+            if (index)
+              index->addFile(entry.addr, entry.name);
           }
           prev_file_addr = codeidx;
         }
@@ -690,6 +695,8 @@ static void append_debug_tables(SmxBuilder *builder, StringPool &pool, RefPtr<Sm
         sp_fdbg_line_t &entry = lines->add();
         entry.addr = str.parse();
         entry.line = str.parse();
+        if (index)
+          index->addLine(entry.addr, entry.line);
         break;
       }
 
@@ -730,6 +737,8 @@ static void append_debug_tables(SmxBuilder *builder, StringPool &pool, RefPtr<Sm
 
         symbols->add(&sym, sizeof(sym));
         symbols->add(dims, sizeof(dims[0]) * sym.dimcount);
+        if (index)
+          index->addSymbol(sym, atom->chars());
         break;
       }
     }
@@ -740,6 +749,8 @@ static void append_debug_tables(SmxBuilder *builder, StringPool &pool, RefPtr<Sm
     sp_fdbg_file_t &entry = files->add();
     entry.addr = prev_file_addr;
     entry.name = dbgnames->add(pool, prev_file_name);
+    if (index)
+      index->addFile(entry.addr, entry.name);
   }
 
   // Build the tags table.
@@ -797,6 +808,10 @@ static void append_debug_tables(SmxBuilder *builder, StringPool &pool, RefPtr<Sm
   builder->add(dbgnames);
   builder->add(info);
   builder->add(tags);
+  if (index) {
+    index->finish();
+    builder->add(index);
+  }
 }
 
 typedef SmxListSection<sp_file_natives_t> SmxNativeSection;
@@ -30,6 +30,7 @@
 #include <amtl/am-hashmap.h>
 #include <amtl/am-string.h>
 #include <assert.h>
+#include <ctype.h>
 #include <inttypes.h>
 #include <limits.h>
 #include <stdlib.h>
@@ -69,10 +70,22 @@ struct MacroEntry {
     ke::AString second;
     ke::AString documentation;
     bool deprecated;
+    bool object_like;
 };
 static bool sMacroTableInitialized;
 static ke::HashMap<ke::AString, MacroEntry, MacroTablePolicy> sMacros;
 
+/* Number of macros per first character and name length. Most identifiers on
+ * a line are not macros; a zero here says so without hashing the name.
+ */
+static uint32_t sMacroShapes[128][32];
+
+static uint32_t&
+macro_shape(const char* name, size_t length)
+{
+    return sMacroShapes[(unsigned char)name[0] & 0x7f][length < 32 ? length : 31];
+}
+
 /* ----- string list functions ----------------------------------- */
 static stringlist*
 insert_string(stringlist* root, const char* string)
@@ -199,6 +212,11 @@ insert_subst(const char* pattern, size_t pattern_length, const char* substitutio
     macro.first = pattern;
     macro.second = substitution;
     macro.deprecated = false;
+    macro.object_like = pattern[pattern_length] == '\0';
+    for (const char* s = substitution; macro.object_like && *s != '\0'; s++) {
+        if (*s == '%' && isdigit(*(s + 1)))
+            macro.object_like = false;
+    }
     if (pc_deprecate.length() > 0) {
         macro.deprecated = true;
         if (sc_status == statWRITE)
@@ -209,15 +227,20 @@ insert_subst(const char* pattern, size_t pattern_length, const char* substitutio
 
     ke::AString key(pattern, pattern_length);
     auto p = sMacros.findForAdd(key);
-    if (p.found())
+    if (p.found()) {
         p->value = macro;
-    else
+    } else {
+        macro_shape(pattern, pattern_length)++;
         sMacros.add(p, ke::Move(key), macro);
+    }
 }
 
 bool
 find_subst(const char* name, size_t length, macro_t* macro)
 {
+    if (length == 0 || macro_shape(name, length) == 0)
+        return false;
+
     sp::CharsAndLength key(name, length);
     auto p = sMacros.find(key);
     if (!p.found())
@@ -230,6 +253,8 @@ find_subst(const char* name, size_t length, macro_t* macro)
     if (macro) {
         macro->first = entry.first.chars();
         macro->second = entry.second.chars();
+        macro->length = entry.second.length();
+        macro->object_like = entry.object_like;
     }
     return true;
 }
@@ -242,6 +267,7 @@ delete_subst(const char* name, size_t length)
     if (!p.found())
         return false;
 
+    macro_shape(name, length)--;
     sMacros.remove(p);
     return true;
 }
@@ -250,6 +276,50 @@ void
 delete_substtable(void)
 {
     sMacros.clear();
+    memset(sMacroShapes, 0, sizeof(sMacroShapes));
+}
+
+/* ----- include guards ------------------------------------------ */
+/* The macro that guards each include file seen, or an empty string for files
+ * without a guard.
+ */
+static bool sIncludeGuardsInitialized;
+static ke::HashMap<ke::AString, ke::AString, MacroTablePolicy> sIncludeGuards;
+
+void
+insert_includeguard(const char* filename, const char* macro)
+{
+    if (!sIncludeGuardsInitialized) {
+        sIncludeGuards.init(64);
+        sIncludeGuardsInitialized = true;
+    }
+
+    ke::AString key(filename);
+    auto p = sIncludeGuards.findForAdd(key);
+    if (p.found())
+        p->value = macro;
+    else
+        sIncludeGuards.add(p, ke::Move(key), ke::AString(macro));
+}
+
+bool
+find_includeguard(const char* filename, const char** macro)
+{
+    if (!sIncludeGuardsInitialized)
+        return false;
+    sp::CharsAndLength key(filename, strlen(filename));
+    auto p = sIncludeGuards.find(key);
+    if (!p.found())
+        return false;
+    *macro = p->value.chars();
+    return true;
+}
+
+void
+delete_includeguardtable(void)
+{
+    if (sIncludeGuardsInitialized)
+        sIncludeGuards.clear();
 }
 
 /* ----- input file list (explicit files) ------------------------ */
@@ -32,6 +32,9 @@ struct stringlist {
 struct macro_t {
     const char* first;
     const char* second;
+    size_t length;    /* of "second" */
+    bool object_like; /* the pattern is just the name and "second" has no
+                       * parameters, so the name is replaced as is */
 };
 
 void insert_alias(const char* name, const char* alias);
@@ -44,6 +47,9 @@ void insert_subst(const char* pattern, size_t pattern_length, const char* substi
 bool find_subst(const char* name, size_t length, macro_t* result);
 bool delete_subst(const char* name, size_t length);
 void delete_substtable(void);
+void insert_includeguard(const char* filename, const char* macro);
+bool find_includeguard(const char* filename, const char** macro);
+void delete_includeguardtable(void);
 stringlist* insert_sourcefile(char* string);
 char* get_sourcefile(int index);
 void delete_sourcefiletable(void);
@@ -84,9 +84,17 @@ ke::AString pc_deprecate;            /* if non-empty, mark next declaration as d
 int pc_optimize = sOPTIMIZE_NOMACRO; /* (peephole) optimization level */
 int pc_memflags = 0;                 /* special flags for the stack/heap usage */
 int sc_showincludes = 0;             /* show include files */
+int sc_symbolstats = 0;             /* print symbol table statistics */
+int sc_depsfile = 0;                /* write a .deps file next to the .smx */
+int sc_skipunchanged = 0;           /* skip the compile if the .deps file is current */
+int sc_coalescebreaks = 0;          /* one "break" per line and basic block */
+int sc_nobreaks = 0;                /* line table only, without "break" opcodes */
+ke::AString sc_profilefile;         /* call counts to order function bodies by */
 int sc_require_newdecls = 0;         /* Require new-style declarations */
 bool sc_warnings_are_errors = false;
 int sc_compression_level = 9;
+int sc_compression_threads = 1;    /* threads that compress the .smx */
+bool sc_debug_index = false;         /* write a precomputed .dbg.index section */
 bool sc_use_new_parser = false;
 
 void* inpf = NULL;      /* file read from (source or include) */
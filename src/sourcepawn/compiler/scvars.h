@@ -59,6 +59,12 @@ extern int sc_listing;            /* create .LST file? */
 extern int sc_needsemicolon;      /* semicolon required to terminate expressions? */
 extern int sc_dataalign;          /* data alignment value */
 extern int sc_showincludes;       /* show include files? */
+extern int sc_symbolstats;        /* print symbol table statistics? */
+extern int sc_depsfile;           /* write a .deps file next to the .smx? */
+extern int sc_skipunchanged;      /* skip the compile if the .deps file is current? */
+extern int sc_coalescebreaks;     /* one "break" per line and basic block? */
+extern int sc_nobreaks;           /* line table only, without "break" opcodes? */
+extern ke::AString sc_profilefile; /* call counts to order function bodies by */
 extern int curseg;                /* 1 if currently parsing CODE, 2 if parsing DATA */
 extern cell pc_stksize;           /* stack size */
 extern int freading;              /* is there an input file ready for reading? */
@@ -87,6 +93,8 @@ extern bool sc_warnings_are_errors;
 extern unsigned sc_total_errors;
 extern int pc_code_version; /* override the code version */
 extern int sc_compression_level;
+extern int sc_compression_threads;
+extern bool sc_debug_index;       /* write a precomputed .dbg.index section? */
 
 extern void* inpf;      /* file read from (source or include) */
 extern void* inpf_org;  /* main source file */
@@ -16,6 +16,8 @@
 // You should have received a copy of the GNU General Public License along with
 // SourcePawn. If not, see http://www.gnu.org/licenses/.
 #include "smx-builder.h"
+#include <algorithm>
+#include <vector>
 
 using namespace ke;
 using namespace sp;
@@ -109,3 +111,167 @@ SmxNameTable::write(ISmxBuffer *buf)
   return true;
 }
 
+
+void
+SmxDebugIndexSection::addFile(uint32_t addr, uint32_t name)
+{
+  files_.append(sp_fdbg_file_t{addr, name});
+}
+
+void
+SmxDebugIndexSection::addLine(uint32_t addr, uint32_t line)
+{
+  lines_.append(sp_fdbg_line_t{addr, line});
+}
+
+void
+SmxDebugIndexSection::addSymbol(const sp_fdbg_symbol_t &sym, const char *chars)
+{
+  Symbol entry;
+  entry.codestart = sym.codestart;
+  entry.codeend = sym.codeend;
+  entry.name = sym.name;
+  entry.hash = sp_fdbg_index_hash(chars);
+  entry.function = sym.ident == IDENT_FUNCTION && sym.codestart < sym.codeend;
+  symbols_.append(entry);
+}
+
+template <typename T>
+static void
+write_table(MemoryBuffer &buffer, const std::vector<T> &table)
+{
+  if (!table.empty())
+    buffer.write(table.data(), table.size() * sizeof(T));
+}
+
+// The tables hold what the VM would build from the other debug sections, in
+// the same order, so debuggers find the same symbols either way.
+void
+SmxDebugIndexSection::finish()
+{
+  uint32_t num_buckets = 1;
+  while (num_buckets < symbols_.length())
+    num_buckets <<= 1;
+  uint32_t mask = num_buckets - 1;
+
+  // Functions by start address; the first symbol listed for an address
+  // comes first.
+  std::vector<uint32_t> function_symbols;
+  for (uint32_t i = 0; i < symbols_.length(); i++) {
+    if (symbols_[i].function)
+      function_symbols.push_back(i);
+  }
+  std::stable_sort(function_symbols.begin(), function_symbols.end(),
+                   [this](uint32_t a, uint32_t b) -> bool {
+    return symbols_[a].codestart < symbols_[b].codestart;
+  });
+
+  std::vector<sp_fdbg_index_function_t> functions;
+  for (uint32_t index : function_symbols) {
+    const Symbol &sym = symbols_[index];
+    functions.push_back(sp_fdbg_index_function_t{sym.codestart, sym.codeend, sym.name});
+  }
+
+  std::vector<uint32_t> function_chain(functions.size());
+  for (uint32_t i = 0; i < function_chain.size(); i++)
+    function_chain[i] = i;
+  std::stable_sort(function_chain.begin(), function_chain.end(),
+                   [&](uint32_t a, uint32_t b) -> bool {
+    return (symbols_[function_symbols[a]].hash & mask) <
+           (symbols_[function_symbols[b]].hash & mask);
+  });
+
+  std::vector<uint32_t> function_buckets(num_buckets + 1);
+  for (uint32_t index : function_chain)
+    function_buckets[(symbols_[function_symbols[index]].hash & mask) + 1]++;
+  for (uint32_t i = 0; i < num_buckets; i++)
+    function_buckets[i + 1] += function_buckets[i];
+
+  // Lines of each file name. Every line belongs to the file whose range of
+  // addresses it falls in.
+  std::vector<uint32_t> file_names;
+  std::vector<std::vector<sp_fdbg_line_t>> file_lines;
+  uint32_t line = 0;
+  for (uint32_t i = 0; i < files_.length(); i++) {
+    uint32_t bottomaddr = files_[i].addr;
+    uint32_t topaddr = (i + 1 < files_.length()) ? files_[i + 1].addr : UINT32_MAX;
+    while (line < lines_.length() && lines_[line].addr < bottomaddr)
+      line++;
+
+    size_t file = std::find(file_names.begin(), file_names.end(), files_[i].name) -
+                  file_names.begin();
+    if (file == file_names.size()) {
+      file_names.push_back(files_[i].name);
+      file_lines.emplace_back();
+    }
+    for (; line < lines_.length() && lines_[line].addr < topaddr; line++)
+      file_lines[file].push_back(lines_[line]);
+  }
+
+  std::vector<sp_fdbg_index_file_t> files;
+  std::vector<sp_fdbg_line_t> lines;
+  for (size_t i = 0; i < file_names.size(); i++) {
+    auto &entries = file_lines[i];
+    std::sort(entries.begin(), entries.end(),
+              [](const sp_fdbg_line_t &a, const sp_fdbg_line_t &b) -> bool {
+      if (a.line != b.line)
+        return a.line < b.line;
+      return a.addr < b.addr;
+    });
+    files.push_back(sp_fdbg_index_file_t{file_names[i], uint32_t(lines.size()),
+                                         uint32_t(entries.size())});
+    lines.insert(lines.end(), entries.begin(), entries.end());
+  }
+
+  // Symbols grouped by bucket, then name, then start of scope. Symbols of
+  // a name with the same scope stay in table order.
+  std::vector<uint32_t> order(symbols_.length());
+  for (uint32_t i = 0; i < order.size(); i++)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) -> bool {
+    const Symbol &x = symbols_[a];
+    const Symbol &y = symbols_[b];
+    if ((x.hash & mask) != (y.hash & mask))
+      return (x.hash & mask) < (y.hash & mask);
+    if (x.name != y.name)
+      return x.name < y.name;
+    return x.codestart < y.codestart;
+  });
+
+  std::vector<sp_fdbg_index_name_t> names;
+  std::vector<sp_fdbg_index_scope_t> scopes;
+  std::vector<uint32_t> name_buckets(num_buckets + 1);
+  for (uint32_t index : order) {
+    const Symbol &sym = symbols_[index];
+    if (names.empty() || names.back().name != sym.name) {
+      names.push_back(sp_fdbg_index_name_t{sym.name, index, uint32_t(scopes.size()), 0});
+      name_buckets[(sym.hash & mask) + 1]++;
+    }
+    sp_fdbg_index_name_t &name = names.back();
+    if (index < name.global)
+      name.global = index;
+    name.num_scopes++;
+    scopes.push_back(sp_fdbg_index_scope_t{sym.codestart, sym.codeend, index});
+  }
+  for (uint32_t i = 0; i < num_buckets; i++)
+    name_buckets[i + 1] += name_buckets[i];
+
+  sp_fdbg_index_t header;
+  header.version = SP_FDBG_INDEX_VERSION;
+  header.num_functions = functions.size();
+  header.num_buckets = num_buckets;
+  header.num_files = files.size();
+  header.num_lines = lines.size();
+  header.num_names = names.size();
+  header.num_scopes = scopes.size();
+
+  buffer_.write(&header, sizeof(header));
+  write_table(buffer_, functions);
+  write_table(buffer_, function_buckets);
+  write_table(buffer_, function_chain);
+  write_table(buffer_, files);
+  write_table(buffer_, lines);
+  write_table(buffer_, name_buckets);
+  write_table(buffer_, names);
+  write_table(buffer_, scopes);
+}
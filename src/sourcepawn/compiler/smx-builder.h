@@ -23,6 +23,8 @@
 #include <am-hashmap.h>
 #include <am-refcounting.h>
 #include <smx/smx-headers.h>
+#include <smx/smx-legacy-debuginfo.h>
+#include <smx/smx-v1.h>
 #include "string-pool.h"
 #include "memory-buffer.h"
 
@@ -199,6 +201,47 @@ class SmxNameTable : public SmxSection
   uint32_t buffer_size_;
 };
 
+// The ".dbg.index" section. It is handed the debug tables as they are
+// written, and lays out its own once they are complete.
+class SmxDebugIndexSection : public SmxSection
+{
+ public:
+  SmxDebugIndexSection(const char *name)
+   : SmxSection(name)
+  {
+  }
+
+  // Names are debug name table offsets, which are the same for the same
+  // string; |chars| is the string itself.
+  void addFile(uint32_t addr, uint32_t name);
+  void addLine(uint32_t addr, uint32_t line);
+  void addSymbol(const sp::sp_fdbg_symbol_t &sym, const char *chars);
+
+  // Must be called after the last table entry was added.
+  void finish();
+
+  bool write(ISmxBuffer *buf) override {
+    return buf->write(buffer_.bytes(), buffer_.size());
+  }
+  size_t length() const override {
+    return buffer_.size();
+  }
+
+ private:
+  struct Symbol {
+    uint32_t codestart;
+    uint32_t codeend;
+    uint32_t name;
+    uint32_t hash;
+    bool function;
+  };
+
+  Vector<sp::sp_fdbg_file_t> files_;
+  Vector<sp::sp_fdbg_line_t> lines_;
+  Vector<Symbol> symbols_;
+  MemoryBuffer buffer_;
+};
+
 class SmxBuilder
 {
  public:
@@ -6,45 +6,78 @@
 #include <string.h>
 #include "sc.h"
 
-struct NameAndScope {
-    sp::Atom* name;
-    int fnumber;
-
-    NameAndScope(const char* name, int fnumber)
-     : name(gAtoms.add(name)),
-       fnumber(fnumber)
-    {}
+// Global symbols, open-addressed by the atom of their name. A slot holds one
+// name and the symbols that have it, in the order they were added; there is
+// usually just one. Slots are never freed, so a probe ends at the first empty
+// slot, and names compare by pointer.
+struct HashTable {
+    struct Slot {
+        sp::Atom* name;
+        symbol* first;
+    };
+
+    Slot* slots;
+    uint32_t capacity;  // A power of two.
+    uint32_t names;
+
+    // For --stats.
+    uint64_t lookups;
+    uint64_t unknown;
+    uint64_t found;
+    uint64_t probes;
+    uint64_t visited;
+    uint32_t longest_probe;
+
+    bool grow();
+    Slot* lookup(sp::Atom* name, uint32_t* probes);
 };
 
-struct SymbolHashPolicy {
-    typedef symbol* Payload;
+static const uint32_t kInitialCapacity = 512;
 
-    // Everything with the same name has the same hash, because the compiler
-    // wants to know two names that have the same tag for some reason. Even
-    // so, we can't be that accurate, since we might match the right symbol
-    // very early.
-    static uint32_t hash(const NameAndScope& key) {
-        return ke::HashPointer(key.name);
-    }
-    static uint32_t hash(const symbol* s) {
-        return ke::HashPointer(s->nameAtom());
+HashTable::Slot*
+HashTable::lookup(sp::Atom* name, uint32_t* count)
+{
+    uint32_t mask = capacity - 1;
+    uint32_t index = ke::HashPointer(name) & mask;
+    *count = 1;
+    while (slots[index].name && slots[index].name != name) {
+        index = (index + 1) & mask;
+        (*count)++;
     }
+    return &slots[index];
+}
+
+bool
+HashTable::grow()
+{
+    Slot* old_slots = slots;
+    uint32_t old_capacity = capacity;
 
-    static bool matches(const NameAndScope& key, symbol* sym) {
-        if (sym->parent() && sym->ident != iCONSTEXPR)
-            return false;
-        if (sym->fnumber >= 0 && sym->fnumber != key.fnumber)
-            return false;
-        if (key.name != sym->nameAtom())
-            return false;
-        return true;
+    slots = (Slot*)calloc(old_capacity * 2, sizeof(Slot));
+    if (!slots) {
+        slots = old_slots;
+        return false;
     }
-    static bool matches(const symbol* key, symbol* sym) {
-        return key == sym;
+    capacity = old_capacity * 2;
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        if (!old_slots[i].name)
+            continue;
+        uint32_t count;
+        *lookup(old_slots[i].name, &count) = old_slots[i];
     }
-};
+    free(old_slots);
+    return true;
+}
 
-struct HashTable : public ke::HashTable<SymbolHashPolicy> {};
+static bool
+Matches(symbol* sym, int fnumber)
+{
+    if (sym->parent() && sym->ident != iCONSTEXPR)
+        return false;
+    if (sym->fnumber >= 0 && sym->fnumber != fnumber)
+        return false;
+    return true;
+}
 
 uint32_t
 NameHash(const char* str)
@@ -55,42 +88,103 @@ NameHash(const char* str)
 HashTable*
 NewHashTable()
 {
-    HashTable* ht = new HashTable();
-    if (!ht->init()) {
-        delete ht;
+    HashTable* ht = (HashTable*)calloc(1, sizeof(HashTable));
+    if (!ht)
+        return nullptr;
+    ht->slots = (HashTable::Slot*)calloc(kInitialCapacity, sizeof(HashTable::Slot));
+    if (!ht->slots) {
+        free(ht);
         return nullptr;
     }
+    ht->capacity = kInitialCapacity;
     return ht;
 }
 
 void
 DestroyHashTable(HashTable* ht)
 {
-    delete ht;
+    if (!ht)
+        return;
+    free(ht->slots);
+    free(ht);
 }
 
 symbol*
 FindInHashTable(HashTable* ht, const char* name, int fnumber)
 {
-    NameAndScope nas(name, fnumber);
-    HashTable::Result r = ht->find(nas);
-    if (!r.found())
+    ht->lookups++;
+
+    // A name that was never interned has no symbol.
+    sp::Atom* atom = gAtoms.find(name, strlen(name));
+    if (!atom) {
+        ht->unknown++;
         return nullptr;
-    return *r;
+    }
+
+    uint32_t count;
+    HashTable::Slot* slot = ht->lookup(atom, &count);
+    ht->probes += count;
+    if (count > ht->longest_probe)
+        ht->longest_probe = count;
+
+    for (symbol* sym = slot->first; sym; sym = sym->hash_next) {
+        ht->visited++;
+        if (Matches(sym, fnumber)) {
+            ht->found++;
+            return sym;
+        }
+    }
+    return nullptr;
 }
 
 void
 AddToHashTable(HashTable* ht, symbol* sym)
 {
-    HashTable::Insert i = ht->findForAdd(sym);
-    assert(!i.found());
-    ht->add(i, sym);
+    // Keep the load at 75% or less.
+    if ((ht->names + 1) * 4 > ht->capacity * 3 && !ht->grow())
+        error(FATAL_ERROR_OOM);
+
+    uint32_t count;
+    HashTable::Slot* slot = ht->lookup(sym->nameAtom(), &count);
+    if (!slot->name) {
+        slot->name = sym->nameAtom();
+        ht->names++;
+    }
+
+    symbol** link = &slot->first;
+    while (*link) {
+        assert(*link != sym);
+        link = &(*link)->hash_next;
+    }
+    sym->hash_next = nullptr;
+    *link = sym;
 }
 
 void
 RemoveFromHashTable(HashTable* ht, symbol* sym)
 {
-    HashTable::Result r = ht->find(sym);
-    assert(r.found());
-    ht->remove(r);
+    uint32_t count;
+    HashTable::Slot* slot = ht->lookup(sym->nameAtom(), &count);
+    assert(slot->name);
+
+    symbol** link = &slot->first;
+    while (*link != sym) {
+        assert(*link);
+        link = &(*link)->hash_next;
+    }
+    *link = sym->hash_next;
+    sym->hash_next = nullptr;
+}
+
+void
+PrintHashTableStats(HashTable* ht)
+{
+    double lookups = ht->lookups ? (double)ht->lookups : 1.0;
+    pc_printf("Global symbol table: %u names in %u slots\n", ht->names, ht->capacity);
+    pc_printf("  Lookups:           %8llu (%llu found, %llu never seen)\n",
+              (unsigned long long)ht->lookups, (unsigned long long)ht->found,
+              (unsigned long long)ht->unknown);
+    pc_printf("  Probes per lookup: %8.2f (longest %u)\n", ht->probes / lookups,
+              ht->longest_probe);
+    pc_printf("  Symbols compared:  %8.2f per lookup\n", ht->visited / lookups);
 }
@@ -28,5 +28,6 @@ void DestroyHashTable(HashTable* ht);
 void AddToHashTable(HashTable* ht, symbol* sym);
 void RemoveFromHashTable(HashTable* ht, symbol* sym);
 symbol* FindInHashTable(HashTable* ht, const char* name, int fnumber);
+void PrintHashTableStats(HashTable* ht);
 
 #endif /* _INCLUDE_SPCOMP_SYMHASH_H_ */
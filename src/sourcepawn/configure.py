@@ -44,6 +44,8 @@ parser.options.add_option('--build', type='string', dest='build', default='all',
                        help='Build which components (all, spcomp, vm, exp, test, core)')
 parser.options.add_option('--enable-spew', action='store_true', default=False, dest='enable_spew',
                        help='Enable debug spew')
+parser.options.add_option('--enable-opcode-stats', action='store_true', default=False,
+                       dest='enable_opcode_stats', help='Count interpreted opcodes per plugin')
 parser.options.add_option("--enable-coverage", action='store_true', default=False,
                        dest='enable_coverage', help='Enable code coverage support.')
 parser.Configure()
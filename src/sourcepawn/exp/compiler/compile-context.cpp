@@ -27,12 +27,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <chrono>
 #include <amtl/os/am-fsutil.h>
 
 using namespace ke;
 using namespace sp;
 
 ThreadLocal<CompileContext*> sp::CurrentCompileContext;
+ThreadLocal<WorkerContext*> sp::CurrentWorkerContext;
 
 CompileContext::CompileContext(PoolAllocator& pool,
                                StringPool& strings,
@@ -40,6 +42,7 @@ CompileContext::CompileContext(PoolAllocator& pool,
                                SourceManager& source)
  : pool_(pool),
    strings_(strings),
+   worker_strings_(strings),
    reports_(reports),
    source_(source),
    types_(strings)
@@ -59,6 +62,13 @@ CompileContext::~CompileContext()
   CurrentCompileContext = NULL;
 }
 
+PoolAllocator*
+CompileContext::newWorkerPool()
+{
+  worker_pools_.append(MakeUnique<PoolAllocator>());
+  return worker_pools_.back().get();
+}
+
 bool
 CompileContext::ChangePragmaDynamic(ReportingContext& rc, int64_t value)
 {
@@ -172,6 +182,21 @@ CompileContext::compile(RefPtr<SourceFile> file)
 {
   Preprocessor pp(*this);
 
+  if (options_.LexOnly) {
+    if (!pp.enter(file))
+      return false;
+
+    auto start = std::chrono::steady_clock::now();
+    size_t tokens = 0;
+    while (pp.next() != TOK_EOF)
+      tokens++;
+    std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+    fprintf(stderr, "%zu tokens in %.3f ms\n", tokens, elapsed.count());
+    return phasePassed();
+  }
+
   fprintf(stderr, "-- Parsing --\n");
 
   TranslationUnit* unit = new (pool()) TranslationUnit();
@@ -196,6 +221,17 @@ CompileContext::compile(RefPtr<SourceFile> file)
   if (options_.ShowAST)
     unit->tree()->dump(stderr);
 
+  if (options_.AstJsonFile) {
+    const char* path = (*options_.AstJsonFile).chars();
+    FILE* fp = fopen(path, "wb");
+    if (!fp) {
+      fprintf(stderr, "cannot open file '%s'\n", path);
+      return false;
+    }
+    unit->tree()->toJson(*this, fp);
+    fclose(fp);
+  }
+
   if (options_.SkipSemanticAnalysis)
     return true;
 
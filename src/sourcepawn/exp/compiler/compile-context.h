@@ -25,6 +25,7 @@
 #include <stdarg.h>
 #include <string.h>
 #include "shared/string-pool.h"
+#include "shared/concurrent-string-pool.h"
 #include "pool-allocator.h"
 #include "auto-string.h"
 #include "type-manager.h"
@@ -41,6 +42,18 @@ namespace ast {
 class ParseTree;
 } // namespace ast
 
+// A thread that analyzes part of a program alongside others allocates from
+// its own pool, and reports to its own ReportManager so that the messages can
+// be merged in source order afterward.
+struct WorkerContext
+{
+  PoolAllocator* pool;
+  ReportManager* reports;
+  ConcurrentStringPool::Cache* atoms;
+};
+
+extern ke::ThreadLocal<WorkerContext*> CurrentWorkerContext;
+
 class TranslationUnit : public PoolObject
 {
  public:
@@ -83,16 +96,21 @@ class CompileContext
 
   bool compile(RefPtr<SourceFile> file);
 
-  bool phasePassed() const {
-    return !reports_.HasErrors();
+  bool phasePassed() {
+    return !reporting().HasErrors();
   }
-  bool canContinueProcessing() const {
-    return !reports_.HasFatalError();
+  bool canContinueProcessing() {
+    return !reporting().HasFatalError();
   }
 
   PoolAllocator& pool() {
+    if (WorkerContext* worker = CurrentWorkerContext.get())
+      return *worker->pool;
     return pool_;
   }
+
+  // A pool for a worker thread, freed along with this context.
+  PoolAllocator* newWorkerPool();
   TypeManager* types() {
     return &types_;
   }
@@ -103,13 +121,19 @@ class CompileContext
     return options_;
   }
 
-  // String interning.
+  // String interning. Worker threads share a pool in front of the main one;
+  // call flushWorkerStrings() once they are done.
   Atom* add(const char* str) {
-    return strings_.add(str);
+    return add(str, strlen(str));
   }
   Atom* add(const char* str, size_t length) {
+    if (WorkerContext* worker = CurrentWorkerContext.get())
+      return worker_strings_.add(worker->atoms, str, length);
     return strings_.add(str, length);
   }
+  void flushWorkerStrings() {
+    worker_strings_.flush();
+  }
 
   // Option changing.
   bool ChangePragmaDynamic(ReportingContext& rc, int64_t value);
@@ -119,19 +143,21 @@ class CompileContext
 
   // Error reporting.
   ReportManager& reporting() {
+    if (WorkerContext* worker = CurrentWorkerContext.get())
+      return *worker->reports;
     return reports_;
   }
   void reportFatal(rmsg::Id msg) {
-    reports_.reportFatal(msg);
+    reporting().reportFatal(msg);
   }
   void reportFatal(const SourceLocation& loc, rmsg::Id msg) {
-    reports_.reportFatal(loc, msg);
+    reporting().reportFatal(loc, msg);
   }
   MessageBuilder report(const SourceLocation& loc, rmsg::Id msg_id) {
-    return reports_.report(loc, msg_id);
+    return reporting().report(loc, msg_id);
   }
   MessageBuilder note(const SourceLocation& loc, rmsg::Id msg_id) {
-    return reports_.note(loc, msg_id);
+    return reporting().note(loc, msg_id);
   }
 
   Atom* createAnonymousName(const SourceLocation& loc);
@@ -139,10 +165,12 @@ class CompileContext
  private:
   PoolAllocator& pool_;
   StringPool& strings_;
+  ConcurrentStringPool worker_strings_;
   ReportManager& reports_;
   SourceManager& source_;
   TypeManager types_;
   CompileOptions options_;
+  Vector<UniquePtr<PoolAllocator>> worker_pools_;
 };
 
 extern ke::ThreadLocal<CompileContext*> CurrentCompileContext;
@@ -0,0 +1,81 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2018 AlliedModders LLC
+//
+// This file is part of SourcePawn.
+//
+// SourcePawn is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// SourcePawn is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+#include "edit-session.h"
+#include "parser/parser.h"
+#include "parser/preprocessor.h"
+#include "sema/name-resolver.h"
+
+using namespace ke;
+using namespace sp;
+
+EditSession::EditSession()
+ : source_(strings_, reports_),
+   tree_(nullptr)
+{
+}
+
+EditSession::~EditSession()
+{
+  discard();
+}
+
+void
+EditSession::discard()
+{
+  tree_ = nullptr;
+  cc_ = nullptr;
+  scope_ = nullptr;
+}
+
+bool
+EditSession::update(const char* path, const char* chars, uint32_t length)
+{
+  bool changed;
+  source_.update(path, chars, length, &changed);
+  return changed;
+}
+
+bool
+EditSession::reparse(const char* path)
+{
+  // Nothing from the last parse may outlive this: its locations are about
+  // to be reused, and its pool memory rewound.
+  discard();
+  reports_.clear();
+  source_.resetLocations();
+
+  scope_ = MakeUnique<PoolScope>(pool_);
+  cc_ = MakeUnique<CompileContext>(pool_, strings_, reports_, source_);
+  cc_->options().SkipSemanticAnalysis = true;
+  for (size_t i = 0; i < search_paths_.length(); i++)
+    cc_->options().SearchPaths.append(search_paths_[i]);
+
+  ReportingContext rc(*cc_, SourceLocation(), false);
+  RefPtr<SourceFile> file = source_.open(rc, path);
+  if (!file)
+    return false;
+
+  Preprocessor pp(*cc_);
+  if (!pp.enter(file))
+    return false;
+
+  NameResolver nr(*cc_);
+  Parser p(*cc_, pp, nr);
+  tree_ = p.parse();
+  return cc_->phasePassed();
+}
@@ -0,0 +1,94 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2018 AlliedModders LLC
+//
+// This file is part of SourcePawn.
+//
+// SourcePawn is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// SourcePawn is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+#ifndef _include_spcomp2_edit_session_h_
+#define _include_spcomp2_edit_session_h_
+
+#include <amtl/am-string.h>
+#include <amtl/am-uniqueptr.h>
+#include <amtl/am-vector.h>
+#include "shared/string-pool.h"
+#include "compile-context.h"
+#include "pool-allocator.h"
+#include "reporting.h"
+#include "source-manager.h"
+
+namespace sp {
+
+namespace ast {
+class ParseTree;
+} // namespace ast
+
+// Parses and binds a file over and over as an editor changes it, for
+// diagnostics and symbol lookups. Between parses the session keeps the text
+// of every file it has read, their line tables, and the interned names, so
+// an unchanged include is never read again and an edited file's line table
+// is only rescanned around the edit. Each parse still runs the preprocessor
+// and parser over the whole translation unit.
+//
+// Includes are keyed by the path the preprocessor opens them with; an
+// include changed on disk is only seen once it is passed to update().
+class EditSession
+{
+ public:
+  EditSession();
+  ~EditSession();
+
+  // Sets the text of |path| as the editor has it. Returns false if that is
+  // the text the session already had, so the last parse still stands.
+  bool update(const char* path, const char* chars, uint32_t length);
+
+  // Parses |path| and binds its names. The tree and the context it was
+  // parsed in stay valid, and reports() holds the messages, until the next
+  // call. Returns false if there were errors.
+  bool reparse(const char* path);
+
+  Vector<AString>& searchPaths() {
+    return search_paths_;
+  }
+  ast::ParseTree* tree() const {
+    return tree_;
+  }
+  CompileContext* context() const {
+    return cc_.get();
+  }
+  SourceManager& source() {
+    return source_;
+  }
+  ReportManager& reports() {
+    return reports_;
+  }
+
+ private:
+  void discard();
+
+ private:
+  StringPool strings_;
+  ReportManager reports_;
+  SourceManager source_;
+  Vector<AString> search_paths_;
+
+  // Everything the last parse allocated goes when its scope is left.
+  PoolAllocator pool_;
+  UniquePtr<PoolScope> scope_;
+  UniquePtr<CompileContext> cc_;
+  ast::ParseTree* tree_;
+};
+
+} // namespace sp
+
+#endif // _include_spcomp2_edit_session_h_
@@ -40,14 +40,20 @@ int main(int argc, char** argv)
   // :TODO: Turn these off by default once we're closer to release.
   BoolOption show_ast(parser, nullptr, "show-ast", Some(true),
     "Print the AST to stderr.");
+  StringOption ast_json(parser, nullptr, "ast-json", Nothing(),
+    "Write the AST as JSON to this file.");
   BoolOption show_sema(parser, nullptr, "show-sema", Some(true),
     "Print the semantic analysis tree to stderr.");
   BoolOption pool_stats(parser, nullptr, "pool-stats", Some(true),
     "Show pool memory usage after each phase.");
+  ToggleOption lex_only(parser, nullptr, "lex-only", Some(false),
+    "Only preprocess the input, and time it.");
   ToggleOption parse_only(parser, nullptr, "parse-only", Some(false),
     "Skip name binding and type resolution.");
   ToggleOption bind_only(parser, nullptr, "bind-only", Some(false),
     "Skip type-checking and code generation.");
+  IntOption sema_threads(parser, nullptr, "sema-threads", Some(0),
+    "Type-check functions on this many threads.");
 
   if (!parser.parse(argc, argv)) {
     parser.usage(stderr, argc, argv);
@@ -63,11 +69,14 @@ int main(int argc, char** argv)
     PoolScope scope(pool);
     CompileContext cc(pool, strings, reports, source);
 
+    cc.options().LexOnly = lex_only.value();
     cc.options().SkipResolution = parse_only.value();
     cc.options().SkipSemanticAnalysis = bind_only.value();
     cc.options().ShowSema = show_sema.value();
     cc.options().ShowPoolStats = pool_stats.value();
+    cc.options().SemaThreads = sema_threads.value() > 0 ? size_t(sema_threads.value()) : 0;
     cc.options().OutputFile = output_file.maybeValue();
+    cc.options().AstJsonFile = ast_json.maybeValue();
     cc.options().SearchPaths = Move(includes.values());
     
     ReportingContext rc(cc, SourceLocation(), false);
@@ -16,125 +16,206 @@
 // You should have received a copy of the GNU General Public License along with
 // SourcePawn. If not, see http://www.gnu.org/licenses/.
 #include "json-tools.h"
+#include <assert.h>
 #include <stdio.h>
 
 using namespace ke;
 using namespace sp;
 
-JsonRenderer::JsonRenderer(std::ostream& output)
- : out_(output),
-   indent_(0)
+JsonWriter::JsonWriter(FILE* fp)
+ : fp_(fp),
+   failed_(false),
+   after_key_(false),
+   used_(0)
 {
 }
 
+JsonWriter::~JsonWriter()
+{
+  flush();
+}
+
+void
+JsonWriter::beginValue()
+{
+  if (after_key_) {
+    after_key_ = false;
+    return;
+  }
+  if (counts_.empty())
+    return;
+  if (counts_.back()++)
+    put(',');
+  put('\n');
+  prefix(counts_.length());
+}
+
+void
+JsonWriter::begin(char open)
+{
+  beginValue();
+  put(open);
+  counts_.append(0);
+}
+
+void
+JsonWriter::end(char close)
+{
+  assert(!after_key_);
+  size_t count = counts_.popCopy();
+  if (count) {
+    put('\n');
+    prefix(counts_.length());
+  }
+  put(close);
+  if (counts_.empty())
+    put('\n');
+}
+
+void
+JsonWriter::beginObject()
+{
+  begin('{');
+}
+
+void
+JsonWriter::endObject()
+{
+  end('}');
+}
+
+void
+JsonWriter::beginList()
+{
+  begin('[');
+}
+
+void
+JsonWriter::endList()
+{
+  end(']');
+}
+
 void
-JsonRenderer::Render(JsonValue* value)
+JsonWriter::key(const char* name, size_t length)
 {
-  value->Render(this);
+  assert(!after_key_ && !counts_.empty());
+  beginValue();
+  quote(name, length);
+  write(": ", 2);
+  after_key_ = true;
 }
 
-void JsonRenderer::RenderNull(JsonNull* val)
+void
+JsonWriter::null()
 {
-  out_ << "null";
+  beginValue();
+  write("null", 4);
 }
 
-void JsonRenderer::RenderBool(JsonBool* val)
+void
+JsonWriter::boolean(bool value)
 {
-  if (val->value())
-    out_ << "true";
+  beginValue();
+  if (value)
+    write("true", 4);
   else
-    out_ << "false";
+    write("false", 5);
 }
 
-void JsonRenderer::RenderInt(JsonInt* val)
+void
+JsonWriter::integer(int value)
 {
-  out_ << val->value();
+  beginValue();
+  char buffer[16];
+  int length = snprintf(buffer, sizeof(buffer), "%d", value);
+  write(buffer, length);
 }
 
-void JsonRenderer::RenderString(JsonString* val)
+void
+JsonWriter::string(const char* str, size_t length)
 {
-  out_ << "\"";
-  for (size_t i = 0; i < val->atom()->length(); i++) {
-    char c = val->atom()->chars()[i];
+  beginValue();
+  quote(str, length);
+}
+
+void
+JsonWriter::quote(const char* str, size_t length)
+{
+  static const char kHex[] = "0123456789abcdef";
+
+  put('"');
+  const char* run = str;
+  const char* end = str + length;
+  for (const char* p = str; p < end; p++) {
+    unsigned char c = *p;
+    if (c >= 0x20 && c != '"' && c != '\\')
+      continue;
+
+    write(run, p - run);
+    run = p + 1;
+
+    put('\\');
     switch (c) {
-      case '\0':
-        out_ << "\\0";
-        continue;
-      case '\\':
-        out_ << "\\";
-        continue;
       case '"':
-      case '\r':
+      case '\\':
+        put(c);
+        break;
       case '\n':
-        out_ << "\\";
+        put('n');
+        break;
+      case '\r':
+        put('r');
+        break;
+      case '\t':
+        put('t');
+        break;
+      default:
+        write("u00", 3);
+        put(kHex[c >> 4]);
+        put(kHex[c & 0xf]);
         break;
     }
-    out_ << c;
   }
-  out_ << "\"";
+  write(run, end - run);
+  put('"');
 }
 
 void
-JsonRenderer::indent()
+JsonWriter::prefix(size_t depth)
 {
-  indent_ += 2;
+  for (size_t i = 0; i < depth; i++)
+    write("  ", 2);
 }
 
 void
-JsonRenderer::dedent()
+JsonWriter::write(const char* str, size_t length)
 {
-  assert(indent_ >= 2);
-  indent_ -= 2;
+  if (length > sizeof(buffer_) - used_) {
+    drain();
+    if (length > sizeof(buffer_)) {
+      if (fwrite(str, 1, length, fp_) != length)
+        failed_ = true;
+      return;
+    }
+  }
+  memcpy(buffer_ + used_, str, length);
+  used_ += length;
 }
 
 void
-JsonRenderer::prefix()
+JsonWriter::drain()
 {
-  for (size_t i = 0; i < indent_; i++)
-    out_ << " ";
+  if (used_ && fwrite(buffer_, 1, used_, fp_) != used_)
+    failed_ = true;
+  used_ = 0;
 }
 
-void JsonRenderer::RenderList(JsonList* val)
+bool
+JsonWriter::flush()
 {
-  if (!val->items().length()) {
-    out_ << "[]";
-    return;
-  }
-
-  out_ << "[\n";
-  indent();
-  for (size_t i = 0; i < val->items().length(); i++) {
-    prefix();
-    val->items()[i]->Render(this);
-    if (i != val->items().length() - 1)
-      out_ << ",";
-    out_ << "\n";
-  }
-  dedent();
-  prefix();
-  out_ << "]";
+  drain();
+  if (fflush(fp_) != 0)
+    failed_ = true;
+  return !failed_;
 }
-
-void JsonRenderer::RenderObject(JsonObject* val)
-{
-  if (!val->keys().length()) {
-    out_ << "{}";
-    return;
-  }
-
-  out_ << "{\n";
-  indent();
-  for (size_t i = 0; i < val->keys().length(); i++) {
-    prefix();
-    out_ << "\"";
-    out_ << val->keys()[i]->chars();
-    out_ << "\": ";
-    val->values()[i]->Render(this);
-    if (i != val->keys().length() - 1)
-      out_ << ",";
-    out_ << "\n";
-  }
-  dedent();
-  prefix();
-  out_ << "}";
-}
\ No newline at end of file
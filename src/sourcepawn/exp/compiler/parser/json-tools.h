@@ -18,171 +18,77 @@
 #ifndef _include_spcomp_json_tools_h_
 #define _include_spcomp_json_tools_h_
 
-#include <iostream>
-#include <sstream>
+#include <amtl/am-vector.h>
 #include "shared/string-pool.h"
-#include "pool-allocator.h"
-#include "boxed-value.h"
 #include <stdio.h>
+#include <string.h>
 
 namespace sp {
 
 using namespace ke;
 
-class JsonRenderer;
-
-class JsonValue : public PoolObject
-{
- public:
-  virtual void Render(JsonRenderer* renderer) = 0;
-};
-
-class JsonNull;
-class JsonBool;
-class JsonInt;
-class JsonString;
-class JsonList;
-class JsonObject;
-
-class JsonRenderer
+// Writes JSON to a file as it is produced, through a buffer, so a document
+// of any size is never held in memory. Calls must nest properly: inside an
+// object, every value is preceded by key(). The layout is two-space indented
+// with one member or item per line.
+class JsonWriter
 {
  public:
-  JsonRenderer(std::ostream& output);
+  explicit JsonWriter(FILE* fp);
+  ~JsonWriter();
 
-  void Render(JsonValue* value);
-
-  std::ostream& stream() {
-    return out_;
-  }
-
-
-  void RenderNull(JsonNull* val);
-  void RenderBool(JsonBool* val);
-  void RenderInt(JsonInt* val);
-  void RenderString(JsonString* val);
-  void RenderList(JsonList* val);
-  void RenderObject(JsonObject* val);
-
- private:
-  void indent();
-  void dedent();
-  void prefix();
-
- private:
-  std::ostream& out_;
-  size_t indent_;
-};
+  void beginObject();
+  void endObject();
+  void beginList();
+  void endList();
 
-class JsonNull : public JsonValue
-{
- public:
-  void Render(JsonRenderer* renderer) override {
-    renderer->RenderNull(this);
+  void key(Atom* name) {
+    key(name->chars(), name->length());
   }
-};
-
-class JsonBool : public JsonValue
-{
- public:
-  JsonBool(bool value)
-   : value_(value)
-  {}
-
-  void Render(JsonRenderer* renderer) override {
-    renderer->RenderBool(this);
+  void key(const char* name) {
+    key(name, strlen(name));
   }
+  void key(const char* name, size_t length);
 
-  bool value() const {
-    return value_;
+  void null();
+  void boolean(bool value);
+  void integer(int value);
+  void string(Atom* atom) {
+    string(atom->chars(), atom->length());
   }
-
- private:
-  bool value_;
-};
-
-class JsonInt : public JsonValue
-{
- public:
-  JsonInt(int value)
-   : value_(value)
-  {}
-
-  void Render(JsonRenderer* renderer) override {
-    renderer->RenderInt(this);
+  void string(const char* str) {
+    string(str, strlen(str));
   }
+  void string(const char* str, size_t length);
 
-  int value() const {
-    return value_;
-  }
+  // Writes out the buffer. Returns false if any write so far failed.
+  bool flush();
 
  private:
-  int value_;
-};
-
-class JsonString : public JsonValue
-{
- public:
-  JsonString(Atom* atom)
-   : atom_(atom)
-   {}
-
-  void Render(JsonRenderer* renderer) override {
-    renderer->RenderString(this);
-  }
-
-  Atom* atom() const {
-    return atom_;
-  }
-
- private:
-  Atom* atom_;
-};
-
-class JsonObject : public JsonValue
-{
- public:
-  PoolList<Atom*>& keys() {
-    return keys_;
-  }
-  PoolList<JsonValue*>& values() {
-    return values_;
-  }
-
-  void add(Atom* key, JsonValue* value) {
-    keys_.append(key);
-    values_.append(value);
-  }
-
-  void Render(JsonRenderer* renderer) override {
-    renderer->RenderObject(this);
-  }
-
- private:
-  PoolList<Atom*> keys_;
-  PoolList<JsonValue*> values_;
-};
-
-class JsonList : public JsonValue
-{
- public:
-  PoolList<JsonValue*>& items() {
-    return items_;
-  }
-  void add(JsonValue* value) {
-    items_.append(value);
-  }
-  size_t length() const {
-    return items_.length();
-  }
+  void beginValue();
+  void begin(char open);
+  void end(char close);
+  void quote(const char* str, size_t length);
+  void prefix(size_t depth);
 
-  void Render(JsonRenderer* renderer) override {
-    renderer->RenderList(this);
+  void put(char c) {
+    if (used_ == sizeof(buffer_))
+      drain();
+    buffer_[used_++] = c;
   }
+  void write(const char* str, size_t length);
+  void drain();
 
  private:
-  PoolList<JsonValue*> items_;
+  FILE* fp_;
+  bool failed_;
+  bool after_key_;
+  // How many members or items each open object or list has so far.
+  Vector<size_t> counts_;
+  size_t used_;
+  char buffer_[16384];
 };
 
-} // namespace ke
+} // namespace sp
 
-#endif // _include_spcomp_json_tools_h_
\ No newline at end of file
+#endif // _include_spcomp_json_tools_h_
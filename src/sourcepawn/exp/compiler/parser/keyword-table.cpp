@@ -16,7 +16,6 @@
 // You should have received a copy of the GNU General Public License along with
 // SourcePawn. If not, see http://www.gnu.org/licenses/.
 #include "keyword-table.h"
-#include "compile-context.h"
 
 using namespace ke;
 using namespace sp;
@@ -29,24 +28,16 @@ const char* sp::TokenNames[] =
   nullptr
 };
 
-KeywordTable::KeywordTable(CompileContext& cc)
+KeywordTable::KeywordTable()
 {
-  impl_.init(128);
-
-#define _(name)                                   \
-  do {                                            \
-    Atom* atom = cc.add(TokenNames[TOK_##name]);  \
-    defineKeyword(atom, TOK_##name);              \
-  } while (0);
+  size_t index = 0;
+#define _(name)                           \
+  names_[index] = TokenNames[TOK_##name];  \
+  kinds_[index] = TOK_##name;              \
+  index++;
   KEYWORDMAP(_)
 #undef _
-}
-
-void
-KeywordTable::defineKeyword(Atom* atom, TokenKind kind)
-{
-  Impl::Insert p = impl_.findForAdd(atom);
-  assert(!p.found());
+  assert(index == kNumKeywords);
 
-  impl_.add(p, atom, kind);
+  hash_.init(names_, kNumKeywords);
 }
@@ -18,33 +18,37 @@
 #ifndef _include_spcomp_keyword_table_h_
 #define _include_spcomp_keyword_table_h_
 
+#include "shared/keyword-hash.h"
 #include "shared/string-pool.h"
 #include "tokens.h"
 
 namespace sp {
 
-class CompileContext;
-
 class KeywordTable
 {
  public:
-  KeywordTable(CompileContext& cc);
+  KeywordTable();
 
-  TokenKind findKeyword(Atom* id) {
-    Impl::Result r = impl_.find(id);
-    if (!r.found())
+  TokenKind findKeyword(const char* str, size_t length) const {
+    int index = hash_.find(str, length);
+    if (index < 0)
       return TOK_NONE;
-    return r->value;
+    return kinds_[index];
+  }
+  TokenKind findKeyword(Atom* id) const {
+    return findKeyword(id->chars(), id->length());
   }
 
  private:
-  void defineKeyword(Atom* atom, TokenKind tok);
-
- private:
-  typedef AtomMap<TokenKind> Impl;
-
- private:
-  Impl impl_;
+  static const size_t kNumKeywords = 0
+#define _(name) + 1
+    KEYWORDMAP(_)
+#undef _
+    ;
+
+  KeywordHash hash_;
+  const char* names_[kNumKeywords];
+  TokenKind kinds_[kNumKeywords];
 };
 
 }
@@ -18,6 +18,7 @@
 #include "lexer.h"
 #include "compile-context.h"
 #include "preprocessor.h"
+#include "shared/char-scan.h"
 #include <ctype.h>
 #include <math.h>
 #include <stdarg.h>
@@ -82,11 +83,6 @@ static inline bool IsIdentStart(char c)
           c == '_';
 }
 
-static inline bool IsIdentChar(char c)
-{
-  return IsIdentStart(c) || (c >= '0' && c <= '9');
-}
-
 int
 sp::StringToInt32(const char* ptr)
 {
@@ -103,18 +99,15 @@ sp::StringToInt32(const char* ptr)
 const char*
 Lexer::skipSpaces()
 {
-  while (IsSkipSpace(peekChar()))
-    skipChar();
+  pos_ = CharScan::SkipBlanks(pos_, end_);
   return ptr();
 }
 
 char
 Lexer::firstNonSpaceChar()
 {
-  char c = readChar();
-  while (IsSkipSpace(c))
-    c = readChar();
-  return c;
+  skipSpaces();
+  return readChar();
 }
 
 void
@@ -122,8 +115,7 @@ Lexer::readUntilEnd(const char** beginp, const char** endp)
 {
   const char* begin = skipSpaces();
 
-  while (!IsLineTerminator(peekChar()))
-    skipChar();
+  pos_ = CharScan::FindLineEnd(pos_, end_);
 
   const char* end = ptr();
   while (end > begin) {
@@ -347,15 +339,9 @@ Lexer::name(char first)
 {
   literal_.clear();
   literal_.append(first);
-  char c;
-  for (;;) {
-    c = readChar();
-    if (!IsIdentChar(c)) {
-      putBack(c);
-      break;
-    }
-    literal_.append(c);
-  }
+  const char* stop = CharScan::SkipIdentChars(pos_, end_);
+  for (; pos_ < stop; pos_++)
+    literal_.append(*pos_);
   literal_.append('\0');
   return TOK_NAME;
 }
@@ -365,8 +351,8 @@ Lexer::maybeKeyword(char first)
 {
   name(first);
 
-  Atom* atom = cc_.add(literal(), literal_length());
-  return pp_.findKeyword(atom);
+  // Directive names need not be interned just to be looked up.
+  return pp_.findKeyword(literal(), literal_length());
 }
 
 // Based on the logic for litchar() in sc2.c.
@@ -481,6 +467,11 @@ Lexer::stringLiteral(Token* tok)
   literal_.clear();
 
   for (;;) {
+    // Copy the run up to the next character that needs a look.
+    const char* stop = CharScan::FindAny(pos_, end_, '\"', '\\', '\r', '\n');
+    for (; pos_ < stop; pos_++)
+      literal_.append(*pos_);
+
     char c = readChar();
     if (c == '\"')
       break;
@@ -550,8 +541,7 @@ Lexer::handleIdentifier(Token* tok, char first)
 TokenKind
 Lexer::singleLineComment()
 {
-  while (!IsLineTerminator(peekChar()))
-    skipChar();
+  pos_ = CharScan::FindLineEnd(pos_, end_);
   return TOK_COMMENT;
 }
 
@@ -559,6 +549,8 @@ TokenKind
 Lexer::multiLineComment(const SourceLocation& begin)
 {
   while (true) {
+    pos_ = CharScan::FindAny(pos_, end_, '*', '\r', '\n', '\0');
+
     char c = readChar();
     if (c == '\r' || c == '\n') {
       advanceLine(c);
@@ -595,6 +587,8 @@ char
 Lexer::consumeWhitespace()
 {
   for (;;) {
+    skipSpaces();
+
     char c = readChar();
     switch (c) {
       case '\n':
@@ -737,8 +731,10 @@ Lexer::handleIfContext()
         return;
     }
 
-    while (!IsLineTerminator(c))
+    if (!IsLineTerminator(c)) {
+      pos_ = CharScan::FindLineEnd(pos_, end_);
       c = readChar();
+    }
 
     if (c == '\0')
       return;
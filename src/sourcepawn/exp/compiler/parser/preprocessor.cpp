@@ -35,7 +35,6 @@ static const size_t kMaxIncludeDepth = 50;
 Preprocessor::Preprocessor(CompileContext& cc)
  : cc_(cc),
    options_(cc_.options()),
-   keywords_(cc),
    tokens_(&normal_tokens_),
    allow_macro_expansion_(true),
    disable_includes_(false),
@@ -182,6 +182,9 @@ class Preprocessor
   TokenKind findKeyword(Atom* name) {
     return keywords_.findKeyword(name);
   }
+  TokenKind findKeyword(const char* str, size_t length) {
+    return keywords_.findKeyword(str, length);
+  }
 
   bool& macro_expansion() {
     return allow_macro_expansion_;
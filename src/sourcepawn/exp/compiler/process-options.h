@@ -41,6 +41,10 @@ struct CompileOptions
   // Always require semicolons.
   bool RequireSemicolons;
 
+  // Only run the preprocessor over the input, and report how many tokens it
+  // produced and how long that took.
+  bool LexOnly;
+
   // Skip name binding and type resolution.
   bool SkipResolution;
 
@@ -56,6 +60,10 @@ struct CompileOptions
   // Show memory stats.
   bool ShowPoolStats;
 
+  // Threads that analyze global declarations and function bodies; with 0 or
+  // 1 they are analyzed in order on the main thread.
+  size_t SemaThreads;
+
   // Memory size for v1 pcode.
   uint32_t PragmaDynamic;
 
@@ -65,14 +73,19 @@ struct CompileOptions
   // Override output file.
   Maybe<AString> OutputFile;
 
+  // Write the AST as JSON to this file.
+  Maybe<AString> AstJsonFile;
+
   CompileOptions()
    : RequireNewdecls(false),
      RequireSemicolons(false),
+     LexOnly(false),
      SkipResolution(false),
      SkipSemanticAnalysis(false),
      ShowAST(false),
      ShowSema(false),
      ShowPoolStats(false),
+     SemaThreads(0),
      PragmaDynamic(0)
   {
   }
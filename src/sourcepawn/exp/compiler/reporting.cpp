@@ -128,6 +128,28 @@ ReportManager::report(const RefPtr<TMessage>& msg)
   messages_.append(msg);
 }
 
+void
+ReportManager::merge(ReportManager& other)
+{
+  for (size_t i = 0; i < other.messages_.length(); i++)
+    report(other.messages_[i]);
+  if (other.fatal_error_)
+    reportFatal(other.fatal_loc_, other.fatal_error_);
+
+  other.messages_.clear();
+  other.fatal_error_ = rmsg::none;
+  other.num_errors_ = 0;
+}
+
+void
+ReportManager::clear()
+{
+  messages_.clear();
+  fatal_error_ = rmsg::none;
+  fatal_loc_ = SourceLocation();
+  num_errors_ = 0;
+}
+
 MessageBuilder
 ReportManager::build(const SourceLocation& loc, rmsg::Id msg_id)
 {
@@ -229,6 +229,14 @@ class ReportManager
   MessageBuilder build(const SourceLocation& loc, rmsg::Id msg_id);
   void report(const RefPtr<TMessage>& msg);
 
+  // Reports the messages that |other| collected, in order, as if they had
+  // been reported here; |other| is left empty.
+  void merge(ReportManager& other);
+
+  // Forgets everything reported so far, for a manager that outlives a
+  // compilation.
+  void clear();
+
  private:
   void printMessage(RefPtr<TMessage> message);
   void printSourceLine(const FullSourceRef& ref);
@@ -20,6 +20,10 @@
 #include "scopes.h"
 #include "symbols.h"
 #include <amtl/am-linkedlist.h>
+#include <amtl/am-thread-utils.h>
+#include <atomic>
+#include <memory>
+#include <vector>
 
 namespace sp {
 
@@ -55,35 +59,109 @@ SemanticAnalysis::walkAST()
 {
   ParseTree* tree = tu_->tree();
   StatementList* statements = tree->statements();
+  size_t threads = cc_.options().SemaThreads;
+  if (threads > 1 && statements->length() > 1)
+    return walkASTInParallel(statements, threads);
+
   for (size_t i = 0; i < statements->length(); i++) {
-    Statement* stmt = statements->at(i);
-    switch (stmt->kind()) {
-      case AstKind::kFunctionStatement:
-      {
-        FunctionStatement* fun = stmt->toFunctionStatement();
-        visitFunctionStatement(fun);
-        break;
-      }
-      case AstKind::kVarDecl:
-      {
-        VarDecl* decl = stmt->toVarDecl();
-        visitVarDecl(decl);
-        break;
-      }
-      case AstKind::kRecordDecl:
-      case AstKind::kTypedefDecl:
-      case AstKind::kEnumStatement:
-        // Type declarations don't have semantic checks.
-        continue;
-      default:
-        cc_.report(stmt->loc(), rmsg::unimpl_kind) <<
-          "sema-ast-walk" << stmt->kindName();
-        break;
+    visitGlobalStatement(statements->at(i));
+    if (!cc_.canContinueProcessing())
+      return false;
+  }
+  return cc_.phasePassed();
+}
+
+// Names and types are resolved by now, so global statements can be checked
+// independently. Each thread takes the next statement left and analyzes it
+// into its own messages and results, allocating from its own pool. These are
+// merged in source order afterward, so the outcome, down to which messages
+// are dropped past an error limit, is the same as walking the statements in
+// order.
+bool
+SemanticAnalysis::walkASTInParallel(StatementList* statements, size_t threads)
+{
+  struct Unit {
+    ReportManager reports;
+    ke::Vector<ast::FunctionStatement*> functions;
+    ke::Vector<ast::VarDecl*> vars;
+  };
+  ke::Vector<UniquePtr<Unit>> units;
+  for (size_t i = 0; i < statements->length(); i++)
+    units.append(MakeUnique<Unit>());
+
+  std::atomic<size_t> next(0);
+  auto analyze = [&, this](PoolAllocator* pool) -> void {
+    ConcurrentStringPool::Cache atoms;
+    WorkerContext worker = { pool, nullptr, &atoms };
+    CurrentWorkerContext = &worker;
+    for (size_t i = next++; i < units.length(); i = next++) {
+      Unit* unit = units[i].get();
+      worker.reports = &unit->reports;
+
+      SemanticAnalysis sema(cc_, tu_);
+      sema.visitGlobalStatement(statements->at(i));
+      unit->functions = ke::Move(sema.global_functions_);
+      unit->vars = ke::Move(sema.global_vars_);
     }
+    CurrentWorkerContext = nullptr;
+  };
+
+  std::vector<std::unique_ptr<ke::Thread>> workers;
+  for (size_t i = 1; i < threads && i < units.length(); i++) {
+    PoolAllocator* pool = cc_.newWorkerPool();
+    std::unique_ptr<ke::Thread> thread(new ke::Thread([this, &analyze, pool]() -> void {
+      CurrentCompileContext = &cc_;
+      analyze(pool);
+      CurrentCompileContext = nullptr;
+    }, "SP Sema"));
+    if (!thread->Succeeded())
+      break;
+    workers.push_back(std::move(thread));
+  }
+  analyze(&pool_);
+  for (const auto& thread : workers)
+    thread->Join();
+  cc_.flushWorkerStrings();
+
+  for (size_t i = 0; i < units.length(); i++) {
+    Unit* unit = units[i].get();
+    cc_.reporting().merge(unit->reports);
+    for (size_t j = 0; j < unit->functions.length(); j++)
+      global_functions_.append(unit->functions[j]);
+    for (size_t j = 0; j < unit->vars.length(); j++)
+      global_vars_.append(unit->vars[j]);
     if (!cc_.canContinueProcessing())
       return false;
   }
   return cc_.phasePassed();
 }
 
+void
+SemanticAnalysis::visitGlobalStatement(Statement* stmt)
+{
+  switch (stmt->kind()) {
+    case AstKind::kFunctionStatement:
+    {
+      FunctionStatement* fun = stmt->toFunctionStatement();
+      visitFunctionStatement(fun);
+      break;
+    }
+    case AstKind::kVarDecl:
+    {
+      VarDecl* decl = stmt->toVarDecl();
+      visitVarDecl(decl);
+      break;
+    }
+    case AstKind::kRecordDecl:
+    case AstKind::kTypedefDecl:
+    case AstKind::kEnumStatement:
+      // Type declarations don't have semantic checks.
+      break;
+    default:
+      cc_.report(stmt->loc(), rmsg::unimpl_kind) <<
+        "sema-ast-walk" << stmt->kindName();
+      break;
+  }
+}
+
 } // namespace sp
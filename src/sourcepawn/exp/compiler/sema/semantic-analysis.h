@@ -42,6 +42,9 @@ class SemanticAnalysis
 
  private:
   bool walkAST();
+  bool walkASTInParallel(StatementList* statements, size_t threads);
+
+  void visitGlobalStatement(Statement* stmt);
 
   void visitFunctionStatement(FunctionStatement* node);
   void visitBlockStatement(BlockStatement* node);
@@ -624,6 +624,13 @@ SmxCompiler::generateSwitch(ast::SwitchStatement* stmt)
 ValueDest
 SmxCompiler::emit(sema::Expr* expr, ValueDest dest)
 {
+  if (expr->isBinaryExpr() || expr->isUnaryExpr()) {
+    if (Maybe<int32_t> value = MaybeConstInt32(expr)) {
+      emit_const(dest, *value);
+      return dest;
+    }
+  }
+
   switch (expr->kind()) {
   case sema::ExprKind::ConstValue:
     return emitConstValue(expr->toConstValueExpr(), dest);
@@ -788,22 +795,122 @@ SmxCompiler::emitStore(sema::StoreExpr* expr, ValueDest requested)
   return ValueDest::Pri;
 }
 
-static inline ke::Maybe<int32_t>
+// Evaluates an integer expression made only of constants the way the VM
+// would, so it can be emitted as a single constant. Division by zero, the one
+// overflowing division, and shifts by more than a cell are left to fail or
+// behave as they do at runtime.
+static ke::Maybe<int32_t>
+FoldBinary(TokenKind token, int32_t left, int32_t right)
+{
+  uint32_t uleft = uint32_t(left);
+  uint32_t uright = uint32_t(right);
+  switch (token) {
+    case TOK_PLUS:
+      return Some(int32_t(uleft + uright));
+    case TOK_MINUS:
+      return Some(int32_t(uleft - uright));
+    case TOK_STAR:
+      return Some(int32_t(uleft * uright));
+    case TOK_SLASH:
+    case TOK_PERCENT:
+      if (right == 0 || (right == -1 && left == INT_MIN))
+        return Nothing();
+      return Some(token == TOK_SLASH ? left / right : left % right);
+    case TOK_BITOR:
+      return Some(left | right);
+    case TOK_BITXOR:
+      return Some(left ^ right);
+    case TOK_BITAND:
+      return Some(left & right);
+    case TOK_SHL:
+    case TOK_SHR:
+    case TOK_USHR:
+      if (uright >= 32)
+        return Nothing();
+      if (token == TOK_SHL)
+        return Some(int32_t(uleft << uright));
+      if (token == TOK_SHR)
+        return Some(left >> right);
+      return Some(int32_t(uleft >> uright));
+    case TOK_EQUALS:
+      return Some(int32_t(left == right));
+    case TOK_NOTEQUALS:
+      return Some(int32_t(left != right));
+    case TOK_GT:
+      return Some(int32_t(left > right));
+    case TOK_GE:
+      return Some(int32_t(left >= right));
+    case TOK_LT:
+      return Some(int32_t(left < right));
+    case TOK_LE:
+      return Some(int32_t(left <= right));
+    case TOK_AND:
+      return Some(int32_t(left && right));
+    case TOK_OR:
+      return Some(int32_t(left || right));
+    default:
+      return Nothing();
+  }
+}
+
+static ke::Maybe<int32_t>
 MaybeConstInt32(sema::Expr* expr)
 {
-  sema::ConstValueExpr* cv = expr->asConstValueExpr();
-  if (!cv)
-    return Nothing();
+  switch (expr->kind()) {
+    case sema::ExprKind::ConstValue:
+    {
+      const BoxedValue& box = expr->toConstValueExpr()->value();
+      if (box.kind() != BoxedValue::Kind::Integer)
+        return Nothing();
+
+      const IntValue& iv = box.toInteger();
+      if (!iv.valueFitsInInt32())
+        return Nothing();
 
-  const BoxedValue& box = cv->value();
-  if (box.kind() != BoxedValue::Kind::Integer)
-    return Nothing();
+      return Some((int32_t)iv.asSigned());
+    }
+
+    case sema::ExprKind::ImplicitCast:
+    {
+      sema::ImplicitCastExpr* cast = expr->toImplicitCastExpr();
+      if (cast->op() != sema::CastOp::None)
+        return Nothing();
+      return MaybeConstInt32(cast->expr());
+    }
+
+    case sema::ExprKind::Unary:
+    {
+      sema::UnaryExpr* unary = expr->toUnaryExpr();
+      Maybe<int32_t> value = MaybeConstInt32(unary->expr());
+      if (!value)
+        return Nothing();
+      switch (unary->token()) {
+        case TOK_NEGATE:
+          return Some(int32_t(0 - uint32_t(*value)));
+        case TOK_NOT:
+          return Some(int32_t(!*value));
+        case TOK_TILDE:
+          return Some(~*value);
+        default:
+          return Nothing();
+      }
+    }
 
-  const IntValue& iv = box.toInteger();
-  if (!iv.valueFitsInInt32())
-    return Nothing();
+    case sema::ExprKind::Binary:
+    {
+      sema::BinaryExpr* bin = expr->toBinaryExpr();
+      Maybe<int32_t> left = MaybeConstInt32(bin->left());
+      if (!left)
+        return Nothing();
+      Maybe<int32_t> right = MaybeConstInt32(bin->right());
+      if (!right)
+        return Nothing();
+      return FoldBinary(bin->token(), *left, *right);
+    }
 
-  return Some((int32_t)iv.asSigned());
+    default:
+      return Nothing();
+  }
 }
 
 ValueDest
@@ -1416,16 +1523,21 @@ SmxCompiler::emitIndex(sema::IndexExpr* expr, ValueDest dest)
 {
   ArrayType* atype = expr->base()->type()->toArray();
 
-  int32_t const_index = -1;
-  if (expr->index()->getConstantInt32(&const_index)) {
+  // Sema rejects constant indexes out of bounds, but not ones that only fold
+  // to a constant here; those keep the runtime check.
+  Maybe<int32_t> const_index = MaybeConstInt32(expr->index());
+  bool in_bounds = const_index &&
+                   (!atype->hasFixedLength() ||
+                    (*const_index >= 0 && *const_index < atype->fixedLength()));
+  if (in_bounds) {
     if (!emit_into(expr->base(), ValueDest::Pri))
       return ValueDest::Error;
 
-    if (const_index != 0) {
+    if (*const_index != 0) {
       if (atype->isCharArray())
-        __ opcode(OP_ADD_C, const_index);
+        __ opcode(OP_ADD_C, *const_index);
       else
-        __ opcode(OP_ADD_C, const_index * sizeof(cell_t));
+        __ opcode(OP_ADD_C, *const_index * sizeof(cell_t));
     }
   } else {
     if (!emit_into(expr->base(), ValueDest::Alt))
@@ -1851,6 +1963,13 @@ InvertTestOp(OPCODE op)
 void
 SmxCompiler::test(sema::Expr* expr, bool jumpOnTrue, Label* taken, Label* fallthrough)
 {
+  // A condition that folds to a constant always goes the same way.
+  if (Maybe<int32_t> value = MaybeConstInt32(expr)) {
+    if (!!*value == jumpOnTrue)
+      __ opcode(OP_JUMP, taken);
+    return;
+  }
+
   if (sema::BinaryExpr* bin = expr->asBinaryExpr()) {
     // Optimize comparators into their jump-conditional instructions, to avoid
     // needing intermediate values.
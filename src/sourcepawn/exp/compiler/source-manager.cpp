@@ -18,6 +18,7 @@
 #include "source-manager.h"
 #include "compile-context.h"
 #include <stdio.h>
+#include <string.h>
 #include <amtl/am-arithmetic.h>
 
 using namespace ke;
@@ -108,6 +109,69 @@ SourceFile::computeLineCache()
   memcpy(line_cache_->buffer(), lines.buffer(), sizeof(uint32_t) * lines.length());
 }
 
+void
+SourceFile::computeLineCache(SourceFile* prev)
+{
+  LineExtents* old = prev->lineCache();
+  if (!old) {
+    computeLineCache();
+    return;
+  }
+
+  const char* old_chars = prev->chars();
+  uint32_t old_length = prev->length();
+  uint32_t limit = Min(length_, old_length);
+  uint32_t prefix = 0;
+  while (prefix < limit && chars_[prefix] == old_chars[prefix])
+    prefix++;
+  uint32_t suffix = 0;
+  while (suffix < limit - prefix &&
+         chars_[length_ - 1 - suffix] == old_chars[old_length - 1 - suffix])
+  {
+    suffix++;
+  }
+
+  // A line start depends on at most the two characters before it and the one
+  // at it (for \r\n), so the ones before the first change stay.
+  Vector<uint32_t> lines;
+  size_t old_index = 0;
+  for (; old_index < old->length() && old->at(old_index) < prefix; old_index++)
+    lines.append(old->at(old_index));
+  if (lines.empty())
+    lines.append(0);
+
+  // Scanning resumes from a line start, so once it finds one in the common
+  // suffix that the old text also had, the rest of the old starts follow.
+  int64_t delta = int64_t(length_) - int64_t(old_length);
+  for (uint32_t i = lines.back(); i < length_; i++) {
+    if (chars_[i] != '\r' && chars_[i] != '\n')
+      continue;
+    if (chars_[i] == '\r' && i + 1 < length_ && chars_[i + 1] == '\n')
+      i++;
+    uint32_t start = i + 1;
+    lines.append(start);
+    if (start < length_ - suffix)
+      continue;
+
+    uint32_t old_start = uint32_t(int64_t(start) - delta);
+    while (old_index < old->length() && old->at(old_index) < old_start)
+      old_index++;
+    if (old_index < old->length() && old->at(old_index) == old_start) {
+      for (old_index++; old_index < old->length(); old_index++)
+        lines.append(uint32_t(int64_t(old->at(old_index)) + delta));
+      break;
+    }
+  }
+
+  line_cache_ = new LineExtents(lines.length());
+  if (!line_cache_->initialize()) {
+    line_cache_ = nullptr;
+    return;
+  }
+
+  memcpy(line_cache_->buffer(), lines.buffer(), sizeof(uint32_t) * lines.length());
+}
+
 SourceManager::SourceManager(StringPool& strings, ReportManager& reports)
  : strings_(strings),
    rr_(reports),
@@ -159,6 +223,45 @@ SourceManager::createFromBuffer(UniquePtr<char[]>&& buffer, uint32_t length, con
   return file;
 }
 
+RefPtr<SourceFile>
+SourceManager::update(const char* path, const char* chars, uint32_t length, bool* changed)
+{
+  Atom* atom = strings_.add(path);
+  AtomMap<RefPtr<SourceFile>>::Insert p = file_cache_.findForAdd(atom);
+
+  RefPtr<SourceFile> prev;
+  if (p.found()) {
+    prev = p->value;
+    if (prev->length() == length && memcmp(prev->chars(), chars, length) == 0) {
+      *changed = false;
+      return prev;
+    }
+  }
+
+  // The lexer expects a terminator past the end, like files read from disk.
+  UniquePtr<char[]> buffer = MakeUnique<char[]>(size_t(length) + 1);
+  memcpy(buffer.get(), chars, length);
+  buffer[length] = '\0';
+
+  RefPtr<SourceFile> file = new SourceFile(buffer.take(), length, path);
+  if (prev) {
+    file->computeLineCache(prev);
+    p->value = file;
+  } else {
+    file_cache_.add(p, atom, file);
+  }
+  *changed = true;
+  return file;
+}
+
+void
+SourceManager::resetLocations()
+{
+  locations_.clear();
+  next_source_id_ = 1;
+  last_lookup_ = 0;
+}
+
 bool
 SourceManager::trackExtents(uint32_t length, size_t* index)
 {
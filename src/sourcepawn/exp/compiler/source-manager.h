@@ -68,6 +68,11 @@ class SourceFile : public Refcounted<SourceFile>
   }
   void computeLineCache();
 
+ private:
+  // Builds the line cache from that of |prev|, an earlier text of the same
+  // file, scanning only from the first changed line until the two agree again.
+  void computeLineCache(SourceFile* prev);
+
  protected:
   AutoPtr<char[]> chars_;
   uint32_t length_;
@@ -215,6 +220,15 @@ class SourceManager
 
   RefPtr<SourceFile> createFromBuffer(UniquePtr<char[]>&& buffer, uint32_t length, const char* path);
 
+  // Sets the text later open()s of |path| get, such as an editor's unsaved
+  // buffer. If the text is what the manager already has, the cached file is
+  // returned and *changed is false. Files already open keep their old text.
+  RefPtr<SourceFile> update(const char* path, const char* chars, uint32_t length, bool* changed);
+
+  // Forgets every tracked file and macro location, so a manager that outlives
+  // a compilation can serve another. Nothing tracked before may be used after.
+  void resetLocations();
+
   // Returns whether two source locations ultimately originate from the same
   // file (i.e., ignoring macros).
   bool sameFiles(const SourceLocation& a, const SourceLocation& b);
@@ -38,10 +38,18 @@ def run_tests(args):
             stdout = stdout.decode('utf-8')
             stderr = stderr.decode('utf-8')
 
+            shell_runs = []
             if test_type == 'runtime':
-                smx_path = test + '.smx'
+                smx_path = os.path.join(testdir, test + '.smx')
                 compiled = os.path.exists(smx_path)
                 if compiled:
+                    # Each shell runs the test with the JIT and with it off.
+                    for shell in args.shell:
+                        for flags in [[], ['-i']]:
+                            argv = [os.path.abspath(shell)] + flags + [smx_path]
+                            sp = subprocess.Popen(argv, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+                            shell_stdout, _ = sp.communicate()
+                            shell_runs.append((' '.join(argv), sp.returncode, shell_stdout.decode('utf-8')))
                     os.unlink(smx_path)
             else:
                 compiled = p.returncode == 0
@@ -65,6 +73,28 @@ def run_tests(args):
                             line,
                         ]
                         break
+
+            # The shell's output, less the stack dumped after an exception,
+            # must be the .out file line for line, and a test that expects an
+            # exception must exit with 1 and any other with 0.
+            out_path = os.path.join(testdir, test + '.out')
+            if status == 'ok' and shell_runs and os.path.exists(out_path):
+                with open(out_path) as fp:
+                    expected = [line.rstrip() for line in fp]
+                expected_rc = 1 if any(line.startswith('Exception thrown: ') for line in expected) else 0
+                for command, rc, shell_stdout in shell_runs:
+                    actual = [line.rstrip() for line in shell_stdout.splitlines()
+                              if not line.startswith('  [')]
+                    if actual != expected:
+                        fails += [
+                            'Shell output of {0} differs, expected:\n'.format(command),
+                            '\n'.join(expected) + '\n',
+                        ]
+                    elif rc != expected_rc:
+                        fails += ['{0} exited with {1}, expected {2}\n'.format(command, rc, expected_rc)]
+                    if len(fails):
+                        stdout += shell_stdout
+                        break
             
             if status == 'fail' or len(fails):
                 print('Test {0} ... FAIL, exit code {1}'.format(test, p.returncode))
@@ -88,6 +118,9 @@ def run_tests(args):
 def main():
     parser = argparse.ArgumentParser()
     parser.add_argument('spcomp', type=str, help='Path to spcomp')
+    parser.add_argument('--shell', type=str, action='append', default=[],
+                        help='Path to a shell to run the runtime tests with, e.g. spshell and '
+                             'spshell-switch; may be given more than once')
     args = parser.parse_args()
     run_tests(args)
 
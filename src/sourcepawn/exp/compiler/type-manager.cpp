@@ -161,6 +161,8 @@ TypeManager::newTypedef(Atom* name)
 ReferenceType*
 TypeManager::newReference(Type* type)
 {
+  ke::AutoLock lock(&reftype_lock_);
+
   RefTypeCache::Insert p = reftype_cache_.findForAdd(type);
   if (p.found())
     return p->value;
@@ -22,6 +22,7 @@
 #include "shared/string-pool.h"
 #include "types.h"
 #include <amtl/am-hashmap.h>
+#include <amtl/am-thread-utils.h>
 
 namespace sp {
 
@@ -109,6 +110,8 @@ class TypeManager
                       ReferenceType*,
                       ke::PointerPolicy<Type>> RefTypeCache;
   RefTypeCache reftype_cache_;
+  // Function bodies may be type-checked on several threads.
+  ke::Mutex reftype_lock_;
 };
 
 }
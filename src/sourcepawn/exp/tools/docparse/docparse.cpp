@@ -24,6 +24,13 @@
 #include "compiler/parser/json-tools.h"
 #include "compiler/sema/name-resolver.h"
 #include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <amtl/am-thread-utils.h>
 #include <amtl/experimental/am-argparser.h>
 
 using namespace ke;
@@ -140,196 +147,216 @@ class Comments : public CommentDelegate
 class Analyzer : public PartialAstVisitor
 {
  public:
-  Analyzer(CompileContext &cc, Comments &comments)
+  Analyzer(CompileContext &cc, Comments &comments, JsonWriter &out)
    : cc_(cc),
-     pool_(cc.pool()),
-     comments_(comments)
-  {
-    atom_name_ = cc_.add("name");
-    atom_kind_ = cc_.add("kind");
-    atom_returnType_ = cc_.add("returnType");
-    atom_type_ = cc_.add("type");
-    atom_parameters_ = cc_.add("arguments");
-    atom_doc_start_ = cc_.add("docStart");
-    atom_doc_end_ = cc_.add("docEnd");
-    atom_properties_ = cc_.add("properties");
-    atom_methods_ = cc_.add("methods");
-    atom_getter_ = cc_.add("getter");
-    atom_setter_ = cc_.add("setter");
-    atom_entries_ = cc_.add("entries");
-    atom_constants_ = cc_.add("constants");
-    atom_decl_ = cc_.add("decl");
-  }
-
-  JsonObject *analyze(ParseTree *tree) {
-    functions_ = new (pool_) JsonList();
-    methodmaps_ = new (pool_) JsonList();
-    enums_ = new (pool_) JsonList();
-    constants_ = new (pool_) JsonList();
-    typesets_ = new (pool_) JsonList();
-    typedefs_ = new (pool_) JsonList();
+     comments_(comments),
+     out_(out)
+  {}
 
+  void write(ParseTree *tree) {
+    // Sort the declarations first, then write each kind's in one list.
     for (size_t i = 0; i < tree->statements()->length(); i++) {
       Statement *stmt = tree->statements()->at(i);
-      stmt->accept(this);
+      switch (stmt->kind()) {
+        case AstKind::kFunctionStatement:
+          functions_.append(stmt);
+          break;
+        case AstKind::kMethodmapDecl:
+          methodmaps_.append(stmt);
+          break;
+        case AstKind::kEnumStatement:
+          if (stmt->toEnumStatement()->name())
+            enums_.append(stmt);
+          else
+            constants_.append(stmt);
+          break;
+        case AstKind::kTypesetDecl:
+          typesets_.append(stmt);
+          break;
+        case AstKind::kTypedefDecl:
+          typedefs_.append(stmt);
+          break;
+        default:
+          break;
+      }
     }
 
-    JsonObject *obj = new (pool_) JsonObject();
-    obj->add(cc_.add("functions"), functions_);
-    obj->add(cc_.add("methodmaps"), methodmaps_);
-    obj->add(cc_.add("enums"), enums_);
-    obj->add(cc_.add("constants"), constants_);
-    obj->add(cc_.add("typesets"), typesets_);
-    obj->add(cc_.add("typedefs"), typedefs_);
-    return obj;
+    out_.beginObject();
+    writeList("functions", functions_);
+    writeList("methodmaps", methodmaps_);
+    writeList("enums", enums_);
+    writeList("constants", constants_);
+    writeList("typesets", typesets_);
+    writeList("typedefs", typedefs_);
+    out_.endObject();
   }
 
   void visitMethodmapDecl(MethodmapDecl *node) override {
-    JsonObject *obj = new (pool_) JsonObject();
-    obj->add(atom_name_, toJson(node->name()));
-    startDoc(obj, "class", node->name(), node->loc());
-
-    SaveAndSet<JsonList *> new_props(&props_, new (pool_) JsonList());
-    SaveAndSet<JsonList *> new_methods(&methods_, new (pool_) JsonList());
-    for (size_t i = 0; i < node->body()->length(); i++)
-      node->body()->at(i)->accept(this);
-
-    obj->add(atom_methods_, methods_);
-    obj->add(atom_properties_, props_);
-    methodmaps_->add(obj);
+    out_.beginObject();
+    writeName(node->name());
+    startDoc("class", node->name(), node->loc());
+
+    out_.key("methods");
+    out_.beginList();
+    for (size_t i = 0; i < node->body()->length(); i++) {
+      if (node->body()->at(i)->isMethodDecl())
+        node->body()->at(i)->accept(this);
+    }
+    out_.endList();
+
+    out_.key("properties");
+    out_.beginList();
+    for (size_t i = 0; i < node->body()->length(); i++) {
+      if (node->body()->at(i)->isPropertyDecl())
+        node->body()->at(i)->accept(this);
+    }
+    out_.endList();
+    out_.endObject();
   }
 
   void visitMethodDecl(MethodDecl *node) override {
-    JsonObject *obj = new (pool_) JsonObject();
-    obj->add(atom_name_, toJson(node->name()));
-    startDoc(obj, "method", node->name(), node->loc());
+    out_.beginObject();
+    writeName(node->name());
+    startDoc("method", node->name(), node->loc());
 
     FunctionNode *fun = node->method();
-    obj->add(atom_returnType_, toJson(fun->signature()->returnType()));
-    obj->add(atom_parameters_, toJson(fun->signature()->parameters()));
-    methods_->add(obj);
+    out_.key("returnType");
+    writeType(fun->signature()->returnType());
+    out_.key("arguments");
+    writeParameters(fun->signature()->parameters());
+    out_.endObject();
   }
   void visitPropertyDecl(PropertyDecl *node) override {
-    JsonObject *obj = new (pool_) JsonObject();
-    obj->add(atom_name_, toJson(node->name()));
-    startDoc(obj, "property", node->name(), node->loc());
-
-    obj->add(atom_type_, toJson(node->te()));
-    obj->add(atom_getter_, new (pool_) JsonBool(!!node->getter()));
-    obj->add(atom_setter_, new (pool_) JsonBool(!!node->setter()));
-    props_->add(obj);
+    out_.beginObject();
+    writeName(node->name());
+    startDoc("property", node->name(), node->loc());
+
+    out_.key("type");
+    writeType(node->te());
+    out_.key("getter");
+    out_.boolean(!!node->getter());
+    out_.key("setter");
+    out_.boolean(!!node->setter());
+    out_.endObject();
   }
 
   void visitTypesetDecl(TypesetDecl *decl) override {
-    JsonObject *obj = new (pool_) JsonObject();
-    obj->add(atom_name_, toJson(decl->name()));
-    startDoc(obj, "typeset", decl->name(), decl->loc());
+    out_.beginObject();
+    writeName(decl->name());
+    startDoc("typeset", decl->name(), decl->loc());
 
-    JsonList *list = new (pool_) JsonList();
+    out_.key("types");
+    out_.beginList();
     for (size_t i = 0; i < decl->types()->length(); i++) {
       const TypesetDecl::Entry &entry = decl->types()->at(i);
-      JsonObject *te = new (pool_) JsonObject();
-      te->add(atom_type_, toJson(entry.te));
+      out_.beginObject();
+      out_.key("type");
+      writeType(entry.te);
       unsigned start, end;
-      if (comments_.findCommentFor(entry.loc, &start, &end)) {
-        te->add(atom_doc_start_, new (pool_) JsonInt(start));
-        te->add(atom_doc_end_, new (pool_) JsonInt(end));
-      }
-      list->add(te);
+      if (comments_.findCommentFor(entry.loc, &start, &end))
+        writeDoc(start, end);
+      out_.endObject();
     }
-    obj->add(cc_.add("types"), list);
-
-    typesets_->add(obj);
+    out_.endList();
+    out_.endObject();
   }
 
   void visitTypedefDecl(TypedefDecl *decl) override {
-    JsonObject *obj = new (pool_) JsonObject();
-    obj->add(atom_name_, toJson(decl->name()));
-    startDoc(obj, "typedef", decl->name(), decl->loc());
-
-    obj->add(atom_type_, toJson(decl->te()));
+    out_.beginObject();
+    writeName(decl->name());
+    startDoc("typedef", decl->name(), decl->loc());
 
-    typedefs_->add(obj);
+    out_.key("type");
+    writeType(decl->te());
+    out_.endObject();
   }
 
   void visitEnumStatement(EnumStatement *node) override {
     if (!node->name()) {
-      for (size_t i = 0; i < node->entries()->length(); i++) {
-        EnumConstant *cs = node->entries()->at(i);
-
-        JsonObject *val = new (pool_) JsonObject();
-        val->add(atom_name_, toJson(cs->name()));
-        startDoc(val, "enum value", cs->name(), cs->loc());
-
-        constants_->add(val);
-      }
+      // Each value is written straight into the constants list.
+      for (size_t i = 0; i < node->entries()->length(); i++)
+        writeEnumConstant(node->entries()->at(i));
       return;
     }
 
-    JsonObject *obj = new (pool_) JsonObject();
-    obj->add(atom_name_, toJson(node->name()));
-    startDoc(obj, "enum", node->name(), node->loc());
+    out_.beginObject();
+    writeName(node->name());
+    startDoc("enum", node->name(), node->loc());
 
-    JsonList *list = new (pool_) JsonList();
-    for (size_t i = 0; i < node->entries()->length(); i++) {
-      EnumConstant *cs = node->entries()->at(i);
-
-      JsonObject *val = new (pool_) JsonObject();
-      val->add(atom_name_, toJson(cs->name()));
-      startDoc(val, "enum value", cs->name(), cs->loc());
-
-      list->add(val);
-    }
-    obj->add(atom_entries_, list);
-
-    enums_->add(obj);
+    out_.key("entries");
+    out_.beginList();
+    for (size_t i = 0; i < node->entries()->length(); i++)
+      writeEnumConstant(node->entries()->at(i));
+    out_.endList();
+    out_.endObject();
   }
 
   void visitFunctionStatement(FunctionStatement *node) override {
-    JsonObject *obj = new (pool_) JsonObject();
-    obj->add(atom_name_, toJson(node->name()));
-    startDoc(obj, "function", node->name(), node->loc());
+    out_.beginObject();
+    writeName(node->name());
+    startDoc("function", node->name(), node->loc());
 
+    out_.key("kind");
     if (node->token() == TOK_FORWARD)
-      obj->add(atom_kind_, toJson("forward"));
+      out_.string("forward");
     else if (node->token() == TOK_NATIVE)
-      obj->add(atom_kind_, toJson("native"));
+      out_.string("native");
     else
-      obj->add(atom_kind_, toJson("stock"));
+      out_.string("stock");
 
-    obj->add(atom_returnType_, toJson(node->signature()->returnType()));
-    obj->add(atom_parameters_, toJson(node->signature()->parameters()));
-
-    functions_->add(obj);
+    out_.key("returnType");
+    writeType(node->signature()->returnType());
+    out_.key("arguments");
+    writeParameters(node->signature()->parameters());
+    out_.endObject();
   }
 
  private:
-  void startDoc(JsonObject *obj, const char *type, Atom *name, const SourceLocation &loc) {
+  void writeList(const char *key, const Vector<Statement *> &stmts) {
+    out_.key(key);
+    out_.beginList();
+    for (size_t i = 0; i < stmts.length(); i++)
+      stmts[i]->accept(this);
+    out_.endList();
+  }
+
+  void writeEnumConstant(EnumConstant *cs) {
+    out_.beginObject();
+    writeName(cs->name());
+    startDoc("enum value", cs->name(), cs->loc());
+    out_.endObject();
+  }
+
+  void writeName(Atom *name) {
+    out_.key("name");
+    out_.string(name);
+  }
+
+  void startDoc(const char *type, Atom *name, const SourceLocation &loc) {
     unsigned start, end;
     if (!comments_.findCommentFor(loc, &start, &end)) {
       cc_.report(loc, rmsg::missing_comment)
         << type << name;
       return;
     }
+    writeDoc(start, end);
+  }
 
+  void writeDoc(unsigned start, unsigned end) {
     assert(start < INT_MAX);
     assert(end < INT_MAX);
 
-    obj->add(atom_doc_start_, new (pool_) JsonInt(start));
-    obj->add(atom_doc_end_, new (pool_) JsonInt(end));
+    out_.key("docStart");
+    out_.integer(start);
+    out_.key("docEnd");
+    out_.integer(end);
   }
 
-  JsonString *toJson(const TypeSpecifier *spec, Atom *name = nullptr) {
-    return toJson(BuildTypeName(spec, name, TypeDiagFlags::Names).chars());
-  }
-  JsonString *toJson(Type *type, Atom *name = nullptr) {
-    return toJson(BuildTypeName(type, name, TypeDiagFlags::Names).chars());
-  }
-
-  JsonString *toJson(const TypeExpr &te, Atom *name = nullptr) {
+  void writeType(const TypeExpr &te, Atom *name = nullptr) {
     if (te.spec())
-      return toJson(te.spec(), name);
-    return toJson(te.resolved(), name);
+      writeString(BuildTypeName(te.spec(), name, TypeDiagFlags::Names));
+    else
+      writeString(BuildTypeName(te.resolved(), name, TypeDiagFlags::Names));
   }
 
   static inline bool isByRef(const TypeExpr& te) {
@@ -343,81 +370,67 @@ class Analyzer : public PartialAstVisitor
            : te.spec()->isConst();
   }
 
-  JsonString *toJson(VarDecl *decl, bool named) {
+  void writeDecl(VarDecl *decl, bool named) {
     // :TODO: add a BuildTypeName(VarDecl) helper.
     TypeDiagFlags flags = TypeDiagFlags::Names;
     if (isByRef(decl->te()))
       flags |= TypeDiagFlags::IsByRef;
     if (isConst(decl->te()))
       flags |= TypeDiagFlags::IsConst;
-    return toJson(BuildTypeName(
+    writeString(BuildTypeName(
       decl->te(),
       named ? decl->name() : nullptr,
-      flags).chars());
+      flags));
   }
 
-  JsonList *toJson(const ParameterList *params) {
-    JsonList *list = new (pool_) JsonList();
+  void writeParameters(const ParameterList *params) {
+    out_.beginList();
     for (size_t i = 0; i < params->length(); i++) {
       VarDecl *decl = params->at(i);
-      JsonObject *obj = new (pool_) JsonObject();
+      out_.beginObject();
 
-      obj->add(atom_type_, toJson(decl, false));
+      out_.key("type");
+      writeDecl(decl, false);
 
       if (decl->name()) {
-        obj->add(atom_name_, toJson(decl->name()));
-        obj->add(atom_decl_, toJson(decl, true));
+        writeName(decl->name());
+        out_.key("decl");
+        writeDecl(decl, true);
       } else {
-        obj->add(atom_name_, toJson("..."));
+        out_.key("name");
+        out_.string("...");
 
         AutoString builder = BuildTypeName(decl->te(), nullptr, TypeDiagFlags::Names);
         builder = builder + " ...";
-        obj->add(atom_decl_, toJson(builder.ptr()));
+        out_.key("decl");
+        out_.string(builder.ptr());
       }
-      list->add(obj);
+      out_.endObject();
     }
-    return list;
+    out_.endList();
   }
 
-  JsonString *toJson(Atom *name) {
-    return new (pool_) JsonString(name);
-  }
-  JsonString *toJson(const char *str) {
-    return new (pool_) JsonString(cc_.add(str));
+  void writeString(const AString &str) {
+    out_.string(str.chars(), str.length());
   }
 
  private:
   CompileContext &cc_;
-  PoolAllocator &pool_;
   Comments &comments_;
-
-  Atom *atom_name_;
-  Atom *atom_kind_;
-  Atom *atom_returnType_;
-  Atom *atom_type_;
-  Atom *atom_parameters_;
-  Atom *atom_doc_start_;
-  Atom *atom_doc_end_;
-  Atom *atom_properties_;
-  Atom *atom_methods_;
-  Atom *atom_getter_;
-  Atom *atom_setter_;
-  Atom *atom_entries_;
-  Atom *atom_constants_;
-  Atom *atom_decl_;
-  JsonList *functions_;
-  JsonList *methodmaps_;
-  JsonList *enums_;
-  JsonList *constants_;
-  JsonList *typesets_;
-  JsonList *typedefs_;
-
-  JsonList *props_;
-  JsonList *methods_;
+  JsonWriter &out_;
+
+  Vector<Statement *> functions_;
+  Vector<Statement *> methodmaps_;
+  Vector<Statement *> enums_;
+  Vector<Statement *> constants_;
+  Vector<Statement *> typesets_;
+  Vector<Statement *> typedefs_;
 };
 
-static JsonObject *
-Run(CompileContext &cc, const char *path)
+// Parses |path| and writes its documentation to |output|, or to stdout if
+// |output| is null.
+static bool
+Run(CompileContext &cc, const char *path, const char *output)
 {
   Comments comments(cc);
   ParseTree *tree = nullptr;
@@ -431,9 +444,9 @@ Run(CompileContext &cc, const char *path)
       ReportingContext rc(cc, SourceLocation());
       RefPtr<SourceFile> file = cc.source().open(rc, path);
       if (!file)
-        return nullptr;
+        return false;
       if (!pp.enter(file))
-        return nullptr;
+        return false;
     }
 
     NameResolver nr(cc);
@@ -441,51 +454,127 @@ Run(CompileContext &cc, const char *path)
 
     tree = parser.parse();
     if (!tree || !cc.phasePassed())
-      return nullptr;
+      return false;
+  }
+
+  FILE *fp = output ? fopen(output, "wb") : stdout;
+  if (!fp) {
+    fprintf(stderr, "cannot open file '%s'\n", output);
+    return false;
   }
 
-  Analyzer analyzer(cc, comments);
-  return analyzer.analyze(tree);
+  bool ok;
+  {
+    JsonWriter out(fp);
+    Analyzer analyzer(cc, comments, out);
+    analyzer.write(tree);
+    ok = out.flush();
+  }
+  if (output && fclose(fp) != 0)
+    ok = false;
+  if (!ok)
+    fprintf(stderr, "could not write '%s'\n", output ? output : "<stdout>");
+  return ok;
+}
+
+// /docs, /include/clients.inc -> /docs/clients.json
+static AString
+GetOutputPath(const char *dir, const char *path)
+{
+  const char *name = path;
+  for (const char *p = path; *p; p++) {
+    if (*p == '/' || *p == '\\')
+      name = p + 1;
+  }
+  const char *ext = strrchr(name, '.');
+  size_t length = (ext && ext != name) ? ext - name : strlen(name);
+
+  AString out;
+  out.format("%s/%.*s.json", dir, int(length), name);
+  return out;
 }
 
 int main(int argc, char **argv)
 {
   args::Parser parser("Documentation generator.");
+  parser.collect_extra_args();
+  parser.set_usage_line("[options] <filename> [filename...]");
 
-  args::StringOption filename(parser,
-    "filename",
-    "SourcePawn file to scan for documentation.");
-
-  StringPool strings;
-  ReportManager reports;
-  SourceManager source(strings, reports);
+  args::StringOption output_dir(parser,
+    "o", "output-dir", Nothing(),
+    "Write each file's documentation to <name>.json in this folder.");
+  args::IntOption threads(parser,
+    "j", "threads", Some(0),
+    "Parse this many files at once (default: one per CPU).");
 
-  if (!parser.parse(argc, argv)) {
+  if (!parser.parse(argc, argv) || parser.extra_args().empty()) {
     parser.usage(stderr, argc, argv);
     return 1;
   }
 
-  PoolAllocator pool;
-  {
-    PoolScope scope(pool);
-
-    CompileContext cc(pool, strings, reports, source);
-
-    cc.SkipResolution();
+  const auto &files = parser.extra_args();
+  if (files.length() > 1 && !output_dir.hasValue()) {
+    fprintf(stderr, "--output-dir is required with more than one file\n");
+    return 1;
+  }
 
-    const char* file = filename.value().chars();
-    JsonObject *obj = Run(cc, file);
-    if (!obj) {
-      reports.PrintMessages();
-      return 1;
+  // Files share nothing, so each is parsed on whichever thread gets to it
+  // first, into its own pools.
+  struct Unit {
+    StringPool strings;
+    ReportManager reports;
+    SourceManager source;
+    bool ok;
+
+    Unit()
+     : source(strings, reports),
+       ok(false)
+    {}
+  };
+  Vector<UniquePtr<Unit>> units;
+  for (size_t i = 0; i < files.length(); i++)
+    units.append(MakeUnique<Unit>());
+
+  std::atomic<size_t> next(0);
+  auto parse = [&]() -> void {
+    for (size_t i = next++; i < units.length(); i = next++) {
+      Unit *unit = units[i].get();
+      const char *file = files[i].chars();
+
+      AString output;
+      if (output_dir.hasValue())
+        output = GetOutputPath(output_dir.value().chars(), file);
+
+      PoolAllocator pool;
+      PoolScope scope(pool);
+      CompileContext cc(pool, unit->strings, unit->reports, unit->source);
+      cc.SkipResolution();
+      unit->ok = Run(cc, file, output.length() ? output.chars() : nullptr);
     }
+  };
 
-    JsonRenderer renderer(std::cout);
-    renderer.Render(obj);
+  size_t num_threads = threads.value() > 0
+                       ? size_t(threads.value())
+                       : std::max<size_t>(std::thread::hardware_concurrency(), 1);
 
-    if (reports.HasMessages())
-      reports.PrintMessages();
+  std::vector<std::unique_ptr<ke::Thread>> workers;
+  for (size_t i = 1; i < num_threads && i < units.length(); i++) {
+    std::unique_ptr<ke::Thread> thread(new ke::Thread(parse, "SP Docparse"));
+    if (!thread->Succeeded())
+      break;
+    workers.push_back(std::move(thread));
   }
-
-  return 0;
+  parse();
+  for (const auto& thread : workers)
+    thread->Join();
+
+  int status = 0;
+  for (size_t i = 0; i < units.length(); i++) {
+    Unit *unit = units[i].get();
+    if (unit->reports.HasMessages())
+      unit->reports.PrintMessages();
+    if (!unit->ok)
+      status = 1;
+  }
+  return status;
 }
@@ -96,6 +96,62 @@ typedef struct sp_fdbg_line_s {
     uint32_t line; /**< Line number */
 } sp_fdbg_line_t;
 
+// The ".dbg.index" section, written by compilers that precompute what a
+// debugger would otherwise derive from .dbg.symbols, .dbg.lines and
+// .dbg.files. The header is followed by these tables, in order:
+//
+//   sp_fdbg_index_function_t functions[num_functions], sorted by codestart
+//   uint32_t function_buckets[num_buckets + 1]
+//   uint32_t function_chain[num_functions]
+//   sp_fdbg_index_file_t files[num_files]
+//   sp_fdbg_line_t lines[num_lines]
+//   uint32_t name_buckets[num_buckets + 1]
+//   sp_fdbg_index_name_t names[num_names]
+//   sp_fdbg_index_scope_t scopes[num_scopes]
+//
+// Names are offsets into the debug name table. Bucket tables are indexed by
+// sp_fdbg_index_hash() of a name masked by num_buckets - 1, and give the
+// range [buckets[i], buckets[i + 1]) of the chain or name table holding
+// names that hash there. Symbols are numbered in .dbg.symbols order.
+static const uint32_t SP_FDBG_INDEX_VERSION = 1;
+
+typedef struct sp_fdbg_index_s {
+    uint32_t version;       /**< SP_FDBG_INDEX_VERSION */
+    uint32_t num_functions; /**< number of function ranges */
+    uint32_t num_buckets;   /**< hash buckets, a power of two */
+    uint32_t num_files;     /**< number of distinct file names */
+    uint32_t num_lines;     /**< number of line entries over all files */
+    uint32_t num_names;     /**< number of distinct symbol names */
+    uint32_t num_scopes;    /**< number of symbols */
+} sp_fdbg_index_t;
+
+typedef struct sp_fdbg_index_function_s {
+    uint32_t codestart; /**< Start of the function in code */
+    uint32_t codeend;   /**< End of the function in code */
+    uint32_t name;      /**< Offset into debug nametable */
+} sp_fdbg_index_function_t;
+
+// The lines of a file name, sorted by line then address.
+typedef struct sp_fdbg_index_file_s {
+    uint32_t name;       /**< Offset into debug nametable */
+    uint32_t first_line; /**< Index of the first entry in lines */
+    uint32_t num_lines;  /**< Number of entries in lines */
+} sp_fdbg_index_file_t;
+
+// The symbols of a name, as scopes sorted by codestart.
+typedef struct sp_fdbg_index_name_s {
+    uint32_t name;        /**< Offset into debug nametable */
+    uint32_t global;      /**< First symbol with this name */
+    uint32_t first_scope; /**< Index of the first entry in scopes */
+    uint32_t num_scopes;  /**< Number of entries in scopes */
+} sp_fdbg_index_name_t;
+
+typedef struct sp_fdbg_index_scope_s {
+    uint32_t codestart; /**< Start scope validity in code */
+    uint32_t codeend;   /**< End scope validity in code */
+    uint32_t symbol;    /**< Symbol number */
+} sp_fdbg_index_scope_t;
+
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 // DO NOT DEFINE NEW STRUCTURES BELOW.
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
@@ -106,6 +162,18 @@ typedef struct sp_fdbg_line_s {
 #    pragma pack(pop) /* reset previous packing */
 #endif
 
+// FNV-1a hash of a name in ".dbg.index".
+static inline uint32_t
+sp_fdbg_index_hash(const char* name)
+{
+    uint32_t hash = 2166136261u;
+    for (; *name; name++) {
+        hash ^= uint8_t(*name);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
 } // namespace sp
 
 #endif //_INCLUDE_SPFILE_HEADERS_v1_H
@@ -0,0 +1,148 @@
+// vim: set ts=4 sw=4 tw=99 noet:
+// 
+// Copyright (C) 2024 AlliedModders LLC
+// 
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#ifndef _INCLUDE_SOURCEPAWN_IMAGE_HASH_H_
+#define _INCLUDE_SOURCEPAWN_IMAGE_HASH_H_
+
+/**
+ * @file sp_image_hash.h
+ * @brief The hash that names a plugin image: XXH64 with seed 0 over the
+ * bytes of the .smx file, as the VM, the debugger and its tools compute it.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace SourcePawn {
+
+// XXH64, fed in pieces of any size. Memory speed on large images, where a
+// cryptographic hash would cost more than loading them; names files and
+// caches, not anything a hostile image could exploit.
+class ImageHasher
+{
+  public:
+    ImageHasher() {
+        acc_[0] = kPrime1 + kPrime2;
+        acc_[1] = kPrime2;
+        acc_[2] = 0;
+        acc_[3] = 0 - kPrime1;
+    }
+
+    void update(const void* data, size_t length) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        total_ += length;
+
+        if (buffered_) {
+            size_t take = kStripe - buffered_;
+            if (take > length)
+                take = length;
+            memcpy(buffer_ + buffered_, p, take);
+            buffered_ += take;
+            p += take;
+            length -= take;
+            if (buffered_ < kStripe)
+                return;
+            stripe(buffer_);
+            buffered_ = 0;
+        }
+        for (; length >= kStripe; p += kStripe, length -= kStripe)
+            stripe(p);
+        memcpy(buffer_, p, length);
+        buffered_ = length;
+    }
+
+    uint64_t digest() const {
+        uint64_t h;
+        if (total_ >= kStripe) {
+            h = rotl(acc_[0], 1) + rotl(acc_[1], 7) + rotl(acc_[2], 12) + rotl(acc_[3], 18);
+            for (size_t i = 0; i < 4; i++) {
+                h ^= round(0, acc_[i]);
+                h = h * kPrime1 + kPrime4;
+            }
+        } else {
+            h = kPrime5;
+        }
+        h += total_;
+
+        const uint8_t* p = buffer_;
+        size_t left = buffered_;
+        for (; left >= 8; p += 8, left -= 8) {
+            h ^= round(0, read64(p));
+            h = rotl(h, 27) * kPrime1 + kPrime4;
+        }
+        if (left >= 4) {
+            h ^= uint64_t(read32(p)) * kPrime1;
+            h = rotl(h, 23) * kPrime2 + kPrime3;
+            p += 4;
+            left -= 4;
+        }
+        for (; left; p++, left--) {
+            h ^= *p * kPrime5;
+            h = rotl(h, 11) * kPrime1;
+        }
+
+        h ^= h >> 33;
+        h *= kPrime2;
+        h ^= h >> 29;
+        h *= kPrime3;
+        h ^= h >> 32;
+        return h;
+    }
+
+    static uint64_t hash(const void* data, size_t length) {
+        ImageHasher hasher;
+        hasher.update(data, length);
+        return hasher.digest();
+    }
+
+  private:
+    static const size_t kStripe = 32;
+    static const uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+    static const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+    static const uint64_t kPrime3 = 0x165667B19E3779F9ull;
+    static const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ull;
+    static const uint64_t kPrime5 = 0x27D4EB2F165667C5ull;
+
+    static uint64_t rotl(uint64_t x, int r) {
+        return (x << r) | (x >> (64 - r));
+    }
+    static uint64_t round(uint64_t acc, uint64_t input) {
+        acc += input * kPrime2;
+        return rotl(acc, 31) * kPrime1;
+    }
+    // Little endian, as every target the VM runs on is.
+    static uint64_t read64(const uint8_t* p) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+    static uint32_t read32(const uint8_t* p) {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    void stripe(const uint8_t* p) {
+        for (size_t i = 0; i < 4; i++)
+            acc_[i] = round(acc_[i], read64(p + i * 8));
+    }
+
+  private:
+    uint64_t acc_[4];
+    uint64_t total_ = 0;
+    uint8_t buffer_[kStripe];
+    size_t buffered_ = 0;
+};
+
+} // namespace SourcePawn
+
+#endif // _INCLUDE_SOURCEPAWN_IMAGE_HASH_H_
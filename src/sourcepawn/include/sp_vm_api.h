@@ -24,7 +24,7 @@
 
 /** SourcePawn Engine API Versions */
 #define SOURCEPAWN_ENGINE2_API_VERSION 0xC
-#define SOURCEPAWN_API_VERSION 0x020E
+#define SOURCEPAWN_API_VERSION 0x0227
 
 namespace SourceMod {
 struct IdentityToken_t;
@@ -516,6 +516,101 @@ class IPluginRuntime
      * @brief Return the file or location this plugin was loaded from.
      */
     virtual const char* GetFilename() = 0;
+
+    /**
+     * @brief Arms or disarms the debug break site at a BREAK instruction.
+     *
+     * Only meaningful when patchable debug breaks are enabled. Armed sites
+     * invoke the debug break handler; disarmed sites cost a single nop.
+     * Must be called on the thread executing plugin code.
+     *
+     * @param cip       Code address of the BREAK instruction.
+     * @param armed     True to arm the site, false to disarm it.
+     * @return          Error code, if any.
+     */
+    virtual int SetDebugBreakSite(ucell_t cip, bool armed) = 0;
+
+    /**
+     * @brief Arms or disarms every debug break site in this plugin, for
+     * example while single-stepping. Individually armed sites keep their
+     * state when this is turned back off.
+     *
+     * @param armed     True to arm all sites, false to restore them.
+     * @return          Error code, if any.
+     */
+    virtual int SetAllDebugBreakSites(bool armed) = 0;
+
+    /**
+     * @brief Returns the plugin's file image as loaded by the VM, with any
+     * compressed region already decompressed. The buffer is read-only and
+     * lives as long as the runtime.
+     *
+     * @param bytes     Set to the start of the image.
+     * @param length    Set to the image length, in bytes.
+     * @return          True on success, false if the image is not available.
+     */
+    virtual bool GetImageBuffer(const uint8_t** bytes, size_t* length) = 0;
+
+    /**
+     * @brief Adds or removes a data watchpoint on a range of plugin memory.
+     *
+     * Only meaningful when data watchpoints are enabled. Every store that
+     * overlaps a watched range invokes the debug break handler with
+     * SP_DEBUG_BREAK_DATAWATCH, at the cip of the storing instruction. A
+     * plugin holds at most SP_MAX_DATA_WATCHES ranges. Must be called on
+     * the thread executing plugin code.
+     *
+     * @param addr      Plugin address of the first watched byte.
+     * @param size      Number of watched bytes.
+     * @param watched   True to add the range, false to remove it.
+     * @return          Error code, if any.
+     */
+    virtual int SetDataWatch(ucell_t addr, ucell_t size, bool watched) = 0;
+
+    /**
+     * @brief Removes every data watchpoint of this plugin.
+     */
+    virtual void ClearDataWatches() = 0;
+
+    /**
+     * @brief Returns the current binding of a native.
+     *
+     * @param index     Native index.
+     * @param pfn       Set to the native function, or null if unbound.
+     * @param flags     Set to the native flags.
+     * @param data      Set to the user data pointer.
+     * @return          Error code, if any.
+     */
+    virtual int GetNativeBinding(uint32_t index, SPVM_NATIVE_FUNC* pfn, uint32_t* flags,
+                                 void** data) = 0;
+
+    /**
+     * @brief Returns the opcodes the interpreter executed for this plugin.
+     * Only VMs built with SP_OPCODE_STATS count them, and JIT-compiled code
+     * is never counted.
+     *
+     * @param counts    Set to the execution count of each opcode, or null.
+     * @param pairs     Set to the count of each opcode pair, indexed by
+     *                  previous * opcodes + next, or null unless pair
+     *                  counting is enabled.
+     * @return          Number of opcodes, or 0 if opcodes aren't counted.
+     */
+    virtual uint32_t GetOpcodeStats(const uint64_t** counts, const uint64_t** pairs) = 0;
+
+    /**
+     * @brief Sets every opcode and opcode pair count back to zero.
+     */
+    virtual void ResetOpcodeStats() = 0;
+
+    /**
+     * @brief Queues every function of this plugin for compilation on the
+     * background compiler thread, public functions first. Functions called
+     * before their turn are compiled on the spot as usual. Best called once
+     * the plugin's natives are bound.
+     *
+     * @return          False if background compilation is not enabled.
+     */
+    virtual bool CompileInBackground() = 0;
 };
 
 /**
@@ -1166,6 +1261,80 @@ class IDebugListener
     virtual void ReportError(const IErrorReport& report, IFrameIterator& iter) = 0;
 };
 
+/**
+ * @brief Decides which plugins are compiled with debug break instrumentation.
+ */
+class IDebugBreakFilter
+{
+  public:
+    /**
+     * @brief Called once per plugin, before its first function is compiled.
+     *
+     * @param runtime   Plugin runtime.
+     * @return          True to instrument BREAK instructions, false to
+     *                  ignore them like a non-debugging environment.
+     */
+    virtual bool ShouldDebugBreak(IPluginRuntime* runtime) = 0;
+};
+
+/**
+ * @brief Receives the duration of public function calls.
+ */
+class IInvokeListener
+{
+  public:
+    /**
+     * @brief Called after a call through IPluginFunction returns, on the
+     * thread that made it.
+     *
+     * @param fn            Function that was called.
+     * @param nanoseconds   Time spent in the call, nested calls included.
+     */
+    virtual void OnInvoked(IPluginFunction* fn, uint64_t nanoseconds) = 0;
+};
+
+/**
+ * @brief Receives calls to the public functions armed with
+ * ISourcePawnEnvironment::SetPublicEntryHook.
+ */
+class IPublicEntryListener
+{
+  public:
+    /**
+     * @brief Called before an armed public function runs, on the thread
+     * calling it. The function's own frame doesn't exist yet; the frames
+     * on the stack, if any, are those of the plugin calling it.
+     *
+     * @param fn            Function about to be called.
+     * @param params        Its arguments, arrays and strings as local
+     *                      addresses in its plugin.
+     * @param num_params    Number of arguments.
+     */
+    virtual void OnPublicEntry(IPluginFunction* fn, const cell_t* params,
+                               unsigned int num_params) = 0;
+};
+
+/**
+ * @brief Receives the plugin heap allocations the VM samples.
+ */
+class IHeapAllocListener
+{
+  public:
+    /**
+     * @brief Called after a sampled HEAP or GENARRAY instruction grew the
+     * heap, on the thread running the plugin. Must not call into plugins.
+     *
+     * @param ctx           Plugin that allocated.
+     * @param cip           Code address of the instruction.
+     * @param size          Bytes the instruction allocated.
+     * @param weight        Bytes allocated since the last sample, this
+     *                      allocation included, rounded to the sampling
+     *                      interval. Summed, an estimate of all bytes
+     *                      allocated; with an interval of 1 it is |size|.
+     */
+    virtual void OnHeapAlloc(IPluginContext* ctx, cell_t cip, uint32_t size, uint64_t weight) = 0;
+};
+
 /**
    * @brief Removed.
    */
@@ -1545,6 +1714,67 @@ class ISourcePawnEngine2
     virtual ISourcePawnEnvironment* Environment() = 0;
 };
 
+/**
+ * @brief A function entry or exit recorded while function tracing is on.
+ */
+struct sp_trace_record_t {
+    uint64_t timestamp;      /**< Nanoseconds on a monotonic clock */
+    IPluginContext* context; /**< Context the function runs in */
+    uint32_t function;       /**< Code offset of the function */
+    uint32_t event;          /**< SP_TRACE_ENTER, SP_TRACE_EXIT or SP_TRACE_BREAK */
+};
+
+#define SP_TRACE_ENTER 0 /**< The function was entered. */
+#define SP_TRACE_EXIT 1  /**< The function returned; not recorded on errors. */
+#define SP_TRACE_BREAK 2 /**< A debug break; |function| is the cip. */
+
+/**
+ * @brief Ring of trace records. The VM fills records[head & mask] and then
+ * bumps head, so a reader on another thread copies from its own position up
+ * to head and drops whatever head has lapped.
+ */
+struct sp_trace_ring_t {
+    volatile uint32_t head;
+    uint32_t mask;
+    const sp_trace_record_t* records;
+};
+
+/**
+ * @brief How a plugin's memory is used, in bytes.
+ */
+struct sp_memory_usage_t {
+    uint32_t data;       /**< Global variables */
+    uint32_t heap_stack; /**< Heap and stack, which grow toward each other */
+    uint32_t heap;       /**< Heap in use */
+    uint32_t stack;      /**< Stack in use */
+};
+
+/**
+ * @brief Where a scripted frame is, as offsets into the plugin's code and
+ * memory.
+ */
+struct sp_script_frame_t {
+    cell_t cip;          /**< Code address, 0 if unknown */
+    cell_t frm;          /**< Frame base, 0 if unknown */
+};
+
+/**
+ * @brief How much time a plugin's code ran, since CPU accounting was enabled.
+ */
+struct sp_cpu_usage_t {
+    uint64_t nanoseconds; /**< Time in the plugin's code and its natives */
+    uint64_t invocations; /**< Calls into the plugin from outside of it */
+};
+
+/**
+ * @brief A frame of the current stack, without names resolved.
+ */
+struct sp_stack_frame_t {
+    IPluginContext* context; /**< Plugin the frame is in */
+    cell_t function;         /**< Entry address of the scripted function, -1 for natives */
+    int32_t native;          /**< Index of the native, -1 for scripted frames */
+};
+
 // @brief This class is the v3 API for SourcePawn. It provides access to
 // the original v1 and v2 APIs as well.
 class ISourcePawnEnvironment
@@ -1588,6 +1818,190 @@ class ISourcePawnEnvironment
     // @brief Enables the line debugger callbacks. This must be called
     // before any plugins are loaded.
     virtual bool EnableDebugBreak() = 0;
+
+    // @brief Enables the line debugger callbacks, but compiles each BREAK
+    // instruction to a patchable nop. Sites only call the debug break
+    // handler once armed through IPluginRuntime::SetDebugBreakSite. This
+    // must be called before any plugins are loaded.
+    virtual bool EnablePatchableDebugBreak() = 0;
+
+    // @brief Sets the filter choosing which plugins get debug breaks, once
+    // debug breaks are enabled. Without a filter, every plugin does.
+    virtual void SetDebugBreakFilter(IDebugBreakFilter* filter) = 0;
+
+    // @brief Enables data watchpoints. Stores into plugin memory check the
+    // ranges set through IPluginRuntime::SetDataWatch, which costs a compare
+    // per store while no range is set. Requires debug breaks, and must be
+    // called before any plugins are loaded.
+    virtual bool EnableDataWatchpoints() = 0;
+
+    // @brief Compiles an entry and exit hook into every function, recording
+    // into a ring of at least |capacity| records. While tracing is off the
+    // hooks cost a compare each. Must be called before any plugins are
+    // loaded.
+    virtual bool EnableFunctionTracing(uint32_t capacity) = 0;
+
+    // @brief As EnableFunctionTracing, recording into |capacity| records
+    // the host owns, e.g. a mapped file that outlives a crash. |capacity|
+    // must be a power of two and the records must stay valid for the life
+    // of the environment. Debug breaks are recorded too.
+    virtual bool EnableFunctionTracingInto(sp_trace_record_t* records, uint32_t capacity) = 0;
+
+    // @brief Starts or stops recording, once function tracing is enabled.
+    // Safe to call from any thread.
+    virtual void SetFunctionTracing(bool active) = 0;
+
+    // @brief Returns the trace ring, or null if function tracing isn't
+    // enabled.
+    virtual const sp_trace_ring_t* GetTraceRing() = 0;
+
+    // @brief Lets UpdateNativeBinding replace natives that are already
+    // bound, so a host can wrap them. Native calls then always load the
+    // function from the binding instead of calling it directly. Must be
+    // called before any plugins are loaded.
+    virtual bool EnableNativeRebinding() = 0;
+
+    // @brief Sets the listener timing every public function call, or null
+    // for none. Must be called before any plugins are loaded.
+    virtual void SetInvokeListener(IInvokeListener* listener) = 0;
+
+    // @brief Counts opcode pairs as well as opcodes, in VMs built with
+    // SP_OPCODE_STATS. Must be called before any plugins are loaded.
+    virtual bool EnableOpcodePairStats() = 0;
+
+    // @brief Starts a thread that compiles the functions of plugins handed to
+    // IPluginRuntime::CompileInBackground. Only available when the JIT is.
+    // Must be called before any plugins are loaded.
+    virtual bool EnableBackgroundCompilation() = 0;
+
+    // @brief Keeps compiled functions in files under the given directory,
+    // which must exist, and reuses them for unchanged plugins after a
+    // restart. Only available when the JIT is. Must be called before any
+    // plugins are loaded.
+    virtual bool EnableCodeCache(const char* directory) = 0;
+
+    // @brief Reserves one contiguous region of executable memory, backed by
+    // huge pages where the OS allows, that compiled code is placed in until
+    // it is full. Must be called before any plugins are loaded.
+    virtual bool ReserveCodeRegion(size_t bytes) = 0;
+
+    // @brief Compiles the given public functions again into one adjacent
+    // block of code, in the order given, so the hottest ones share cache
+    // lines and pages. Functions already relocated are left alone. Only
+    // while no plugin code is running.
+    //
+    // @return          Number of functions relocated.
+    virtual size_t RelocateHotCode(IPluginFunction** functions, size_t count) = 0;
+
+    // @brief With debug breaks enabled, whether plugins are compiled with
+    // them. Functions compiled the other way are compiled again the next
+    // time they are entered, so a server stops paying for debug breaks once
+    // nothing uses them. Active by default.
+    virtual void SetDebugBreaksActive(bool active) = 0;
+
+    // @brief Verifies every method of a large plugin while it loads, on the
+    // loading thread and |threads| more, instead of each one when it is
+    // first called. At most 16; 0 turns it off. Must be called before any
+    // plugins are loaded.
+    virtual bool EnableParallelVerification(size_t threads) = 0;
+
+    // @brief Fills |usage| for the plugin owning |ctx|. The heap and stack
+    // in use are only telling while the plugin runs, e.g. from a debug
+    // break or a native; between calls into the plugin both are empty.
+    //
+    // @return          False if |ctx| has no plugin memory.
+    virtual bool GetMemoryUsage(IPluginContext* ctx, sp_memory_usage_t* usage) = 0;
+
+    // @brief Fills |frames| with up to |max| scripted frames of |ctx| on the
+    // current stack, innermost first, and |*sp| and |*stp| with the bounds
+    // of its stack in use. Only telling while the plugin runs, e.g. from an
+    // error report.
+    //
+    // @return          Number of frames filled.
+    virtual size_t GetScriptFrames(IPluginContext* ctx, sp_script_frame_t* frames, size_t max,
+                                   cell_t* sp, cell_t* stp) = 0;
+
+    // @brief Starts charging each plugin for the time its code runs, as
+    // entries into the VM switch from one plugin to another. A plugin that
+    // calls into another is not charged for the time spent there. Costs two
+    // clock reads per call into a plugin. Only while no plugin code is
+    // running.
+    virtual bool EnableCpuAccounting() = 0;
+
+    // @brief Fills |usage| for the plugin owning |ctx|. Safe to call from
+    // any thread.
+    //
+    // @return          False if CPU accounting is not enabled.
+    virtual bool GetCpuUsage(IPluginContext* ctx, sp_cpu_usage_t* usage) = 0;
+
+    // @brief Fills |frames| with up to |max| scripted and native frames of
+    // the current stack, innermost first, across plugins. Resolves no
+    // names, so it is much cheaper than walking an IFrameIterator; names
+    // come from IPluginDebugInfo::LookupFunction and GetNativeByIndex, on
+    // any thread while the plugin is loaded. Main thread only.
+    //
+    // @return          Number of frames filled.
+    virtual size_t CaptureStack(sp_stack_frame_t* frames, size_t max) = 0;
+
+    // @brief Sets |*hash| to the image hash (sp_image_hash.h) of the .smx
+    // file |ctx| was loaded from, computed once at load. It changes exactly
+    // when the file does, so it keys anything derived from the image.
+    //
+    // @return          False if the plugin was not loaded from a file.
+    virtual bool GetImageHash(IPluginContext* ctx, uint64_t* hash) = 0;
+
+    // @brief Compiles a hook after every HEAP and GENARRAY instruction that
+    // grows the heap, reporting sampled allocations to |listener| once
+    // SetHeapSampling turns it on. While sampling is off the hooks cost a
+    // compare each. Must be called before any plugins are loaded. Passing
+    // nullptr later stops sampling and drops the listener, as before it is
+    // unloaded; the hooks stay compiled in.
+    virtual bool EnableHeapProfiling(IHeapAllocListener* listener) = 0;
+
+    // @brief Reports one allocation per |interval| bytes allocated, or
+    // every allocation for 1; 0 stops. Safe to call from any thread.
+    virtual void SetHeapSampling(uint32_t interval) = 0;
+
+    // @brief With patchable debug breaks, compiles a method with its debug
+    // breaks and data watch checks only while it has an armed break site,
+    // every site is armed, or its plugin watches data; other methods are
+    // compiled as if debug breaks were off. Arming a site in a method
+    // compiled without them compiles it again right away, and calls into it
+    // go to the new code. A frame already running the old code only breaks
+    // once the method is entered again. A method that lost its last armed
+    // site is compiled again the next time it is entered. Must be called
+    // after EnablePatchableDebugBreak and before any plugins are loaded.
+    virtual bool EnableMethodDebugBreaks() = 0;
+
+    // @brief Sets the listener told about calls to armed public functions,
+    // or null for none.
+    virtual void SetPublicEntryListener(IPublicEntryListener* listener) = 0;
+
+    // @brief Arms or disarms the entry hook of |fn|, a function of a
+    // plugin runtime. Calls through an armed function are reported to the
+    // public entry listener before it runs; any other costs one load per
+    // call. Main thread only.
+    virtual bool SetPublicEntryHook(IPluginFunction* fn, bool armed) = 0;
+
+    // @brief Starts loading |count| plugin files on |threads| worker
+    // threads, at most 16, taking them in the order given. Each is read,
+    // decompressed and validated, and its methods verified if parallel
+    // verification is on. A later LoadBinaryFromFile() of the same path,
+    // spelled the same way, waits for that file and returns what loading it
+    // gave. Files never asked for are freed by the next call or at shutdown.
+    // Main thread only, after the environment is configured.
+    virtual bool PreloadBinaries(const char* const* files, size_t count, size_t threads) = 0;
+
+    // @brief Fills |peaks| with the most heap and stack the plugin owning
+    // |ctx| has used since it loaded or since the last reset, read off what
+    // its code left in memory: heap and stack start out zeroed, and the
+    // extent of what is no longer zero is the high-water mark. Cells only
+    // ever written with zeros aren't seen, so the peaks are lower bounds.
+    // With |reset|, what was used is zeroed again. Main thread only, and
+    // only between calls into the plugin.
+    //
+    // @return          False if |ctx| has no plugin memory or is running.
+    virtual bool GetMemoryPeaks(IPluginContext* ctx, sp_memory_usage_t* peaks, bool reset) = 0;
 };
 
 // @brief This class is the entry-point to using SourcePawn from a DLL.
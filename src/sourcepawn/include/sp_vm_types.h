@@ -56,7 +56,8 @@ typedef uint32_t funcid_t; /**< Function index code */
 #define SP_PROF_CALLBACKS (1 << 1) /**< Profile callbacks. */
 #define SP_PROF_FUNCTIONS (1 << 2) /**< Profile functions. */
 
-#define DEBUG_BREAK_INFO_VERSION 0x0001 /**< Version of the sp_debug_break_info_t struct. */
+#define DEBUG_BREAK_INFO_VERSION 0x0002 /**< Version of the sp_debug_break_info_t struct. */
+#define SP_MAX_DATA_WATCHES 8          /**< Data watchpoint ranges per plugin. */
 
 /**
  * @brief Error codes for SourcePawn routines.
@@ -248,8 +249,17 @@ typedef struct sp_debug_break_info_s {
     uint16_t version; /**< Version of this struct */
     cell_t cip;       /**< Current virtual instruction pointer */
     cell_t frm;       /**< Current virtual frame pointer */
+    uint32_t flags;   /**< SP_DEBUG_BREAK_* flags (version 2) */
+    ucell_t addr;     /**< Address written, with SP_DEBUG_BREAK_DATAWATCH (version 2) */
+    ucell_t size;     /**< Bytes written, with SP_DEBUG_BREAK_DATAWATCH (version 2) */
 } sp_debug_break_info_t;
 
+/**
+ * @brief The break was caused by a store into a watched data range; cip is
+ * the storing instruction and the new value is already in memory.
+ */
+#define SP_DEBUG_BREAK_DATAWATCH (1<<0)
+
 /**
  * Breaks into a debugger.
  * If the exception parameter is not null, 
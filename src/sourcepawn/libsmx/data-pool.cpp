@@ -21,6 +21,7 @@
 namespace sp { 
 
 DataPool::DataPool()
+ : bytes_saved_(0)
 {
   pool_map_.init(64);
   buffer_.write<uint8_t>(0);
@@ -29,24 +30,52 @@ DataPool::DataPool()
 uint32_t
 DataPool::add(const Vector<uint8_t>& run)
 {
+  // Runs are keyed by where they are in the buffer, so nothing is copied.
   BytesAndLength tmp_key;
   tmp_key.bytes = run.buffer();
   tmp_key.length = run.length();
+  tmp_key.pool = buffer_.bytes();
 
   DataPoolMap::Insert p = pool_map_.findForAdd(tmp_key);
-  if (p.found())
-    return p->value;
+  if (p.found()) {
+    bytes_saved_ += run.length();
+    return p->offset;
+  }
 
   uint32_t index = buffer_.position();
   if (!buffer_.writeBytes(run.buffer(), run.length()))
     return 0;
 
   ByteRun key;
-  key.bytes = ke::MakeUnique<uint8_t[]>(run.length());
-  key.length = run.length();
-  memcpy(key.bytes.get(), run.buffer(), key.length);
-  pool_map_.add(p, Move(key), index);
+  key.offset = index;
+  key.length = uint32_t(run.length());
+  pool_map_.add(p, key);
+
+  addTails(index, run.buffer(), run.length());
   return index;
 }
 
+// Readers decode a run from its own bytes, wherever it starts, so a run that
+// is the tail of one already in the pool can point into it. Runs are short
+// type encodings, so every tail is kept.
+void
+DataPool::addTails(uint32_t offset, const uint8_t* bytes, size_t length)
+{
+  for (size_t i = 1; i < length; i++) {
+    BytesAndLength tmp_key;
+    tmp_key.bytes = bytes + i;
+    tmp_key.length = length - i;
+    tmp_key.pool = buffer_.bytes();
+
+    DataPoolMap::Insert p = pool_map_.findForAdd(tmp_key);
+    if (p.found())
+      continue;
+
+    ByteRun key;
+    key.offset = offset + uint32_t(i);
+    key.length = uint32_t(length - i);
+    pool_map_.add(p, key);
+  }
+}
+
 } // namespace sp
@@ -19,8 +19,7 @@
 #ifndef _include_sourcepawn_metadata_datapool_h
 #define _include_sourcepawn_metadata_datapool_h
 
-#include <amtl/am-hashmap.h>
-#include <amtl/am-uniqueptr.h>
+#include <amtl/am-hashtable.h>
 #include <amtl/am-vector.h>
 #include <stdint.h>
 #include <string.h>
@@ -41,23 +40,30 @@ class DataPool
     return buffer_;
   }
 
+  // Bytes that add() did not write, because the run, or a run it was the
+  // tail of, was already in the pool.
+  size_t bytes_saved() const {
+    return bytes_saved_;
+  }
+
+ private:
+  void addTails(uint32_t offset, const uint8_t* bytes, size_t length);
+
  private:
+  // A run of bytes in |buffer_|.
   struct ByteRun {
-    ByteRun()
-    {}
-    ByteRun(ByteRun&& other)
-     : bytes(Move(other.bytes)),
-       length(other.length)
-    {}
-    UniquePtr<uint8_t[]> bytes;
-    size_t length;
+    uint32_t offset;
+    uint32_t length;
   };
   struct BytesAndLength {
     const uint8_t* bytes;
     size_t length;
+    const uint8_t* pool;
   };
 
   struct ByteRunPolicy {
+    typedef ByteRun Payload;
+
     static uint32_t hash(const BytesAndLength& key) {
       return HashCharSequence(reinterpret_cast<const char*>(key.bytes), key.length);
     }
@@ -65,13 +71,14 @@ class DataPool
     static bool matches(const BytesAndLength& key, const ByteRun& payload) {
       if (key.length != payload.length)
         return false;
-      return memcmp(key.bytes, payload.bytes.get(), key.length) == 0;
+      return memcmp(key.bytes, key.pool + payload.offset, key.length) == 0;
     }
   };
 
   ByteBuffer buffer_;
+  size_t bytes_saved_;
 
-  typedef HashMap<ByteRun, uint32_t, ByteRunPolicy> DataPoolMap;
+  typedef HashTable<ByteRunPolicy> DataPoolMap;
   DataPoolMap pool_map_;
 };
 
@@ -26,6 +26,15 @@ SmxBuilder::SmxBuilder()
 {
 }
 
+size_t
+SmxBuilder::length() const
+{
+  size_t length = sizeof(sp_file_hdr_t) + sizeof(sp_file_section_t) * sections_.length();
+  for (size_t i = 0; i < sections_.length(); i++)
+    length += sections_[i]->name().length() + 1 + sections_[i]->length();
+  return length;
+}
+
 bool
 SmxBuilder::write(ISmxBuffer* buf)
 {
@@ -96,6 +105,7 @@ SmxBuilder::write(ISmxBuffer* buf)
 
   assert(buf->pos() == current_offset);
   assert(current_offset == header.disksize);
+  assert(current_offset == length());
 
   return true;
 }
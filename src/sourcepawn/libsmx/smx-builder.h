@@ -248,6 +248,9 @@ class SmxBuilder
 
   bool write(ISmxBuffer* buf);
 
+  // The size of the file write() produces.
+  size_t length() const;
+
   void add(const ke::RefPtr<SmxSection>& section) {
     sections_.append(section);
   }
@@ -65,6 +65,19 @@ class ByteBuffer
     return true;
   }
 
+  // Makes room for |bytes| more without writing them, so that a writer that
+  // knows its size up front grows the buffer once.
+  bool reserve(size_t bytes) {
+    if (size_t(buffer_end_ - buffer_pos_) >= bytes)
+      return true;
+    size_t used = size_t(buffer_pos_ - buffer_.get());
+    if (!ke::IsUintPtrAddSafe(used, bytes) || !tryRealloc(used + bytes)) {
+      oom_ = true;
+      return false;
+    }
+    return true;
+  }
+
   template <typename T>
   T* ptr(uint32_t pos) {
     assert(pos < size_t(buffer_pos_ - buffer_.get()));
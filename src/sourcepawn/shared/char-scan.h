@@ -0,0 +1,125 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2018 AlliedModders LLC
+//
+// This file is part of SourcePawn.
+//
+// SourcePawn is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// SourcePawn is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+#ifndef _include_sp_shared_char_scan_h_
+#define _include_sp_shared_char_scan_h_
+
+#include <stdint.h>
+#include <amtl/am-bits.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define SP_CHAR_SCAN_SSE2
+# include <emmintrin.h>
+#endif
+
+namespace sp {
+
+// Scanners for the runs of characters a lexer otherwise walks one at a time:
+// identifier characters, blanks, and the insides of comments, strings and
+// lines. Each returns the first position in [p, end) whose character ends
+// the run, or |end|. With SSE2 they test sixteen characters at once, and
+// never read at or past |end|; the tail is scanned a character at a time.
+class CharScan
+{
+ public:
+  // [A-Za-z0-9_]
+  static const char* SkipIdentChars(const char* p, const char* end) {
+#if defined(SP_CHAR_SCAN_SSE2)
+    const __m128i lower_a = _mm_set1_epi8('a' - 1);
+    const __m128i lower_z = _mm_set1_epi8('z' + 1);
+    const __m128i digit_0 = _mm_set1_epi8('0' - 1);
+    const __m128i digit_9 = _mm_set1_epi8('9' + 1);
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    const __m128i underscore = _mm_set1_epi8('_');
+    for (; end - p >= 16; p += 16) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      // Bytes past 0x7f compare as negative, so they fall outside every range.
+      __m128i folded = _mm_or_si128(v, case_bit);
+      __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(folded, lower_a),
+                                    _mm_cmpgt_epi8(lower_z, folded));
+      __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, digit_0),
+                                    _mm_cmpgt_epi8(digit_9, v));
+      __m128i ident = _mm_or_si128(_mm_or_si128(alpha, digit),
+                                   _mm_cmpeq_epi8(v, underscore));
+      uint32_t stops = ~uint32_t(_mm_movemask_epi8(ident)) & 0xffff;
+      if (stops)
+        return p + ke::FindRightmostBit(stops);
+    }
+#endif
+    while (p < end && IsIdentChar(*p))
+      p++;
+    return p;
+  }
+
+  // Spaces, tabs and form feeds.
+  static const char* SkipBlanks(const char* p, const char* end) {
+#if defined(SP_CHAR_SCAN_SSE2)
+    for (; end - p >= 16; p += 16) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      __m128i blank = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                                _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                                   _mm_cmpeq_epi8(v, _mm_set1_epi8('\f')));
+      uint32_t stops = ~uint32_t(_mm_movemask_epi8(blank)) & 0xffff;
+      if (stops)
+        return p + ke::FindRightmostBit(stops);
+    }
+#endif
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\f'))
+      p++;
+    return p;
+  }
+
+  // The first of |a|, |b|, |c|, |d| or '\0'. Pass '\0' for the unused ones.
+  static const char* FindAny(const char* p, const char* end, char a, char b, char c, char d) {
+#if defined(SP_CHAR_SCAN_SSE2)
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    const __m128i vc = _mm_set1_epi8(c);
+    const __m128i vd = _mm_set1_epi8(d);
+    const __m128i vnul = _mm_setzero_si128();
+    for (; end - p >= 16; p += 16) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(v, vc), _mm_cmpeq_epi8(v, vd)));
+      hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, vnul));
+      uint32_t stops = uint32_t(_mm_movemask_epi8(hit));
+      if (stops)
+        return p + ke::FindRightmostBit(stops);
+    }
+#endif
+    while (p < end && *p != a && *p != b && *p != c && *p != d && *p != '\0')
+      p++;
+    return p;
+  }
+
+  // A line terminator: '\n', '\r' or '\0'.
+  static const char* FindLineEnd(const char* p, const char* end) {
+    return FindAny(p, end, '\n', '\r', '\0', '\0');
+  }
+
+ private:
+  static bool IsIdentChar(char c) {
+    return (c >= 'a' && c <= 'z') ||
+           (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') ||
+           c == '_';
+  }
+};
+
+} // namespace sp
+
+#endif // _include_sp_shared_char_scan_h_
@@ -0,0 +1,119 @@
+// vim: set ts=2 sw=2 tw=99 et:
+//
+// Copyright (C) 2012-2014 AlliedModders LLC, David Anderson
+//
+// This file is part of SourcePawn.
+//
+// SourcePawn is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// SourcePawn is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+#ifndef _include_sp_shared_concurrent_string_pool_h_
+#define _include_sp_shared_concurrent_string_pool_h_
+
+#include <amtl/am-thread-utils.h>
+#include <stdint.h>
+#include <string.h>
+#include "string-pool.h"
+
+namespace sp {
+
+// Interning for several threads at once, in front of a StringPool that none
+// of them adds to directly while they run. Strings the base pool already has
+// are found there without locking, since nothing changes it. New strings go
+// into one of several shards, picked by hash, each with its own lock, so
+// threads adding different strings rarely wait on each other. Atoms never
+// move, so a string has the same atom for every thread, whichever found it
+// first; once the threads are done, flush() hands the new atoms to the base
+// pool and everyone can use it directly again.
+//
+// Each thread also keeps a small cache of the atoms it has looked up, since
+// the same identifiers come up over and over in a function body.
+class ConcurrentStringPool
+{
+ public:
+  static const size_t kShards = 16;
+
+  class Cache
+  {
+    friend class ConcurrentStringPool;
+
+   public:
+    static const size_t kEntries = 256;
+
+    Cache() {
+      memset(entries_, 0, sizeof(entries_));
+    }
+
+   private:
+    struct Entry {
+      uint32_t hash;
+      Atom* atom;
+    };
+    Entry entries_[kEntries];
+  };
+
+  explicit ConcurrentStringPool(StringPool& base)
+   : base_(base)
+  {
+  }
+
+  // Safe to call from any thread between flushes, with a cache only that
+  // thread uses, or none.
+  Atom* add(Cache* cache, const char* str, size_t length) {
+    uint32_t hash = HashCharSequence(str, length);
+    Cache::Entry* entry = nullptr;
+    if (cache) {
+      entry = &cache->entries_[hash & (Cache::kEntries - 1)];
+      if (entry->atom && entry->hash == hash && matches(entry->atom, str, length))
+        return entry->atom;
+    }
+
+    Atom* atom = base_.find(str, length);
+    if (!atom) {
+      Shard& shard = shards_[(hash >> 24) % kShards];
+      ke::AutoLock lock(&shard.lock);
+      atom = shard.pool.add(str, length);
+    }
+    if (entry && atom) {
+      entry->hash = hash;
+      entry->atom = atom;
+    }
+    return atom;
+  }
+
+  Atom* add(Cache* cache, const char* str) {
+    return add(cache, str, strlen(str));
+  }
+
+  // Moves the atoms added since the last flush into the base pool. Only once
+  // no other thread can be adding. Caches stay valid.
+  void flush() {
+    for (size_t i = 0; i < kShards; i++)
+      shards_[i].pool.moveTo(base_);
+  }
+
+ private:
+  static bool matches(Atom* atom, const char* str, size_t length) {
+    return atom->length() == length && memcmp(atom->chars(), str, length) == 0;
+  }
+
+  struct Shard {
+    ke::Mutex lock;
+    StringPool pool;
+  };
+
+  StringPool& base_;
+  Shard shards_[kShards];
+};
+
+} // namespace sp
+
+#endif // _include_sp_shared_concurrent_string_pool_h_
@@ -0,0 +1,122 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2018 AlliedModders LLC
+//
+// This file is part of SourcePawn.
+//
+// SourcePawn is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// SourcePawn is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+#ifndef _include_sp_shared_keyword_hash_h_
+#define _include_sp_shared_keyword_hash_h_
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace sp {
+
+// A perfect hash over a fixed list of keywords, for the lexers. Every name
+// the lexer scans is looked up, and most are not keywords, so a lookup first
+// checks whether any keyword starts with the same character and has the same
+// length; only then does it hash the name, and one slot decides it.
+//
+// The seed of the hash is searched for when the table is built, until no two
+// keywords share a slot. With a table of 1024 slots and fewer than 128
+// keywords that takes a few hundred tries at most.
+class KeywordHash
+{
+ public:
+  static const size_t kMaxKeywords = 255;
+  static const size_t kMaxLength = 31;
+
+  KeywordHash()
+   : names_(nullptr),
+     count_(0),
+     seed_(0)
+  {
+    memset(lengths_, 0, sizeof(lengths_));
+    memset(slots_, 0, sizeof(slots_));
+  }
+
+  // Builds the table over |count| names; find() returns indexes into them.
+  // The names must outlive the table.
+  void init(const char* const* names, size_t count) {
+    assert(count <= kMaxKeywords);
+    names_ = names;
+    count_ = count;
+
+    memset(lengths_, 0, sizeof(lengths_));
+    for (size_t i = 0; i < count; i++) {
+      size_t length = strlen(names[i]);
+      assert(length > 0 && length <= kMaxLength);
+      lengths_[(unsigned char)names[i][0]] |= uint32_t(1) << length;
+    }
+
+    for (seed_ = 1;; seed_++) {
+      if (place())
+        return;
+    }
+  }
+
+  // Returns the index of the keyword, or -1 if |str| is not one.
+  int find(const char* str, size_t length) const {
+    if (length == 0 || length > kMaxLength)
+      return -1;
+    if (!(lengths_[(unsigned char)str[0]] & (uint32_t(1) << length)))
+      return -1;
+
+    uint8_t entry = slots_[hash(seed_, str, length)];
+    if (!entry)
+      return -1;
+    const char* name = names_[entry - 1];
+    if (memcmp(name, str, length) != 0 || name[length] != '\0')
+      return -1;
+    return entry - 1;
+  }
+
+ private:
+  static const size_t kSlots = 1024;
+
+  static uint32_t hash(uint32_t seed, const char* str, size_t length) {
+    uint32_t h = seed * 2166136261u;
+    for (size_t i = 0; i < length; i++)
+      h = (h ^ (unsigned char)str[i]) * 16777619u;
+    return (h ^ (h >> 15)) & (kSlots - 1);
+  }
+
+  bool place() {
+    memset(slots_, 0, sizeof(slots_));
+    for (size_t i = 0; i < count_; i++) {
+      uint8_t* slot = &slots_[hash(seed_, names_[i], strlen(names_[i]))];
+      if (*slot)
+        return false;
+      *slot = uint8_t(i + 1);
+    }
+    return true;
+  }
+
+ private:
+  const char* const* names_;
+  size_t count_;
+  uint32_t seed_;
+
+  // For each first character, a bit for each length some keyword has.
+  uint32_t lengths_[256];
+
+  // Index of the keyword in each slot, plus one; zero if empty.
+  uint8_t slots_[kSlots];
+};
+
+} // namespace sp
+
+#endif // _include_sp_shared_keyword_hash_h_
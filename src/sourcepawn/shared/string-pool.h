@@ -22,6 +22,7 @@
 #include <amtl/am-hashset.h>
 #include <amtl/am-hashmap.h>
 #include <amtl/am-string.h>
+#include <assert.h>
 #include <string.h>
 #include "string-atom.h"
 
@@ -85,6 +86,26 @@ class StringPool
     return add(str, strlen(str));
   }
 
+  // The atom of a string that was added before, or null; nothing is added.
+  Atom* find(const char* str, size_t length) {
+    CharsAndLength chars(str, length);
+    Table::Result r = table_.find(chars);
+    return r.found() ? *r : nullptr;
+  }
+
+  // Hands every atom to |other|, which must not have any of the same strings,
+  // keeping their addresses. This pool is left empty.
+  void moveTo(StringPool& other) {
+    for (Table::iterator i(&table_); !i.empty(); i.next()) {
+      Atom* atom = *i;
+      CharsAndLength chars(atom->chars(), atom->length());
+      Table::Insert p = other.table_.findForAdd(chars);
+      assert(!p.found());
+      other.table_.add(p, atom);
+    }
+    table_.clear();
+  }
+
  private:
   struct Policy {
     typedef Atom* Payload;
@@ -127,6 +127,18 @@ class TestPlan(object):
         'env': env,
       })
 
+      # The same interpreter, dispatching through a switch instead of
+      # computed goto; only built where both are available.
+      path = os.path.join(self.args.objdir, 'vm', 'spshell-switch' + arch, 'spshell-switch')
+      path = self.find_executable(path)
+      if path:
+        self.shells.append({
+          'path': os.path.abspath(path),
+          'args': ['--disable-jit'],
+          'name': 'interpreter-switch' + arch,
+          'env': env,
+        })
+
   def find_compilers(self):
     if self.args.spcomp2:
       self.find_spcomp2()
@@ -0,0 +1,291 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+// Runs plugin functions repeatedly under each way the VM can execute them
+// and prints how long each call took, one JSON object per line.
+//
+// Every public named bench_<name> is called with an iteration count, which
+// grows until one call takes long enough to time; ns_per_op is per
+// iteration. With --entry, the named publics are called without arguments
+// instead, and ns_per_op is per call. Each plugin is run by the JIT (where
+// there is one), by the interpreter, and then with debug breaks enabled,
+// where breaks_per_op says how many breaks each operation took.
+//
+#include <sp_vm_api.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <amtl/am-cxx.h>
+#include <amtl/experimental/am-argparser.h>
+#include "environment.h"
+#include "plugin-runtime.h"
+
+using namespace ke;
+using namespace ke::args;
+using namespace sp;
+using namespace SourcePawn;
+
+typedef std::chrono::steady_clock Clock;
+
+static Environment* sEnv;
+static uint64_t sMinNanoseconds;
+static uint64_t sDebugBreaks;
+static volatile cell_t sSink;
+
+// A single call taking this long is timed on its own.
+static const uint64_t kCallNanoseconds = 10 * 1000 * 1000;
+
+class BenchDebugListener : public IDebugListener
+{
+ public:
+  void ReportError(const IErrorReport& report, IFrameIterator& iter) override {
+    fprintf(stderr, "Exception thrown: %s\n", report.Message());
+  }
+  void OnDebugSpew(const char* msg, ...) override {
+  }
+};
+
+static void
+OnDebugBreak(IPluginContext* cx, sp_debug_break_info_t& info, const IErrorReport* report)
+{
+  sDebugBreaks++;
+}
+
+static cell_t
+Forward16(IPluginContext* cx, const cell_t* params)
+{
+  IPluginFunction* fn = cx->GetFunctionById(params[2]);
+  if (!fn)
+    return cx->ThrowNativeError("Invalid function id %x", params[2]);
+
+  for (cell_t i = 0; i < params[1]; i++) {
+    for (cell_t arg = 0; arg < 16; arg++)
+      fn->PushCell(arg);
+    if (!fn->Invoke())
+      return 0;
+  }
+  return 0;
+}
+
+static cell_t
+DoNothing(IPluginContext* cx, const cell_t* params)
+{
+  return 1;
+}
+
+static cell_t
+Consume(IPluginContext* cx, const cell_t* params)
+{
+  sSink = params[1];
+  return 0;
+}
+
+static void
+BindNative(IPluginRuntime* rt, const char* name, SPVM_NATIVE_FUNC fn)
+{
+  uint32_t index;
+  if (rt->FindNativeByName(name, &index) != SP_ERROR_NONE)
+    return;
+  rt->UpdateNativeBinding(index, fn, 0, nullptr);
+}
+
+struct Mode {
+  const char* name;
+  bool jit;
+  bool debug_breaks;
+};
+
+static uint64_t
+Elapsed(Clock::time_point start)
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+// Calls |fn|, with |iterations| as its argument if |counted|.
+static bool
+Call(IPluginContext* cx, IPluginFunction* fn, bool counted, cell_t iterations)
+{
+  ExceptionHandler eh(cx);
+  if (counted)
+    fn->PushCell(iterations);
+  if (!fn->Invoke()) {
+    fprintf(stderr, "Error executing %s: %s\n", fn->DebugName(), eh.Message());
+    return false;
+  }
+  return true;
+}
+
+static bool
+RunFunction(const char* file, const Mode& mode, IPluginContext* cx, IPluginFunction* fn,
+            bool counted)
+{
+  // The first call compiles the function, and is not timed. Iteration
+  // counts then double until a call takes long enough to time.
+  cell_t iterations = 1;
+  if (!Call(cx, fn, counted, iterations))
+    return false;
+  if (counted) {
+    while (iterations < (1 << 30)) {
+      Clock::time_point start = Clock::now();
+      if (!Call(cx, fn, counted, iterations))
+        return false;
+      if (Elapsed(start) >= kCallNanoseconds)
+        break;
+      iterations *= 2;
+    }
+  }
+
+  uint64_t calls = 0;
+  uint64_t breaks = sDebugBreaks;
+  uint64_t elapsed = 0;
+  Clock::time_point start = Clock::now();
+  while (elapsed < sMinNanoseconds) {
+    if (!Call(cx, fn, counted, iterations))
+      return false;
+    calls++;
+    elapsed = Elapsed(start);
+  }
+  breaks = sDebugBreaks - breaks;
+
+  uint64_t ops = calls * uint64_t(iterations);
+  fprintf(stdout, "{\"plugin\": \"%s\", \"bench\": \"%s\", \"mode\": \"%s\", \"ops\": %llu, "
+          "\"ns_per_op\": %.3f",
+          file, fn->DebugName(), mode.name, (unsigned long long)ops,
+          double(elapsed) / double(ops));
+  if (mode.debug_breaks)
+    fprintf(stdout, ", \"breaks_per_op\": %.3f", double(breaks) / double(ops));
+  fprintf(stdout, "}\n");
+  fflush(stdout);
+  return true;
+}
+
+static bool
+RunPlugin(const char* file, const Mode& mode, const std::vector<std::string>& entries)
+{
+  sEnv->SetJitEnabled(mode.jit);
+
+  char error[255];
+  AutoPtr<IPluginRuntime> rtb(sEnv->APIv2()->LoadBinaryFromFile(file, error, sizeof(error)));
+  if (!rtb) {
+    fprintf(stderr, "Could not load plugin %s: %s\n", file, error);
+    return false;
+  }
+
+  PluginRuntime* rt = PluginRuntime::FromAPI(rtb);
+  rt->InstallBuiltinNatives();
+  BindNative(rt, "forward16", Forward16);
+  BindNative(rt, "donothing", DoNothing);
+  BindNative(rt, "consume", Consume);
+
+  IPluginContext* cx = rt->GetDefaultContext();
+
+  bool ok = true;
+  if (!entries.empty()) {
+    for (const auto& name : entries) {
+      IPluginFunction* fn = rt->GetFunctionByName(name.c_str());
+      if (!fn) {
+        fprintf(stderr, "%s has no public %s\n", file, name.c_str());
+        ok = false;
+        continue;
+      }
+      ok &= RunFunction(file, mode, cx, fn, false);
+    }
+    return ok;
+  }
+
+  for (uint32_t i = 0; i < rt->GetPublicsNum(); i++) {
+    sp_public_t* pub;
+    if (rt->GetPublicByIndex(i, &pub) != SP_ERROR_NONE)
+      continue;
+    if (strncmp(pub->name, "bench_", 6) != 0)
+      continue;
+    IPluginFunction* fn = rt->GetFunctionById(pub->funcid);
+    if (!fn)
+      continue;
+    ok &= RunFunction(file, mode, cx, fn, true);
+  }
+  return ok;
+}
+
+int main(int argc, char** argv)
+{
+  Parser parser("SourcePawn VM benchmark runner.");
+  parser.collect_extra_args();
+  parser.set_usage_line("[options] <plugin.smx> [plugin.smx...]");
+
+  IntOption min_ms(parser,
+    "t", "min-ms",
+    Some(200),
+    "Time each function for at least this many milliseconds.");
+  StringOption entries_option(parser,
+    "e", "entry",
+    Nothing(),
+    "Call these comma-separated publics without arguments, instead of bench_*.");
+
+  if (!parser.parse(argc, argv) || parser.extra_args().empty()) {
+    parser.usage(stderr, argc, argv);
+    return 1;
+  }
+
+  sMinNanoseconds = uint64_t(min_ms.value()) * 1000 * 1000;
+
+  std::vector<std::string> entries;
+  if (entries_option.hasValue()) {
+    const char* list = entries_option.value().chars();
+    while (*list) {
+      const char* comma = strchr(list, ',');
+      size_t length = comma ? size_t(comma - list) : strlen(list);
+      if (length)
+        entries.emplace_back(list, length);
+      list += length + (comma ? 1 : 0);
+    }
+  }
+
+  if ((sEnv = Environment::New()) == nullptr) {
+    fprintf(stderr, "Could not initialize ISourcePawnEngine2\n");
+    return 1;
+  }
+
+  BenchDebugListener debug;
+  sEnv->SetDebugger(&debug);
+
+  // Debug breaks can only be enabled before any plugin is loaded, and not
+  // disabled again, so they are measured last.
+  std::vector<Mode> modes;
+#if defined(SP_HAS_JIT)
+  modes.push_back(Mode{"jit", true, false});
+#endif
+  modes.push_back(Mode{"interpreter", false, false});
+#if defined(SP_HAS_JIT)
+  modes.push_back(Mode{"jit+debug", true, true});
+#else
+  modes.push_back(Mode{"interpreter+debug", false, true});
+#endif
+
+  bool ok = true;
+  for (const Mode& mode : modes) {
+    if (mode.debug_breaks) {
+      sEnv->EnableDebugBreak();
+      sEnv->APIv1()->SetDebugBreakHandler(OnDebugBreak);
+    }
+    for (const auto& file : parser.extra_args())
+      ok &= RunPlugin(file.chars(), mode, entries);
+  }
+
+  sEnv->SetDebugger(nullptr);
+  sEnv->Shutdown();
+  delete sEnv;
+
+  return ok ? 0 : 1;
+}
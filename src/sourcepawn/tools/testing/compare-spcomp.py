@@ -0,0 +1,109 @@
+# vim: set ts=2 sw=2 tw=99 et:
+#
+# Compiles a corpus of .sp files with two spcomp binaries, checks that both
+# write the same output, and compares how long they take. Meant for changes
+# to the compiler that should not change what it emits, like the peephole
+# optimizer:
+#
+#   python compare-spcomp.py old/spcomp new/spcomp path/to/scripting -i include
+#
+import argparse
+import filecmp
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+def main():
+  parser = argparse.ArgumentParser()
+  parser.add_argument('baseline', type=str, help='spcomp to compare against.')
+  parser.add_argument('candidate', type=str, help='spcomp to test.')
+  parser.add_argument('corpus', type=str, nargs='+',
+                      help='.sp files, or folders to search for them.')
+  parser.add_argument('-i', '--include', type=str, action='append', default=[],
+                      help='Include folder, passed on to spcomp.')
+  parser.add_argument('--runs', type=int, default=3,
+                      help='Compiles per file and binary; the fastest counts.')
+  parser.add_argument('--asm', default=False, action='store_true',
+                      help='Compare the assembly listing (-a) instead of the .smx.')
+  parser.add_argument('--spcomp-arg', type=str, action='append', default=[],
+                      dest='spcomp_args', help='Extra argument for both binaries.')
+  args = parser.parse_args()
+
+  files = []
+  for path in args.corpus:
+    if os.path.isdir(path):
+      for root, _, names in os.walk(path):
+        files += [os.path.join(root, name) for name in sorted(names) if name.endswith('.sp')]
+    else:
+      files.append(path)
+  if not files:
+    sys.stderr.write('No .sp files found.\n')
+    return 1
+
+  workdir = tempfile.mkdtemp(prefix='compare-spcomp-')
+  try:
+    return compare(args, files, workdir)
+  finally:
+    shutil.rmtree(workdir, ignore_errors=True)
+
+def compile(args, spcomp, path, output):
+  argv = [os.path.abspath(spcomp)]
+  for include in args.include:
+    argv += ['-i', include]
+  argv += args.spcomp_args
+  if args.asm:
+    argv += ['-a']
+  argv += ['-o', output, path]
+
+  best = None
+  status = None
+  for _ in range(max(args.runs, 1)):
+    start = time.perf_counter()
+    result = subprocess.run(argv, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    elapsed = time.perf_counter() - start
+    status = result.returncode
+    if best is None or elapsed < best:
+      best = elapsed
+  return status, best
+
+def compare(args, files, workdir):
+  totals = [0.0, 0.0]
+  compiled = 0
+  mismatches = []
+  for index, path in enumerate(files):
+    outputs = [os.path.join(workdir, '{0}.{1}'.format(index, which)) for which in ('a', 'b')]
+    base_status, base_time = compile(args, args.baseline, path, outputs[0])
+    cand_status, cand_time = compile(args, args.candidate, path, outputs[1])
+
+    if base_status != cand_status:
+      mismatches.append('{0}: exit code {1} vs {2}'.format(path, base_status, cand_status))
+      continue
+    if base_status != 0:
+      # Both fail; nothing to compare or time.
+      continue
+    if not all(os.path.exists(output) for output in outputs):
+      mismatches.append('{0}: no output'.format(path))
+      continue
+    if not filecmp.cmp(outputs[0], outputs[1], shallow=False):
+      mismatches.append('{0}: output differs'.format(path))
+
+    compiled += 1
+    totals[0] += base_time
+    totals[1] += cand_time
+    print('{0:8.1f} ms {1:8.1f} ms  {2}'.format(base_time * 1000, cand_time * 1000, path))
+
+  print('')
+  print('{0} of {1} files compiled'.format(compiled, len(files)))
+  if compiled:
+    change = (totals[1] - totals[0]) / totals[0] * 100 if totals[0] else 0
+    print('baseline  {0:8.1f} ms'.format(totals[0] * 1000))
+    print('candidate {0:8.1f} ms ({1:+.1f}%)'.format(totals[1] * 1000, change))
+  for line in mismatches:
+    print('MISMATCH ' + line)
+  return 1 if mismatches else 0
+
+if __name__ == '__main__':
+  sys.exit(main())
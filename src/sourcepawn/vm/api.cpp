@@ -38,6 +38,7 @@
 #endif
 #include "code-stubs.h"
 #include "smx-v1-image.h"
+#include "plugin-loader.h"
 #include <amtl/am-string.h>
 
 using namespace sp;
@@ -248,49 +249,10 @@ SourcePawnEngine2::LoadPlugin(ICompilation* co, const char* file, int* err)
 IPluginRuntime*
 SourcePawnEngine2::LoadBinaryFromFile(const char* file, char* error, size_t maxlength)
 {
-  FILE* fp = fopen(file, "rb");
-
-  if (!fp) {
-    UTIL_Format(error, maxlength, "file not found");
-    return nullptr;
-  }
-
-  ke::AutoPtr<SmxV1Image> image(new SmxV1Image(fp));
-  fclose(fp);
-
-  if (!image->validate()) {
-    const char* errorMessage = image->errorMessage();
-    if (!errorMessage)
-      errorMessage = "file parse error";
-    UTIL_Format(error, maxlength, "%s", errorMessage);
-    return nullptr;
-  }
-
-  PluginRuntime* pRuntime = new PluginRuntime(image.take());
-  if (!pRuntime->Initialize()) {
-    delete pRuntime;
-
-    UTIL_Format(error, maxlength, "out of memory");
-    return nullptr;
-  }
-
-  size_t len = strlen(file);
-  for (size_t i = len - 1; i < len; i--) {
-    if (file[i] == '/' 
-# if defined WIN32
-      || file[i] == '\\'
-# endif
-    )
-    {
-      pRuntime->SetNames(file, &file[i + 1]);
-      break;
-    }
-  }
-
-  if (!pRuntime->Name())
-    pRuntime->SetNames(file, file);
-
-  return pRuntime;
+  PluginRuntime* rt;
+  if (Environment::get()->loader()->Take(file, &rt, error, maxlength))
+    return rt;
+  return LoadPluginFile(file, error, maxlength);
 }
 
 SPVM_NATIVE_FUNC
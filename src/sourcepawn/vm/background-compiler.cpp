@@ -0,0 +1,179 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#include "background-compiler.h"
+#include <algorithm>
+#include "environment.h"
+#include "method-info.h"
+#include "plugin-runtime.h"
+#include "pool-allocator.h"
+#if defined(SP_HAS_JIT)
+# include "jit.h"
+#endif
+
+namespace sp {
+
+BackgroundCompiler::BackgroundCompiler(Environment* env)
+ : env_(env),
+   terminate_(false),
+   busy_(nullptr)
+{
+}
+
+BackgroundCompiler::~BackgroundCompiler()
+{
+  assert(!thread_);
+}
+
+bool
+BackgroundCompiler::Initialize()
+{
+  if (thread_)
+    return true;
+
+  thread_ = new ke::Thread([this]() -> void {
+    Run();
+  }, "SP Compiler");
+  if (!thread_->Succeeded()) {
+    thread_ = nullptr;
+    return false;
+  }
+  return true;
+}
+
+void
+BackgroundCompiler::Shutdown()
+{
+  if (!thread_)
+    return;
+
+  {
+    ke::AutoLock lock(&cv_);
+    terminate_ = true;
+    queue_.clear();
+    cv_.Notify();
+  }
+  thread_->Join();
+  thread_ = nullptr;
+}
+
+bool
+BackgroundCompiler::Enqueue(PluginRuntime* rt)
+{
+  std::vector<ucell_t> procs;
+  std::vector<std::vector<ucell_t>> callees;
+  rt->ScanMethods(&procs, &callees);
+
+  std::vector<bool> queued(procs.size());
+  std::vector<size_t> order;
+  auto visit = [&](ucell_t offset) -> void {
+    auto iter = std::lower_bound(procs.begin(), procs.end(), offset);
+    if (iter == procs.end() || *iter != offset)
+      return;
+    size_t index = iter - procs.begin();
+    if (queued[index])
+      return;
+    queued[index] = true;
+    order.push_back(index);
+  };
+
+  for (size_t i = 0; i < rt->image()->NumPublics(); i++) {
+    uint32_t offset;
+    const char* name;
+    rt->image()->GetPublic(i, &offset, &name);
+    visit(offset);
+  }
+  for (size_t head = 0; head < order.size(); head++) {
+    for (ucell_t callee : callees[order[head]])
+      visit(callee);
+  }
+  for (ucell_t offset : procs)
+    visit(offset);
+
+  // The debug break filter belongs to the host, so it is asked here rather
+  // than from the compiler thread.
+  rt->IsDebugBreakInstrumented();
+
+  std::vector<Job> jobs;
+  for (size_t index : order) {
+    RefPtr<MethodInfo> method = rt->AcquireMethod(procs[index]);
+    if (!method || method->jit())
+      continue;
+    jobs.push_back(Job{rt, method});
+  }
+
+  ke::AutoLock lock(&cv_);
+  if (terminate_)
+    return false;
+  for (Job& job : jobs)
+    queue_.push_back(std::move(job));
+  cv_.Notify();
+  return true;
+}
+
+void
+BackgroundCompiler::Cancel(PluginRuntime* rt)
+{
+  ke::AutoLock lock(&cv_);
+  queue_.erase(std::remove_if(queue_.begin(), queue_.end(), [rt](const Job& job) -> bool {
+    return job.rt == rt;
+  }), queue_.end());
+
+  while (busy_ == rt)
+    cv_.Wait();
+}
+
+void
+BackgroundCompiler::Run()
+{
+  // The compiler's out-of-line paths come from this thread's pool.
+  PoolAllocator::InitDefault();
+  Loop();
+  PoolAllocator::FreeDefault();
+}
+
+void
+BackgroundCompiler::Loop()
+{
+  ke::AutoLock lock(&cv_);
+
+  while (!terminate_) {
+    if (queue_.empty()) {
+      cv_.Wait();
+      continue;
+    }
+
+    Job job = std::move(queue_.front());
+    queue_.pop_front();
+    busy_ = job.rt;
+
+    {
+      ke::AutoUnlock unlock(&cv_);
+
+#if defined(SP_HAS_JIT)
+      // Errors are left for the game thread, which compiles the method
+      // again, and reports them, if it is ever called.
+      int err;
+      if (env_->IsJitEnabled() && !job.method->jit())
+        CompilerBase::Compile(job.rt->GetBaseContext(), job.method, &err);
+#endif
+
+      // The runtime may go away as soon as it is no longer busy.
+      job.method = nullptr;
+    }
+
+    busy_ = nullptr;
+    cv_.Notify();
+  }
+}
+
+} // namespace sp
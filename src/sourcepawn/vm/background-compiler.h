@@ -0,0 +1,72 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#ifndef _include_sourcepawn_vm_background_compiler_h_
+#define _include_sourcepawn_vm_background_compiler_h_
+
+#include <am-thread-utils.h>
+#include <amtl/am-refcounting.h>
+#include <deque>
+#include <vector>
+
+namespace sp {
+
+class Environment;
+class MethodInfo;
+class PluginRuntime;
+
+// Compiles the methods of newly loaded plugins on a thread of its own, so
+// the game thread rarely has to. A method that is not compiled yet when it
+// is first called is compiled on the caller's thread as usual; whichever
+// compile comes second finds the method already done.
+class BackgroundCompiler
+{
+ public:
+  BackgroundCompiler(Environment* env);
+  ~BackgroundCompiler();
+
+  bool Initialize();
+  void Shutdown();
+
+  // Queues every method of a runtime, public functions first, then the
+  // functions they call in breadth-first order, then whatever is left.
+  // Main thread only.
+  bool Enqueue(PluginRuntime* rt);
+
+  // Drops the runtime's queued methods and waits for the one being
+  // compiled, if any. Main thread only, without the environment lock.
+  void Cancel(PluginRuntime* rt);
+
+ private:
+  // Compiler thread.
+  void Run();
+  void Loop();
+
+ private:
+  struct Job {
+    PluginRuntime* rt;
+    ke::RefPtr<MethodInfo> method;
+  };
+
+  Environment* env_;
+  bool terminate_;
+  ke::AutoPtr<ke::Thread> thread_;
+  ke::ConditionVariable cv_;
+
+  // Guarded by cv_.
+  std::deque<Job> queue_;
+  PluginRuntime* busy_;
+};
+
+} // namespace sp
+
+#endif // _include_sourcepawn_vm_background_compiler_h_
@@ -0,0 +1,259 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#include "bounds-analysis.h"
+#include "opcodes.h"
+#include <algorithm>
+
+namespace sp {
+
+void
+BoundsAnalysis::analyze(ControlFlowGraph* graph, bool debug_breaks, BitSet* line_breaks)
+{
+  start_at_ = graph->entry()->start();
+  debug_breaks_ = debug_breaks;
+  line_breaks_ = line_breaks;
+
+  uint32_t max_id = 0;
+  for (auto iter = graph->rpoBegin(); iter != graph->rpoEnd(); iter++)
+    max_id = std::max(max_id, (*iter)->id());
+  exits_.assign(max_id + 1, State());
+  scanned_.assign(max_id + 1, false);
+
+  // In RPO, a block's only predecessor has been scanned unless the block is
+  // the target of a backedge, and then it has two.
+  for (auto iter = graph->rpoBegin(); iter != graph->rpoEnd(); iter++) {
+    Block* block = *iter;
+
+    State state;
+    const auto& preds = block->predecessors();
+    if (preds.length() == 1 && scanned_[preds[0]->id()])
+      state = exits_[preds[0]->id()];
+
+    scan(block, &state);
+    exits_[block->id()] = std::move(state);
+    scanned_[block->id()] = true;
+  }
+}
+
+void
+BoundsAnalysis::scan(Block* block, State* state)
+{
+  const uint8_t* stop_at = block->end();
+  if (block->endType() == BlockEnd::Insn)
+    stop_at = NextInstruction(stop_at);
+
+  for (const uint8_t* cip = block->start(); cip < stop_at; cip = NextInstruction(cip)) {
+    const cell_t* insn = reinterpret_cast<const cell_t*>(cip);
+    OPCODE op = (OPCODE)insn[0];
+
+    if (debug_breaks_ && line_breaks_ && line_breaks_->test(getCellNumber(cip))) {
+      state->slots.clear();
+      state->pri_mirrors_slot = false;
+    }
+
+    switch (op) {
+      case OP_BOUNDS:
+      {
+        ucell_t limit = insn[1];
+        if (state->pri_known && state->pri_limit <= limit) {
+          redundant_.set(getCellNumber(cip));
+          break;
+        }
+        state->pri_known = true;
+        state->pri_limit = limit;
+        if (state->pri_mirrors_slot) {
+          // The check covers the slot PRI was loaded from, too.
+          cell_t offset = state->pri_slot;
+          kill(state, offset);
+          state->slots.push_back(Fact{offset, limit});
+          state->pri_mirrors_slot = true;
+          state->pri_slot = offset;
+        }
+        break;
+      }
+
+      case OP_CONST_PRI:
+        setPri(state, true, insn[1]);
+        break;
+
+      case OP_ZERO_PRI:
+        setPri(state, true, 0);
+        break;
+
+      case OP_LOAD_S_PRI:
+      case OP_LOAD_S_BOTH:
+      {
+        const Fact* fact = find(*state, insn[1]);
+        setPri(state, !!fact, fact ? fact->limit : 0);
+        state->pri_mirrors_slot = true;
+        state->pri_slot = insn[1];
+        break;
+      }
+
+      case OP_STOR_S_PRI:
+        kill(state, insn[1]);
+        if (state->pri_known)
+          state->slots.push_back(Fact{insn[1], state->pri_limit});
+        state->pri_mirrors_slot = true;
+        state->pri_slot = insn[1];
+        break;
+
+      case OP_ZERO_S:
+        kill(state, insn[1]);
+        state->slots.push_back(Fact{insn[1], 0});
+        break;
+
+      case OP_CONST_S:
+        kill(state, insn[1]);
+        state->slots.push_back(Fact{insn[1], ucell_t(insn[2])});
+        break;
+
+      case OP_STOR_S_ALT:
+      case OP_INC_S:
+      case OP_DEC_S:
+        kill(state, insn[1]);
+        break;
+
+      // These leave PRI and the frame alone. Pushes write below the stack
+      // pointer, where no slot with a fact lives.
+      case OP_LOAD_ALT:
+      case OP_LOAD_S_ALT:
+      case OP_LREF_S_ALT:
+      case OP_CONST_ALT:
+      case OP_ADDR_ALT:
+      case OP_MOVE_ALT:
+      case OP_ZERO_ALT:
+      case OP_INC_ALT:
+      case OP_DEC_ALT:
+      case OP_SHL_C_ALT:
+      case OP_STOR_PRI:
+      case OP_STOR_ALT:
+      case OP_ZERO:
+      case OP_INC:
+      case OP_DEC:
+      case OP_CONST:
+      case OP_PUSH_PRI:
+      case OP_PUSH_ALT:
+      case OP_PUSH_C:
+      case OP_PUSH:
+      case OP_PUSH_S:
+      case OP_PUSH_ADR:
+      case OP_PUSH2_C:
+      case OP_PUSH2:
+      case OP_PUSH2_S:
+      case OP_PUSH2_ADR:
+      case OP_PUSH3_C:
+      case OP_PUSH3:
+      case OP_PUSH3_S:
+      case OP_PUSH3_ADR:
+      case OP_PUSH4_C:
+      case OP_PUSH4:
+      case OP_PUSH4_S:
+      case OP_PUSH4_ADR:
+      case OP_PUSH5_C:
+      case OP_PUSH5:
+      case OP_PUSH5_S:
+      case OP_PUSH5_ADR:
+      case OP_HEAP:
+      case OP_TRACKER_PUSH_C:
+      case OP_TRACKER_POP_SETHEAP:
+      case OP_NOP:
+        break;
+
+      case OP_BREAK:
+        if (debug_breaks_) {
+          state->slots.clear();
+          state->pri_mirrors_slot = false;
+        }
+        break;
+
+      // These move the stack pointer up, write through a pointer, or run
+      // other code. The frame could change under any slot.
+      case OP_POP_PRI:
+      case OP_POP_ALT:
+      case OP_STACK:
+      case OP_STOR_I:
+      case OP_STRB_I:
+      case OP_SREF_S_PRI:
+      case OP_SREF_S_ALT:
+      case OP_INC_I:
+      case OP_DEC_I:
+      case OP_MOVS:
+      case OP_FILL:
+      case OP_GENARRAY:
+      case OP_GENARRAY_Z:
+      case OP_REBASE:
+      case OP_CALL:
+      case OP_SYSREQ_C:
+      case OP_SYSREQ_N:
+        setPri(state, false, 0);
+        state->slots.clear();
+        break;
+
+      // Anything else may change PRI.
+      default:
+        setPri(state, false, 0);
+        break;
+    }
+
+    if (debug_breaks_ && IsFixedAddressStore(op)) {
+      state->slots.clear();
+      state->pri_mirrors_slot = false;
+    }
+  }
+}
+
+const BoundsAnalysis::Fact*
+BoundsAnalysis::find(const State& state, cell_t offset)
+{
+  for (const auto& fact : state.slots) {
+    if (fact.offset == offset)
+      return &fact;
+  }
+  return nullptr;
+}
+
+void
+BoundsAnalysis::setPri(State* state, bool known, ucell_t limit)
+{
+  state->pri_known = known;
+  state->pri_limit = limit;
+  state->pri_mirrors_slot = false;
+}
+
+static inline bool
+Overlaps(cell_t a, cell_t b)
+{
+  cell_t distance = a - b;
+  return distance > -cell_t(sizeof(cell_t)) && distance < cell_t(sizeof(cell_t));
+}
+
+// Drops facts about any slot a cell store at |offset| overlaps.
+void
+BoundsAnalysis::kill(State* state, cell_t offset)
+{
+  if (state->pri_mirrors_slot && Overlaps(state->pri_slot, offset))
+    state->pri_mirrors_slot = false;
+
+  auto& slots = state->slots;
+  for (size_t i = 0; i < slots.size();) {
+    if (Overlaps(slots[i].offset, offset)) {
+      slots[i] = slots.back();
+      slots.pop_back();
+    } else {
+      i++;
+    }
+  }
+}
+
+} // namespace sp
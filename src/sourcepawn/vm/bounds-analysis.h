@@ -0,0 +1,90 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+
+#ifndef _include_sourcepawn_vm_bounds_analysis_h_
+#define _include_sourcepawn_vm_bounds_analysis_h_
+
+#include <sp_vm_types.h>
+#include <vector>
+#include "bitset.h"
+#include "control-flow.h"
+
+namespace sp {
+
+// Finds the BOUNDS checks in a method that an earlier check already covers,
+// so the JIT can leave them out. The typical case is an index read from a
+// local and checked once per array it subscripts:
+//
+//     load.s.pri i; bounds 63; ...; load.s.pri i; bounds 63
+//
+// What is known is an unsigned upper limit for PRI and for frame slots, from
+// constants and from checks that passed. It flows forward through a block and
+// into successors that have no other predecessor; loop headers and joins
+// start over. Slot facts are dropped when the slot is stored to, and all of
+// them when anything could write the frame behind the analysis' back: stores
+// through a pointer, calls, natives, the stack pointer moving up (pushes may
+// then reuse the slot), and, when the debugger can set locals, BREAK and
+// watched stores.
+//
+// Leaving a check out never makes plugin code unsafe for the host: loads and
+// stores through the indexed address still check it against plugin memory.
+class BoundsAnalysis
+{
+ public:
+  // |line_breaks| holds the cells, counted from the method's start, of
+  // instructions the JIT puts a break site before (see
+  // CompilerBase::findLineBreaks); these count as BREAKs.
+  void analyze(ControlFlowGraph* graph, bool debug_breaks, BitSet* line_breaks);
+
+  bool isRedundant(const cell_t* cip) {
+    return redundant_.test(getCellNumber(reinterpret_cast<const uint8_t*>(cip)));
+  }
+
+ private:
+  struct Fact {
+    cell_t offset;
+    ucell_t limit;
+  };
+  struct State {
+    bool pri_known = false;
+    ucell_t pri_limit = 0;
+    // PRI still holds what was loaded from this slot.
+    bool pri_mirrors_slot = false;
+    cell_t pri_slot = 0;
+    std::vector<Fact> slots;
+  };
+
+  void scan(Block* block, State* state);
+  static void setPri(State* state, bool known, ucell_t limit);
+  static const Fact* find(const State& state, cell_t offset);
+  static void kill(State* state, cell_t offset);
+
+  uint32_t getCellNumber(const uint8_t* cip) const {
+    return static_cast<uint32_t>((cip - start_at_) / sizeof(cell_t));
+  }
+
+ private:
+  const uint8_t* start_at_ = nullptr;
+  bool debug_breaks_ = false;
+  BitSet* line_breaks_ = nullptr;
+
+  // Indexed by block id.
+  std::vector<State> exits_;
+  std::vector<bool> scanned_;
+
+  BitSet redundant_;
+};
+
+} // namespace sp
+
+#endif // _include_sourcepawn_vm_bounds_analysis_h_
@@ -32,44 +32,101 @@ CodeAllocator::~CodeAllocator()
 }
 
 CodeChunk
-CodeAllocator::Allocate(size_t rawBytes)
+CodeAllocator::Allocate(size_t rawBytes, const void* group)
 {
   size_t bytes = Align(rawBytes, kMallocAlignment);
   if (bytes < rawBytes)
     return CodeChunk();
 
   // First search the cache for any pools we can re-use.
-  RefPtr<CodePool> pool = findPool(bytes);
+  RefPtr<CodePool> pool = findPool(bytes, group);
   if (pool)
     return allocateInPool(pool, bytes);
 
-  pool = CodePool::AllocateFor(bytes);
+  pool = newPool(bytes, group);
   if (!pool)
     return CodeChunk();
 
   CodeChunk chunk = allocateInPool(pool, bytes);
+  cachePool(pool);
+  return chunk;
+}
 
-  // Enter this pool into the cache if we can.
-  if (cached_pools_.length() < kMaxCachedPools) {
-    cached_pools_.append(pool);
-  } else {
-    // If this pool has more free space than any of our cached pools, then
-    // evict the pool with the least amount of free space left.
-    size_t min_index = 0;
-    for (size_t i = 1; i < cached_pools_.length(); i++) {
-      if (cached_pools_[i]->bytesFree() < cached_pools_[min_index]->bytesFree())
-        min_index = i;
-    }
-    if (cached_pools_[min_index]->bytesFree() < pool->bytesFree())
-      cached_pools_[min_index] = pool;
+bool
+CodeAllocator::ReserveRegion(size_t bytes)
+{
+  if (region_)
+    return false;
+  region_ = CodeRegion::Reserve(bytes);
+  return !!region_;
+}
+
+void
+CodeAllocator::ReleaseGroup(const void* group)
+{
+  for (size_t i = 0; i < group_pools_.length(); i++) {
+    if (group_pools_[i]->group_ != group)
+      continue;
+    group_pools_[i] = group_pools_.back();
+    group_pools_.pop();
+    return;
   }
+}
 
-  return chunk;
+static size_t kPageGranularity = 0;
+static size_t kMinPoolSize = 1 * kMB;
+
+// Plugins mostly need little code, so their pools start out smaller.
+static size_t kMinGroupPoolSize = 64 * kKB;
+
+RefPtr<CodePool>
+CodeAllocator::newPool(size_t bytes, const void* group)
+{
+  size_t minBytes = group ? kMinGroupPoolSize : kMinPoolSize;
+
+  if (region_) {
+    size_t size = ke::Align(bytes < minBytes ? minBytes : bytes, region_->spanSize());
+    if (size >= bytes) {
+      if (uint8_t* address = region_->take(size))
+        return new CodePool(address, size, group, region_);
+    }
+  }
+  return CodePool::AllocateFor(bytes, minBytes, group);
 }
 
 RefPtr<CodePool>
-CodeAllocator::findPool(size_t bytes)
+CodeAllocator::findPool(size_t bytes, const void* group)
 {
+  if (group) {
+    for (size_t i = 0; i < group_pools_.length(); i++) {
+      RefPtr<CodePool> pool = group_pools_[i];
+      if (pool->group_ != group)
+        continue;
+      if (pool->unused())
+        pool->reset();
+      if (bytes > pool->bytesFree())
+        return nullptr;
+      return pool;
+    }
+    return nullptr;
+  }
+
+  // Pools left empty by unloaded code are reused, but only one is kept
+  // around for that; the others go back to the system.
+  bool have_empty = false;
+  for (size_t i = 0; i < cached_pools_.length(); i++) {
+    if (!cached_pools_[i]->unused())
+      continue;
+    if (have_empty) {
+      cached_pools_[i] = cached_pools_.back();
+      cached_pools_.pop();
+      i--;
+      continue;
+    }
+    cached_pools_[i]->reset();
+    have_empty = true;
+  }
+
   // Find the cached pool with the smallest free region that holds |bytes|, to
   // reduce fragmentation.
   RefPtr<CodePool> min;
@@ -83,6 +140,38 @@ CodeAllocator::findPool(size_t bytes)
   return min;
 }
 
+void
+CodeAllocator::cachePool(RefPtr<CodePool> pool)
+{
+  // A group only fills its newest pool. The old one lives on until its
+  // chunks are freed.
+  if (pool->group_) {
+    for (size_t i = 0; i < group_pools_.length(); i++) {
+      if (group_pools_[i]->group_ == pool->group_) {
+        group_pools_[i] = pool;
+        return;
+      }
+    }
+    group_pools_.append(pool);
+    return;
+  }
+
+  // Enter this pool into the cache if we can.
+  if (cached_pools_.length() < kMaxCachedPools) {
+    cached_pools_.append(pool);
+  } else {
+    // If this pool has more free space than any of our cached pools, then
+    // evict the pool with the least amount of free space left.
+    size_t min_index = 0;
+    for (size_t i = 1; i < cached_pools_.length(); i++) {
+      if (cached_pools_[i]->bytesFree() < cached_pools_[min_index]->bytesFree())
+        min_index = i;
+    }
+    if (cached_pools_[min_index]->bytesFree() < pool->bytesFree())
+      cached_pools_[min_index] = pool;
+  }
+}
+
 CodeChunk
 CodeAllocator::allocateInPool(RefPtr<CodePool> pool, size_t bytes)
 {
@@ -90,30 +179,36 @@ CodeAllocator::allocateInPool(RefPtr<CodePool> pool, size_t bytes)
   return CodeChunk(pool, address, bytes);
 }
 
-static size_t kPageGranularity = 0;
-static size_t kMinPoolSize = 1 * kMB;
-
-RefPtr<CodePool>
-CodePool::AllocateFor(size_t askBytes)
+static void
+InitPageGranularity()
 {
-  if (!kPageGranularity) {
-    // On Windows, the page granularity is defined as 64KB. On POSIX systems it's
-    // usually 4KB.
+  if (kPageGranularity)
+    return;
+
+  // On Windows, the page granularity is defined as 64KB. On POSIX systems it's
+  // usually 4KB.
 #if defined(_WIN32)
-    SYSTEM_INFO info;
-    GetSystemInfo(&info);
-    kPageGranularity = info.dwAllocationGranularity;
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  kPageGranularity = info.dwAllocationGranularity;
 #else
-    kPageGranularity = sysconf(_SC_PAGESIZE);
+  kPageGranularity = sysconf(_SC_PAGESIZE);
 #endif
-    assert(ke::IsAligned(kPageGranularity, kMallocAlignment));
-  }
+  assert(ke::IsAligned(kPageGranularity, kMallocAlignment));
+}
+
+RefPtr<CodePool>
+CodePool::AllocateFor(size_t askBytes, size_t minBytes, const void* group)
+{
+  InitPageGranularity();
 
   // If the allocation is larger than our minimum pool size, we only align up
   // to the page granularity.
-  size_t bytes = (askBytes < kMinPoolSize)
-                 ? kMinPoolSize
+  size_t bytes = (askBytes < minBytes)
+                 ? ke::Align(minBytes, kPageGranularity)
                  : ke::Align(askBytes, kPageGranularity);
+  if (bytes < askBytes)
+    return nullptr;
   assert(ke::IsAligned(bytes, kPageGranularity));
 
 #if defined(_WIN32)
@@ -126,19 +221,27 @@ CodePool::AllocateFor(size_t askBytes)
     return nullptr;
 #endif
 
-  return new CodePool((uint8_t*)address, bytes);
+  return new CodePool((uint8_t*)address, bytes, group, nullptr);
 }
 
-CodePool::CodePool(uint8_t* start, size_t size)
+CodePool::CodePool(uint8_t* start, size_t size, const void* group, CodeRegion* region)
  : start_(start),
    ptr_(start),
    end_(start + size),
-   size_(size)
+   size_(size),
+   group_(group),
+   region_(region),
+   chunks_(0)
 {
 }
 
 CodePool::~CodePool()
 {
+  if (region_) {
+    region_->give(start_, size_);
+    return;
+  }
+
 #if defined(_WIN32)
   VirtualFree(start_, 0, MEM_RELEASE);
 #else
@@ -154,3 +257,119 @@ CodePool::allocate(size_t bytes)
   ptr_ += bytes;
   return result;
 }
+
+// Huge pages are 2MB on every platform we run on; the region is aligned to
+// them even where they are not available, so transparent huge pages can back
+// it.
+static const size_t kHugePageSize = 2 * kMB;
+static const size_t kRegionSpanSize = 64 * kKB;
+
+RefPtr<CodeRegion>
+CodeRegion::Reserve(size_t askBytes)
+{
+  InitPageGranularity();
+
+  size_t bytes = ke::Align(askBytes, kHugePageSize);
+  if (!bytes || bytes < askBytes)
+    return nullptr;
+
+#if defined(_WIN32)
+  // Large pages need SeLockMemoryPrivilege, which servers rarely run with.
+  if (SIZE_T large = GetLargePageMinimum()) {
+    SIZE_T size = ke::Align(bytes, size_t(large));
+    void* address = VirtualAlloc(nullptr, size, MEM_COMMIT|MEM_RESERVE|MEM_LARGE_PAGES,
+                                 PAGE_EXECUTE_READWRITE);
+    if (address)
+      return new CodeRegion((uint8_t*)address, size);
+  }
+  void* address = VirtualAlloc(nullptr, bytes, MEM_COMMIT|MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+  if (!address)
+    return nullptr;
+  return new CodeRegion((uint8_t*)address, bytes);
+#else
+# if defined(MAP_HUGETLB)
+  // Only succeeds if the administrator has set huge pages aside.
+  void* huge = mmap(nullptr, bytes, PROT_READ|PROT_WRITE|PROT_EXEC,
+                    MAP_PRIVATE|MAP_ANON|MAP_HUGETLB, -1, 0);
+  if (huge != MAP_FAILED)
+    return new CodeRegion((uint8_t*)huge, bytes);
+# endif
+
+  // Over-reserve so the region can be aligned, then trim the ends.
+  size_t mapped = bytes + kHugePageSize;
+  void* address = mmap(nullptr, mapped, PROT_READ|PROT_WRITE|PROT_EXEC, MAP_PRIVATE|MAP_ANON, -1, 0);
+  if (address == MAP_FAILED)
+    return nullptr;
+
+  uint8_t* base = (uint8_t*)address;
+  uint8_t* start = (uint8_t*)ke::Align(uintptr_t(base), kHugePageSize);
+  if (start != base)
+    munmap(base, start - base);
+  if (start + bytes != base + mapped)
+    munmap(start + bytes, (base + mapped) - (start + bytes));
+
+# if defined(MADV_HUGEPAGE)
+  madvise(start, bytes, MADV_HUGEPAGE);
+# endif
+  return new CodeRegion(start, bytes);
+#endif
+}
+
+CodeRegion::CodeRegion(uint8_t* start, size_t size)
+ : start_(start),
+   size_(size),
+   used_(size / kRegionSpanSize)
+{
+  assert(ke::IsAligned(size, kRegionSpanSize));
+}
+
+CodeRegion::~CodeRegion()
+{
+#if defined(_WIN32)
+  VirtualFree(start_, 0, MEM_RELEASE);
+#else
+  munmap(start_, size_);
+#endif
+}
+
+size_t
+CodeRegion::spanSize() const
+{
+  return kRegionSpanSize;
+}
+
+uint8_t*
+CodeRegion::take(size_t bytes)
+{
+  assert(ke::IsAligned(bytes, kRegionSpanSize));
+  size_t count = bytes / kRegionSpanSize;
+
+  // First fit, so that code stays at the bottom of the region.
+  ke::AutoLock lock(&lock_);
+  size_t run = 0;
+  for (size_t i = 0; i < used_.size(); i++) {
+    if (used_[i]) {
+      run = 0;
+      continue;
+    }
+    if (++run < count)
+      continue;
+
+    size_t first = i + 1 - count;
+    for (size_t j = first; j <= i; j++)
+      used_[j] = true;
+    return start_ + first * kRegionSpanSize;
+  }
+  return nullptr;
+}
+
+void
+CodeRegion::give(uint8_t* address, size_t bytes)
+{
+  assert(address >= start_ && address + bytes <= start_ + size_);
+  size_t first = (address - start_) / kRegionSpanSize;
+
+  ke::AutoLock lock(&lock_);
+  for (size_t i = first; i < first + bytes / kRegionSpanSize; i++)
+    used_[i] = false;
+}
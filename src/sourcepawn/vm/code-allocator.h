@@ -16,30 +16,78 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <am-refcounting.h>
+#include <am-refcounting-threadsafe.h>
 #include <am-vector.h>
+#include <am-thread-utils.h>
+#include <atomic>
+#include <vector>
 
 namespace sp {
 
 using namespace ke;
 
-// Manages CodeChunks, optimized for the underlying system allocator.
-class CodePool : public ke::Refcounted<CodePool>
+// One large reservation that pools are carved out of, so compiled code is
+// covered by as few TLB entries as possible. It is backed by huge pages where
+// the OS allows. Spans are taken on the allocating thread and given back on
+// whichever thread frees the last chunk of a pool.
+class CodeRegion : public ke::RefcountedThreadsafe<CodeRegion>
+{
+ public:
+  ~CodeRegion();
+
+  static RefPtr<CodeRegion> Reserve(size_t bytes);
+
+  // A run of free spans holding |bytes|, or null if there is none.
+  uint8_t* take(size_t bytes);
+  void give(uint8_t* address, size_t bytes);
+
+  size_t spanSize() const;
+
+ private:
+  CodeRegion(uint8_t* start, size_t size);
+
+ private:
+  CodeRegion(const CodeRegion&) = delete;
+  void operator =(const CodeRegion&) = delete;
+
+ private:
+  ke::Mutex lock_;
+  uint8_t* start_;
+  size_t size_;
+  std::vector<bool> used_;
+};
+
+// Manages CodeChunks, optimized for the underlying system allocator. Chunks
+// are allocated and freed on both the game and the background compiler
+// thread.
+class CodePool : public ke::RefcountedThreadsafe<CodePool>
 {
   friend class CodeAllocator;
+  friend struct CodeChunk;
 
  public:
   ~CodePool();
 
  private:
-  CodePool(uint8_t* start, size_t size);
+  CodePool(uint8_t* start, size_t size, const void* group, CodeRegion* region);
 
-  static RefPtr<CodePool> AllocateFor(size_t bytes);
+  static RefPtr<CodePool> AllocateFor(size_t bytes, size_t minBytes, const void* group);
 
   uint8_t* allocate(size_t bytes);
   size_t bytesFree() const {
     return end_ - ptr_;
   }
 
+  // Once no chunk in the pool is alive, its space can be handed out again.
+  // Chunks are only created by the allocator, so this holds until it
+  // allocates from the pool.
+  bool unused() const {
+    return chunks_.load(std::memory_order_acquire) == 0;
+  }
+  void reset() {
+    ptr_ = start_;
+  }
+
  private:
   CodePool(const CodePool&) = delete;
   void operator =(const CodePool&) = delete;
@@ -49,6 +97,11 @@ class CodePool : public ke::Refcounted<CodePool>
   uint8_t* ptr_;
   uint8_t* end_;
   size_t size_;
+  const void* group_;
+  RefPtr<CodeRegion> region_;
+
+  // Number of CodeChunks, copies included, pointing into the pool.
+  std::atomic<size_t> chunks_;
 };
 
 // Raw reference to allocated code.
@@ -62,7 +115,30 @@ struct CodeChunk
    : pool_(pool),
      address_(address),
      bytes_(bytes)
-  {}
+  {
+    retain();
+  }
+  CodeChunk(const CodeChunk& other)
+   : pool_(other.pool_),
+     address_(other.address_),
+     bytes_(other.bytes_)
+  {
+    retain();
+  }
+  ~CodeChunk() {
+    release();
+  }
+
+  CodeChunk& operator =(const CodeChunk& other) {
+    if (this == &other)
+      return *this;
+    release();
+    pool_ = other.pool_;
+    address_ = other.address_;
+    bytes_ = other.bytes_;
+    retain();
+    return *this;
+  }
 
   uint8_t* address() const {
     return address_;
@@ -71,24 +147,46 @@ struct CodeChunk
     return bytes_;
   }
 
+ private:
+  void retain() {
+    if (pool_)
+      pool_->chunks_.fetch_add(1, std::memory_order_relaxed);
+  }
+  void release() {
+    if (pool_)
+      pool_->chunks_.fetch_sub(1, std::memory_order_release);
+  }
+
  private:
   RefPtr<CodePool> pool_;
   uint8_t* address_;
   size_t bytes_;
 };
 
-// Manages CodePools.
+// Manages CodePools. Code allocated for a group, such as a plugin, is kept
+// in pools of its own, so that its methods sit next to each other and its
+// pools are released whole when it goes away. Pools whose chunks are all
+// freed are reused, or returned to the system.
 class CodeAllocator
 {
  public:
   CodeAllocator();
   ~CodeAllocator();
 
-  CodeChunk Allocate(size_t bytes);
+  CodeChunk Allocate(size_t bytes, const void* group = nullptr);
+
+  // Takes later pools out of one reservation of |bytes|, falling back to
+  // separate mappings once it is full.
+  bool ReserveRegion(size_t bytes);
+
+  // Stops placing code in the group's pools. They are freed along with their
+  // last chunk.
+  void ReleaseGroup(const void* group);
 
  private:
-  RefPtr<CodePool> newPool(size_t bytes);
-  RefPtr<CodePool> findPool(size_t bytes);
+  RefPtr<CodePool> newPool(size_t bytes, const void* group);
+  RefPtr<CodePool> findPool(size_t bytes, const void* group);
+  void cachePool(RefPtr<CodePool> pool);
   CodeChunk allocateInPool(RefPtr<CodePool> pool, size_t bytes);
 
  private:
@@ -97,6 +195,9 @@ class CodeAllocator
 
  private:
   Vector<RefPtr<CodePool>> cached_pools_;
+  // At most one pool per group, the one still being filled.
+  Vector<RefPtr<CodePool>> group_pools_;
+  RefPtr<CodeRegion> region_;
 };
 
 } // namespace sp
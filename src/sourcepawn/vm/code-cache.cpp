@@ -0,0 +1,582 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#include "code-cache.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#if defined(_WIN32)
+# include <Windows.h>
+#else
+# include <dlfcn.h>
+#endif
+#include "code-stubs.h"
+#include "compiled-function.h"
+#include "environment.h"
+#include "method-info.h"
+#include "plugin-context.h"
+#include "plugin-runtime.h"
+#include "md5/md5.h"
+#if defined(SP_HAS_JIT)
+# include "macro-assembler.h"
+#endif
+
+namespace sp {
+
+static const uint32_t kCacheMagic = 0x434a5053; // SPJC
+static const uint32_t kCacheVersion = 1;
+
+// What a relocated address points at. The index and delta of a relocation
+// are relative to it.
+enum class RelocKind : uint8_t {
+  Self,             // The code itself.
+  Module,           // The VM binary, i.e. its helpers and constants.
+  Environment,      // The Environment.
+  Context,          // The runtime's base context.
+  Runtime,          // The runtime.
+  NativeEntry,      // natives_[index].
+  NativeFunction,   // The function bound to natives_[index].
+  ReturnStub
+};
+
+struct Relocation {
+  uint32_t offset;
+  uint8_t kind;
+  uint8_t rel32;
+  uint16_t padding;
+  uint32_t index;
+  uint32_t delta;
+};
+
+struct RecordHeader {
+  uint32_t pcode_offset;
+  uint32_t mode;
+  uint64_t natives;
+  uint32_t code_length;
+  uint32_t num_relocs;
+  uint32_t num_edges;
+  uint32_t num_cips;
+  uint32_t num_breaks;
+};
+
+// Environment state that decides what the compiler emits.
+static const uint32_t kModeDebugBreaks      = 0x01;
+static const uint32_t kModePatchableBreaks  = 0x02;
+static const uint32_t kModeDataWatches      = 0x04;
+static const uint32_t kModeTracing          = 0x08;
+static const uint32_t kModeNativeRebinding  = 0x10;
+static const uint32_t kModeSSE              = 0x20;
+static const uint32_t kModeSSE2             = 0x40;
+static const uint32_t kModeHeapProfiling     = 0x80;
+
+// The base of the binary holding |address|, or 0 if there is none.
+static uintptr_t
+ModuleBaseOf(const void* address)
+{
+#if defined(_WIN32)
+  HMODULE module;
+  if (!GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+                          GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                          reinterpret_cast<LPCSTR>(address), &module))
+  {
+    return 0;
+  }
+  return uintptr_t(module);
+#else
+  Dl_info info;
+  if (!dladdr(address, &info))
+    return 0;
+  return uintptr_t(info.dli_fbase);
+#endif
+}
+
+// Hashes the binary holding |address|, so code is only ever reused by the
+// VM build that compiled it.
+static bool
+HashModuleOf(const void* address, uint8_t digest[16])
+{
+  char path[1024];
+#if defined(_WIN32)
+  HMODULE module = reinterpret_cast<HMODULE>(ModuleBaseOf(address));
+  DWORD length = GetModuleFileNameA(module, path, sizeof(path));
+  if (!module || !length || length >= sizeof(path))
+    return false;
+#else
+  Dl_info info;
+  if (!dladdr(address, &info) || !info.dli_fname)
+    return false;
+  snprintf(path, sizeof(path), "%s", info.dli_fname);
+#endif
+
+  FILE* fp = fopen(path, "rb");
+  if (!fp)
+    return false;
+
+  // Digests and closes the file.
+  MD5 md5(fp);
+  md5.raw_digest(digest);
+  return true;
+}
+
+// Whether the compiler calls the native directly, or replaces it with an
+// opcode. Same rule as the compiler, less native rebinding, which is part
+// of the mode.
+static bool
+IsFixedNative(const NativeEntry* native)
+{
+  return native->status == SP_NATIVE_BOUND &&
+         !(native->flags & (SP_NTVFLAG_EPHEMERAL|SP_NTVFLAG_OPTIONAL));
+}
+
+static uint64_t
+NativeFingerprint(PluginRuntime* rt)
+{
+  // FNV-1a, one step per native.
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < rt->image()->NumNatives(); i++)
+    hash = (hash ^ uint64_t(IsFixedNative(rt->NativeAt(i)))) * 1099511628211ull;
+  return hash;
+}
+
+template <typename T>
+static void
+Append(std::vector<uint8_t>* out, const T& value)
+{
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+  out->insert(out->end(), bytes, bytes + sizeof(T));
+}
+
+class RecordReader
+{
+ public:
+  RecordReader(const uint8_t* bytes, size_t length)
+   : pos_(bytes),
+     end_(bytes + length)
+  {}
+
+  template <typename T>
+  bool read(T* out) {
+    if (size_t(end_ - pos_) < sizeof(T))
+      return false;
+    memcpy(out, pos_, sizeof(T));
+    pos_ += sizeof(T);
+    return true;
+  }
+
+  const uint8_t* skip(size_t bytes) {
+    if (size_t(end_ - pos_) < bytes)
+      return nullptr;
+    const uint8_t* start = pos_;
+    pos_ += bytes;
+    return start;
+  }
+
+ private:
+  const uint8_t* pos_;
+  const uint8_t* end_;
+};
+
+CodeCache::CodeCache(Environment* env, const char* directory)
+ : env_(env),
+   directory_(directory),
+   module_base_(0)
+{
+  memset(build_id_, 0, sizeof(build_id_));
+}
+
+CodeCache::~CodeCache()
+{
+}
+
+bool
+CodeCache::Initialize()
+{
+  module_base_ = ModuleBaseOf(&kCacheMagic);
+  if (!module_base_)
+    return false;
+  if (!HashModuleOf(&kCacheMagic, build_id_))
+    return false;
+
+  if (!directory_.empty() && directory_.back() != '/' && directory_.back() != '\\')
+    directory_ += '/';
+  return true;
+}
+
+uint32_t
+CodeCache::modeFor(PluginRuntime* rt, const MethodInfo* method) const
+{
+  uint32_t mode = 0;
+  bool instrumented = rt->IsMethodDebugInstrumented(method);
+  if (instrumented)
+    mode |= kModeDebugBreaks;
+  if (env_->IsDebugBreakPatchable())
+    mode |= kModePatchableBreaks;
+  if (instrumented && rt->IsDataWatchInstrumented())
+    mode |= kModeDataWatches;
+  if (env_->IsFunctionTracingEnabled())
+    mode |= kModeTracing;
+  if (env_->IsNativeRebindingEnabled())
+    mode |= kModeNativeRebinding;
+  if (env_->IsHeapProfilingEnabled())
+    mode |= kModeHeapProfiling;
+#if defined(SP_HAS_JIT)
+  if (MacroAssembler::Features().sse)
+    mode |= kModeSSE;
+  if (MacroAssembler::Features().sse2)
+    mode |= kModeSSE2;
+#endif
+  return mode;
+}
+
+CodeCache::Image*
+CodeCache::imageFor(PluginRuntime* rt)
+{
+  auto iter = images_.find(rt);
+  if (iter != images_.end())
+    return iter->second.get();
+
+  // The whole image decides the code, down to native names and the heap
+  // size, so the file is named after all of it: the hash taken when the
+  // file was read, or an MD5 of what the runtime has without one.
+  char digest[33];
+  if (uint64_t hash = rt->image_hash()) {
+    snprintf(digest, sizeof(digest), "%016" PRIx64, hash);
+  } else {
+    MD5 md5;
+    const uint8_t* bytes;
+    size_t length;
+    if (rt->GetImageBuffer(&bytes, &length)) {
+      md5.update(bytes, (unsigned int)length);
+    } else {
+      md5.update(rt->code().bytes, (unsigned int)rt->code().length);
+      md5.update(rt->data().bytes, (unsigned int)rt->data().length);
+    }
+    md5.finalize();
+    md5.hex_digest(digest);
+  }
+
+  std::unique_ptr<Image> image = std::make_unique<Image>();
+  image->path = directory_ + digest + ".jit";
+  image->writable = readImage(image.get());
+
+  Image* result = image.get();
+  images_[rt] = std::move(image);
+  return result;
+}
+
+bool
+CodeCache::readImage(Image* image)
+{
+  if (FILE* fp = fopen(image->path.c_str(), "rb")) {
+    uint32_t magic, version;
+    uint8_t build_id[16];
+    bool current = fread(&magic, sizeof(magic), 1, fp) == 1 &&
+                   fread(&version, sizeof(version), 1, fp) == 1 &&
+                   fread(build_id, sizeof(build_id), 1, fp) == 1 &&
+                   magic == kCacheMagic &&
+                   version == kCacheVersion &&
+                   memcmp(build_id, build_id_, sizeof(build_id)) == 0;
+
+    // A record cut short, by a crash say, ends the file.
+    uint32_t length;
+    while (current && fread(&length, sizeof(length), 1, fp) == 1) {
+      std::vector<uint8_t> record(length);
+      if (length < sizeof(RecordHeader) || fread(record.data(), 1, length, fp) != length)
+        break;
+      RecordHeader header;
+      memcpy(&header, record.data(), sizeof(header));
+      image->records[header.pcode_offset] = std::move(record);
+    }
+    fclose(fp);
+
+    if (current)
+      return true;
+  }
+
+  // Missing, or written by another VM: start over.
+  FILE* fp = fopen(image->path.c_str(), "wb");
+  if (!fp)
+    return false;
+  bool ok = fwrite(&kCacheMagic, sizeof(kCacheMagic), 1, fp) == 1 &&
+            fwrite(&kCacheVersion, sizeof(kCacheVersion), 1, fp) == 1 &&
+            fwrite(build_id_, sizeof(build_id_), 1, fp) == 1;
+  return fclose(fp) == 0 && ok;
+}
+
+CompiledFunction*
+CodeCache::Load(PluginRuntime* rt, MethodInfo* method)
+{
+  Image* image = imageFor(rt);
+  auto iter = image->records.find(method->pcode_offset());
+  if (iter == image->records.end())
+    return nullptr;
+
+  RecordReader reader(iter->second.data(), iter->second.size());
+  RecordHeader header;
+  if (!reader.read(&header))
+    return nullptr;
+  if (header.mode != modeFor(rt, method) || header.natives != NativeFingerprint(rt))
+    return nullptr;
+
+  const uint8_t* code = reader.skip(header.code_length);
+  if (!code || !header.code_length)
+    return nullptr;
+
+  // Resolve everything before allocating anything. Targets in the code
+  // itself are resolved once it has an address.
+  struct Patch {
+    uint32_t offset;
+    uintptr_t target;
+    bool rel32;
+    bool self;
+  };
+  std::vector<Patch> patches;
+  for (uint32_t i = 0; i < header.num_relocs; i++) {
+    Relocation reloc;
+    if (!reader.read(&reloc))
+      return nullptr;
+    if (reloc.offset < sizeof(uint32_t) || reloc.offset > header.code_length)
+      return nullptr;
+
+    uintptr_t target;
+    switch (RelocKind(reloc.kind)) {
+      case RelocKind::Self:
+        if (reloc.delta >= header.code_length)
+          return nullptr;
+        target = reloc.delta;
+        break;
+      case RelocKind::Module:
+        target = module_base_ + reloc.delta;
+        break;
+      case RelocKind::Environment:
+        target = uintptr_t(env_) + reloc.delta;
+        break;
+      case RelocKind::Context:
+        target = uintptr_t(rt->GetBaseContext()) + reloc.delta;
+        break;
+      case RelocKind::Runtime:
+        target = uintptr_t(rt) + reloc.delta;
+        break;
+      case RelocKind::NativeEntry:
+        if (reloc.index >= rt->image()->NumNatives())
+          return nullptr;
+        target = uintptr_t(rt->NativeAt(reloc.index)) + reloc.delta;
+        break;
+      case RelocKind::NativeFunction:
+        if (reloc.index >= rt->image()->NumNatives() ||
+            !IsFixedNative(rt->NativeAt(reloc.index)))
+        {
+          return nullptr;
+        }
+        target = uintptr_t(rt->NativeAt(reloc.index)->legacy_fn);
+        break;
+      case RelocKind::ReturnStub:
+        target = uintptr_t(env_->stubs()->ReturnStub());
+        break;
+      default:
+        return nullptr;
+    }
+    patches.push_back(Patch{reloc.offset, target, !!reloc.rel32,
+                            RelocKind(reloc.kind) == RelocKind::Self});
+  }
+
+  AutoPtr<FixedArray<LoopEdge>> edges(new FixedArray<LoopEdge>(header.num_edges));
+  for (uint32_t i = 0; i < header.num_edges; i++) {
+    if (!reader.read(&edges->at(i)) || edges->at(i).offset > header.code_length)
+      return nullptr;
+  }
+  // Entries were written in pc order; anything else is a corrupt record.
+  AutoPtr<DeltaTable> cipmap(new DeltaTable());
+  for (uint32_t i = 0, last_pcoffs = 0; i < header.num_cips; i++) {
+    CipMapEntry entry;
+    if (!reader.read(&entry) || entry.pcoffs < last_pcoffs || entry.pcoffs > header.code_length)
+      return nullptr;
+    cipmap->append(entry.pcoffs, entry.cipoffs);
+    last_pcoffs = entry.pcoffs;
+  }
+  cipmap->shrink();
+  AutoPtr<FixedArray<DebugBreakSite>> break_sites(
+    new FixedArray<DebugBreakSite>(header.num_breaks));
+  for (uint32_t i = 0; i < header.num_breaks; i++) {
+    DebugBreakSite& site = break_sites->at(i);
+    if (!reader.read(&site.offset) || !reader.read(&site.cipoffs) ||
+        !reader.read(&site.disp32) || site.offset > header.code_length)
+    {
+      return nullptr;
+    }
+    site.armed = false;
+  }
+
+  CodeChunk chunk = env_->AllocateCode(header.code_length, rt);
+  if (!chunk.address())
+    return nullptr;
+
+  uint8_t* base = chunk.address();
+  memcpy(base, code, header.code_length);
+  for (const Patch& patch : patches) {
+    uint8_t* field = base + patch.offset;
+    uintptr_t target = patch.self ? uintptr_t(base) + patch.target : patch.target;
+    *reinterpret_cast<uint32_t*>(field - 4) = patch.rel32
+                                              ? uint32_t(target - uintptr_t(field))
+                                              : uint32_t(target);
+  }
+
+  // Call sites aren't kept, so loaded code links its calls one call at a
+  // time, each when it is first made.
+  return new CompiledFunction(chunk, method->pcode_offset(), edges.take(), cipmap.take(),
+                              break_sites.take(), new FixedArray<CallThunkSite>(0),
+                              !!(header.mode & kModeDebugBreaks));
+}
+
+void
+CodeCache::Store(PluginRuntime* rt, MethodInfo* method, CompiledFunction* fun,
+                 const CodeReferences& refs)
+{
+  Image* image = imageFor(rt);
+  if (!image->writable)
+    return;
+
+  const uint8_t* base = reinterpret_cast<const uint8_t*>(fun->GetEntryAddress());
+  auto fieldAt = [base](uint32_t offset) -> uintptr_t {
+    return *reinterpret_cast<const uint32_t*>(base + offset - 4);
+  };
+
+  std::vector<Relocation> relocs;
+  auto add = [&](uint32_t offset, RelocKind kind, bool rel32, uint32_t index,
+                 uintptr_t delta) -> void {
+    Relocation reloc = {};
+    reloc.offset = offset;
+    reloc.kind = uint8_t(kind);
+    reloc.rel32 = rel32;
+    reloc.index = index;
+    reloc.delta = uint32_t(delta);
+    relocs.push_back(reloc);
+  };
+
+  // Anything the code points at must be found again in the next process.
+  uintptr_t env = uintptr_t(env_);
+  uintptr_t cx = uintptr_t(rt->GetBaseContext());
+  uintptr_t self = uintptr_t(rt);
+  size_t num_natives = rt->image()->NumNatives();
+  uintptr_t natives = num_natives ? uintptr_t(rt->NativeAt(0)) : 0;
+  auto classify = [&](uint32_t offset, uintptr_t target, bool rel32) -> bool {
+    if (target - env < sizeof(Environment)) {
+      add(offset, RelocKind::Environment, rel32, 0, target - env);
+      return true;
+    }
+    if (target - cx < sizeof(PluginContext)) {
+      add(offset, RelocKind::Context, rel32, 0, target - cx);
+      return true;
+    }
+    if (target - self < sizeof(PluginRuntime)) {
+      add(offset, RelocKind::Runtime, rel32, 0, target - self);
+      return true;
+    }
+    if (num_natives && target - natives < num_natives * sizeof(NativeEntry)) {
+      uintptr_t index = (target - natives) / sizeof(NativeEntry);
+      add(offset, RelocKind::NativeEntry, rel32, uint32_t(index),
+          target - uintptr_t(rt->NativeAt(index)));
+      return true;
+    }
+    if (target == uintptr_t(env_->stubs()->ReturnStub())) {
+      add(offset, RelocKind::ReturnStub, rel32, 0, 0);
+      return true;
+    }
+
+    // Natives are looked up by index, so the function must be bound to
+    // exactly one.
+    size_t found = num_natives;
+    for (size_t i = 0; i < num_natives; i++) {
+      if (uintptr_t(rt->NativeAt(i)->legacy_fn) != target)
+        continue;
+      if (found != num_natives)
+        return false;
+      found = i;
+    }
+    if (found != num_natives) {
+      add(offset, RelocKind::NativeFunction, rel32, uint32_t(found), 0);
+      return true;
+    }
+
+    if (ModuleBaseOf(reinterpret_cast<const void*>(target)) == module_base_) {
+      add(offset, RelocKind::Module, rel32, 0, target - module_base_);
+      return true;
+    }
+    return false;
+  };
+
+  for (size_t i = 0; i < refs.local->length(); i++) {
+    uint32_t offset = refs.local->at(i);
+    add(offset, RelocKind::Self, false, 0, fieldAt(offset) - uintptr_t(base));
+  }
+  for (size_t i = 0; i < refs.external->length(); i++) {
+    uint32_t offset = refs.external->at(i);
+    uintptr_t target = uintptr_t(base) + offset + fieldAt(offset);
+    if (!classify(offset, target, true))
+      return;
+  }
+  for (size_t i = 0; i < refs.absolute->length(); i++) {
+    uint32_t offset = refs.absolute->at(i);
+    if (!classify(offset, fieldAt(offset), false))
+      return;
+  }
+
+  RecordHeader header = {};
+  header.pcode_offset = method->pcode_offset();
+  header.mode = modeFor(rt, method);
+  header.natives = NativeFingerprint(rt);
+
+  // Debug breaks were switched on or off while the method was compiled.
+  if (!!(header.mode & kModeDebugBreaks) != fun->IsDebugInstrumented())
+    return;
+  header.code_length = refs.length;
+  header.num_relocs = uint32_t(relocs.size());
+  header.num_edges = fun->NumLoopEdges();
+  header.num_cips = uint32_t(fun->GetCipMap().size());
+  header.num_breaks = fun->NumDebugBreakSites();
+
+  std::vector<uint8_t> record;
+  Append(&record, header);
+  record.insert(record.end(), base, base + refs.length);
+  for (const Relocation& reloc : relocs)
+    Append(&record, reloc);
+  for (uint32_t i = 0; i < header.num_edges; i++)
+    Append(&record, fun->GetLoopEdge(i));
+  fun->GetCipMap().forEach([&record](uint32_t pcoffs, uint32_t cipoffs) {
+    Append(&record, CipMapEntry{cipoffs, pcoffs});
+  });
+  for (uint32_t i = 0; i < header.num_breaks; i++) {
+    const DebugBreakSite& site = fun->GetDebugBreakSite(i);
+    Append(&record, site.offset);
+    Append(&record, site.cipoffs);
+    Append(&record, site.disp32);
+  }
+
+  FILE* fp = fopen(image->path.c_str(), "ab");
+  if (!fp) {
+    image->writable = false;
+    return;
+  }
+  uint32_t length = uint32_t(record.size());
+  bool ok = fwrite(&length, sizeof(length), 1, fp) == 1 &&
+            fwrite(record.data(), 1, record.size(), fp) == record.size();
+  if (fclose(fp) != 0 || !ok)
+    image->writable = false;
+}
+
+void
+CodeCache::Forget(PluginRuntime* rt)
+{
+  images_.erase(rt);
+}
+
+} // namespace sp
@@ -0,0 +1,93 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#ifndef _include_sourcepawn_vm_code_cache_h_
+#define _include_sourcepawn_vm_code_cache_h_
+
+#include <stdint.h>
+#include <am-vector.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace sp {
+
+class CompiledFunction;
+class Environment;
+class MethodInfo;
+class PluginRuntime;
+
+// The addresses the assembler wrote into a method's code. Each list holds
+// offsets just past a 32-bit field.
+struct CodeReferences
+{
+  uint32_t length;
+  // abs32 fields pointing into the code itself.
+  const ke::Vector<uint32_t>* local;
+  // rel32 fields pointing at code outside it.
+  const ke::Vector<uint32_t>* external;
+  // abs32 fields pointing at anything outside it.
+  const ke::Vector<uint32_t>* absolute;
+};
+
+// Compiled methods kept on disk across restarts, one file per plugin image
+// in a directory given by the host. A file is named after the image's hash
+// and only trusted by the VM binary that wrote it. Each method is stored
+// with the state its code depends on: the debug break mode, and which
+// natives were bound when it was compiled. Addresses in the code are
+// stored relative to what they point at and relocated on load, and code
+// that points anywhere else is not stored.
+//
+// Every method is called with the environment's compile lock held.
+class CodeCache
+{
+ public:
+  CodeCache(Environment* env, const char* directory);
+  ~CodeCache();
+
+  bool Initialize();
+
+  // Code for the method in this process, or null if none was stored for
+  // the current state.
+  CompiledFunction* Load(PluginRuntime* rt, MethodInfo* method);
+
+  // Saves freshly compiled code that has not been linked in yet.
+  void Store(PluginRuntime* rt, MethodInfo* method, CompiledFunction* fun,
+             const CodeReferences& refs);
+
+  // Drops what is known about an unloading runtime.
+  void Forget(PluginRuntime* rt);
+
+ private:
+  struct Image {
+    std::string path;
+    bool writable;
+    // Stored methods by pcode offset. The last one stored wins.
+    std::unordered_map<uint32_t, std::vector<uint8_t>> records;
+  };
+
+  Image* imageFor(PluginRuntime* rt);
+  bool readImage(Image* image);
+  uint32_t modeFor(PluginRuntime* rt, const MethodInfo* method) const;
+
+ private:
+  Environment* env_;
+  std::string directory_;
+  uint8_t build_id_[16];
+  uintptr_t module_base_;
+  std::unordered_map<PluginRuntime*, std::unique_ptr<Image>> images_;
+};
+
+} // namespace sp
+
+#endif // _include_sourcepawn_vm_code_cache_h_
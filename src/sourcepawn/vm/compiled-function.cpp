@@ -19,12 +19,17 @@ using namespace sp;
 CompiledFunction::CompiledFunction(const CodeChunk& code,
                                    cell_t pcode_offs,
                                    FixedArray<LoopEdge>* edges,
-                                   FixedArray<CipMapEntry>* cipmap)
+                                   DeltaTable* cipmap,
+                                   FixedArray<DebugBreakSite>* break_sites,
+                                   FixedArray<CallThunkSite>* call_sites,
+                                   bool debug_instrumented)
  : code_(code),
    code_offset_(pcode_offs),
    edges_(edges),
    cip_map_(cipmap),
-   cip_map_sorted_(false)
+   break_sites_(break_sites),
+   call_sites_(call_sites),
+   debug_instrumented_(debug_instrumented)
 {
 }
 
@@ -32,28 +37,6 @@ CompiledFunction::~CompiledFunction()
 {
 }
 
-static int cip_map_entry_sort_cmp(const void* a1, const void* a2)
-{
-  const CipMapEntry* c1 = reinterpret_cast<const CipMapEntry*>(a1);
-  const CipMapEntry* c2 = reinterpret_cast<const CipMapEntry*>(a2);
-  if (c1->pcoffs < c2->pcoffs)
-    return -1;
-  if (c1->pcoffs == c2->pcoffs)
-    return 0;
-  return 1;
-}
-
-static int cip_map_entry_cmp(const void* a1, const void* aEntry)
-{
-  uint32_t pcoffs = (uint32_t)(intptr_t)a1;
-  const CipMapEntry* entry = reinterpret_cast<const CipMapEntry*>(aEntry);
-  if (pcoffs < entry->pcoffs)
-    return -1;
-  if (pcoffs == entry->pcoffs)
-    return 0;
-  return pcoffs > entry->pcoffs;
-}
-
 ucell_t
 CompiledFunction::FindCipByPc(void* pc)
 {
@@ -64,26 +47,12 @@ CompiledFunction::FindCipByPc(void* pc)
   if (pcoffs > code_.bytes())
     return kInvalidCip;
 
-  if (!cip_map_sorted_) {
-    qsort(cip_map_->buffer(),
-          cip_map_->length(),
-          sizeof(CipMapEntry),
-          cip_map_entry_sort_cmp);
-    cip_map_sorted_ = true;
-  }
-
-  void* ptr = bsearch(
-    (void*)(uintptr_t)pcoffs,
-    cip_map_->buffer(),
-    cip_map_->length(),
-    sizeof(CipMapEntry),
-    cip_map_entry_cmp);
-  assert(ptr);
-
-  if (!ptr) {
+  uint32_t found_pcoffs, cipoffs;
+  if (!cip_map_->lowerBound(pcoffs, &found_pcoffs, &cipoffs) || found_pcoffs != pcoffs) {
     // Shouldn't happen, but fail gracefully.
+    assert(false);
     return kInvalidCip;
   }
 
-  return code_offset_ + reinterpret_cast<CipMapEntry*>(ptr)->cipoffs;
+  return code_offset_ + cipoffs;
 }
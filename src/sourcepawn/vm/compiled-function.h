@@ -18,6 +18,7 @@
 #include <amtl/am-fixedarray.h>
 #include <amtl/am-refcounting.h>
 #include "code-allocator.h"
+#include "delta-table.h"
 
 namespace sp {
 
@@ -35,6 +36,32 @@ struct LoopEdge
   int32_t disp32;
 };
 
+// Size of a patchable debug break site: a call rel32, or a nop of the same
+// length when the site is disarmed.
+static const size_t kDebugBreakSiteSize = 5;
+
+struct DebugBreakSite
+{
+  // Offset to the end of the patchable site, such that
+  // (base + offset - kDebugBreakSiteSize) yields the start of the site.
+  uint32_t offset;
+  // Offset of the BREAK instruction from the first cip of the function.
+  uint32_t cipoffs;
+  // The displacement to the debug break thunk, used when the site is armed.
+  int32_t disp32;
+  // Whether the site currently calls the debug break thunk.
+  bool armed;
+};
+
+struct CallThunkSite
+{
+  // Offset to the end of a call to a call thunk, such that
+  // (base + offset - 4) yields its patchable displacement.
+  uint32_t offset;
+  // The pcode offset of the function it calls.
+  cell_t pcode_offs;
+};
+
 struct CipMapEntry {
   // Offset from the first cip of the function.
   uint32_t cipoffs;
@@ -50,7 +77,10 @@ class CompiledFunction
   CompiledFunction(const CodeChunk& code,
                    cell_t pcode_offs,
                    FixedArray<LoopEdge>* edges,
-                   FixedArray<CipMapEntry>* cip_map);
+                   DeltaTable* cip_map,
+                   FixedArray<DebugBreakSite>* break_sites,
+                   FixedArray<CallThunkSite>* call_sites,
+                   bool debug_instrumented);
   ~CompiledFunction();
 
  public:
@@ -66,6 +96,26 @@ class CompiledFunction
   LoopEdge& GetLoopEdge(size_t i) {
     return edges_->at(i);
   }
+  uint32_t NumDebugBreakSites() const {
+    return break_sites_->length();
+  }
+  DebugBreakSite& GetDebugBreakSite(size_t i) {
+    return break_sites_->at(i);
+  }
+  uint32_t NumCallThunkSites() const {
+    return call_sites_->length();
+  }
+  const CallThunkSite& GetCallThunkSite(size_t i) const {
+    return call_sites_->at(i);
+  }
+  // Return addresses mapped to their cip offsets, keyed by pc offset.
+  const DeltaTable& GetCipMap() const {
+    return *cip_map_;
+  }
+  // Whether the code has debug breaks and data watches compiled in.
+  bool IsDebugInstrumented() const {
+    return debug_instrumented_;
+  }
 
   ucell_t FindCipByPc(void* pc);
 
@@ -73,8 +123,10 @@ class CompiledFunction
   CodeChunk code_;
   cell_t code_offset_;
   AutoPtr<FixedArray<LoopEdge>> edges_;
-  AutoPtr<FixedArray<CipMapEntry>> cip_map_;
-  bool cip_map_sorted_;
+  AutoPtr<DeltaTable> cip_map_;
+  AutoPtr<FixedArray<DebugBreakSite>> break_sites_;
+  AutoPtr<FixedArray<CallThunkSite>> call_sites_;
+  bool debug_instrumented_;
 };
 
 }
@@ -736,10 +736,7 @@ Debugger::HandleFunctionListCmd()
 
   // Run through all functions with a name and 
   // print it including the filename where it's defined.
-  SmxV1Image::SymbolIterator iter = imagev1->symboliterator();
-  while (!iter.Done()) {
-    const SmxV1Image::Symbol sym = iter.Next();
-
+  imagev1->forEachSymbol(false, [&](const SmxV1Image::Symbol& sym) {
     if (sym.ident() == sp::IDENT_FUNCTION &&
       imagev1->GetDebugName(sym.name()) != nullptr)
     {
@@ -750,7 +747,7 @@ Debugger::HandleFunctionListCmd()
       }
       fputs("\n", stdout);
     }
-  }
+  });
 }
 
 void
@@ -888,27 +885,24 @@ Debugger::HandleVariableDisplayCmd(char *params)
 
   if (*params == '\0') {
     // Display all variables that are in scope
-    SmxV1Image::SymbolIterator iter = imagev1->symboliterator();
-    while (!iter.Done()) {
-      ke::AutoPtr<SmxV1Image::Symbol> sym;
-      sym = iter.Next();
-
+    imagev1->forEachSymbol(false, [&](const SmxV1Image::Symbol& entry) {
       // Only variables in scope.
-      if (sym->ident() != sp::IDENT_FUNCTION &&
-        sym->codestart() <= (uint32_t)cip_ &&
-        sym->codeend() >= (uint32_t)cip_)
+      if (entry.ident() != sp::IDENT_FUNCTION &&
+        entry.codestart() <= (uint32_t)cip_ &&
+        entry.codeend() >= (uint32_t)cip_)
       {
+        SmxV1Image::Symbol sym(entry);
         // Print the name and address
-        printf("%s\t<%#8x>\t", (sym->vclass() & DISP_MASK) > 0 ? "loc" : "glb", (sym->vclass() & DISP_MASK) > 0 ? frm_ + sym->addr() : sym->addr());
-        if (imagev1->GetDebugName(sym->name()) != nullptr) {
-          printf("%s\t", imagev1->GetDebugName(sym->name()));
+        printf("%s\t<%#8x>\t", (sym.vclass() & DISP_MASK) > 0 ? "loc" : "glb", (sym.vclass() & DISP_MASK) > 0 ? frm_ + sym.addr() : sym.addr());
+        if (imagev1->GetDebugName(sym.name()) != nullptr) {
+          printf("%s\t", imagev1->GetDebugName(sym.name()));
         }
 
         // Print the value.
-        DisplayVariable(sym, idx, 0);
+        DisplayVariable(&sym, idx, 0);
         fputs("\n", stdout);
       }
-    }
+    });
   }
   // Display a single variable with the given name.
   else {
@@ -13,22 +13,16 @@
 #include "debugging.h"
 #include "stack-frames.h"
 #include "environment.h"
+#include "plugin-runtime.h"
 #include "watchdog_timer.h"
 #include <amtl/am-raii.h>
 
 namespace sp {
 
-void InvokeDebugger(PluginContext* ctx, const IErrorReport* report)
+static void
+CallDebugBreakHandler(PluginContext* ctx, const IErrorReport* report, uint32_t flags,
+                      ucell_t addr, ucell_t size)
 {
-  // Continue normal execution, if there is no listener registered.
-  if (!Environment::get()->debugbreak())
-    return;
-
-  if (!ctx->IsDebugging()) {
-    ctx->ReportErrorNumber(SP_ERROR_NOTDEBUGGING);
-    return;
-  }
-
   cell_t cip = 0;
 
   // Find first scripted frame on the stack to get the cip from.
@@ -43,6 +37,9 @@ void InvokeDebugger(PluginContext* ctx, const IErrorReport* report)
     }
   }
 
+  // Orders breaks among the function entries and exits around them.
+  Environment::get()->TraceFunction(ctx, cip, SP_TRACE_BREAK);
+
   // Tell the watchdog to take a break.
   // We might stay in the debugger callback for a while,
   // so don't let the watchdog hit immediately after
@@ -54,9 +51,40 @@ void InvokeDebugger(PluginContext* ctx, const IErrorReport* report)
   dbginfo.version = DEBUG_BREAK_INFO_VERSION;
   dbginfo.cip = cip;
   dbginfo.frm = ctx->frm();
+  dbginfo.flags = flags;
+  dbginfo.addr = addr;
+  dbginfo.size = size;
 
   // Call debug callback.
   Environment::get()->debugbreak()(ctx, dbginfo, report);
 }
 
+void InvokeDebugger(PluginContext* ctx, const IErrorReport* report)
+{
+  // Continue normal execution, if there is no listener registered.
+  if (!Environment::get()->debugbreak())
+    return;
+
+  if (!ctx->IsDebugging()) {
+    ctx->ReportErrorNumber(SP_ERROR_NOTDEBUGGING);
+    return;
+  }
+
+  CallDebugBreakHandler(ctx, report, 0, 0, 0);
+}
+
+int InvokeDataWatch(PluginContext* ctx, ucell_t addr, ucell_t size)
+{
+  // The window is only the hull of the watched ranges.
+  if (!ctx->runtime()->IsDataWatched(addr, size))
+    return SP_ERROR_NONE;
+  if (!Environment::get()->debugbreak())
+    return SP_ERROR_NONE;
+  if (!ctx->IsDebugging())
+    return SP_ERROR_NOTDEBUGGING;
+
+  CallDebugBreakHandler(ctx, nullptr, SP_DEBUG_BREAK_DATAWATCH, addr, size);
+  return SP_ERROR_NONE;
+}
+
 } // namespace sp
@@ -24,6 +24,10 @@ namespace sp {
 
 void InvokeDebugger(PluginContext* ctx, const IErrorReport* report);
 
+// Called after a store of |size| bytes at |addr| hit the plugin's data watch
+// window. Breaks into the debugger if the store touched a watched range.
+int InvokeDataWatch(PluginContext* ctx, ucell_t addr, ucell_t size);
+
 } // namespace sp
 
 #endif // _include_sourcepawn_vm_debugging_h_
\ No newline at end of file
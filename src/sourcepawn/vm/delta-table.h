@@ -0,0 +1,170 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2004-2015 AlliedModers LLC
+//
+// This file is part of SourcePawn. SourcePawn is licensed under the GNU
+// General Public License, version 3.0 (GPL). If a copy of the GPL was not
+// provided with this file, you can obtain it here:
+//   http://www.gnu.org/licenses/gpl.html
+//
+#ifndef _include_sourcepawn_delta_table_h_
+#define _include_sourcepawn_delta_table_h_
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+namespace sp {
+
+// A sorted table of (key, value) pairs, stored as varint deltas in blocks of
+// kBlockSize entries. Each block's first entry is kept whole in a skip index,
+// so a lookup is a binary search over the blocks and then a decode of at
+// most one block. Keys must be appended in non-decreasing order; values may
+// go either way.
+class DeltaTable
+{
+ public:
+  static const uint32_t kBlockSize = 16;
+
+  void append(uint32_t key, uint32_t value) {
+    assert(!count_ || key >= last_key_);
+    if (count_ % kBlockSize == 0) {
+      blocks_.push_back(Block{key, value, uint32_t(bytes_.size())});
+    } else {
+      putVarint(key - last_key_);
+      int32_t delta = int32_t(value - last_value_);
+      putVarint((uint32_t(delta) << 1) ^ uint32_t(delta >> 31));
+    }
+    last_key_ = key;
+    last_value_ = value;
+    count_++;
+  }
+
+  // Call once all entries are appended, to drop the slack from growing.
+  void shrink() {
+    blocks_.shrink_to_fit();
+    bytes_.shrink_to_fit();
+  }
+
+  size_t size() const {
+    return count_;
+  }
+
+  // The first entry whose key is at least |key|.
+  bool lowerBound(uint32_t key, uint32_t* found_key, uint32_t* value) const {
+    auto block = std::lower_bound(blocks_.begin(), blocks_.end(), key,
+                                  [](const Block& b, uint32_t key) {
+                                    return b.key < key;
+                                  });
+    // Entries equal to |key| may start in the block before.
+    if (block != blocks_.begin()) {
+      Cursor cursor(this, block - 1 - blocks_.begin());
+      do {
+        if (cursor.key >= key) {
+          *found_key = cursor.key;
+          *value = cursor.value;
+          return true;
+        }
+      } while (cursor.next());
+    }
+    if (block == blocks_.end())
+      return false;
+    *found_key = block->key;
+    *value = block->value;
+    return true;
+  }
+
+  // The last entry whose key is at most |key|.
+  bool floor(uint32_t key, uint32_t* found_key, uint32_t* value) const {
+    auto block = std::upper_bound(blocks_.begin(), blocks_.end(), key,
+                                  [](uint32_t key, const Block& b) {
+                                    return key < b.key;
+                                  });
+    if (block == blocks_.begin())
+      return false;
+    Cursor cursor(this, block - 1 - blocks_.begin());
+    do {
+      *found_key = cursor.key;
+      *value = cursor.value;
+    } while (cursor.next() && cursor.key <= key);
+    return true;
+  }
+
+  // Calls |fn(key, value)| for every entry, in key order.
+  template <typename Func>
+  void forEach(Func&& fn) const {
+    for (size_t block = 0; block < blocks_.size(); block++) {
+      Cursor cursor(this, block);
+      do {
+        fn(cursor.key, cursor.value);
+      } while (cursor.next());
+    }
+  }
+
+  // Heap bytes held by the table.
+  size_t memoryUsage() const {
+    return blocks_.capacity() * sizeof(Block) + bytes_.capacity();
+  }
+
+ private:
+  struct Block {
+    uint32_t key;
+    uint32_t value;
+    // Where the deltas of the block's remaining entries start in bytes_.
+    uint32_t offset;
+  };
+
+  // Walks the entries of one block.
+  struct Cursor {
+    Cursor(const DeltaTable* table, size_t block)
+     : key(table->blocks_[block].key),
+       value(table->blocks_[block].value),
+       pos(table->bytes_.data() + table->blocks_[block].offset),
+       left(std::min<size_t>(kBlockSize, table->count_ - block * kBlockSize) - 1)
+    {}
+    bool next() {
+      if (!left)
+        return false;
+      left--;
+      key += getVarint();
+      uint32_t zigzag = getVarint();
+      value += (zigzag >> 1) ^ (0 - (zigzag & 1));
+      return true;
+    }
+    uint32_t getVarint() {
+      uint32_t result = 0;
+      for (int shift = 0;; shift += 7) {
+        uint8_t b = *pos++;
+        result |= uint32_t(b & 0x7f) << shift;
+        if (!(b & 0x80))
+          return result;
+      }
+    }
+
+    uint32_t key;
+    uint32_t value;
+    const uint8_t* pos;
+    size_t left;
+  };
+
+  void putVarint(uint32_t value) {
+    while (value >= 0x80) {
+      bytes_.push_back(uint8_t(value) | 0x80);
+      value >>= 7;
+    }
+    bytes_.push_back(uint8_t(value));
+  }
+
+ private:
+  std::vector<Block> blocks_;
+  std::vector<uint8_t> bytes_;
+  uint32_t count_ = 0;
+  uint32_t last_key_ = 0;
+  uint32_t last_value_ = 0;
+};
+
+} // namespace sp
+
+#endif // _include_sourcepawn_delta_table_h_
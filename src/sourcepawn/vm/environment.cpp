@@ -13,6 +13,9 @@
 #include "environment.h"
 #include "watchdog_timer.h"
 #include "api.h"
+#include "background-compiler.h"
+#include "code-cache.h"
+#include "plugin-loader.h"
 #include "watchdog_timer.h"
 #include "plugin-context.h"
 #include "pool-allocator.h"
@@ -26,6 +29,9 @@
 #include "builtins.h"
 #include "debugging.h"
 #include <stdarg.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
 
 using namespace sp;
 using namespace SourcePawn;
@@ -34,7 +40,29 @@ static Environment* sEnvironment = nullptr;
 
 Environment::Environment()
  : debug_break_enabled_(false),
+   debug_break_patchable_(false),
+   method_debug_breaks_(false),
+   debug_breaks_active_(true),
+   data_watch_enabled_(false),
+   trace_enabled_(false),
+   native_rebinding_(false),
+   opcode_pair_stats_(false),
+   cpu_accounting_(false),
+   cpu_charged_at_(0),
+   verify_threads_(0),
+   jumps_patched_(false),
+   trace_active_(0),
+   trace_storage_(nullptr),
+   trace_ring_(),
+   debug_break_filter_(nullptr),
+   invoke_listener_(nullptr),
+   public_entry_listener_(nullptr),
    debug_break_handler_(nullptr),
+   heap_listener_(nullptr),
+   heap_hooks_(false),
+   heap_sample_interval_(0),
+   heap_sampling_active_(0),
+   heap_sample_left_(0),
    debugger_(nullptr),
    eh_top_(nullptr),
    exception_code_(SP_ERROR_NONE),
@@ -86,6 +114,7 @@ Environment::Initialize()
   builtins_ = new BuiltinNatives();
   code_alloc_ = new CodeAllocator();
   code_stubs_ = new CodeStubs(this);
+  loader_ = new PluginLoader();
 
   // Safe to initialize code now that we have the code cache.
   if (!code_stubs_->Initialize())
@@ -99,7 +128,15 @@ Environment::Initialize()
 void
 Environment::Shutdown()
 {
+  // Unclaimed runtimes go before anything they use.
+  loader_->Shutdown();
+  loader_ = nullptr;
   watchdog_timer_->Shutdown();
+  if (background_compiler_) {
+    background_compiler_->Shutdown();
+    background_compiler_ = nullptr;
+  }
+  code_cache_ = nullptr;
   builtins_ = nullptr;
   code_stubs_ = nullptr;
   code_alloc_ = nullptr;
@@ -126,6 +163,428 @@ Environment::EnableDebugBreak()
   return true;
 }
 
+bool
+Environment::EnablePatchableDebugBreak()
+{
+  if (!EnableDebugBreak())
+    return false;
+
+  debug_break_patchable_ = true;
+  return true;
+}
+
+bool
+Environment::EnableMethodDebugBreaks()
+{
+  // Methods already compiled never looked at their own break sites.
+  if (!debug_break_patchable_ || !runtimes_.empty())
+    return false;
+
+  method_debug_breaks_ = true;
+  return true;
+}
+
+void
+Environment::RecompileForDebugging(PluginRuntime* rt, const std::vector<RefPtr<MethodInfo>>& methods)
+{
+#if defined(SP_HAS_JIT)
+  if (!jit_enabled_)
+    return;
+
+  // Installing the new code sends calls linked to the old entry on to it.
+  // Should compiling fail, the old code keeps running without breaks.
+  for (const auto& method : methods) {
+    int err;
+    if (method->stale())
+      CompilerBase::Compile(rt->GetBaseContext(), method, &err);
+  }
+#endif
+}
+
+void
+Environment::SetDebugBreaksActive(bool active)
+{
+  if (debug_break_enabled_)
+    debug_breaks_active_.store(active, std::memory_order_relaxed);
+}
+
+bool
+Environment::EnableParallelVerification(size_t threads)
+{
+  if (!runtimes_.empty() || threads > 16)
+    return false;
+
+  verify_threads_ = threads;
+  return true;
+}
+
+bool
+Environment::PreloadBinaries(const char* const* files, size_t count, size_t threads)
+{
+  if (!threads || threads > 16)
+    return false;
+  return loader_->Start(files, count, threads);
+}
+
+bool
+Environment::GetMemoryUsage(IPluginContext* ctx, sp_memory_usage_t* usage)
+{
+  PluginContext* cx = static_cast<PluginRuntime*>(ctx->GetRuntime())->GetBaseContext();
+  if (!cx)
+    return false;
+
+  usage->data = uint32_t(cx->DataSize());
+  usage->heap_stack = uint32_t(cx->HeapSize() - cx->DataSize());
+  usage->heap = uint32_t(cx->hp() - cell_t(cx->DataSize()));
+  usage->stack = uint32_t(cx->stp() - cx->sp());
+  return true;
+}
+
+bool
+Environment::GetMemoryPeaks(IPluginContext* ctx, sp_memory_usage_t* peaks, bool reset)
+{
+  PluginContext* cx = static_cast<PluginRuntime*>(ctx->GetRuntime())->GetBaseContext();
+  if (!cx || cx->IsInExec())
+    return false;
+
+  cell_t data = cell_t(cx->DataSize());
+  cell_t top = cell_t(cx->HeapSize());
+  if (cx->hp() != data || cx->sp() != cx->stp())
+    return false;
+
+  // The heap grows up from |data| and the stack down from |top|; the
+  // longest run of zero cells between them is taken to be the gap that
+  // neither has reached.
+  const cell_t* cells = reinterpret_cast<const cell_t*>(cx->memory());
+  cell_t first = data / cell_t(sizeof(cell_t));
+  cell_t end = top / cell_t(sizeof(cell_t));
+  cell_t gap_start = first, gap_end = first;
+  cell_t run_start = first;
+  for (cell_t i = first; i <= end; i++) {
+    if (i < end && !cells[i])
+      continue;
+    if (i - run_start > gap_end - gap_start) {
+      gap_start = run_start;
+      gap_end = i;
+    }
+    run_start = i + 1;
+  }
+  if (gap_end == gap_start)
+    gap_start = gap_end = end;
+
+  uint32_t heap = uint32_t((gap_start - first) * sizeof(cell_t));
+  uint32_t stack = uint32_t((end - gap_end) * sizeof(cell_t));
+  peaks->data = uint32_t(data);
+  peaks->heap_stack = uint32_t(top - data);
+  peaks->heap = heap;
+  peaks->stack = stack;
+  if (reset) {
+    memset(cx->memory() + data, 0, heap);
+    memset(cx->memory() + top - stack, 0, stack);
+  }
+  return true;
+}
+
+bool
+Environment::EnableCpuAccounting()
+{
+  if (top_)
+    return false;
+  cpu_accounting_ = true;
+  return true;
+}
+
+bool
+Environment::GetCpuUsage(IPluginContext* ctx, sp_cpu_usage_t* usage)
+{
+  if (!cpu_accounting_)
+    return false;
+  static_cast<PluginRuntime*>(ctx->GetRuntime())->GetCpuUsage(usage);
+  return true;
+}
+
+bool
+Environment::GetImageHash(IPluginContext* ctx, uint64_t* hash)
+{
+  *hash = static_cast<PluginRuntime*>(ctx->GetRuntime())->image_hash();
+  return *hash != 0;
+}
+
+static inline uint64_t
+CpuClock()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+size_t
+Environment::GetScriptFrames(IPluginContext* ctx, sp_script_frame_t* frames, size_t max,
+                             cell_t* sp, cell_t* stp)
+{
+  PluginContext* cx = static_cast<PluginRuntime*>(ctx->GetRuntime())->GetBaseContext();
+  if (!cx)
+    return 0;
+
+  *sp = cx->sp();
+  *stp = cx->stp();
+
+  // Each PROC saves the caller's frm one cell above its own frame base.
+  size_t count = 0;
+  cell_t frm = cx->frm();
+  for (FrameIterator iter; !iter.Done() && count < max; iter.Next()) {
+    if (!iter.IsScriptedFrame() || iter.Context() != ctx)
+      continue;
+    frames[count].cip = iter.cip();
+    frames[count].frm = frm;
+    count++;
+
+    cell_t* saved;
+    if (frm && cx->LocalToPhysAddr(frm + sizeof(cell_t), &saved) == SP_ERROR_NONE)
+      frm = *saved;
+    else
+      frm = 0;
+  }
+  return count;
+}
+
+size_t
+Environment::CaptureStack(sp_stack_frame_t* frames, size_t max)
+{
+  size_t count = 0;
+  for (FrameIterator iter; !iter.Done() && count < max; iter.Next()) {
+    if (iter.IsScriptedFrame())
+      frames[count++] = { iter.Context(), cell_t(iter.function_cip()), -1 };
+    else if (iter.IsNativeFrame())
+      frames[count++] = { iter.Context(), -1, int32_t(iter.native_index()) };
+  }
+  return count;
+}
+
+bool
+Environment::EnableDataWatchpoints()
+{
+  // Stores are only instrumented when plugins are compiled.
+  if (!runtimes_.empty() || !debug_break_enabled_)
+    return false;
+
+  data_watch_enabled_ = true;
+  return true;
+}
+
+bool
+Environment::EnableFunctionTracing(uint32_t capacity)
+{
+  // The hooks are only emitted when plugins are compiled.
+  if (!runtimes_.empty() || trace_enabled_ || !capacity || capacity > (1u << 24))
+    return false;
+
+  uint32_t size = 1;
+  while (size < capacity)
+    size <<= 1;
+  trace_records_ = std::make_unique<sp_trace_record_t[]>(size);
+  return EnableFunctionTracingInto(trace_records_.get(), size);
+}
+
+bool
+Environment::EnableFunctionTracingInto(sp_trace_record_t* records, uint32_t capacity)
+{
+  if (!runtimes_.empty() || trace_enabled_ || !records || !capacity ||
+      (capacity & (capacity - 1)) || capacity > (1u << 24))
+    return false;
+
+  trace_storage_ = records;
+  trace_ring_.head = 0;
+  trace_ring_.mask = capacity - 1;
+  trace_ring_.records = records;
+  trace_enabled_ = true;
+  return true;
+}
+
+bool
+Environment::EnableNativeRebinding()
+{
+  // Native calls are only compiled indirectly when plugins are compiled.
+  if (!runtimes_.empty())
+    return false;
+
+  native_rebinding_ = true;
+  return true;
+}
+
+bool
+Environment::EnableOpcodePairStats()
+{
+#if defined(SP_OPCODE_STATS)
+  // Runtimes size their pair table when they are created.
+  if (!runtimes_.empty())
+    return false;
+
+  opcode_pair_stats_ = true;
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool
+Environment::EnableBackgroundCompilation()
+{
+#if defined(SP_HAS_JIT)
+  if (!runtimes_.empty() || !jit_enabled_)
+    return false;
+  if (background_compiler_)
+    return true;
+
+  ke::AutoPtr<BackgroundCompiler> compiler(new BackgroundCompiler(this));
+  if (!compiler->Initialize())
+    return false;
+  background_compiler_ = compiler.take();
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool
+Environment::EnableCodeCache(const char* directory)
+{
+#if defined(SP_HAS_JIT)
+  // Whether calls are linked directly is decided as methods are compiled.
+  if (!runtimes_.empty() || !jit_enabled_)
+    return false;
+
+  ke::AutoPtr<CodeCache> cache(new CodeCache(this, directory));
+  if (!cache->Initialize())
+    return false;
+  code_cache_ = cache.take();
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool
+Environment::ReserveCodeRegion(size_t bytes)
+{
+  // Code stubs are already allocated by now, and stay where they are.
+  if (!runtimes_.empty())
+    return false;
+
+  ke::AutoLock lock(&code_mutex_);
+  return code_alloc_->ReserveRegion(bytes);
+}
+
+size_t
+Environment::RelocateHotCode(IPluginFunction** functions, size_t count)
+{
+  size_t relocated = 0;
+#if defined(SP_HAS_JIT)
+  // Frames of the old code could still be on the stack.
+  if (!jit_enabled_ || RunningCode())
+    return 0;
+
+  // The environment itself is the group for hot code, so the functions end
+  // up next to each other in the order given.
+  for (size_t i = 0; i < count; i++) {
+    funcid_t id = functions[i]->GetFunctionID();
+    if (!(id & 1))
+      continue;
+
+    PluginRuntime* rt = static_cast<PluginRuntime*>(functions[i]->GetParentRuntime());
+    sp_public_t* pub;
+    if (rt->GetPublicByIndex(id >> 1, &pub) != SP_ERROR_NONE)
+      continue;
+
+    RefPtr<MethodInfo> method = rt->GetMethod(pub->code_offs);
+    if (method && CompilerBase::Relocate(rt->GetBaseContext(), method, this))
+      relocated++;
+  }
+#endif
+  return relocated;
+}
+
+void
+Environment::TraceFunction(PluginContext* cx, uint32_t function, uint32_t event)
+{
+  if (!trace_active_)
+    return;
+
+  uint32_t head = trace_ring_.head;
+  sp_trace_record_t& record = trace_storage_[head & trace_ring_.mask];
+  record.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  record.context = cx;
+  record.function = function;
+  record.event = event;
+
+  // The record has to be complete before a reader sees the new head.
+  std::atomic_thread_fence(std::memory_order_release);
+  trace_ring_.head = head + 1;
+}
+
+bool
+Environment::EnableHeapProfiling(IHeapAllocListener* listener)
+{
+  // The listener is going away. Hooks already compiled keep their compare
+  // but report nothing.
+  if (!listener) {
+    heap_sample_interval_.store(0, std::memory_order_relaxed);
+    heap_sampling_active_ = 0;
+    heap_listener_ = nullptr;
+    return true;
+  }
+
+  // The hooks are only emitted when plugins are compiled.
+  if (!runtimes_.empty() || heap_hooks_)
+    return false;
+
+  heap_listener_ = listener;
+  heap_hooks_ = true;
+  return true;
+}
+
+bool
+Environment::SetPublicEntryHook(IPluginFunction* fn, bool armed)
+{
+  // Every IPluginFunction a runtime hands out is one of its invokers.
+  if (!fn)
+    return false;
+  static_cast<ScriptedInvoker*>(fn)->setEntryHook(armed);
+  return true;
+}
+
+void
+Environment::SetHeapSampling(uint32_t interval)
+{
+  if (!heap_listener_)
+    return;
+  heap_sample_interval_.store(interval, std::memory_order_relaxed);
+  heap_sampling_active_ = interval ? 1 : 0;
+}
+
+void
+Environment::ProfileHeapAlloc(PluginContext* cx, cell_t cip, cell_t old_hp)
+{
+  uint32_t interval = heap_sample_interval_.load(std::memory_order_relaxed);
+  if (!interval || !heap_listener_)
+    return;
+
+  // Counting down from a longer interval than the current one would delay
+  // the first sample after the interval shrinks.
+  if (heap_sample_left_ > int64_t(interval))
+    heap_sample_left_ = interval;
+
+  uint32_t size = uint32_t(cx->hp() - old_hp);
+  heap_sample_left_ -= size;
+  if (heap_sample_left_ > 0)
+    return;
+
+  // A large allocation can cross several intervals at once.
+  uint64_t samples = uint64_t(-heap_sample_left_) / interval + 1;
+  heap_sample_left_ += int64_t(samples * interval);
+  heap_listener_->OnHeapAlloc(cx, cip, size, samples * interval);
+}
+
 void
 Environment::EnableProfiling()
 {
@@ -202,9 +661,17 @@ Environment::GetErrorString(int error)
 }
 
 CodeChunk
-Environment::AllocateCode(size_t size)
+Environment::AllocateCode(size_t size, const void* group)
+{
+  ke::AutoLock lock(&code_mutex_);
+  return code_alloc_->Allocate(size, group);
+}
+
+void
+Environment::ReleaseCodeGroup(const void* group)
 {
-  return code_alloc_->Allocate(size);
+  ke::AutoLock lock(&code_mutex_);
+  code_alloc_->ReleaseGroup(group);
 }
 
 void
@@ -230,6 +697,16 @@ SwapLoopEdge(uint8_t* code, LoopEdge& e)
   *loc = new_disp32;
 }
 
+void
+Environment::PatchJumpsForTimeout(CompiledFunction* fun)
+{
+  mutex_.AssertCurrentThreadOwns();
+  uint8_t* base = reinterpret_cast<uint8_t*>(fun->GetEntryAddress());
+
+  for (size_t i = 0; i < fun->NumLoopEdges(); i++)
+    SwapLoopEdge(base, fun->GetLoopEdge(i));
+}
+
 void
 Environment::PatchAllJumpsForTimeout()
 {
@@ -240,15 +717,13 @@ Environment::PatchAllJumpsForTimeout()
     const Vector<RefPtr<MethodInfo>>& methods = rt->AllMethods();
     for (size_t i = 0; i < methods.length(); i++) {
       CompiledFunction* fun = methods[i]->jit();
-      if (!fun)
-        continue;
-
-      uint8_t* base = reinterpret_cast<uint8_t*>(fun->GetEntryAddress());
-
-      for (size_t j = 0; j < fun->NumLoopEdges(); j++)
-        SwapLoopEdge(base, fun->GetLoopEdge(j));
+      if (fun)
+        PatchJumpsForTimeout(fun);
+      for (const auto& retired : methods[i]->retired())
+        PatchJumpsForTimeout(retired.get());
     }
   }
+  jumps_patched_ = true;
 }
 
 void
@@ -261,15 +736,13 @@ Environment::UnpatchAllJumpsFromTimeout()
     const Vector<RefPtr<MethodInfo>>& methods = rt->AllMethods();
     for (size_t i = 0; i < methods.length(); i++) {
       CompiledFunction* fun = methods[i]->jit();
-      if (!fun)
-        continue;
-
-      uint8_t* base = reinterpret_cast<uint8_t*>(fun->GetEntryAddress());
-
-      for (size_t j = 0; j < fun->NumLoopEdges(); j++)
-        SwapLoopEdge(base, fun->GetLoopEdge(j));
+      if (fun)
+        PatchJumpsForTimeout(fun);
+      for (const auto& retired : methods[i]->retired())
+        PatchJumpsForTimeout(retired.get());
     }
   }
+  jumps_patched_ = false;
 }
 
 bool
@@ -279,12 +752,14 @@ Environment::Invoke(PluginContext* cx,
 {
 #if defined(SP_HAS_JIT)
   if (jit_enabled_) {
-    if (!method->jit()) {
+    if (!method->jit() || method->stale()) {
       int err = SP_ERROR_NONE;
-      if (!CompilerBase::Compile(cx, method, &err)) {
+      CompiledFunction* fn = CompilerBase::Compile(cx, method, &err);
+      if (!fn) {
         cx->ReportErrorNumber(err);
         return false;
       }
+      CompilerBase::LinkCallees(cx, fn);
     }
 
     if (CompiledFunction* fn = method->jit()) {
@@ -498,6 +973,15 @@ Environment::enterInvoke(InvokeFrame* frame)
 {
   if (!top_)
     frame_id_++;
+  if (cpu_accounting_) {
+    // The plugin being left, if any, is charged up to here.
+    uint64_t now = CpuClock();
+    if (top_)
+      top_->cx()->runtime()->AddCpuTime(now - cpu_charged_at_, 0);
+    if (!top_ || top_->cx() != frame->cx())
+      frame->cx()->runtime()->AddCpuTime(0, 1);
+    cpu_charged_at_ = now;
+  }
   top_ = frame;
 }
 
@@ -511,5 +995,10 @@ Environment::leaveJitInvoke(JitInvokeFrame* frame)
 void
 Environment::leaveInvoke()
 {
+  if (cpu_accounting_) {
+    uint64_t now = CpuClock();
+    top_->cx()->runtime()->AddCpuTime(now - cpu_charged_at_, 0);
+    cpu_charged_at_ = now;
+  }
   top_ = top_->prev();
 }
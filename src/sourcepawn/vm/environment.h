@@ -14,6 +14,7 @@
 #define _include_sourcepawn_vm_environment_h_
 
 #include <sp_vm_api.h>
+#include <atomic>
 #include <amtl/am-cxx.h>
 #include <amtl/am-inlinelist.h>
 #include <amtl/am-thread-utils.h>
@@ -28,6 +29,9 @@ using namespace SourcePawn;
 class PluginRuntime;
 class CodeStubs;
 class WatchdogTimer;
+class BackgroundCompiler;
+class PluginLoader;
+class CodeCache;
 class ErrorReport;
 class BuiltinNatives;
 
@@ -62,6 +66,46 @@ class Environment : public ISourcePawnEnvironment
   bool HasPendingException(const ExceptionHandler* handler) override;
   const char* GetPendingExceptionMessage(const ExceptionHandler* handler) override;
   bool EnableDebugBreak() override;
+  bool EnablePatchableDebugBreak() override;
+  void SetDebugBreakFilter(IDebugBreakFilter* filter) override {
+    debug_break_filter_ = filter;
+  }
+  bool EnableDataWatchpoints() override;
+  bool EnableFunctionTracing(uint32_t capacity) override;
+  bool EnableFunctionTracingInto(sp_trace_record_t* records, uint32_t capacity) override;
+  void SetInvokeListener(IInvokeListener* listener) override {
+    invoke_listener_ = listener;
+  }
+  bool EnableNativeRebinding() override;
+  bool EnableOpcodePairStats() override;
+  bool EnableBackgroundCompilation() override;
+  bool EnableCodeCache(const char* directory) override;
+  bool ReserveCodeRegion(size_t bytes) override;
+  size_t RelocateHotCode(IPluginFunction** functions, size_t count) override;
+  void SetDebugBreaksActive(bool active) override;
+  bool EnableParallelVerification(size_t threads) override;
+  bool GetMemoryUsage(IPluginContext* ctx, sp_memory_usage_t* usage) override;
+  size_t GetScriptFrames(IPluginContext* ctx, sp_script_frame_t* frames, size_t max,
+                         cell_t* sp, cell_t* stp) override;
+  bool EnableCpuAccounting() override;
+  bool GetCpuUsage(IPluginContext* ctx, sp_cpu_usage_t* usage) override;
+  size_t CaptureStack(sp_stack_frame_t* frames, size_t max) override;
+  bool GetImageHash(IPluginContext* ctx, uint64_t* hash) override;
+  bool EnableHeapProfiling(IHeapAllocListener* listener) override;
+  void SetHeapSampling(uint32_t interval) override;
+  bool EnableMethodDebugBreaks() override;
+  void SetPublicEntryListener(IPublicEntryListener* listener) override {
+    public_entry_listener_ = listener;
+  }
+  bool SetPublicEntryHook(IPluginFunction* fn, bool armed) override;
+  bool PreloadBinaries(const char* const* files, size_t count, size_t threads) override;
+  bool GetMemoryPeaks(IPluginContext* ctx, sp_memory_usage_t* peaks, bool reset) override;
+  void SetFunctionTracing(bool active) override {
+    trace_active_ = active;
+  }
+  const sp_trace_ring_t* GetTraceRing() override {
+    return trace_enabled_ ? &trace_ring_ : nullptr;
+  }
 
   // Runtime functions.
   const char* GetErrorString(int err);
@@ -72,8 +116,10 @@ class Environment : public ISourcePawnEnvironment
   void ReportErrorVA(int code, const char* fmt, va_list ap);
   void BlamePluginErrorVA(SourcePawn::IPluginFunction* pf, const char* fmt, va_list ap);
 
-  // Allocate and free executable memory.
-  CodeChunk AllocateCode(size_t size);
+  // Allocate and free executable memory. Safe to call from any thread.
+  // Code for the same group, usually a runtime, is placed together.
+  CodeChunk AllocateCode(size_t size, const void* group = nullptr);
+  void ReleaseCodeGroup(const void* group);
 
   CodeStubs* stubs() {
     return code_stubs_;
@@ -87,9 +133,18 @@ class Environment : public ISourcePawnEnvironment
   void DeregisterRuntime(PluginRuntime* rt);
   void PatchAllJumpsForTimeout();
   void UnpatchAllJumpsFromTimeout();
+  void PatchJumpsForTimeout(CompiledFunction* fun);
+  bool AreJumpsPatchedForTimeout() const {
+    return jumps_patched_;
+  }
   ke::Mutex* lock() {
     return &mutex_;
   }
+  // Held while a method is compiled, on whichever thread. Taken before the
+  // environment lock.
+  ke::Mutex* compileLock() {
+    return &compile_mutex_;
+  }
 
   bool Invoke(PluginContext* cx, const RefPtr<MethodInfo>& method, cell_t* result);
 
@@ -120,6 +175,54 @@ class Environment : public ISourcePawnEnvironment
   bool IsDebugBreakEnabled() const {
     return debug_break_enabled_;
   }
+  bool IsDebugBreakPatchable() const {
+    return debug_break_patchable_;
+  }
+  // Whether only methods with debug interest are compiled with debug breaks.
+  bool AreDebugBreaksPerMethod() const {
+    return method_debug_breaks_;
+  }
+  // Compiles methods that gained debug interest again, on the thread
+  // running plugin code, without the environment lock.
+  void RecompileForDebugging(PluginRuntime* rt, const std::vector<RefPtr<MethodInfo>>& methods);
+  // Read on either compiling thread; methods compiled in the other state
+  // are compiled again as they are entered.
+  bool AreDebugBreaksActive() const {
+    return debug_breaks_active_.load(std::memory_order_relaxed);
+  }
+  bool IsDataWatchEnabled() const {
+    return data_watch_enabled_;
+  }
+  bool IsFunctionTracingEnabled() const {
+    return trace_enabled_;
+  }
+  bool IsNativeRebindingEnabled() const {
+    return native_rebinding_;
+  }
+  bool IsOpcodePairStatsEnabled() const {
+    return opcode_pair_stats_;
+  }
+  // Extra threads verifying large plugins' methods as they load, or 0.
+  size_t verifyThreads() const {
+    return verify_threads_;
+  }
+  // Records an entry, exit or debug break while tracing is active.
+  void TraceFunction(PluginContext* cx, uint32_t function, uint32_t event);
+  bool IsHeapProfilingEnabled() const {
+    return heap_hooks_;
+  }
+  // Called after the instruction at |cip| grew the heap from |old_hp|.
+  // Reports it if sampling is on and it is due.
+  void ProfileHeapAlloc(PluginContext* cx, cell_t cip, cell_t old_hp);
+  IDebugBreakFilter* debugBreakFilter() const {
+    return debug_break_filter_;
+  }
+  IInvokeListener* invokeListener() const {
+    return invoke_listener_;
+  }
+  IPublicEntryListener* publicEntryListener() const {
+    return public_entry_listener_;
+  }
   void SetDebugBreakHandler(SPVM_DEBUGBREAK handler) {
     debug_break_handler_ = handler;
   }
@@ -130,6 +233,18 @@ class Environment : public ISourcePawnEnvironment
   WatchdogTimer* watchdog() const {
     return watchdog_timer_;
   }
+  // Null unless background compilation was enabled.
+  BackgroundCompiler* backgroundCompiler() const {
+    return background_compiler_;
+  }
+  PluginLoader* loader() const {
+    return loader_;
+  }
+  // Null unless the code cache was enabled. Only used under the compile
+  // lock.
+  CodeCache* codeCache() const {
+    return code_cache_;
+  }
 
   bool hasPendingException() const;
   void clearPendingException();
@@ -168,6 +283,12 @@ class Environment : public ISourcePawnEnvironment
   void* addressOfExceptionCode() {
     return &exception_code_;
   }
+  uint8_t* addressOfTraceActive() {
+    return &trace_active_;
+  }
+  uint8_t* addressOfHeapSamplingActive() {
+    return &heap_sampling_active_;
+  }
 
  private:
   bool Initialize();
@@ -178,11 +299,49 @@ class Environment : public ISourcePawnEnvironment
   ke::AutoPtr<ISourcePawnEngine> api_v1_;
   ke::AutoPtr<ISourcePawnEngine2> api_v2_;
   ke::AutoPtr<WatchdogTimer> watchdog_timer_;
+  ke::AutoPtr<BackgroundCompiler> background_compiler_;
+  ke::AutoPtr<PluginLoader> loader_;
+  ke::AutoPtr<CodeCache> code_cache_;
   ke::AutoPtr<BuiltinNatives> builtins_;
   ke::Mutex mutex_;
+  ke::Mutex compile_mutex_;
+  ke::Mutex code_mutex_;
 
   bool debug_break_enabled_;
+  bool debug_break_patchable_;
+  bool method_debug_breaks_;
+  std::atomic<bool> debug_breaks_active_;
+  bool data_watch_enabled_;
+  bool trace_enabled_;
+  bool native_rebinding_;
+  bool opcode_pair_stats_;
+  bool cpu_accounting_;
+  // When the plugin on top of the invoke stack was last charged, in
+  // nanoseconds of the steady clock.
+  uint64_t cpu_charged_at_;
+  size_t verify_threads_;
+  // Whether loop edges currently point at the timeout thunks. Guarded by
+  // the environment lock.
+  bool jumps_patched_;
+  // Read by the JIT's function hooks on every call.
+  uint8_t trace_active_;
+  std::unique_ptr<sp_trace_record_t[]> trace_records_;
+  // trace_records_, or the host's records.
+  sp_trace_record_t* trace_storage_;
+  sp_trace_ring_t trace_ring_;
+  IDebugBreakFilter* debug_break_filter_;
+  IInvokeListener* invoke_listener_;
+  IPublicEntryListener* public_entry_listener_;
   SPVM_DEBUGBREAK debug_break_handler_;
+  IHeapAllocListener* heap_listener_;
+  // Hooks are compiled in; stays set after the listener is cleared.
+  bool heap_hooks_;
+  std::atomic<uint32_t> heap_sample_interval_;
+  // Read by the JIT's heap hooks on every allocation.
+  uint8_t heap_sampling_active_;
+  // Bytes left until the next sample. Only touched by the thread running
+  // plugins.
+  int64_t heap_sample_left_;
 
   IDebugListener* debugger_;
   ExceptionHandler* eh_top_;
@@ -13,6 +13,15 @@
 
 #include <memory>
 
+#if defined(_WIN32)
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
 using namespace sp;
 
 FileType
@@ -29,7 +38,10 @@ sp::DetectFileType(FILE* fp)
 }
 
 FileReader::FileReader(FILE* fp)
- : length_(0)
+ : length_(0),
+   mapped_(nullptr),
+   mapped_length_(0),
+   borrowed_(false)
 {
   if (fseek(fp, 0, SEEK_END) != 0)
     return;
@@ -50,6 +62,93 @@ FileReader::FileReader(FILE* fp)
 FileReader::FileReader(std::unique_ptr<uint8_t[]>&& buffer, size_t length)
  : buffer_(std::move(buffer))
  ,
-   length_(length)
+   length_(length),
+   mapped_(nullptr),
+   mapped_length_(0),
+   borrowed_(false)
+{
+}
+
+FileReader::FileReader(const char* path)
+ : length_(0),
+   mapped_(nullptr),
+   mapped_length_(0),
+   borrowed_(false)
+{
+#if defined(_WIN32)
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return;
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart <= 0 || size.HighPart) {
+    CloseHandle(file);
+    return;
+  }
+
+  // The view keeps the file alive, so neither handle is needed afterwards.
+  HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file);
+  if (!mapping)
+    return;
+  void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);
+  if (!view)
+    return;
+
+  mapped_ = reinterpret_cast<const uint8_t*>(view);
+  mapped_length_ = size_t(size.QuadPart);
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return;
+  }
+
+  void* view = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (view == MAP_FAILED)
+    return;
+
+  mapped_ = reinterpret_cast<const uint8_t*>(view);
+  mapped_length_ = st.st_size;
+#endif
+  length_ = mapped_length_;
+}
+
+FileReader::FileReader(const uint8_t* buffer, size_t length)
+ : length_(length),
+   mapped_(buffer),
+   mapped_length_(length),
+   borrowed_(true)
+{
+}
+
+FileReader::~FileReader()
 {
+  unmap();
+}
+
+void
+FileReader::unmap()
+{
+  if (!mapped_)
+    return;
+  if (borrowed_) {
+    mapped_ = nullptr;
+    mapped_length_ = 0;
+    return;
+  }
+#if defined(_WIN32)
+  UnmapViewOfFile(mapped_);
+#else
+  munmap(const_cast<uint8_t*>(mapped_), mapped_length_);
+#endif
+  mapped_ = nullptr;
+  mapped_length_ = 0;
 }
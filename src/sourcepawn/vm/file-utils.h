@@ -31,16 +31,41 @@ class FileReader
   FileReader(FILE* fp);
   FileReader(std::unique_ptr<uint8_t[]>&& buffer, size_t length);
 
+  // Map the file read-only instead of reading it into memory. On failure
+  // length() is 0, as with the FILE* constructor.
+  explicit FileReader(const char* path);
+
+  // Read a buffer owned by someone else, which must outlive the reader.
+  FileReader(const uint8_t* buffer, size_t length);
+  ~FileReader();
+
+  FileReader(const FileReader&) = delete;
+  FileReader& operator =(const FileReader&) = delete;
+
+  // An owned buffer, once assigned, takes precedence over the mapping.
   const uint8_t* buffer() const {
-    return buffer_.get();
+    return buffer_ ? buffer_.get() : mapped_;
   }
   size_t length() const {
     return length_;
   }
+  bool mapped() const {
+    return !!mapped_;
+  }
+
+ protected:
+  // Release the file mapping, if any. Call this after replacing the
+  // contents with an owned buffer.
+  void unmap();
 
  protected:
   std::unique_ptr<uint8_t[]> buffer_;
   size_t length_;
+
+ private:
+  const uint8_t* mapped_;
+  size_t mapped_length_;
+  bool borrowed_;
 };
 
 } // namespace sp
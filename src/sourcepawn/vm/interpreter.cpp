@@ -21,6 +21,7 @@
 #include "method-info.h"
 #include "plugin-context.h"
 #include "pcode-reader.h"
+#include "threaded-code.h"
 #include "runtime-helpers.h"
 #include "watchdog_timer.h"
 #include <amtl/am-algorithm.h>
@@ -49,7 +50,10 @@ Interpreter::Interpreter(PluginContext* cx, RefPtr<MethodInfo> method)
    reader_(rt_, method->pcode_offset(), this),
    method_(method),
    has_returned_(false),
-   return_value_(0)
+   return_value_(0),
+   watch_data_(rt_->IsDataWatchInstrumented()),
+   trace_functions_(env_->IsFunctionTracingEnabled()),
+   profile_heap_(env_->IsHeapProfilingEnabled())
 {
 }
 
@@ -65,17 +69,480 @@ Interpreter::run()
 
   if (!cx_->pushAmxFrame())
     return false;
+  if (trace_functions_)
+    env_->TraceFunction(cx_, method_->pcode_offset(), SP_TRACE_ENTER);
 
-  while (!has_returned_ && reader_.more()) {
-    if (reader_.peekOpcode() == OP_PROC || reader_.peekOpcode() == OP_ENDPROC)
-      break;
-    if (!reader_.visitNext())
+  return dispatch(method_->threaded());
+}
+
+// Computed goto jumps straight from one handler to the next, instead of
+// going back through a single switch. SP_SWITCH_DISPATCH builds the switch
+// anyway, so the tests can cover it with compilers that have both.
+#if defined(__GNUC__) && !defined(SP_SWITCH_DISPATCH)
+# define SP_THREADED_GOTO
+#endif
+
+#if defined(SP_OPCODE_STATS)
+# define SP_COUNT_OPCODE()                                \
+    if (insn->op != OP_ENDPROC) {                         \
+      rt_->CountOpcode(prev, OPCODE(insn->args[-1]));     \
+      prev = OPCODE(insn->args[-1]);                      \
+    }
+#else
+# define SP_COUNT_OPCODE()
+#endif
+
+#if defined(SP_THREADED_GOTO)
+# define TARGET(op) case OP_##op: L_##op:
+# define FUSED(first, second) case OP_##first##__##second: L_##first##__##second:
+# define DISPATCH()                                       \
+    do {                                                  \
+      reader_.setCip(insn->next);                         \
+      SP_COUNT_OPCODE();                                  \
+      goto *kTargets[insn->op];                           \
+    } while (0)
+#else
+# define TARGET(op) case OP_##op:
+# define FUSED(first, second) case OP_##first##__##second:
+# define DISPATCH() goto dispatch
+#endif
+
+// Runs the first instruction of a fused pair and moves on to the second,
+// which the handler finishes with DO or DO_BRANCH.
+#define FIRST(expr)                                       \
+  do {                                                    \
+    if (!(expr))                                          \
+      return false;                                       \
+    insn++;                                               \
+    reader_.setCip(insn->next);                           \
+  } while (0)
+
+#define NEXT()                                            \
+  do {                                                    \
+    insn++;                                               \
+    DISPATCH();                                           \
+  } while (0)
+
+#define DO(expr)                                          \
+  do {                                                    \
+    if (!(expr))                                          \
+      return false;                                       \
+    NEXT();                                               \
+  } while (0)
+
+// For handlers that may move the reader to another instruction.
+#define DO_BRANCH(expr)                                   \
+  do {                                                    \
+    if (!(expr))                                          \
+      return false;                                       \
+    insn = (reader_.cip() == insn->next)                  \
+           ? insn + 1                                     \
+           : code->lookup(reader_.cip());                 \
+    DISPATCH();                                           \
+  } while (0)
+
+bool
+Interpreter::dispatch(const ThreadedCode* code)
+{
+  const ThreadedInsn* insn = code->insns();
+  const cell_t* code_base = reinterpret_cast<const cell_t*>(rt_->code().bytes);
+#if defined(SP_OPCODE_STATS)
+  OPCODE prev = OP_NONE;
+#endif
+
+#if defined(SP_THREADED_GOTO)
+  static const void* const kTargets[] = {
+# define _G(op, text, cells) &&L_##op,
+# define _U(op, text) &&L_invalid,
+    OPCODE_LIST(_G, _U)
+# undef _U
+# undef _G
+    &&L_invalid,
+# define _F(first, second) &&L_##first##__##second,
+    FUSED_OPCODE_LIST(_F)
+# undef _F
+  };
+
+  DISPATCH();
+#else
+ dispatch:
+  reader_.setCip(insn->next);
+  SP_COUNT_OPCODE();
+#endif
+
+  const cell_t* args;
+  switch (insn->op) {
+    TARGET(NOP)
+      NEXT();
+
+    // This opcode is used to note where line breaks occur.
+    TARGET(BREAK)
+      DO(visitBREAK());
+
+    TARGET(LOAD_PRI)
+      DO(visitLOAD(PawnReg::Pri, insn->args[0]));
+    TARGET(LOAD_ALT)
+      DO(visitLOAD(PawnReg::Alt, insn->args[0]));
+    TARGET(LOAD_S_PRI)
+      DO(visitLOAD_S(PawnReg::Pri, insn->args[0]));
+    TARGET(LOAD_S_ALT)
+      DO(visitLOAD_S(PawnReg::Alt, insn->args[0]));
+    TARGET(LREF_S_PRI)
+      DO(visitLREF_S(PawnReg::Pri, insn->args[0]));
+    TARGET(LREF_S_ALT)
+      DO(visitLREF_S(PawnReg::Alt, insn->args[0]));
+    TARGET(LOAD_I)
+      DO(visitLOAD_I());
+    TARGET(LODB_I)
+      DO(visitLODB_I(insn->args[0]));
+    TARGET(CONST_PRI)
+      DO(visitCONST(PawnReg::Pri, insn->args[0]));
+    TARGET(CONST_ALT)
+      DO(visitCONST(PawnReg::Alt, insn->args[0]));
+    TARGET(ADDR_PRI)
+      DO(visitADDR(PawnReg::Pri, insn->args[0]));
+    TARGET(ADDR_ALT)
+      DO(visitADDR(PawnReg::Alt, insn->args[0]));
+    TARGET(STOR_PRI)
+      DO(visitSTOR(insn->args[0], PawnReg::Pri));
+    TARGET(STOR_ALT)
+      DO(visitSTOR(insn->args[0], PawnReg::Alt));
+    TARGET(STOR_S_PRI)
+      DO(visitSTOR_S(insn->args[0], PawnReg::Pri));
+    TARGET(STOR_S_ALT)
+      DO(visitSTOR_S(insn->args[0], PawnReg::Alt));
+    TARGET(SREF_S_PRI)
+      DO(visitSREF_S(insn->args[0], PawnReg::Pri));
+    TARGET(SREF_S_ALT)
+      DO(visitSREF_S(insn->args[0], PawnReg::Alt));
+    TARGET(STOR_I)
+      DO(visitSTOR_I());
+    TARGET(STRB_I)
+      DO(visitSTRB_I(insn->args[0]));
+    TARGET(LIDX)
+      DO(visitLIDX());
+    TARGET(IDXADDR)
+      DO(visitIDXADDR());
+    TARGET(MOVE_PRI)
+      DO(visitMOVE(PawnReg::Pri));
+    TARGET(MOVE_ALT)
+      DO(visitMOVE(PawnReg::Alt));
+    TARGET(XCHG)
+      DO(visitXCHG());
+    TARGET(PUSH_PRI)
+      DO(visitPUSH(PawnReg::Pri));
+    TARGET(PUSH_ALT)
+      DO(visitPUSH(PawnReg::Alt));
+
+    TARGET(PUSH_C)
+      DO(visitPUSH_C(insn->args, 1));
+    TARGET(PUSH2_C)
+      DO(visitPUSH_C(insn->args, 2));
+    TARGET(PUSH3_C)
+      DO(visitPUSH_C(insn->args, 3));
+    TARGET(PUSH4_C)
+      DO(visitPUSH_C(insn->args, 4));
+    TARGET(PUSH5_C)
+      DO(visitPUSH_C(insn->args, 5));
+
+    TARGET(PUSH)
+      DO(visitPUSH(insn->args, 1));
+    TARGET(PUSH2)
+      DO(visitPUSH(insn->args, 2));
+    TARGET(PUSH3)
+      DO(visitPUSH(insn->args, 3));
+    TARGET(PUSH4)
+      DO(visitPUSH(insn->args, 4));
+    TARGET(PUSH5)
+      DO(visitPUSH(insn->args, 5));
+
+    TARGET(PUSH_S)
+      DO(visitPUSH_S(insn->args, 1));
+    TARGET(PUSH2_S)
+      DO(visitPUSH_S(insn->args, 2));
+    TARGET(PUSH3_S)
+      DO(visitPUSH_S(insn->args, 3));
+    TARGET(PUSH4_S)
+      DO(visitPUSH_S(insn->args, 4));
+    TARGET(PUSH5_S)
+      DO(visitPUSH_S(insn->args, 5));
+
+    TARGET(PUSH_ADR)
+      DO(visitPUSH_ADR(insn->args, 1));
+    TARGET(PUSH2_ADR)
+      DO(visitPUSH_ADR(insn->args, 2));
+    TARGET(PUSH3_ADR)
+      DO(visitPUSH_ADR(insn->args, 3));
+    TARGET(PUSH4_ADR)
+      DO(visitPUSH_ADR(insn->args, 4));
+    TARGET(PUSH5_ADR)
+      DO(visitPUSH_ADR(insn->args, 5));
+
+    TARGET(POP_PRI)
+      DO(visitPOP(PawnReg::Pri));
+    TARGET(POP_ALT)
+      DO(visitPOP(PawnReg::Alt));
+    TARGET(STACK)
+      DO(visitSTACK(insn->args[0]));
+    TARGET(HEAP)
+      DO(visitHEAP(insn->args[0]));
+
+    TARGET(RETN)
+      // Sets has_returned_, which ends the method like the loop it replaces.
+      return visitRETN();
+
+    TARGET(CALL)
+      DO(visitCALL(insn->args[0]));
+
+    TARGET(JUMP)
+      DO_BRANCH(visitJUMP(insn->args[0]));
+    TARGET(JZER)
+      DO_BRANCH(visitJcmp(CompareOp::Zero, insn->args[0]));
+    TARGET(JNZ)
+      DO_BRANCH(visitJcmp(CompareOp::NotZero, insn->args[0]));
+    TARGET(JEQ)
+      DO_BRANCH(visitJcmp(CompareOp::Eq, insn->args[0]));
+    TARGET(JNEQ)
+      DO_BRANCH(visitJcmp(CompareOp::Neq, insn->args[0]));
+    TARGET(JSLESS)
+      DO_BRANCH(visitJcmp(CompareOp::Sless, insn->args[0]));
+    TARGET(JSLEQ)
+      DO_BRANCH(visitJcmp(CompareOp::Sleq, insn->args[0]));
+    TARGET(JSGRTR)
+      DO_BRANCH(visitJcmp(CompareOp::Sgrtr, insn->args[0]));
+    TARGET(JSGEQ)
+      DO_BRANCH(visitJcmp(CompareOp::Sgeq, insn->args[0]));
+
+    TARGET(SHL)
+      DO(visitSHL());
+    TARGET(SHR)
+      DO(visitSHR());
+    TARGET(SSHR)
+      DO(visitSSHR());
+    TARGET(SHL_C_PRI)
+      DO(visitSHL_C(PawnReg::Pri, insn->args[0]));
+    TARGET(SHL_C_ALT)
+      DO(visitSHL_C(PawnReg::Alt, insn->args[0]));
+
+    TARGET(SMUL)
+      DO(visitSMUL());
+    TARGET(SDIV)
+      DO(visitSDIV(PawnReg::Pri));
+    TARGET(SDIV_ALT)
+      DO(visitSDIV(PawnReg::Alt));
+
+    TARGET(ADD)
+      DO(visitADD());
+    TARGET(SUB)
+      DO(visitSUB());
+    TARGET(SUB_ALT)
+      DO(visitSUB_ALT());
+    TARGET(AND)
+      DO(visitAND());
+    TARGET(OR)
+      DO(visitOR());
+    TARGET(XOR)
+      DO(visitXOR());
+    TARGET(NOT)
+      DO(visitNOT());
+    TARGET(NEG)
+      DO(visitNEG());
+    TARGET(INVERT)
+      DO(visitINVERT());
+    TARGET(ADD_C)
+      DO(visitADD_C(insn->args[0]));
+    TARGET(SMUL_C)
+      DO(visitSMUL_C(insn->args[0]));
+
+    TARGET(ZERO_PRI)
+      DO(visitZERO(PawnReg::Pri));
+    TARGET(ZERO_ALT)
+      DO(visitZERO(PawnReg::Alt));
+    TARGET(ZERO)
+      DO(visitZERO(insn->args[0]));
+    TARGET(ZERO_S)
+      DO(visitZERO_S(insn->args[0]));
+
+    TARGET(EQ)
+      DO(visitCompareOp(CompareOp::Eq));
+    TARGET(NEQ)
+      DO(visitCompareOp(CompareOp::Neq));
+    TARGET(SLESS)
+      DO(visitCompareOp(CompareOp::Sless));
+    TARGET(SLEQ)
+      DO(visitCompareOp(CompareOp::Sleq));
+    TARGET(SGRTR)
+      DO(visitCompareOp(CompareOp::Sgrtr));
+    TARGET(SGEQ)
+      DO(visitCompareOp(CompareOp::Sgeq));
+    TARGET(EQ_C_PRI)
+      DO(visitEQ_C(PawnReg::Pri, insn->args[0]));
+    TARGET(EQ_C_ALT)
+      DO(visitEQ_C(PawnReg::Alt, insn->args[0]));
+
+    TARGET(INC_PRI)
+      DO(visitINC(PawnReg::Pri));
+    TARGET(INC_ALT)
+      DO(visitINC(PawnReg::Alt));
+    TARGET(INC)
+      DO(visitINC(insn->args[0]));
+    TARGET(INC_S)
+      DO(visitINC_S(insn->args[0]));
+    TARGET(INC_I)
+      DO(visitINC_I());
+    TARGET(DEC_PRI)
+      DO(visitDEC(PawnReg::Pri));
+    TARGET(DEC_ALT)
+      DO(visitDEC(PawnReg::Alt));
+    TARGET(DEC)
+      DO(visitDEC(insn->args[0]));
+    TARGET(DEC_S)
+      DO(visitDEC_S(insn->args[0]));
+    TARGET(DEC_I)
+      DO(visitDEC_I());
+
+    TARGET(MOVS)
+      DO(visitMOVS(insn->args[0]));
+    TARGET(FILL)
+      DO(visitFILL(insn->args[0]));
+    TARGET(BOUNDS)
+      DO(visitBOUNDS(insn->args[0]));
+    TARGET(SYSREQ_C)
+      DO(visitSYSREQ_C(insn->args[0]));
+    TARGET(SYSREQ_N)
+      DO(visitSYSREQ_N(insn->args[0], insn->args[1]));
+    TARGET(SWAP_PRI)
+      DO(visitSWAP(PawnReg::Pri));
+    TARGET(SWAP_ALT)
+      DO(visitSWAP(PawnReg::Alt));
+
+    TARGET(LOAD_BOTH)
+      DO(visitLOAD_BOTH(insn->args[0], insn->args[1]));
+    TARGET(LOAD_S_BOTH)
+      DO(visitLOAD_S_BOTH(insn->args[0], insn->args[1]));
+    TARGET(CONST)
+      DO(visitCONST(insn->args[0], insn->args[1]));
+    TARGET(CONST_S)
+      DO(visitCONST_S(insn->args[0], insn->args[1]));
+
+    TARGET(TRACKER_PUSH_C)
+      DO(visitTRACKER_PUSH_C(insn->args[0]));
+    TARGET(TRACKER_POP_SETHEAP)
+      DO(visitTRACKER_POP_SETHEAP());
+    TARGET(GENARRAY)
+      DO(visitGENARRAY(insn->args[0], false));
+    TARGET(GENARRAY_Z)
+      DO(visitGENARRAY(insn->args[0], true));
+    TARGET(STRADJUST_PRI)
+      DO(visitSTRADJUST_PRI());
+
+    TARGET(FABS)
+      DO(visitFABS());
+    TARGET(FLOAT)
+      DO(visitFLOAT());
+    TARGET(FLOATADD)
+      DO(visitFLOATADD());
+    TARGET(FLOATSUB)
+      DO(visitFLOATSUB());
+    TARGET(FLOATMUL)
+      DO(visitFLOATMUL());
+    TARGET(FLOATDIV)
+      DO(visitFLOATDIV());
+    TARGET(RND_TO_NEAREST)
+      DO(visitRND_TO_NEAREST());
+    TARGET(RND_TO_CEIL)
+      DO(visitRND_TO_CEIL());
+    TARGET(RND_TO_ZERO)
+      DO(visitRND_TO_ZERO());
+    TARGET(RND_TO_FLOOR)
+      DO(visitRND_TO_FLOOR());
+    TARGET(FLOATCMP)
+      DO(visitFLOATCMP());
+    TARGET(FLOAT_GT)
+      DO(visitFLOAT_CMP_OP(CompareOp::Sgrtr));
+    TARGET(FLOAT_GE)
+      DO(visitFLOAT_CMP_OP(CompareOp::Sgeq));
+    TARGET(FLOAT_LE)
+      DO(visitFLOAT_CMP_OP(CompareOp::Sleq));
+    TARGET(FLOAT_LT)
+      DO(visitFLOAT_CMP_OP(CompareOp::Sless));
+    TARGET(FLOAT_EQ)
+      DO(visitFLOAT_CMP_OP(CompareOp::Eq));
+    TARGET(FLOAT_NE)
+      DO(visitFLOAT_CMP_OP(CompareOp::Neq));
+    TARGET(FLOAT_NOT)
+      DO(visitFLOAT_NOT());
+
+    TARGET(HALT)
+      DO(visitHALT(insn->args[0]));
+
+    TARGET(SWITCH)
+      args = code_base + (insn->args[0] / sizeof(cell_t));
+      assert(OPCODE(*args) == OP_CASETBL);
+      DO_BRANCH(visitSWITCH(args[2], reinterpret_cast<const CaseTableEntry*>(args + 3), args[1]));
+
+    // Nothing to do here. This is handled in OP_SWITCH.
+    TARGET(CASETBL)
+      NEXT();
+
+    TARGET(REBASE)
+      DO(visitREBASE(insn->args[0], insn->args[1], insn->args[2]));
+
+    FUSED(LOAD_S_PRI, PUSH_PRI)
+      FIRST(visitLOAD_S(PawnReg::Pri, insn->args[0]));
+      DO(visitPUSH(PawnReg::Pri));
+    FUSED(CONST_PRI, STOR_PRI)
+      FIRST(visitCONST(PawnReg::Pri, insn->args[0]));
+      DO(visitSTOR(insn->args[0], PawnReg::Pri));
+    FUSED(CONST_PRI, STOR_S_PRI)
+      FIRST(visitCONST(PawnReg::Pri, insn->args[0]));
+      DO(visitSTOR_S(insn->args[0], PawnReg::Pri));
+    FUSED(EQ, JZER)
+      FIRST(visitCompareOp(CompareOp::Eq));
+      DO_BRANCH(visitJcmp(CompareOp::Zero, insn->args[0]));
+    FUSED(NEQ, JZER)
+      FIRST(visitCompareOp(CompareOp::Neq));
+      DO_BRANCH(visitJcmp(CompareOp::Zero, insn->args[0]));
+    FUSED(SLESS, JZER)
+      FIRST(visitCompareOp(CompareOp::Sless));
+      DO_BRANCH(visitJcmp(CompareOp::Zero, insn->args[0]));
+    FUSED(SLEQ, JZER)
+      FIRST(visitCompareOp(CompareOp::Sleq));
+      DO_BRANCH(visitJcmp(CompareOp::Zero, insn->args[0]));
+    FUSED(SGRTR, JZER)
+      FIRST(visitCompareOp(CompareOp::Sgrtr));
+      DO_BRANCH(visitJcmp(CompareOp::Zero, insn->args[0]));
+    FUSED(SGEQ, JZER)
+      FIRST(visitCompareOp(CompareOp::Sgeq));
+      DO_BRANCH(visitJcmp(CompareOp::Zero, insn->args[0]));
+    FUSED(EQ_C_PRI, JZER)
+      FIRST(visitEQ_C(PawnReg::Pri, insn->args[0]));
+      DO_BRANCH(visitJcmp(CompareOp::Zero, insn->args[0]));
+
+    // The end of the method.
+    TARGET(PROC)
+    TARGET(ENDPROC)
+      return true;
+
+    TARGET(NONE)
+    default:
+#if defined(SP_THREADED_GOTO)
+    L_invalid:
+#endif
+      cx_->ReportErrorNumber(SP_ERROR_INVALID_INSTRUCTION);
       return false;
   }
-
-  return true;
 }
 
+#undef FIRST
+#undef DO_BRANCH
+#undef DO
+#undef NEXT
+#undef DISPATCH
+#undef FUSED
+#undef TARGET
+#undef SP_COUNT_OPCODE
+
 bool
 Interpreter::invokeNative(uint32_t native_index)
 {
@@ -102,6 +569,8 @@ Interpreter::visitRETN()
 {
   if (!cx_->popAmxFrame())
     return false;
+  if (trace_functions_)
+    env_->TraceFunction(cx_, method_->pcode_offset(), SP_TRACE_EXIT);
 
   has_returned_ = true;
   return_value_ = regs_.pri();
@@ -168,7 +637,11 @@ Interpreter::visitCALL(cell_t offset)
 bool
 Interpreter::visitHEAP(cell_t amount)
 {
-  return cx_->heapAlloc(amount, &regs_.alt());
+  if (!cx_->heapAlloc(amount, &regs_.alt()))
+    return false;
+  if (profile_heap_ && amount > 0)
+    profileHeap(regs_.alt());
+  return true;
 }
 
 bool
@@ -180,7 +653,9 @@ Interpreter::visitLOAD_I()
 bool
 Interpreter::visitSTOR_I()
 {
-  return cx_->setCellValue(regs_.alt(), regs_.pri());
+  if (!cx_->setCellValue(regs_.alt(), regs_.pri()))
+    return false;
+  return checkDataWatch(regs_.alt(), sizeof(cell_t));
 }
 
 bool
@@ -227,7 +702,9 @@ Interpreter::visitZERO(PawnReg dest)
 bool
 Interpreter::visitZERO(cell_t address)
 {
-  return cx_->setCellValue(address, 0);
+  if (!cx_->setCellValue(address, 0))
+    return false;
+  return checkDataWatch(address, sizeof(cell_t));
 }
 
 bool
@@ -265,7 +742,9 @@ Interpreter::visitCONST(PawnReg dest, cell_t imm)
 bool
 Interpreter::visitCONST(cell_t address, cell_t value)
 {
-  return cx_->setCellValue(address, value);
+  if (!cx_->setCellValue(address, value))
+    return false;
+  return checkDataWatch(address, sizeof(cell_t));
 }
 
 bool
@@ -405,7 +884,7 @@ Interpreter::visitINC(cell_t address)
   if (!addr)
     return false;
   *addr += 1;
-  return true;
+  return checkDataWatch(address, sizeof(cell_t));
 }
 
 bool
@@ -424,7 +903,7 @@ Interpreter::visitINC_I()
   if (!addr)
     return false;
   *addr += 1;
-  return true;
+  return checkDataWatch(regs_.pri(), sizeof(cell_t));
 }
 
 bool
@@ -441,7 +920,7 @@ Interpreter::visitDEC(cell_t address)
   if (!addr)
     return false;
   *addr -= 1;
-  return true;
+  return checkDataWatch(address, sizeof(cell_t));
 }
 
 bool
@@ -460,7 +939,7 @@ Interpreter::visitDEC_I()
   if (!addr)
     return false;
   *addr -= 1;
-  return true;
+  return checkDataWatch(regs_.pri(), sizeof(cell_t));
 }
 
 bool
@@ -633,7 +1112,7 @@ Interpreter::visitMOVS(uint32_t amount)
   if (!dest)
     return false;
   memmove(dest, src, amount);
-  return true;
+  return checkDataWatch(regs_.alt(), amount);
 }
 
 bool
@@ -644,7 +1123,7 @@ Interpreter::visitFILL(uint32_t amount)
     return false;
   for (size_t i = 0; i < (amount / sizeof(cell_t)); i++)
     dest[i] = regs_.pri();
-  return true;
+  return checkDataWatch(regs_.alt(), amount);
 }
 
 bool
@@ -700,7 +1179,9 @@ Interpreter::visitSREF_S(cell_t destoffs, PawnReg src)
   cell_t address;
   if (!cx_->getFrameValue(destoffs, &address))
     return false;
-  return cx_->setCellValue(address, regs_[src]);
+  if (!cx_->setCellValue(address, regs_[src]))
+    return false;
+  return checkDataWatch(address, sizeof(cell_t));
 }
 
 bool
@@ -744,7 +1225,7 @@ Interpreter::visitSTRB_I(cell_t width)
   default:
     assert(false);
   }
-  return true;
+  return checkDataWatch(regs_.alt(), width);
 }
 
 bool
@@ -756,7 +1237,9 @@ Interpreter::visitLOAD(PawnReg dest, cell_t srcaddr)
 bool
 Interpreter::visitSTOR(cell_t address, PawnReg src)
 {
-  return cx_->setCellValue(address, regs_[src]);
+  if (!cx_->setCellValue(address, regs_[src]))
+    return false;
+  return checkDataWatch(address, sizeof(cell_t));
 }
 
 bool
@@ -993,6 +1476,10 @@ Interpreter::visitGENARRAY(uint32_t dims, bool autozero)
     return false;
   }
 
+  // The last argument now holds the array's address, where the heap was.
+  if (profile_heap_)
+    profileHeap(stack[dims - 1]);
+
   // Remove all but the last argument, which is where the new address is
   // stored.
   cell_t ignore;
@@ -1036,14 +1523,45 @@ Interpreter::visitSTRADJUST_PRI()
 bool
 Interpreter::visitBREAK()
 {
-  // Ignore opcode if this isn't enabled.
-  if (!Environment::get()->IsDebugBreakEnabled())
+  // Ignore opcode if this isn't enabled for this plugin.
+  if (!rt_->IsDebugBreakInstrumented())
     return true;
 
+  // Patchable sites only reach the debugger while armed.
+  if (Environment::get()->IsDebugBreakPatchable()) {
+    ucell_t cip = ucell_t(uintptr_t(reader_.cip()) - uintptr_t(rt_->code().bytes)) - sizeof(cell_t);
+    if (!rt_->IsDebugBreakArmed(cip))
+      return true;
+  }
+
   InvokeDebugger(cx_, nullptr);
   return !env_->hasPendingException();
 }
 
+// HEAP and GENARRAY both take one operand, so the reader is two cells past
+// the instruction.
+void
+Interpreter::profileHeap(cell_t old_hp)
+{
+  cell_t cip = cell_t(uintptr_t(reader_.cip()) - uintptr_t(rt_->code().bytes)) -
+               2 * sizeof(cell_t);
+  env_->ProfileHeapAlloc(cx_, cip, old_hp);
+}
+
+bool
+Interpreter::checkDataWatch(cell_t address, ucell_t size)
+{
+  if (!watch_data_ || !rt_->IsDataWatched(address, size))
+    return true;
+
+  // The stop reports this instruction, with the new value in place.
+  if (int err = InvokeDataWatch(cx_, address, size)) {
+    cx_->ReportErrorNumber(err);
+    return false;
+  }
+  return !env_->hasPendingException();
+}
+
 bool
 Interpreter::visitHALT(cell_t value)
 {
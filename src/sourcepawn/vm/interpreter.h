@@ -33,6 +33,7 @@ class Environment;
 class PluginContext;
 class PluginRuntime;
 class MethodInfo;
+class ThreadedCode;
 
 class InterpRegs
 {
@@ -157,6 +158,9 @@ class Interpreter final : public PcodeVisitor
 
   bool run();
 
+  // Runs the method's pre-decoded handler stream.
+  bool dispatch(const ThreadedCode* code);
+
   cell_t return_value() const {
     return return_value_;
   }
@@ -164,6 +168,10 @@ class Interpreter final : public PcodeVisitor
  private:
   bool invokeNative(uint32_t native_index);
 
+  // Breaks into the debugger if a store touched a data watchpoint.
+  bool checkDataWatch(cell_t address, ucell_t size);
+  void profileHeap(cell_t old_hp);
+
  private:
   Environment* env_;
   PluginRuntime* rt_;
@@ -174,6 +182,9 @@ class Interpreter final : public PcodeVisitor
   cell_t return_value_;
   InterpRegs regs_;
   InterpInvokeFrame* ivk_;
+  bool watch_data_;
+  bool trace_functions_;
+  bool profile_heap_;
 };
 
 } // namespace sp
@@ -16,6 +16,7 @@
 // along with SourcePawn.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include "jit.h"
+#include "code-cache.h"
 #include "environment.h"
 #include "linking.h"
 #include "method-info.h"
@@ -25,6 +26,8 @@
 #include "plugin-runtime.h"
 #include "stack-frames.h"
 #include "watchdog_timer.h"
+#include <algorithm>
+#include <vector>
 #if defined(KE_ARCH_X86)
 # include "x86/jit_x86.h"
 #endif
@@ -44,7 +47,9 @@ CompilerBase::CompilerBase(PluginRuntime* rt, MethodInfo* method)
    error_(SP_ERROR_NONE),
    pcode_start_(0),
    code_start_(nullptr),
-   op_cip_(nullptr)
+   op_cip_(nullptr),
+   code_group_(rt),
+   debug_instrumented_(rt->IsMethodDebugInstrumented(method))
 {
 }
 
@@ -55,18 +60,106 @@ CompilerBase::~CompilerBase()
 CompiledFunction*
 CompilerBase::Compile(PluginContext* cx, RefPtr<MethodInfo> method, int* err)
 {
+  // The background compiler may be compiling or have compiled this method
+  // already.
+  ke::AutoLock lock(Environment::get()->compileLock());
+  CompiledFunction* current = method->jit();
+  if (current && !method->stale())
+    return current;
+
+  CodeCache* cache = Environment::get()->codeCache();
+  if (cache) {
+    if (CompiledFunction* fun = cache->Load(cx->runtime(), method)) {
+      Install(method, fun);
+      return fun;
+    }
+  }
+
   Compiler cc(cx->runtime(), method);
 
   CompiledFunction* fun = cc.emit();
   if (!fun) {
+    // Stale code still works.
+    if (current)
+      return current;
     *err = cc.error();
     return nullptr;
   }
 
-  method->setCompiledFunction(fun);
+  // Stored before it is linked in and patched.
+  if (cache)
+    cache->Store(cx->runtime(), method, fun, cc.references());
+
+  Install(method, fun);
   return fun;
 }
 
+void
+CompilerBase::Install(MethodInfo* method, CompiledFunction* fun)
+{
+  // Code compiled before debug breaks were switched on or off is replaced.
+  if (method->jit())
+    method->replaceCompiledFunction(fun);
+  else
+    method->setCompiledFunction(fun);
+}
+
+bool
+CompilerBase::Relocate(PluginContext* cx, RefPtr<MethodInfo> method, const void* group)
+{
+  ke::AutoLock lock(Environment::get()->compileLock());
+  if (!method->jit() || method->relocated())
+    return false;
+  method->setRelocated();
+
+  Compiler cc(cx->runtime(), method);
+  cc.code_group_ = group;
+
+  CompiledFunction* fun = cc.emit();
+  if (!fun)
+    return false;
+
+  method->replaceCompiledFunction(fun);
+  return true;
+}
+
+// Code compiled with --no-breaks has a line table but no BREAK opcodes. For
+// such a method, each line entry gets the break site a BREAK would have, so
+// breakpoints and stepping still stop there. Line entries are at statement
+// starts, where spcomp keeps nothing live in PRI or ALT.
+void
+CompilerBase::findLineBreaks()
+{
+  uint32_t end = pcode_start_;
+  for (auto iter = graph_->rpoBegin(); iter != graph_->rpoEnd(); iter++) {
+    Block* block = *iter;
+    const uint8_t* stop_at = block->end();
+    if (block->endType() == BlockEnd::Insn)
+      stop_at = NextInstruction(stop_at);
+    for (const uint8_t* cip = block->start(); cip < stop_at; cip = NextInstruction(cip)) {
+      if (*reinterpret_cast<const cell_t*>(cip) == OP_BREAK)
+        return;
+    }
+    end = std::max(end, uint32_t(stop_at - rt_->code().bytes));
+  }
+
+  std::vector<uint32_t> lines;
+  image_->GetLineAddresses(pcode_start_, end, &lines);
+  for (uint32_t addr : lines)
+    line_breaks_.set((addr - pcode_start_) / sizeof(cell_t));
+}
+
+CodeReferences
+CompilerBase::references() const
+{
+  CodeReferences refs;
+  refs.length = masm.length();
+  refs.local = &masm.localRefs();
+  refs.external = &masm.externalRefs();
+  refs.absolute = &masm.absoluteRefs();
+  return refs;
+}
+
 CompiledFunction*
 CompilerBase::emit()
 {
@@ -79,6 +172,11 @@ CompilerBase::emit()
   pcode_start_ = method_info_->pcode_offset();
   code_start_ = reinterpret_cast<const cell_t*>(rt_->code().bytes + pcode_start_);
 
+  if (debug_instrumented_)
+    findLineBreaks();
+  bounds_.analyze(graph_, debug_instrumented_, &line_breaks_);
+  forwarding_.analyze(graph_, debug_instrumented_, &line_breaks_);
+
 #if defined JIT_SPEW
   Environment::get()->debugger()->OnDebugSpew(
       "Compiling function %s::%s\n",
@@ -105,6 +203,9 @@ CompilerBase::emit()
       // Save the start of the opcode for emitCipMap().
       op_cip_ = reader.cip();
 
+      if (line_breaks_.test(op_cip_ - code_start_) && !visitBREAK())
+        return nullptr;
+
       if (!reader.visitNext() || error_)
         return nullptr;
     }
@@ -144,6 +245,9 @@ CompilerBase::emit()
   // Common path for invoking line debugger.
   emitDebugBreakHandler();
 
+  // Common path for stores that hit a data watchpoint.
+  emitDataWatchHandler();
+
   // This has to come very, very last, since it checks whether return paths
   // are used.
   emitErrorHandlers();
@@ -151,7 +255,7 @@ CompilerBase::emit()
   if (error_)
     return nullptr;
 
-  CodeChunk code = LinkCode(env_, masm);
+  CodeChunk code = LinkCode(env_, masm, code_group_);
   if (!code.address()) {
     reportError(SP_ERROR_OUT_OF_MEMORY);
     return nullptr;
@@ -165,12 +269,31 @@ CompilerBase::emit()
     edges->at(i).disp32 = int32_t(jump.timeout_offset) - int32_t(jump.pc);
   }
 
-  AutoPtr<FixedArray<CipMapEntry>> cipmap(
-    new FixedArray<CipMapEntry>(cip_map_.length()));
-  memcpy(cipmap->buffer(), cip_map_.buffer(), cip_map_.length() * sizeof(CipMapEntry));
+  cip_map_.shrink();
+  AutoPtr<DeltaTable> cipmap(new DeltaTable(std::move(cip_map_)));
+
+  // Patchable BREAK sites start out disarmed; the runtime arms them through
+  // the recorded displacement to the debug break thunk.
+  AutoPtr<FixedArray<DebugBreakSite>> break_sites(
+    new FixedArray<DebugBreakSite>(break_sites_.length()));
+  for (size_t i = 0; i < break_sites_.length(); i++) {
+    const BreakSite& site = break_sites_[i];
+    break_sites->at(i).offset = site.pc;
+    break_sites->at(i).cipoffs = uintptr_t(site.cip) - uintptr_t(code_start_);
+    break_sites->at(i).disp32 = int32_t(debug_break_.offset()) - int32_t(site.pc);
+    break_sites->at(i).armed = false;
+  }
+
+  AutoPtr<FixedArray<CallThunkSite>> call_sites(
+    new FixedArray<CallThunkSite>(thunk_calls_.length()));
+  for (size_t i = 0; i < thunk_calls_.length(); i++) {
+    call_sites->at(i).offset = thunk_calls_[i].pc;
+    call_sites->at(i).pcode_offs = thunk_calls_[i].offset;
+  }
 
   assert(error_ == SP_ERROR_NONE);
-  return new CompiledFunction(code, pcode_start_, edges.take(), cipmap.take());
+  return new CompiledFunction(code, pcode_start_, edges.take(), cipmap.take(),
+                              break_sites.take(), call_sites.take(), debug_instrumented_);
 }
 
 void
@@ -239,11 +362,14 @@ CompilerBase::CompileFromThunk(PluginContext* cx, cell_t pcode_offs, void** addr
     return SP_ERROR_INVALID_ADDRESS;
 
   CompiledFunction* fn = method->jit();
-  if (!fn) {
+  if (!fn || method->stale()) {
     int err;
     fn = Compile(cx, method, &err);
     if (!fn)
       return err;
+
+    // It's being called, so what it calls likely will be too.
+    LinkCallees(cx, fn);
   }
 
 #if defined JIT_SPEW
@@ -260,6 +386,29 @@ CompilerBase::CompileFromThunk(PluginContext* cx, cell_t pcode_offs, void** addr
   return SP_ERROR_NONE;
 }
 
+void
+CompilerBase::LinkCallees(PluginContext* cx, CompiledFunction* fun)
+{
+  uint8_t* base = reinterpret_cast<uint8_t*>(fun->GetEntryAddress());
+  for (uint32_t i = 0; i < fun->NumCallThunkSites(); i++) {
+    const CallThunkSite& site = fun->GetCallThunkSite(i);
+
+    RefPtr<MethodInfo> callee = cx->runtime()->AcquireMethod(site.pcode_offs);
+    if (!callee)
+      continue;
+
+    CompiledFunction* target = callee->jit();
+    if (!target || callee->stale()) {
+      // If this fails, the thunk reports it once the call is made.
+      int err;
+      target = Compile(cx, callee, &err);
+      if (!target)
+        continue;
+    }
+    PatchCallThunk(base + site.offset, target->GetEntryAddress());
+  }
+}
+
 // Find the |ebp| associated with the entry frame. We use this to drop out of
 // the entire scripted call stack.
 void*
@@ -26,7 +26,10 @@
 #include "outofline-asm.h"
 #include "pcode-visitor.h"
 #include "compiled-function.h"
+#include "bounds-analysis.h"
 #include "control-flow.h"
+#include "load-forwarding.h"
+#include "code-cache.h"
 
 namespace sp {
 
@@ -52,6 +55,34 @@ struct BackwardJump {
   {}
 };
 
+struct BreakSite {
+  // The pc after the patchable nop.
+  uint32_t pc;
+  // The cip of the BREAK instruction.
+  const cell_t* cip;
+
+  BreakSite()
+  {}
+  BreakSite(uint32_t pc, const cell_t* cip)
+   : pc(pc),
+     cip(cip)
+  {}
+};
+
+struct ThunkCall {
+  // The pc after the call to the thunk.
+  uint32_t pc;
+  // The pcode offset of the callee.
+  cell_t offset;
+
+  ThunkCall()
+  {}
+  ThunkCall(uint32_t pc, cell_t offset)
+   : pc(pc),
+     offset(offset)
+  {}
+};
+
 class CompilerBase : public PcodeVisitor
 {
   friend class ErrorPath;
@@ -62,6 +93,14 @@ class CompilerBase : public PcodeVisitor
 
   static CompiledFunction* Compile(PluginContext* cx, RefPtr<MethodInfo> method, int* err);
 
+  // Compiles an already compiled method again, into code allocated for
+  // |group|, and moves the method there. Not while plugin code is running.
+  static bool Relocate(PluginContext* cx, RefPtr<MethodInfo> method, const void* group);
+
+  // Compiles what a just compiled function calls and patches its call thunks
+  // to call the code directly. Callees' own calls are left as they are.
+  static void LinkCallees(PluginContext* cx, CompiledFunction* fun);
+
   int error() const {
     return error_;
   }
@@ -69,11 +108,17 @@ class CompilerBase : public PcodeVisitor
  protected:
   CompiledFunction* emit();
 
+  // The addresses in the code just emitted, for the code cache.
+  CodeReferences references() const;
+
+  static void Install(MethodInfo* method, CompiledFunction* fun);
+
   virtual void emitPrologue() = 0;
   virtual void emitThrowPath(int err) = 0;
   virtual void emitErrorHandlers() = 0;
   virtual void emitOutOfBoundsErrorPath(OutOfBoundsErrorPath* path) = 0;
   virtual void emitDebugBreakHandler() = 0;
+  virtual void emitDataWatchHandler() = 0;
 
   // Helpers.
   static int CompileFromThunk(PluginContext* cx, cell_t pcode_offs, void** addrp, uint8_t* pc);
@@ -89,10 +134,7 @@ class CompilerBase : public PcodeVisitor
   // cip. This lets us avoid tracking the cip during runtime. These are
   // sorted by definition since we assemble and emit in forward order.
   void emitCipMapping(const cell_t* cip) {
-    CipMapEntry entry;
-    entry.cipoffs = uintptr_t(cip) - uintptr_t(code_start_);
-    entry.pcoffs = masm.pc();
-    cip_map_.append(entry);
+    cip_map_.append(masm.pc(), uintptr_t(cip) - uintptr_t(code_start_));
   }
 
   bool isNextBlock(Block* target) {
@@ -108,6 +150,8 @@ class CompilerBase : public PcodeVisitor
 
   void reportError(int err);
 
+  void findLineBreaks();
+
  protected:
   Environment* env_;
   PluginRuntime* rt_;
@@ -116,11 +160,18 @@ class CompilerBase : public PcodeVisitor
   PoolScope scope_;
   ke::RefPtr<MethodInfo> method_info_;
   ke::RefPtr<ControlFlowGraph> graph_;
+  BoundsAnalysis bounds_;
+  LoadForwarding forwarding_;
+  // Cells of instructions that get a break site in place of a BREAK.
+  BitSet line_breaks_;
   ke::RefPtr<Block> block_;
   int error_;
   uint32_t pcode_start_;
   const cell_t* code_start_;
   const cell_t* op_cip_;
+  const void* code_group_;
+  // Read once, since it can change from another thread while compiling.
+  bool debug_instrumented_;
 
   MacroAssembler masm;
 
@@ -134,9 +185,12 @@ class CompilerBase : public PcodeVisitor
 
   // Debugging.
   Label debug_break_;
+  Label data_watch_;
 
   ke::Vector<BackwardJump> backward_jumps_;
-  ke::Vector<CipMapEntry> cip_map_;
+  DeltaTable cip_map_;
+  ke::Vector<BreakSite> break_sites_;
+  ke::Vector<ThunkCall> thunk_calls_;
 };
 
 } // namespace sp
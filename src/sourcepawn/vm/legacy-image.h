@@ -15,6 +15,7 @@
 
 #include <smx/smx-headers.h>
 #include <string.h>
+#include <vector>
 
 namespace sp {
 
@@ -58,6 +59,23 @@ class LegacyImage
     virtual bool LookupLineAddress(const uint32_t line, const char* file, ucell_t* addr) = 0;
     virtual size_t NumFiles() const = 0;
     virtual const char* GetFileName(size_t index) const = 0;
+
+    // Appends the addresses of the line entries in [codestart, codeend), in
+    // address order. Images without debug info have none.
+    virtual void GetLineAddresses(uint32_t codestart, uint32_t codeend,
+                                  std::vector<uint32_t>* out) const {
+    }
+
+    // The whole decompressed file image, for tools that parse it themselves.
+    virtual bool DescribeImage(const uint8_t** bytes, size_t* length) const {
+        return false;
+    }
+
+    // The image hash (sp_image_hash.h) of the file as it was read, before
+    // any decompression, or 0 if the image didn't come from a file.
+    virtual uint64_t FileHash() const {
+        return 0;
+    }
 };
 
 class EmptyImage : public LegacyImage
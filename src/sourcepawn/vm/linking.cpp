@@ -16,12 +16,12 @@
 using namespace sp;
 
 CodeChunk
-sp::LinkCode(Environment* env, Assembler& masm)
+sp::LinkCode(Environment* env, Assembler& masm, const void* group)
 {
   if (masm.outOfMemory())
     return CodeChunk();
 
-  CodeChunk code = env->AllocateCode(masm.length());
+  CodeChunk code = env->AllocateCode(masm.length(), group);
   if (!code.address())
     return code;
 
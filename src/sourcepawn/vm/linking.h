@@ -20,7 +20,7 @@ namespace sp {
 
 class Environment;
 
-CodeChunk LinkCode(Environment* env, Assembler& masm);
+CodeChunk LinkCode(Environment* env, Assembler& masm, const void* group = nullptr);
 uint8_t* LinkCodeToLegacyPtr(Environment* env, Assembler& masm);
 
 }
@@ -0,0 +1,241 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#include "load-forwarding.h"
+#include "opcodes.h"
+#include <algorithm>
+
+namespace sp {
+
+void
+LoadForwarding::analyze(ControlFlowGraph* graph, bool debug_breaks, BitSet* line_breaks)
+{
+  start_at_ = graph->entry()->start();
+  debug_breaks_ = debug_breaks;
+  line_breaks_ = line_breaks;
+
+  uint32_t max_id = 0;
+  for (auto iter = graph->rpoBegin(); iter != graph->rpoEnd(); iter++)
+    max_id = std::max(max_id, (*iter)->id());
+  exits_.assign(max_id + 1, State());
+  scanned_.assign(max_id + 1, false);
+
+  for (auto iter = graph->rpoBegin(); iter != graph->rpoEnd(); iter++) {
+    Block* block = *iter;
+
+    State state;
+    const auto& preds = block->predecessors();
+    if (preds.length() == 1 && scanned_[preds[0]->id()])
+      state = exits_[preds[0]->id()];
+
+    scan(block, &state);
+    exits_[block->id()] = state;
+    scanned_[block->id()] = true;
+  }
+}
+
+void
+LoadForwarding::scan(Block* block, State* state)
+{
+  const uint8_t* stop_at = block->end();
+  if (block->endType() == BlockEnd::Insn)
+    stop_at = NextInstruction(stop_at);
+
+  for (const uint8_t* cip = block->start(); cip < stop_at; cip = NextInstruction(cip)) {
+    const cell_t* insn = reinterpret_cast<const cell_t*>(cip);
+    OPCODE op = (OPCODE)insn[0];
+
+    if (debug_breaks_ && line_breaks_ && line_breaks_->test(getCellNumber(cip)))
+      *state = State();
+
+    switch (op) {
+      case OP_LOAD_S_PRI:
+        load(cip, &state->pri, state->alt, insn[1]);
+        break;
+
+      case OP_LOAD_S_ALT:
+        load(cip, &state->alt, state->pri, insn[1]);
+        break;
+
+      case OP_LOAD_S_BOTH:
+        if (state->pri.known && state->pri.offset == insn[1] &&
+            state->alt.known && state->alt.offset == insn[2])
+        {
+          redundant_.set(getCellNumber(cip));
+        }
+        state->pri = Mirror{true, insn[1]};
+        state->alt = Mirror{true, insn[2]};
+        break;
+
+      case OP_STOR_S_PRI:
+        kill(state, insn[1]);
+        state->pri = Mirror{true, insn[1]};
+        break;
+
+      case OP_STOR_S_ALT:
+        kill(state, insn[1]);
+        state->alt = Mirror{true, insn[1]};
+        break;
+
+      case OP_ZERO_S:
+      case OP_CONST_S:
+      case OP_INC_S:
+      case OP_DEC_S:
+        kill(state, insn[1]);
+        break;
+
+      case OP_MOVE_PRI:
+        state->pri = state->alt;
+        break;
+
+      case OP_MOVE_ALT:
+        state->alt = state->pri;
+        break;
+
+      case OP_XCHG:
+        std::swap(state->pri, state->alt);
+        break;
+
+      case OP_PUSH_PRI:
+      case OP_PUSH_ALT:
+      {
+        // A pop right after the push moves the value between registers, and
+        // the stack ends up where it was.
+        const uint8_t* next = NextInstruction(cip);
+        if (next >= stop_at)
+          break;
+        OPCODE next_op = (OPCODE)*reinterpret_cast<const cell_t*>(next);
+        if (next_op != OP_POP_PRI && next_op != OP_POP_ALT)
+          break;
+
+        Mirror* src = (op == OP_PUSH_PRI) ? &state->pri : &state->alt;
+        Mirror* dest = (next_op == OP_POP_PRI) ? &state->pri : &state->alt;
+        redundant_.set(getCellNumber(cip));
+        if (src == dest)
+          redundant_.set(getCellNumber(next));
+        else
+          forwarded_.set(getCellNumber(next));
+        *dest = *src;
+        cip = next;
+        break;
+      }
+
+      // These change only ALT.
+      case OP_LOAD_ALT:
+      case OP_LREF_S_ALT:
+      case OP_CONST_ALT:
+      case OP_ADDR_ALT:
+      case OP_ZERO_ALT:
+      case OP_INC_ALT:
+      case OP_DEC_ALT:
+      case OP_SHL_C_ALT:
+        state->alt = Mirror();
+        break;
+
+      // These change only PRI.
+      case OP_LOAD_PRI:
+      case OP_LREF_S_PRI:
+      case OP_CONST_PRI:
+      case OP_ADDR_PRI:
+      case OP_ZERO_PRI:
+      case OP_INC_PRI:
+      case OP_DEC_PRI:
+      case OP_SHL_C_PRI:
+        state->pri = Mirror();
+        break;
+
+      // These leave both registers and the frame alone. Pushes write below
+      // the stack pointer, where no slot a register mirrors lives.
+      case OP_STOR_PRI:
+      case OP_STOR_ALT:
+      case OP_ZERO:
+      case OP_INC:
+      case OP_DEC:
+      case OP_CONST:
+      case OP_PUSH_C:
+      case OP_PUSH:
+      case OP_PUSH_S:
+      case OP_PUSH_ADR:
+      case OP_PUSH2_C:
+      case OP_PUSH2:
+      case OP_PUSH2_S:
+      case OP_PUSH2_ADR:
+      case OP_PUSH3_C:
+      case OP_PUSH3:
+      case OP_PUSH3_S:
+      case OP_PUSH3_ADR:
+      case OP_PUSH4_C:
+      case OP_PUSH4:
+      case OP_PUSH4_S:
+      case OP_PUSH4_ADR:
+      case OP_PUSH5_C:
+      case OP_PUSH5:
+      case OP_PUSH5_S:
+      case OP_PUSH5_ADR:
+      case OP_BOUNDS:
+      case OP_NOP:
+      case OP_JUMP:
+      case OP_JZER:
+      case OP_JNZ:
+      case OP_JEQ:
+      case OP_JNEQ:
+      case OP_JSLESS:
+      case OP_JSLEQ:
+      case OP_JSGRTR:
+      case OP_JSGEQ:
+      case OP_SWITCH:
+        break;
+
+      case OP_BREAK:
+        if (debug_breaks_)
+          *state = State();
+        break;
+
+      // Anything else may change either register or the frame.
+      default:
+        *state = State();
+        break;
+    }
+
+    if (debug_breaks_ && IsFixedAddressStore(op))
+      *state = State();
+  }
+}
+
+void
+LoadForwarding::load(const uint8_t* cip, Mirror* dest, const Mirror& other, cell_t offset)
+{
+  if (dest->known && dest->offset == offset)
+    redundant_.set(getCellNumber(cip));
+  else if (other.known && other.offset == offset)
+    forwarded_.set(getCellNumber(cip));
+  *dest = Mirror{true, offset};
+}
+
+static inline bool
+Overlaps(cell_t a, cell_t b)
+{
+  cell_t distance = a - b;
+  return distance > -cell_t(sizeof(cell_t)) && distance < cell_t(sizeof(cell_t));
+}
+
+// Forgets registers mirroring any slot a cell store at |offset| overlaps.
+void
+LoadForwarding::kill(State* state, cell_t offset)
+{
+  if (state->pri.known && Overlaps(state->pri.offset, offset))
+    state->pri = Mirror();
+  if (state->alt.known && Overlaps(state->alt.offset, offset))
+    state->alt = Mirror();
+}
+
+} // namespace sp
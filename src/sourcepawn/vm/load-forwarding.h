@@ -0,0 +1,87 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+
+#ifndef _include_sourcepawn_vm_load_forwarding_h_
+#define _include_sourcepawn_vm_load_forwarding_h_
+
+#include <sp_vm_types.h>
+#include <vector>
+#include "bitset.h"
+#include "control-flow.h"
+
+namespace sp {
+
+// Finds frame loads and stack traffic the JIT can replace with the registers
+// it already has. PRI and ALT live in registers, so code like
+//
+//     stor.s.pri i; load.s.pri i      push.pri; pop.alt
+//
+// needs no memory access for its second half. A register is known to hold a
+// frame slot after loading or storing it, until either changes; this flows
+// through a block and into successors with no other predecessor, like
+// BoundsAnalysis. Anything that could write the frame behind the analysis'
+// back forgets both: stores through a pointer, calls, the stack pointer
+// moving up, and, when the debugger can set locals, BREAK and watched stores.
+class LoadForwarding
+{
+ public:
+  // |line_breaks| as for BoundsAnalysis::analyze.
+  void analyze(ControlFlowGraph* graph, bool debug_breaks, BitSet* line_breaks);
+
+  // The instruction at |cip| can be left out: its destination register
+  // already holds what it would load. For a push, the pop after it takes
+  // the value from the register instead.
+  bool isRedundant(const cell_t* cip) {
+    return redundant_.test(getCellNumber(cip));
+  }
+
+  // The instruction at |cip| loads what the other register holds.
+  bool isForwarded(const cell_t* cip) {
+    return forwarded_.test(getCellNumber(cip));
+  }
+
+ private:
+  struct Mirror {
+    bool known = false;
+    cell_t offset = 0;
+  };
+  struct State {
+    Mirror pri;
+    Mirror alt;
+  };
+
+  void scan(Block* block, State* state);
+  void load(const uint8_t* cip, Mirror* dest, const Mirror& other, cell_t offset);
+  static void kill(State* state, cell_t offset);
+
+  uint32_t getCellNumber(const void* cip) const {
+    return static_cast<uint32_t>((reinterpret_cast<const uint8_t*>(cip) - start_at_) /
+                                 sizeof(cell_t));
+  }
+
+ private:
+  const uint8_t* start_at_ = nullptr;
+  bool debug_breaks_ = false;
+  BitSet* line_breaks_ = nullptr;
+
+  // Indexed by block id.
+  std::vector<State> exits_;
+  std::vector<bool> scanned_;
+
+  BitSet redundant_;
+  BitSet forwarded_;
+};
+
+} // namespace sp
+
+#endif // _include_sourcepawn_vm_load_forwarding_h_
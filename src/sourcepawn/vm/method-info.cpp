@@ -10,17 +10,23 @@
 // You should have received a copy of the GNU General Public License along with
 // SourcePawn. If not, see http://www.gnu.org/licenses/.
 //
+#include <string.h>
 #include "environment.h"
 #include "compiled-function.h"
 #include "method-info.h"
 #include "method-verifier.h"
 #include "graph-builder.h"
+#include "plugin-runtime.h"
+#include "threaded-code.h"
 
 namespace sp {
 
 MethodInfo::MethodInfo(PluginRuntime* rt, uint32_t codeOffset)
  : rt_(rt),
    pcode_offset_(codeOffset),
+   jit_(nullptr),
+   relocated_(false),
+   debug_interest_(false),
    checked_(false),
    validation_error_(SP_ERROR_NONE),
    max_stack_(0)
@@ -29,17 +35,82 @@ MethodInfo::MethodInfo(PluginRuntime* rt, uint32_t codeOffset)
 
 MethodInfo::~MethodInfo()
 {
+  delete jit_.load(std::memory_order_relaxed);
+}
+
+const ThreadedCode*
+MethodInfo::threaded()
+{
+  if (!threaded_)
+    threaded_ = ThreadedCode::Build(rt_, pcode_offset_);
+  return threaded_.get();
 }
 
 void
 MethodInfo::setCompiledFunction(CompiledFunction* fun)
 {
-  assert(!jit_);
+  assert(!jit());
 
   // Grab the lock before linking code in, since the watchdog timer will look
   // at this on another thread.
-  ke::AutoLock lock(Environment::get()->lock());
-  jit_ = fun;
+  Environment* env = Environment::get();
+  ke::AutoLock lock(env->lock());
+
+  // Code compiled in the background can be linked while a timeout is being
+  // processed, after the watchdog patched everything else.
+  if (env->AreJumpsPatchedForTimeout())
+    env->PatchJumpsForTimeout(fun);
+
+  if (env->IsDebugBreakPatchable())
+    rt_->PatchDebugBreakSites(fun);
+
+  jit_.store(fun, std::memory_order_release);
+}
+
+void
+MethodInfo::replaceCompiledFunction(CompiledFunction* fun)
+{
+  assert(jit());
+
+  Environment* env = Environment::get();
+  ke::AutoLock lock(env->lock());
+
+  if (env->AreJumpsPatchedForTimeout())
+    env->PatchJumpsForTimeout(fun);
+
+  if (env->IsDebugBreakPatchable())
+    rt_->PatchDebugBreakSites(fun);
+
+  // Calls linked to the old entry take a jmp rel32 to the new one.
+  CompiledFunction* old = jit();
+  uint8_t* entry = reinterpret_cast<uint8_t*>(old->GetEntryAddress());
+  uint8_t* target = reinterpret_cast<uint8_t*>(fun->GetEntryAddress());
+  int32_t disp32 = int32_t(intptr_t(target) - intptr_t(entry + 5));
+  entry[0] = 0xe9;
+  memcpy(entry + 1, &disp32, sizeof(disp32));
+
+  retired_.emplace_back(old);
+  jit_.store(fun, std::memory_order_release);
+}
+
+bool
+MethodInfo::stale() const
+{
+  CompiledFunction* fun = jit();
+  return fun && fun->IsDebugInstrumented() != rt_->IsMethodDebugInstrumented(this);
+}
+
+ucell_t
+MethodInfo::FindCipByPc(void* pc)
+{
+  CompiledFunction* fun = jit();
+  if (!fun)
+    return kInvalidCip;
+
+  ucell_t cip = fun->FindCipByPc(pc);
+  for (size_t i = 0; i < retired_.size() && cip == kInvalidCip; i++)
+    cip = retired_[i]->FindCipByPc(pc);
+  return cip;
 }
 
 void
@@ -14,15 +14,21 @@
 #define _INCLUDE_SOURCEPAWN_VM_METHOD_INFO_H_
 
 #include <sp_vm_types.h>
-#include <amtl/am-refcounting.h>
+#include <amtl/am-refcounting-threadsafe.h>
 #include "control-flow.h"
+#include <atomic>
+#include <memory>
+#include <vector>
 
 namespace sp {
 
 class PluginRuntime;
 class CompiledFunction;
+class ThreadedCode;
 
-class MethodInfo final : public ke::Refcounted<MethodInfo>
+// Methods are shared with the background compiler, so references to them
+// may be taken on either thread.
+class MethodInfo final : public ke::RefcountedThreadsafe<MethodInfo>
 {
  public:
   MethodInfo(PluginRuntime* rt, uint32_t codeOffset);
@@ -41,6 +47,13 @@ class MethodInfo final : public ke::Refcounted<MethodInfo>
     return graph_.take();
   }
 
+  // Verifies the method ahead of its first call, keeping the graph for the
+  // compiler. Only before the method can be used on another thread.
+  void Prevalidate() {
+    if (!checked_)
+      InternalValidate();
+  }
+
   int validationError() const {
     return validation_error_;
   }
@@ -51,10 +64,47 @@ class MethodInfo final : public ke::Refcounted<MethodInfo>
     return max_stack_;
   }
 
+  // Publishes the method's code. Once set, jit() returns it on any thread.
   void setCompiledFunction(CompiledFunction* fun);
   CompiledFunction* jit() const {
-    return jit_;
+    return jit_.load(std::memory_order_acquire);
+  }
+
+  // Moves the method to code compiled again. Callers linked to the old
+  // code are sent on from its entry, and frames still running it return
+  // into it, so it is kept until the method goes away.
+  void replaceCompiledFunction(CompiledFunction* fun);
+  const std::vector<std::unique_ptr<CompiledFunction>>& retired() const {
+    return retired_;
+  }
+
+  // Whether the code was compiled before debug breaks were switched on or
+  // off for the runtime, or for the method.
+  bool stale() const;
+
+  // With per-method debug breaks, whether the method has an armed break
+  // site, or its plugin arms every site or watches data. Written under the
+  // environment lock.
+  bool hasDebugInterest() const {
+    return debug_interest_.load(std::memory_order_relaxed);
+  }
+  void setDebugInterest(bool interest) {
+    debug_interest_.store(interest, std::memory_order_relaxed);
+  }
+
+  // Whether the method was moved to hot code already.
+  bool relocated() const {
+    return relocated_;
   }
+  void setRelocated() {
+    relocated_ = true;
+  }
+
+  // The cip of a return address in the method's current or retired code.
+  ucell_t FindCipByPc(void* pc);
+
+  // The pcode decoded for the interpreter, built on first use.
+  const ThreadedCode* threaded();
 
  private:
   void InternalValidate();
@@ -62,8 +112,14 @@ class MethodInfo final : public ke::Refcounted<MethodInfo>
  private:
   PluginRuntime* rt_;
   uint32_t pcode_offset_;
-  ke::AutoPtr<CompiledFunction> jit_;
+  // Owned.
+  std::atomic<CompiledFunction*> jit_;
   ke::RefPtr<ControlFlowGraph> graph_;
+  std::unique_ptr<ThreadedCode> threaded_;
+  // Code replaced since, which is entered only to jump to jit_.
+  std::vector<std::unique_ptr<CompiledFunction>> retired_;
+  bool relocated_;
+  std::atomic<bool> debug_interest_;
 
   bool checked_;
   int validation_error_;
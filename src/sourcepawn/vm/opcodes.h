@@ -53,6 +53,31 @@ NextInstruction(const uint8_t* cip)
   return cip + kOpcodeSizes[op] * sizeof(cell_t);
 }
 
+// Stores to a fixed frame or data address. With debug breaks compiled in,
+// the JIT checks these against data watches, and a hit can stop in the
+// debugger, which may change locals.
+static inline bool
+IsFixedAddressStore(OPCODE op)
+{
+  switch (op) {
+    case OP_STOR_PRI:
+    case OP_STOR_ALT:
+    case OP_STOR_S_PRI:
+    case OP_STOR_S_ALT:
+    case OP_ZERO:
+    case OP_ZERO_S:
+    case OP_INC:
+    case OP_INC_S:
+    case OP_DEC:
+    case OP_DEC_S:
+    case OP_CONST:
+    case OP_CONST_S:
+      return true;
+    default:
+      return false;
+  }
+}
+
 } // namespace sp
 
 #endif //_INCLUDE_SOURCEPAWN_JIT_X86_OPCODES_H_
@@ -92,6 +92,11 @@ class PcodeReader
     return (cip_ - code_) * sizeof(cell_t);
   }
 
+  // Moves to an instruction decoded ahead of time.
+  void setCip(const cell_t* cip) {
+    cip_ = cip;
+  }
+
   void jump(cell_t offset) {
     assert(offset >= 0);
     assert(ke::IsAligned(offset, sizeof(cell_t)));
@@ -105,6 +105,9 @@ class PluginContext : public BasePluginContext
   cell_t hp() const {
     return hp_;
   }
+  cell_t stp() const {
+    return stp_;
+  }
 
   int popTrackerAndSetHeap();
   int pushTracker(uint32_t amount);
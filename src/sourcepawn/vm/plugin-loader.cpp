@@ -0,0 +1,172 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#include "plugin-loader.h"
+#include <stdio.h>
+#include <string.h>
+#include "api.h"
+#include "plugin-runtime.h"
+#include "smx-v1-image.h"
+
+using namespace sp;
+
+PluginRuntime*
+sp::LoadPluginFile(const char* file, char* error, size_t maxlength)
+{
+  FILE* fp = fopen(file, "rb");
+
+  if (!fp) {
+    UTIL_Format(error, maxlength, "file not found");
+    return nullptr;
+  }
+
+  ke::AutoPtr<SmxV1Image> image(new SmxV1Image(fp));
+  fclose(fp);
+
+  if (!image->validate()) {
+    const char* errorMessage = image->errorMessage();
+    if (!errorMessage)
+      errorMessage = "file parse error";
+    UTIL_Format(error, maxlength, "%s", errorMessage);
+    return nullptr;
+  }
+
+  PluginRuntime* pRuntime = new PluginRuntime(image.take());
+  if (!pRuntime->Initialize()) {
+    delete pRuntime;
+
+    UTIL_Format(error, maxlength, "out of memory");
+    return nullptr;
+  }
+
+  size_t len = strlen(file);
+  for (size_t i = len - 1; i < len; i--) {
+    if (file[i] == '/'
+# if defined WIN32
+      || file[i] == '\\'
+# endif
+    )
+    {
+      pRuntime->SetNames(file, &file[i + 1]);
+      break;
+    }
+  }
+
+  if (!pRuntime->Name())
+    pRuntime->SetNames(file, file);
+
+  return pRuntime;
+}
+
+PluginLoader::PluginLoader()
+ : terminate_(false),
+   next_(0)
+{
+}
+
+PluginLoader::~PluginLoader()
+{
+  Shutdown();
+}
+
+bool
+PluginLoader::Start(const char* const* files, size_t count, size_t threads)
+{
+  Shutdown();
+
+  for (size_t i = 0; i < count; i++) {
+    // The host asks for each file once; a repeat is loaded as usual.
+    if (index_.count(files[i]))
+      continue;
+    index_[files[i]] = jobs_.size();
+    jobs_.push_back(Job{files[i], false, false, nullptr, std::string()});
+  }
+
+  terminate_ = false;
+  next_ = 0;
+  for (size_t i = 0; i < threads && i < jobs_.size(); i++) {
+    std::unique_ptr<ke::Thread> thread(new ke::Thread([this]() -> void {
+      Run();
+    }, "SP Loader"));
+    if (!thread->Succeeded())
+      break;
+    threads_.push_back(std::move(thread));
+  }
+  if (threads_.empty()) {
+    jobs_.clear();
+    index_.clear();
+    return false;
+  }
+  return true;
+}
+
+void
+PluginLoader::Run()
+{
+  ke::AutoLock lock(&cv_);
+  while (!terminate_ && next_ < jobs_.size()) {
+    Job& job = jobs_[next_++];
+
+    PluginRuntime* rt;
+    char error[255];
+    {
+      ke::AutoUnlock unlock(&cv_);
+      rt = LoadPluginFile(job.path.c_str(), error, sizeof(error));
+    }
+
+    job.rt = rt;
+    if (!rt)
+      job.error = error;
+    job.done = true;
+    cv_.Notify();
+  }
+}
+
+bool
+PluginLoader::Take(const char* file, PluginRuntime** rt, char* error, size_t maxlength)
+{
+  auto iter = index_.find(file);
+  if (iter == index_.end())
+    return false;
+
+  ke::AutoLock lock(&cv_);
+  Job& job = jobs_[iter->second];
+  if (job.taken)
+    return false;
+  while (!job.done)
+    cv_.Wait();
+
+  job.taken = true;
+  *rt = job.rt;
+  if (!job.rt)
+    UTIL_Format(error, maxlength, "%s", job.error.c_str());
+  return true;
+}
+
+void
+PluginLoader::Shutdown()
+{
+  {
+    ke::AutoLock lock(&cv_);
+    terminate_ = true;
+  }
+  for (const auto& thread : threads_)
+    thread->Join();
+  threads_.clear();
+
+  for (const Job& job : jobs_) {
+    if (!job.taken)
+      delete job.rt;
+  }
+  jobs_.clear();
+  index_.clear();
+}
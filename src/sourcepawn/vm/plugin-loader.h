@@ -0,0 +1,80 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#ifndef _include_sourcepawn_vm_plugin_loader_h_
+#define _include_sourcepawn_vm_plugin_loader_h_
+
+#include <amtl/am-thread-utils.h>
+#include <stddef.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace sp {
+
+class PluginRuntime;
+
+// Reads, decompresses and validates a plugin file and sets up its runtime,
+// verifying its methods if parallel verification is on. Safe to call from
+// any thread. Null with |error| filled on failure.
+PluginRuntime* LoadPluginFile(const char* file, char* error, size_t maxlength);
+
+// Loads a batch of plugin files on worker threads ahead of the host asking
+// for them, in the order given, so that at startup the main thread mostly
+// waits on files that are already done instead of loading each in turn. The
+// host still binds and starts each plugin itself, in its own order.
+class PluginLoader
+{
+ public:
+  PluginLoader();
+  ~PluginLoader();
+
+  // Drops what is left of the previous batch and starts this one. Main
+  // thread only.
+  bool Start(const char* const* files, size_t count, size_t threads);
+
+  // If |file| is in the batch and not taken yet, waits for it and returns
+  // true, with |*rt| its runtime, or null with |error| filled. Main thread
+  // only.
+  bool Take(const char* file, PluginRuntime** rt, char* error, size_t maxlength);
+
+  // Waits for the workers and frees every runtime nobody took. Main thread
+  // only.
+  void Shutdown();
+
+ private:
+  // Worker threads.
+  void Run();
+
+ private:
+  struct Job {
+    std::string path;
+    // Guarded by cv_.
+    bool done;
+    bool taken;
+    PluginRuntime* rt;
+    std::string error;
+  };
+
+  ke::ConditionVariable cv_;
+  // Fixed while the workers run; each job's results are guarded by cv_.
+  std::vector<Job> jobs_;
+  std::unordered_map<std::string, size_t> index_;
+  bool terminate_;
+  size_t next_;
+  std::vector<std::unique_ptr<ke::Thread>> threads_;
+};
+
+} // namespace sp
+
+#endif // _include_sourcepawn_vm_plugin_loader_h_
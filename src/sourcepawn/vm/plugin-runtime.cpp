@@ -15,12 +15,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <smx/smx-v1-opcodes.h>
 #include "compiled-function.h"
 #include "environment.h"
 #include "method-info.h"
 #include "plugin-context.h"
 #include "builtins.h"
+#include "background-compiler.h"
+#include "code-cache.h"
 
 #include "md5/md5.h"
 
@@ -30,13 +35,26 @@ using namespace SourcePawn;
 PluginRuntime::PluginRuntime(LegacyImage* image)
  : image_(image),
    paused_(false),
+   debug_break_state_(DebugBreakState::Unknown),
+   all_breaks_armed_(false),
+   data_watched_(false),
+   data_watch_base_(~ucell_t(0)),
+   data_watch_span_(0),
+   data_watch_store_size_(0),
    computed_code_hash_(false),
-   computed_data_hash_(false)
+   computed_data_hash_(false),
+   cpu_time_(0),
+   cpu_invocations_(0)
 {
   code_ = image_->DescribeCode();
   data_ = image_->DescribeData();
   memset(code_hash_, 0, sizeof(code_hash_));
   memset(data_hash_, 0, sizeof(data_hash_));
+#if defined(SP_OPCODE_STATS)
+  memset(opcode_counts_, 0, sizeof(opcode_counts_));
+  if (Environment::get()->IsOpcodePairStatsEnabled())
+    opcode_pairs_ = std::make_unique<uint64_t[]>(OPCODES_TOTAL * OPCODES_TOTAL);
+#endif
 
   ke::AutoLock lock(Environment::get()->lock());
   Environment::get()->RegisterRuntime(this);
@@ -44,6 +62,15 @@ PluginRuntime::PluginRuntime(LegacyImage* image)
 
 PluginRuntime::~PluginRuntime()
 {
+  // The background compiler links code in under the environment lock, so it
+  // has to be stopped before the lock is taken.
+  if (BackgroundCompiler* compiler = Environment::get()->backgroundCompiler())
+    compiler->Cancel(this);
+  if (CodeCache* cache = Environment::get()->codeCache()) {
+    ke::AutoLock lock(Environment::get()->compileLock());
+    cache->Forget(this);
+  }
+
   // The watchdog thread takes the global JIT lock while it patches all
   // runtimes. It is not enough to ensure that the unlinking of the runtime is
   // protected; we cannot delete functions or code while the watchdog might be
@@ -51,6 +78,7 @@ PluginRuntime::~PluginRuntime()
   ke::AutoLock lock(Environment::get()->lock());
 
   Environment::get()->DeregisterRuntime(this);
+  Environment::get()->ReleaseCodeGroup(this);
 
   for (uint32_t i = 0; i < image_->NumPublics(); i++)
     delete entrypoints_[i];
@@ -93,13 +121,97 @@ PluginRuntime::Initialize()
     return false;
 
   SetupFloatNativeRemapping();
+  SetupNativeIntrinsics();
 
   if (!function_map_.init(32))
     return false;
 
+  if (size_t threads = Environment::get()->verifyThreads())
+    VerifyMethods(threads);
+
   return true;
 }
 
+// Smaller plugins are verified a method at a time as they are called.
+static const size_t kMinParallelVerifyBytes = 64 * 1024;
+
+void
+PluginRuntime::VerifyMethods(size_t threads)
+{
+  if (code_.length < kMinParallelVerifyBytes)
+    return;
+
+  std::vector<ucell_t> procs;
+  ScanMethods(&procs, nullptr);
+
+  std::vector<RefPtr<MethodInfo>> methods;
+  for (ucell_t offset : procs) {
+    if (RefPtr<MethodInfo> method = AcquireMethod(offset))
+      methods.push_back(method);
+  }
+
+  // Methods don't depend on each other, so each thread takes the next one
+  // left. Nothing else can use them until the runtime is loaded.
+  std::atomic<size_t> next(0);
+  auto verify = [&methods, &next]() -> void {
+    for (size_t i = next++; i < methods.size(); i = next++)
+      methods[i]->Prevalidate();
+  };
+
+  std::vector<std::unique_ptr<ke::Thread>> workers;
+  for (size_t i = 0; i < threads && i + 1 < methods.size(); i++) {
+    std::unique_ptr<ke::Thread> thread(new ke::Thread(verify, "SP Verifier"));
+    if (!thread->Succeeded())
+      break;
+    workers.push_back(std::move(thread));
+  }
+  verify();
+  for (const auto& thread : workers)
+    thread->Join();
+}
+
+// Instruction sizes, in cells. Opcodes that are never generated are 0.
+static const uint8_t kOpcodeCells[] = {
+#define _G(op, text, cells) cells,
+#define _U(op, text) 0,
+  OPCODE_LIST(_G, _U)
+#undef _U
+#undef _G
+};
+
+void
+PluginRuntime::ScanMethods(std::vector<ucell_t>* procs,
+                           std::vector<std::vector<ucell_t>>* callees) const
+{
+  const cell_t* code = reinterpret_cast<const cell_t*>(code_.bytes);
+  size_t ncells = code_.length / sizeof(cell_t);
+
+  // Something that does not decode is skipped a cell at a time.
+  size_t i = 0;
+  while (i < ncells) {
+    OPCODE op = OPCODE(code[i]);
+    if (op == OP_PROC) {
+      procs->push_back(ucell_t(i * sizeof(cell_t)));
+      if (callees)
+        callees->emplace_back();
+      i++;
+      continue;
+    }
+
+    size_t cells = ucell_t(op) < OPCODES_TOTAL ? kOpcodeCells[op] : 0;
+    if (op == OP_CASETBL && i + 1 < ncells)
+      cells = (size_t(ucell_t(code[i + 1])) * 2) + 3;
+    if (!cells || cells > ncells - i) {
+      i++;
+      continue;
+    }
+
+    if (op == OP_CALL && callees && !callees->empty())
+      callees->back().push_back(ucell_t(code[i + 1]));
+    i += cells;
+  }
+}
+
 struct NativeMapping {
   const char* name;
   unsigned opcode;
@@ -118,6 +230,7 @@ static const NativeMapping sNativeMap[] = {
   { "RoundToZero",    OP_RND_TO_ZERO },
   { "RoundToFloor",   OP_RND_TO_FLOOR },
   { "RoundToNearest", OP_RND_TO_NEAREST },
+  { "RoundFloat",     OP_RND_TO_NEAREST },
   { "__FLOAT_GT__",   OP_FLOAT_GT },
   { "__FLOAT_GE__",   OP_FLOAT_GE },
   { "__FLOAT_LT__",   OP_FLOAT_LT },
@@ -160,6 +273,33 @@ PluginRuntime::SetupFloatNativeRemapping()
   }
 }
 
+struct IntrinsicMapping {
+  const char* name;
+  NativeIntrinsic intrinsic;
+};
+
+static const IntrinsicMapping sIntrinsicMap[] = {
+  { "SquareRoot",     NativeIntrinsic::SquareRoot },
+  { "strlen",         NativeIntrinsic::StrLen },
+  { NULL,             NativeIntrinsic::None },
+};
+
+void
+PluginRuntime::SetupNativeIntrinsics()
+{
+  intrinsics_ = MakeUnique<NativeIntrinsic[]>(image_->NumNatives());
+  for (size_t i = 0; i < image_->NumNatives(); i++) {
+    const char* name = image_->GetNative(i);
+    intrinsics_[i] = NativeIntrinsic::None;
+    for (const IntrinsicMapping* iter = sIntrinsicMap; iter->name; iter++) {
+      if (strcmp(name, iter->name) == 0) {
+        intrinsics_[i] = iter->intrinsic;
+        break;
+      }
+    }
+  }
+}
+
 static cell_t
 NativeMustBeReplaced(IPluginContext* cx, const cell_t* params)
 {
@@ -201,6 +341,9 @@ PluginRuntime::SetNames(const char* fullname, const char* name)
 RefPtr<MethodInfo>
 PluginRuntime::GetMethod(cell_t pcode_offset) const
 {
+  // Called by the background compiler, while the game thread may be adding
+  // methods.
+  ke::AutoLock lock(Environment::get()->lock());
   FunctionMap::Result r = function_map_.find(pcode_offset);
   if (!r.found())
     return nullptr;
@@ -228,16 +371,17 @@ PluginRuntime::AcquireMethod(cell_t pcode_offset)
   if (*address != OP_PROC)
     return nullptr;
 
+  // Grab the lock before linking code in, since the watchdog timer and the
+  // background compiler will look at these on another thread.
   RefPtr<MethodInfo> method = new MethodInfo(this, pcode_offset);
-  if (!function_map_.add(p, pcode_offset, method))
-    return nullptr;
-
-  // Grab the lock before linking code in, since the watchdog timer will look
-  // at this list on another thread.
   {
     ke::AutoLock lock(Environment::get()->lock());
+    if (!function_map_.add(p, pcode_offset, method))
+      return nullptr;
     if (!methods_.append(method))
       return nullptr;
+    if (Environment::get()->AreDebugBreaksPerMethod())
+      UpdateDebugInterest(method);
   }
   return method;
 }
@@ -280,7 +424,8 @@ PluginRuntime::UpdateNativeBinding(uint32_t index, SPVM_NATIVE_FUNC pfn, uint32_
   // Otherwise, we've already baked its address in at callsites and it's too
   // late to fix them.
   if (native->status == SP_NATIVE_BOUND &&
-      !(native->flags & (SP_NTVFLAG_OPTIONAL|SP_NTVFLAG_EPHEMERAL)))
+      !(native->flags & (SP_NTVFLAG_OPTIONAL|SP_NTVFLAG_EPHEMERAL)) &&
+      !Environment::get()->IsNativeRebindingEnabled())
   {
     return SP_ERROR_PARAM;
   }
@@ -582,3 +727,276 @@ PluginRuntime::LookupLineAddress(const uint32_t line, const char* file, ucell_t*
     return SP_ERROR_NOT_FOUND;
   return SP_ERROR_NONE;
 }
+
+bool
+PluginRuntime::IsDebugBreakInstrumented()
+{
+  if (debug_break_state_ == DebugBreakState::Unknown) {
+    Environment* env = Environment::get();
+    IDebugBreakFilter* filter = env->debugBreakFilter();
+    if (!env->IsDebugBreakEnabled())
+      debug_break_state_ = DebugBreakState::Ignored;
+    else if (filter && !filter->ShouldDebugBreak(this))
+      debug_break_state_ = DebugBreakState::Ignored;
+    else
+      debug_break_state_ = DebugBreakState::Instrumented;
+  }
+  return debug_break_state_ == DebugBreakState::Instrumented &&
+         Environment::get()->AreDebugBreaksActive();
+}
+
+bool
+PluginRuntime::IsMethodDebugInstrumented(const MethodInfo* method)
+{
+  if (!IsDebugBreakInstrumented())
+    return false;
+  return !Environment::get()->AreDebugBreaksPerMethod() || method->hasDebugInterest();
+}
+
+// Returns whether the method has debug interest now but runs code compiled
+// without it.
+bool
+PluginRuntime::UpdateDebugInterest(MethodInfo* method)
+{
+  Environment::get()->lock()->AssertCurrentThreadOwns();
+
+  bool interest = all_breaks_armed_ || data_watched_;
+  if (!interest && !armed_breaks_.empty()) {
+    if (method_starts_.empty())
+      ScanMethods(&method_starts_, nullptr);
+    ucell_t start = method->pcode_offset();
+    auto next = std::upper_bound(method_starts_.begin(), method_starts_.end(), start);
+    ucell_t end = next == method_starts_.end() ? ucell_t(code_.length) : *next;
+    for (size_t cell = start / sizeof(cell_t); cell < end / sizeof(cell_t) && !interest; cell++)
+      interest = armed_breaks_[cell];
+  }
+  method->setDebugInterest(interest);
+  return interest && method->stale();
+}
+
+void
+PluginRuntime::UpdateAllDebugInterest(std::vector<RefPtr<MethodInfo>>* recompile)
+{
+  for (const auto& method : methods_) {
+    if (UpdateDebugInterest(method))
+      recompile->push_back(method);
+  }
+}
+
+static inline void
+PatchDebugBreakSite(uint8_t* code, DebugBreakSite& site, bool armed)
+{
+  if (site.armed == armed)
+    return;
+
+  // Swap between a call to the debug break thunk and a nop of the same
+  // length, matching what Compiler::visitBREAK emits.
+  static const uint8_t kNop5[kDebugBreakSiteSize] = { 0x0f, 0x1f, 0x44, 0x00, 0x00 };
+  uint8_t* loc = code + site.offset - kDebugBreakSiteSize;
+  if (armed) {
+    loc[0] = 0xe8;
+    memcpy(loc + 1, &site.disp32, sizeof(site.disp32));
+  } else {
+    memcpy(loc, kNop5, sizeof(kNop5));
+  }
+  site.armed = armed;
+}
+
+void
+PluginRuntime::PatchDebugBreakSites(CompiledFunction* fun)
+{
+  Environment::get()->lock()->AssertCurrentThreadOwns();
+
+  uint8_t* base = reinterpret_cast<uint8_t*>(fun->GetEntryAddress());
+  for (size_t i = 0; i < fun->NumDebugBreakSites(); i++) {
+    DebugBreakSite& site = fun->GetDebugBreakSite(i);
+    PatchDebugBreakSite(base, site, IsDebugBreakArmed(fun->GetCodeOffset() + site.cipoffs));
+  }
+}
+
+int
+PluginRuntime::SetDebugBreakSite(ucell_t cip, bool armed)
+{
+  if (!Environment::get()->IsDebugBreakPatchable())
+    return SP_ERROR_NOTDEBUGGING;
+  if (cip >= code_.length || !ke::IsAligned(size_t(cip), sizeof(cell_t)))
+    return SP_ERROR_INVALID_ADDRESS;
+
+  Environment* env = Environment::get();
+  std::vector<RefPtr<MethodInfo>> recompile;
+  {
+    // Methods compiled in the background read the armed state under the lock.
+    ke::AutoLock lock(env->lock());
+    if (armed_breaks_.empty())
+      armed_breaks_.resize(code_.length / sizeof(cell_t));
+    armed_breaks_[cip / sizeof(cell_t)] = armed;
+
+    // Methods are not ordered, so the one owning this cip is the one with the
+    // closest preceding entry point. Methods that have not been compiled yet
+    // pick up the new state in MethodInfo::setCompiledFunction.
+    MethodInfo* owner = nullptr;
+    for (const auto& method : methods_) {
+      if (method->pcode_offset() > cip)
+        continue;
+      if (!owner || method->pcode_offset() > owner->pcode_offset())
+        owner = method;
+    }
+    if (owner) {
+      if (env->AreDebugBreaksPerMethod() && UpdateDebugInterest(owner))
+        recompile.push_back(owner);
+      if (CompiledFunction* fun = owner->jit())
+        PatchDebugBreakSites(fun);
+    }
+  }
+  env->RecompileForDebugging(this, recompile);
+  return SP_ERROR_NONE;
+}
+
+int
+PluginRuntime::SetAllDebugBreakSites(bool armed)
+{
+  if (!Environment::get()->IsDebugBreakPatchable())
+    return SP_ERROR_NOTDEBUGGING;
+
+  Environment* env = Environment::get();
+  std::vector<RefPtr<MethodInfo>> recompile;
+  {
+    ke::AutoLock lock(env->lock());
+    all_breaks_armed_ = armed;
+    if (env->AreDebugBreaksPerMethod())
+      UpdateAllDebugInterest(&recompile);
+    for (const auto& method : methods_) {
+      if (CompiledFunction* fun = method->jit())
+        PatchDebugBreakSites(fun);
+    }
+  }
+  env->RecompileForDebugging(this, recompile);
+  return SP_ERROR_NONE;
+}
+
+bool
+PluginRuntime::IsDataWatchInstrumented()
+{
+  return Environment::get()->IsDataWatchEnabled() && IsDebugBreakInstrumented();
+}
+
+bool
+PluginRuntime::IsDataWatched(ucell_t addr, ucell_t size) const
+{
+  for (const auto& watch : data_watches_) {
+    if (addr < watch.addr + watch.size && watch.addr < addr + size)
+      return true;
+  }
+  return false;
+}
+
+int
+PluginRuntime::SetDataWatch(ucell_t addr, ucell_t size, bool watched)
+{
+  if (!Environment::get()->IsDataWatchEnabled())
+    return SP_ERROR_NOTDEBUGGING;
+  if (!size || addr >= context_->HeapSize() || size > context_->HeapSize() - addr)
+    return SP_ERROR_PARAM;
+
+  auto iter = data_watches_.begin();
+  for (; iter != data_watches_.end(); iter++) {
+    if (iter->addr == addr && iter->size == size)
+      break;
+  }
+  if (watched) {
+    if (iter != data_watches_.end())
+      return SP_ERROR_NONE;
+    if (data_watches_.size() >= SP_MAX_DATA_WATCHES)
+      return SP_ERROR_PARAM;
+    data_watches_.push_back(DataWatch{addr, size});
+  } else {
+    if (iter == data_watches_.end())
+      return SP_ERROR_PARAM;
+    data_watches_.erase(iter);
+  }
+
+  // Every store has to be checked while anything is watched.
+  Environment* env = Environment::get();
+  if (env->AreDebugBreaksPerMethod() && data_watched_ == data_watches_.empty()) {
+    std::vector<RefPtr<MethodInfo>> recompile;
+    {
+      ke::AutoLock lock(env->lock());
+      data_watched_ = !data_watches_.empty();
+      UpdateAllDebugInterest(&recompile);
+    }
+    env->RecompileForDebugging(this, recompile);
+  }
+
+  // Recompute the window compiled stores test against.
+  if (data_watches_.empty()) {
+    data_watch_base_ = ~ucell_t(0);
+    data_watch_span_ = 0;
+    return SP_ERROR_NONE;
+  }
+  ucell_t low = ~ucell_t(0);
+  ucell_t high = 0;
+  for (const auto& watch : data_watches_) {
+    if (watch.addr < low)
+      low = watch.addr;
+    if (watch.addr + watch.size > high)
+      high = watch.addr + watch.size;
+  }
+  data_watch_base_ = low;
+  data_watch_span_ = high - low;
+  return SP_ERROR_NONE;
+}
+
+void
+PluginRuntime::ClearDataWatches()
+{
+  data_watches_.clear();
+  data_watch_base_ = ~ucell_t(0);
+  data_watch_span_ = 0;
+}
+
+int
+PluginRuntime::GetNativeBinding(uint32_t index, SPVM_NATIVE_FUNC* pfn, uint32_t* flags,
+                                void** data)
+{
+  if (index >= image_->NumNatives())
+    return SP_ERROR_INDEX;
+
+  const NativeEntry* native = &natives_[index];
+  *pfn = native->status == SP_NATIVE_BOUND ? native->legacy_fn : nullptr;
+  *flags = native->flags;
+  *data = native->user;
+  return SP_ERROR_NONE;
+}
+
+uint32_t
+PluginRuntime::GetOpcodeStats(const uint64_t** counts, const uint64_t** pairs)
+{
+#if defined(SP_OPCODE_STATS)
+  *counts = opcode_counts_;
+  *pairs = opcode_pairs_.get();
+  return OPCODES_TOTAL;
+#else
+  *counts = nullptr;
+  *pairs = nullptr;
+  return 0;
+#endif
+}
+
+void
+PluginRuntime::ResetOpcodeStats()
+{
+#if defined(SP_OPCODE_STATS)
+  memset(opcode_counts_, 0, sizeof(opcode_counts_));
+  if (opcode_pairs_)
+    memset(opcode_pairs_.get(), 0, sizeof(uint64_t) * OPCODES_TOTAL * OPCODES_TOTAL);
+#endif
+}
+
+bool
+PluginRuntime::CompileInBackground()
+{
+  BackgroundCompiler* compiler = Environment::get()->backgroundCompiler();
+  if (!compiler)
+    return false;
+  return compiler->Enqueue(this);
+}
@@ -19,14 +19,19 @@
 #include <am-inlinelist.h>
 #include <am-hashmap.h>
 #include <amtl/am-refcounting.h>
+#include <atomic>
 #include "scripted-invoker.h"
 #include "legacy-image.h"
+#if defined(SP_OPCODE_STATS)
+# include <smx/smx-v1-opcodes.h>
+#endif
 namespace sp {
 
 using namespace ke;
 
 class PluginContext;
 class MethodInfo;
+class CompiledFunction;
 
 struct floattbl_t
 {
@@ -38,6 +43,15 @@ struct floattbl_t
   unsigned int index;
 };
 
+// Natives the JIT can compute inline, calling them only for arguments the
+// inline code leaves to them.
+enum class NativeIntrinsic : uint8_t
+{
+  None,
+  SquareRoot,
+  StrLen
+};
+
 struct NativeEntry : public sp_native_t
 {
   NativeEntry()
@@ -82,6 +96,9 @@ class PluginRuntime
   virtual unsigned char* GetDataHash() override;
   void SetNames(const char* fullname, const char* name);
   unsigned GetNativeReplacement(size_t index);
+  NativeIntrinsic GetNativeIntrinsic(size_t index) const {
+    return intrinsics_[index];
+  }
   ScriptedInvoker* GetPublicFunction(size_t index);
   int UpdateNativeBinding(uint32_t index, SPVM_NATIVE_FUNC pfn, uint32_t flags, void* data) override;
   const sp_native_t* GetNative(uint32_t index) override;
@@ -95,6 +112,24 @@ class PluginRuntime
   const char* GetFilename() override {
     return full_name_.c_str();
   }
+  int SetDebugBreakSite(ucell_t cip, bool armed) override;
+  int SetAllDebugBreakSites(bool armed) override;
+  bool GetImageBuffer(const uint8_t** bytes, size_t* length) override {
+    return image_->DescribeImage(bytes, length);
+  }
+  int SetDataWatch(ucell_t addr, ucell_t size, bool watched) override;
+  void ClearDataWatches() override;
+  int GetNativeBinding(uint32_t index, SPVM_NATIVE_FUNC* pfn, uint32_t* flags,
+                       void** data) override;
+  uint32_t GetOpcodeStats(const uint64_t** counts, const uint64_t** pairs) override;
+  void ResetOpcodeStats() override;
+  bool CompileInBackground() override;
+
+  // Splits the code section into methods and, if |callees| is given,
+  // collects the functions each one calls. The pcode is not verified yet,
+  // so this is only a good guess.
+  void ScanMethods(std::vector<ucell_t>* procs,
+                   std::vector<std::vector<ucell_t>>* callees) const;
 
   // Mark builtin natives as bound.
   void InstallBuiltinNatives();
@@ -109,6 +144,48 @@ class PluginRuntime
   // Return a list of all methods. The caller must own the environment lock.
   const std::vector<RefPtr<MethodInfo>>& AllMethods() const;
 
+  // Whether BREAK instructions in this plugin call into the debugger. The
+  // debug break filter is consulted the first time this is asked.
+  bool IsDebugBreakInstrumented();
+
+  // Whether |method| is compiled with its debug breaks: as the plugin is,
+  // unless debug breaks are per method and it has no debug interest.
+  bool IsMethodDebugInstrumented(const MethodInfo* method);
+
+  // Whether the patchable BREAK at the given cip should invoke the debugger.
+  bool IsDebugBreakArmed(ucell_t cip) const {
+    if (all_breaks_armed_)
+      return true;
+    size_t cell = cip / sizeof(cell_t);
+    return cell < armed_breaks_.size() && armed_breaks_[cell];
+  }
+
+  // Bring every BREAK site of a newly compiled function in line with the
+  // armed state. The caller must own the environment lock.
+  void PatchDebugBreakSites(CompiledFunction* fun);
+
+  // Whether stores in this plugin are checked against the data watches.
+  bool IsDataWatchInstrumented();
+
+  // Whether a store of |size| bytes at |addr| overlaps a watched range.
+  bool IsDataWatched(ucell_t addr, ucell_t size) const;
+
+  // Compiled stores test their address against [base, base + span), the
+  // hull of every watched range, and only call out on a hit. The width of
+  // that store is left in the store size cell for the callout.
+  ucell_t* addressOfDataWatchBase() {
+    return &data_watch_base_;
+  }
+  ucell_t* addressOfDataWatchSpan() {
+    return &data_watch_span_;
+  }
+  ucell_t* addressOfDataWatchStoreSize() {
+    return &data_watch_store_size_;
+  }
+  ucell_t dataWatchStoreSize() const {
+    return data_watch_store_size_;
+  }
+
   NativeEntry* NativeAt(size_t index) {
     return &natives_[index];
   }
@@ -136,17 +213,45 @@ class PluginRuntime
   LegacyImage* image() const {
     return image_.get();
   }
+  uint64_t image_hash() const {
+    return image_->FileHash();
+  }
   PluginContext* context() const {
     return context_.get();
   }
 
+  // CPU accounting. Charged on the main thread, read from any.
+  void AddCpuTime(uint64_t nanoseconds, uint64_t invocations) {
+    cpu_time_.store(cpu_time_.load(std::memory_order_relaxed) + nanoseconds,
+                    std::memory_order_relaxed);
+    cpu_invocations_.store(cpu_invocations_.load(std::memory_order_relaxed) + invocations,
+                           std::memory_order_relaxed);
+  }
+  void GetCpuUsage(sp_cpu_usage_t* usage) const {
+    usage->nanoseconds = cpu_time_.load(std::memory_order_relaxed);
+    usage->invocations = cpu_invocations_.load(std::memory_order_relaxed);
+  }
+
+#if defined(SP_OPCODE_STATS)
+  // Called by the interpreter before each instruction; |prev| is OP_NONE
+  // at the start of a function.
+  void CountOpcode(OPCODE prev, OPCODE op) {
+    opcode_counts_[op]++;
+    if (opcode_pairs_ && prev != OP_NONE)
+      opcode_pairs_[prev * OPCODES_TOTAL + op]++;
+  }
+#endif
+
  private:
   void SetupFloatNativeRemapping();
+  void SetupNativeIntrinsics();
+  void VerifyMethods(size_t threads);
 
  private:
   std::unique_ptr<sp::LegacyImage> image_;
   std::unique_ptr<uint8_t[]> aligned_code_;
   std::unique_ptr<floattbl_t[]> float_table_;
+  std::unique_ptr<NativeIntrinsic[]> intrinsics_;
   std::string name_;
   std::string full_name_;
   Code code_;
@@ -173,11 +278,49 @@ class PluginRuntime
   // Pause state.
   bool paused_;
 
+  // Debug break instrumentation, decided lazily by the filter.
+  enum class DebugBreakState {
+    Unknown,
+    Instrumented,
+    Ignored
+  };
+  DebugBreakState debug_break_state_;
+
+  // Patchable debug break state, indexed by code cell.
+  std::vector<bool> armed_breaks_;
+  bool all_breaks_armed_;
+
+  // Per-method debug breaks. A method runs up to the next PROC; the
+  // offsets are found on first use. Under the environment lock.
+  bool UpdateDebugInterest(MethodInfo* method);
+  void UpdateAllDebugInterest(std::vector<RefPtr<MethodInfo>>* recompile);
+  std::vector<ucell_t> method_starts_;
+  bool data_watched_;
+
+  // Data watchpoints. With no ranges the base is all ones and the span
+  // zero, so neither window test can hit.
+  struct DataWatch {
+    ucell_t addr;
+    ucell_t size;
+  };
+  std::vector<DataWatch> data_watches_;
+  ucell_t data_watch_base_;
+  ucell_t data_watch_span_;
+  ucell_t data_watch_store_size_;
+
   // Checksumming.
   bool computed_code_hash_;
   bool computed_data_hash_;
   unsigned char code_hash_[16];
   unsigned char data_hash_[16];
+
+  std::atomic<uint64_t> cpu_time_;
+  std::atomic<uint64_t> cpu_invocations_;
+
+#if defined(SP_OPCODE_STATS)
+  uint64_t opcode_counts_[OPCODES_TOTAL];
+  std::unique_ptr<uint64_t[]> opcode_pairs_;
+#endif
 };
 
 } // sp
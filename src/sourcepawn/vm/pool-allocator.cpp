@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include <new>
 #include <amtl/am-threadlocal.h>
+#include <amtl/am-thread-utils.h>
 #include "pool-allocator.h"
 
 using namespace ke;
@@ -27,10 +28,21 @@ using namespace sp;
 
 ThreadLocal<PoolAllocator*> sAllocatorTLS;
 
+struct PoolAllocator::Depot
+{
+  ke::Mutex lock;
+  Pool* pools = nullptr;
+  size_t count = 0;
+};
+
+PoolAllocator::Depot PoolAllocator::sDepot;
+
 PoolAllocator::PoolAllocator()
- : reserved_(nullptr),
+ : free_(nullptr),
+   free_count_(0),
    last_(nullptr),
-   scope_depth_(0)
+   scope_depth_(0),
+   stats_()
 {
 }
 
@@ -39,15 +51,20 @@ PoolAllocator::~PoolAllocator()
   assert(!scope_depth_);
 
   unwind(nullptr);
-  if (reserved_)
-    free(reserved_);
+  while (free_) {
+    Pool* prev = free_->prev;
+    free(free_);
+    free_ = prev;
+  }
 }
 
 void
 PoolAllocator::InitDefault()
 {
   assert(!sAllocatorTLS);
-  sAllocatorTLS.set(new PoolAllocator());
+  PoolAllocator* allocator = new PoolAllocator();
+  allocator->takeFreePools();
+  sAllocatorTLS.set(allocator);
 }
 
 PoolAllocator&
@@ -62,10 +79,43 @@ PoolAllocator::FreeDefault()
 {
   if (!sAllocatorTLS)
     return;
-  delete sAllocatorTLS.get();
+  PoolAllocator* allocator = sAllocatorTLS.get();
+  allocator->unwind(nullptr);
+  allocator->releaseFreePools();
+  delete allocator;
   sAllocatorTLS = nullptr;
 }
 
+void
+PoolAllocator::releaseFreePools()
+{
+  ke::AutoLock lock(&sDepot.lock);
+  while (free_ && sDepot.count < kMaxDepotPools) {
+    Pool* pool = free_;
+    free_ = pool->prev;
+    free_count_--;
+
+    pool->prev = sDepot.pools;
+    sDepot.pools = pool;
+    sDepot.count++;
+  }
+}
+
+void
+PoolAllocator::takeFreePools()
+{
+  ke::AutoLock lock(&sDepot.lock);
+  while (sDepot.pools && free_count_ < kMaxFreePools) {
+    Pool* pool = sDepot.pools;
+    sDepot.pools = pool->prev;
+    sDepot.count--;
+
+    pool->prev = free_;
+    free_ = pool;
+    free_count_++;
+  }
+}
+
 char*
 PoolAllocator::enter()
 {
@@ -90,17 +140,7 @@ PoolAllocator::unwind(char* pos)
     if (pos && pos >= last_->base && pos < last_->end)
       break;
     Pool* prev = last_->prev;
-    {
-      if (last_->size() <= kMaxReserveSize &&
-        (!reserved_ || reserved_->size() < last_->size()))
-      {
-        if (reserved_)
-          free(reserved_);
-        reserved_ = last_;
-      } else {
-        free(last_);
-      }
-    }
+    recycle(last_);
     last_ = prev;
   }
 
@@ -112,6 +152,22 @@ PoolAllocator::unwind(char* pos)
   last_->ptr = pos;
 }
 
+void
+PoolAllocator::recycle(Pool* pool)
+{
+  stats_.pools_in_use--;
+  stats_.bytes_in_use -= pool->size();
+
+  // Pools grown for one huge allocation are not worth keeping.
+  if (pool->size() > kMaxReserveSize || free_count_ >= kMaxFreePools) {
+    free(pool);
+    return;
+  }
+  pool->prev = free_;
+  free_ = pool;
+  free_count_++;
+}
+
 void*
 PoolAllocator::slowAllocate(size_t actualBytes)
 {
@@ -119,10 +175,20 @@ PoolAllocator::slowAllocate(size_t actualBytes)
   if (bytesNeeded < kDefaultPoolSize)
     bytesNeeded = kDefaultPoolSize;
 
+  // Take the smallest free pool that fits.
+  Pool** best = nullptr;
+  for (Pool** link = &free_; *link; link = &(*link)->prev) {
+    if ((*link)->size() < actualBytes)
+      continue;
+    if (!best || (*link)->size() < (*best)->size())
+      best = link;
+  }
+
   Pool* pool;
-  if (reserved_ && reserved_->size() >= bytesNeeded) {
-    pool = reserved_;
-    reserved_ = nullptr;
+  if (best) {
+    pool = *best;
+    *best = pool->prev;
+    free_count_--;
   } else {
     pool = (Pool*)malloc(bytesNeeded);
     if (!pool) {
@@ -132,10 +198,16 @@ PoolAllocator::slowAllocate(size_t actualBytes)
     }
     pool->base = (char*)(pool + 1);
     pool->end = (char*)pool + bytesNeeded;
+    stats_.pools_allocated++;
   }
   pool->ptr = pool->base + actualBytes;
   pool->prev = last_;
   last_ = pool;
+
+  stats_.pools_in_use++;
+  stats_.bytes_in_use += pool->size();
+  if (stats_.bytes_in_use > stats_.high_water)
+    stats_.high_water = stats_.bytes_in_use;
   return pool->base;
 }
 
@@ -31,6 +31,11 @@ using namespace ke;
 
 // Allocates memory in chunks that are not freed until the entire allocator
 // is freed. This is intended for use with large, temporary data structures.
+//
+// Each thread has its own allocator. Pools left empty are kept on a short
+// free list and reused by size; when a thread's allocator goes away, or it
+// lets go of them early, they are handed to the next thread that starts
+// one.
 class PoolAllocator
 {
   struct Pool {
@@ -44,17 +49,39 @@ class PoolAllocator
     }
   };
 
+  // Free pools shared between threads.
+  struct Depot;
+
   static const size_t kDefaultPoolSize = 8 * 1024;
   static const size_t kMaxReserveSize = 64 * 1024;
+  static const size_t kMaxFreePools = 4;
+  static const size_t kMaxDepotPools = 16;
+
+ public:
+  struct Stats {
+    // Pools ever taken from malloc.
+    size_t pools_allocated;
+    // Pools holding allocations now.
+    size_t pools_in_use;
+    // Bytes of those pools now, and the most there ever were.
+    size_t bytes_in_use;
+    size_t high_water;
+  };
 
  private:
-  Pool* reserved_;
+  Pool* free_;
+  size_t free_count_;
   Pool* last_;
   size_t scope_depth_;
+  Stats stats_;
+
+  static Depot sDepot;
 
  private:
   void unwind(char* pos);
   void* slowAllocate(size_t actualBytes);
+  void recycle(Pool* pool);
+  void takeFreePools();
 
  public:
   PoolAllocator();
@@ -64,6 +91,13 @@ class PoolAllocator
   static PoolAllocator& DefaultForThread();
   static void FreeDefault();
 
+  // Gives the pools this allocator is not using to other threads.
+  void releaseFreePools();
+
+  const Stats& stats() const {
+    return stats_;
+  }
+
   void memoryUsage(size_t* allocated, size_t* reserved, size_t* bookkeeping) const {
     *allocated = 0;
     *reserved = 0;
@@ -73,8 +107,8 @@ class PoolAllocator
       *reserved += size_t(cursor->end - cursor->base);
       *bookkeeping += sizeof(Pool);
     }
-    if (reserved_) {
-      *reserved += size_t(reserved_->end - reserved_->base);
+    for (Pool* cursor = free_; cursor; cursor = cursor->prev) {
+      *reserved += size_t(cursor->end - cursor->base);
       *bookkeeping += sizeof(Pool);
     }
   }
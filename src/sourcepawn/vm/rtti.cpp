@@ -25,12 +25,27 @@ RttiData::RttiData(const uint8_t* blob, uint32_t size)
 {
 }
 
+RttiData::~RttiData()
+{
+}
+
 const Rtti*
 RttiData::typeFromTypeId(uint32_t type_id) const
 {
   if (!rtti_data_)
     return nullptr;
 
+  std::lock_guard<std::mutex> lock(types_lock_);
+  auto iter = types_.find(type_id);
+  if (iter == types_.end())
+    iter = types_.emplace(type_id, std::unique_ptr<const Rtti>(decodeTypeId(type_id))).first;
+  return iter->second.get();
+}
+
+const Rtti*
+RttiData::decodeTypeId(uint32_t type_id) const
+{
+
   uint8_t kind = type_id & kMaxTypeIdKind;
   uint32_t payload = (type_id >> 4) & kMaxTypeIdPayload;
 
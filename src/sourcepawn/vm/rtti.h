@@ -11,6 +11,8 @@
 #define _include_sourcepawn_rtti_h_
 
 #include <memory>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 
 #include <sp_vm_types.h>
@@ -25,7 +27,9 @@ class RttiData {
 public:
   RttiData();
   RttiData(const uint8_t* blob, uint32_t size);
+  ~RttiData();
 
+  // Decoded types are cached and owned by the RttiData.
   const Rtti* typeFromTypeId(uint32_t type_id) const;
   const Rtti* functionTypeFromOffset(uint32_t offset) const;
   const Rtti* typesetTypeFromOffset(uint32_t offset) const;
@@ -37,9 +41,15 @@ public:
   bool validateFunctionOffset(uint32_t offset) const;
   bool validateTypesetOffset(uint32_t offset) const;
 
+private:
+  const Rtti* decodeTypeId(uint32_t type_id) const;
+
 private:
   const uint8_t* rtti_data_;
   uint32_t rtti_data_size_;
+
+  mutable std::mutex types_lock_;
+  mutable std::unordered_map<uint32_t, std::unique_ptr<const Rtti>> types_;
 };
 
 class RttiParser {
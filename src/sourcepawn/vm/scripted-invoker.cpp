@@ -13,6 +13,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <chrono>
 #include "scripted-invoker.h"
 #include "plugin-runtime.h"
 #include "environment.h"
@@ -30,8 +31,10 @@ ScriptedInvoker::ScriptedInvoker(PluginRuntime* runtime, funcid_t id, uint32_t p
  : env_(Environment::get()),
    context_(runtime->GetBaseContext()),
    m_curparam(0),
+   m_marked(0),
    m_errorstate(SP_ERROR_NONE),
-   m_FnId(id)
+   m_FnId(id),
+   entry_hook_(false)
 {
   runtime->GetPublicByIndex(pub_id, &public_);
 
@@ -118,6 +121,7 @@ ScriptedInvoker::PushArray(cell_t* inarray, unsigned int cells, int copyback)
 
   info->flags = inarray ? copyback : 0;
   info->marked = true;
+  m_marked++;
   info->size = cells;
   info->str.is_sz = false;
   info->orig_addr = inarray;
@@ -148,6 +152,7 @@ ScriptedInvoker::_PushString(const char* string, int sz_flags, int cp_flags, siz
   ParamInfo* info = &m_info[m_curparam];
 
   info->marked = true;
+  m_marked++;
   info->orig_addr = (cell_t*)string;
   info->flags = cp_flags;
   info->size = len;
@@ -167,6 +172,7 @@ ScriptedInvoker::Cancel()
 
   m_errorstate = SP_ERROR_NONE;
   m_curparam = 0;
+  m_marked = 0;
 }
 
 int
@@ -209,18 +215,29 @@ ScriptedInvoker::Invoke(cell_t* result)
     return false;
   }
 
-  //This is for re-entrancy!
+  unsigned int numparams = m_curparam;
+  unsigned int marked = m_marked;
+  m_curparam = 0;
+  m_marked = 0;
+
+  // Cells only: nothing to build or copy back. The params are copied onto
+  // the plugin stack before any plugin code runs, so a re-entrant push
+  // can't clobber them.
+  if (!marked) {
+    Call(m_params, numparams, result);
+    return !env_->hasPendingException();
+  }
+
+  //This is for re-entrancy! Only arrays and strings need their info saved.
   cell_t temp_params[SP_MAX_EXEC_PARAMS];
   ParamInfo temp_info[SP_MAX_EXEC_PARAMS];
-  unsigned int numparams = m_curparam;
   unsigned int i;
-
-  if (numparams)
-  {
-    //Save the info locally, then reset it for re-entrant calls.
-    memcpy(temp_info, m_info, numparams * sizeof(ParamInfo));
+  for (i = 0; i < numparams; i++) {
+    if (m_info[i].marked)
+      temp_info[i] = m_info[i];
+    else
+      temp_info[i].marked = false;
   }
-  m_curparam = 0;
 
   /* Browse the parameters and build arrays */
   bool ok = true;
@@ -292,14 +309,8 @@ ScriptedInvoker::Invoke(cell_t* result)
   }
 
   /* Make the call if we can */
-  if (ok) {
-    const char *debugName = this->DebugName();
-    size_t debugNameLength = strlen(debugName) + 2;
-    volatile char * volatile debugNameForCrashDumps = (char *)alloca(debugNameLength);
-    SafeStrcpy((char *)debugNameForCrashDumps + 1, debugNameLength - 1, debugName);
-
-    ok = context_->Invoke(m_FnId, temp_params, numparams, result);
-  }
+  if (ok)
+    ok = Call(temp_params, numparams, result);
 
   /* i should be equal to the last valid parameter + 1 */
   bool docopies = ok;
@@ -331,6 +342,29 @@ ScriptedInvoker::Invoke(cell_t* result)
   return !env_->hasPendingException();
 }
 
+bool
+ScriptedInvoker::Call(const cell_t* params, unsigned int num_params, cell_t* result)
+{
+  const char *debugName = this->DebugName();
+  size_t debugNameLength = strlen(debugName) + 2;
+  volatile char * volatile debugNameForCrashDumps = (char *)alloca(debugNameLength);
+  SafeStrcpy((char *)debugNameForCrashDumps + 1, debugNameLength - 1, debugName);
+
+  if (entry_hook_) {
+    if (IPublicEntryListener* listener = env_->publicEntryListener())
+      listener->OnPublicEntry(this, params, num_params);
+  }
+
+  if (IInvokeListener* listener = env_->invokeListener()) {
+    auto start = std::chrono::steady_clock::now();
+    bool ok = context_->Invoke(m_FnId, params, num_params, result);
+    listener->OnInvoked(this, std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count());
+    return ok;
+  }
+  return context_->Invoke(m_FnId, params, num_params, result);
+}
+
 int
 ScriptedInvoker::Execute2(IPluginContext* ctx, cell_t* result)
 {
@@ -78,9 +78,15 @@ class ScriptedInvoker : public IPluginFunction
     // Helper for pRuntime->AcquireMethod that caches the result.
     RefPtr<MethodInfo> AcquireMethod();
 
+    // Whether calls are reported to the public entry listener first.
+    void setEntryHook(bool armed) {
+        entry_hook_ = armed;
+    }
+
   private:
     int _PushString(const char* string, int sz_flags, int cp_flags, size_t len);
     int SetError(int err);
+    bool Call(const cell_t* params, unsigned int num_params, cell_t* result);
 
   private:
     Environment* env_;
@@ -88,11 +94,14 @@ class ScriptedInvoker : public IPluginFunction
     cell_t m_params[SP_MAX_EXEC_PARAMS];
     ParamInfo m_info[SP_MAX_EXEC_PARAMS];
     unsigned int m_curparam;
+    // How many of the pushed params are arrays or strings.
+    unsigned int m_marked;
     int m_errorstate;
     funcid_t m_FnId;
     std::unique_ptr<char[]> full_name_;
     sp_public_t* public_;
     RefPtr<MethodInfo> method_;
+    bool entry_hook_;
 };
 
 } // namespace sp
@@ -13,6 +13,8 @@
 #include <sp_vm_api.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <math.h>
+#include <string.h>
 #include <amtl/am-cxx.h>
 #include <amtl/experimental/am-argparser.h>
 #include "dll_exports.h"
@@ -152,6 +154,21 @@ static cell_t WriteFloat(IPluginContext* cx, const cell_t* params)
   return printf("%f", sp_ctof(params[1]));
 }
 
+static cell_t SquareRoot(IPluginContext* cx, const cell_t* params)
+{
+  float val = sp_ctof(params[1]);
+  if (val < 0.0)
+    return cx->ThrowNativeError("Cannot evaluate the square root of a negative number (%f)", val);
+  return sp_ftoc(sqrt(val));
+}
+
+static cell_t StrLen(IPluginContext* cx, const cell_t* params)
+{
+  char* str;
+  cx->LocalToString(params[1], &str);
+  return strlen(str);
+}
+
 static cell_t DoExecute(IPluginContext* cx, const cell_t* params)
 {
   int32_t ok = 0;
@@ -207,6 +224,8 @@ static int Execute(const char* file)
   BindNative(rt, "printnums", PrintNums);
   BindNative(rt, "printfloat", PrintFloat);
   BindNative(rt, "writefloat", WriteFloat);
+  BindNative(rt, "SquareRoot", SquareRoot);
+  BindNative(rt, "strlen", StrLen);
   BindNative(rt, "donothing", DoNothing);
   BindNative(rt, "execute", DoExecute);
   BindNative(rt, "invoke", DoInvoke);
@@ -8,7 +8,11 @@
 //   http://www.gnu.org/licenses/gpl.html
 //
 #include "smx-v1-image.h"
+#include <smx/smx-v1-opcodes.h>
+#include <sp_image_hash.h>
 #include <zlib.h>
+#include <algorithm>
+#include <new>
 #include <fmt/format.h>
 
 using namespace ke;
@@ -17,6 +21,7 @@ using namespace sp;
 SmxV1Image::SmxV1Image(FILE* fp)
  : FileReader(fp)
  , hdr_(nullptr)
+ , inflated_(UINT32_MAX)
  , header_strings_(nullptr)
  , names_section_(nullptr)
  , names_(nullptr)
@@ -26,10 +31,64 @@ SmxV1Image::SmxV1Image(FILE* fp)
  , debug_syms_unpacked_(nullptr) {
 }
 
+SmxV1Image::SmxV1Image(const uint8_t* bytes, size_t length)
+ : FileReader(bytes, length)
+ , hdr_(nullptr)
+ , decompressed_(true)
+ , inflated_(UINT32_MAX)
+ , header_strings_(nullptr)
+ , names_section_(nullptr)
+ , names_(nullptr)
+ , debug_names_section_(nullptr)
+ , debug_names_(nullptr)
+ , debug_syms_(nullptr)
+ , debug_syms_unpacked_(nullptr) {
+}
+
+SmxV1Image::SmxV1Image(std::unique_ptr<uint8_t[]>&& bytes, size_t length)
+ : FileReader(std::move(bytes), length)
+ , hdr_(nullptr)
+ , decompressed_(true)
+ , inflated_(UINT32_MAX)
+ , header_strings_(nullptr)
+ , names_section_(nullptr)
+ , names_(nullptr)
+ , debug_names_section_(nullptr)
+ , debug_names_(nullptr)
+ , debug_syms_(nullptr)
+ , debug_syms_unpacked_(nullptr) {
+}
+
+SmxV1Image::SmxV1Image(const char* path)
+ : FileReader(path)
+ , hdr_(nullptr)
+ , inflated_(UINT32_MAX)
+ , header_strings_(nullptr)
+ , names_section_(nullptr)
+ , names_(nullptr)
+ , debug_names_section_(nullptr)
+ , debug_names_(nullptr)
+ , debug_syms_(nullptr)
+ , debug_syms_unpacked_(nullptr) {
+}
+
+struct SmxV1Image::Inflater {
+    z_stream stream;
+    // The compressed file, if it was read rather than mapped.
+    std::unique_ptr<uint8_t[]> file;
+
+    ~Inflater() {
+        inflateEnd(&stream);
+    }
+};
+
+SmxV1Image::~SmxV1Image() {
+}
+
 // Validating SMX v1 scripts is fairly expensive. We reserve real validation
 // for v2.
 bool
-SmxV1Image::validate() {
+SmxV1Image::validate(bool debug_info_only) {
     if (length_ < sizeof(sp_file_hdr_t))
         return error("bad header");
 
@@ -37,6 +96,11 @@ SmxV1Image::validate() {
     if (hdr_->magic != SmxConsts::FILE_MAGIC)
         return error("bad header");
 
+    // Hashed once, while the buffer still holds the file: debugger caches
+    // and the code cache know the image by it.
+    if (!decompressed_)
+        file_hash_ = SourcePawn::ImageHasher::hash(buffer(), length_);
+
     switch (hdr_->version) {
         case SmxConsts::SP1_VERSION_1_0:
         case SmxConsts::SP1_VERSION_1_1:
@@ -46,7 +110,13 @@ SmxV1Image::validate() {
             return error("unsupported version");
     }
 
-    switch (hdr_->compression) {
+    // The header of an image decompressed by the VM still says it is
+    // compressed.
+    uint8_t compression = hdr_->compression;
+    if (decompressed_)
+        compression = SmxConsts::FILE_COMPRESSION_NONE;
+
+    switch (compression) {
         case SmxConsts::FILE_COMPRESSION_GZ: {
             // We don't support junk in binaries, check that disksize matches the actual file size.
             // (this is to avoid a known crash in inflate() if told that data is bigger than it is)
@@ -66,26 +136,29 @@ SmxV1Image::validate() {
             if (hdr_->imagesize < hdr_->dataoffs)
                 return error("illegal image size");
 
-            // Allocate the uncompressed image buffer.
-            uint32_t compressedSize = hdr_->disksize - hdr_->dataoffs;
-            std::unique_ptr<uint8_t[]> uncompressed = std::make_unique<uint8_t[]>(hdr_->imagesize);
+            // Allocate the uncompressed image buffer. Decompression writes
+            // straight into it, so it is not cleared first.
+            std::unique_ptr<uint8_t[]> uncompressed(new (std::nothrow) uint8_t[hdr_->imagesize]);
             if (!uncompressed)
                 return error("out of memory");
 
-            // Decompress.
-            const uint8_t* src = buffer() + hdr_->dataoffs;
-            uint8_t* dest = uncompressed.get() + hdr_->dataoffs;
-            uLongf destlen = hdr_->imagesize - hdr_->dataoffs;
-            int rv = uncompress((Bytef*)dest, &destlen, src, compressedSize);
-            if (rv != Z_OK)
-                return error("could not decode compressed region");
+            auto inflater = std::make_unique<Inflater>();
+            z_stream& zs = inflater->stream;
+            memset(&zs, 0, sizeof(zs));
+            zs.next_in = const_cast<Bytef*>(buffer() + hdr_->dataoffs);
+            zs.avail_in = hdr_->disksize - hdr_->dataoffs;
+            if (inflateInit(&zs) != Z_OK)
+                return error("out of memory");
 
-            // Copy the initial uncompressed region back in.
+            // Copy the initial uncompressed region, which holds the section
+            // table, and decompress once the table says how far to go. The
+            // compressed file is kept until the stream has been consumed.
             memcpy(uncompressed.get(), buffer(), hdr_->dataoffs);
-
-            // Replace the original buffer.
+            inflater->file = std::move(buffer_);
             length_ = hdr_->imagesize;
             buffer_ = std::move(uncompressed);
+            inflater_ = std::move(inflater);
+            inflated_ = hdr_->dataoffs;
             hdr_ = (sp_file_hdr_t*)buffer();
             break;
         }
@@ -97,13 +170,17 @@ SmxV1Image::validate() {
             return error("unknown compression type");
     }
 
+    // The section table of a compressed image must be in the part that is
+    // not compressed.
+    size_t header_end = inflater_ ? hdr_->dataoffs : length_;
+
     // Validate the string table.
-    if (hdr_->stringtab >= length_)
+    if (hdr_->stringtab >= header_end)
         return error("invalid string table");
     header_strings_ = reinterpret_cast<const char*>(buffer() + hdr_->stringtab);
 
     // Validate sections header.
-    if ((sizeof(sp_file_hdr_t) + hdr_->sections * sizeof(sp_file_section_t)) > length_)
+    if ((sizeof(sp_file_hdr_t) + hdr_->sections * sizeof(sp_file_section_t)) > header_end)
         return error("invalid section table");
 
     size_t last_header_string = 0;
@@ -134,6 +211,27 @@ SmxV1Image::validate() {
     if (!found_terminator)
         return error("malformed section names header");
 
+    // Decompress as far as validation reads. Without the bodies of .code and
+    // .data, that is the end of whichever other section comes last.
+    if (inflater_) {
+        uint32_t needed = hdr_->imagesize;
+        if (debug_info_only) {
+            needed = hdr_->dataoffs;
+            for (const Section& section : sections_) {
+                uint64_t end = uint64_t(section.dataoffs) + section.size;
+                if (strcmp(section.name, ".code") == 0)
+                    end = std::min<uint64_t>(end, uint64_t(section.dataoffs) + sizeof(sp_file_code_t));
+                else if (strcmp(section.name, ".data") == 0)
+                    end = std::min<uint64_t>(end, uint64_t(section.dataoffs) + sizeof(sp_file_data_t));
+                needed = uint32_t(std::max<uint64_t>(needed, std::min<uint64_t>(end, length_)));
+            }
+        }
+        if (!inflateTo(needed))
+            return error("could not decode compressed region");
+        if (!inflater_)
+            unmap();
+    }
+
     names_section_ = findSection(".names");
     if (!names_section_)
         return error("could not find .names section");
@@ -163,9 +261,162 @@ SmxV1Image::validate() {
     if (!validateTags())
         return false;
 
+    buildArrayDimensions();
+    std::atomic_store(&symbol_index_, buildSymbolIndex());
+    buildFunctionIndex();
     return true;
 }
 
+template <typename T>
+static size_t
+VectorBytes(const std::vector<T>& vector) {
+    return vector.capacity() * sizeof(T);
+}
+
+// Each entry of a std::unordered_map is a node with the value, a next
+// pointer and the cached hash.
+template <typename Map>
+static size_t
+HashMapBytes(const Map& map) {
+    return map.bucket_count() * sizeof(void*) +
+           map.size() * (sizeof(typename Map::value_type) + 2 * sizeof(void*));
+}
+
+// Array dimensions point into the image's tables for as long as it lives,
+// so unlike the symbol index they are decoded once and never evicted.
+void
+SmxV1Image::buildArrayDimensions() {
+    if (!debug_names_)
+        return;
+    auto decode = [this](const Symbol& sym) { decodeArrayDimensions(sym); };
+    forEachSymbol(false, decode);
+    if (!debug_syms_ && !debug_syms_unpacked_)
+        forEachSymbol(true, decode);
+}
+
+// GetVariable is called for every evaluated name, so resolve names once:
+// a hash probe on the name, then a binary search on the scope.
+std::shared_ptr<const SmxV1Image::SymbolIndex>
+SmxV1Image::buildSymbolIndex() {
+    auto index = std::make_shared<SymbolIndex>();
+    if (!debug_names_)
+        return index;
+
+    // The compiler's index names symbols by their position in the table, so
+    // they are only numbered here.
+    if (debug_index_.header) {
+        forEachSymbol(false, [&](const Symbol& sym) {
+            uint32_t pos = uint32_t(index->symbols.size());
+            index->symbols.push_back(sym);
+            if (sym.name() >= debug_names_section_->size || sym.ident() == sp::IDENT_FUNCTION)
+                return;
+            if (sym.vclass() & 0x0f)
+                index->local_vars.push_back(pos);
+            else
+                index->global_vars.push_back(pos);
+        });
+    } else {
+        // Legacy images list every symbol in one table that both passes
+        // walk, so only the first pass classifies the variables.
+        auto add = [&](bool global, bool scoped, bool classify) {
+            forEachSymbol(global, [&](const Symbol& sym) {
+                if (sym.name() >= debug_names_section_->size)
+                    return;
+                std::string_view name(debug_names_ + sym.name());
+                uint32_t pos = uint32_t(index->symbols.size());
+                index->symbols.push_back(sym);
+                if (scoped)
+                    index->scoped[name].push_back({sym.codestart(), sym.codeend(), pos});
+                else
+                    index->globals.emplace(name, pos);
+
+                if (classify && sym.ident() != sp::IDENT_FUNCTION) {
+                    if (sym.vclass() & 0x0f)
+                        index->local_vars.push_back(pos);
+                    else
+                        index->global_vars.push_back(pos);
+                }
+            });
+        };
+
+        bool legacy = debug_syms_ || debug_syms_unpacked_;
+        if (legacy || locals_)
+            add(false, true, true);
+        if (legacy || globals_)
+            add(true, false, !legacy);
+
+        for (auto& entry : index->scoped) {
+            std::stable_sort(entry.second.begin(), entry.second.end(),
+                             [](const ScopedSymbol& a, const ScopedSymbol& b) {
+                                 return a.codestart < b.codestart;
+                             });
+        }
+    }
+
+    index->bytes = VectorBytes(index->symbols) + HashMapBytes(index->scoped) +
+                   HashMapBytes(index->globals) + VectorBytes(index->local_vars) +
+                   VectorBytes(index->global_vars);
+    for (const auto& entry : index->scoped)
+        index->bytes += VectorBytes(entry.second);
+    return index;
+}
+
+std::shared_ptr<const SmxV1Image::SymbolIndex>
+SmxV1Image::symbolIndex() {
+    auto index = std::atomic_load(&symbol_index_);
+    if (index)
+        return index;
+    std::lock_guard<std::mutex> lock(index_mtx_);
+    index = std::atomic_load(&symbol_index_);
+    if (!index) {
+        index = buildSymbolIndex();
+        std::atomic_store(&symbol_index_, index);
+    }
+    return index;
+}
+
+std::shared_ptr<const SmxV1Image::LineIndex>
+SmxV1Image::lineIndex() {
+    auto index = std::atomic_load(&line_index_);
+    if (index)
+        return index;
+    std::lock_guard<std::mutex> lock(index_mtx_);
+    index = std::atomic_load(&line_index_);
+    if (!index) {
+        index = buildLineIndex();
+        std::atomic_store(&line_index_, index);
+    }
+    return index;
+}
+
+void
+SmxV1Image::BuildIndices() {
+    symbolIndex();
+    if (debug_info_ && !debug_index_.header)
+        lineIndex();
+}
+
+size_t
+SmxV1Image::EvictIndices() {
+    std::lock_guard<std::mutex> lock(index_mtx_);
+    size_t freed = 0;
+    if (auto index = std::atomic_exchange(&symbol_index_, std::shared_ptr<const SymbolIndex>()))
+        freed += index->bytes;
+    if (auto index = std::atomic_exchange(&line_index_, std::shared_ptr<const LineIndex>()))
+        freed += index->bytes;
+    return freed;
+}
+
+size_t
+SmxV1Image::EvictableIndexBytes() {
+    size_t bytes = 0;
+    if (auto index = std::atomic_load(&symbol_index_))
+        bytes += index->bytes;
+    if (auto index = std::atomic_load(&line_index_))
+        bytes += index->bytes;
+    return bytes;
+}
+
 const SmxV1Image::Section*
 SmxV1Image::findSection(const char* name) {
     for (size_t i = 0; i < sections_.size(); i++) {
@@ -344,15 +595,17 @@ SmxV1Image::validateRtti() {
         }
     }
 
+    // Enum names are never read, and enum structs and classdefs are checked
+    // per type on first use; see getEnumFields and getTypeFields.
     rtti_enums_ = findRttiSection("rtti.enums");
-    if (rtti_enums_ && !validateRttiEnums())
-        return false;
 
     rtti_enumstruct_fields_ = findRttiSection("rtti.enumstruct_fields");
     rtti_enumstructs_ = findRttiSection("rtti.enumstructs");
-    if (rtti_enumstructs_ && !validateRttiEnumStructs())
-        return false;
-
+    if (rtti_enumstructs_) {
+        if (!rtti_enumstruct_fields_)
+            return error("rtti.enumstruct_fields section missing");
+        enum_fields_ = std::make_unique<TypeCache[]>(rtti_enumstructs_->row_count);
+    }
 
     rtti_methods_ = findRttiSection("rtti.methods");
     if (rtti_methods_ && !validateRttiMethods())
@@ -360,8 +613,11 @@ SmxV1Image::validateRtti() {
 
     rtti_fields_ = findRttiSection("rtti.fields");
     rtti_classdefs_ = findRttiSection("rtti.classdefs");
-    if (rtti_classdefs_ && !validateRttiClassdefs())
-        return false;
+    if (rtti_classdefs_) {
+        if (!rtti_fields_)
+            return error("rtti.fields section missing");
+        classdef_fields_ = std::make_unique<TypeCache[]>(rtti_classdefs_->row_count);
+    }
 
     return true;
 }
@@ -482,6 +738,98 @@ SmxV1Image::validateDebugInfo() {
         }
     }
 
+    return validateDebugIndex();
+}
+
+bool
+SmxV1Image::validateDebugIndex() {
+    // Only compilers writing packed symbol tables emit an index.
+    const Section* section = findSection(".dbg.index");
+    if (!section || !debug_syms_)
+        return true;
+    if (!validateSection(section) || section->size < sizeof(sp_fdbg_index_t))
+        return error("invalid .dbg.index section");
+
+    const uint8_t* base = buffer() + section->dataoffs;
+    const sp_fdbg_index_t* header = reinterpret_cast<const sp_fdbg_index_t*>(base);
+
+    // An index from a newer compiler is ignored rather than misread.
+    if (header->version != SP_FDBG_INDEX_VERSION)
+        return true;
+
+    uint32_t buckets = header->num_buckets;
+    if (!buckets || (buckets & (buckets - 1)))
+        return error("invalid .dbg.index section");
+
+    // Lay the tables out back to back and check that they fit.
+    uint64_t offsets[8];
+    uint64_t end = sizeof(sp_fdbg_index_t);
+    const uint64_t sizes[8] = {
+        uint64_t(header->num_functions) * sizeof(sp_fdbg_index_function_t),
+        (uint64_t(buckets) + 1) * sizeof(uint32_t),
+        uint64_t(header->num_functions) * sizeof(uint32_t),
+        uint64_t(header->num_files) * sizeof(sp_fdbg_index_file_t),
+        uint64_t(header->num_lines) * sizeof(sp_fdbg_line_t),
+        (uint64_t(buckets) + 1) * sizeof(uint32_t),
+        uint64_t(header->num_names) * sizeof(sp_fdbg_index_name_t),
+        uint64_t(header->num_scopes) * sizeof(sp_fdbg_index_scope_t),
+    };
+    for (size_t i = 0; i < 8; i++) {
+        offsets[i] = end;
+        end += sizes[i];
+    }
+    if (end > section->size)
+        return error("invalid .dbg.index section");
+
+    DebugIndex index;
+    index.header = header;
+    index.functions = reinterpret_cast<const sp_fdbg_index_function_t*>(base + offsets[0]);
+    index.function_buckets = reinterpret_cast<const uint32_t*>(base + offsets[1]);
+    index.function_chain = reinterpret_cast<const uint32_t*>(base + offsets[2]);
+    index.files = reinterpret_cast<const sp_fdbg_index_file_t*>(base + offsets[3]);
+    index.lines = reinterpret_cast<const sp_fdbg_line_t*>(base + offsets[4]);
+    index.name_buckets = reinterpret_cast<const uint32_t*>(base + offsets[5]);
+    index.names = reinterpret_cast<const sp_fdbg_index_name_t*>(base + offsets[6]);
+    index.scopes = reinterpret_cast<const sp_fdbg_index_scope_t*>(base + offsets[7]);
+
+    // Every offset and range must stay within its table, so lookups need no
+    // checks of their own beyond the symbol numbers.
+    auto valid_buckets = [buckets](const uint32_t* table, uint32_t count) -> bool {
+        if (table[0] != 0 || table[buckets] != count)
+            return false;
+        for (uint32_t i = 0; i < buckets; i++) {
+            if (table[i] > table[i + 1])
+                return false;
+        }
+        return true;
+    };
+    auto valid_name = [this](uint32_t name) -> bool {
+        return name < debug_names_section_->size;
+    };
+
+    for (uint32_t i = 0; i < header->num_functions; i++) {
+        if (!valid_name(index.functions[i].name) ||
+            index.function_chain[i] >= header->num_functions)
+            return error("invalid .dbg.index functions");
+    }
+    if (!valid_buckets(index.function_buckets, header->num_functions))
+        return error("invalid .dbg.index functions");
+    for (uint32_t i = 0; i < header->num_files; i++) {
+        const sp_fdbg_index_file_t& file = index.files[i];
+        if (!valid_name(file.name) || file.first_line > header->num_lines ||
+            file.num_lines > header->num_lines - file.first_line)
+            return error("invalid .dbg.index files");
+    }
+    for (uint32_t i = 0; i < header->num_names; i++) {
+        const sp_fdbg_index_name_t& name = index.names[i];
+        if (!valid_name(name.name) || name.first_scope > header->num_scopes ||
+            name.num_scopes > header->num_scopes - name.first_scope)
+            return error("invalid .dbg.index names");
+    }
+    if (!valid_buckets(index.name_buckets, header->num_names))
+        return error("invalid .dbg.index names");
+
+    debug_index_ = index;
     return true;
 }
 
@@ -505,6 +853,20 @@ SmxV1Image::validateTags() {
     }
 
     tags_ = List<sp_file_tag_t>(tags, length);
+
+    // Display code looks tags up for every untagged symbol on every stop.
+    for (size_t i = 0; i < length; i++) {
+        TagInfo info;
+        info.name = names_ + tags[i].name;
+        if (!stricmp(info.name, "bool"))
+            info.kind = TagKind::Bool;
+        else if (!stricmp(info.name, "float"))
+            info.kind = TagKind::Float;
+        else
+            info.kind = TagKind::Other;
+        // The first entry for an id wins, as with the old linear scan.
+        tag_index_.emplace(tags[i].tag_id, info);
+    }
     return true;
 }
 
@@ -531,8 +893,50 @@ SmxV1Image::symboliterator(bool global) {
     }
 }
 
+bool
+SmxV1Image::inflateTo(uint32_t end) const {
+    end = std::min<uint32_t>(end, uint32_t(length_));
+    if (inflated_.load(std::memory_order_acquire) >= end)
+        return true;
+
+    std::lock_guard<std::mutex> lock(inflate_lock_);
+    uint32_t pos = inflated_.load(std::memory_order_relaxed);
+    if (pos >= end)
+        return true;
+
+    bool ok = true;
+    uint8_t* image = buffer_.get();
+    z_stream& zs = inflater_->stream;
+    while (pos < end) {
+        zs.next_out = image + pos;
+        zs.avail_out = end - pos;
+        int rv = inflate(&zs, Z_NO_FLUSH);
+        pos = uint32_t(zs.next_out - image);
+        if (rv == Z_STREAM_END)
+            break;
+        if (rv != Z_OK) {
+            ok = false;
+            break;
+        }
+    }
+
+    // Whatever a short stream leaves out reads as zeroes.
+    if (pos < end) {
+        memset(image + pos, 0, length_ - pos);
+        pos = uint32_t(length_);
+    }
+    if (pos == length_)
+        inflater_ = nullptr;
+    inflated_.store(pos, std::memory_order_release);
+    return ok;
+}
+
 auto
 SmxV1Image::DescribeCode() const -> LegacyImage::Code {
+    // The code of an image validated for debug info only is decompressed
+    // on first use.
+    inflateTo(uint32_t(code_.blob() + code_.length() - buffer()));
+
     LegacyImage::Code code;
     code.bytes = code_.blob();
     code.length = code_.length();
@@ -542,6 +946,8 @@ SmxV1Image::DescribeCode() const -> LegacyImage::Code {
 
 auto
 SmxV1Image::DescribeData() const -> LegacyImage::Data {
+    inflateTo(uint32_t(data_.blob() + data_.length() - buffer()));
+
     LegacyImage::Data data;
     data.bytes = data_.blob();
     data.length = data_.length();
@@ -654,6 +1060,14 @@ SmxV1Image::ImageSize() const {
     return length_;
 }
 
+bool
+SmxV1Image::DescribeImage(const uint8_t** bytes, size_t* length) const {
+    inflateTo(uint32_t(length_));
+    *bytes = buffer();
+    *length = length_;
+    return true;
+}
+
 const char*
 SmxV1Image::LookupFile(uint32_t addr) {
     int high = debug_files_.length();
@@ -676,8 +1090,8 @@ SmxV1Image::LookupFile(uint32_t addr) {
 }
 
 template <typename SymbolType, typename DimType>
-const char*
-SmxV1Image::lookupFunction(const SymbolType* syms, uint32_t addr) {
+void
+SmxV1Image::addFunctions(const SymbolType* syms) {
     const uint8_t* cursor = reinterpret_cast<const uint8_t*>(syms);
     const uint8_t* cursor_end = cursor + debug_symbols_section_->size;
     for (uint32_t i = 0; i < debug_info_->num_syms; i++) {
@@ -685,26 +1099,185 @@ SmxV1Image::lookupFunction(const SymbolType* syms, uint32_t addr) {
             break;
 
         const SymbolType* sym = reinterpret_cast<const SymbolType*>(cursor);
-        if (sym->ident == sp::IDENT_FUNCTION && sym->codestart <= addr && sym->codeend > addr) {
-            if (sym->name >= debug_names_section_->size)
-                return nullptr;
-            return debug_names_ + sym->name;
+        if (sym->ident == sp::IDENT_FUNCTION && sym->codestart < sym->codeend) {
+            const char* name = nullptr;
+            if (sym->name < debug_names_section_->size)
+                name = debug_names_ + sym->name;
+            functions_.push_back({sym->codestart, sym->codeend, name});
         }
 
         if (sym->dimcount > 0)
             cursor += sizeof(DimType) * sym->dimcount;
         cursor += sizeof(SymbolType);
     }
-    return nullptr;
 }
 
-const char*
-SmxV1Image::LookupFunction(uint32_t code_offset) {
+// Call stacks look up a function per frame, so keep a sorted range table
+// rather than scanning the symbols each time.
+void
+SmxV1Image::buildFunctionIndex() {
+    if (debug_index_.header) {
+        for (uint32_t i = 0; i < debug_index_.header->num_functions; i++) {
+            const sp_fdbg_index_function_t& fn = debug_index_.functions[i];
+            functions_.push_back({fn.codestart, fn.codeend, debug_names_ + fn.name});
+        }
+        return;
+    }
+
     if (debug_syms_) {
-        return lookupFunction<sp_fdbg_symbol_t, sp_fdbg_arraydim_t>(debug_syms_, code_offset);
+        addFunctions<sp_fdbg_symbol_t, sp_fdbg_arraydim_t>(debug_syms_);
+    } else if (debug_syms_unpacked_) {
+        addFunctions<sp_u_fdbg_symbol_t, sp_u_fdbg_arraydim_t>(debug_syms_unpacked_);
+    } else if (rtti_methods_) {
+        for (uint32_t i = 0; i < rtti_methods_->row_count; i++) {
+            const smx_rtti_method* method = getRttiRow<smx_rtti_method>(rtti_methods_, i);
+            if (method->pcode_start < method->pcode_end)
+                functions_.push_back({method->pcode_start, method->pcode_end, names_ + method->name});
+        }
     }
-    return lookupFunction<sp_u_fdbg_symbol_t, sp_u_fdbg_arraydim_t>(debug_syms_unpacked_,
-                                                                    code_offset);
+
+    // Keep the first symbol listed for a start address, as the old scan did.
+    std::stable_sort(functions_.begin(), functions_.end(),
+                     [](const FunctionRange& a, const FunctionRange& b) {
+                         return a.codestart < b.codestart;
+                     });
+
+    // Function breakpoints look functions up by name.
+    for (uint32_t i = 0; i < functions_.size(); i++)
+        function_names_[functions_[i].name].push_back(i);
+}
+
+const SmxV1Image::FunctionRange*
+SmxV1Image::LookupFunctionRange(uint32_t code_offset) const {
+    auto iter = std::upper_bound(functions_.begin(), functions_.end(), code_offset,
+                                 [](uint32_t addr, const FunctionRange& fn) {
+                                     return addr < fn.codestart;
+                                 });
+    if (iter == functions_.begin())
+        return nullptr;
+    --iter;
+    if (code_offset >= iter->codeend)
+        return nullptr;
+    return &*iter;
+}
+
+size_t
+SmxV1Image::lowerLine(uint32_t addr) const {
+    // The line table is sorted by address.
+    size_t low = 0;
+    size_t high = debug_lines_.length();
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (debug_lines_[mid].addr < addr)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+void
+SmxV1Image::GetLineAddresses(uint32_t codestart, uint32_t codeend,
+                             std::vector<uint32_t>* out) const {
+    size_t i = lowerLine(codestart);
+    for (; i < debug_lines_.length() && debug_lines_[i].addr < codeend; i++) {
+        if (out->empty() || out->back() != debug_lines_[i].addr)
+            out->push_back(debug_lines_[i].addr);
+    }
+}
+
+// Cells taken by the instruction at |insn|, opcode included, or 0 if it
+// doesn't decode in the |left| bytes up to the end of its function.
+static uint32_t
+InstructionCells(const cell_t* insn, uint32_t left) {
+    static const int kCells[] = {
+#define _G(op, text, cells) cells,
+#define _U(op, text) 0,
+        OPCODE_LIST(_G, _U)
+#undef _U
+#undef _G
+    };
+
+    if (left < sizeof(cell_t) || insn[0] < 0 || insn[0] >= OPCODES_LAST)
+        return 0;
+    int cells = kCells[insn[0]];
+    if (insn[0] == OP_CASETBL) {
+        if (left < 2 * sizeof(cell_t) || insn[1] < 0 ||
+            uint32_t(insn[1]) > left / sizeof(cell_t))
+            return 0;
+        cells = insn[1] * 2 + 3;
+    }
+    // Ungenerated opcodes never appear in valid code.
+    if (cells <= 0 || cells * sizeof(cell_t) > left)
+        return 0;
+    return uint32_t(cells);
+}
+
+void
+SmxV1Image::GetLineCalls(uint32_t cip, std::vector<uint32_t>* targets) const {
+    const FunctionRange* fn = LookupFunctionRange(cip);
+    if (!fn)
+        return;
+    uint32_t end = std::min<uint32_t>(fn->codeend, code_.length());
+    inflateTo(uint32_t(code_.blob() + end - buffer()));
+    // Code compiled without BREAKs ends the line at the next line entry.
+    size_t next = lowerLine(cip + 1);
+    if (next < debug_lines_.length())
+        end = std::min<uint32_t>(end, debug_lines_[next].addr);
+    const uint8_t* code = code_.blob();
+    for (uint32_t pos = cip; pos + sizeof(cell_t) <= end;) {
+        const cell_t* insn = reinterpret_cast<const cell_t*>(code + pos);
+        uint32_t cells = InstructionCells(insn, end - pos);
+        if (!cells)
+            return;
+        OPCODE op = (OPCODE)insn[0];
+        if ((op == OP_BREAK && pos != cip) || op == OP_RETN)
+            return;
+        if (op == OP_CALL)
+            targets->push_back(insn[1]);
+        pos += cells * sizeof(cell_t);
+    }
+}
+
+bool
+SmxV1Image::DecodeInstructions(uint32_t codestart, uint32_t codeend,
+                               std::vector<Instruction>* out) const {
+    uint32_t end = std::min<uint32_t>(codeend, code_.length());
+    if (codestart >= end)
+        return codestart == end;
+    inflateTo(uint32_t(code_.blob() + end - buffer()));
+    const uint8_t* code = code_.blob();
+    for (uint32_t pos = codestart; pos < end;) {
+        const cell_t* insn = reinterpret_cast<const cell_t*>(code + pos);
+        uint32_t cells = InstructionCells(insn, end - pos);
+        if (!cells)
+            return false;
+        out->push_back({pos, (OPCODE)insn[0], insn + 1, cells - 1});
+        pos += cells * sizeof(cell_t);
+    }
+    return true;
+}
+
+const char*
+SmxV1Image::OpcodeName(OPCODE op) {
+    static const char* const kNames[] = {
+#define _G(op, text, cells) text,
+#define _U(op, text) text,
+        OPCODE_LIST(_G, _U)
+#undef _U
+#undef _G
+    };
+    if (op < 0 || op >= OPCODES_LAST)
+        return "?";
+    return kNames[op];
+}
+
+const char*
+SmxV1Image::LookupFunction(uint32_t code_offset) {
+    const FunctionRange* fn = LookupFunctionRange(code_offset);
+    if (!fn)
+        return nullptr;
+    return fn->name;
 }
 
 bool
@@ -728,180 +1301,417 @@ SmxV1Image::LookupLine(uint32_t addr, uint32_t* line) {
     return true;
 }
 
-template <typename SymbolType, typename DimType>
-bool
-SmxV1Image::getFunctionAddress(const SymbolType* syms, const char* name, uint32_t* addr,
-                               uint32_t* index) {
-    unsigned int i = 0;
-    SymbolIterator iter = symboliterator(false);
-    while (!iter.Done()) {
-        Symbol sym = iter.Next();
-
-        if (i >= *index && sym.ident() == sp::IDENT_FUNCTION &&
-            sym.name() < debug_names_section_->size && !strcmp(debug_names_ + sym.name(), name)) {
-            *addr = sym.addr();
-            return true;
-        }
+void
+SmxV1Image::buildLocationTable() {
+    // Only the cells where a value changes are kept; a lookup takes the last
+    // change at or before its cell. Entries sharing an address all apply
+    // to it, so only the last of them counts.
+    uint32_t cells = uint32_t(code_.length() / sizeof(cell_t));
+    uint32_t file = kNoFile;
+    for (uint32_t i = 0; i < debug_files_.length(); i++) {
+        uint32_t addr = debug_files_[i].addr;
+        if (addr / sizeof(cell_t) >= cells)
+            break;
+        if (i + 1 < debug_files_.length() && debug_files_[i + 1].addr <= addr)
+            continue;
+        uint32_t next = debug_files_[i].name < debug_names_section_->size ? i : kNoFile;
+        if (next != file)
+            file_runs_.append(addr, next);
+        file = next;
+    }
+    file_runs_.shrink();
 
-        if (i == *index)
-            (*index)++;
-        i++;
+    uint32_t line = 0;
+    for (uint32_t i = 0; i < debug_lines_.length(); i++) {
+        uint32_t addr = debug_lines_[i].addr;
+        if (addr / sizeof(cell_t) >= cells)
+            break;
+        if (i + 1 < debug_lines_.length() && debug_lines_[i + 1].addr <= addr)
+            continue;
+        uint32_t next = debug_lines_[i].line + 1;
+        if (next != line)
+            line_runs_.append(addr, next);
+        line = next;
     }
-    return false;
+    line_runs_.shrink();
+}
+
+bool
+SmxV1Image::LookupLocation(uint32_t code_offset, uint32_t* file, uint32_t* line) {
+    std::call_once(locations_built_, [this] { buildLocationTable(); });
+
+    size_t cell = code_offset / sizeof(cell_t);
+    if (cell >= code_.length() / sizeof(cell_t))
+        return false;
+
+    uint32_t addr = uint32_t(cell * sizeof(cell_t));
+    uint32_t found;
+    if (!file_runs_.floor(addr, &found, file))
+        *file = kNoFile;
+    return line_runs_.floor(addr, &found, line);
 }
 
 bool
 SmxV1Image::GetFunctionAddress(const char* function, const char* file, uint32_t* funcaddr) {
-    uint32_t index = 0;
-    const char* tgtfile;
     *funcaddr = 0;
-    for (;;) {
-        // find (next) matching function
-        if (debug_syms_) {
-            getFunctionAddress<sp_fdbg_symbol_t, sp_fdbg_arraydim_t>(debug_syms_, function,
-                                                                     funcaddr, &index);
-        } else {
-            getFunctionAddress<sp_u_fdbg_symbol_t, sp_u_fdbg_arraydim_t>(
-                debug_syms_unpacked_, function, funcaddr, &index);
+    auto try_function = [&](const FunctionRange& fn) -> bool {
+        // verify that this function is defined in the apprpriate file
+        if (file) {
+            const char* tgtfile = LookupFile(fn.codestart);
+            if (tgtfile == nullptr || strcmp(file, tgtfile) != 0)
+                return false;
         }
 
-        if (index >= debug_info_->num_syms)
+        // now find the first line in the function where we can "break" on
+        size_t line = lowerLine(fn.codestart);
+        if (line >= debug_lines_.length() || debug_lines_[line].addr >= fn.codeend)
             return false;
+        *funcaddr = debug_lines_[line].addr;
+        return true;
+    };
 
-        // verify that this function is defined in the apprpriate file
-        tgtfile = LookupFile(*funcaddr);
-        if (tgtfile != nullptr && strcmp(file, tgtfile) == 0)
-            break;
-        index++;
+    if (debug_index_.header) {
+        uint32_t bucket = sp_fdbg_index_hash(function) & (debug_index_.header->num_buckets - 1);
+        for (uint32_t i = debug_index_.function_buckets[bucket];
+             i < debug_index_.function_buckets[bucket + 1]; i++) {
+            const FunctionRange& fn = functions_[debug_index_.function_chain[i]];
+            if (strcmp(fn.name, function) == 0 && try_function(fn))
+                return true;
+        }
+        return false;
     }
-    assert(index < debug_info_->num_syms);
-
-    // now find the first line in the function where we can "break" on
-    for (index = 0; index < debug_info_->num_lines && debug_lines_[index].addr < *funcaddr; index++)
-        /* nothing */;
 
-    if (index >= debug_info_->num_lines)
+    auto found = function_names_.find(function);
+    if (found == function_names_.end())
         return false;
 
-    *funcaddr = debug_lines_[index].addr;
-    return true;
+    for (uint32_t index : found->second) {
+        if (try_function(functions_[index]))
+            return true;
+    }
+    return false;
+}
+
+std::shared_ptr<const SmxV1Image::LineIndex>
+SmxV1Image::buildLineIndex() {
+    // Both tables are sorted by address, so one pass assigns every line to
+    // the file range it falls in.
+    struct LineAddress {
+        uint32_t line;
+        uint32_t addr;
+    };
+    std::unordered_map<std::string_view, std::vector<LineAddress>> lines_by_file;
+    uint32_t index = 0;
+    for (uint32_t file = 0; file < debug_info_->num_files; file++) {
+        uint32_t bottomaddr = debug_files_[file].addr;
+        uint32_t topaddr =
+            (file + 1 < debug_info_->num_files) ? debug_files_[file + 1].addr : (uint32_t)-1;
+
+        while (index < debug_info_->num_lines && debug_lines_[index].addr < bottomaddr)
+            index++;
+        if (debug_files_[file].name >= debug_names_section_->size)
+            continue;
+
+        auto& lines = lines_by_file[std::string_view(debug_names_ + debug_files_[file].name)];
+        for (; index < debug_info_->num_lines && debug_lines_[index].addr < topaddr; index++)
+            lines.push_back({debug_lines_[index].line, debug_lines_[index].addr});
+    }
+
+    auto line_index = std::make_shared<LineIndex>();
+    for (auto& entry : lines_by_file) {
+        std::sort(entry.second.begin(), entry.second.end(),
+                  [](const LineAddress& a, const LineAddress& b) {
+                      if (a.line != b.line)
+                          return a.line < b.line;
+                      return a.addr < b.addr;
+                  });
+        DeltaTable& table = line_index->files[entry.first];
+        for (const LineAddress& line : entry.second)
+            table.append(line.line, line.addr);
+        table.shrink();
+        line_index->bytes += table.memoryUsage();
+    }
+    line_index->bytes += HashMapBytes(line_index->files);
+    return line_index;
 }
 
 bool
 SmxV1Image::GetLineAddress(const uint32_t line, const char* filename, uint32_t* addr) {
+    uint32_t found_line;
+    return GetLineAddress(line, filename, addr, &found_line);
+}
+
+bool
+SmxV1Image::GetLineAddress(const uint32_t line, const char* filename, uint32_t* addr,
+                           uint32_t* found_line) {
     /* Find a suitable "breakpoint address" close to the indicated line (and in
    * the specified file). The address is moved up to the next "breakable" line
-   * if no "breakpoint" is available on the specified line. You can use function
-   * LookupLine() to find out at which precise line the breakpoint was set.
+   * if no "breakpoint" is available on the specified line; |found_line| tells
+   * which line that was.
    *
    * The filename comparison is strict (case sensitive and path sensitive).
    */
     *addr = 0;
+    if (!debug_info_)
+        return false;
 
-    uint32_t bottomaddr, topaddr;
-    uint32_t file;
-    uint32_t index = 0;
-    for (file = 0; file < debug_info_->num_files; file++) {
-        // find the (next) matching instance of the file
-        if (debug_files_[file].name >= debug_names_section_->size ||
-            strcmp(debug_names_ + debug_files_[file].name, filename) != 0) {
-            continue;
-        }
-
-        // get address range for the current file
-        bottomaddr = debug_files_[file].addr;
-        topaddr = (file + 1 < debug_info_->num_files) ? debug_files_[file + 1].addr : (uint32_t)-1;
-
-        // go to the starting address in the line table
-        while (index < debug_info_->num_lines && debug_lines_[index].addr < bottomaddr)
-            index++;
+    if (debug_index_.header) {
+        for (uint32_t i = 0; i < debug_index_.header->num_files; i++) {
+            const sp_fdbg_index_file_t& file = debug_index_.files[i];
+            if (strcmp(debug_names_ + file.name, filename) != 0)
+                continue;
+
+            const sp_fdbg_line_t* first = debug_index_.lines + file.first_line;
+            const sp_fdbg_line_t* last = first + file.num_lines;
+            auto iter = std::lower_bound(first, last, line,
+                                         [](const sp_fdbg_line_t& entry, uint32_t line) {
+                                             return entry.line < line;
+                                         });
+            if (iter == last)
+                return false;
 
-        // browse until the line is found or until the top address is exceeded
-        while (index < debug_info_->num_lines && debug_lines_[index].line < line &&
-               debug_lines_[index].addr < topaddr) {
-            index++;
+            *addr = iter->addr;
+            *found_line = iter->line;
+            return true;
         }
-
-        if (index >= debug_info_->num_lines)
-            return false;
-        if (debug_lines_[index].line >= line)
-            break;
-
-        // if not found (and the line table is not yet exceeded) try the next
-        // instance of the same file (a file may appear twice in the file table)
+        return false;
     }
-    if (file >= debug_info_->num_files)
+
+    auto index = lineIndex();
+    auto found = index->files.find(std::string_view(filename));
+    if (found == index->files.end())
         return false;
 
-    assert(index < debug_info_->num_lines);
-    *addr = debug_lines_[index].addr;
-    return true;
+    return found->second.lowerBound(line, found_line, addr);
 }
 
-const char*
-SmxV1Image::FindFileByPartialName(const char* partialname) {
-    // the user may have given a partial filename (e.g. without a path), so
-    // walk through all files to find a match.
-    int len = strlen(partialname);
-    int offs;
-    const char* filename;
+void
+SmxV1Image::buildSuffixIndex() {
+    suffix_index_.push_back({UINT32_MAX, {}});
     for (uint32_t i = 0; i < debug_info_->num_files; i++) {
         // Invalid name offset?
         if (debug_files_[i].name >= debug_names_section_->size)
             continue;
 
-        filename = debug_names_ + debug_files_[i].name;
-        offs = strlen(filename) - len;
-        if (offs >= 0 && !strncmp(filename + offs, partialname, len)) {
-            return filename;
+        const char* filename = debug_names_ + debug_files_[i].name;
+        uint32_t node = 0;
+        suffix_index_[node].first = std::min(suffix_index_[node].first, i);
+        for (size_t pos = strlen(filename); pos > 0; pos--) {
+            char c = filename[pos - 1];
+            uint32_t next = UINT32_MAX;
+            for (const auto& child : suffix_index_[node].children) {
+                if (child.first == c) {
+                    next = child.second;
+                    break;
+                }
+            }
+            if (next == UINT32_MAX) {
+                next = (uint32_t)suffix_index_.size();
+                suffix_index_[node].children.emplace_back(c, next);
+                suffix_index_.push_back({i, {}});
+            }
+            node = next;
+            suffix_index_[node].first = std::min(suffix_index_[node].first, i);
         }
     }
-    return nullptr;
+}
+
+const char*
+SmxV1Image::FindFileByPartialName(const char* partialname) {
+    // the user may have given a partial filename (e.g. without a path), so
+    // find the first file ending in it.
+    if (!debug_info_)
+        return nullptr;
+
+    std::call_once(suffix_index_built_, [this] { buildSuffixIndex(); });
+
+    uint32_t node = 0;
+    for (size_t pos = strlen(partialname); pos > 0; pos--) {
+        char c = partialname[pos - 1];
+        uint32_t next = UINT32_MAX;
+        for (const auto& child : suffix_index_[node].children) {
+            if (child.first == c) {
+                next = child.second;
+                break;
+            }
+        }
+        if (next == UINT32_MAX)
+            return nullptr;
+        node = next;
+    }
+
+    uint32_t file = suffix_index_[node].first;
+    if (file == UINT32_MAX)
+        return nullptr;
+    return debug_names_ + debug_files_[file].name;
+}
+
+void
+SmxV1Image::GetLocalVariables(uint32_t scopeaddr, std::vector<Symbol>* out) {
+    auto index = symbolIndex();
+    for (uint32_t pos : index->local_vars) {
+        const Symbol& sym = index->symbols[pos];
+        if (sym.codestart() <= scopeaddr && sym.codeend() >= scopeaddr)
+            out->push_back(sym);
+    }
+}
+
+void
+SmxV1Image::GetGlobalVariables(std::vector<Symbol>* out) {
+    auto index = symbolIndex();
+    for (uint32_t pos : index->global_vars)
+        out->push_back(index->symbols[pos]);
 }
 
 const char*
 SmxV1Image::GetTagName(uint32_t tag) {
-    unsigned int index;
-    for (index = 0; index < tags_.length() && tags_[index].tag_id != tag; index++)
-        /* nothing */;
-    if (index >= tags_.length())
+    auto found = tag_index_.find(tag);
+    if (found == tag_index_.end())
         return nullptr;
+    return found->second.name;
+}
+
+SmxV1Image::TagKind
+SmxV1Image::GetTagKind(uint32_t tag) {
+    auto found = tag_index_.find(tag);
+    if (found == tag_index_.end())
+        return TagKind::Other;
+    return found->second.kind;
+}
 
-    return names_ + tags_[index].name;
+SmxV1Image::IndexMemory
+SmxV1Image::GetIndexMemory() {
+    IndexMemory memory = {};
+
+    if (auto index = std::atomic_load(&symbol_index_))
+        memory.symbols += index->bytes;
+    memory.symbols += VectorBytes(dim_table_) + HashMapBytes(dim_ranges_);
+
+    memory.functions += VectorBytes(functions_);
+    memory.functions += HashMapBytes(function_names_);
+    for (const auto& entry : function_names_)
+        memory.functions += VectorBytes(entry.second);
+
+    memory.lines += file_runs_.memoryUsage() + line_runs_.memoryUsage();
+    if (auto index = std::atomic_load(&line_index_))
+        memory.lines += index->bytes;
+    memory.lines += VectorBytes(suffix_index_);
+    for (const auto& node : suffix_index_)
+        memory.lines += VectorBytes(node.children);
+
+    memory.types += HashMapBytes(tag_index_);
+    if (enum_fields_) {
+        memory.types += rtti_enumstructs_->row_count * sizeof(TypeCache);
+        for (uint32_t i = 0; i < rtti_enumstructs_->row_count; i++)
+            memory.types += VectorBytes(enum_fields_[i].fields);
+    }
+    if (classdef_fields_) {
+        memory.types += rtti_classdefs_->row_count * sizeof(TypeCache);
+        for (uint32_t i = 0; i < rtti_classdefs_->row_count; i++)
+            memory.types += VectorBytes(classdef_fields_[i].fields);
+    }
+    return memory;
 }
 
 bool
 SmxV1Image::GetVariable(const char* symname, uint32_t scopeaddr, std::unique_ptr<Symbol>& sym) {
-    uint32_t codestart = 0;
-    uint32_t codeend = 0;
+    return GetVariable(symname, scopeaddr, sym, nullptr, nullptr);
+}
 
+bool
+SmxV1Image::GetVariable(const char* symname, uint32_t scopeaddr, std::unique_ptr<Symbol>& sym,
+                        uint32_t* start, uint32_t* end) {
     sym = nullptr;
 
-    SymbolIterator iter = symboliterator(false);
-    while (!iter.Done()) {
-        // find (next) matching variable
-        sym = std::make_unique<Symbol>(iter.Next());
+    // Between two consecutive scope boundaries of the name the same scopes
+    // contain the address, so the same symbol wins.
+    uint32_t lo = 0, hi = UINT32_MAX;
+    auto bound = [&](uint32_t codestart, uint32_t codeend) {
+        if (codestart <= scopeaddr)
+            lo = std::max(lo, codestart);
+        else
+            hi = std::min(hi, codestart - 1);
+        if (codeend != UINT32_MAX) {
+            if (codeend + 1 <= scopeaddr)
+                lo = std::max(lo, codeend + 1);
+            else
+                hi = std::min(hi, codeend);
+        }
+    };
+    struct Range {
+        uint32_t* start;
+        uint32_t* end;
+        uint32_t& lo;
+        uint32_t& hi;
+        ~Range() {
+            if (start)
+                *start = lo;
+            if (end)
+                *end = hi;
+        }
+    } range{start, end, lo, hi};
 
-        if (sym->codestart() <= scopeaddr && sym->codeend() >= scopeaddr &&              
-            strcmp(debug_names_ + sym->name(), symname) == 0) {            
-            break;
+    auto index = symbolIndex();
+    if (debug_index_.header) {
+        auto found = [&](uint32_t symbol) -> bool {
+            if (symbol >= index->symbols.size())
+                return false;
+            sym = std::make_unique<Symbol>(index->symbols[symbol]);
+            return true;
+        };
+
+        uint32_t bucket = sp_fdbg_index_hash(symname) & (debug_index_.header->num_buckets - 1);
+        for (uint32_t i = debug_index_.name_buckets[bucket];
+             i < debug_index_.name_buckets[bucket + 1]; i++) {
+            const sp_fdbg_index_name_t& name = debug_index_.names[i];
+            if (strcmp(debug_names_ + name.name, symname) != 0)
+                continue;
+
+            // The innermost scope containing the address wins.
+            const sp_fdbg_index_scope_t* first = debug_index_.scopes + name.first_scope;
+            if (start || end) {
+                for (uint32_t j = 0; j < name.num_scopes; j++)
+                    bound(first[j].codestart, first[j].codeend);
+            }
+            const sp_fdbg_index_scope_t* it =
+                std::upper_bound(first, first + name.num_scopes, scopeaddr,
+                                 [](uint32_t addr, const sp_fdbg_index_scope_t& scope) {
+                                     return addr < scope.codestart;
+                                 });
+            while (it != first) {
+                --it;
+                if (it->codeend >= scopeaddr)
+                    return found(it->symbol);
+            }
+            return found(name.global);
         }
-        sym = nullptr;
+        return false;
     }
-    if (sym == nullptr) {
-        iter = symboliterator(true);
-        while (!iter.Done()) {
-            // find (next) matching variable
-            sym = std::make_unique<Symbol>(iter.Next());
 
-            if (
-                strcmp(debug_names_ + sym->name(), symname) == 0) {
-                break;
+    // The innermost scope containing the address wins.
+    auto scoped = index->scoped.find(symname);
+    if (scoped != index->scoped.end()) {
+        const auto& ranges = scoped->second;
+        if (start || end) {
+            for (const auto& scope : ranges)
+                bound(scope.codestart, scope.codeend);
+        }
+        auto it = std::upper_bound(ranges.begin(), ranges.end(), scopeaddr,
+                                   [](uint32_t addr, const ScopedSymbol& range) {
+                                       return addr < range.codestart;
+                                   });
+        while (it != ranges.begin()) {
+            --it;
+            if (it->codeend >= scopeaddr) {
+                sym = std::make_unique<Symbol>(index->symbols[it->index]);
+                return true;
             }
-            sym = nullptr;
         }
-
     }
+
+    auto global = index->globals.find(symname);
+    if (global != index->globals.end())
+        sym = std::make_unique<Symbol>(index->symbols[global->second]);
     return sym != nullptr;
 }
 
@@ -921,43 +1731,53 @@ SmxV1Image::GetFileName(uint32_t index) {
 
 uint32_t
 SmxV1Image::GetFileCount() {
+    if (!debug_info_)
+        return 0;
     return debug_info_->num_files;
 }
 
-std::vector<SmxV1Image::ArrayDim*>*
+SmxV1Image::ArrayDims
 SmxV1Image::GetArrayDimensions(const Symbol* sym) {
     if (sym->ident() != sp::IDENT_ARRAY && sym->ident() != IDENT_REFARRAY)
-        return nullptr;
+        return ArrayDims();
 
-    assert(sym->dimcount() > 0); // array must have at least one dimension
+    auto found = dim_ranges_.find(sym->sym());
+    if (found == dim_ranges_.end())
+        return ArrayDims();
+    return ArrayDims(dim_table_.data() + found->second.offset, found->second.count);
+}
+
+void
+SmxV1Image::decodeArrayDimensions(const Symbol& sym) {
+    if (sym.ident() != sp::IDENT_ARRAY && sym.ident() != IDENT_REFARRAY)
+        return;
 
-    // find he end of the symbol name
-    const char* ptr = (const char*)sym->sym();
-    auto type = sym->type();
+    assert(sym.dimcount() > 0); // array must have at least one dimension
+
+    DimRange range;
+    range.offset = (uint32_t)dim_table_.size();
+
+    // The dimensions follow the symbol entry.
+    const char* ptr = (const char*)sym.sym();
+    auto type = sym.type();
     if (type == Symbol::VAR_PACKED) {
         ptr += sizeof(sp_fdbg_symbol_t);
+        for (int i = 0; i < sym.dimcount(); i++) {
+            dim_table_.push_back(ArrayDim((sp_fdbg_arraydim_t*)ptr));
+            ptr += sizeof(sp_fdbg_arraydim_t);
+        }
     } else if (type == Symbol::VAR_UNPACKED) {
         ptr += sizeof(sp_u_fdbg_symbol_t);
-    }
-    if (type != Symbol::VAR_RTTI) {
-        std::vector<ArrayDim*>* dims = new std::vector<ArrayDim*>();
-        for (int i = 0; i < sym->dimcount(); i++) {
-            if (sym->packed()) {
-                dims->push_back(new ArrayDim((sp_fdbg_arraydim_t*)ptr));
-                ptr += sizeof(sp_fdbg_arraydim_t);
-            } else {
-                // There's a padding of 2 bytes before this short.
-                ptr += 2;
-                dims->push_back(new ArrayDim((sp_u_fdbg_arraydim_t*)ptr));
-                ptr += sizeof(sp_u_fdbg_arraydim_t);
-            }
+        for (int i = 0; i < sym.dimcount(); i++) {
+            // There's a padding of 2 bytes before this short.
+            ptr += 2;
+            dim_table_.push_back(ArrayDim((sp_u_fdbg_arraydim_t*)ptr));
+            ptr += sizeof(sp_u_fdbg_arraydim_t);
         }
-        return dims;
     } else {
-        std::vector<ArrayDim*>* dims = new std::vector<ArrayDim*>();
-        auto sym = (smx_rtti_debug_var*)ptr;
-        int kind = (sym->type_id) & 0xf;
-        int payload = ((sym->type_id) >> 4) & 0xfffffff;
+        auto var = (const smx_rtti_debug_var*)ptr;
+        int kind = (var->type_id) & 0xf;
+        int payload = ((var->type_id) >> 4) & 0xfffffff;
         auto DecodeUint32 = [](unsigned char* bytes, int &offset) {
             uint32_t value = 0;
             int shift = 0;
@@ -970,18 +1790,6 @@ SmxV1Image::GetArrayDimensions(const Symbol* sym) {
             }
             return (int)value;
         };
-        std::function<void(unsigned char*, int&)> Decode;
-        Decode = [dims, DecodeUint32, &Decode](unsigned char* bytes, int& offset) {
-            unsigned char b = bytes[offset++];
-            switch (b) {
-                case cb::kFixedArray: {
-                    auto dimcount_ = DecodeUint32(bytes, offset);
-                    dims->push_back(new ArrayDim(dimcount_));
-                    Decode(bytes, offset);
-                    break;
-                }
-            }
-        };
         if (kind == kTypeId_Inline) {
             unsigned char temp[4];
             temp[0] = (payload & 0xff);
@@ -989,25 +1797,29 @@ SmxV1Image::GetArrayDimensions(const Symbol* sym) {
             temp[2] = ((payload >> 16) & 0xff);
             temp[3] = ((payload >> 24) & 0xff);
             int offset = 0;
-            Decode(temp, offset);
+            while (offset < 4 && temp[offset] == cb::kFixedArray) {
+                offset++;
+                dim_table_.push_back(ArrayDim((uint32_t)DecodeUint32(temp, offset)));
+            }
         }
-        return dims;
     }
-    
+
+    range.count = (uint32_t)dim_table_.size() - range.offset;
+    dim_ranges_[sym.sym()] = range;
 }
 
 
 bool
 SmxV1Image::validateRttiField(uint32_t index) {
     if (index >= rtti_fields_->row_count)
-        return error("invalid classdef field index");
+        return false;
 
     // TODO: Validate flags.
     const smx_rtti_field* field = getRttiRow<smx_rtti_field>(rtti_fields_, index);
     if (!validateName(field->name))
-        return error("invalid classdef field name");
+        return false;
     if (!rtti_data_->validateType(field->type_id))
-        return error("invalid classdef field type");
+        return false;
     return true;
 }
 size_t SmxV1Image::getTypeFromTypeId(uint32_t typeId) {
@@ -1044,10 +1856,17 @@ size_t SmxV1Image::getTypeFromTypeId(uint32_t typeId) {
     }
     return 0;
 };
-std::vector<smx_rtti_es_field*>
-SmxV1Image::getEnumFields(uint32_t index) {
-    const smx_rtti_enumstruct* enumstruct = getRttiRow<smx_rtti_enumstruct>(rtti_enumstructs_, index);
-    // Calculate how many fields this class has.
+// Enum structs and classdefs are only validated when the debugger first
+// looks at one, so opening an image for a stack trace doesn't walk every
+// field of every type. A row that fails has no fields.
+bool
+SmxV1Image::validateRttiEnumStruct(uint32_t index) {
+    const smx_rtti_enumstruct* enumstruct =
+        getRttiRow<smx_rtti_enumstruct>(rtti_enumstructs_, index);
+    if (!validateName(enumstruct->name))
+        return false;
+
+    // Calculate how many fields this enum struct has.
     uint32_t stopat = rtti_enumstruct_fields_->row_count;
     if (index != rtti_enumstructs_->row_count - 1) {
         const smx_rtti_enumstruct* next_enumstruct =
@@ -1055,22 +1874,30 @@ SmxV1Image::getEnumFields(uint32_t index) {
         stopat = next_enumstruct->first_field;
     }
     if (enumstruct->first_field >= stopat)
-        return {};
+        return false;
 
-    std::vector<smx_rtti_es_field*> ret;
+    std::vector<TypeField>& fields = enum_fields_[index].fields;
     for (uint32_t j = enumstruct->first_field; j < stopat; j++) {
-        if (!validateRttiEnumStructField(enumstruct, j))
-            return {};
-        const smx_rtti_es_field* field = getRttiRow<smx_rtti_es_field>(rtti_enumstruct_fields_, j);
-        ret.push_back(const_cast<smx_rtti_es_field*>(field));
+        if (!validateRttiEnumStructField(enumstruct, j)) {
+            fields.clear();
+            return false;
+        }
+        const smx_rtti_es_field* field =
+            getRttiRow<smx_rtti_es_field>(rtti_enumstruct_fields_, j);
+        fields.push_back({GetDebugName(field->name),
+                          rtti_data_->typeFromTypeId(field->type_id),
+                          field->offset});
     }
-    return ret;
+    return true;
 }
 
-
-std::vector<smx_rtti_field*>
-SmxV1Image::getTypeFields(uint32_t index) {
+bool
+SmxV1Image::validateRttiClassdef(uint32_t index) {
     const smx_rtti_classdef* classdef = getRttiRow<smx_rtti_classdef>(rtti_classdefs_, index);
+    // TODO: Validate flags.
+    if (!validateName(classdef->name))
+        return false;
+
     // Calculate how many fields this class has.
     uint32_t stopat = rtti_fields_->row_count;
     if (index != rtti_classdefs_->row_count - 1) {
@@ -1079,98 +1906,61 @@ SmxV1Image::getTypeFields(uint32_t index) {
         stopat = next_classdef->first_field;
     }
     if (classdef->first_field >= stopat)
-        return {};
+        return false;
 
-    std::vector<smx_rtti_field*> ret;
+    std::vector<TypeField>& fields = classdef_fields_[index].fields;
     for (uint32_t j = classdef->first_field; j < stopat; j++) {
-        if (!validateRttiField(j))
-            return {};
+        if (!validateRttiField(j)) {
+            fields.clear();
+            return false;
+        }
         const smx_rtti_field* field = getRttiRow<smx_rtti_field>(rtti_fields_, j);
-        ret.push_back(const_cast<smx_rtti_field*>(field));
+        fields.push_back({GetDebugName(field->name),
+                          rtti_data_->typeFromTypeId(field->type_id), 0});
     }
-    return ret;
+    return true;
 }
 
-bool
-SmxV1Image::validateRttiClassdefs() {
-    if (!rtti_fields_)
-        return error("rtti.fields section missing");
-
-    for (uint32_t i = 0; i < rtti_classdefs_->row_count; i++) {
-        const smx_rtti_classdef* classdef = getRttiRow<smx_rtti_classdef>(rtti_classdefs_, i);
-        // TODO: Validate flags.
-        if (!validateName(classdef->name))
-            return error("invalid classdef name");
-
-        // Calculate how many fields this class has.
-        uint32_t stopat = rtti_fields_->row_count;
-        if (i != rtti_classdefs_->row_count - 1) {
-            const smx_rtti_classdef* next_classdef =
-                getRttiRow<smx_rtti_classdef>(rtti_classdefs_, i + 1);
-            stopat = next_classdef->first_field;
-        }
-        if (classdef->first_field >= stopat)
-            return error("invalid classdef fields boundary");
-
-        for (uint32_t j = classdef->first_field; j < stopat; j++) {
-            if (!validateRttiField(j))
-                return false;
-        }
-    }
-    return true;
+SmxV1Image::TypeFields
+SmxV1Image::getEnumFields(uint32_t index) {
+    if (!rtti_enumstructs_ || index >= rtti_enumstructs_->row_count)
+        return TypeFields();
+    TypeCache& cache = enum_fields_[index];
+    std::call_once(cache.validated, [&] { cache.valid = validateRttiEnumStruct(index); });
+    if (!cache.valid)
+        return TypeFields();
+    return TypeFields(cache.fields.data(), cache.fields.size());
 }
 
+uint32_t
+SmxV1Image::getEnumStructSize(uint32_t index) {
+    if (!rtti_enumstructs_ || index >= rtti_enumstructs_->row_count)
+        return 0;
+    return getRttiRow<smx_rtti_enumstruct>(rtti_enumstructs_, index)->size;
+}
 
-bool
-SmxV1Image::validateRttiEnums() {
-    for (uint32_t i = 0; i < rtti_enums_->row_count; i++) {
-        const smx_rtti_enum* enumType = getRttiRow<smx_rtti_enum>(rtti_enums_, i);
-        if (!validateName(enumType->name))
-            return error("invalid enum name");
-    }
-    return true;
+SmxV1Image::TypeFields
+SmxV1Image::getTypeFields(uint32_t index) {
+    if (!rtti_classdefs_ || index >= rtti_classdefs_->row_count)
+        return TypeFields();
+    TypeCache& cache = classdef_fields_[index];
+    std::call_once(cache.validated, [&] { cache.valid = validateRttiClassdef(index); });
+    if (!cache.valid)
+        return TypeFields();
+    return TypeFields(cache.fields.data(), cache.fields.size());
 }
 
 bool
 SmxV1Image::validateRttiEnumStructField(const smx_rtti_enumstruct* enumstruct, uint32_t index) {
     if (index >= rtti_enumstruct_fields_->row_count)
-        return error("invalid enum struct field index");
+        return false;
 
     const smx_rtti_es_field* field = getRttiRow<smx_rtti_es_field>(rtti_enumstruct_fields_, index);
     if (!validateName(field->name))
-        return error("invalid enum struct field name");
+        return false;
     if (field->offset >= enumstruct->size * 4)
-        return error("invalid enum struct field offset");
+        return false;
     if (!rtti_data_->validateType(field->type_id))
-        return error("invalid enum struct field type");
+        return false;
     return true;
 }
-
-bool
-SmxV1Image::validateRttiEnumStructs() {
-    if (!rtti_enumstruct_fields_)
-        return error("rtti.enumstruct_fields section missing");
-
-    for (uint32_t i = 0; i < rtti_enumstructs_->row_count; i++) {
-        const smx_rtti_enumstruct* enumstruct =
-            getRttiRow<smx_rtti_enumstruct>(rtti_enumstructs_, i);
-        if (!validateName(enumstruct->name))
-            return error("invalid enum struct name");
-
-        // Calculate how many fields this enumstruct has.
-        uint32_t stopat = rtti_enumstruct_fields_->row_count;
-        if (i != rtti_enumstructs_->row_count - 1) {
-            const smx_rtti_enumstruct* next_enumstruct =
-                getRttiRow<smx_rtti_enumstruct>(rtti_enumstructs_, i + 1);
-            stopat = next_enumstruct->first_field;
-        }
-        if (enumstruct->first_field >= stopat)
-            return error("invalid enum struct fields boundary");
-
-        for (uint32_t j = enumstruct->first_field; j < stopat; j++) {
-            if (!validateRttiEnumStructField(enumstruct, j))
-                return false;
-        }
-    }
-    return true;
-}
\ No newline at end of file
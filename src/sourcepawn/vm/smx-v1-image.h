@@ -13,13 +13,19 @@
 #include <am-vector.h>
 #include <smx/smx-headers.h>
 #include <smx/smx-v1.h>
+#include <smx/smx-v1-opcodes.h>
 #include <sp_vm_types.h>
 #include <stdio.h>
+#include "delta-table.h"
 #include "file-utils.h"
 #include "legacy-image.h"
 #include "smx/smx-legacy-debuginfo.h"
 #include "smx/smx-typeinfo.h"
+#include <atomic>
 #include <functional>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
 #include "rtti.h"
 namespace sp {
 
@@ -33,9 +39,21 @@ class SmxV1Image : public FileReader
 
   public:
     SmxV1Image(FILE* fp);
-
-    // This must be called to initialize the reader.
-    bool validate();
+    // Map the file instead of reading it. Uncompressed images are used in
+    // place; compressed ones are decompressed by validate().
+    explicit SmxV1Image(const char* path);
+    // Read an image that was already loaded and decompressed, such as the
+    // one behind a PluginRuntime. The buffer must outlive this object.
+    SmxV1Image(const uint8_t* bytes, size_t length);
+    // The same, owning a copy of such an image.
+    SmxV1Image(std::unique_ptr<uint8_t[]>&& bytes, size_t length);
+    ~SmxV1Image();
+
+    // This must be called to initialize the reader. A compressed image is
+    // decompressed through its last section, unless |debug_info_only| is
+    // set: then the bodies of .code and .data are left for the first call
+    // that needs them, and only decompressed if later sections follow.
+    bool validate(bool debug_info_only = false);
 
     const sp_file_hdr_t* hdr() const {
         return hdr_;
@@ -59,23 +77,123 @@ class SmxV1Image : public FileReader
     bool FindPubvar(const char* name, size_t* indexp) const;
     size_t HeapSize() const;
     size_t ImageSize() const;
+    bool DescribeImage(const uint8_t** bytes, size_t* length) const;
+    uint64_t FileHash() const {
+        return file_hash_;
+    }
     const char* LookupFile(uint32_t code_offset);
     const char* LookupFunction(uint32_t code_offset);
     bool LookupLine(uint32_t code_offset, uint32_t* line);
 
+    // File index and line of a code offset, from delta-encoded tables of
+    // where each changes that are built on first use. *file is kNoFile if
+    // no file covers the offset.
+    static constexpr uint32_t kNoFile = UINT32_MAX;
+    bool LookupLocation(uint32_t code_offset, uint32_t* file, uint32_t* line);
+
+    // Code range of a function, [codestart, codeend).
+    struct FunctionRange {
+        uint32_t codestart;
+        uint32_t codeend;
+        const char* name;
+    };
+
+    // All functions with debug info, sorted by codestart.
+    const std::vector<FunctionRange>& Functions() const {
+        return functions_;
+    }
+    // Finds the function containing a code offset, or null.
+    const FunctionRange* LookupFunctionRange(uint32_t code_offset) const;
+    // Appends the addresses of the line entries in [codestart, codeend),
+    // which are the function's BREAK instructions (or, in code compiled
+    // with --no-breaks, where the JIT puts its break sites), in address order.
+    void GetLineAddresses(uint32_t codestart, uint32_t codeend,
+                          std::vector<uint32_t>* out) const;
+    // Appends the targets of the direct calls made by the line whose BREAK
+    // is at |cip|, decoding up to the next BREAK or line entry of the function.
+    void GetLineCalls(uint32_t cip, std::vector<uint32_t>* targets) const;
+
+    // One decoded instruction: the code offset of its opcode and its
+    // operand cells, which point into the image.
+    struct Instruction {
+        uint32_t cip;
+        OPCODE op;
+        const cell_t* operands;
+        uint32_t count;
+    };
+    // Appends the instructions in [codestart, codeend). Returns false if
+    // it stopped early at something that doesn't decode.
+    bool DecodeInstructions(uint32_t codestart, uint32_t codeend,
+                            std::vector<Instruction>* out) const;
+    // The assembler name of an opcode, such as "load.s.pri".
+    static const char* OpcodeName(OPCODE op);
+
     // Additional information for interactive debugging.
     class Symbol;
+    // First breakable line of a function, looked up by name. A null file
+    // matches the first function of that name in any file.
     bool GetFunctionAddress(const char* function, const char* file, uint32_t* addr);
     bool GetLineAddress(const uint32_t line, const char* file, uint32_t* addr);
+    // As above, also returning the (zero based) line the address belongs to,
+    // which is the next breakable line if |line| has no code.
+    bool GetLineAddress(const uint32_t line, const char* file, uint32_t* addr,
+                        uint32_t* found_line);
     const char* FindFileByPartialName(const char* partialname);
     bool GetVariable(const char* symname, uint32_t scopeaddr, std::unique_ptr<Symbol>& sym);
+    // As above, also setting [*start, *end] to the code range around
+    // |scopeaddr| in which the name resolves the same way, found or not.
+    bool GetVariable(const char* symname, uint32_t scopeaddr, std::unique_ptr<Symbol>& sym,
+                     uint32_t* start, uint32_t* end);
+    // Local variables, arguments and static locals visible at a code offset,
+    // in symbol table order.
+    void GetLocalVariables(uint32_t scopeaddr, std::vector<Symbol>* out);
+    // Global variables, in symbol table order.
+    void GetGlobalVariables(std::vector<Symbol>* out);
     const char* GetDebugName(uint32_t nameoffs);
     const char* GetFileName(uint32_t index);
     uint32_t GetFileCount();
+    // Whether the lookups above come from a .dbg.index section rather than
+    // tables built at load.
+    bool HasDebugIndex() const {
+        return debug_index_.header != nullptr;
+    }
 
   public:
     const char* GetTagName(uint32_t tag);
 
+    // Default display of a value carrying a tag, derived once from its name.
+    enum class TagKind {
+        Other,
+        Bool,
+        Float
+    };
+    TagKind GetTagKind(uint32_t tag);
+
+    // Heap bytes taken by the lookup tables built from this image, beyond
+    // the image itself. Tables that are built on first use and haven't
+    // been yet count as nothing.
+    struct IndexMemory {
+        size_t symbols;
+        size_t functions;
+        size_t lines;
+        size_t types;
+        size_t total() const {
+            return symbols + functions + lines + types;
+        }
+    };
+    IndexMemory GetIndexMemory();
+
+    // The symbol and line indices behind GetVariable, Get*Variables and
+    // GetLineAddress are built on first use, and can be evicted to save
+    // memory while nobody is looking at the image. The location and
+    // function tables that stack traces need always stay. Safe to call on
+    // any thread; a lookup running during an eviction keeps its own copy.
+    void BuildIndices();
+    // Returns the bytes freed.
+    size_t EvictIndices();
+    // Bytes EvictIndices would free now.
+    size_t EvictableIndexBytes();
+
   public:
     class Symbol
     {
@@ -84,41 +202,39 @@ class SmxV1Image : public FileReader
         Symbol(sp_fdbg_symbol_t* sym, SmxV1Image* image)
          : addr_(sym->addr)
          , tagid_(sym->tagid)
-         , codestart_(sym->codestart)
-         , codeend_(sym->codeend)
          , ident_(sym->ident)
          , vclass_(sym->vclass)
+         , codestart_(sym->codestart)
+         , codeend_(sym->codeend)
          , dimcount_(sym->dimcount)
-         , name_(sym->name)
-         , sym_(sym)
          , type_(VAR_PACKED)
-         , unpacked_sym_(nullptr) {
+         , name_(sym->name)
+         , sym_(sym) {
         }
 
         Symbol(sp_u_fdbg_symbol_t* sym, SmxV1Image* image)
          : addr_(sym->addr)
          , tagid_(sym->tagid)
-         , codestart_(sym->codestart)
-         , codeend_(sym->codeend)
          , ident_(sym->ident)
          , vclass_(sym->vclass)
+         , codestart_(sym->codestart)
+         , codeend_(sym->codeend)
          , dimcount_(sym->dimcount)
-         , name_(sym->name)
          , type_(VAR_UNPACKED)
-         , sym_(nullptr)
-         , unpacked_sym_(sym) {
+         , name_(sym->name)
+         , sym_(sym) {
         }
 
         Symbol(smx_rtti_debug_var* sym, SmxV1Image* image)
          : addr_(sym->address)
+         , tagid_(0)
+         , ident_(sp::IDENT_VARIABLE)
          , codestart_(sym->code_start)
          , codeend_(sym->code_end)
-         , name_(sym->name)
+         , dimcount_(0)
          , type_(VAR_RTTI)
-         , sym_(nullptr)
-         , unpacked_sym_(nullptr)
-         , rtti_sym(sym) {
-            dimcount_ = 0;
+         , name_(sym->name)
+         , sym_(sym) {
             enum {
                 DISP_DEFAULT = 0x10,
                 DISP_STRING = 0x20,
@@ -141,17 +257,14 @@ class SmxV1Image : public FileReader
                 }
                 return (int)value;
             };
-            std::function<void(unsigned char*, int&)> Decode;
-            Decode = [this, DecodeUint32, &Decode](unsigned char* bytes, int& offset) {
-                unsigned char b = bytes[offset++];
-                switch (b) {
-                    case cb::kFixedArray: {
-                        ident_ = IDENT_ARRAY;
-                        DecodeUint32(bytes, offset);
-                        dimcount_++;
-                        Decode(bytes, offset);
-                        break;
-                    }
+            // Each fixed array prefix adds a dimension. This runs for every
+            // iterated symbol, so it is a loop rather than a std::function.
+            auto Decode = [this, DecodeUint32](unsigned char* bytes, int& offset) {
+                while (offset < 4 && bytes[offset] == cb::kFixedArray) {
+                    offset++;
+                    ident_ = IDENT_ARRAY;
+                    DecodeUint32(bytes, offset);
+                    dimcount_++;
                 }
             };
             vclass_ = sym->vclass;
@@ -170,16 +283,14 @@ class SmxV1Image : public FileReader
         Symbol(Symbol* sym)
          : addr_(sym->addr_)
          , tagid_(sym->tagid_)
-         , codestart_(sym->codestart_)
-         , codeend_(sym->codeend_)
          , ident_(sym->ident_)
          , vclass_(sym->vclass_)
+         , codestart_(sym->codestart_)
+         , codeend_(sym->codeend_)
          , dimcount_(sym->dimcount_)
-         , name_(sym->name_)
-         , sym_(sym->sym_)
          , type_(sym->type_)
-         , rtti_sym(sym->rtti_sym)
-         , unpacked_sym_(sym->unpacked_sym_) {
+         , name_(sym->name_)
+         , sym_(sym->sym_) {
         }
 
         const int32_t addr() const {
@@ -206,50 +317,38 @@ class SmxV1Image : public FileReader
         const uint32_t name() const {
             return name_;
         }
+        // Only changes this copy; the image itself may be mapped read-only.
         void setVClass(uint8_t vclass) {
             vclass_ = vclass;
-            if (sym_)
-                sym_->vclass = vclass;
-            else if (unpacked_sym_)
-                unpacked_sym_->vclass = vclass;
-            else
-                rtti_sym->vclass = vclass;
         }
         const bool packed() const {
-            return sym_ != nullptr;
+            return type_ == VAR_PACKED;
         }
         const uint8_t type() const {
             return type_;
         }
         const smx_rtti_debug_var* rtti() const {
-            return rtti_sym;
+            if (type_ != VAR_RTTI)
+                return nullptr;
+            return static_cast<const smx_rtti_debug_var*>(sym_);
         }
         const void* sym() const {
-            if (sym_) {
-                return sym_;
-            }
-            if (sym_) {
-                return unpacked_sym_;
-            }
-            if (rtti_sym) {
-                return rtti_sym;
-            }
+            return sym_;
         }
 
       private:
+        // Ordered to pack: every loaded image keeps one of these per symbol.
         int32_t addr_;       /**< Address rel to DAT or stack frame */
         int16_t tagid_;      /**< Tag id */
-        uint32_t codestart_; /**< Start scope validity in code */
-        uint32_t codeend_;   /**< End scope validity in code */
         uint8_t ident_;      /**< Variable type */
         uint8_t vclass_;     /**< Scope class (local vs global) */
+        uint32_t codestart_; /**< Start scope validity in code */
+        uint32_t codeend_;   /**< End scope validity in code */
         uint16_t dimcount_;  /**< Dimension count (for arrays) */
+        uint8_t type_;       /**< Which record sym_ points to */
         uint32_t name_;      /**< Offset into debug nametable */
-        uint8_t type_;
 
-        sp_fdbg_symbol_t* sym_;
-        sp_u_fdbg_symbol_t* unpacked_sym_;
-        smx_rtti_debug_var* rtti_sym;
+        const void* sym_;
     };
 
     class SymbolIterator
@@ -275,27 +374,28 @@ class SmxV1Image : public FileReader
             { return index_ >= image_->globals_->row_count; }
         }
 
-        Symbol* Next() {
+        // Symbols are small views into the image, returned by value.
+        Symbol Next() {
             if (type_ == 1) {
                 sp_fdbg_symbol_t* sym = reinterpret_cast<sp_fdbg_symbol_t*>(cursor_);
                 if (sym->dimcount > 0)
                     cursor_ += sizeof(sp_fdbg_arraydim_t) * sym->dimcount;
                 cursor_ += sizeof(sp_fdbg_symbol_t);
 
-                return new Symbol(sym, nullptr);
+                return Symbol(sym, nullptr);
             } else if (type_ == 0) {
                 sp_u_fdbg_symbol_t* sym = reinterpret_cast<sp_u_fdbg_symbol_t*>(cursor_);
                 if (sym->dimcount > 0)
                     cursor_ += sizeof(sp_u_fdbg_arraydim_t) * sym->dimcount;
                 cursor_ += sizeof(sp_u_fdbg_symbol_t);
 
-                return new Symbol(sym, nullptr);
+                return Symbol(sym, nullptr);
             } else {
                 const smx_rtti_debug_var* sym = image_->getRttiRow<smx_rtti_debug_var>(
                     (type_ == 2) ? image_->locals_ : image_->globals_, index_);
                 //smx_rtti_debug_var* sym = reinterpret_cast<smx_rtti_debug_var*>(cursor_);
                 index_ += 1;
-                return new Symbol((smx_rtti_debug_var*)sym, image_);
+                return Symbol((smx_rtti_debug_var*)sym, image_);
             }
         }
 
@@ -309,6 +409,29 @@ class SmxV1Image : public FileReader
 
     SymbolIterator symboliterator(bool global = false);
 
+    // Calls |fn| with each symbol symboliterator(global) would return, in
+    // the same order. The table format is picked once, and each loop is
+    // instantiated for one record type, so scans over every symbol don't
+    // branch on the format per symbol.
+    template <typename Func>
+    void forEachSymbol(bool global, Func&& fn) {
+        if (debug_syms_) {
+            forEachLegacySymbol<sp_fdbg_symbol_t, sp_fdbg_arraydim_t>(debug_syms_, fn);
+            return;
+        }
+        if (debug_syms_unpacked_) {
+            forEachLegacySymbol<sp_u_fdbg_symbol_t, sp_u_fdbg_arraydim_t>(debug_syms_unpacked_,
+                                                                          fn);
+            return;
+        }
+        const smx_rtti_table_header* table = global ? globals_ : locals_;
+        if (!table)
+            return;
+        const uint8_t* row = reinterpret_cast<const uint8_t*>(table) + table->header_size;
+        for (uint32_t i = 0; i < table->row_count; i++, row += table->row_size)
+            fn(Symbol((smx_rtti_debug_var*)row, this));
+    }
+
     class ArrayDim
     {
       public:
@@ -322,13 +445,14 @@ class SmxV1Image : public FileReader
          , size_(dim->size) {
         }
         ArrayDim(uint32_t size)
-         : size_(size) {
+         : tagid_(0)
+         , size_(size) {
         }
 
-        int16_t tagid() {
+        int16_t tagid() const {
             return tagid_;
         }
-        uint32_t size() {
+        uint32_t size() const {
             return size_;
         }
 
@@ -337,16 +461,67 @@ class SmxV1Image : public FileReader
         uint32_t size_; /**< Size of dimension */
     };
 
-   std::vector<ArrayDim*>* GetArrayDimensions(const Symbol* sym);
+    // A view of a table owned by the image.
+    template <typename T>
+    class Span
+    {
+      public:
+        Span()
+         : items_(nullptr)
+         , count_(0) {
+        }
+        Span(const T* items, size_t count)
+         : items_(items)
+         , count_(count) {
+        }
+
+        size_t size() const {
+            return count_;
+        }
+        bool empty() const {
+            return count_ == 0;
+        }
+        const T& at(size_t index) const {
+            assert(index < count_);
+            return items_[index];
+        }
+        const T& operator[](size_t index) const {
+            return at(index);
+        }
+        const T* begin() const {
+            return items_;
+        }
+        const T* end() const {
+            return items_ + count_;
+        }
+
+      private:
+        const T* items_;
+        size_t count_;
+    };
+    typedef Span<ArrayDim> ArrayDims;
+
+    // Empty if the symbol is not an array.
+    ArrayDims GetArrayDimensions(const Symbol* sym);
+
+    // A field of an enum struct or classdef, with its name and type resolved.
+    // The type is null if it could not be decoded.
+    struct TypeField {
+        const char* name;
+        const debug::Rtti* type;
+        uint32_t offset; // in bytes; enum struct fields only
+    };
+    typedef Span<TypeField> TypeFields;
+
     bool validateRttiField(uint32_t index);
     size_t getTypeFromTypeId(uint32_t typeId);
-    std::vector<smx_rtti_es_field*> getEnumFields(uint32_t index);
+    // Empty if the type has no valid fields.
+    TypeFields getEnumFields(uint32_t index);
+    // Size in cells of an enum struct, or 0 if there is no such row.
+    uint32_t getEnumStructSize(uint32_t index);
     size_t getTypeSize(uint32_t typeId);
-    std::vector<smx_rtti_field*> getTypeFields(uint32_t typeId);
-    bool validateRttiClassdefs();
-    bool validateRttiEnums();
+    TypeFields getTypeFields(uint32_t index);
     bool validateRttiEnumStructField(const smx_rtti_enumstruct* enumstruct, uint32_t index);
-    bool validateRttiEnumStructs();
 
 private:
     const Section* findSection(const char* name);
@@ -470,14 +645,20 @@ private:
     bool validatePubvars();
     bool validateNatives();
     bool validateDebugInfo();
+    bool validateDebugIndex();
     bool validateTags();
+    void buildArrayDimensions();
+    void buildFunctionIndex();
+    void buildLocationTable();
+    void buildSuffixIndex();
+    bool validateRttiEnumStruct(uint32_t index);
+    bool validateRttiClassdef(uint32_t index);
 
   private:
     template <typename SymbolType, typename DimType>
-    const char* lookupFunction(const SymbolType* syms, uint32_t addr);
-    template <typename SymbolType, typename DimType>
-    bool getFunctionAddress(const SymbolType* syms, const char* name, uint32_t* addr,
-                            uint32_t* index);
+    void addFunctions(const SymbolType* syms);
+    // Index of the first line entry at or after a code offset.
+    size_t lowerLine(uint32_t addr) const;
 
     const smx_rtti_table_header* findRttiSection(const char* name) {
         const Section* section = findSection(name);
@@ -493,8 +674,36 @@ private:
         return reinterpret_cast<const T*>(base + header->row_size * index);
     }
 
+    // Legacy symbols are followed by their array dimensions, so each record
+    // is found from the one before it.
+    template <typename SymbolType, typename DimType, typename Func>
+    void forEachLegacySymbol(const SymbolType* syms, Func& fn) {
+        const uint8_t* cursor = reinterpret_cast<const uint8_t*>(syms);
+        const uint8_t* end = cursor + debug_symbols_section_->size;
+        while (cursor + sizeof(SymbolType) <= end) {
+            SymbolType* sym = (SymbolType*)cursor;
+            cursor += sizeof(SymbolType) + sizeof(DimType) * sym->dimcount;
+            fn(Symbol(sym, nullptr));
+        }
+    }
+
+  private:
+    // Decompresses a compressed image up to |end|, which may be past what
+    // validate() needed. Once the image is complete the stream is freed. If
+    // the stream turns out to be corrupt the rest of the image reads as
+    // zeroes and false is returned.
+    struct Inflater;
+    bool inflateTo(uint32_t end) const;
+
   private:
     sp_file_hdr_t* hdr_;
+    bool decompressed_ = false;
+    uint64_t file_hash_ = 0;
+    // Bytes of a compressed image decompressed so far; everything for any
+    // other image.
+    mutable std::atomic<uint32_t> inflated_;
+    mutable std::mutex inflate_lock_;
+    mutable std::unique_ptr<Inflater> inflater_;
     std::string error_;
     const char* header_strings_;
    std::vector<Section> sections_;
@@ -511,23 +720,116 @@ private:
 
     const Section* debug_names_section_;
     const char* debug_names_;
-    const sp_fdbg_info_t* debug_info_;
+    const sp_fdbg_info_t* debug_info_ = nullptr;
     List<sp_fdbg_file_t> debug_files_;
     List<sp_fdbg_line_t> debug_lines_;
     const Section* debug_symbols_section_;
     const sp_fdbg_symbol_t* debug_syms_;
     const sp_u_fdbg_symbol_t* debug_syms_unpacked_;
 
+    // Tables the compiler precomputed in a .dbg.index section, used in place
+    // of the indices below where present. See smx-v1.h.
+    struct DebugIndex {
+        const sp_fdbg_index_t* header = nullptr;
+        const sp_fdbg_index_function_t* functions;
+        const uint32_t* function_buckets;
+        const uint32_t* function_chain;
+        const sp_fdbg_index_file_t* files;
+        const sp_fdbg_line_t* lines;
+        const uint32_t* name_buckets;
+        const sp_fdbg_index_name_t* names;
+        const sp_fdbg_index_scope_t* scopes;
+    };
+    DebugIndex debug_index_;
+
+    // Name -> symbols, for GetVariable. Scoped entries are sorted by
+    // codestart; the global entry is the first symbol with that name.
+    struct ScopedSymbol {
+        uint32_t codestart;
+        uint32_t codeend;
+        uint32_t index;
+    };
+    struct SymbolIndex {
+        std::vector<Symbol> symbols;
+        std::unordered_map<std::string_view, std::vector<ScopedSymbol>> scoped;
+        std::unordered_map<std::string_view, uint32_t> globals;
+        // Variables (not functions) in symbols, split by scope class.
+        std::vector<uint32_t> local_vars;
+        std::vector<uint32_t> global_vars;
+        size_t bytes = 0;
+    };
+    // Lines of each file name, sorted by line then address, mapped to the
+    // address. A file that appears several times in the file table has all
+    // its ranges merged.
+    struct LineIndex {
+        std::unordered_map<std::string_view, DeltaTable> files;
+        size_t bytes = 0;
+    };
+    // Evictable; lookups take a reference for as long as they read one.
+    std::mutex index_mtx_;
+    std::shared_ptr<const SymbolIndex> symbol_index_;
+    std::shared_ptr<const LineIndex> line_index_;
+    std::shared_ptr<const SymbolIndex> symbolIndex();
+    std::shared_ptr<const LineIndex> lineIndex();
+    std::shared_ptr<const SymbolIndex> buildSymbolIndex();
+    std::shared_ptr<const LineIndex> buildLineIndex();
+
+    // Decoded array dimensions of every array symbol, keyed by the symbol's
+    // entry in the image. Each entry is a range in dim_table_.
+    void decodeArrayDimensions(const Symbol& sym);
+    struct DimRange {
+        uint32_t offset;
+        uint32_t count;
+    };
+    std::vector<ArrayDim> dim_table_;
+    std::unordered_map<const void*, DimRange> dim_ranges_;
+
+    std::vector<FunctionRange> functions_;
+    // Indices into functions_ by name; static functions can repeat a name.
+    std::unordered_map<std::string_view, std::vector<uint32_t>> function_names_;
+
+    struct TagInfo {
+        const char* name;
+        TagKind kind;
+    };
+    std::unordered_map<uint32_t, TagInfo> tag_index_;
+
+    // Code addresses where the file index or the (one based) line changes,
+    // mapped to the new value. A file entry with a bad name maps to kNoFile.
+    std::once_flag locations_built_;
+    DeltaTable file_runs_;
+    DeltaTable line_runs_;
+
+    // Trie of the file names read backwards, so a partial name is resolved
+    // by walking its characters from the end. Each node remembers the first
+    // file table entry below it; node 0 is the root.
+    struct SuffixNode {
+        uint32_t first;
+        std::vector<std::pair<char, uint32_t>> children;
+    };
+    std::once_flag suffix_index_built_;
+    std::vector<SuffixNode> suffix_index_;
+
+    // Fields of each enum struct and classdef row, validated and decoded on
+    // first use so arrays of them don't re-walk the RTTI rows per element.
+    struct TypeCache {
+        std::once_flag validated;
+        bool valid = false;
+        std::vector<TypeField> fields;
+    };
+    std::unique_ptr<TypeCache[]> enum_fields_;
+    std::unique_ptr<TypeCache[]> classdef_fields_;
+
     std::unique_ptr<const debug::RttiData> rtti_data_ = nullptr;
     const smx_rtti_table_header* rtti_fields_ = nullptr;
-    const smx_rtti_table_header* rtti_methods_;
-    const smx_rtti_table_header* rtti_classdefs_;
-    const smx_rtti_table_header* globals_;
-    const smx_rtti_table_header* locals_;
-    const smx_rtti_table_header* methods_;
-    const smx_rtti_table_header* rtti_enums_;
-    const smx_rtti_table_header* rtti_enumstruct_fields_;
-    const smx_rtti_table_header* rtti_enumstructs_;
+    const smx_rtti_table_header* rtti_methods_ = nullptr;
+    const smx_rtti_table_header* rtti_classdefs_ = nullptr;
+    const smx_rtti_table_header* globals_ = nullptr;
+    const smx_rtti_table_header* locals_ = nullptr;
+    const smx_rtti_table_header* methods_ = nullptr;
+    const smx_rtti_table_header* rtti_enums_ = nullptr;
+    const smx_rtti_table_header* rtti_enumstruct_fields_ = nullptr;
+    const smx_rtti_table_header* rtti_enumstructs_ = nullptr;
 };
 
 } // namespace sp
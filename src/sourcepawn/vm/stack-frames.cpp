@@ -205,7 +205,7 @@ JitFrameIterator::cip() const
 
   if (cip_ == kInvalidCip) {
     if (pc_)
-      cip_ = fn->FindCipByPc(pc_);
+      cip_ = method->FindCipByPc(pc_);
     else
       cip_ = function_cip();
   }
@@ -248,6 +248,18 @@ FrameIterator::cip() const
   return frame_cursor_->cip();
 }
 
+cell_t
+FrameIterator::function_cip() const
+{
+  return frame_cursor_->function_cip();
+}
+
+uint32_t
+FrameIterator::native_index() const
+{
+  return frame_cursor_->native_index();
+}
+
 void
 FrameIterator::Next()
 {
@@ -231,6 +231,8 @@ class FrameIterator : public SourcePawn::IFrameIterator
   bool IsInternalFrame() const override;
 
   cell_t cip() const;
+  cell_t function_cip() const;
+  uint32_t native_index() const;
 
  private:
   void nextInvokeFrame();
@@ -0,0 +1,101 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+// 
+// Copyright (C) 2006-2015 AlliedModders LLC
+// 
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#include "threaded-code.h"
+#include "plugin-runtime.h"
+
+namespace sp {
+
+// Instruction sizes, in cells. Opcodes that are never generated are 0.
+static const uint8_t kOpcodeCells[] = {
+#define _G(op, text, cells) cells,
+#define _U(op, text) 0,
+  OPCODE_LIST(_G, _U)
+#undef _U
+#undef _G
+};
+
+std::unique_ptr<ThreadedCode>
+ThreadedCode::Build(PluginRuntime* rt, uint32_t pcode_offset)
+{
+  auto& code = rt->code();
+  const cell_t* base = reinterpret_cast<const cell_t*>(code.bytes);
+  const cell_t* stop = reinterpret_cast<const cell_t*>(code.bytes + code.length);
+  const cell_t* cip = base + (pcode_offset / sizeof(cell_t));
+  assert(OPCODE(*cip) == OP_PROC);
+  cip++;
+
+  std::unique_ptr<ThreadedCode> tc(new ThreadedCode(cip));
+  auto add = [&](const ThreadedInsn& insn) -> void {
+    tc->index_.resize(cip - tc->start_ + 1, kNoInsn);
+    tc->index_.back() = uint32_t(tc->insns_.size());
+    tc->insns_.push_back(insn);
+  };
+
+  while (cip < stop) {
+    OPCODE op = OPCODE(*cip);
+    if (op == OP_PROC || op == OP_ENDPROC)
+      break;
+
+    // The method was verified, so anything unknown is unreachable. It ends
+    // decoding like it would end the interpreter.
+    size_t cells = ucell_t(op) < OPCODES_TOTAL ? kOpcodeCells[op] : 0;
+    if (op == OP_CASETBL && cip + 1 < stop)
+      cells = (cip[1] * 2) + 3;
+    if (!cells || cip + cells > stop) {
+      add(ThreadedInsn{OP_NONE, cip + 1, cip + 1});
+      cip++;
+      break;
+    }
+
+    ThreadedInsn insn{op, cip + 1, cip + cells};
+    if (op == OP_SYSREQ_N) {
+      // Same rule as the reader: only natives that can't be rebound are
+      // replaced.
+      NativeEntry* native = rt->NativeAt(cip[1]);
+      if (native->status == SP_NATIVE_BOUND &&
+          !(native->flags & (SP_NTVFLAG_EPHEMERAL|SP_NTVFLAG_OPTIONAL)))
+      {
+        uint32_t replacement = rt->GetNativeReplacement(cip[1]);
+        if (replacement != OP_NOP)
+          insn.op = OPCODE(replacement);
+      }
+    }
+    add(insn);
+    cip += cells;
+  }
+
+  add(ThreadedInsn{OP_ENDPROC, cip, cip});
+#if !defined(SP_OPCODE_STATS)
+  tc->fuse();
+#endif
+  return tc;
+}
+
+void
+ThreadedCode::fuse()
+{
+  // The terminator is never the first of a pair.
+  for (size_t i = 0; i + 1 < insns_.size(); i++) {
+    uint32_t first = insns_[i].op;
+    uint32_t second = insns_[i + 1].op;
+#define _F(a, b)                                                            \
+    if (first == OP_##a && second == OP_##b) {                              \
+      insns_[i].op = OP_##a##__##b;                                         \
+      continue;                                                             \
+    }
+    FUSED_OPCODE_LIST(_F)
+#undef _F
+  }
+}
+
+} // namespace sp
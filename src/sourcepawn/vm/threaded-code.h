@@ -0,0 +1,101 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+// 
+// Copyright (C) 2006-2015 AlliedModders LLC
+// 
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#ifndef _include_sourcepawn_vm_threaded_code_h_
+#define _include_sourcepawn_vm_threaded_code_h_
+
+#include <assert.h>
+#include <stdint.h>
+#include <sp_vm_types.h>
+#include <smx/smx-v1-opcodes.h>
+#include <memory>
+#include <vector>
+
+namespace sp {
+
+class PluginRuntime;
+
+// Instruction pairs run by one handler. The second instruction keeps its
+// own entry, so branches into it and the cips the debugger sees are the
+// same as without fusion.
+#define FUSED_OPCODE_LIST(_F)                                               \
+  _F(LOAD_S_PRI, PUSH_PRI)                                                  \
+  _F(CONST_PRI, STOR_PRI)                                                   \
+  _F(CONST_PRI, STOR_S_PRI)                                                 \
+  _F(EQ, JZER)                                                              \
+  _F(NEQ, JZER)                                                             \
+  _F(SLESS, JZER)                                                           \
+  _F(SLEQ, JZER)                                                            \
+  _F(SGRTR, JZER)                                                           \
+  _F(SGEQ, JZER)                                                            \
+  _F(EQ_C_PRI, JZER)
+
+// Fused handlers are numbered after the opcodes.
+enum FusedOpcode {
+  OP_FUSED_NONE = OPCODES_LAST,
+#define _F(first, second) OP_##first##__##second,
+  FUSED_OPCODE_LIST(_F)
+#undef _F
+  OP_FUSED_LAST
+};
+
+// A pre-decoded instruction.
+struct ThreadedInsn
+{
+  // Selects the interpreter's handler. This is the instruction's opcode,
+  // except for natives that are replaced by an opcode and for the first
+  // instruction of a fused pair.
+  uint32_t op;
+  // The operands, in the pcode.
+  const cell_t* args;
+  // The pcode following the instruction, where the reader points while the
+  // handler runs.
+  const cell_t* next;
+};
+
+// A method's pcode, decoded once into a stream of handlers for the
+// interpreter. The stream ends with an OP_ENDPROC entry. Branches still
+// target pcode offsets; lookup() finds the instruction at the target.
+// With SP_OPCODE_STATS nothing is fused, so the counts match the pcode.
+class ThreadedCode
+{
+ public:
+  static std::unique_ptr<ThreadedCode> Build(PluginRuntime* rt, uint32_t pcode_offset);
+
+  const ThreadedInsn* insns() const {
+    return insns_.data();
+  }
+
+  const ThreadedInsn* lookup(const cell_t* cip) const {
+    size_t cell = cip - start_;
+    assert(cell < index_.size() && index_[cell] != kNoInsn);
+    return &insns_[index_[cell]];
+  }
+
+ private:
+  ThreadedCode(const cell_t* start)
+   : start_(start)
+  {}
+
+  static const uint32_t kNoInsn = UINT32_MAX;
+
+  const cell_t* start_;
+  std::vector<ThreadedInsn> insns_;
+  // Instruction index by code cell, from the start of the method.
+  std::vector<uint32_t> index_;
+
+  void fuse();
+};
+
+} // namespace sp
+
+#endif // _include_sourcepawn_vm_threaded_code_h_
@@ -246,6 +246,9 @@ struct Operand
   bool isRegister() const {
     return mode() == kModeReg;
   }
+  bool isAbsolute() const {
+    return mode() == kModeDisp0 && rm() == kRIP;
+  }
   bool isRegister(Register r) const {
     return mode() == kModeReg && rm() == r.code;
   }
@@ -357,6 +360,11 @@ class Assembler : public AssemblerBase
       emit1(0xc7, 0, dest);
     writeInt32(imm);
   }
+  void movl(const Operand& dest, const ExternalAddress& address) {
+    movl(dest, int32_t(address.value()));
+    if (!absolute_refs_.append(pc()))
+      outOfMemory_ = true;
+  }
   void movw(const Operand& dest, Register src) {
     emit1(0x89, src.code, dest);
   }
@@ -612,6 +620,11 @@ class Assembler : public AssemblerBase
     emit1(0x68);
     writeInt32(imm);
   }
+  void push(const ExternalAddress& address) {
+    push(int32_t(address.value()));
+    if (!absolute_refs_.append(pc()))
+      outOfMemory_ = true;
+  }
   void push(CodeLabel* src) {
     emit1(0x68);
     if (src->bound()) {
@@ -749,6 +762,11 @@ class Assembler : public AssemblerBase
     emit1(0xe8);
     emitJumpTarget(dest);
   }
+  // nopl 0(%eax,%eax,1) - a single nop the size of a call rel32.
+  void nop5() {
+    emit3(0x0f, 0x1f, 0x44);
+    emit2(0x00, 0x00);
+  }
   void bind(Label* target) {
     if (outOfMemory()) {
       // If we ran out of memory, the code stream is potentially invalid and
@@ -875,6 +893,10 @@ class Assembler : public AssemblerBase
     assert(Features().sse);
     emit3(0xf3, 0x0f, 0x5e, dest.code, src);
   }
+  void sqrtss(FloatRegister dest, const Operand& src) {
+    assert(Features().sse);
+    emit3(0xf3, 0x0f, 0x51, dest.code, src);
+  }
   void xorps(FloatRegister dest, FloatRegister src) {
     assert(Features().sse);
     emit2(0x0f, 0x57, src.code, dest.code);
@@ -902,6 +924,19 @@ class Assembler : public AssemblerBase
     *reinterpret_cast<int32_t*>(ip - 4) = delta;
   }
 
+  // Offsets just past each 32-bit field holding an address: rel32 to
+  // external code, abs32 to external data, and abs32 into this code once
+  // emitted.
+  const ke::Vector<uint32_t>& externalRefs() const {
+    return external_refs_;
+  }
+  const ke::Vector<uint32_t>& absoluteRefs() const {
+    return absolute_refs_;
+  }
+  const ke::Vector<uint32_t>& localRefs() const {
+    return local_refs_;
+  }
+
   void emitToExecutableMemory(void* code) {
     assert(!outOfMemory());
 
@@ -1014,6 +1049,8 @@ class Assembler : public AssemblerBase
     size_t length = operand.length();
     for (size_t i = 1; i < length; i++)
       *pos_++ = operand.getByte(i);
+    if (operand.isAbsolute() && !absolute_refs_.append(pc()))
+      outOfMemory_ = true;
   }
 
   void emit1(uint8_t opcode) {
@@ -1102,6 +1139,7 @@ class Assembler : public AssemblerBase
 
  private:
   ke::Vector<uint32_t> external_refs_;
+  ke::Vector<uint32_t> absolute_refs_;
   ke::Vector<uint32_t> local_refs_;
 };
 
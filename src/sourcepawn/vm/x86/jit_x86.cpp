@@ -32,6 +32,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <algorithm>
+#include <vector>
 #include "jit_x86.h"
 #include "plugin-runtime.h"
 #include "plugin-context.h"
@@ -72,7 +74,10 @@ OpToCondition(CompareOp op)
 }
 
 Compiler::Compiler(PluginRuntime* rt, MethodInfo* method)
- : CompilerBase(rt, method)
+ : CompilerBase(rt, method),
+   watch_data_(debug_instrumented_ && Environment::get()->IsDataWatchEnabled()),
+   trace_functions_(Environment::get()->IsFunctionTracingEnabled()),
+   profile_heap_(Environment::get()->IsHeapProfilingEnabled())
 {
 }
 
@@ -80,6 +85,20 @@ Compiler::~Compiler()
 {
 }
 
+// No exit frame - nothing can fail.
+static void
+InvokeFunctionTrace(PluginContext* cx, uint32_t function, uint32_t event)
+{
+  Environment::get()->TraceFunction(cx, function, event);
+}
+
+// No exit frame - nothing can fail.
+static void
+InvokeHeapProfile(PluginContext* cx, cell_t cip, cell_t old_hp)
+{
+  Environment::get()->ProfileHeapAlloc(cx, cip, old_hp);
+}
+
 // No exit frame - error code is returned directly.
 static int
 InvokePushTracker(PluginContext* cx, uint32_t amount)
@@ -133,6 +152,7 @@ bool
 Compiler::visitZERO(cell_t offset)
 {
   __ movl(Operand(dat, offset), 0);
+  emitDataWatchAt(offset, sizeof(cell_t));
   return true;
 }
 
@@ -146,6 +166,10 @@ Compiler::visitZERO_S(cell_t offset)
 bool
 Compiler::visitPUSH(PawnReg src)
 {
+  // Popped right away; the pop moves the value instead.
+  if (forwarding_.isRedundant(op_cip_))
+    return true;
+
   Register reg = (src == PawnReg::Pri) ? pri : alt;
   __ movl(Operand(stk, -4), reg);
   __ subl(stk, 4);
@@ -257,6 +281,8 @@ Compiler::emitPrologue()
     __ cmpl(ecx, eax);
     jumpOnError(below, SP_ERROR_STACKLOW);
   }
+
+  emitFunctionTrace(SP_TRACE_ENTER);
 }
 
 bool
@@ -388,6 +414,7 @@ bool
 Compiler::visitINC(cell_t offset)
 {
   __ addl(Operand(dat, offset), 1);
+  emitDataWatchAt(offset, sizeof(cell_t));
   return true;
 }
 
@@ -402,6 +429,7 @@ bool
 Compiler::visitINC_I()
 {
   __ addl(Operand(dat, pri, NoScale), 1);
+  emitDataWatch(pri, sizeof(cell_t));
   return true;
 }
 
@@ -417,6 +445,7 @@ bool
 Compiler::visitDEC(cell_t offset)
 {
   __ subl(Operand(dat, offset), 1);
+  emitDataWatchAt(offset, sizeof(cell_t));
   return true;
 }
 
@@ -431,6 +460,7 @@ bool
 Compiler::visitDEC_I()
 {
   __ subl(Operand(dat, pri, NoScale), 1);
+  emitDataWatch(pri, sizeof(cell_t));
   return true;
 }
 
@@ -454,6 +484,12 @@ bool
 Compiler::visitLOAD_S(PawnReg dest, cell_t srcoffs)
 {
   Register reg = (dest == PawnReg::Pri) ? pri : alt;
+  if (forwarding_.isRedundant(op_cip_))
+    return true;
+  if (forwarding_.isForwarded(op_cip_)) {
+    __ movl(reg, (reg == pri) ? alt : pri);
+    return true;
+  }
   __ movl(reg, Operand(frm, srcoffs));
   return true;
 }
@@ -497,6 +533,7 @@ Compiler::visitSTOR(cell_t offset, PawnReg src)
 {
   Register reg = (src == PawnReg::Pri) ? pri : alt;
   __ movl(Operand(dat, offset), reg);
+  emitDataWatchAt(offset, sizeof(cell_t));
   return true;
 }
 
@@ -521,6 +558,7 @@ Compiler::visitSREF_S(cell_t offset, PawnReg src)
   Register reg = (src == PawnReg::Pri) ? pri : alt;
   __ movl(tmp, Operand(frm, offset));
   __ movl(Operand(dat, tmp, NoScale), reg);
+  emitDataWatch(tmp, sizeof(cell_t));
   return true;
 }
 
@@ -528,6 +566,12 @@ bool
 Compiler::visitPOP(PawnReg dest)
 {
   Register reg = (dest == PawnReg::Pri) ? pri : alt;
+  if (forwarding_.isRedundant(op_cip_))
+    return true;
+  if (forwarding_.isForwarded(op_cip_)) {
+    __ movl(reg, (reg == pri) ? alt : pri);
+    return true;
+  }
   __ movl(reg, Operand(stk, 0));
   __ addl(stk, 4);
   return true;
@@ -555,6 +599,7 @@ bool
 Compiler::visitCONST(cell_t offset, cell_t value)
 {
   __ movl(Operand(dat, offset), value);
+  emitDataWatchAt(offset, sizeof(cell_t));
   return true;
 }
 
@@ -578,6 +623,7 @@ Compiler::visitSTOR_I()
 {
   emitCheckAddress(alt);
   __ movl(Operand(dat, alt, NoScale), pri);
+  emitDataWatch(alt, sizeof(cell_t));
   return true;
 }
 
@@ -632,12 +678,15 @@ Compiler::visitSTRB_I(cell_t width)
     __ movw(Operand(dat, alt, NoScale), pri);
   else if (width == 4)
     __ movl(Operand(dat, alt, NoScale), pri);
+  emitDataWatch(alt, width);
   return true;
 }
 
 bool
 Compiler::visitRETN()
 {
+  emitFunctionTrace(SP_TRACE_EXIT);
+
   // Restore the old stack and frame pointer.
   __ movl(stk, frm);
   __ movl(frm, Operand(stk, 4));              // get the old frm
@@ -678,6 +727,7 @@ Compiler::visitMOVS(uint32_t amount)
   }
   __ pop(edi);
   __ pop(esi);
+  emitDataWatch(alt, amount);
   return true;
 }
   
@@ -693,6 +743,7 @@ Compiler::visitFILL(uint32_t amount)
   __ cld();
   __ rep_stosd();
   __ pop(edi);
+  emitDataWatch(alt, amount);
   return true;
 }
 
@@ -995,6 +1046,9 @@ Compiler::visitHEAP(cell_t amount)
     __ lea(tmp, Operand(dat, ecx, NoScale, STACK_MARGIN));
     __ cmpl(tmp, stk);
     jumpOnError(above, SP_ERROR_HEAPLOW);
+
+    if (amount > 0)
+      emitHeapProfile(alt);
   }
   return true;
 }
@@ -1080,7 +1134,7 @@ Compiler::visitTRACKER_PUSH_C(cell_t amount)
   __ push(alt);
 
   __ push(amount);
-  __ push(intptr_t(rt_->GetBaseContext()));
+  __ push(ExternalAddress(rt_->GetBaseContext()));
   __ callWithABI(ExternalAddress((void*)InvokePushTracker));
   __ addl(esp, 8);
   __ testl(eax, eax);
@@ -1100,7 +1154,7 @@ Compiler::visitTRACKER_POP_SETHEAP()
   __ push(alt);
 
   // Get the context pointer and call the sanity checker.
-  __ push(intptr_t(rt_->GetBaseContext()));
+  __ push(ExternalAddress(rt_->GetBaseContext()));
   __ callWithABI(ExternalAddress((void*)InvokePopTrackerAndSetHeap));
   __ addl(esp, 4);
   __ testl(eax, eax);
@@ -1125,7 +1179,7 @@ Compiler::visitREBASE(cell_t addr, cell_t iv_size, cell_t data_size)
   __ push(iv_size);
   __ push(addr);
   __ push(pri);
-  __ push(intptr_t(rt_->GetBaseContext()));
+  __ push(ExternalAddress(rt_->GetBaseContext()));
   __ callWithABI(ExternalAddress((void*)InvokeRebaseArray));
   __ addl(esp, 8 * sizeof(intptr_t));
   __ testl(eax, eax);
@@ -1136,9 +1190,18 @@ Compiler::visitREBASE(cell_t addr, cell_t iv_size, cell_t data_size)
 bool
 Compiler::visitBREAK()
 {
-  if (!Environment::get()->IsDebugBreakEnabled())
+  if (!debug_instrumented_)
     return true;
 
+  if (Environment::get()->IsDebugBreakPatchable()) {
+    // Leave room for a call to the debug break thunk. The runtime swaps it
+    // in only while a breakpoint or step trap is armed at this cip.
+    __ nop5();
+    break_sites_.append(BreakSite(masm.pc(), op_cip_));
+    emitCipMapping(op_cip_);
+    return true;
+  }
+
   __ call(&debug_break_);
   emitCipMapping(op_cip_);
   return true;
@@ -1156,6 +1219,10 @@ Compiler::visitHALT(cell_t value)
 bool
 Compiler::visitBOUNDS(uint32_t limit)
 {
+  // An earlier check in this method already covers this one.
+  if (bounds_.isRedundant(op_cip_))
+    return true;
+
   OutOfBoundsErrorPath* bounds = new OutOfBoundsErrorPath(op_cip_, limit);
   if (!ool_paths_.append(bounds)) {
     reportError(SP_ERROR_OUT_OF_MEMORY);
@@ -1184,6 +1251,111 @@ Compiler::emitCheckAddress(Register reg)
   __ bind(&done);
 }
 
+void
+Compiler::emitDataWatch(Register addr, ucell_t size)
+{
+  if (!watch_data_)
+    return;
+
+  // Test the store against the hull of the watched ranges; the exact ranges
+  // are only checked once it hits. Clobbers tmp, which block stores don't
+  // pass their address in.
+  assert(addr != tmp || size <= sizeof(cell_t));
+  Operand base = Operand(ExternalAddress(rt_->addressOfDataWatchBase()));
+  Operand span = Operand(ExternalAddress(rt_->addressOfDataWatchSpan()));
+
+  Label hit, done;
+  if (addr != tmp)
+    __ movl(tmp, addr);
+  __ subl(tmp, base);
+  __ cmpl(tmp, span);
+  if (size <= sizeof(cell_t)) {
+    __ j(above_equal, &done);
+  } else {
+    // A block store may also cover the whole window.
+    __ j(below, &hit);
+    __ movl(tmp, base);
+    __ subl(tmp, addr);
+    __ cmpl(tmp, int32_t(size));
+    __ j(above_equal, &done);
+  }
+
+  __ bind(&hit);
+  if (addr == tmp)
+    __ addl(tmp, base);
+  else
+    __ movl(tmp, addr);
+  __ movl(Operand(ExternalAddress(rt_->addressOfDataWatchStoreSize())), int32_t(size));
+  __ call(&data_watch_);
+  emitCipMapping(op_cip_);
+  __ bind(&done);
+}
+
+void
+Compiler::emitDataWatchAt(cell_t addr, ucell_t size)
+{
+  if (!watch_data_)
+    return;
+
+  __ movl(tmp, addr);
+  emitDataWatch(tmp, size);
+}
+
+void
+Compiler::emitFunctionTrace(uint32_t event)
+{
+  if (!trace_functions_)
+    return;
+
+  Label done;
+  __ cmpb(Operand(ExternalAddress(env_->addressOfTraceActive())), 0);
+  __ j(equal, &done);
+
+  // Save registers; pri holds the return value at a RETN.
+  __ subl(esp, 12);
+  __ push(pri);
+  __ push(alt);
+
+  __ push(event);
+  __ push(pcode_start_);
+  __ push(ExternalAddress(rt_->GetBaseContext()));
+  __ callWithABI(ExternalAddress((void*)InvokeFunctionTrace));
+  __ addl(esp, 12);
+
+  __ pop(alt);
+  __ pop(pri);
+  __ addl(esp, 12);
+  __ bind(&done);
+}
+
+void
+Compiler::emitHeapProfile(Register old_hp)
+{
+  if (!profile_heap_)
+    return;
+
+  Label done;
+  __ cmpb(Operand(ExternalAddress(env_->addressOfHeapSamplingActive())), 0);
+  __ j(equal, &done);
+
+  // Save registers.
+  __ subl(esp, 12);
+  __ push(pri);
+  __ push(alt);
+
+  cell_t cip = cell_t(uintptr_t(op_cip_) - uintptr_t(rt_->code().bytes));
+  __ push(old_hp);
+  __ push(cip);
+  __ push(ExternalAddress(rt_->GetBaseContext()));
+  __ callWithABI(ExternalAddress((void*)InvokeHeapProfile));
+  __ addl(esp, 12);
+
+  __ pop(alt);
+  __ pop(pri);
+  __ addl(esp, 12);
+  __ bind(&done);
+}
+
 bool
 Compiler::visitGENARRAY(uint32_t dims, bool autozero)
 {
@@ -1203,7 +1375,7 @@ Compiler::visitGENARRAY(uint32_t dims, bool autozero)
     __ shll(tmp, 2);
     __ subl(esp, 8);
     __ push(tmp);
-    __ push(intptr_t(rt_->GetBaseContext()));
+    __ push(ExternalAddress(rt_->GetBaseContext()));
     __ callWithABI(ExternalAddress((void*)InvokePushTracker));
     __ movl(tmp, Operand(esp, 4));
     __ addl(esp, 16);
@@ -1231,7 +1403,7 @@ Compiler::visitGENARRAY(uint32_t dims, bool autozero)
     __ push(autozero ? 1 : 0);
     __ push(stk);
     __ push(dims);
-    __ push(intptr_t(context_));
+    __ push(ExternalAddress(context_));
     __ callWithABI(ExternalAddress((void*)InvokeGenerateFullArray));
     __ addl(esp, 4 * sizeof(void*) + 12);
 
@@ -1245,6 +1417,12 @@ Compiler::visitGENARRAY(uint32_t dims, bool autozero)
     __ movl(pri, tmp);
     __ addl(stk, (dims - 1) * 4);
   }
+
+  // The array's address is where the heap was.
+  if (profile_heap_) {
+    __ movl(tmp, Operand(stk, 0));
+    emitHeapProfile(tmp);
+  }
   return true;
 }
 
@@ -1267,12 +1445,14 @@ class CallThunk : public OutOfLinePath
 bool
 Compiler::visitCALL(cell_t offset)
 {
-  RefPtr<MethodInfo> method = rt_->GetMethod(offset);
-  if (!method || !method->jit()) {
+  // Cached code can't refer to other methods' code, so with a code cache
+  // every call starts out as a thunk and is patched on first use.
+  RefPtr<MethodInfo> method = env_->codeCache() ? nullptr : rt_->GetMethod(offset);
+  if (!method || !method->jit() || method->stale()) {
     // Need to emit a delayed thunk.
     CallThunk* thunk = new CallThunk(offset);
     __ callWithABI(thunk->label());
-    if (!ool_paths_.append(thunk)) {
+    if (!ool_paths_.append(thunk) || !thunk_calls_.append(ThunkCall(masm.pc(), offset))) {
       reportError(SP_ERROR_OUT_OF_MEMORY);
       return false;
     }
@@ -1308,7 +1488,7 @@ Compiler::emitCallThunk(CallThunk* thunk)
   __ lea(edx, Operand(esp, 4 * sizeof(void*)));
   __ movl(Operand(esp, 2 * sizeof(void*)), edx);
   __ movl(Operand(esp, 1 * sizeof(void*)), intptr_t(thunk->pcode_offset));
-  __ movl(Operand(esp, 0 * sizeof(void*)), intptr_t(context_));
+  __ movl(Operand(esp, 0 * sizeof(void*)), ExternalAddress(context_));
 
   __ callWithABI(ExternalAddress((void*)CompileFromThunk));
   __ movl(edx, Operand(esp, 4 * sizeof(void*)));
@@ -1325,14 +1505,92 @@ Compiler::visitSYSREQ_N(uint32_t native_index, uint32_t nparams)
 {
   NativeEntry* native = rt_->NativeAt(native_index);
 
+  // An inlined native still calls out for what the inline code can't do.
+  Label call, done;
+  bool inlined = emitNativeIntrinsic(native_index, native, nparams, &call);
+  if (inlined) {
+    __ addl(stk, nparams * sizeof(cell_t));
+    __ jmp(&done);
+    __ bind(&call);
+  }
+
   // Store the number of parameters on the stack.
   __ movl(Operand(stk, -4), nparams);
   __ subl(stk, 4);
   emitLegacyNativeCall(native_index, native);
   __ addl(stk, (nparams + 1) * sizeof(cell_t));
+
+  if (inlined)
+    __ bind(&done);
   return true;
 }
 
+// Leaves the native's result in pri, without popping its arguments, or
+// jumps to |fallback| to have the native called.
+bool
+Compiler::emitNativeIntrinsic(uint32_t native_index, NativeEntry* native, uint32_t nparams,
+                              Label* fallback)
+{
+  // Only natives nothing can swap out from under the code.
+  if (native->status != SP_NATIVE_BOUND ||
+      (native->flags & (SP_NTVFLAG_EPHEMERAL|SP_NTVFLAG_OPTIONAL)) ||
+      env_->IsNativeRebindingEnabled())
+  {
+    return false;
+  }
+
+  switch (rt_->GetNativeIntrinsic(native_index)) {
+    case NativeIntrinsic::SquareRoot:
+    {
+      if (nparams != 1 || !MacroAssembler::Features().sse2)
+        return false;
+
+      // The native reports negative arguments as an error; those with the
+      // sign bit set, -0.0 included, are left to it.
+      __ movl(pri, Operand(stk, 0));
+      __ testl(pri, pri);
+      __ j(negative, fallback);
+      __ sqrtss(xmm0, Operand(stk, 0));
+      __ movd(pri, xmm0);
+      return true;
+    }
+
+    case NativeIntrinsic::StrLen:
+    {
+      if (nparams != 1)
+        return false;
+
+      // Addresses the native would refuse are left to it.
+      Label valid;
+      __ movl(pri, Operand(stk, 0));
+      __ cmpl(pri, context_->HeapSize());
+      __ j(not_below, fallback);
+      __ cmpl(pri, Operand(hpAddr()));
+      __ j(below, &valid);
+      __ lea(tmp, Operand(dat, pri, NoScale));
+      __ cmpl(tmp, stk);
+      __ j(below, fallback);
+      __ bind(&valid);
+
+      Label loop, found;
+      __ lea(tmp, Operand(dat, pri, NoScale));
+      __ movl(pri, tmp);
+      __ bind(&loop);
+      __ cmpb(Operand(tmp, 0), 0);
+      __ j(equal, &found);
+      __ addl(tmp, 1);
+      __ jmp(&loop);
+      __ bind(&found);
+      __ subl(tmp, pri);
+      __ movl(pri, tmp);
+      return true;
+    }
+
+    default:
+      return false;
+  }
+}
+
 bool
 Compiler::visitSYSREQ_C(uint32_t native_index)
 {
@@ -1351,7 +1609,8 @@ Compiler::emitLegacyNativeCall(uint32_t native_index, NativeEntry* native)
 
   // Check whether the native is bound.
   bool immutable = native->status == SP_NATIVE_BOUND &&
-                   !(native->flags & (SP_NTVFLAG_EPHEMERAL|SP_NTVFLAG_OPTIONAL));
+                   !(native->flags & (SP_NTVFLAG_EPHEMERAL|SP_NTVFLAG_OPTIONAL)) &&
+                   !env_->IsNativeRebindingEnabled();
   if (!immutable) {
     __ movl(edx, Operand(ExternalAddress(&native->legacy_fn)));
     __ testl(edx, edx);
@@ -1370,7 +1629,7 @@ Compiler::emitLegacyNativeCall(uint32_t native_index, NativeEntry* native)
   __ movl(Operand(spAddr()), stk);
 
   // Push the first parameter, the context.
-  __ push(intptr_t(rt_->GetBaseContext()));
+  __ push(ExternalAddress(rt_->GetBaseContext()));
 
   // Invoke the native.
   if (immutable)
@@ -1426,62 +1685,93 @@ Compiler::visitSWITCH(cell_t defaultOffset,
     return true;
   }
 
-  // We have two or more cases, so let's generate a full switch. Decide
-  // whether we'll make an if chain, or a jump table, based on whether
-  // the numbers are strictly sequential.
-  bool sequential = true;
+  // Both lowerings want the cases in order. The first of two cases with the
+  // same value is the one that matches, as in the bytecode.
+  std::vector<SwitchCase> sorted;
+  sorted.reserve(ncases);
+  for (size_t i = 0; i < ncases; i++)
+    sorted.push_back(SwitchCase{cases[i].value, block_->successors()[i + 1]});
+  auto by_value = [](const SwitchCase& a, const SwitchCase& b) -> bool {
+    return a.value < b.value;
+  };
+  auto same_value = [](const SwitchCase& a, const SwitchCase& b) -> bool {
+    return a.value == b.value;
+  };
+  std::stable_sort(sorted.begin(), sorted.end(), by_value);
+  sorted.erase(std::unique(sorted.begin(), sorted.end(), same_value), sorted.end());
+
+  // A table when the cases fill enough of their range, since its cost
+  // doesn't grow with them; otherwise a compare tree, which takes log2(n)
+  // compares to find any case.
+  ucell_t range = ucell_t(sorted.back().value) - ucell_t(sorted.front().value);
+  if (sorted.size() > kSwitchChainLength &&
+      range < kMaxSwitchTableSize &&
+      range / kSwitchTableSpread < sorted.size())
   {
-    cell_t first = cases[0].value;
-    cell_t last = first;
-    for (size_t i = 1; i < ncases; i++) {
-      if (cases[i].value != ++last) {
-        sequential = false;
-        break;
-      }
-    }
+    emitSwitchTable(sorted.data(), sorted.size(), defaultCase);
+  } else {
+    emitSwitchTree(sorted.data(), sorted.size(), defaultCase);
   }
+  return true;
+}
 
-  // First check whether the bounds are correct: if (a < LOW || a > HIGH);
-  // this check is valid whether or not we emit a sequential-optimized switch.
+// |cases| are sorted and distinct. Slots between cases go to the default.
+void
+Compiler::emitSwitchTable(const SwitchCase* cases, size_t ncases, Block* defaultCase)
+{
+  // Rebase the value so the lowest case is 0, then one unsigned compare
+  // catches values on either side of the table.
   cell_t low = cases[0].value;
-  if (low != 0) {
-    // negate it so we'll get a lower bound of 0.
-    low = -low;
-    __ lea(tmp, Operand(pri, low));
-  } else {
+  ucell_t range = ucell_t(cases[ncases - 1].value) - ucell_t(low);
+  if (low != 0)
+    __ lea(tmp, Operand(pri, cell_t(0 - ucell_t(low))));
+  else
     __ movl(tmp, pri);
-  }
-
-  cell_t high = abs(cases[0].value - cases[ncases - 1].value);
-  __ cmpl(tmp, high);
+  __ cmpl(tmp, cell_t(range));
   __ j(above, defaultCase->label());
 
-  if (sequential) {
-    // Optimized table version. The tomfoolery below is because we only have
-    // one free register... it seems unlikely pri or alt will be used given
-    // that we're at the end of a control-flow point, but we'll play it safe.
-    CodeLabel table;
-    __ push(eax);
-    __ movl(eax, &table);
-    __ movl(ecx, Operand(eax, ecx, ScaleFour));
-    __ pop(eax);
-    __ jmp(ecx);
+  // The tomfoolery below is because we only have one free register... it
+  // seems unlikely pri or alt will be used given that we're at the end of a
+  // control-flow point, but we'll play it safe.
+  CodeLabel table;
+  __ push(eax);
+  __ movl(eax, &table);
+  __ movl(ecx, Operand(eax, ecx, ScaleFour));
+  __ pop(eax);
+  __ jmp(ecx);
+
+  __ bind(&table);
+  size_t next = 0;
+  for (ucell_t slot = 0; slot <= range; slot++) {
+    Block* target = defaultCase;
+    if (next < ncases && ucell_t(cases[next].value) - ucell_t(low) == slot)
+      target = cases[next++].target;
+    __ emit_absolute_address(target->label());
+  }
+}
 
-    __ bind(&table);
-    for (size_t i = 0; i < ncases; i++) {
-      Block* target = block_->successors()[i + 1];
-      __ emit_absolute_address(target->label());
-    }
-  } else {
-    // Slower version. Go through each case and generate a check.
+// |cases| are sorted and distinct.
+void
+Compiler::emitSwitchTree(const SwitchCase* cases, size_t ncases, Block* defaultCase)
+{
+  // Short runs are cheaper compared in turn than split again.
+  if (ncases <= kSwitchChainLength) {
     for (size_t i = 0; i < ncases; i++) {
-      Block* target = block_->successors()[i + 1];
       __ cmpl(pri, cases[i].value);
-      __ j(equal, target->label());
+      __ j(equal, cases[i].target->label());
     }
     __ jmp(defaultCase->label());
+    return;
   }
-  return true;
+
+  size_t mid = ncases / 2;
+  Label lower;
+  __ cmpl(pri, cases[mid].value);
+  __ j(equal, cases[mid].target->label());
+  __ j(less, &lower);
+  emitSwitchTree(cases + mid + 1, ncases - mid - 1, defaultCase);
+  __ bind(&lower);
+  emitSwitchTree(cases, mid, defaultCase);
 }
 
 void
@@ -1656,7 +1946,7 @@ Compiler::emitDebugBreakHandler()
 
   // Get the context pointer and call the debugging break handler.
   __ movl(Operand(esp, 1 * sizeof(void *)), 0); // IErrorReport*
-  __ movl(Operand(esp, 0 * sizeof(void *)), intptr_t(rt_->GetBaseContext()));
+  __ movl(Operand(esp, 0 * sizeof(void *)), ExternalAddress(rt_->GetBaseContext()));
   __ call(ExternalAddress((void *)InvokeDebugger));
   __ leaveExitFrame();
   __ testl(eax, eax);
@@ -1664,6 +1954,56 @@ Compiler::emitDebugBreakHandler()
   __ ret();
 }
 
+// The store size was left in the runtime by the call site.
+static int
+InvokeDataWatchFromJit(PluginContext* cx, ucell_t addr)
+{
+  return InvokeDataWatch(cx, addr, cx->runtime()->dataWatchStoreSize());
+}
+
+void
+Compiler::emitDataWatchHandler()
+{
+  if (!data_watch_.used())
+    return;
+
+  // Common path for stores that hit the data watch window. The address is
+  // in tmp, and pri and alt may still be live.
+  __ bind(&data_watch_);
+
+  // Enter the exit frame. This aligns the stack.
+  __ enterExitFrame(ExitFrameType::Helper, 0);
+
+  // Allocate room for the arguments and the saved registers.
+  static const size_t kStackNeeded = 4 * sizeof(void *);
+  static const size_t kStackReserve = ke::Align(kStackNeeded, 16);
+  __ subl(esp, kStackReserve);
+  __ movl(Operand(esp, 3 * sizeof(void *)), alt);
+  __ movl(Operand(esp, 2 * sizeof(void *)), pri);
+  __ movl(Operand(esp, 1 * sizeof(void *)), tmp);
+  __ movl(Operand(esp, 0 * sizeof(void *)), ExternalAddress(rt_->GetBaseContext()));
+
+  // Get and store the current stack pointer.
+  __ movl(tmp, stk);
+  __ subl(tmp, dat);
+  __ movl(Operand(spAddr()), tmp);
+
+  __ call(ExternalAddress((void *)InvokeDataWatchFromJit));
+  __ movl(tmp, eax);
+  __ movl(pri, Operand(esp, 2 * sizeof(void *)));
+  __ movl(alt, Operand(esp, 3 * sizeof(void *)));
+  __ leaveExitFrame();
+
+  // The error path expects the error code in eax; mov keeps the flags.
+  Label resume;
+  __ testl(tmp, tmp);
+  __ j(zero, &resume);
+  __ movl(eax, tmp);
+  jumpOnError(not_zero);
+  __ bind(&resume);
+  __ ret();
+}
+
 void
 CompilerBase::PatchCallThunk(uint8_t* pc, void* target)
 {
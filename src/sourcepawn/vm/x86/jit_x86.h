@@ -140,17 +140,38 @@ class Compiler : public CompilerBase
  private:
   bool setup(cell_t pcode_offs);
 
+  // A SWITCH case and the block it jumps to.
+  struct SwitchCase {
+    cell_t value;
+    Block* target;
+  };
+  // Up to this many cases are compared in turn.
+  static const size_t kSwitchChainLength = 4;
+  // The largest jump table, in slots, and the most slots it may spend per
+  // case.
+  static const ucell_t kMaxSwitchTableSize = 4096;
+  static const ucell_t kSwitchTableSpread = 4;
+
  private:
   void emitPrologue() override;
   void emitThrowPath(int err) override;
   void emitErrorHandlers() override;
   void emitOutOfBoundsErrorPath(OutOfBoundsErrorPath* path) override;
   void emitDebugBreakHandler() override;
+  void emitDataWatchHandler() override;
 
   void emitLegacyNativeCall(uint32_t native_index, NativeEntry* native);
+  bool emitNativeIntrinsic(uint32_t native_index, NativeEntry* native, uint32_t nparams,
+                           Label* fallback);
   void emitGenArray(bool autozero);
   void emitCheckAddress(Register reg);
+  void emitDataWatch(Register addr, ucell_t size);
+  void emitDataWatchAt(cell_t addr, ucell_t size);
+  void emitFunctionTrace(uint32_t event);
+  void emitHeapProfile(Register old_hp);
   void emitFloatCmp(ConditionCode cc);
+  void emitSwitchTable(const SwitchCase* cases, size_t ncases, Block* defaultCase);
+  void emitSwitchTree(const SwitchCase* cases, size_t ncases, Block* defaultCase);
   void emitCallThunk(CallThunk* thunk);
   void jumpOnError(ConditionCode cc, int err = 0);
 
@@ -163,6 +184,14 @@ class Compiler : public CompilerBase
   ExternalAddress spAddr() {
     return ExternalAddress(context_->addressOfSp());
   }
+
+ private:
+  // Whether stores are checked against the runtime's data watch window.
+  bool watch_data_;
+  // Whether functions record their entry and exit into the trace ring.
+  bool trace_functions_;
+  // Whether heap allocations call the heap profiler's hook.
+  bool profile_heap_;
 };
 
 const Register pri = eax;
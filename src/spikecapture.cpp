@@ -0,0 +1,102 @@
+#include "spikecapture.h"
+#include "functiontrace.h"
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <fmt/format.h>
+
+SpikeCapture DebugSpikes;
+
+static uint64_t steadyNs(std::chrono::steady_clock::time_point when) {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(when.time_since_epoch()).count();
+}
+
+bool SpikeCapture::enable(const std::string& dir, uint32_t frame_ms, uint32_t public_ms,
+	uint32_t window_ms) {
+	if (dir.empty() || (!frame_ms && !public_ms) || !DebugTrace.available())
+		return false;
+	std::error_code ec;
+	std::filesystem::create_directories(dir, ec);
+	DebugTrace.keepRecording();
+	directory = dir;
+	frame_threshold = uint64_t(frame_ms) * 1000000;
+	public_threshold = uint64_t(public_ms) * 1000000;
+	window = uint64_t(window_ms ? window_ms : 500) * 1000000;
+	return true;
+}
+
+void SpikeCapture::endFrame() {
+	if (!frame_threshold)
+		return;
+	auto now = std::chrono::steady_clock::now();
+	auto previous = last_frame;
+	last_frame = now;
+	if (previous.time_since_epoch().count() == 0)
+		return;
+	uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - previous).count();
+	if (elapsed > frame_threshold)
+		capture("server frame", elapsed);
+}
+
+void SpikeCapture::addPlugin(SourcePawn::IPluginContext* ctx) {
+	if (!active())
+		return;
+	TraceFileHeader::plugin_s plugin = {};
+	plugin.context = uint64_t(uintptr_t(ctx));
+	plugin.loaded = steadyNs(std::chrono::steady_clock::now());
+	const char* path = ctx->GetRuntime()->GetFilename();
+	strncpy(plugin.path, path ? path : "", sizeof(plugin.path) - 1);
+	plugins.push_back(plugin);
+}
+
+void SpikeCapture::removePlugin(SourcePawn::IPluginContext* ctx) {
+	plugins.erase(std::remove_if(plugins.begin(), plugins.end(),
+		[ctx](const TraceFileHeader::plugin_s& plugin) {
+			return plugin.context == uint64_t(uintptr_t(ctx));
+		}), plugins.end());
+}
+
+void SpikeCapture::capture(const std::string& what, uint64_t nanoseconds) {
+	auto now = std::chrono::steady_clock::now();
+	if (last_capture.time_since_epoch().count() != 0 && now - last_capture < kMinInterval)
+		return;
+	last_capture = now;
+
+	// At least the whole spike, if the ring still holds it.
+	uint64_t span = std::max(window, nanoseconds);
+	auto records = DebugTrace.recent(steadyNs(now) - std::min(span, steadyNs(now)));
+	if (records.empty())
+		return;
+
+	auto header = std::make_unique<TraceFileHeader>();
+	memset(header.get(), 0, sizeof(TraceFileHeader));
+	header->magic = TRACE_FILE_MAGIC;
+	header->version = TRACE_FILE_VERSION;
+	header->record_size = sizeof(SourcePawn::sp_trace_record_t);
+	header->capacity = uint32_t(records.size());
+	size_t listed = std::min<size_t>(plugins.size(), TRACE_FILE_PLUGINS);
+	std::copy(plugins.end() - listed, plugins.end(), header->plugins);
+	header->plugin_count = uint32_t(listed);
+
+	auto path = std::filesystem::path(directory) /
+		fmt::format("spike-{}-{}ms.sptrace", (int64_t)time(nullptr), nanoseconds / 1000000);
+	fmt::print("[SM_DEBUGGER] {} took {:.1f} ms; the last {} ms of calls go to {}\n", what,
+		nanoseconds / 1e6, span / 1000000, path.string());
+
+	if (writer.joinable())
+		writer.join();
+	writer = std::thread([path, header = std::move(header), records = std::move(records)]() {
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		out.write(reinterpret_cast<const char*>(header.get()), sizeof(TraceFileHeader));
+		out.write(reinterpret_cast<const char*>(records.data()),
+			records.size() * sizeof(SourcePawn::sp_trace_record_t));
+	});
+}
+
+void SpikeCapture::shutdown() {
+	if (writer.joinable())
+		writer.join();
+}
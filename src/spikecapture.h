@@ -0,0 +1,68 @@
+#ifndef _INCLUDE_SPIKECAPTURE_H_
+#define _INCLUDE_SPIKECAPTURE_H_
+
+#include <sp_vm_api.h>
+#include "tracefile.h"
+#include <stdint.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+//
+//  Keeps the function trace ring recording and, when a server frame or a
+//  single public function call runs longer than its threshold, writes the
+//  calls of the last few hundred milliseconds to a trace file in the format
+//  of DebuggerTraceFile, which sm_debugger_trace_export reads. Copying the
+//  records is all the game thread does; the file is written on a thread of
+//  its own. At most one capture per kMinInterval, so a slow stretch leaves
+//  its first spike rather than a file per frame.
+//
+class SpikeCapture {
+public:
+	static constexpr std::chrono::seconds kMinInterval{ 10 };
+
+	// Writes captures into |directory|, for frames over |frame_ms| and
+	// public calls over |public_ms|, 0 being off. Needs the trace ring,
+	// which it keeps recording. Before any plugins are loaded.
+	bool enable(const std::string& directory, uint32_t frame_ms, uint32_t public_ms,
+		uint32_t window_ms);
+
+	bool active() const {
+		return !directory.empty();
+	}
+
+	// Times the frame since the previous call. Main thread only.
+	void endFrame();
+
+	// Checks a call into a plugin timed at the invoker. Main thread only.
+	void invoked(SourcePawn::IPluginFunction* fn, uint64_t nanoseconds) {
+		if (public_threshold && nanoseconds > public_threshold)
+			capture(fn->DebugName(), nanoseconds);
+	}
+
+	// Lists a plugin in the trace files from now on. Main thread only.
+	void addPlugin(SourcePawn::IPluginContext* ctx);
+
+	// Forgets an unloading plugin. Main thread only.
+	void removePlugin(SourcePawn::IPluginContext* ctx);
+
+	// Waits for the file being written, if any. Main thread only.
+	void shutdown();
+
+private:
+	void capture(const std::string& what, uint64_t nanoseconds);
+
+	std::string directory;
+	uint64_t frame_threshold = 0;	// nanoseconds
+	uint64_t public_threshold = 0;
+	uint64_t window = 0;
+	std::chrono::steady_clock::time_point last_frame;
+	std::chrono::steady_clock::time_point last_capture;
+	std::vector<TraceFileHeader::plugin_s> plugins;
+	std::thread writer;
+};
+
+extern SpikeCapture DebugSpikes;
+
+#endif //_INCLUDE_SPIKECAPTURE_H_
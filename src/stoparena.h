@@ -0,0 +1,54 @@
+#ifndef _INCLUDE_STOPARENA_H_
+#define _INCLUDE_STOPARENA_H_
+
+#include <stddef.h>
+#include <memory>
+#include <memory_resource>
+
+//
+//  Memory for what a client keeps for one stop and drops at the next, like
+//  its child handles. Allocation bumps a pointer through a first block kept
+//  for the client's lifetime, then through blocks from the heap; nothing is
+//  freed until reset(), which hands the extra blocks back and starts over in
+//  the first one. Single threaded, like the stop it belongs to.
+//
+class StopArena : public std::pmr::memory_resource {
+public:
+	explicit StopArena(size_t first_block)
+		: first_(new char[first_block]),
+		  resource_(first_.get(), first_block, std::pmr::new_delete_resource()) {
+	}
+
+	StopArena(const StopArena&) = delete;
+	StopArena& operator=(const StopArena&) = delete;
+
+	// Everything allocated from the arena must be gone by now.
+	void reset() {
+		resource_.release();
+		used_ = 0;
+	}
+
+	// Bytes handed out since the last reset.
+	size_t used() const {
+		return used_;
+	}
+
+private:
+	void* do_allocate(size_t bytes, size_t alignment) override {
+		used_ += bytes;
+		return resource_.allocate(bytes, alignment);
+	}
+
+	void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+		return this == &other;
+	}
+
+	std::unique_ptr<char[]> first_;
+	std::pmr::monotonic_buffer_resource resource_;
+	size_t used_ = 0;
+};
+
+#endif //_INCLUDE_STOPARENA_H_
@@ -0,0 +1,214 @@
+//
+//  Converts a trace file written with DebuggerTraceFile into the Chrome
+//  trace event format, which chrome://tracing and Perfetto open. Functions
+//  are named through the plugins the file lists, read from the paths they
+//  were loaded from; debug breaks show as instant events at their line.
+//
+//  usage: sm_debugger_trace_export trace.sptrace > trace.json
+//
+#include "tracefile.h"
+#include "smx-v1-image.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using SourcePawn::sp_trace_record_t;
+
+// A read-only view of a whole file.
+class MappedFile {
+public:
+	~MappedFile() {
+#ifdef _WIN32
+		if (base)
+			UnmapViewOfFile(base);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+#else
+		if (base)
+			munmap((void*)base, size);
+#endif
+	}
+
+	bool open(const char* path) {
+#ifdef _WIN32
+		// The server may still be recording into it.
+		file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+			OPEN_EXISTING, 0, nullptr);
+		LARGE_INTEGER length;
+		if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &length) || !length.QuadPart)
+			return false;
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping)
+			return false;
+		base = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		size = size_t(length.QuadPart);
+#else
+		int fd = ::open(path, O_RDONLY);
+		struct stat st;
+		if (fd < 0 || fstat(fd, &st) != 0 || !st.st_size) {
+			if (fd >= 0)
+				close(fd);
+			return false;
+		}
+		void* view = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (view == MAP_FAILED)
+			return false;
+		base = (const char*)view;
+		size = size_t(st.st_size);
+#endif
+		return base != nullptr;
+	}
+
+	const char* base = nullptr;
+	size_t size = 0;
+
+private:
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+};
+
+static void write_json_string(std::string& out, const char* str) {
+	out += '"';
+	for (; *str; str++) {
+		unsigned char c = *str;
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		}
+		else if (c < 0x20) {
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			out += escaped;
+		}
+		else {
+			out += c;
+		}
+	}
+	out += '"';
+}
+
+struct Plugin {
+	std::string name;
+	uint64_t loaded;
+	// Null if the plugin couldn't be read.
+	std::shared_ptr<sp::SmxV1Image> image;
+};
+
+int main(int argc, char** argv) {
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s trace.sptrace > trace.json\n", argv[0]);
+		return 1;
+	}
+
+	MappedFile file;
+	if (!file.open(argv[1]) || file.size < sizeof(TraceFileHeader)) {
+		fprintf(stderr, "%s: not a trace file\n", argv[1]);
+		return 1;
+	}
+	auto header = reinterpret_cast<const TraceFileHeader*>(file.base);
+	if (header->magic != TRACE_FILE_MAGIC || header->version != TRACE_FILE_VERSION) {
+		fprintf(stderr, "%s: not a trace file\n", argv[1]);
+		return 1;
+	}
+	if (header->record_size != sizeof(sp_trace_record_t) ||
+		(file.size - sizeof(TraceFileHeader)) / sizeof(sp_trace_record_t) < header->capacity) {
+		fprintf(stderr, "%s: records don't match this build\n", argv[1]);
+		return 1;
+	}
+
+	// Each context's plugins, oldest first; contexts can be reused.
+	std::unordered_map<uint64_t, std::vector<Plugin>> plugins;
+	std::unordered_map<std::string, std::shared_ptr<sp::SmxV1Image>> images;
+	std::unordered_map<std::string, bool> readable;
+	uint32_t listed = std::min<uint32_t>(header->plugin_count, TRACE_FILE_PLUGINS);
+	for (uint32_t i = header->plugin_count - listed; i != header->plugin_count; i++) {
+		const auto& entry = header->plugins[i % TRACE_FILE_PLUGINS];
+		std::string path(entry.path, strnlen(entry.path, sizeof(entry.path)));
+		auto& image = images[path];
+		if (!readable.count(path)) {
+			image = std::make_shared<sp::SmxV1Image>(path.c_str());
+			readable[path] = image->validate(false);
+			if (!readable[path]) {
+				fprintf(stderr, "warning: %s: %s\n", path.c_str(), image->errorMessage());
+				image = nullptr;
+			}
+		}
+		auto slash = path.find_last_of("/\\");
+		plugins[entry.context].push_back({ slash == std::string::npos ? path : path.substr(slash + 1),
+			entry.loaded, image });
+	}
+
+	auto first = reinterpret_cast<const sp_trace_record_t*>(header + 1);
+	std::vector<sp_trace_record_t> records;
+	for (uint32_t i = 0; i < header->capacity; i++) {
+		if (first[i].timestamp)
+			records.push_back(first[i]);
+	}
+	std::stable_sort(records.begin(), records.end(),
+		[](const sp_trace_record_t& a, const sp_trace_record_t& b) {
+			return a.timestamp < b.timestamp;
+		});
+
+	std::string out = "{\"traceEvents\":[";
+	for (size_t i = 0; i < records.size(); i++) {
+		const auto& record = records[i];
+		const Plugin* plugin = nullptr;
+		auto found = plugins.find(uint64_t(uintptr_t(record.context)));
+		if (found != plugins.end()) {
+			for (const auto& candidate : found->second) {
+				if (candidate.loaded <= record.timestamp || !plugin)
+					plugin = &candidate;
+			}
+		}
+		auto image = plugin ? plugin->image.get() : nullptr;
+
+		std::string name = plugin ? plugin->name : "?";
+		const char* ph = record.event == SP_TRACE_ENTER ? "B" : "E";
+		if (record.event == SP_TRACE_BREAK) {
+			ph = "i";
+			uint32_t line = 0;
+			const char* path = image ? image->LookupFile(record.function) : nullptr;
+			if (path && image->LookupLine(record.function, &line))
+				name += std::string(" ") + path + ":" + std::to_string(line);
+			else
+				name += " break " + std::to_string(record.function);
+		}
+		else {
+			const char* function = image ? image->LookupFunction(record.function) : nullptr;
+			char address[16];
+			snprintf(address, sizeof(address), "%#x", record.function);
+			name += "::";
+			name += function ? function : address;
+		}
+
+		if (i)
+			out += ',';
+		out += "{\"name\":";
+		write_json_string(out, name.c_str());
+		char fields[96];
+		snprintf(fields, sizeof(fields), ",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":1%s}", ph,
+			record.timestamp / 1000.0, *ph == 'i' ? ",\"s\":\"t\"" : "");
+		out += fields;
+	}
+	out += "]}\n";
+	fwrite(out.data(), 1, out.size(), stdout);
+	return 0;
+}
@@ -0,0 +1,81 @@
+#include "tracefile.h"
+#include <chrono>
+#include <string.h>
+#include <fmt/format.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+TraceFile DebugTraceFile;
+
+bool TraceFile::open(SourcePawn::ISourcePawnEnvironment* env, const std::string& path, uint32_t capacity) {
+#if SOURCEPAWN_API_VERSION >= 0x021F
+	if (header_ || !capacity || capacity > (1u << 24) || env->ApiVersion() < 0x021F)
+		return false;
+	uint32_t size = 1;
+	while (size < capacity)
+		size <<= 1;
+	size_t length = sizeof(TraceFileHeader) + size_t(size) * sizeof(SourcePawn::sp_trace_record_t);
+
+	// The mapping is never unmapped; the VM records into it until exit.
+	void* base = nullptr;
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+		nullptr, CREATE_ALWAYS, 0, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, 0, DWORD(length), nullptr);
+	CloseHandle(file);
+	if (!mapping)
+		return false;
+	base = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, length);
+	CloseHandle(mapping);
+#else
+	int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return false;
+	if (ftruncate(fd, off_t(length)) == 0) {
+		base = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (base == MAP_FAILED)
+			base = nullptr;
+	}
+	close(fd);
+#endif
+	if (!base) {
+		fmt::print("Debugger: could not map trace file {}\n", path);
+		return false;
+	}
+
+	// A new file reads as zeros, so only the header is filled in.
+	auto header = static_cast<TraceFileHeader*>(base);
+	header->magic = TRACE_FILE_MAGIC;
+	header->version = TRACE_FILE_VERSION;
+	header->record_size = sizeof(SourcePawn::sp_trace_record_t);
+	header->capacity = size;
+	auto records = reinterpret_cast<SourcePawn::sp_trace_record_t*>(header + 1);
+	if (!env->EnableFunctionTracingInto(records, size))
+		return false;
+	header_ = header;
+	return true;
+#else
+	return false;
+#endif
+}
+
+void TraceFile::addPlugin(SourcePawn::IPluginContext* ctx) {
+	if (!header_)
+		return;
+	auto& entry = header_->plugins[header_->plugin_count % TRACE_FILE_PLUGINS];
+	entry.context = uint64_t(uintptr_t(ctx));
+	entry.loaded = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+	const char* path = ctx->GetRuntime()->GetFilename();
+	strncpy(entry.path, path ? path : "", sizeof(entry.path) - 1);
+	entry.path[sizeof(entry.path) - 1] = '\0';
+	header_->plugin_count++;
+}
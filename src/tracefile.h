@@ -0,0 +1,61 @@
+#ifndef _INCLUDE_TRACEFILE_H_
+#define _INCLUDE_TRACEFILE_H_
+
+#include <sp_vm_api.h>
+#include <stdint.h>
+#include <string>
+
+#define TRACE_FILE_MAGIC 0x52545053	// "SPTR"
+#define TRACE_FILE_VERSION 1
+#define TRACE_FILE_PLUGINS 128
+
+//
+//  A trace file: the VM's function trace ring, kept in a shared mapping of
+//  a file instead of process memory, so what the last seconds of a crashed
+//  server ran is on disk without anything being written out. The header is
+//  followed by |capacity| sp_trace_record_t of |record_size| bytes each:
+//
+//    entries and exits, |function| being the code address of the function,
+//    and debug breaks, |function| being the cip of the break.
+//
+//  The ring's head stays in the VM, so readers order records by timestamp
+//  and skip zero ones. Contexts are named through the plugin table, whose
+//  entries are reused oldest first once it's full; a context's entry is the
+//  latest one loaded before a record.
+//
+struct TraceFileHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t capacity;
+	// Plugins ever added; entry i is at plugins[i % TRACE_FILE_PLUGINS].
+	uint32_t plugin_count;
+	uint32_t reserved;
+	struct plugin_s {
+		uint64_t context;
+		// Same clock as the records.
+		uint64_t loaded;
+		char path[240];
+	} plugins[TRACE_FILE_PLUGINS];
+};
+
+class TraceFile {
+public:
+	// Creates |path| with room for at least |capacity| records, and hands
+	// the mapping to the VM to record into. Before any plugins are loaded.
+	bool open(SourcePawn::ISourcePawnEnvironment* env, const std::string& path, uint32_t capacity);
+
+	bool active() const {
+		return header_ != nullptr;
+	}
+
+	// Lists a plugin in the table. Main thread only.
+	void addPlugin(SourcePawn::IPluginContext* ctx);
+
+private:
+	TraceFileHeader* header_ = nullptr;
+};
+
+extern TraceFile DebugTraceFile;
+
+#endif //_INCLUDE_TRACEFILE_H_
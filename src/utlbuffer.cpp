@@ -151,6 +151,29 @@ void CUtlBuffer::GetString(char* pString, int nMaxLen)
 }
 
 
+//-----------------------------------------------------------------------------
+// Reads a length prefixed string without copying it
+//-----------------------------------------------------------------------------
+std::string_view CUtlBuffer::GetStringView()
+{
+	// Like GetString, the string ends at its zero whatever the length says.
+	GetInt();
+	if (!IsValid())
+		return "";
+
+	int remaining = m_Memory.NumAllocated() - m_Get;
+	const char* pString = (const char*)PeekGet();
+	const char* pEnd = remaining > 0 ? (const char*)memchr(pString, 0, remaining) : nullptr;
+	if (!pEnd)
+	{
+		m_Error |= GET_OVERFLOW;
+		return "";
+	}
+	m_Get += (int)(pEnd - pString) + 1;
+	return std::string_view(pString, pEnd - pString);
+}
+
+
 //-----------------------------------------------------------------------------
 // Checks if a get is ok
 //-----------------------------------------------------------------------------
@@ -245,7 +268,7 @@ int CUtlBuffer::VaScanf(char const* pFmt, va_list list)
 				*i = strtol((char*)PeekGet(), &pEnd, 10);
 				if (pEnd == PeekGet())
 					return numScanned;
-				m_Get = (int)pEnd - (int)Base();
+				m_Get = (int)(pEnd - (char*)Base());
 			}
 				break;
 
@@ -255,7 +278,7 @@ int CUtlBuffer::VaScanf(char const* pFmt, va_list list)
 				*i = strtol((char*)PeekGet(), &pEnd, 16);
 				if (pEnd == PeekGet())
 					return numScanned;
-				m_Get = (int)pEnd - (int)Base();
+				m_Get = (int)(pEnd - (char*)Base());
 			}
 				break;
 
@@ -265,7 +288,7 @@ int CUtlBuffer::VaScanf(char const* pFmt, va_list list)
 				*u = strtoul((char*)PeekGet(), &pEnd, 10);
 				if (pEnd == PeekGet())
 					return numScanned;
-				m_Get = (int)pEnd - (int)Base();
+				m_Get = (int)(pEnd - (char*)Base());
 			}
 				break;
 
@@ -275,7 +298,7 @@ int CUtlBuffer::VaScanf(char const* pFmt, va_list list)
 				*f = (float)strtod((char*)PeekGet(), &pEnd);
 				if (pEnd == PeekGet())
 					return numScanned;
-				m_Get = (int)pEnd - (int)Base();
+				m_Get = (int)(pEnd - (char*)Base());
 			}
 				break;
 
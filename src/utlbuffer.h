@@ -22,6 +22,7 @@
 #include <limits.h>
 #include <stdarg.h>
 #include <cstdint>
+#include <string_view>
 
 //-----------------------------------------------------------------------------
 // Command parsing..
@@ -58,9 +59,16 @@ public:
 	int				GetInt();
 	int				GetIntHex();
 	unsigned int	GetUnsignedInt();
+	uint64_t		GetUnsignedInt64();
 	float			GetFloat();
 	double			GetDouble();
 	void			GetString(char* pString, int nMaxLen = 0);
+	// Binary mode only: a protocol string, [int len][chars], parsed in place.
+	// The view points into the buffer and stops at the string's terminating
+	// zero, so data() is also a C string. The length is not trusted; a string
+	// with no zero before the end of the buffer reads as "" and marks the
+	// buffer invalid.
+	std::string_view	GetStringView();
 	void			Get(void* pMem, int size);
 
 	// Just like scanf, but doesn't work in binary mode
@@ -236,6 +244,13 @@ inline unsigned int CUtlBuffer::GetUnsignedInt()
 	return u;
 }
 
+inline uint64_t CUtlBuffer::GetUnsignedInt64()
+{
+	uint64_t u;
+	GET_TYPE(uint64_t, u, "%llu");
+	return u;
+}
+
 inline float CUtlBuffer::GetFloat()
 {
 	float f;
@@ -0,0 +1,70 @@
+#include "workerpool.h"
+#include <algorithm>
+
+WorkerPool DebugWorkers(8);
+
+WorkerPool::WorkerPool(size_t max_threads) {
+	// The caller works too, and the game server keeps a core.
+	size_t cores = std::thread::hardware_concurrency();
+	threads_wanted = std::min(max_threads, cores > 2 ? cores - 2 : 0);
+}
+
+size_t WorkerPool::parts(size_t items, size_t min_items) const {
+	if (!threads_wanted || items < 2 * min_items)
+		return 1;
+	return std::min(threads_wanted + 1, items / min_items);
+}
+
+void WorkerPool::run(size_t parts, const std::function<void(size_t)>& fn) {
+	std::unique_lock<std::mutex> lock(mtx);
+	// Another caller's job has the threads; this one runs on its caller.
+	if (stopping || parts <= 1 || job) {
+		lock.unlock();
+		for (size_t i = 0; i < parts; i++)
+			fn(i);
+		return;
+	}
+	while (threads.size() < threads_wanted)
+		threads.emplace_back(&WorkerPool::work, this);
+	job = &fn;
+	next = 0;
+	total = parts;
+	finished = 0;
+	wake.notify_all();
+	runParts(lock);
+	done.wait(lock, [this] { return finished == total; });
+	job = nullptr;
+}
+
+void WorkerPool::runParts(std::unique_lock<std::mutex>& lock) {
+	while (job && next < total) {
+		size_t part = next++;
+		auto fn = job;
+		lock.unlock();
+		(*fn)(part);
+		lock.lock();
+		if (++finished == total)
+			done.notify_one();
+	}
+}
+
+void WorkerPool::work() {
+	std::unique_lock<std::mutex> lock(mtx);
+	while (true) {
+		wake.wait(lock, [this] { return stopping || (job && next < total); });
+		if (stopping)
+			return;
+		runParts(lock);
+	}
+}
+
+void WorkerPool::shutdown() {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (auto& thread : threads)
+		thread.join();
+	threads.clear();
+}
@@ -0,0 +1,54 @@
+#ifndef _INCLUDE_WORKERPOOL_H_
+#define _INCLUDE_WORKERPOOL_H_
+
+#include <stddef.h>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+//  A few threads that split one job at a time into numbered parts, for
+//  work done while the game thread is stopped and nothing else runs, like
+//  formatting a large scope. The threads start on the first job that
+//  needs them.
+//
+class WorkerPool {
+public:
+	// At most |max_threads| besides the caller, fewer on smaller hosts.
+	explicit WorkerPool(size_t max_threads);
+
+	// How many parts |items| split into, each of at least |min_items|;
+	// 1 means run them on the caller.
+	size_t parts(size_t items, size_t min_items) const;
+
+	// Runs |fn(part)| for every part below |parts| on the workers and the
+	// calling thread, and returns once all have. While another caller's
+	// job is running, the parts run one after another on the caller.
+	void run(size_t parts, const std::function<void(size_t)>& fn);
+
+	// Stops and joins the threads.
+	void shutdown();
+
+private:
+	void work();
+	// Runs parts of the current job until none are left. Holds |lock|
+	// except while running one.
+	void runParts(std::unique_lock<std::mutex>& lock);
+
+	size_t threads_wanted;
+	std::mutex mtx;
+	std::condition_variable wake;
+	std::condition_variable done;
+	std::vector<std::thread> threads;
+	const std::function<void(size_t)>* job = nullptr;
+	size_t next = 0;
+	size_t total = 0;
+	size_t finished = 0;
+	bool stopping = false;
+};
+
+extern WorkerPool DebugWorkers;
+
+#endif //_INCLUDE_WORKERPOOL_H_